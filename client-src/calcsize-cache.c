@@ -0,0 +1,476 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+#include "amanda.h"
+#include "amutil.h"
+#include "stat-time.h"
+#include "calcsize-cache.h"
+
+/*
+ * File layout: a cache_header_t, then the directory records.  Each record is
+ * a cache_record_t, the '\0'-terminated path, the calc_cache_file_t of the
+ * files and the '\0'-terminated names of the files then of the
+ * subdirectories, each part padded to 8 bytes so that the whole file can be
+ * used in place once read.
+ */
+
+#define CACHE_MAGIC	"AMCSCAC2"
+#define CACHE_BYTEORDER	0x01020304
+
+#define PAD8(n)		(((n) + 7) & ~(gsize)7)
+
+typedef struct cache_header_s {
+    char    magic[8];
+    guint32 byteorder;
+    guint32 pad;
+    guint64 excl_hash;
+    guint64 n_records;
+} cache_header_t;
+
+typedef struct cache_record_s {
+    guint64 dev;
+    guint64 ino;
+    gint64  mtime_ns;
+    gint64  ctime_ns;
+    gint64  scanned;	/* when the directory was read; 0 if never valid */
+    guint32 path_len;	/* without the '\0' */
+    guint32 n_other;
+    guint32 n_files;
+    guint32 n_subdirs;
+    guint32 names_len;	/* with the '\0's */
+    guint32 pad;
+} cache_record_t;
+
+typedef struct cache_worker_s {
+    GByteArray *out;	/* records of the new cache */
+    guint64 n_records;
+    guint64 hits;
+    guint64 misses;
+
+    /* the directory being recorded */
+    cache_record_t rec;
+    GString *path;
+    GArray  *files;
+    GString *file_names;
+    GString *names;	/* of the subdirectories */
+} cache_worker_t;
+
+struct calc_cache_s {
+    char       *filename;
+    guint64     excl_hash;
+    time_t      start;
+    gint64      max_age;	/* in seconds */
+
+    char       *buf;		/* the old cache */
+    GHashTable *dirs;		/* path -> cache_record_t * in buf */
+
+    int             nworkers;
+    cache_worker_t *workers;
+};
+
+static gint64
+time_ns(
+    struct timespec ts)
+{
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static gsize
+record_size(
+    const cache_record_t *rec)
+{
+    return sizeof(cache_record_t) + PAD8((gsize)rec->path_len + 1) +
+	   (gsize)rec->n_files * sizeof(calc_cache_file_t) +
+	   PAD8((gsize)rec->names_len);
+}
+
+static gboolean
+load_cache(
+    calc_cache_t *cache)
+{
+    cache_header_t *hdr;
+    struct stat finfo;
+    gsize len, pos;
+    guint64 i;
+    int fd;
+
+    fd = open(cache->filename, O_RDONLY);
+    if (fd == -1) {
+	if (errno != ENOENT)
+	    g_debug("estimate cache: can't open %s: %s", cache->filename,
+		    strerror(errno));
+	return FALSE;
+    }
+    if (fstat(fd, &finfo) == -1) {
+	g_debug("estimate cache: can't stat %s: %s", cache->filename,
+		strerror(errno));
+	close(fd);
+	return FALSE;
+    }
+    len = finfo.st_size;
+    cache->buf = g_malloc(len + 1);
+    errno = 0;
+    if (full_read(fd, cache->buf, len) != len) {
+	g_debug("estimate cache: can't read %s: %s", cache->filename,
+		errno ? strerror(errno) : _("short read"));
+	close(fd);
+	return FALSE;
+    }
+    close(fd);
+
+    hdr = (cache_header_t *)cache->buf;
+    if (len < sizeof(*hdr) ||
+	memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	hdr->byteorder != CACHE_BYTEORDER) {
+	g_debug("estimate cache: %s is not an estimate cache file",
+		cache->filename);
+	return FALSE;
+    }
+    if (hdr->excl_hash != cache->excl_hash) {
+	g_debug("estimate cache: the exclusion changed, not using %s",
+		cache->filename);
+	return FALSE;
+    }
+
+    pos = sizeof(*hdr);
+    for (i = 0; i < hdr->n_records; i++) {
+	cache_record_t *rec = (cache_record_t *)(cache->buf + pos);
+	char *path, *names;
+	gsize size;
+	guint32 j, n;
+
+	if (len - pos < sizeof(*rec) ||
+	    (size = record_size(rec)) > len - pos)
+	    goto corrupt;
+	path = (char *)(rec + 1);
+	names = path + PAD8((gsize)rec->path_len + 1) +
+		(gsize)rec->n_files * sizeof(calc_cache_file_t);
+	if (path[rec->path_len] != '\0' ||
+	    (rec->names_len > 0 && names[rec->names_len - 1] != '\0'))
+	    goto corrupt;
+	for (n = 0, j = 0; j < rec->names_len; j++) {
+	    if (names[j] == '\0')
+		n++;
+	}
+	if (n != rec->n_files + rec->n_subdirs)
+	    goto corrupt;
+	g_hash_table_insert(cache->dirs, path, rec);
+	pos += size;
+    }
+    return TRUE;
+
+corrupt:
+    g_debug("estimate cache: %s is corrupted", cache->filename);
+    g_hash_table_remove_all(cache->dirs);
+    return FALSE;
+}
+
+calc_cache_t *
+calc_cache_new(
+    const char *filename,
+    guint64     excl_hash,
+    int         max_days,
+    int         nworkers)
+{
+    calc_cache_t *cache = g_new0(calc_cache_t, 1);
+    int i;
+
+    cache->filename = g_strdup(filename);
+    cache->excl_hash = excl_hash;
+    cache->start = time(NULL);
+    cache->max_age = (gint64)max_days * 24 * 60 * 60;
+    cache->dirs = g_hash_table_new(g_str_hash, g_str_equal);
+    cache->nworkers = nworkers;
+    cache->workers = g_new0(cache_worker_t, nworkers);
+    for (i = 0; i < nworkers; i++) {
+	cache_worker_t *w = &cache->workers[i];
+
+	w->out = g_byte_array_new();
+	w->path = g_string_new(NULL);
+	w->files = g_array_new(FALSE, FALSE, sizeof(calc_cache_file_t));
+	w->file_names = g_string_new(NULL);
+	w->names = g_string_new(NULL);
+    }
+
+    if (!load_cache(cache)) {
+	amfree(cache->buf);
+    }
+    g_debug("estimate cache: %u directories in %s",
+	    g_hash_table_size(cache->dirs), filename);
+
+    return cache;
+}
+
+/* Directories are read again after between half and all of max_age,
+ * depending on their path, so that they don't all expire on the same run. */
+static gboolean
+is_fresh(
+    calc_cache_t         *cache,
+    const char           *relpath,
+    const cache_record_t *rec)
+{
+    double spread = (g_str_hash(relpath) % 1024) / 1024.0;
+
+    if (rec->scanned == 0)
+	return FALSE;
+    return (cache->start - rec->scanned) <
+	   (gint64)(cache->max_age * (0.5 + 0.5 * spread));
+}
+
+gboolean
+calc_cache_lookup(
+    calc_cache_t     *cache,
+    const char       *relpath,
+    struct stat      *dinfo,
+    calc_cache_dir_t *dir)
+{
+    cache_record_t *rec = g_hash_table_lookup(cache->dirs, relpath);
+    const char *path;
+    const char *name;
+    guint32 n;
+
+    if (!rec ||
+	rec->dev != (guint64)dinfo->st_dev ||
+	rec->ino != (guint64)dinfo->st_ino ||
+	rec->mtime_ns != time_ns(get_stat_mtime(dinfo)) ||
+	rec->ctime_ns != time_ns(get_stat_ctime(dinfo)) ||
+	!is_fresh(cache, relpath, rec)) {
+	return FALSE;
+    }
+
+    path = (const char *)(rec + 1);
+    dir->n_other = rec->n_other;
+    dir->n_files = rec->n_files;
+    dir->n_subdirs = rec->n_subdirs;
+    dir->files = (const calc_cache_file_t *)(path +
+					     PAD8((gsize)rec->path_len + 1));
+    dir->file_names = (const char *)(dir->files + rec->n_files);
+    for (n = 0, name = dir->file_names; n < rec->n_files; n++)
+	name += strlen(name) + 1;
+    dir->subdirs = name;
+    dir->scanned = rec->scanned;
+    return TRUE;
+}
+
+void
+calc_cache_begin(
+    calc_cache_t           *cache,
+    int                     worker,
+    const char             *relpath,
+    struct stat            *dinfo,
+    const calc_cache_dir_t *dir)
+{
+    cache_worker_t *w = &cache->workers[worker];
+
+    memset(&w->rec, 0, sizeof(w->rec));
+    w->rec.dev = dinfo->st_dev;
+    w->rec.ino = dinfo->st_ino;
+    w->rec.mtime_ns = time_ns(get_stat_mtime(dinfo));
+    w->rec.ctime_ns = time_ns(get_stat_ctime(dinfo));
+
+    if (dir) {
+	w->rec.scanned = dir->scanned;
+	w->hits++;
+    } else if (dinfo->st_mtime >= cache->start - 1 ||
+	       dinfo->st_ctime >= cache->start - 1) {
+	/* a change in the same timestamp tick as the read would go
+	 * unnoticed, so a directory changed since just before the run is
+	 * never reused */
+	w->rec.scanned = 0;
+	w->misses++;
+    } else {
+	w->rec.scanned = cache->start;
+	w->misses++;
+    }
+
+    g_string_assign(w->path, relpath);
+    g_array_set_size(w->files, 0);
+    g_string_truncate(w->file_names, 0);
+    g_string_truncate(w->names, 0);
+}
+
+void
+calc_cache_add_file(
+    calc_cache_t *cache,
+    int           worker,
+    const char   *name,
+    struct stat  *finfo,
+    guint64       blocks,
+    gboolean      excluded)
+{
+    cache_worker_t *w = &cache->workers[worker];
+    calc_cache_file_t f;
+
+    f.ctime = finfo->st_ctime;
+    f.blocks = blocks;
+    if (excluded)
+	f.blocks |= CALC_CACHE_EXCLUDED;
+    g_array_append_val(w->files, f);
+    /* keep the '\0' */
+    g_string_append_len(w->file_names, name, strlen(name) + 1);
+    w->rec.n_files++;
+}
+
+void
+calc_cache_add_other(
+    calc_cache_t *cache,
+    int           worker)
+{
+    cache->workers[worker].rec.n_other++;
+}
+
+void
+calc_cache_add_subdir(
+    calc_cache_t *cache,
+    int           worker,
+    const char   *name)
+{
+    cache_worker_t *w = &cache->workers[worker];
+
+    /* keep the '\0' */
+    g_string_append_len(w->names, name, strlen(name) + 1);
+    w->rec.n_subdirs++;
+}
+
+void
+calc_cache_end(
+    calc_cache_t *cache,
+    int           worker)
+{
+    cache_worker_t *w = &cache->workers[worker];
+    static const guint8 zeros[8];
+
+    w->rec.path_len = w->path->len;
+    w->rec.names_len = w->file_names->len + w->names->len;
+
+    g_byte_array_append(w->out, (guint8 *)&w->rec, sizeof(w->rec));
+    g_byte_array_append(w->out, (guint8 *)w->path->str, w->path->len + 1);
+    g_byte_array_append(w->out, zeros,
+			PAD8(w->path->len + 1) - (w->path->len + 1));
+    g_byte_array_append(w->out, (guint8 *)w->files->data,
+			w->files->len * sizeof(calc_cache_file_t));
+    g_byte_array_append(w->out, (guint8 *)w->file_names->str,
+			w->file_names->len);
+    g_byte_array_append(w->out, (guint8 *)w->names->str, w->names->len);
+    g_byte_array_append(w->out, zeros,
+			PAD8(w->rec.names_len) - w->rec.names_len);
+    w->n_records++;
+}
+
+gboolean
+calc_cache_write(
+    calc_cache_t  *cache,
+    char         **errmsg)
+{
+    cache_header_t hdr;
+    char *tmpname;
+    int fd, i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.byteorder = CACHE_BYTEORDER;
+    hdr.excl_hash = cache->excl_hash;
+    for (i = 0; i < cache->nworkers; i++)
+	hdr.n_records += cache->workers[i].n_records;
+
+    tmpname = g_strdup_printf("%s.%ld.tmp", cache->filename, (long)getpid());
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+	*errmsg = g_strdup_printf(_("can't create %s: %s"), tmpname,
+				  strerror(errno));
+	g_free(tmpname);
+	return FALSE;
+    }
+
+    if (full_write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+	goto write_error;
+    for (i = 0; i < cache->nworkers; i++) {
+	GByteArray *out = cache->workers[i].out;
+
+	if (full_write(fd, out->data, out->len) != out->len)
+	    goto write_error;
+    }
+    if (close(fd) == -1) {
+	fd = -1;
+	goto write_error;
+    }
+
+    if (rename(tmpname, cache->filename) == -1) {
+	*errmsg = g_strdup_printf(_("can't rename %s to %s: %s"), tmpname,
+				  cache->filename, strerror(errno));
+	unlink(tmpname);
+	g_free(tmpname);
+	return FALSE;
+    }
+    g_free(tmpname);
+    return TRUE;
+
+write_error:
+    *errmsg = g_strdup_printf(_("can't write %s: %s"), tmpname,
+			      strerror(errno));
+    if (fd != -1)
+	close(fd);
+    unlink(tmpname);
+    g_free(tmpname);
+    return FALSE;
+}
+
+void
+calc_cache_log_stats(
+    calc_cache_t *cache)
+{
+    guint64 hits = 0, misses = 0;
+    int i;
+
+    for (i = 0; i < cache->nworkers; i++) {
+	hits += cache->workers[i].hits;
+	misses += cache->workers[i].misses;
+    }
+    g_debug("estimate cache: %llu directories from the cache, %llu read",
+	    (unsigned long long)hits, (unsigned long long)misses);
+}
+
+void
+calc_cache_free(
+    calc_cache_t *cache)
+{
+    int i;
+
+    for (i = 0; i < cache->nworkers; i++) {
+	cache_worker_t *w = &cache->workers[i];
+
+	g_byte_array_free(w->out, TRUE);
+	g_string_free(w->path, TRUE);
+	g_array_free(w->files, TRUE);
+	g_string_free(w->file_names, TRUE);
+	g_string_free(w->names, TRUE);
+    }
+    g_free(cache->workers);
+    g_hash_table_destroy(cache->dirs);
+    g_free(cache->buf);
+    g_free(cache->filename);
+    g_free(cache);
+}
@@ -0,0 +1,115 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Estimate cache of calcsize (see estimate-cache-dir in amanda-client.conf)
+ *
+ * For each directory it reads, calcsize records the name, change time, size
+ * in blocks and exclusion of each file, the number of other entries, the
+ * names of the subdirectories to walk, and the device, inode, mtime and ctime
+ * of the directory.  On the next run, a directory whose markers are unchanged
+ * is not read: its entries are taken from the cache.
+ *
+ * Creating, removing or renaming an entry changes the mtime of the
+ * directory, but rewriting a file in place does not, so the files of such a
+ * directory are still lstat'ed by name for their current size and change
+ * time.  Each directory is also read again once its entry is old enough.
+ *
+ * The file is in the native byte order and is only meant to be read on the
+ * host that wrote it.
+ */
+
+#ifndef CALCSIZE_CACHE_H
+#define CALCSIZE_CACHE_H
+
+#include "amanda.h"
+
+typedef struct calc_cache_s calc_cache_t;
+
+/* the blocks of an excluded file have this bit set */
+#define CALC_CACHE_EXCLUDED	G_GUINT64_CONSTANT(0x8000000000000000)
+
+typedef struct calc_cache_file_s {
+    gint64  ctime;
+    guint64 blocks;	/* ST_BLOCKS, and CALC_CACHE_EXCLUDED */
+} calc_cache_file_t;
+
+/* The content of a directory, as found in the cache */
+typedef struct calc_cache_dir_s {
+    guint32 n_other;		/* directories and symlinks */
+    guint32 n_files;
+    guint32 n_subdirs;
+    const calc_cache_file_t *files;
+    const char *file_names;	/* N_FILES '\0'-terminated names */
+    const char *subdirs;	/* N_SUBDIRS '\0'-terminated names */
+    gint64 scanned;		/* when the directory was last read */
+} calc_cache_dir_t;
+
+/* Load the cache FILENAME, if it exists and was written with the same
+ * exclusion, and prepare a new one for NWORKERS walker threads.
+ *
+ * @param excl_hash: identifies the exclusion list
+ * @param max_days: the estimate-cache-days setting
+ * @returns: the cache; never NULL
+ */
+calc_cache_t *calc_cache_new(const char *filename, guint64 excl_hash,
+			     int max_days, int nworkers);
+
+/* Look up the directory RELPATH.  If its entry is still valid for DINFO, its
+ * content is returned in DIR.
+ *
+ * @returns: TRUE if the directory need not be read
+ */
+gboolean calc_cache_lookup(calc_cache_t *cache, const char *relpath,
+			   struct stat *dinfo, calc_cache_dir_t *dir);
+
+/* Record the content of the directory RELPATH for the new cache, from walker
+ * thread WORKER: call calc_cache_begin(), then the calc_cache_add_*
+ * functions for its entries, then calc_cache_end().  DIR is NULL if the
+ * directory is read, or what calc_cache_lookup returned if its entries are
+ * taken from the cache; the entry then keeps its age.
+ */
+void calc_cache_begin(calc_cache_t *cache, int worker, const char *relpath,
+		      struct stat *dinfo, const calc_cache_dir_t *dir);
+void calc_cache_add_file(calc_cache_t *cache, int worker, const char *name,
+			 struct stat *finfo, guint64 blocks, gboolean excluded);
+void calc_cache_add_other(calc_cache_t *cache, int worker);
+void calc_cache_add_subdir(calc_cache_t *cache, int worker, const char *name);
+void calc_cache_end(calc_cache_t *cache, int worker);
+
+/* Replace the cache file with the directories looked up or recorded.
+ *
+ * @param errmsg (output): error message if FALSE is returned
+ * @returns: FALSE on error
+ */
+gboolean calc_cache_write(calc_cache_t *cache, char **errmsg);
+
+/* Log how many directories were found in the cache and how many were read */
+void calc_cache_log_stats(calc_cache_t *cache);
+
+void calc_cache_free(calc_cache_t *cache);
+
+#endif /* CALCSIZE_CACHE_H */
@@ -39,6 +39,8 @@
 #include "fsusage.h"
 #include "am_sl.h"
 #include "amutil.h"
+#include "dirwalk.h"
+#include "calcsize-cache.h"
 
 #define ROUND(n,x)	((x) + (n) - 1 - (((x) + (n) - 1) % (n)))
 
@@ -64,29 +66,24 @@ round_function(n, x)
 
 #define	FILETYPES	(S_IFREG|S_IFLNK|S_IFDIR)
 
-typedef struct name_s {
-    struct name_s *next;
-    char *str;
-} Name;
-
-Name *name_stack;
-
 #define MAXDUMPS 10
 
-struct {
+typedef struct dumpstats_s {
     int max_inode;
     int total_dirs;
     int total_files;
     off_t total_size;
     off_t total_size_name;
-} dumpstats[MAXDUMPS];
+} dumpstats_t;
+
+dumpstats_t dumpstats[MAXDUMPS];
 
 time_t dumpdate[MAXDUMPS];
 int  dumplevel[MAXDUMPS];
 int ndumps;
 
-void (*add_file_name)(int, char *);
-void (*add_file)(int, struct stat *);
+void (*add_file_name)(dumpstats_t *, int, const char *);
+void (*add_file)(dumpstats_t *, int, struct stat *);
 off_t (*final_size)(int, char *);
 
 
@@ -94,29 +91,32 @@ int main(int, char **);
 void traverse_dirs(char *, char *);
 
 
-void add_file_name_dump(int, char *);
-void add_file_dump(int, struct stat *);
+void add_file_name_dump(dumpstats_t *, int, const char *);
+void add_file_dump(dumpstats_t *, int, struct stat *);
 off_t final_size_dump(int, char *);
 
-void add_file_name_star(int, char *);
-void add_file_star(int, struct stat *);
+void add_file_name_star(dumpstats_t *, int, const char *);
+void add_file_star(dumpstats_t *, int, struct stat *);
 off_t final_size_star(int, char *);
 
-void add_file_name_gnutar(int, char *);
-void add_file_gnutar(int, struct stat *);
+void add_file_name_gnutar(dumpstats_t *, int, const char *);
+void add_file_gnutar(dumpstats_t *, int, struct stat *);
 off_t final_size_gnutar(int, char *);
 
-void add_file_name_unknown(int, char *);
-void add_file_unknown(int, struct stat *);
+void add_file_name_unknown(dumpstats_t *, int, const char *);
+void add_file_unknown(dumpstats_t *, int, struct stat *);
 off_t final_size_unknown(int, char *);
 
 am_sl_t *calc_load_file(char *filename);
-int calc_check_exclude(char *filename);
+int calc_check_exclude(const char *filename);
+static guint64 calc_exclude_hash(void);
 
 int use_star_excl = 0;
 int use_gtar_excl = 0;
 am_sl_t *include_sl=NULL, *exclude_sl=NULL;
 
+static calc_cache_t *estimate_cache = NULL;
+
 int
 main(
     int		argc,
@@ -174,12 +174,16 @@ main(
     char *dirname=NULL;
     char *amname=NULL, *qamname=NULL;
     char *filename=NULL, *qfilename = NULL;
+    char *config_name;
+    char *cache_dir;
 
     if (argc > 1 && argv[1] && g_str_equal(argv[1], "--version")) {
 	printf("calcsize-%s\n", VERSION);
 	return (0);
     }
 
+    glib_init();
+
     safe_fd(-1, 0);
     safe_cd();
 
@@ -210,6 +214,7 @@ main(
     }
 
     dbprintf(_("config: %s\n"), *argv);
+    config_name = *argv;
     if (!g_str_equal(*argv, "NOCONFIG")) {
 	dbrename(*argv, DBG_SUBDIR_CLIENT);
     }
@@ -340,6 +345,21 @@ main(
 	/*NOTREACHED*/
     }
 
+    cache_dir = getconf_str(CNF_ESTIMATE_CACHE_DIR);
+    if (cache_dir && *cache_dir) {
+	char *sconfig = sanitise_filename(config_name);
+	char *sdirname = sanitise_filename(dirname);
+
+	filename = g_strconcat(cache_dir, "/", sconfig, "_", sdirname,
+			       ".cache", NULL);
+	estimate_cache = calc_cache_new(filename, calc_exclude_hash(),
+					getconf_int(CNF_ESTIMATE_CACHE_DAYS),
+					dirwalk_default_threads());
+	amfree(filename);
+	amfree(sconfig);
+	amfree(sdirname);
+    }
+
     if(is_empty_sl(include_sl)) {
 	traverse_dirs(dirname,".");
     }
@@ -371,6 +391,18 @@ main(
     }
     amfree(qamname);
 
+    if (estimate_cache) {
+	char *errmsg = NULL;
+
+	calc_cache_log_stats(estimate_cache);
+	if (!calc_cache_write(estimate_cache, &errmsg)) {
+	    dbprintf(_("estimate cache not written: %s\n"), errmsg);
+	    amfree(errmsg);
+	}
+	calc_cache_free(estimate_cache);
+	estimate_cache = NULL;
+    }
+
     return 0;
 #endif
 }
@@ -393,154 +425,243 @@ basename(
 }
 #endif
 
-void push_name(char *str);
-char *pop_name(void);
-
-void
-traverse_dirs(
-    char *	parent_dir,
-    char *	include)
-{
-    DIR *d;
-    struct dirent *f;
-    struct stat finfo;
-    char *dirname, *newname = NULL;
-    char *newbase = NULL;
-    dev_t parent_dev = (dev_t)0;
-    int i;
-    size_t l;
+typedef struct calc_walk_s {
+    dumpstats_t *stats;		/* MAXDUMPS entries per walker thread */
     size_t parent_len;
     int has_exclude;
-    char *aparent;
+    calc_cache_t *cache;	/* NULL without estimate-cache-dir */
+} calc_walk_t;
+
+static gboolean
+calc_walk_entry(
+    gpointer		data,
+    int			worker,
+    const char *	newname,
+    struct stat *	finfo)
+{
+    calc_walk_t *cw = data;
+    dumpstats_t *ds = cw->stats + worker * MAXDUMPS;
+    int is_dir = ((finfo->st_mode & S_IFMT) == S_IFDIR);
+    int is_file = ((finfo->st_mode & S_IFMT) == S_IFREG);
+    int is_excluded = -1;
+    int i;
 
-    if(parent_dir == NULL || include == NULL)
-	return;
+    if(cw->cache) {
+	if(is_file) {
+	    /* the cache needs it whatever the levels */
+	    if(cw->has_exclude)
+		is_excluded = calc_check_exclude(newname+cw->parent_len+1);
+	    calc_cache_add_file(cw->cache, worker, strrchr(newname, '/') + 1,
+				finfo,
+				(guint64)ST_BLOCKS(*finfo), is_excluded == 1);
+	} else {
+	    calc_cache_add_other(cw->cache, worker);
+	}
+    }
 
-    has_exclude = !is_empty_sl(exclude_sl) && (use_gtar_excl || use_star_excl);
-    aparent = g_strjoin(NULL, parent_dir, "/", include, NULL);
+    for(i = 0; i < ndumps; i++) {
+	add_file_name(ds, i, newname);
+	if(is_file && (time_t)finfo->st_ctime >= dumpdate[i]) {
+
+	    if(cw->has_exclude) {
+		if(is_excluded == -1)
+		    is_excluded =
+			   calc_check_exclude(newname+cw->parent_len+1);
+		if(is_excluded == 1) {
+		    i = ndumps;
+		    continue;
+		}
+	    }
+	    add_file(ds, i, finfo);
+	}
+    }
+    if(is_dir) {
+	if(cw->has_exclude && calc_check_exclude(newname+cw->parent_len+1))
+	    return FALSE;
+	if(cw->cache)
+	    calc_cache_add_subdir(cw->cache, worker, strrchr(newname, '/') + 1);
+	return TRUE;
+    }
+    return FALSE;
+}
 
-    /* We (may) need root privs for the *stat() calls here. */
-    set_root_privs(1);
-    if(stat(parent_dir, &finfo) != -1)
-	parent_dev = finfo.st_dev;
+/*
+ * Give the entries of a directory found in the estimate cache to the
+ * add_file_name and add_file functions, as calc_walk_entry would have, and
+ * walk its subdirectories.  Its files are stat'ed again, since one rewritten
+ * in place does not change the directory.
+ */
+static int
+calc_walk_enter(
+    gpointer		data,
+    int			worker,
+    const char *	path,
+    struct stat *	dinfo,
+    GPtrArray *		subdirs)
+{
+    calc_walk_t *cw = data;
+    dumpstats_t *ds = cw->stats + worker * MAXDUMPS;
+    const char *relpath = path + cw->parent_len + 1;
+    const char *sep;
+    const char *name;
+    calc_cache_dir_t dir;
+    struct stat *finfos;
+    guint32 n;
+    int i;
 
-    parent_len = strlen(parent_dir);
+    if(!calc_cache_lookup(cw->cache, relpath, dinfo, &dir)) {
+	calc_cache_begin(cw->cache, worker, relpath, dinfo, NULL);
+	return DIRWALK_READ;
+    }
 
-    push_name(aparent);
+    sep = g_str_has_suffix(path, "/") ? "" : "/";
 
-    for(; (dirname = pop_name()) != NULL; free(dirname)) {
-	if(has_exclude && calc_check_exclude(dirname+parent_len+1)) {
-	    continue;
-	}
-	if((d = opendir(dirname)) == NULL) {
-	    continue;
-	}
+    /* all of them first: if one is no longer a file, read the directory */
+    finfos = g_new(struct stat, dir.n_files);
+    for(n = 0, name = dir.file_names; n < dir.n_files;
+	n++, name += strlen(name) + 1) {
+	char *filename = g_strconcat(path, sep, name, NULL);
+	int rc = lstat(filename, &finfos[n]);
 
-	l = strlen(dirname);
-	if(l > 0 && dirname[l - 1] != '/') {
-	    g_free(newbase);
-	    newbase = g_strconcat(dirname, "/", NULL);
-	} else {
-	    g_free(newbase);
-	    newbase = g_strdup(dirname);
+	g_free(filename);
+	if(rc == -1 || (finfos[n].st_mode & S_IFMT) != S_IFREG) {
+	    g_free(finfos);
+	    calc_cache_begin(cw->cache, worker, relpath, dinfo, NULL);
+	    return DIRWALK_READ;
 	}
+    }
 
-	while((f = readdir(d)) != NULL) {
-	    int is_symlink = 0;
-	    int is_dir;
-	    int is_file;
-	    if(is_dot_or_dotdot(f->d_name)) {
-		continue;
-	    }
+    calc_cache_begin(cw->cache, worker, relpath, dinfo, &dir);
+
+    for(n = 0; n < dir.n_other; n++) {
+	for(i = 0; i < ndumps; i++)
+	    add_file_name(ds, i, path);
+	calc_cache_add_other(cw->cache, worker);
+    }
 
-	    g_free(newname);
-	    newname = g_strconcat(newbase, f->d_name, NULL);
-	    if(lstat(newname, &finfo) == -1) {
-		g_fprintf(stderr, "%s/%s: %s\n",
-			dirname, f->d_name, strerror(errno));
-		continue;
+    for(n = 0, name = dir.file_names; n < dir.n_files;
+	n++, name += strlen(name) + 1) {
+	struct stat *finfo = &finfos[n];
+	gboolean excluded = (dir.files[n].blocks & CALC_CACHE_EXCLUDED) != 0;
+
+	calc_cache_add_file(cw->cache, worker, name, finfo,
+			    (guint64)ST_BLOCKS(*finfo), excluded);
+	for(i = 0; i < ndumps; i++) {
+	    add_file_name(ds, i, path);
+	    if((time_t)finfo->st_ctime >= dumpdate[i]) {
+		if(excluded)
+		    break;
+		add_file(ds, i, finfo);
 	    }
+	}
+    }
+    g_free(finfos);
 
-	    if(finfo.st_dev != parent_dev)
-		continue;
+    for(n = 0, name = dir.subdirs; n < dir.n_subdirs;
+	n++, name += strlen(name) + 1) {
+	g_ptr_array_add(subdirs, g_strconcat(path, sep, name, NULL));
+	calc_cache_add_subdir(cw->cache, worker, name);
+    }
 
-#ifdef S_IFLNK
-	    is_symlink = ((finfo.st_mode & S_IFMT) == S_IFLNK);
-#endif
-	    is_dir = ((finfo.st_mode & S_IFMT) == S_IFDIR);
-	    is_file = ((finfo.st_mode & S_IFMT) == S_IFREG);
+    /* the directory is not read, so calc_walk_leave is not called */
+    calc_cache_end(cw->cache, worker);
+    return DIRWALK_SKIP;
+}
 
-	    if (!(is_file || is_dir || is_symlink)) {
-		continue;
-	    }
+static void
+calc_walk_leave(
+    gpointer		data,
+    int			worker,
+    const char *	path)
+{
+    calc_walk_t *cw = data;
 
-	    {
-		int is_excluded = -1;
-		for(i = 0; i < ndumps; i++) {
-		    add_file_name(i, newname);
-		    if(is_file && (time_t)finfo.st_ctime >= dumpdate[i]) {
-
-			if(has_exclude) {
-			    if(is_excluded == -1)
-				is_excluded =
-				       calc_check_exclude(newname+parent_len+1);
-			    if(is_excluded == 1) {
-				i = ndumps;
-				continue;
-			    }
-			}
-			add_file(i, &finfo);
-		    }
-		}
-		if(is_dir) {
-		    if(has_exclude && calc_check_exclude(newname+parent_len+1))
-			continue;
-		    push_name(newname);
-		}
-	    }
-	}
+    (void)path;		/* Quiet unused parameter warning */
 
-#ifdef CLOSEDIR_VOID
-	closedir(d);
-#else
-	if(closedir(d) == -1)
-	    perror(dirname);
-#endif
-    }
+    calc_cache_end(cw->cache, worker);
+}
 
-    /* drop root privs -- we're done with the permission-sensitive calls */
-    set_root_privs(0);
+static void
+calc_walk_error(
+    gpointer		data,
+    int			worker,
+    const char *	path,
+    int			err)
+{
+    (void)data;		/* Quiet unused parameter warning */
+    (void)worker;	/* Quiet unused parameter warning */
 
-    amfree(newbase);
-    amfree(newname);
-    amfree(aparent);
+    g_fprintf(stderr, "%s: %s\n", path, strerror(err));
 }
 
+/*
+ * Walk the tree with several threads (see dirwalk.h), each adding up its
+ * own sizes per level, then add all of them to dumpstats.
+ */
 void
-push_name(
-    char *	str)
+traverse_dirs(
+    char *	parent_dir,
+    char *	include)
 {
-    Name *newp;
+    calc_walk_t cw;
+    dirwalk_ops_t ops;
+    dirwalk_stats_t stats;
+    int nthreads;
+    int t, i;
 
-    newp = g_malloc(sizeof(*newp));
-    newp->str = g_strdup(str);
+    if(parent_dir == NULL || include == NULL)
+	return;
 
-    newp->next = name_stack;
-    name_stack = newp;
-}
+    cw.has_exclude = !is_empty_sl(exclude_sl) && (use_gtar_excl || use_star_excl);
+    cw.parent_len = strlen(parent_dir);
+    cw.cache = estimate_cache;
 
-char *
-pop_name(void)
-{
-    Name *newp = name_stack;
-    char *str;
+    if(cw.has_exclude && calc_check_exclude(include)) {
+	return;
+    }
 
-    if(!newp) return NULL;
+    /* the same number of threads as the estimate cache was made for */
+    nthreads = dirwalk_default_threads();
+    cw.stats = g_new0(dumpstats_t, nthreads * MAXDUMPS);
 
-    name_stack = newp->next;
-    str = newp->str;
-    amfree(newp);
-    return str;
+    memset(&ops, 0, sizeof(ops));
+    ops.entry_fn = calc_walk_entry;
+    ops.error_fn = calc_walk_error;
+    if(cw.cache) {
+	ops.enter_fn = calc_walk_enter;
+	ops.leave_fn = calc_walk_leave;
+    }
+
+    /* We (may) need root privs for the *stat() calls here. */
+    set_root_privs(1);
+    dirwalk_full(parent_dir, include, nthreads,
+		 DIRWALK_WANT_SIZE | DIRWALK_WANT_TIMES,
+		 &ops, &cw, &stats);
+    /* drop root privs -- we're done with the permission-sensitive calls */
+    set_root_privs(0);
+
+    for(t = 0; t < nthreads; t++) {
+	dumpstats_t *ds = cw.stats + t * MAXDUMPS;
+
+	for(i = 0; i < ndumps; i++) {
+	    dumpstats[i].max_inode += ds[i].max_inode;
+	    dumpstats[i].total_dirs += ds[i].total_dirs;
+	    dumpstats[i].total_files += ds[i].total_files;
+	    dumpstats[i].total_size += ds[i].total_size;
+	    dumpstats[i].total_size_name += ds[i].total_size_name;
+	}
+    }
+    amfree(cw.stats);
+
+    dbprintf(_("calcsize: walked %s/%s with %d threads: %llu directories, "
+	       "%llu from the cache, %llu entries, %llu errors in %.3f seconds "
+	       "(%.0f files/s)\n"),
+	     parent_dir, include, nthreads,
+	     (unsigned long long)stats.dirs,
+	     (unsigned long long)stats.skipped,
+	     (unsigned long long)stats.entries,
+	     (unsigned long long)stats.errors, stats.seconds,
+	     stats.seconds > 0 ? stats.entries / stats.seconds : 0.0);
 }
 
 
@@ -562,9 +683,11 @@ pop_name(void)
  */
 void
 add_file_name_dump(
-    int		level,
-    char *	name)
+    dumpstats_t *	ds,
+    int			level,
+    const char *	name)
 {
+    (void)ds;		/* Quiet unused parameter warning */
     (void)level;	/* Quiet unused parameter warning */
     (void)name;		/* Quiet unused parameter warning */
 
@@ -573,12 +696,13 @@ add_file_name_dump(
 
 void
 add_file_dump(
+    dumpstats_t *	ds,
     int			level,
     struct stat *	sp)
 {
     /* keep the size in kbytes, rounded up, plus a 1k header block */
     if((sp->st_mode & S_IFMT) == S_IFREG || (sp->st_mode & S_IFMT) == S_IFDIR)
-    	dumpstats[level].total_size +=
+    	ds[level].total_size +=
 			(ST_BLOCKS(*sp) + (off_t)1) / (off_t)2 + (off_t)1;
 }
 
@@ -628,22 +752,24 @@ final_size_dump(
  */
 void
 add_file_name_gnutar(
-    int		level,
-    char *	name)
+    dumpstats_t *	ds,
+    int			level,
+    const char *	name)
 {
     (void)name;	/* Quiet unused parameter warning */
 
-/*  dumpstats[level].total_size_name += strlen(name) + 64;*/
-    dumpstats[level].total_size += (off_t)1;
+/*  ds[level].total_size_name += strlen(name) + 64;*/
+    ds[level].total_size += (off_t)1;
 }
 
 void
 add_file_gnutar(
+    dumpstats_t *	ds,
     int			level,
     struct stat *	sp)
 {
     /* the header takes one additional block */
-    dumpstats[level].total_size += ST_BLOCKS(*sp);
+    ds[level].total_size += ST_BLOCKS(*sp);
 }
 
 off_t
@@ -668,9 +794,11 @@ final_size_gnutar(
 
 void
 add_file_name_unknown(
-    int		level,
-    char *	name)
+    dumpstats_t *	ds,
+    int			level,
+    const char *	name)
 {
+    (void)ds;		/* Quiet unused parameter warning */
     (void)level;	/* Quiet unused parameter warning */
     (void)name;		/* Quiet unused parameter warning */
 
@@ -679,12 +807,13 @@ add_file_name_unknown(
 
 void
 add_file_unknown(
+    dumpstats_t *	ds,
     int			level,
     struct stat *	sp)
 {
     /* just add up the block counts */
     if((sp->st_mode & S_IFMT) == S_IFREG || (sp->st_mode & S_IFMT) == S_IFDIR)
-    	dumpstats[level].total_size += ST_BLOCKS(*sp);
+    	ds[level].total_size += ST_BLOCKS(*sp);
 }
 
 off_t
@@ -729,7 +858,7 @@ calc_load_file(
 
 int
 calc_check_exclude(
-    char *	filename)
+    const char *	filename)
 {
     sle_t *an_exclude;
     if(is_empty_sl(exclude_sl)) return 0;
@@ -743,3 +872,26 @@ calc_check_exclude(
     }
     return 0;
 }
+
+/* identifies the exclusion in the estimate cache, as each file's exclusion
+ * is kept there */
+static guint64
+calc_exclude_hash(void)
+{
+    guint64 h = G_GUINT64_CONSTANT(14695981039346656037);
+    sle_t *an_exclude;
+    const char *s;
+
+    if(is_empty_sl(exclude_sl) || !(use_gtar_excl || use_star_excl))
+	return 0;
+
+    /* FNV-1a over the patterns, with their '\0' */
+    for(an_exclude = exclude_sl->first; an_exclude != NULL;
+	an_exclude = an_exclude->next) {
+	s = an_exclude->name;
+	do {
+	    h = (h ^ (guchar)*s) * G_GUINT64_CONSTANT(1099511628211);
+	} while(*s++ != '\0');
+    }
+    return h;
+}
@@ -42,6 +42,7 @@
 #include "amandates.h"
 #include "stream.h"
 #include "shm-ring.h"
+#include "amcompress.h"
 
 #define sendbackup_debug(i, ...) do {	\
 	if ((i) <= debug_sendbackup) {	\
@@ -89,6 +90,15 @@ typedef struct filter_stderr_pipe {
 static filter_stderr_pipe enc_stderr_pipe;
 static filter_stderr_pipe comp_stderr_pipe;
 
+/* in-process compression of COMP_FAST/COMP_BEST, from 'in' to 'out' */
+typedef struct filter_compress {
+    int in;
+    int out;
+    am_compress_t *comp;
+    GThread *thread;
+} filter_compress;
+static filter_compress comp_filter;
+
 /* local functions */
 int main(int argc, char **argv);
 char *childstr(pid_t pid);
@@ -103,6 +113,9 @@ static void save_fd(int *, int);
 void application_api_info_tapeheader(int mesgfd, char *prog, dle_t *dle);
 
 gpointer stderr_thread(gpointer data);
+static gboolean start_compress_thread(int compout, int *dumpout, comp_t compress);
+static gboolean compress_output(gpointer data, gpointer buf, gsize size);
+static gpointer compress_thread(gpointer data);
 
 int
 fdprintf(
@@ -559,6 +572,8 @@ main(
 	    int        client_pipe[2];
 	    int        data_out = datafd;
 
+	    comp_filter.thread = NULL;
+
 	    crc32_init(&native_crc.crc);
 	    crc32_init(&client_crc.crc);
 	    /* create pipes to compute the native CRC */
@@ -618,7 +633,15 @@ main(
 	    }
 
 	    /*  now do the client-side compression */
-	    if(dle->compress == COMP_FAST || dle->compress == COMP_BEST) {
+	    if ((dle->compress == COMP_FAST || dle->compress == COMP_BEST) &&
+		g_str_equal(COMPRESS_SUFFIX, ".gz") &&
+		am_compress_supported(AM_COMPRESS_GZIP)) {
+		if (!start_compress_thread(compout, &dumpout, dle->compress)) {
+		    return 0;
+		}
+		compout = -1;
+		comppid = -1;
+	    } else if(dle->compress == COMP_FAST || dle->compress == COMP_BEST) {
 		compopt = skip_argument;
 #if defined(COMPRESS_BEST_OPT) && defined(COMPRESS_FAST_OPT)
 		if(dle->compress == COMP_BEST) {
@@ -942,6 +965,10 @@ main(
 		if (comp_stderr_pipe.thread) {
 		    g_thread_join(comp_stderr_pipe.thread);
 		}
+		if (comp_filter.thread) {
+		    g_thread_join(comp_filter.thread);
+		    comp_filter.thread = NULL;
+		}
 		g_thread_join(client_crc.thread);
 	    }
 
@@ -1808,6 +1835,120 @@ stderr_thread(
     return NULL;
 }
 
+/*
+ * Compress DUMPOUT to COMPOUT in a thread, instead of running COMPRESS_PATH.
+ * With more than one compress-threads, the data is compressed in parallel
+ * blocks, followed by a seek table.
+ */
+static gboolean
+start_compress_thread(
+    int     compout,
+    int    *dumpout,
+    comp_t  compress)
+{
+    int    comp_pipe[2];
+    int    nthreads = getconf_int(CNF_COMPRESS_THREADS);
+    int    level = 0;
+    char  *errmsg = NULL;
+    char  *qerrmsg;
+
+    if (pipe(comp_pipe) < 0) {
+	errmsg = g_strdup_printf("compress: can't create pipe: %s",
+				 strerror(errno));
+    } else {
+	level = compress == COMP_BEST ? am_compress_best_level(AM_COMPRESS_GZIP)
+				      : am_compress_fast_level(AM_COMPRESS_GZIP);
+	comp_filter.comp = am_compress_new(AM_COMPRESS_GZIP, level, nthreads, 0,
+				nthreads > 1 ? AM_COMPRESS_SEEK_TABLE : 0,
+				compress_output, &comp_filter, &errmsg);
+	if (!comp_filter.comp) {
+	    aclose(comp_pipe[0]);
+	    aclose(comp_pipe[1]);
+	}
+    }
+    if (errmsg) {
+	qerrmsg = quote_string(errmsg);
+	fdprintf(mesgfd, _("sendbackup: error [%s]\n"), errmsg);
+	g_debug("ERROR %s", qerrmsg);
+	amfree(qerrmsg);
+	amfree(errmsg);
+	return FALSE;
+    }
+
+    g_debug("compress: in-process gzip, level %d, %d thread%s", level,
+	    nthreads, nthreads > 1 ? "s" : "");
+    comp_filter.in = comp_pipe[0];
+    comp_filter.out = compout;
+    *dumpout = comp_pipe[1];
+    comp_filter.thread = g_thread_create(compress_thread,
+					 (gpointer)&comp_filter, TRUE, NULL);
+    return TRUE;
+}
+
+static gboolean
+compress_output(
+    gpointer data,
+    gpointer buf,
+    gsize    size)
+{
+    filter_compress *fc = (filter_compress *)data;
+    size_t written;
+
+    written = full_write(fc->out, buf, size);
+    g_free(buf);
+    return written == size;
+}
+
+static gpointer
+compress_thread(
+    gpointer data)
+{
+    filter_compress *fc = (filter_compress *)data;
+    char    *buf = g_malloc(NETWORK_BLOCK_BYTES);
+    ssize_t  size;
+    gboolean failed = FALSE;
+
+    while ((size = read(fc->in, buf, NETWORK_BLOCK_BYTES)) != 0) {
+	if (size < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	/* keep reading after an error, so the writer does not block */
+	if (!failed && !am_compress_write(fc->comp, buf, size))
+	    failed = TRUE;
+    }
+    if (!failed && (size < 0 || !am_compress_finish(fc->comp)))
+	failed = TRUE;
+
+    if (failed) {
+	const char *errmsg = am_compress_error(fc->comp);
+	if (shm_ring) {
+	    shm_ring->mc->cancelled = TRUE;
+	    sem_post(shm_ring->sem_ready);
+	    sem_post(shm_ring->sem_start);
+	    sem_post(shm_ring->sem_write);
+	    sem_post(shm_ring->sem_read);
+	}
+	if (!errmsg)
+	    errmsg = strerror(errno);
+	fdprintf(mesgfd, "sendbackup: error [compress: %s]\n", errmsg);
+	g_debug("error [compress: %s]", errmsg);
+    } else {
+	g_debug("compress: %lld bytes compressed to %lld bytes",
+		(long long)am_compress_bytes_in(fc->comp),
+		(long long)am_compress_bytes_out(fc->comp));
+    }
+
+    aclose(fc->in);
+    aclose(fc->out);
+    am_compress_free(fc->comp);
+    fc->comp = NULL;
+    g_free(buf);
+
+    return NULL;
+}
+
 gpointer
 handle_crc_to_shm_ring_thread(
     gpointer data)
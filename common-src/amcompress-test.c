@@ -0,0 +1,344 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amcompress.h"
+#include "testutils.h"
+#include "amutil.h"
+
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+#include <zlib.h>
+
+#define TEST_BLOCK_SIZE (64*1024)
+#define TEST_DATA_SIZE	(TEST_BLOCK_SIZE * 10 + 1234)
+
+static char *test_data = NULL;
+
+/* compressible, but not trivially so */
+static void
+init_test_data(void)
+{
+    guint32 seed = 0x1234567;
+    size_t i;
+
+    if (test_data)
+	return;
+
+    test_data = g_malloc(TEST_DATA_SIZE);
+    for (i = 0; i < TEST_DATA_SIZE; i++) {
+	seed = seed * 1103515245 + 12345;
+	test_data[i] = "abcdefgh\n"[(seed >> 16) % 9];
+    }
+}
+
+static gboolean
+append_output(
+    gpointer data,
+    gpointer buf,
+    gsize size)
+{
+    GByteArray *out = (GByteArray *)data;
+
+    g_byte_array_append(out, buf, size);
+    g_free(buf);
+    return TRUE;
+}
+
+/* compress test_data, writing it in odd-sized pieces */
+static GByteArray *
+compress_test_data(
+    int nthreads,
+    int flags)
+{
+    GByteArray *out = g_byte_array_new();
+    am_compress_t *comp;
+    char *errmsg = NULL;
+    size_t pos, len;
+
+    comp = am_compress_new(AM_COMPRESS_GZIP, AM_COMPRESS_DEFAULT_LEVEL,
+			   nthreads, TEST_BLOCK_SIZE, flags,
+			   append_output, out, &errmsg);
+    if (!comp) {
+	g_fprintf(stderr, "am_compress_new: %s\n", errmsg);
+	g_free(errmsg);
+	g_byte_array_free(out, TRUE);
+	return NULL;
+    }
+
+    for (pos = 0; pos < TEST_DATA_SIZE; pos += len) {
+	len = MIN(10007, TEST_DATA_SIZE - pos);
+	if (!am_compress_write(comp, test_data + pos, len))
+	    goto error;
+    }
+    if (!am_compress_finish(comp))
+	goto error;
+
+    am_compress_free(comp);
+    return out;
+
+error:
+    g_fprintf(stderr, "compression failed: %s\n", am_compress_error(comp));
+    am_compress_free(comp);
+    g_byte_array_free(out, TRUE);
+    return NULL;
+}
+
+/* decompress a concatenation of gzip members, as 'gzip -dc' would */
+static GByteArray *
+gunzip(
+    guint8 *buf,
+    gsize size)
+{
+    GByteArray *out = g_byte_array_new();
+    guint8 tmp[16384];
+    z_stream z;
+    int rv;
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 32) != Z_OK) {
+	g_byte_array_free(out, TRUE);
+	return NULL;
+    }
+
+    z.next_in = buf;
+    z.avail_in = size;
+    while (z.avail_in > 0) {
+	z.next_out = tmp;
+	z.avail_out = sizeof(tmp);
+	rv = inflate(&z, Z_NO_FLUSH);
+	g_byte_array_append(out, tmp, sizeof(tmp) - z.avail_out);
+	if (rv == Z_STREAM_END) {
+	    /* start over with the next member */
+	    inflateReset(&z);
+	} else if (rv != Z_OK) {
+	    g_fprintf(stderr, "inflate: %s\n", z.msg? z.msg : "error");
+	    inflateEnd(&z);
+	    g_byte_array_free(out, TRUE);
+	    return NULL;
+	}
+    }
+    inflateEnd(&z);
+
+    return out;
+}
+
+static gboolean
+check_round_trip(
+    int nthreads,
+    int flags)
+{
+    GByteArray *comp, *uncomp;
+    gboolean ok;
+
+    comp = compress_test_data(nthreads, flags);
+    if (!comp)
+	return FALSE;
+
+    uncomp = gunzip(comp->data, comp->len);
+    g_byte_array_free(comp, TRUE);
+    if (!uncomp)
+	return FALSE;
+
+    ok = uncomp->len == TEST_DATA_SIZE &&
+	 memcmp(uncomp->data, test_data, TEST_DATA_SIZE) == 0;
+    if (!ok)
+	g_fprintf(stderr, "decompressed data differs (%u bytes)\n", uncomp->len);
+    g_byte_array_free(uncomp, TRUE);
+
+    return ok;
+}
+
+/*
+ * Tests
+ */
+
+static gboolean
+test_stream(void)
+{
+    init_test_data();
+    return check_round_trip(1, 0);
+}
+
+static gboolean
+test_threaded(void)
+{
+    init_test_data();
+    return check_round_trip(4, 0);
+}
+
+static gboolean
+test_seek_table(void)
+{
+    GByteArray *comp = NULL, *uncomp = NULL;
+    am_seek_table_t *table = NULL;
+    const am_seek_entry_t *entry;
+    char *filename = NULL;
+    char *errmsg = NULL;
+    gboolean ok = FALSE;
+    guint nblocks = (TEST_DATA_SIZE + TEST_BLOCK_SIZE - 1) / TEST_BLOCK_SIZE;
+    guint64 offset;
+    int fd = -1;
+
+    init_test_data();
+
+    /* the table must not disturb a plain decompressor */
+    if (!check_round_trip(2, AM_COMPRESS_SEEK_TABLE))
+	return FALSE;
+
+    comp = compress_test_data(2, AM_COMPRESS_SEEK_TABLE);
+    if (!comp)
+	return FALSE;
+
+    /* write it after some unrelated data, as on a holding disk chunk */
+    filename = g_strdup("amcompress-test.XXXXXX");
+    fd = g_mkstemp(filename);
+    if (fd < 0) {
+	g_fprintf(stderr, "mkstemp: %s\n", strerror(errno));
+	goto done;
+    }
+    unlink(filename);
+    if (full_write(fd, test_data, 100) != 100 ||
+	full_write(fd, comp->data, comp->len) != comp->len) {
+	g_fprintf(stderr, "write: %s\n", strerror(errno));
+	goto done;
+    }
+
+    table = am_seek_table_read(fd, 100, 100 + comp->len, &errmsg);
+    if (!table) {
+	g_fprintf(stderr, "am_seek_table_read: %s\n", errmsg? errmsg : "no table");
+	goto done;
+    }
+
+    if (table->algo != AM_COMPRESS_GZIP ||
+	table->block_size != TEST_BLOCK_SIZE ||
+	table->uncomp_size != TEST_DATA_SIZE ||
+	table->entries->len != nblocks) {
+	g_fprintf(stderr, "bad seek table header\n");
+	goto done;
+    }
+
+    if (am_seek_table_find(table, TEST_DATA_SIZE) != NULL) {
+	g_fprintf(stderr, "found a block past the end\n");
+	goto done;
+    }
+
+    /* decompress from the middle, starting with the block holding OFFSET */
+    offset = TEST_BLOCK_SIZE * 4 + 17;
+    entry = am_seek_table_find(table, offset);
+    if (!entry || entry->uncomp_offset != TEST_BLOCK_SIZE * 4 ||
+	entry->uncomp_size != TEST_BLOCK_SIZE) {
+	g_fprintf(stderr, "am_seek_table_find returned the wrong block\n");
+	goto done;
+    }
+
+    uncomp = gunzip(comp->data + entry->comp_offset,
+		    table->comp_size - entry->comp_offset);
+    if (!uncomp ||
+	uncomp->len != TEST_DATA_SIZE - entry->uncomp_offset ||
+	memcmp(uncomp->data, test_data + entry->uncomp_offset, uncomp->len) != 0) {
+	g_fprintf(stderr, "decompression from a block boundary failed\n");
+	goto done;
+    }
+
+    ok = TRUE;
+
+done:
+    if (fd >= 0)
+	close(fd);
+    g_free(filename);
+    g_free(errmsg);
+    am_seek_table_free(table);
+    if (comp)
+	g_byte_array_free(comp, TRUE);
+    if (uncomp)
+	g_byte_array_free(uncomp, TRUE);
+    return ok;
+}
+
+static gboolean
+test_no_seek_table(void)
+{
+    GByteArray *comp;
+    am_seek_table_t *table;
+    char *filename;
+    char *errmsg = NULL;
+    gboolean ok;
+    int fd;
+
+    init_test_data();
+
+    comp = compress_test_data(1, 0);
+    if (!comp)
+	return FALSE;
+
+    filename = g_strdup("amcompress-test.XXXXXX");
+    fd = g_mkstemp(filename);
+    if (fd < 0) {
+	g_fprintf(stderr, "mkstemp: %s\n", strerror(errno));
+	g_free(filename);
+	g_byte_array_free(comp, TRUE);
+	return FALSE;
+    }
+    unlink(filename);
+    g_free(filename);
+
+    ok = full_write(fd, comp->data, comp->len) == comp->len;
+    if (ok) {
+	/* a plain stream has no table; this is not an error */
+	table = am_seek_table_read(fd, 0, comp->len, &errmsg);
+	ok = (table == NULL);
+	am_seek_table_free(table);
+    }
+
+    close(fd);
+    g_free(errmsg);
+    g_byte_array_free(comp, TRUE);
+    return ok;
+}
+
+#endif /* HAVE_LIBZ && HAVE_ZLIB_H */
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_stream, 90),
+	TU_TEST(test_threaded, 90),
+	TU_TEST(test_seek_table, 90),
+	TU_TEST(test_no_seek_table, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+#else
+    g_fprintf(stderr, "No zlib support -- nothing to test\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,1315 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amcompress.h"
+
+#if defined(HAVE_LIBZ) && defined(HAVE_ZLIB_H)
+#define AM_WITH_GZIP
+#include <zlib.h>
+#endif
+#if defined(HAVE_LIBZSTD) && defined(HAVE_ZSTD_H)
+#define AM_WITH_ZSTD
+#include <zstd.h>
+#endif
+#if defined(HAVE_LIBLZ4) && defined(HAVE_LZ4FRAME_H)
+#define AM_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+/* size of the output buffers of the single-threaded compressor */
+#define STREAM_OUTBUF_SIZE (128*1024)
+
+/* largest piece of input given to LZ4F_compressUpdate at once */
+#define LZ4_STREAM_CHUNK (64*1024)
+
+/* seek table frames; see amcompress.h */
+#define SEEK_TABLE_MAGIC	"AMST"
+#define SEEK_FOOTER_MAGIC	"AMSF"
+#define SEEK_FOOTER_PAYLOAD	32
+#define SEEK_ENTRIES_PER_FRAME	8000
+#define GZIP_FRAME_OVERHEAD	(10 + 2 + 4 + 2 + 8)
+#define SKIPPABLE_FRAME_OVERHEAD 8
+
+/* largest block size that fits in a seek table entry */
+#define MAX_BLOCK_SIZE		(1024*1024*1024)
+
+typedef struct seek_size_s {
+    guint32 comp_size;
+    guint32 uncomp_size;
+} seek_size_t;
+
+/* A block compressed by the thread pool */
+typedef struct comp_job_s {
+    char *in;
+    gsize in_size;
+    char *out;
+    gsize out_size;
+    gboolean done;
+    char *errmsg;
+} comp_job_t;
+
+struct am_compress_s {
+    am_compress_algo_t algo;
+    int level;
+    int nthreads;
+    gsize block_size;
+    int flags;
+
+    am_compress_output_fn output;
+    gpointer output_data;
+
+    char *errmsg;
+    gboolean failed;
+    gboolean finished;
+    guint64 bytes_in;
+    guint64 bytes_out;
+
+    /* single-threaded stream state */
+    char *outbuf;
+    gsize outpos;
+    gsize outsize;
+#ifdef AM_WITH_GZIP
+    z_stream zs;
+    gboolean zs_init;
+#endif
+#ifdef AM_WITH_ZSTD
+    ZSTD_CCtx *zcctx;
+#endif
+#ifdef AM_WITH_LZ4
+    LZ4F_cctx *lz4cctx;
+    LZ4F_preferences_t lz4prefs;
+#endif
+
+    /* thread pool state; jobs is in input order, and protected by mutex */
+    GThreadPool *pool;
+    GMutex *mutex;
+    GCond *cond;
+    GQueue *jobs;
+    comp_job_t *cur_job;
+    guint njobs_submitted;
+
+    /* sizes of the blocks emitted, for the seek table */
+    GArray *seek_sizes;
+};
+
+static void set_error(am_compress_t *comp, char *errmsg);
+static gboolean do_output(am_compress_t *comp, gpointer buf, gsize size);
+
+/*
+ * Algorithms
+ */
+
+gboolean
+am_compress_supported(
+    am_compress_algo_t algo)
+{
+    switch (algo) {
+#ifdef AM_WITH_GZIP
+	case AM_COMPRESS_GZIP: return TRUE;
+#endif
+#ifdef AM_WITH_ZSTD
+	case AM_COMPRESS_ZSTD: return TRUE;
+#endif
+#ifdef AM_WITH_LZ4
+	case AM_COMPRESS_LZ4: return TRUE;
+#endif
+	default: return FALSE;
+    }
+}
+
+am_compress_algo_t
+am_compress_algo_from_name(
+    const char *name)
+{
+    if (!name)
+	return AM_COMPRESS_NONE;
+    if (g_str_equal(name, "gzip") || g_str_equal(name, "gz"))
+	return AM_COMPRESS_GZIP;
+    if (g_str_equal(name, "zstd") || g_str_equal(name, "zst"))
+	return AM_COMPRESS_ZSTD;
+    if (g_str_equal(name, "lz4"))
+	return AM_COMPRESS_LZ4;
+    return AM_COMPRESS_NONE;
+}
+
+const char *
+am_compress_algo_name(
+    am_compress_algo_t algo)
+{
+    switch (algo) {
+	case AM_COMPRESS_GZIP: return "gzip";
+	case AM_COMPRESS_ZSTD: return "zstd";
+	case AM_COMPRESS_LZ4:  return "lz4";
+	default:               return "none";
+    }
+}
+
+int
+am_compress_fast_level(
+    am_compress_algo_t algo)
+{
+    switch (algo) {
+	case AM_COMPRESS_LZ4:  return 0;
+	default:               return 1;
+    }
+}
+
+int
+am_compress_best_level(
+    am_compress_algo_t algo)
+{
+    switch (algo) {
+	case AM_COMPRESS_ZSTD: return 19;
+	case AM_COMPRESS_LZ4:  return 12;
+	default:               return 9;
+    }
+}
+
+static int
+default_level(
+    am_compress_algo_t algo)
+{
+    switch (algo) {
+	case AM_COMPRESS_GZIP: return 6;
+	case AM_COMPRESS_ZSTD: return 3;
+	default:               return 0;
+    }
+}
+
+/*
+ * Compression of a whole block, used by the thread pool
+ */
+
+static char *
+compress_block(
+    am_compress_algo_t algo,
+    int level,
+    const char *in,
+    gsize in_size,
+    char **out,
+    gsize *out_size)
+{
+    *out = NULL;
+    *out_size = 0;
+
+    switch (algo) {
+#ifdef AM_WITH_GZIP
+	case AM_COMPRESS_GZIP: {
+	    z_stream zs;
+	    int zerr;
+
+	    memset(&zs, 0, sizeof(zs));
+	    /* 15+16 selects the gzip wrapper */
+	    if (deflateInit2(&zs, level, Z_DEFLATED, 15+16, 8,
+			     Z_DEFAULT_STRATEGY) != Z_OK)
+		return g_strdup_printf("deflateInit2 failed: %s",
+				       zs.msg? zs.msg : "unknown error");
+	    *out_size = deflateBound(&zs, in_size) + 32;
+	    *out = g_malloc(*out_size);
+	    zs.next_in = (Bytef *)in;
+	    zs.avail_in = in_size;
+	    zs.next_out = (Bytef *)*out;
+	    zs.avail_out = *out_size;
+	    zerr = deflate(&zs, Z_FINISH);
+	    if (zerr != Z_STREAM_END) {
+		char *errmsg = g_strdup_printf("deflate failed: %s",
+					zs.msg? zs.msg : "unknown error");
+		deflateEnd(&zs);
+		return errmsg;
+	    }
+	    *out_size = zs.total_out;
+	    deflateEnd(&zs);
+	    return NULL;
+	}
+#endif
+#ifdef AM_WITH_ZSTD
+	case AM_COMPRESS_ZSTD: {
+	    size_t rv;
+
+	    *out_size = ZSTD_compressBound(in_size);
+	    *out = g_malloc(*out_size);
+	    rv = ZSTD_compress(*out, *out_size, in, in_size, level);
+	    if (ZSTD_isError(rv))
+		return g_strdup_printf("ZSTD_compress failed: %s",
+				       ZSTD_getErrorName(rv));
+	    *out_size = rv;
+	    return NULL;
+	}
+#endif
+#ifdef AM_WITH_LZ4
+	case AM_COMPRESS_LZ4: {
+	    LZ4F_preferences_t prefs;
+	    size_t rv;
+
+	    memset(&prefs, 0, sizeof(prefs));
+	    prefs.compressionLevel = level;
+	    prefs.frameInfo.contentSize = in_size;
+	    *out_size = LZ4F_compressFrameBound(in_size, &prefs);
+	    *out = g_malloc(*out_size);
+	    rv = LZ4F_compressFrame(*out, *out_size, in, in_size, &prefs);
+	    if (LZ4F_isError(rv))
+		return g_strdup_printf("LZ4F_compressFrame failed: %s",
+				       LZ4F_getErrorName(rv));
+	    *out_size = rv;
+	    return NULL;
+	}
+#endif
+	default:
+	    return g_strdup_printf("compression algorithm '%s' is not supported",
+				   am_compress_algo_name(algo));
+    }
+}
+
+static void
+compress_job_thread(
+    gpointer data,
+    gpointer user_data)
+{
+    comp_job_t *job = data;
+    am_compress_t *comp = user_data;
+    char *errmsg;
+
+    errmsg = compress_block(comp->algo, comp->level, job->in, job->in_size,
+			    &job->out, &job->out_size);
+    amfree(job->in);
+
+    g_mutex_lock(comp->mutex);
+    job->errmsg = errmsg;
+    job->done = TRUE;
+    g_cond_broadcast(comp->cond);
+    g_mutex_unlock(comp->mutex);
+}
+
+static void
+free_job(
+    comp_job_t *job)
+{
+    g_free(job->in);
+    g_free(job->out);
+    g_free(job->errmsg);
+    g_free(job);
+}
+
+/* Emit the finished jobs at the head of the queue, waiting until at most
+ * WAIT_FOR jobs are still queued. */
+static gboolean
+emit_jobs(
+    am_compress_t *comp,
+    guint wait_for)
+{
+    g_mutex_lock(comp->mutex);
+    while (!g_queue_is_empty(comp->jobs)) {
+	comp_job_t *job = g_queue_peek_head(comp->jobs);
+
+	if (!job->done) {
+	    if (g_queue_get_length(comp->jobs) <= wait_for)
+		break;
+	    g_cond_wait(comp->cond, comp->mutex);
+	    continue;
+	}
+
+	g_queue_pop_head(comp->jobs);
+	g_mutex_unlock(comp->mutex);
+
+	if (job->errmsg) {
+	    set_error(comp, job->errmsg);
+	    job->errmsg = NULL;
+	    free_job(job);
+	    return FALSE;
+	}
+	if (comp->seek_sizes) {
+	    seek_size_t ss;
+	    ss.comp_size = job->out_size;
+	    ss.uncomp_size = job->in_size;
+	    g_array_append_val(comp->seek_sizes, ss);
+	}
+	if (!do_output(comp, job->out, job->out_size)) {
+	    job->out = NULL;
+	    free_job(job);
+	    return FALSE;
+	}
+	job->out = NULL;
+	free_job(job);
+
+	g_mutex_lock(comp->mutex);
+    }
+    g_mutex_unlock(comp->mutex);
+
+    return TRUE;
+}
+
+static gboolean
+submit_job(
+    am_compress_t *comp)
+{
+    comp_job_t *job = comp->cur_job;
+    GError *error = NULL;
+
+    comp->cur_job = NULL;
+    g_mutex_lock(comp->mutex);
+    g_queue_push_tail(comp->jobs, job);
+    g_mutex_unlock(comp->mutex);
+    comp->njobs_submitted++;
+
+    g_thread_pool_push(comp->pool, job, &error);
+    if (error) {
+	set_error(comp, g_strdup_printf("could not start compression thread: %s",
+					error->message));
+	g_error_free(error);
+	return FALSE;
+    }
+
+    /* keep at most two blocks per thread in flight */
+    return emit_jobs(comp, comp->nthreads * 2 - 1);
+}
+
+static gboolean
+threaded_write(
+    am_compress_t *comp,
+    const char *buf,
+    gsize size)
+{
+    while (size > 0) {
+	gsize n;
+
+	if (!comp->cur_job) {
+	    comp->cur_job = g_new0(comp_job_t, 1);
+	    comp->cur_job->in = g_malloc(comp->block_size);
+	}
+
+	n = MIN(size, comp->block_size - comp->cur_job->in_size);
+	memcpy(comp->cur_job->in + comp->cur_job->in_size, buf, n);
+	comp->cur_job->in_size += n;
+	buf += n;
+	size -= n;
+
+	if (comp->cur_job->in_size == comp->block_size) {
+	    if (!submit_job(comp))
+		return FALSE;
+	}
+    }
+
+    return TRUE;
+}
+
+static void
+put_le16(
+    char *p,
+    guint16 v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void
+put_le32(
+    char *p,
+    guint32 v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p+2, v >> 16);
+}
+
+static void
+put_le64(
+    char *p,
+    guint64 v)
+{
+    put_le32(p, v & 0xffffffff);
+    put_le32(p+4, v >> 32);
+}
+
+static guint16
+get_le16(
+    const char *p)
+{
+    const guint8 *u = (const guint8 *)p;
+    return u[0] | (u[1] << 8);
+}
+
+static guint32
+get_le32(
+    const char *p)
+{
+    return get_le16(p) | ((guint32)get_le16(p+2) << 16);
+}
+
+static guint64
+get_le64(
+    const char *p)
+{
+    return get_le32(p) | ((guint64)get_le32(p+4) << 32);
+}
+
+static gsize
+seek_frame_overhead(
+    am_compress_algo_t algo)
+{
+    return algo == AM_COMPRESS_GZIP ? GZIP_FRAME_OVERHEAD
+				    : SKIPPABLE_FRAME_OVERHEAD;
+}
+
+/* Wrap PAYLOAD in a frame ignored by the decompressor of ALGO */
+static char *
+seek_frame(
+    am_compress_algo_t algo,
+    const char *payload,
+    gsize len,
+    gsize *frame_size)
+{
+    char *frame, *p;
+
+    *frame_size = len + seek_frame_overhead(algo);
+    p = frame = g_malloc0(*frame_size);
+    if (algo == AM_COMPRESS_GZIP) {
+	/* ID1 ID2 CM FLG=FEXTRA MTIME(4) XFL OS=unknown */
+	p[0] = (char)0x1f; p[1] = (char)0x8b; p[2] = 8; p[3] = 4;
+	p[9] = (char)255;
+	p += 10;
+	put_le16(p, len + 4);		/* XLEN */
+	p[2] = 'A'; p[3] = 'S';		/* SI1 SI2 */
+	put_le16(p+4, len);		/* LEN */
+	p += 6;
+	memcpy(p, payload, len);
+	p += len;
+	/* an empty, final, fixed-huffman deflate block; CRC32 and ISIZE are 0 */
+	p[0] = 3; p[1] = 0;
+    } else {
+	put_le32(p, AM_SEEK_SKIPPABLE_MAGIC);
+	put_le32(p+4, len);
+	memcpy(p+8, payload, len);
+    }
+
+    return frame;
+}
+
+static gboolean
+write_seek_table(
+    am_compress_t *comp)
+{
+    guint nblocks = comp->seek_sizes->len;
+    guint64 table_bytes = 0;
+    char footer[SEEK_FOOTER_PAYLOAD];
+    char *frame;
+    gsize frame_size;
+    guint i = 0;
+
+    do {
+	guint n = MIN(nblocks - i, SEEK_ENTRIES_PER_FRAME);
+	gsize len = 4 + n * 8;
+	char *payload = g_malloc(len);
+	char *p = payload + 4;
+	guint j;
+
+	memcpy(payload, SEEK_TABLE_MAGIC, 4);
+	for (j = 0; j < n; j++, i++, p += 8) {
+	    seek_size_t *ss = &g_array_index(comp->seek_sizes, seek_size_t, i);
+	    put_le32(p, ss->comp_size);
+	    put_le32(p+4, ss->uncomp_size);
+	}
+	frame = seek_frame(comp->algo, payload, len, &frame_size);
+	g_free(payload);
+	table_bytes += frame_size;
+	if (!do_output(comp, frame, frame_size))
+	    return FALSE;
+    } while (i < nblocks);
+
+    memset(footer, 0, sizeof(footer));
+    memcpy(footer, SEEK_FOOTER_MAGIC, 4);
+    put_le16(footer+4, AM_SEEK_TABLE_VERSION);
+    put_le16(footer+6, comp->algo);
+    put_le32(footer+12, comp->block_size);
+    put_le64(footer+16, nblocks);
+    put_le64(footer+24, table_bytes);
+    frame = seek_frame(comp->algo, footer, sizeof(footer), &frame_size);
+
+    return do_output(comp, frame, frame_size);
+}
+
+static gboolean
+threaded_finish(
+    am_compress_t *comp)
+{
+    /* an empty stream is still a single, empty, frame */
+    if (!comp->cur_job && comp->njobs_submitted == 0) {
+	comp->cur_job = g_new0(comp_job_t, 1);
+	comp->cur_job->in = g_malloc(1);
+    }
+
+    if (comp->cur_job) {
+	if (!submit_job(comp))
+	    return FALSE;
+    }
+
+    if (!emit_jobs(comp, 0))
+	return FALSE;
+
+    if (comp->seek_sizes)
+	return write_seek_table(comp);
+    return TRUE;
+}
+
+/*
+ * Single-threaded streaming compression
+ */
+
+/* emit the current output buffer, if it holds anything */
+static gboolean
+flush_outbuf(
+    am_compress_t *comp)
+{
+    char *buf;
+    gsize size;
+
+    if (comp->outpos == 0)
+	return TRUE;
+
+    buf = comp->outbuf;
+    size = comp->outpos;
+    comp->outbuf = g_malloc(comp->outsize);
+    comp->outpos = 0;
+
+    return do_output(comp, buf, size);
+}
+
+static char *
+stream_init(
+    am_compress_t *comp)
+{
+    comp->outsize = STREAM_OUTBUF_SIZE;
+
+    switch (comp->algo) {
+#ifdef AM_WITH_GZIP
+	case AM_COMPRESS_GZIP:
+	    if (deflateInit2(&comp->zs, comp->level, Z_DEFLATED, 15+16, 8,
+			     Z_DEFAULT_STRATEGY) != Z_OK)
+		return g_strdup_printf("deflateInit2 failed: %s",
+			comp->zs.msg? comp->zs.msg : "unknown error");
+	    comp->zs_init = TRUE;
+	    break;
+#endif
+#ifdef AM_WITH_ZSTD
+	case AM_COMPRESS_ZSTD: {
+	    size_t rv;
+
+	    comp->zcctx = ZSTD_createCCtx();
+	    if (!comp->zcctx)
+		return g_strdup("ZSTD_createCCtx failed");
+	    rv = ZSTD_CCtx_setParameter(comp->zcctx, ZSTD_c_compressionLevel,
+					comp->level);
+	    if (ZSTD_isError(rv))
+		return g_strdup_printf("invalid zstd compression level %d: %s",
+				       comp->level, ZSTD_getErrorName(rv));
+	    comp->outsize = MAX(comp->outsize, ZSTD_CStreamOutSize());
+	    break;
+	}
+#endif
+#ifdef AM_WITH_LZ4
+	case AM_COMPRESS_LZ4: {
+	    size_t rv;
+
+	    rv = LZ4F_createCompressionContext(&comp->lz4cctx, LZ4F_VERSION);
+	    if (LZ4F_isError(rv))
+		return g_strdup_printf("LZ4F_createCompressionContext failed: %s",
+				       LZ4F_getErrorName(rv));
+	    memset(&comp->lz4prefs, 0, sizeof(comp->lz4prefs));
+	    comp->lz4prefs.compressionLevel = comp->level;
+	    comp->outsize = MAX(comp->outsize,
+			LZ4F_compressBound(LZ4_STREAM_CHUNK, &comp->lz4prefs)
+			+ LZ4F_HEADER_SIZE_MAX);
+	    comp->outbuf = g_malloc(comp->outsize);
+	    rv = LZ4F_compressBegin(comp->lz4cctx, comp->outbuf, comp->outsize,
+				    &comp->lz4prefs);
+	    if (LZ4F_isError(rv))
+		return g_strdup_printf("LZ4F_compressBegin failed: %s",
+				       LZ4F_getErrorName(rv));
+	    comp->outpos = rv;
+	    break;
+	}
+#endif
+	default:
+	    return g_strdup_printf("compression algorithm '%s' is not supported",
+				   am_compress_algo_name(comp->algo));
+    }
+
+    if (!comp->outbuf)
+	comp->outbuf = g_malloc(comp->outsize);
+    return NULL;
+}
+
+static gboolean
+stream_write(
+    am_compress_t *comp,
+    const char *buf,
+    gsize size,
+    gboolean finish)
+{
+    switch (comp->algo) {
+#ifdef AM_WITH_GZIP
+	case AM_COMPRESS_GZIP: {
+	    int flush = finish? Z_FINISH : Z_NO_FLUSH;
+	    int zerr;
+
+	    comp->zs.next_in = (Bytef *)buf;
+	    comp->zs.avail_in = size;
+	    do {
+		if (comp->outpos == comp->outsize && !flush_outbuf(comp))
+		    return FALSE;
+		comp->zs.next_out = (Bytef *)comp->outbuf + comp->outpos;
+		comp->zs.avail_out = comp->outsize - comp->outpos;
+		zerr = deflate(&comp->zs, flush);
+		if (zerr != Z_OK && zerr != Z_STREAM_END && zerr != Z_BUF_ERROR) {
+		    set_error(comp, g_strdup_printf("deflate failed: %s",
+			    comp->zs.msg? comp->zs.msg : "unknown error"));
+		    return FALSE;
+		}
+		comp->outpos = comp->outsize - comp->zs.avail_out;
+	    } while (comp->zs.avail_in > 0 ||
+		     (finish && zerr != Z_STREAM_END));
+	    break;
+	}
+#endif
+#ifdef AM_WITH_ZSTD
+	case AM_COMPRESS_ZSTD: {
+	    ZSTD_EndDirective mode = finish? ZSTD_e_end : ZSTD_e_continue;
+	    ZSTD_inBuffer input = { buf, size, 0 };
+	    size_t remaining;
+
+	    do {
+		ZSTD_outBuffer output;
+
+		if (comp->outpos == comp->outsize && !flush_outbuf(comp))
+		    return FALSE;
+		output.dst = comp->outbuf;
+		output.size = comp->outsize;
+		output.pos = comp->outpos;
+		remaining = ZSTD_compressStream2(comp->zcctx, &output, &input,
+						 mode);
+		if (ZSTD_isError(remaining)) {
+		    set_error(comp, g_strdup_printf(
+				"ZSTD_compressStream2 failed: %s",
+				ZSTD_getErrorName(remaining)));
+		    return FALSE;
+		}
+		comp->outpos = output.pos;
+	    } while (input.pos < input.size || (finish && remaining != 0));
+	    break;
+	}
+#endif
+#ifdef AM_WITH_LZ4
+	case AM_COMPRESS_LZ4: {
+	    size_t rv;
+
+	    while (size > 0) {
+		gsize n = MIN(size, LZ4_STREAM_CHUNK);
+
+		if (comp->outsize - comp->outpos <
+			LZ4F_compressBound(n, &comp->lz4prefs) &&
+		    !flush_outbuf(comp))
+		    return FALSE;
+		rv = LZ4F_compressUpdate(comp->lz4cctx,
+				comp->outbuf + comp->outpos,
+				comp->outsize - comp->outpos, buf, n, NULL);
+		if (LZ4F_isError(rv)) {
+		    set_error(comp, g_strdup_printf(
+				"LZ4F_compressUpdate failed: %s",
+				LZ4F_getErrorName(rv)));
+		    return FALSE;
+		}
+		comp->outpos += rv;
+		buf += n;
+		size -= n;
+	    }
+	    if (finish) {
+		if (comp->outsize - comp->outpos <
+			LZ4F_compressBound(0, &comp->lz4prefs) &&
+		    !flush_outbuf(comp))
+		    return FALSE;
+		rv = LZ4F_compressEnd(comp->lz4cctx,
+				comp->outbuf + comp->outpos,
+				comp->outsize - comp->outpos, NULL);
+		if (LZ4F_isError(rv)) {
+		    set_error(comp, g_strdup_printf(
+				"LZ4F_compressEnd failed: %s",
+				LZ4F_getErrorName(rv)));
+		    return FALSE;
+		}
+		comp->outpos += rv;
+	    }
+	    break;
+	}
+#endif
+	default:
+	    set_error(comp, g_strdup("compression algorithm is not supported"));
+	    return FALSE;
+    }
+
+    if (finish)
+	return flush_outbuf(comp);
+    return TRUE;
+}
+
+/*
+ * Public interface
+ */
+
+static void
+set_error(
+    am_compress_t *comp,
+    char *errmsg)
+{
+    g_free(comp->errmsg);
+    comp->errmsg = errmsg;
+    comp->failed = TRUE;
+}
+
+static gboolean
+do_output(
+    am_compress_t *comp,
+    gpointer buf,
+    gsize size)
+{
+    comp->bytes_out += size;
+    if (!comp->output(comp->output_data, buf, size)) {
+	if (!comp->errmsg)
+	    set_error(comp, g_strdup("error writing compressed data"));
+	comp->failed = TRUE;
+	return FALSE;
+    }
+    return TRUE;
+}
+
+am_compress_t *
+am_compress_new(
+    am_compress_algo_t algo,
+    int level,
+    int nthreads,
+    gsize block_size,
+    int flags,
+    am_compress_output_fn output,
+    gpointer output_data,
+    char **errmsg)
+{
+    am_compress_t *comp;
+    char *err;
+
+    if (!am_compress_supported(algo)) {
+	*errmsg = g_strdup_printf("compression algorithm '%s' is not supported",
+				  am_compress_algo_name(algo));
+	return NULL;
+    }
+
+    comp = g_new0(am_compress_t, 1);
+    comp->algo = algo;
+    comp->level = (level == AM_COMPRESS_DEFAULT_LEVEL)? default_level(algo)
+						       : level;
+    comp->nthreads = MAX(nthreads, 1);
+    comp->block_size = block_size? block_size : AM_COMPRESS_DEFAULT_BLOCK_SIZE;
+    comp->block_size = MIN(comp->block_size, MAX_BLOCK_SIZE);
+    comp->flags = flags;
+    comp->output = output;
+    comp->output_data = output_data;
+
+    if (flags & AM_COMPRESS_SEEK_TABLE)
+	comp->seek_sizes = g_array_new(FALSE, FALSE, sizeof(seek_size_t));
+
+    if (comp->nthreads > 1 || (flags & AM_COMPRESS_SEEK_TABLE)) {
+	GError *error = NULL;
+
+	comp->mutex = g_mutex_new();
+	comp->cond = g_cond_new();
+	comp->jobs = g_queue_new();
+	comp->pool = g_thread_pool_new(compress_job_thread, comp,
+				       comp->nthreads, FALSE, &error);
+	if (!comp->pool) {
+	    *errmsg = g_strdup_printf("could not create compression threads: %s",
+			error? error->message : "unknown error");
+	    if (error)
+		g_error_free(error);
+	    am_compress_free(comp);
+	    return NULL;
+	}
+    } else if ((err = stream_init(comp)) != NULL) {
+	*errmsg = err;
+	am_compress_free(comp);
+	return NULL;
+    }
+
+    return comp;
+}
+
+gboolean
+am_compress_write(
+    am_compress_t *comp,
+    gconstpointer buf,
+    gsize size)
+{
+    if (comp->failed)
+	return FALSE;
+    if (comp->finished) {
+	set_error(comp, g_strdup("write after the end of the compressed stream"));
+	return FALSE;
+    }
+    if (size == 0)
+	return TRUE;
+
+    comp->bytes_in += size;
+    if (comp->pool)
+	return threaded_write(comp, buf, size);
+    return stream_write(comp, buf, size, FALSE);
+}
+
+gboolean
+am_compress_finish(
+    am_compress_t *comp)
+{
+    if (comp->failed)
+	return FALSE;
+    if (comp->finished)
+	return TRUE;
+    comp->finished = TRUE;
+
+    if (comp->pool)
+	return threaded_finish(comp);
+    return stream_write(comp, NULL, 0, TRUE);
+}
+
+void
+am_compress_free(
+    am_compress_t *comp)
+{
+    if (!comp)
+	return;
+
+    if (comp->pool) {
+	/* wait for the running jobs */
+	g_thread_pool_free(comp->pool, FALSE, TRUE);
+    }
+    if (comp->jobs) {
+	comp_job_t *job;
+	while ((job = g_queue_pop_head(comp->jobs)) != NULL)
+	    free_job(job);
+	g_queue_free(comp->jobs);
+    }
+    if (comp->cur_job)
+	free_job(comp->cur_job);
+    if (comp->mutex)
+	g_mutex_free(comp->mutex);
+    if (comp->cond)
+	g_cond_free(comp->cond);
+
+#ifdef AM_WITH_GZIP
+    if (comp->zs_init)
+	deflateEnd(&comp->zs);
+#endif
+#ifdef AM_WITH_ZSTD
+    if (comp->zcctx)
+	ZSTD_freeCCtx(comp->zcctx);
+#endif
+#ifdef AM_WITH_LZ4
+    if (comp->lz4cctx)
+	LZ4F_freeCompressionContext(comp->lz4cctx);
+#endif
+
+    if (comp->seek_sizes)
+	g_array_free(comp->seek_sizes, TRUE);
+    g_free(comp->outbuf);
+    g_free(comp->errmsg);
+    g_free(comp);
+}
+
+const char *
+am_compress_error(
+    am_compress_t *comp)
+{
+    return comp->errmsg;
+}
+
+guint64
+am_compress_bytes_in(
+    am_compress_t *comp)
+{
+    return comp->bytes_in;
+}
+
+guint64
+am_compress_bytes_out(
+    am_compress_t *comp)
+{
+    return comp->bytes_out;
+}
+
+/*
+ * Seek table reader
+ */
+
+/* Return the payload of the seek frame at BUF, or NULL if BUF does not hold
+ * a valid frame. */
+static const char *
+parse_seek_frame(
+    am_compress_algo_t algo,
+    const char *buf,
+    gsize size,
+    gsize *payload_len,
+    gsize *frame_size)
+{
+    if (algo == AM_COMPRESS_GZIP) {
+	gsize xlen;
+
+	if (size < GZIP_FRAME_OVERHEAD ||
+	    (guint8)buf[0] != 0x1f || (guint8)buf[1] != 0x8b ||
+	    buf[2] != 8 || buf[3] != 4)
+	    return NULL;
+	xlen = get_le16(buf+10);
+	if (xlen < 4 || buf[12] != 'A' || buf[13] != 'S' ||
+	    get_le16(buf+14) != xlen - 4)
+	    return NULL;
+	*payload_len = xlen - 4;
+	*frame_size = *payload_len + GZIP_FRAME_OVERHEAD;
+	if (*frame_size > size || buf[16 + *payload_len] != 3)
+	    return NULL;
+	return buf + 16;
+    } else {
+	if (size < SKIPPABLE_FRAME_OVERHEAD ||
+	    get_le32(buf) != AM_SEEK_SKIPPABLE_MAGIC)
+	    return NULL;
+	*payload_len = get_le32(buf+4);
+	*frame_size = *payload_len + SKIPPABLE_FRAME_OVERHEAD;
+	if (*frame_size > size)
+	    return NULL;
+	return buf + SKIPPABLE_FRAME_OVERHEAD;
+    }
+}
+
+/* a stream stored in one piece of a file */
+typedef struct fd_stream_s {
+    int fd;
+    off_t start;
+} fd_stream_t;
+
+static gboolean
+read_fd_stream(
+    gpointer data,
+    guint64 offset,
+    char *buf,
+    gsize size)
+{
+    fd_stream_t *fs = (fd_stream_t *)data;
+    off_t pos = fs->start + (off_t)offset;
+
+    if (lseek(fs->fd, pos, SEEK_SET) != pos)
+	return FALSE;
+    return full_read(fs->fd, buf, size) == size;
+}
+
+am_seek_table_t *
+am_seek_table_read(
+    int fd,
+    off_t start,
+    off_t end,
+    char **errmsg)
+{
+    fd_stream_t fs;
+
+    fs.fd = fd;
+    fs.start = start;
+    return am_seek_table_read_fn(read_fd_stream, &fs,
+				 end > start ? (guint64)(end - start) : 0,
+				 errmsg);
+}
+
+am_seek_table_t *
+am_seek_table_read_fn(
+    am_seek_read_fn read_fn,
+    gpointer read_data,
+    guint64 size,
+    char **errmsg)
+{
+    char tail[GZIP_FRAME_OVERHEAD + SEEK_FOOTER_PAYLOAD];
+    am_compress_algo_t algo = AM_COMPRESS_NONE;
+    const char *footer = NULL;
+    gsize footer_size = 0;
+    gsize len, frame_size;
+    guint64 nblocks, table_bytes;
+    guint64 comp_offset = 0, uncomp_offset = 0;
+    char *table = NULL;
+    gsize pos;
+    am_seek_table_t *st;
+
+    *errmsg = NULL;
+    if (size < sizeof(tail)) {
+	*errmsg = g_strdup("no seek table: stream too short");
+	return NULL;
+    }
+    if (!read_fn(read_data, size - sizeof(tail), tail, sizeof(tail))) {
+	*errmsg = g_strdup_printf("can't read the seek table: %s",
+				  strerror(errno));
+	return NULL;
+    }
+
+    /* the footer is either a gzip member, or a shorter skippable frame */
+    if ((footer = parse_seek_frame(AM_COMPRESS_GZIP, tail, sizeof(tail),
+				   &len, &frame_size)) != NULL &&
+	len == SEEK_FOOTER_PAYLOAD) {
+	footer_size = frame_size;
+    } else if ((footer = parse_seek_frame(AM_COMPRESS_ZSTD,
+			tail + sizeof(tail) - SKIPPABLE_FRAME_OVERHEAD - SEEK_FOOTER_PAYLOAD,
+			SKIPPABLE_FRAME_OVERHEAD + SEEK_FOOTER_PAYLOAD,
+			&len, &frame_size)) != NULL &&
+	       len == SEEK_FOOTER_PAYLOAD) {
+	footer_size = frame_size;
+    } else {
+	footer = NULL;
+    }
+    if (!footer || memcmp(footer, SEEK_FOOTER_MAGIC, 4) != 0) {
+	*errmsg = g_strdup("no seek table");
+	return NULL;
+    }
+    if (get_le16(footer+4) != AM_SEEK_TABLE_VERSION) {
+	*errmsg = g_strdup_printf("unsupported seek table version %d",
+				  get_le16(footer+4));
+	return NULL;
+    }
+
+    algo = get_le16(footer+6);
+    nblocks = get_le64(footer+16);
+    table_bytes = get_le64(footer+24);
+    if ((algo != AM_COMPRESS_GZIP && algo != AM_COMPRESS_ZSTD &&
+	 algo != AM_COMPRESS_LZ4) ||
+	(algo == AM_COMPRESS_GZIP) != (footer_size == GZIP_FRAME_OVERHEAD + SEEK_FOOTER_PAYLOAD) ||
+	table_bytes + footer_size > size ||
+	nblocks > table_bytes / 8 ||
+	table_bytes > nblocks * 8 + (nblocks / SEEK_ENTRIES_PER_FRAME + 1) *
+				    (GZIP_FRAME_OVERHEAD + 4)) {
+	*errmsg = g_strdup("invalid seek table footer");
+	return NULL;
+    }
+
+    st = g_new0(am_seek_table_t, 1);
+    st->algo = algo;
+    st->block_size = get_le32(footer+12);
+    st->entries = g_array_sized_new(FALSE, FALSE, sizeof(am_seek_entry_t),
+				    nblocks);
+
+    table = g_malloc(table_bytes);
+    if (!read_fn(read_data, size - footer_size - table_bytes, table, table_bytes)) {
+	*errmsg = g_strdup_printf("can't read the seek table: %s",
+				  strerror(errno));
+	goto error;
+    }
+
+    for (pos = 0; pos < table_bytes; pos += frame_size) {
+	const char *payload = parse_seek_frame(algo, table + pos,
+					       table_bytes - pos,
+					       &len, &frame_size);
+	const char *p;
+
+	if (!payload || len < 4 || (len - 4) % 8 != 0 ||
+	    memcmp(payload, SEEK_TABLE_MAGIC, 4) != 0) {
+	    *errmsg = g_strdup("invalid seek table frame");
+	    goto error;
+	}
+	for (p = payload + 4; p < payload + len; p += 8) {
+	    am_seek_entry_t e;
+
+	    e.comp_offset = comp_offset;
+	    e.uncomp_offset = uncomp_offset;
+	    e.comp_size = get_le32(p);
+	    e.uncomp_size = get_le32(p+4);
+	    comp_offset += e.comp_size;
+	    uncomp_offset += e.uncomp_size;
+	    g_array_append_val(st->entries, e);
+	}
+    }
+
+    if (st->entries->len != nblocks ||
+	comp_offset + table_bytes + footer_size != size) {
+	*errmsg = g_strdup("seek table does not match the stream");
+	goto error;
+    }
+    st->comp_size = comp_offset;
+    st->uncomp_size = uncomp_offset;
+
+    g_free(table);
+    return st;
+
+error:
+    g_free(table);
+    am_seek_table_free(st);
+    return NULL;
+}
+
+const am_seek_entry_t *
+am_seek_table_find(
+    am_seek_table_t *table,
+    guint64 offset)
+{
+    guint lo = 0, hi = table->entries->len;
+
+    if (offset >= table->uncomp_size)
+	return NULL;
+
+    /* find the last block starting at or before OFFSET */
+    while (hi - lo > 1) {
+	guint mid = lo + (hi - lo) / 2;
+	if (g_array_index(table->entries, am_seek_entry_t, mid).uncomp_offset <= offset)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    return &g_array_index(table->entries, am_seek_entry_t, lo);
+}
+
+void
+am_seek_table_free(
+    am_seek_table_t *table)
+{
+    if (!table)
+	return;
+    if (table->entries)
+	g_array_free(table->entries, TRUE);
+    g_free(table);
+}
+
+/*
+ * Whole buffers
+ */
+
+char *
+am_compress_buffer(
+    am_compress_algo_t algo,
+    int level,
+    gconstpointer in,
+    gsize in_size,
+    char **out,
+    gsize *out_size)
+{
+    char *errmsg;
+
+    if (level == AM_COMPRESS_DEFAULT_LEVEL)
+	level = default_level(algo);
+    errmsg = compress_block(algo, level, in, in_size, out, out_size);
+    if (errmsg) {
+	amfree(*out);
+	*out_size = 0;
+    }
+    return errmsg;
+}
+
+char *
+am_uncompress_buffer(
+    am_compress_algo_t algo,
+    gconstpointer in,
+    gsize in_size,
+    char *out,
+    gsize out_size)
+{
+    switch (algo) {
+#ifdef AM_WITH_GZIP
+	case AM_COMPRESS_GZIP: {
+	    z_stream zs;
+	    int zerr;
+
+	    memset(&zs, 0, sizeof(zs));
+	    if (inflateInit2(&zs, 15+16) != Z_OK)
+		return g_strdup_printf("inflateInit2 failed: %s",
+				       zs.msg? zs.msg : "unknown error");
+	    zs.next_in = (Bytef *)in;
+	    zs.avail_in = in_size;
+	    zs.next_out = (Bytef *)out;
+	    zs.avail_out = out_size;
+	    zerr = inflate(&zs, Z_FINISH);
+	    if (zerr != Z_STREAM_END || zs.total_out != out_size) {
+		char *errmsg = g_strdup_printf("inflate failed: %s",
+				zs.msg? zs.msg :
+				zerr == Z_STREAM_END? "wrong uncompressed size"
+						    : "truncated data");
+		inflateEnd(&zs);
+		return errmsg;
+	    }
+	    inflateEnd(&zs);
+	    return NULL;
+	}
+#endif
+#ifdef AM_WITH_ZSTD
+	case AM_COMPRESS_ZSTD: {
+	    size_t rv = ZSTD_decompress(out, out_size, in, in_size);
+
+	    if (ZSTD_isError(rv))
+		return g_strdup_printf("ZSTD_decompress failed: %s",
+				       ZSTD_getErrorName(rv));
+	    if (rv != out_size)
+		return g_strdup("ZSTD_decompress failed: wrong uncompressed size");
+	    return NULL;
+	}
+#endif
+#ifdef AM_WITH_LZ4
+	case AM_COMPRESS_LZ4: {
+	    LZ4F_dctx *dctx;
+	    size_t src_size = in_size;
+	    size_t dst_size = out_size;
+	    size_t rv;
+
+	    rv = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+	    if (LZ4F_isError(rv))
+		return g_strdup_printf("LZ4F_createDecompressionContext failed: %s",
+				       LZ4F_getErrorName(rv));
+	    rv = LZ4F_decompress(dctx, out, &dst_size, in, &src_size, NULL);
+	    LZ4F_freeDecompressionContext(dctx);
+	    if (LZ4F_isError(rv))
+		return g_strdup_printf("LZ4F_decompress failed: %s",
+				       LZ4F_getErrorName(rv));
+	    if (rv != 0 || dst_size != out_size)
+		return g_strdup("LZ4F_decompress failed: wrong uncompressed size");
+	    return NULL;
+	}
+#endif
+	default:
+	    return g_strdup_printf("compression algorithm '%s' is not supported",
+				   am_compress_algo_name(algo));
+    }
+}
+
+char *
+am_skip_frame(
+    am_compress_algo_t algo,
+    gconstpointer payload,
+    gsize len,
+    gsize *frame_size)
+{
+    g_assert(algo != AM_COMPRESS_GZIP || len <= AM_SKIP_FRAME_MAX_PAYLOAD);
+    return seek_frame(algo, payload, len, frame_size);
+}
+
+const char *
+am_skip_frame_parse(
+    am_compress_algo_t algo,
+    gconstpointer buf,
+    gsize size,
+    gsize *payload_len,
+    gsize *frame_size)
+{
+    return parse_seek_frame(algo, buf, size, payload_len, frame_size);
+}
@@ -0,0 +1,274 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* In-process stream compression, used instead of forking COMPRESS_PATH.
+ *
+ * A compressor is fed with am_compress_write() and hands its output, in
+ * order, to an output callback; the callback is always invoked from the
+ * thread calling am_compress_write() or am_compress_finish().  With more
+ * than one thread, the input is cut in blocks of block_size bytes, each
+ * block is compressed by a thread pool into an independent gzip member,
+ * zstd frame or lz4 frame, and the frames are emitted in input order.  The
+ * standard decompressors accept such a concatenation of frames, so the
+ * output is usable with 'gzip -dc', 'zstd -dc' or 'lz4 -dc'.
+ *
+ * With AM_COMPRESS_SEEK_TABLE, a seek table is appended to the blocks.  It
+ * lists the compressed and uncompressed size of each block, so a reader can
+ * start decompressing at any block boundary, since each block is a complete
+ * gzip member or zstd/lz4 frame.  The table is stored in frames that the
+ * decompressors ignore:
+ *
+ *  - for gzip, empty gzip members with an FEXTRA subfield 'A','S';
+ *  - for zstd and lz4, skippable frames with magic AM_SEEK_SKIPPABLE_MAGIC.
+ *
+ * The payload of the table frames is "AMST" followed by, for each block, the
+ * compressed size and the uncompressed size as 32-bit little-endian
+ * integers.  The last frame of the stream is a footer of fixed size, whose
+ * payload is:
+ *
+ *	"AMSF"
+ *	16-bit version (AM_SEEK_TABLE_VERSION)
+ *	16-bit algorithm (am_compress_algo_t)
+ *	32-bit reserved (0)
+ *	32-bit block size
+ *	64-bit number of blocks
+ *	64-bit size of the table frames preceding the footer
+ *
+ * all little-endian, so the table can be found from the end of the stream.
+ */
+
+#ifndef AMCOMPRESS_H
+#define AMCOMPRESS_H
+
+#include <glib.h>
+
+typedef enum {
+    AM_COMPRESS_NONE,
+    AM_COMPRESS_GZIP,
+    AM_COMPRESS_ZSTD,
+    AM_COMPRESS_LZ4,
+} am_compress_algo_t;
+
+/* default size of a block compressed by one thread */
+#define AM_COMPRESS_DEFAULT_BLOCK_SIZE (1024*1024)
+
+/* use the default compression level of the algorithm */
+#define AM_COMPRESS_DEFAULT_LEVEL (-1)
+
+/* flags for am_compress_new */
+#define AM_COMPRESS_SEEK_TABLE	(1 << 0)	/* compress in blocks, and append a seek table */
+
+#define AM_SEEK_TABLE_VERSION	1
+#define AM_SEEK_SKIPPABLE_MAGIC	0x184D2A5EU
+
+/* Called with each piece of compressed output.  The callback takes ownership
+ * of BUF and must g_free it.
+ *
+ * @param data: the output_data given to am_compress_new
+ * @param buf: compressed data
+ * @param size: size of BUF
+ * @returns: FALSE if the data could not be written
+ */
+typedef gboolean (*am_compress_output_fn)(gpointer data, gpointer buf, gsize size);
+
+typedef struct am_compress_s am_compress_t;
+
+/* Return TRUE if ALGO was compiled in.
+ *
+ * @param algo: the algorithm
+ * @returns: TRUE if supported
+ */
+gboolean am_compress_supported(am_compress_algo_t algo);
+
+/* Convert between an algorithm and its name ("gzip", "zstd", "lz4" or
+ * "none").  am_compress_algo_from_name returns AM_COMPRESS_NONE for an
+ * unknown name.
+ */
+am_compress_algo_t am_compress_algo_from_name(const char *name);
+const char *am_compress_algo_name(am_compress_algo_t algo);
+
+/* The compression levels equivalent to COMPRESS_FAST_OPT and
+ * COMPRESS_BEST_OPT for ALGO.
+ */
+int am_compress_fast_level(am_compress_algo_t algo);
+int am_compress_best_level(am_compress_algo_t algo);
+
+/* Create a new compressor.
+ *
+ * @param algo: the algorithm, must be supported
+ * @param level: compression level, or AM_COMPRESS_DEFAULT_LEVEL
+ * @param nthreads: number of compression threads; 0 or 1 compress a single
+ *                  stream in the calling thread, unless AM_COMPRESS_SEEK_TABLE
+ *                  is given
+ * @param block_size: block size for threaded compression, 0 for the default
+ * @param flags: AM_COMPRESS_* flags
+ * @param output: callback receiving the compressed data
+ * @param output_data: passed to OUTPUT
+ * @param errmsg (output): error message if NULL is returned
+ * @returns: the new compressor, or NULL on error
+ */
+am_compress_t *am_compress_new(am_compress_algo_t algo, int level,
+			       int nthreads, gsize block_size, int flags,
+			       am_compress_output_fn output,
+			       gpointer output_data, char **errmsg);
+
+/* Compress SIZE bytes from BUF.  This may block while waiting for the
+ * compression threads.  BUF is not kept after the call returns.
+ *
+ * @returns: FALSE on error, see am_compress_error()
+ */
+gboolean am_compress_write(am_compress_t *comp, gconstpointer buf, gsize size);
+
+/* Compress any remaining data, and emit the end of the stream.  No more
+ * data can be written after this call.
+ *
+ * @returns: FALSE on error, see am_compress_error()
+ */
+gboolean am_compress_finish(am_compress_t *comp);
+
+/* Free a compressor, waiting for any running compression thread.  COMP
+ * can be NULL.
+ */
+void am_compress_free(am_compress_t *comp);
+
+/* @returns: the error message of the last failure, or NULL */
+const char *am_compress_error(am_compress_t *comp);
+
+/* @returns: number of bytes given to / emitted by the compressor */
+guint64 am_compress_bytes_in(am_compress_t *comp);
+guint64 am_compress_bytes_out(am_compress_t *comp);
+
+/*
+ * Seek tables
+ */
+
+typedef struct am_seek_entry_s {
+    guint64 comp_offset;	/* offset of the block in the compressed stream */
+    guint64 uncomp_offset;	/* offset of its data in the uncompressed stream */
+    guint32 comp_size;
+    guint32 uncomp_size;
+} am_seek_entry_t;
+
+typedef struct am_seek_table_s {
+    am_compress_algo_t algo;
+    guint32 block_size;
+    guint64 comp_size;		/* size of the compressed blocks, without the table */
+    guint64 uncomp_size;
+    GArray *entries;		/* of am_seek_entry_t */
+} am_seek_table_t;
+
+/* Read the seek table of the compressed stream stored between offsets START
+ * and END of FD.  FD must be seekable.
+ *
+ * @param fd: the file
+ * @param start: offset of the start of the compressed stream
+ * @param end: offset of the end of the compressed stream
+ * @param errmsg (output): error message if NULL is returned
+ * @returns: the seek table, or NULL if there is none or it is invalid
+ */
+am_seek_table_t *am_seek_table_read(int fd, off_t start, off_t end,
+				    char **errmsg);
+
+/* Read SIZE bytes at OFFSET of a compressed stream into BUF; returns FALSE,
+ * with errno set, on error or if the stream is too short. */
+typedef gboolean (*am_seek_read_fn)(gpointer data, guint64 offset,
+				    char *buf, gsize size);
+
+/* Like am_seek_table_read, for a stream of SIZE bytes that is not stored
+ * as one piece of a file, like a holding file split in chunks.
+ *
+ * @param read_fn: reads the stream
+ * @param read_data: passed to READ_FN
+ * @param size: size of the compressed stream
+ * @param errmsg (output): error message if NULL is returned
+ * @returns: the seek table, or NULL if there is none or it is invalid
+ */
+am_seek_table_t *am_seek_table_read_fn(am_seek_read_fn read_fn,
+				       gpointer read_data, guint64 size,
+				       char **errmsg);
+
+/* Find the block holding byte OFFSET of the uncompressed stream.
+ *
+ * @param table: the seek table
+ * @param offset: offset in the uncompressed stream
+ * @returns: the entry of the block, or NULL if OFFSET is past the end
+ */
+const am_seek_entry_t *am_seek_table_find(am_seek_table_t *table,
+					  guint64 offset);
+
+void am_seek_table_free(am_seek_table_t *table);
+
+/*
+ * Whole buffers and skippable frames
+ *
+ * These let a caller lay out its own file of independently compressed
+ * blocks, with metadata in the same frames as the seek table, so that the
+ * file still decompresses as a whole with the command-line tools.
+ */
+
+/* largest payload of a gzip skippable frame (an FEXTRA subfield) */
+#define AM_SKIP_FRAME_MAX_PAYLOAD (65535 - 4)
+
+/* Compress IN into a single gzip member, zstd frame or lz4 frame.
+ *
+ * @param out (output): the compressed data, to be g_free'd
+ * @param out_size (output): size of OUT
+ * @returns: NULL on success, or an error message
+ */
+char *am_compress_buffer(am_compress_algo_t algo, int level,
+			 gconstpointer in, gsize in_size,
+			 char **out, gsize *out_size);
+
+/* Decompress a single member or frame produced by am_compress_buffer (or a
+ * block of a threaded compressor) into OUT, which must be exactly the
+ * uncompressed size.
+ *
+ * @returns: NULL on success, or an error message
+ */
+char *am_uncompress_buffer(am_compress_algo_t algo,
+			   gconstpointer in, gsize in_size,
+			   char *out, gsize out_size);
+
+/* Wrap PAYLOAD in a frame that the decompressor of ALGO skips; for gzip,
+ * LEN must not exceed AM_SKIP_FRAME_MAX_PAYLOAD.  The seek table uses
+ * payloads starting with "AMST" and "AMSF"; other users should pick their
+ * own 4-byte magic.
+ *
+ * @param frame_size (output): size of the returned frame
+ * @returns: the frame, to be g_free'd
+ */
+char *am_skip_frame(am_compress_algo_t algo, gconstpointer payload, gsize len,
+		    gsize *frame_size);
+
+/* Parse the skippable frame at the start of BUF.
+ *
+ * @param payload_len (output): size of the payload
+ * @param frame_size (output): size of the whole frame
+ * @returns: a pointer to the payload in BUF, or NULL if BUF does not start
+ *           with a complete skippable frame
+ */
+const char *am_skip_frame_parse(am_compress_algo_t algo, gconstpointer buf,
+				gsize size, gsize *payload_len,
+				gsize *frame_size);
+
+#endif /* AMCOMPRESS_H */
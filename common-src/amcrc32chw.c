@@ -29,6 +29,12 @@
 #include <amutil.h>
 #include <amcrc32chw.h>
 
+/* the crcs are combined with PCLMULQDQ only on x86_64 */
+#if defined __PCLMUL__ && defined __x86_64__
+#define CRC32C_CLMUL
+#include <wmmintrin.h>
+#endif
+
 #ifdef __SSE4_2__
 gboolean compiled_with_sse4_2 = TRUE;
 #define POLY 0x82F63B78
@@ -140,13 +146,73 @@ static uint32_t crc32c_long[4][256];
 static uint32_t crc32c_short[4][256];
 static uint32_t crc32c_low[4][256];
 
+#ifdef CRC32C_CLMUL
+gboolean compiled_with_pclmul = TRUE;
+static gboolean use_pclmul = FALSE;
+
+/* Constants for shifting a crc by LONG and SHORT zeros, one, two and three
+ * times, with a carry-less multiplication.  See crc32c_shift_clmul. */
+static uint32_t crc32c_long_k[3];
+static uint32_t crc32c_short_k[3];
+
+/* Return x^n modulo the CRC-32C polynomial, bit-reflected. */
+static uint32_t
+crc32c_x_pow(
+    size_t n)
+{
+    uint32_t p = 0x80000000;	/* x^0 */
+
+    while (n--)
+	p = (p >> 1) ^ ((p & 1) ? POLY : 0);
+    return p;
+}
+
+static void
+crc32c_init_clmul(
+    uint32_t *k,
+    size_t len)
+{
+    int i;
+
+    /* the product of two bit-reflected 32-bit values is shifted by one bit,
+     * and crc32q multiplies by x^32: x^(8*len - 33) makes up for both. */
+    for (i = 0; i < 3; i++)
+	k[i] = crc32c_x_pow(8 * len * (i + 1) - 33);
+}
+
+/* Shift crc by the number of zeros matching k, using PCLMULQDQ; the
+ * reduction modulo the polynomial is done by the crc32 instruction. */
+static inline uint64_t
+crc32c_shift_clmul(
+    uint32_t k,
+    uint64_t crc)
+{
+    __m128i prod = _mm_clmulepi64_si128(_mm_cvtsi32_si128((uint32_t)crc),
+					_mm_cvtsi32_si128(k), 0x00);
+
+    return __builtin_ia32_crc32di(0, (uint64_t)_mm_cvtsi128_si64(prod));
+}
+#else
+gboolean compiled_with_pclmul = FALSE;
+#endif
+
 /* Initialize tables for shifting crcs. */
 void
-crc32c_init_hw(void)
+crc32c_init_hw(
+    gboolean pclmul)
 {
     crc32c_zeros(crc32c_long, LONG);
     crc32c_zeros(crc32c_short, SHORT);
     crc32c_zeros(crc32c_low, LOW);
+#ifdef CRC32C_CLMUL
+    if (pclmul) {
+	crc32c_init_clmul(crc32c_long_k, LONG);
+	crc32c_init_clmul(crc32c_short_k, SHORT);
+    }
+    use_pclmul = pclmul;
+#else
+    (void)pclmul;
+#endif
 }
 
 typedef struct {
@@ -157,8 +223,47 @@ typedef struct {
   } b;
 } multi_b;
 
-/* Compute CRC-32C using the Intel hardware instruction. */
-void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
+#ifdef __x86_64__
+/* Combine the crcs of four consecutive blocks of LEN bytes, the crc of the
+ * first block being crc0. */
+static inline uint64_t
+crc32c_combine4(
+    uint32_t zeros[][256],
+    const uint32_t *k G_GNUC_UNUSED,
+    uint64_t crc0,
+    uint64_t crc1,
+    uint64_t crc2,
+    uint64_t crc3)
+{
+#ifdef CRC32C_CLMUL
+    if (use_pclmul) {
+	/* the three multiplications are independent */
+	return crc32c_shift_clmul(k[2], crc0) ^ crc32c_shift_clmul(k[1], crc1) ^
+	       crc32c_shift_clmul(k[0], crc2) ^ crc3;
+    }
+#endif
+    crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ crc1;
+    crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ crc2;
+    crc0 = crc32c_shift(zeros, (uint32_t)crc0) ^ crc3;
+    return crc0;
+}
+
+/* Store a 64-bit word at a possibly unaligned address */
+static inline void
+store64(
+    uint8_t *dst,
+    uint64_t v)
+{
+    memcpy(dst, &v, sizeof(v));
+}
+#endif
+
+/* Compute CRC-32C using the Intel hardware instruction, copying the data to
+ * dst if it is not NULL.  Copying while computing the crc reads the data
+ * once instead of twice.  This is always inlined, so the copy disappears
+ * from crc32c_add_hw. */
+static inline void crc32c_hw(uint8_t *dst, const uint8_t *buf, size_t len, crc_t *crc) __attribute__((always_inline));
+static inline void crc32c_hw(uint8_t *dst, const uint8_t *buf, size_t len, crc_t *crc)
 {
 
     multi_b next;
@@ -169,6 +274,7 @@ void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
     uint64_t *next64_2;
     uint64_t *next64_3;
     uint64_t crc64_0, crc64_1, crc64_2, crc64_3; /* need to be 64 bits for crc32q */
+    uint64_t v0, v1, v2, v3;
 #else
     uint32_t *next32_1;
     uint32_t *next32_2;
@@ -183,6 +289,8 @@ void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
     /* compute the crc for up to seven leading bytes to bring the data pointer
      * to an eight-byte boundary */
     while (len && ((uintptr_t)next.b.b8 & 7) != 0) {
+	if (dst)
+	    *dst++ = *next.b.b8;
 	crc32_0 = __builtin_ia32_crc32qi(crc32_0, *next.b.b8);
         next.b.b8++;
         len--;
@@ -203,16 +311,33 @@ void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
 	next64_3 = (uint64_t *)(next.b.b64+(LONG/8)*3);
 	end.b.b64 = next64_1;
         do {
-	    crc64_0 = __builtin_ia32_crc32di(crc64_0, *next.b.b64++);
-	    crc64_1 = __builtin_ia32_crc32di(crc64_1, *next64_1++);
-	    crc64_2 = __builtin_ia32_crc32di(crc64_2, *next64_2++);
-	    crc64_3 = __builtin_ia32_crc32di(crc64_3, *next64_3++);
+	    v0 = *next.b.b64++;
+	    v1 = *next64_1++;
+	    v2 = *next64_2++;
+	    v3 = *next64_3++;
+	    crc64_0 = __builtin_ia32_crc32di(crc64_0, v0);
+	    crc64_1 = __builtin_ia32_crc32di(crc64_1, v1);
+	    crc64_2 = __builtin_ia32_crc32di(crc64_2, v2);
+	    crc64_3 = __builtin_ia32_crc32di(crc64_3, v3);
+	    if (dst) {
+		store64(dst, v0);
+		store64(dst + LONG, v1);
+		store64(dst + LONG*2, v2);
+		store64(dst + LONG*3, v3);
+		dst += 8;
+	    }
         } while (next.b.b64 < end.b.b64);
-        crc64_0 = crc32c_shift(crc32c_long, (uint32_t)crc64_0) ^ crc64_1;
-        crc64_0 = crc32c_shift(crc32c_long, (uint32_t)crc64_0) ^ crc64_2;
-        crc64_0 = crc32c_shift(crc32c_long, (uint32_t)crc64_0) ^ crc64_3;
+	crc64_0 = crc32c_combine4(crc32c_long,
+#ifdef CRC32C_CLMUL
+				  crc32c_long_k,
+#else
+				  NULL,
+#endif
+				  crc64_0, crc64_1, crc64_2, crc64_3);
         len -= LONG*4;
 	next.b.b64 = next64_3;
+	if (dst)
+	    dst += LONG*3;
     }
 
     /* do the same thing, but now on SHORT*4 blocks for the remaining data less
@@ -226,28 +351,56 @@ void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
 	next64_3 = (uint64_t *)(next.b.b64+(SHORT/8)*3);
         end.b.b64 = next64_1;
         do {
-	    crc64_0 = __builtin_ia32_crc32di(crc64_0, *next.b.b64++);
-	    crc64_1 = __builtin_ia32_crc32di(crc64_1, *next64_1++);
-	    crc64_2 = __builtin_ia32_crc32di(crc64_2, *next64_2++);
-	    crc64_3 = __builtin_ia32_crc32di(crc64_3, *next64_3++);
+	    v0 = *next.b.b64++;
+	    v1 = *next64_1++;
+	    v2 = *next64_2++;
+	    v3 = *next64_3++;
+	    crc64_0 = __builtin_ia32_crc32di(crc64_0, v0);
+	    crc64_1 = __builtin_ia32_crc32di(crc64_1, v1);
+	    crc64_2 = __builtin_ia32_crc32di(crc64_2, v2);
+	    crc64_3 = __builtin_ia32_crc32di(crc64_3, v3);
+	    if (dst) {
+		store64(dst, v0);
+		store64(dst + SHORT, v1);
+		store64(dst + SHORT*2, v2);
+		store64(dst + SHORT*3, v3);
+		dst += 8;
+	    }
         } while (next.b.b64 < end.b.b64);
-        crc64_0 = crc32c_shift(crc32c_short, crc64_0) ^ crc64_1;
-        crc64_0 = crc32c_shift(crc32c_short, crc64_0) ^ crc64_2;
-        crc64_0 = crc32c_shift(crc32c_short, crc64_0) ^ crc64_3;
+	crc64_0 = crc32c_combine4(crc32c_short,
+#ifdef CRC32C_CLMUL
+				  crc32c_short_k,
+#else
+				  NULL,
+#endif
+				  crc64_0, crc64_1, crc64_2, crc64_3);
         len -= SHORT*4;
 	next.b.b64 = next64_3;
+	if (dst)
+	    dst += SHORT*3;
     }
 
     /* compute the crc on the remaining eight-byte units less than a SHORT*3
      * block */
     end.b.b8 = next.b.b8 + (len - (len & 7));
     while (next.b.b64 < end.b.b64) {
-	crc64_0 = __builtin_ia32_crc32di(crc64_0, *next.b.b64++);
+	v0 = *next.b.b64++;
+	crc64_0 = __builtin_ia32_crc32di(crc64_0, v0);
+	if (dst) {
+	    store64(dst, v0);
+	    dst += 8;
+	}
     }
     len &= 7;
     crc32_0 = (uint32_t)crc64_0;
 
 #else
+    /* the copy is not interleaved on 32-bit systems */
+    if (dst) {
+	memcpy(dst, next.b.b8, len);
+	dst += len;
+    }
+
     /* compute the crc on sets of LONG*4 bytes, executing three independent crc
      * instructions, each on LONG bytes -- this is optimized for the Nehalem,
      * Westmere, Sandy Bridge, and Ivy Bridge architectures, which have a
@@ -306,6 +459,10 @@ void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
 #endif
 
     /* compute the crc for up to seven trailing bytes */
+#ifdef __x86_64__
+    if (dst)
+	memcpy(dst, next.b.b8, len);
+#endif
     crc->crc = crc32_0;
     switch (len) {
         case 7:
@@ -341,11 +498,23 @@ void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
     }
 }
 
+void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc)
+{
+    crc32c_hw(NULL, buf, len, crc);
+}
+
+void crc32c_copy_hw(uint8_t *dst, uint8_t *buf, size_t len, crc_t *crc)
+{
+    crc32c_hw(dst, buf, len, crc);
+}
+
 #else
 gboolean compiled_with_sse4_2 = FALSE;
+gboolean compiled_with_pclmul = FALSE;
 
 void
-crc32c_init_hw(void)
+crc32c_init_hw(
+    gboolean pclmul G_GNUC_UNUSED)
 {
    g_error("crc32c_init_hw is not defined");
 }
@@ -358,4 +527,13 @@ void crc32c_add_hw(
    g_error("crc32c_add_hw is not defined");
 }
 
+void crc32c_copy_hw(
+    uint8_t *dst G_GNUC_UNUSED,
+    uint8_t *buf G_GNUC_UNUSED,
+    size_t len G_GNUC_UNUSED,
+    crc_t *crc G_GNUC_UNUSED)
+{
+   g_error("crc32c_copy_hw is not defined");
+}
+
 #endif
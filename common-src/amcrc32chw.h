@@ -31,7 +31,9 @@
 #include <amutil.h>
 
 extern gboolean compiled_with_sse4_2;
-void crc32c_init_hw(void);
+extern gboolean compiled_with_pclmul;
+void crc32c_init_hw(gboolean pclmul);
 void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc);
+void crc32c_copy_hw(uint8_t *dst, uint8_t *buf, size_t len, crc_t *crc);
 
 #endif /* AMCRCC32HW_H */
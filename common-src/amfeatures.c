@@ -218,6 +218,7 @@ am_init_feature_set(void)
 	am_add_feature(f, fe_sendbackup_req_options_data_shm_control_name);
 	am_add_feature(f, fe_req_options_timestamp);
 	am_add_feature(f, fe_sendbackup_statedone);
+	am_add_feature(f, fe_amidxtaped_seek);
     }
     return f;
 }
@@ -251,6 +251,7 @@ typedef enum {
     fe_sendbackup_stream_cmd,
     fe_sendbackup_stream_cmd_get_dumper_result,
     fe_sendbackup_statedone,
+    fe_amidxtaped_seek,
 
     /*
      * All new features must be inserted immediately *before* this entry.
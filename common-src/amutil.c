@@ -2175,7 +2175,8 @@ make_amanda_tmpdir(void)
 
 #define POLY 0x82F63B78
 #if defined __x86_64__ || defined __i386__ || defined __i486__ || defined __i586__ || defined __i686__
-static int get_sse42(void)
+/* return the feature flags in ecx of cpuid leaf 1 */
+static uint32_t get_cpuid_ecx(void)
 {
     uint32_t op, eax, ebx, ecx, edx;
     op = 1;
@@ -2197,19 +2198,24 @@ static int get_sse42(void)
 		: "cc"
     );
 #endif
-    return (ecx >> 20) & 1;
+    return ecx;
 }
 #else
-static int get_sse42(void)
+static uint32_t get_cpuid_ecx(void)
 {
     return 0;
 }
 #endif
 
+#define CPUID_ECX_PCLMUL	(1 << 1)
+#define CPUID_ECX_SSE42		(1 << 20)
+
 static uint32_t crc_table[16][256];
 static gboolean crc_initialized = FALSE;
 gboolean have_sse42 = FALSE;
+gboolean have_pclmul = FALSE;
 void (* crc32_function)(uint8_t *buf, size_t len, crc_t *crc);
+void (* crc32_copy_function)(uint8_t *dst, uint8_t *buf, size_t len, crc_t *crc);
 
   #include "amcrc32chw.h"
 
@@ -2223,13 +2229,19 @@ make_crc_table(void)
 
     if (!crc_initialized) {
 	if (compiled_with_sse4_2) {
-	    have_sse42 = get_sse42();
+	    uint32_t ecx = get_cpuid_ecx();
+
+	    have_sse42 = !!(ecx & CPUID_ECX_SSE42);
+	    if (compiled_with_pclmul)
+		have_pclmul = !!(ecx & CPUID_ECX_PCLMUL);
 	}
 	if (have_sse42) {
-	    crc32c_init_hw();
+	    crc32c_init_hw(have_pclmul);
 	    crc32_function = &crc32c_add_hw;
+	    crc32_copy_function = &crc32c_copy_hw;
 	} else {
             crc32_function = &crc32_add_16bytes;
+            crc32_copy_function = &crc32_copy_16bytes;
 	}
 
         for (i = 0; i < 256; i++) {
@@ -2358,6 +2370,28 @@ crc32_add_16bytes(
     }
 }
 
+/* The table-driven crc is slower than a copy, so the copy is done in
+ * pieces small enough to still be in the L1 cache when the crc reads them. */
+#define CRC32_COPY_CHUNK 4096
+
+void
+crc32_copy_16bytes(
+    uint8_t *dst,
+    uint8_t *buf,
+    size_t len,
+    crc_t *crc)
+{
+    while (len > 0) {
+	size_t chunk = MIN(len, CRC32_COPY_CHUNK);
+
+	memcpy(dst, buf, chunk);
+	crc32_add_16bytes(dst, chunk, crc);
+	dst += chunk;
+	buf += chunk;
+	len -= chunk;
+    }
+}
+
 void
 crc32_add(
     uint8_t *buf,
@@ -2368,6 +2402,16 @@ crc32_add(
     return;
  }
 
+void
+crc32_add_copy(
+    uint8_t *dst,
+    uint8_t *buf,
+    size_t len,
+    crc_t *crc)
+{
+    crc32_copy_function(dst, buf, len, crc);
+}
+
 uint32_t
 crc32_finish(
     crc_t *crc)
@@ -433,11 +433,17 @@ typedef struct crc_s {
 } crc_t;
 
 extern int have_sse42;
+extern int have_pclmul;
 void make_crc_table(void);
 void crc32_init(crc_t *crc);
 void crc32_add_1byte(uint8_t *buf, size_t len, crc_t *crc);
 void crc32_add_16bytes(uint8_t *buf, size_t len, crc_t *crc);
+void crc32_copy_16bytes(uint8_t *dst, uint8_t *buf, size_t len, crc_t *crc);
 void crc32_add(uint8_t *buf, size_t len, crc_t *crc);
+
+/* Copy LEN bytes from BUF to DST and add them to CRC, reading the data only
+ * once.  The buffers must not overlap. */
+void crc32_add_copy(uint8_t *dst, uint8_t *buf, size_t len, crc_t *crc);
 uint32_t crc32_finish(crc_t *crc);
 void parse_crc(char *s, crc_t *crc);
 
@@ -64,9 +64,10 @@ typedef enum {
     CONF_CHANGERDEV,		CONF_CHANGERFILE,	CONF_LABELSTR,
     CONF_BUMPPERCENT,		CONF_BUMPSIZE,		CONF_BUMPDAYS,
     CONF_BUMPMULT,		CONF_ETIMEOUT,		CONF_DTIMEOUT,
-    CONF_CTIMEOUT,		CONF_TAPELIST,
+    CONF_CTIMEOUT,		CONF_TAPELIST,		CONF_ESTIMATE_REQUESTS,
     CONF_DEVICE_OUTPUT_BUFFER_SIZE,
     CONF_DISKFILE,		CONF_INFOFILE,		CONF_LOGDIR,
+    CONF_INFOFILE_FORMAT,	CONF_BALANCE_ALGORITHM,	CONF_BANDWIDTH_ALLOCATION,
     CONF_LOGFILE,		CONF_DISKDIR,		CONF_DISKSIZE,
     CONF_INDEXDIR,		CONF_NETUSAGE,		CONF_INPARALLEL,
     CONF_DUMPORDER,		CONF_TIMEOUT,		CONF_TPCHANGER,
@@ -97,7 +98,9 @@ typedef enum {
     CONF_RETRY_DUMP,	       CONF_TAPEPOOL,
     CONF_POLICY,               CONF_STORAGE,		CONF_VAULT_STORAGE,
     CONF_CMDFILE,              CONF_REST_API_PORT,	CONF_REST_SSL_CERT,
-    CONF_REST_SSL_KEY,         CONF_ACTIVE_STORAGE,
+    CONF_REST_SSL_KEY,         CONF_ACTIVE_STORAGE,	CONF_RESTORE_STREAMS,
+    CONF_RESTORE_SPOOL_SIZE,
+    CONF_STREAMING_FLUSH,
 
     /* storage setting */
     CONF_SET_NO_REUSE,	       CONF_ERASE_VOLUME,
@@ -123,7 +126,7 @@ typedef enum {
 
     /* holding disk */
     CONF_COMMENT,		CONF_DIRECTORY,		CONF_USE,
-    CONF_CHUNKSIZE,
+    CONF_CHUNKSIZE,		CONF_IO_DEPTH,
 
     /* dump type */
     /*COMMENT,*/		CONF_PROGRAM,		CONF_DUMPCYCLE,
@@ -158,6 +161,12 @@ typedef enum {
     /* protocol config */
     CONF_REP_TRIES,		CONF_CONNECT_TRIES,	CONF_REQ_TRIES,
 
+    /* compression */
+    CONF_COMPRESS_THREADS,
+
+    /* estimates */
+    CONF_ESTIMATE_CACHE_DIR,	CONF_ESTIMATE_CACHE_DAYS,
+
     /* debug config */
     CONF_DEBUG_DAYS,
     CONF_DEBUG_AMANDAD,		CONF_DEBUG_AMIDXTAPED,	CONF_DEBUG_AMINDEXD,
@@ -677,6 +686,9 @@ static void validate_runspercycle(conf_var_t *, val_t *);
 static void validate_bumppercent(conf_var_t *, val_t *);
 static void validate_bumpmult(conf_var_t *, val_t *);
 static void validate_displayunit(conf_var_t *, val_t *);
+static void validate_infofile_format(conf_var_t *, val_t *);
+static void validate_balance_algorithm(conf_var_t *, val_t *);
+static void validate_bandwidth_allocation(conf_var_t *, val_t *);
 static void validate_reserve(conf_var_t *, val_t *);
 static void validate_use(conf_var_t *, val_t *);
 static void validate_chunksize(conf_var_t *, val_t *);
@@ -908,6 +920,7 @@ keytab_t client_keytab[] = {
     { "CLIENT_PORT", CONF_CLIENT_PORT },
     { "CTIMEOUT", CONF_CTIMEOUT },
     { "COMMENT", CONF_COMMENT },
+    { "COMPRESS_THREADS", CONF_COMPRESS_THREADS },
     { "CONF", CONF_CONF },
     { "CONNECT_TRIES", CONF_CONNECT_TRIES },
     { "DEBUG_AMANDAD", CONF_DEBUG_AMANDAD },
@@ -929,6 +942,8 @@ keytab_t client_keytab[] = {
     { "DEBUG_SENDSIZE", CONF_DEBUG_SENDSIZE },
     { "DEBUG_TAPER", CONF_DEBUG_TAPER },
     { "DEFINE", CONF_DEFINE },
+    { "ESTIMATE_CACHE_DAYS", CONF_ESTIMATE_CACHE_DAYS },
+    { "ESTIMATE_CACHE_DIR", CONF_ESTIMATE_CACHE_DIR },
     { "EXECUTE_ON", CONF_EXECUTE_ON },
     { "EXECUTE_WHERE", CONF_EXECUTE_WHERE },
     { "GNUTAR_LIST_DIR", CONF_GNUTAR_LIST_DIR },
@@ -1009,6 +1024,8 @@ keytab_t server_keytab[] = {
     { "AUTOLABEL", CONF_AUTOLABEL },
     { "APPLICATION", CONF_APPLICATION },
     { "APPLICATION_TOOL", CONF_APPLICATION_TOOL },
+    { "BALANCE_ALGORITHM", CONF_BALANCE_ALGORITHM },
+    { "BANDWIDTH_ALLOCATION", CONF_BANDWIDTH_ALLOCATION },
     { "BEST", CONF_BEST },
     { "BLOCKSIZE", CONF_BLOCKSIZE },
     { "BUMPDAYS", CONF_BUMPDAYS },
@@ -1033,6 +1050,7 @@ keytab_t server_keytab[] = {
     { "COMPRATE", CONF_COMPRATE },
     { "COMPRESS", CONF_COMPRESS },
     { "COMPRESS_INDEX", CONF_COMPRESS_INDEX },
+    { "COMPRESS_THREADS", CONF_COMPRESS_THREADS },
     { "CONNECT_TRIES", CONF_CONNECT_TRIES },
     { "CTIMEOUT", CONF_CTIMEOUT },
     { "CUSTOM", CONF_CUSTOM },
@@ -1078,6 +1096,7 @@ keytab_t server_keytab[] = {
     { "ENCRYPT", CONF_ENCRYPT },
     { "ERROR", CONF_ERROR },
     { "ESTIMATE", CONF_ESTIMATE },
+    { "ESTIMATE_REQUESTS", CONF_ESTIMATE_REQUESTS },
     { "ETIMEOUT", CONF_ETIMEOUT },
     { "EXCLUDE", CONF_EXCLUDE },
     { "EXCLUDE_FILE", CONF_EXCLUDE_FILE },
@@ -1103,9 +1122,11 @@ keytab_t server_keytab[] = {
     { "INDEX", CONF_INDEX },
     { "INDEXDIR", CONF_INDEXDIR },
     { "INFOFILE", CONF_INFOFILE },
+    { "INFOFILE_FORMAT", CONF_INFOFILE_FORMAT },
     { "INPARALLEL", CONF_INPARALLEL },
     { "INTERACTIVITY", CONF_INTERACTIVITY },
     { "INTERFACE", CONF_INTERFACE },
+    { "IO_DEPTH", CONF_IO_DEPTH },
     { "KENCRYPT", CONF_KENCRYPT },
     { "KRB5KEYTAB", CONF_KRB5KEYTAB },
     { "KRB5PRINCIPAL", CONF_KRB5PRINCIPAL },
@@ -1193,6 +1214,8 @@ keytab_t server_keytab[] = {
     { "REST_API_PORT", CONF_REST_API_PORT },
     { "REST_SSL_CERT", CONF_REST_SSL_CERT },
     { "REST_SSL_KEY", CONF_REST_SSL_KEY },
+    { "RESTORE_SPOOL_SIZE", CONF_RESTORE_SPOOL_SIZE },
+    { "RESTORE_STREAMS", CONF_RESTORE_STREAMS },
     { "RETRY_DUMP", CONF_RETRY_DUMP },
     { "RETENTION_DAYS", CONF_RETENTION_DAYS },
     { "RETENTION_FULL", CONF_RETENTION_FULL },
@@ -1234,6 +1257,7 @@ keytab_t server_keytab[] = {
     { "STORAGE", CONF_STORAGE },
     { "STRANGE", CONF_STRANGE },
     { "STRATEGY", CONF_STRATEGY },
+    { "STREAMING_FLUSH", CONF_STREAMING_FLUSH },
     { "DEVICE_OUTPUT_BUFFER_SIZE", CONF_DEVICE_OUTPUT_BUFFER_SIZE },
     { "TAG", CONF_TAG },
     { "TAPECYCLE", CONF_TAPECYCLE },
@@ -1372,6 +1396,9 @@ conf_var_t client_var [] = {
    { CONF_CONNECT_TRIES      , CONFTYPE_INT     , read_int     , CNF_CONNECT_TRIES      , validate_positive },
    { CONF_REP_TRIES          , CONFTYPE_INT     , read_int     , CNF_REP_TRIES          , validate_positive },
    { CONF_REQ_TRIES          , CONFTYPE_INT     , read_int     , CNF_REQ_TRIES          , validate_positive },
+   { CONF_COMPRESS_THREADS   , CONFTYPE_INT     , read_int     , CNF_COMPRESS_THREADS   , validate_positive },
+   { CONF_ESTIMATE_CACHE_DIR , CONFTYPE_STR     , read_str     , CNF_ESTIMATE_CACHE_DIR , NULL },
+   { CONF_ESTIMATE_CACHE_DAYS, CONFTYPE_INT     , read_int     , CNF_ESTIMATE_CACHE_DAYS, validate_nonnegative },
    { CONF_DEBUG_DAYS         , CONFTYPE_INT     , read_int     , CNF_DEBUG_DAYS         , NULL },
    { CONF_DEBUG_AMANDAD      , CONFTYPE_INT     , read_int     , CNF_DEBUG_AMANDAD      , validate_debug },
    { CONF_DEBUG_RECOVERY     , CONFTYPE_INT     , read_int     , CNF_DEBUG_RECOVERY     , validate_debug },
@@ -1416,12 +1443,15 @@ conf_var_t server_var [] = {
    { CONF_TAPELIST             , CONFTYPE_STR      , read_str         , CNF_TAPELIST             , NULL },
    { CONF_DISKFILE             , CONFTYPE_STR      , read_str         , CNF_DISKFILE             , NULL },
    { CONF_INFOFILE             , CONFTYPE_STR      , read_str         , CNF_INFOFILE             , NULL },
+   { CONF_INFOFILE_FORMAT      , CONFTYPE_STR      , read_str         , CNF_INFOFILE_FORMAT      , validate_infofile_format },
    { CONF_LOGDIR               , CONFTYPE_STR      , read_str         , CNF_LOGDIR               , NULL },
    { CONF_INDEXDIR             , CONFTYPE_STR      , read_str         , CNF_INDEXDIR             , NULL },
    { CONF_TAPETYPE             , CONFTYPE_IDENT    , read_ident       , CNF_TAPETYPE             , NULL },
    { CONF_HOLDING              , CONFTYPE_IDENTLIST, read_holdingdisk , CNF_HOLDINGDISK          , NULL },
    { CONF_DUMPCYCLE            , CONFTYPE_INT      , read_int         , CNF_DUMPCYCLE            , validate_nonnegative },
    { CONF_RUNSPERCYCLE         , CONFTYPE_INT      , read_int         , CNF_RUNSPERCYCLE         , validate_runspercycle },
+   { CONF_BALANCE_ALGORITHM    , CONFTYPE_STR      , read_str         , CNF_BALANCE_ALGORITHM    , validate_balance_algorithm },
+   { CONF_BANDWIDTH_ALLOCATION , CONFTYPE_STR      , read_str         , CNF_BANDWIDTH_ALLOCATION , validate_bandwidth_allocation },
    { CONF_RUNTAPES             , CONFTYPE_INT      , read_int         , CNF_RUNTAPES             , validate_nonnegative },
    { CONF_TAPECYCLE            , CONFTYPE_INT      , read_int         , CNF_TAPECYCLE            , validate_positive },
    { CONF_BUMPDAYS             , CONFTYPE_INT      , read_int         , CNF_BUMPDAYS             , validate_nonnegative },
@@ -1434,6 +1464,7 @@ conf_var_t server_var [] = {
    { CONF_MAXDUMPS             , CONFTYPE_INT      , read_int         , CNF_MAXDUMPS             , validate_positive },
    { CONF_MAX_DLE_BY_VOLUME    , CONFTYPE_INT      , read_int         , CNF_MAX_DLE_BY_VOLUME    , validate_positive },
    { CONF_ETIMEOUT             , CONFTYPE_INT      , read_int         , CNF_ETIMEOUT             , validate_non_zero },
+   { CONF_ESTIMATE_REQUESTS    , CONFTYPE_INT      , read_int         , CNF_ESTIMATE_REQUESTS    , validate_positive },
    { CONF_DTIMEOUT             , CONFTYPE_INT      , read_int         , CNF_DTIMEOUT             , validate_positive },
    { CONF_CTIMEOUT             , CONFTYPE_INT      , read_int         , CNF_CTIMEOUT             , validate_positive },
    { CONF_DEVICE_OUTPUT_BUFFER_SIZE, CONFTYPE_SIZE , read_size        , CNF_DEVICE_OUTPUT_BUFFER_SIZE, NULL },
@@ -1462,6 +1493,7 @@ conf_var_t server_var [] = {
    { CONF_CONNECT_TRIES        , CONFTYPE_INT      , read_int         , CNF_CONNECT_TRIES        , validate_positive },
    { CONF_REP_TRIES            , CONFTYPE_INT      , read_int         , CNF_REP_TRIES            , validate_positive },
    { CONF_REQ_TRIES            , CONFTYPE_INT      , read_int         , CNF_REQ_TRIES            , validate_positive },
+   { CONF_COMPRESS_THREADS     , CONFTYPE_INT      , read_int         , CNF_COMPRESS_THREADS     , validate_positive },
    { CONF_DEBUG_DAYS           , CONFTYPE_INT      , read_int         , CNF_DEBUG_DAYS           , NULL },
    { CONF_DEBUG_AMANDAD        , CONFTYPE_INT      , read_int         , CNF_DEBUG_AMANDAD        , validate_debug },
    { CONF_DEBUG_RECOVERY       , CONFTYPE_INT      , read_int         , CNF_DEBUG_RECOVERY       , validate_debug },
@@ -1484,6 +1516,9 @@ conf_var_t server_var [] = {
    { CONF_RESERVED_TCP_PORT    , CONFTYPE_INTRANGE , read_intrange    , CNF_RESERVED_TCP_PORT    , validate_reserved_port_range },
    { CONF_UNRESERVED_TCP_PORT  , CONFTYPE_INTRANGE , read_intrange    , CNF_UNRESERVED_TCP_PORT  , validate_unreserved_port_range },
    { CONF_RECOVERY_LIMIT       , CONFTYPE_HOST_LIMIT, read_host_limit , CNF_RECOVERY_LIMIT       , NULL },
+   { CONF_RESTORE_STREAMS      , CONFTYPE_INT      , read_int         , CNF_RESTORE_STREAMS      , validate_positive },
+   { CONF_RESTORE_SPOOL_SIZE   , CONFTYPE_INT64    , read_int64       , CNF_RESTORE_SPOOL_SIZE   , validate_nonnegative },
+   { CONF_STREAMING_FLUSH      , CONFTYPE_BOOLEAN  , read_bool        , CNF_STREAMING_FLUSH      , NULL },
    { CONF_INTERACTIVITY        , CONFTYPE_STR      , read_dinteractivity, CNF_INTERACTIVITY      , NULL },
    { CONF_TAPERSCAN            , CONFTYPE_STR      , read_dtaperscan  , CNF_TAPERSCAN            , NULL },
    { CONF_REPORT_USE_MEDIA     , CONFTYPE_BOOLEAN  , read_bool        , CNF_REPORT_USE_MEDIA     , NULL },
@@ -1583,6 +1618,7 @@ conf_var_t holding_var [] = {
    { CONF_COMMENT  , CONFTYPE_STR   , read_str   , HOLDING_COMMENT  , NULL },
    { CONF_USE      , CONFTYPE_INT64 , read_int64 , HOLDING_DISKSIZE , validate_use },
    { CONF_CHUNKSIZE, CONFTYPE_INT64 , read_int64 , HOLDING_CHUNKSIZE, validate_chunksize },
+   { CONF_IO_DEPTH , CONFTYPE_INT   , read_int   , HOLDING_IO_DEPTH , validate_nonnegative },
    { CONF_UNKNOWN  , CONFTYPE_INT   , NULL       , HOLDING_HOLDING  , NULL }
 };
 
@@ -2543,6 +2579,7 @@ init_holdingdisk_defaults(
     conf_init_int64(&hdcur.value[HOLDING_DISKSIZE] , CONF_UNIT_K, (gint64)0);
                     /* 1 Gb = 1M counted in 1Kb blocks */
     conf_init_int64(&hdcur.value[HOLDING_CHUNKSIZE], CONF_UNIT_K, (gint64)1024*1024);
+    conf_init_int  (&hdcur.value[HOLDING_IO_DEPTH] , CONF_UNIT_NONE, 0);
 }
 
 static void
@@ -5831,6 +5868,57 @@ validate_displayunit(
     conf_parserror(_("displayunit must be k,m,g or t."));
 }
 
+static void
+validate_infofile_format(
+    struct conf_var_s *np G_GNUC_UNUSED,
+    val_t        *val)
+{
+    char *s = val_t__str(val);
+
+    if (g_ascii_strcasecmp(s, "text") == 0 ||
+	g_ascii_strcasecmp(s, "binary") == 0) {
+	/* fold to lower case */
+	for (; *s != '\0'; s++)
+	    *s = g_ascii_tolower(*s);
+	return;
+    }
+    conf_parserror(_("infofile-format must be \"text\" or \"binary\"."));
+}
+
+static void
+validate_balance_algorithm(
+    struct conf_var_s *np G_GNUC_UNUSED,
+    val_t        *val)
+{
+    char *s = val_t__str(val);
+
+    if (g_ascii_strcasecmp(s, "heuristic") == 0 ||
+	g_ascii_strcasecmp(s, "binpack") == 0) {
+	/* fold to lower case */
+	for (; *s != '\0'; s++)
+	    *s = g_ascii_tolower(*s);
+	return;
+    }
+    conf_parserror(_("balance-algorithm must be \"heuristic\" or \"binpack\"."));
+}
+
+static void
+validate_bandwidth_allocation(
+    struct conf_var_s *np G_GNUC_UNUSED,
+    val_t        *val)
+{
+    char *s = val_t__str(val);
+
+    if (g_ascii_strcasecmp(s, "static") == 0 ||
+	g_ascii_strcasecmp(s, "adaptive") == 0) {
+	/* fold to lower case */
+	for (; *s != '\0'; s++)
+	    *s = g_ascii_tolower(*s);
+	return;
+    }
+    conf_parserror(_("bandwidth-allocation must be \"static\" or \"adaptive\"."));
+}
+
 static void
 validate_reserve(
     struct conf_var_s *np G_GNUC_UNUSED,
@@ -6445,12 +6533,15 @@ init_defaults(
     conf_init_str   (&conf_data[CNF_TAPELIST]             , "tapelist");
     conf_init_str   (&conf_data[CNF_DISKFILE]             , "disklist");
     conf_init_str   (&conf_data[CNF_INFOFILE]             , "/usr/adm/amanda/curinfo");
+    conf_init_str   (&conf_data[CNF_INFOFILE_FORMAT]      , "text");
     conf_init_str   (&conf_data[CNF_LOGDIR]               , "/usr/adm/amanda");
     conf_init_str   (&conf_data[CNF_INDEXDIR]             , "/usr/adm/amanda/index");
     conf_init_ident    (&conf_data[CNF_TAPETYPE]             , "DEFAULT_TAPE");
     conf_init_identlist(&conf_data[CNF_HOLDINGDISK]          , NULL);
     conf_init_int      (&conf_data[CNF_DUMPCYCLE]            , CONF_UNIT_NONE, 10);
     conf_init_int      (&conf_data[CNF_RUNSPERCYCLE]         , CONF_UNIT_NONE, 0);
+    conf_init_str   (&conf_data[CNF_BALANCE_ALGORITHM]    , "heuristic");
+    conf_init_str   (&conf_data[CNF_BANDWIDTH_ALLOCATION] , "static");
     conf_init_int      (&conf_data[CNF_TAPECYCLE]            , CONF_UNIT_NONE, 15);
     conf_init_int      (&conf_data[CNF_NETUSAGE]             , CONF_UNIT_K   , 80000);
     conf_init_int      (&conf_data[CNF_INPARALLEL]           , CONF_UNIT_NONE, 10);
@@ -6464,6 +6555,7 @@ init_defaults(
     conf_init_int      (&conf_data[CNF_MAXDUMPS]             , CONF_UNIT_NONE, 1);
     conf_init_int      (&conf_data[CNF_MAX_DLE_BY_VOLUME]    , CONF_UNIT_NONE, 1000000000);
     conf_init_int      (&conf_data[CNF_ETIMEOUT]             , CONF_UNIT_NONE, 300);
+    conf_init_int      (&conf_data[CNF_ESTIMATE_REQUESTS]    , CONF_UNIT_NONE, 1);
     conf_init_int      (&conf_data[CNF_DTIMEOUT]             , CONF_UNIT_NONE, 1800);
     conf_init_int      (&conf_data[CNF_CTIMEOUT]             , CONF_UNIT_NONE, 30);
     conf_init_size     (&conf_data[CNF_DEVICE_OUTPUT_BUFFER_SIZE], CONF_UNIT_NONE, 40*32768);
@@ -6503,6 +6595,9 @@ init_defaults(
     conf_init_int      (&conf_data[CNF_CONNECT_TRIES]        , CONF_UNIT_NONE, 3);
     conf_init_int      (&conf_data[CNF_REP_TRIES]            , CONF_UNIT_NONE, 5);
     conf_init_int      (&conf_data[CNF_REQ_TRIES]            , CONF_UNIT_NONE, 3);
+    conf_init_int      (&conf_data[CNF_COMPRESS_THREADS]     , CONF_UNIT_NONE, 1);
+    conf_init_str      (&conf_data[CNF_ESTIMATE_CACHE_DIR]   , "");
+    conf_init_int      (&conf_data[CNF_ESTIMATE_CACHE_DAYS]  , CONF_UNIT_NONE, 7);
     conf_init_int      (&conf_data[CNF_DEBUG_DAYS]           , CONF_UNIT_NONE, AMANDA_DEBUG_DAYS);
     conf_init_int      (&conf_data[CNF_DEBUG_AMANDAD]        , CONF_UNIT_NONE, 0);
     conf_init_int      (&conf_data[CNF_DEBUG_RECOVERY]       , CONF_UNIT_NONE, 1);
@@ -6541,6 +6636,9 @@ init_defaults(
     conf_init_labelstr(&conf_data[CNF_LABELSTR]);
     conf_init_str(&conf_data[CNF_META_AUTOLABEL], NULL);
     conf_init_host_limit(&conf_data[CNF_RECOVERY_LIMIT]);
+    conf_init_int      (&conf_data[CNF_RESTORE_STREAMS]      , CONF_UNIT_NONE, 1);
+    conf_init_int64    (&conf_data[CNF_RESTORE_SPOOL_SIZE]   , CONF_UNIT_K   , (gint64)1024*1024);
+    conf_init_bool     (&conf_data[CNF_STREAMING_FLUSH]      , 0);
     conf_init_str(&conf_data[CNF_INTERACTIVITY], NULL);
     conf_init_str(&conf_data[CNF_TAPERSCAN], NULL);
     conf_init_str(&conf_data[CNF_HOSTNAME], NULL);
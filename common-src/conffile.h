@@ -495,11 +495,14 @@ typedef enum {
     CNF_TAPELIST,
     CNF_DISKFILE,
     CNF_INFOFILE,
+    CNF_INFOFILE_FORMAT,
     CNF_LOGDIR,
     CNF_INDEXDIR,
     CNF_TAPETYPE,
     CNF_DUMPCYCLE,
     CNF_RUNSPERCYCLE,
+    CNF_BALANCE_ALGORITHM,
+    CNF_BANDWIDTH_ALLOCATION,
     CNF_TAPECYCLE,
     CNF_NETUSAGE,
     CNF_INPARALLEL,
@@ -512,6 +515,7 @@ typedef enum {
     CNF_RUNTAPES,
     CNF_MAXDUMPS,
     CNF_ETIMEOUT,
+    CNF_ESTIMATE_REQUESTS,
     CNF_DTIMEOUT,
     CNF_CTIMEOUT,
     CNF_DEVICE_OUTPUT_BUFFER_SIZE,
@@ -537,6 +541,9 @@ typedef enum {
     CNF_REP_TRIES,
     CNF_CONNECT_TRIES,
     CNF_REQ_TRIES,
+    CNF_COMPRESS_THREADS,
+    CNF_ESTIMATE_CACHE_DIR,
+    CNF_ESTIMATE_CACHE_DAYS,
     CNF_DEBUG_AMANDAD,
     CNF_DEBUG_RECOVERY,
     CNF_DEBUG_AMIDXTAPED,
@@ -563,6 +570,9 @@ typedef enum {
     CNF_DEBUG_DAYS,
     CNF_TAPER_PARALLEL_WRITE,
     CNF_RECOVERY_LIMIT,
+    CNF_RESTORE_STREAMS,
+    CNF_RESTORE_SPOOL_SIZE,
+    CNF_STREAMING_FLUSH,
     CNF_TAPERSCAN,
     CNF_MAX_DLE_BY_VOLUME,
     CNF_EJECT_VOLUME,
@@ -1005,6 +1015,7 @@ typedef enum {
     HOLDING_DISKDIR,
     HOLDING_DISKSIZE,
     HOLDING_CHUNKSIZE,
+    HOLDING_IO_DEPTH,
     HOLDING_HOLDING /* sentinel */
 } holdingdisk_key;
 
@@ -1060,6 +1071,7 @@ char *holdingdisk_key_to_name(int parm);
 #define holdingdisk_get_diskdir(hdisk)   (val_t_to_str(holdingdisk_getconf((hdisk), HOLDING_DISKDIR)))
 #define holdingdisk_get_disksize(hdisk)  (val_t_to_int64(holdingdisk_getconf((hdisk), HOLDING_DISKSIZE)))
 #define holdingdisk_get_chunksize(hdisk) (val_t_to_int64(holdingdisk_getconf((hdisk), HOLDING_CHUNKSIZE)))
+#define holdingdisk_get_io_depth(hdisk)  (val_t_to_int(holdingdisk_getconf((hdisk), HOLDING_IO_DEPTH)))
 
 /* A application-tool interface */
 typedef enum application_e  {
@@ -43,6 +43,37 @@ init_test_buf(void)
     }
 }
 
+static uint8_t copy_buf[SIZE_BUF + 8];
+
+/* check that a copy function copies exactly SIZE bytes and computes the
+ * same crc as REF */
+static int
+check_copy(
+    const char *name,
+    void (*copy_fn)(uint8_t *dst, uint8_t *buf, size_t len, crc_t *crc),
+    uint8_t *src,
+    size_t size,
+    crc_t *ref)
+{
+    crc_t crc;
+    uint8_t *dst = copy_buf + 3;	/* unaligned */
+
+    memset(copy_buf, 0x5a, sizeof(copy_buf));
+    crc32_init(&crc);
+    copy_fn(dst, src, size, &crc);
+
+    if (crc.crc != ref->crc || crc.size != ref->size) {
+	g_fprintf(stderr, " %s %zu %08x:%lld != %08x:%lld\n", name, size, crc32_finish(ref), (long long)ref->size, crc32_finish(&crc), (long long)crc.size);
+	return FALSE;
+    }
+    if (memcmp(dst, src, size) != 0 || copy_buf[2] != 0x5a ||
+	dst[size] != 0x5a) {
+	g_fprintf(stderr, " %s %zu: bad copy\n", name, size);
+	return FALSE;
+    }
+    return TRUE;
+}
+
 static int
 test_size(
     size_t size)
@@ -51,12 +82,14 @@ test_size(
     crc_t crc16;
 #ifdef __SSE4_2__
     crc_t crchw;
+    crc_t crchw_table;
 #endif
 
     crc32_init(&crc1);
     crc32_init(&crc16);
 #ifdef __SSE4_2__
     crc32_init(&crchw);
+    crc32_init(&crchw_table);
 #endif
 
     crc32_add_1byte(test_buf, size, &crc1);
@@ -64,6 +97,11 @@ test_size(
 #ifdef __SSE4_2__
     if (have_sse42) {
 	crc32c_add_hw(test_buf, size, &crchw);
+
+	/* and without the carry-less multiplication */
+	crc32c_init_hw(FALSE);
+	crc32c_add_hw(test_buf, size, &crchw_table);
+	crc32c_init_hw(have_pclmul);
     }
 #endif
 
@@ -78,6 +116,8 @@ test_size(
 	g_fprintf(stderr, " CRC16 %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc16), (long long)crc16.size);
 	return FALSE;
     }
+    if (!check_copy("CRC16 copy", crc32_copy_16bytes, test_buf, size, &crc1))
+	return FALSE;
 #ifdef __SSE4_2__
     if (have_sse42) {
 	if (crc1.crc != crchw.crc ||
@@ -85,11 +125,129 @@ test_size(
 	    g_fprintf(stderr, " CRChw %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crchw), (long long)crchw.size);
 	    return FALSE;
 	}
+	if (crc1.crc != crchw_table.crc ||
+	    crc1.size != crchw_table.size) {
+	    g_fprintf(stderr, " CRChw table %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crchw_table), (long long)crchw_table.size);
+	    return FALSE;
+	}
+	if (!check_copy("CRChw copy", crc32c_copy_hw, test_buf, size, &crc1))
+	    return FALSE;
+	/* an unaligned source takes another path */
+	if (size > 1) {
+	    crc_t crc_unaligned;
+
+	    crc32_init(&crc_unaligned);
+	    crc32_add_1byte(test_buf + 1, size - 1, &crc_unaligned);
+	    if (!check_copy("CRChw copy unaligned", crc32c_copy_hw, test_buf + 1, size - 1, &crc_unaligned))
+		return FALSE;
+	}
     }
 #endif
     return TRUE;
 }
 
+/*
+ * Benchmark: throughput of each kernel.  This takes a while, so it only
+ * runs when crc32-test is invoked with --bench, never from 'make check'.
+ */
+
+#define BENCH_BUF_SIZE (1024*1024)
+#define BENCH_TOTAL_SIZE (256*1024*1024)
+
+static uint8_t *bench_src;
+static uint8_t *bench_dst;
+
+static void
+bench_add(
+    const char *name,
+    void (*add_fn)(uint8_t *buf, size_t len, crc_t *crc),
+    int div)
+{
+    GTimer *timer = g_timer_new();
+    crc_t crc;
+    int i;
+    int n = BENCH_TOTAL_SIZE / BENCH_BUF_SIZE / div;
+    double secs;
+
+    crc32_init(&crc);
+    g_timer_start(timer);
+    for (i = 0; i < n; i++)
+	add_fn(bench_src, BENCH_BUF_SIZE, &crc);
+    secs = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    g_fprintf(stderr, " %-24s %6.2f GB/s\n", name,
+	      secs > 0 ? (double)n * BENCH_BUF_SIZE / secs / 1e9 : 0.0);
+}
+
+static void
+bench_copy(
+    const char *name,
+    void (*copy_fn)(uint8_t *dst, uint8_t *buf, size_t len, crc_t *crc),
+    int div)
+{
+    GTimer *timer = g_timer_new();
+    crc_t crc;
+    int i;
+    int n = BENCH_TOTAL_SIZE / BENCH_BUF_SIZE / div;
+    double secs;
+
+    crc32_init(&crc);
+    g_timer_start(timer);
+    for (i = 0; i < n; i++)
+	copy_fn(bench_dst, bench_src, BENCH_BUF_SIZE, &crc);
+    secs = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    g_fprintf(stderr, " %-24s %6.2f GB/s\n", name,
+	      secs > 0 ? (double)n * BENCH_BUF_SIZE / secs / 1e9 : 0.0);
+}
+
+/* memcpy followed by a separate crc pass, for comparison with the copy
+ * kernels */
+static void
+copy_then_add(
+    uint8_t *dst,
+    uint8_t *buf,
+    size_t len,
+    crc_t *crc)
+{
+    memcpy(dst, buf, len);
+    crc32_add(dst, len, crc);
+}
+
+static void
+benchmark(void)
+{
+    int i;
+
+    bench_src = g_malloc(BENCH_BUF_SIZE);
+    bench_dst = g_malloc(BENCH_BUF_SIZE);
+    for (i = 0; i < BENCH_BUF_SIZE; i++)
+	bench_src[i] = rand();
+
+    g_fprintf(stderr, " benchmark:\n");
+    bench_add("crc32_add_1byte", crc32_add_1byte, 8);
+    bench_add("crc32_add_16bytes", crc32_add_16bytes, 1);
+    bench_copy("crc32_copy_16bytes", crc32_copy_16bytes, 1);
+#ifdef __SSE4_2__
+    if (have_sse42) {
+	crc32c_init_hw(FALSE);
+	bench_add("crc32c_add_hw (table)", crc32c_add_hw, 1);
+	bench_copy("crc32c_copy_hw (table)", crc32c_copy_hw, 1);
+	crc32c_init_hw(have_pclmul);
+	if (have_pclmul) {
+	    bench_add("crc32c_add_hw (pclmul)", crc32c_add_hw, 1);
+	    bench_copy("crc32c_copy_hw (pclmul)", crc32c_copy_hw, 1);
+	}
+    }
+#endif
+    bench_copy("memcpy + crc32_add", copy_then_add, 1);
+
+    g_free(bench_src);
+    g_free(bench_dst);
+}
+
 
 /*
  * Main driver
@@ -97,11 +255,21 @@ test_size(
 
 int
 main(
-    int    argc G_GNUC_UNUSED,
-    char **argv G_GNUC_UNUSED)
+    int    argc,
+    char **argv)
 {
     int i;
     int nb_error = 0;
+    gboolean bench = FALSE;
+
+    for (i = 1; i < argc; i++) {
+	if (g_str_equal(argv[i], "--bench")) {
+	    bench = TRUE;
+	} else {
+	    g_fprintf(stderr, "USAGE: %s [--bench]\n", argv[0]);
+	    return 1;
+	}
+    }
 
     make_crc_table();
     init_test_buf();
@@ -115,6 +283,8 @@ main(
 	g_fprintf(stderr, " FAIL CRC \n");
     } else {
 	g_fprintf(stderr, " PASS CRC\n");
+	if (bench)
+	    benchmark();
     }
     return nb_error;
 }
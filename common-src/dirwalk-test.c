@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "dirwalk.h"
+#include "testutils.h"
+
+#define TEST_DIR	"./dirwalk-test.dir"
+#define TEST_DEPTH	4	/* levels of directories below TEST_DIR */
+#define TEST_FANOUT	4	/* subdirectories per directory */
+#define TEST_FILES	5	/* files per directory, of 0..4 kB */
+
+#define MAX_WORKERS	64
+
+typedef struct counts_s {
+    guint64 files;
+    guint64 dirs;
+    guint64 symlinks;
+    guint64 bytes;
+    gboolean pruned;	/* don't walk into directories named "d0" */
+} counts_t;
+
+static counts_t expected, expected_pruned;
+
+/* make a directory with TEST_FILES files, a symlink, a fifo and, above
+ * TEST_DEPTH, TEST_FANOUT subdirectories */
+static gboolean
+make_tree(
+    const char *dir,
+    int         depth,
+    gboolean    in_d0)
+{
+    char *path;
+    int i;
+
+    for (i = 0; i < TEST_FILES; i++) {
+	int fd;
+	char buf[4096];
+
+	path = g_strdup_printf("%s/f%d", dir, i);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1) {
+	    g_fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	    return FALSE;
+	}
+	memset(buf, 'x', sizeof(buf));
+	if (full_write(fd, buf, 1024 * i) != (size_t)(1024 * i)) {
+	    close(fd);
+	    return FALSE;
+	}
+	close(fd);
+	g_free(path);
+	expected.files++;
+	expected.bytes += 1024 * i;
+	if (!in_d0) {
+	    expected_pruned.files++;
+	    expected_pruned.bytes += 1024 * i;
+	}
+    }
+
+    path = g_strdup_printf("%s/link", dir);
+    if (symlink("f1", path) == -1)
+	return FALSE;
+    g_free(path);
+    expected.symlinks++;
+    if (!in_d0)
+	expected_pruned.symlinks++;
+
+    /* not counted */
+    path = g_strdup_printf("%s/fifo", dir);
+    if (mkfifo(path, 0600) == -1)
+	return FALSE;
+    g_free(path);
+
+    if (depth == TEST_DEPTH)
+	return TRUE;
+
+    for (i = 0; i < TEST_FANOUT; i++) {
+	path = g_strdup_printf("%s/d%d", dir, i);
+	if (mkdir(path, 0700) == -1)
+	    return FALSE;
+	expected.dirs++;
+	/* a pruned directory is still seen, but not its content */
+	if (!in_d0)
+	    expected_pruned.dirs++;
+	if (!make_tree(path, depth + 1, in_d0 || i == 0))
+	    return FALSE;
+	g_free(path);
+    }
+
+    return TRUE;
+}
+
+static void
+remove_tree(
+    const char *dir)
+{
+    DIR *d;
+    struct dirent *f;
+
+    if ((d = opendir(dir)) == NULL)
+	return;
+    while ((f = readdir(d)) != NULL) {
+	char *path;
+	struct stat finfo;
+
+	if (is_dot_or_dotdot(f->d_name))
+	    continue;
+	path = g_strconcat(dir, "/", f->d_name, NULL);
+	if (lstat(path, &finfo) == 0 && S_ISDIR(finfo.st_mode))
+	    remove_tree(path);
+	else
+	    unlink(path);
+	g_free(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+static gboolean
+count_entry(
+    gpointer     data,
+    int          worker,
+    const char  *path,
+    struct stat *finfo)
+{
+    counts_t *c = (counts_t *)data + worker;
+
+    if (S_ISREG(finfo->st_mode)) {
+	c->files++;
+	c->bytes += finfo->st_size;
+    } else if (S_ISDIR(finfo->st_mode)) {
+	c->dirs++;
+	if (c->pruned && g_str_has_suffix(path, "/d0"))
+	    return FALSE;
+    } else if (S_ISLNK(finfo->st_mode)) {
+	c->symlinks++;
+    }
+    return TRUE;
+}
+
+static gboolean
+run_walk(
+    int       nthreads,
+    gboolean  pruned)
+{
+    counts_t counts[MAX_WORKERS];
+    counts_t total, *exp = pruned? &expected_pruned : &expected;
+    dirwalk_stats_t stats;
+    int i;
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < MAX_WORKERS; i++)
+	counts[i].pruned = pruned;
+
+    dirwalk(TEST_DIR, ".", nthreads, DIRWALK_WANT_SIZE, count_entry, NULL,
+	    counts, &stats);
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < MAX_WORKERS; i++) {
+	total.files += counts[i].files;
+	total.dirs += counts[i].dirs;
+	total.symlinks += counts[i].symlinks;
+	total.bytes += counts[i].bytes;
+    }
+
+    tu_dbg("%d threads%s: %ju files, %ju dirs, %ju symlinks, %ju bytes\n",
+	   nthreads, pruned? " (pruned)" : "",
+	   (uintmax_t)total.files, (uintmax_t)total.dirs,
+	   (uintmax_t)total.symlinks, (uintmax_t)total.bytes);
+
+    if (total.files != exp->files || total.dirs != exp->dirs ||
+	total.symlinks != exp->symlinks || total.bytes != exp->bytes) {
+	g_fprintf(stderr, "%d threads%s: expected %ju files, %ju dirs, "
+		  "%ju symlinks, %ju bytes\n", nthreads,
+		  pruned? " (pruned)" : "",
+		  (uintmax_t)exp->files, (uintmax_t)exp->dirs,
+		  (uintmax_t)exp->symlinks, (uintmax_t)exp->bytes);
+	return FALSE;
+    }
+    if (stats.entries != total.files + total.dirs + total.symlinks ||
+	stats.errors != 0) {
+	g_fprintf(stderr, "bad stats: %ju entries, %ju errors\n",
+		  (uintmax_t)stats.entries, (uintmax_t)stats.errors);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+setup(void)
+{
+    remove_tree(TEST_DIR);
+    memset(&expected, 0, sizeof(expected));
+    memset(&expected_pruned, 0, sizeof(expected_pruned));
+    if (mkdir(TEST_DIR, 0700) == -1) {
+	perror(TEST_DIR);
+	return FALSE;
+    }
+    if (!make_tree(TEST_DIR, 0, FALSE)) {
+	perror("make_tree");
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/* skip the top directory, giving its subdirectories instead, and check that
+ * every other directory is entered and left once */
+typedef struct enter_counts_s {
+    counts_t counts[MAX_WORKERS];
+    guint64 entered[MAX_WORKERS];
+    guint64 left[MAX_WORKERS];
+    char *current[MAX_WORKERS];
+    gboolean mixed;	/* an entry of another directory seen in between */
+} enter_counts_t;
+
+static gboolean
+enter_count_entry(
+    gpointer     data,
+    int          worker,
+    const char  *path,
+    struct stat *finfo)
+{
+    enter_counts_t *ec = data;
+    const char *cur = ec->current[worker];
+
+    if (!cur || strncmp(path, cur, strlen(cur)) != 0 ||
+	strchr(path + strlen(cur) + 1, '/') != NULL)
+	ec->mixed = TRUE;
+    return count_entry(ec->counts, worker, path, finfo);
+}
+
+static int
+enter_dir(
+    gpointer     data,
+    int          worker,
+    const char  *path,
+    struct stat *dinfo G_GNUC_UNUSED,
+    GPtrArray   *subdirs)
+{
+    enter_counts_t *ec = data;
+    int i;
+
+    ec->entered[worker]++;
+    if (g_str_equal(path, TEST_DIR "/.")) {
+	for (i = 0; i < TEST_FANOUT; i++)
+	    g_ptr_array_add(subdirs, g_strdup_printf("%s/d%d", path, i));
+	return DIRWALK_SKIP;
+    }
+    g_free(ec->current[worker]);
+    ec->current[worker] = g_strdup(path);
+    return DIRWALK_READ;
+}
+
+static void
+leave_dir(
+    gpointer    data,
+    int         worker,
+    const char *path)
+{
+    enter_counts_t *ec = data;
+
+    if (!ec->current[worker] || !g_str_equal(path, ec->current[worker]))
+	ec->mixed = TRUE;
+    amfree(ec->current[worker]);
+    ec->left[worker]++;
+}
+
+static gboolean
+run_enter_walk(
+    int nthreads)
+{
+    enter_counts_t *ec = g_new0(enter_counts_t, 1);
+    dirwalk_ops_t ops;
+    dirwalk_stats_t stats;
+    guint64 files = 0, dirs = 0, symlinks = 0, bytes = 0;
+    guint64 entered = 0, left = 0, top_bytes = 0;
+    gboolean ok = TRUE;
+    int i;
+
+    memset(&ops, 0, sizeof(ops));
+    ops.entry_fn = enter_count_entry;
+    ops.enter_fn = enter_dir;
+    ops.leave_fn = leave_dir;
+    dirwalk_full(TEST_DIR, ".", nthreads, DIRWALK_WANT_SIZE, &ops, ec, &stats);
+
+    for (i = 0; i < MAX_WORKERS; i++) {
+	files += ec->counts[i].files;
+	dirs += ec->counts[i].dirs;
+	symlinks += ec->counts[i].symlinks;
+	bytes += ec->counts[i].bytes;
+	entered += ec->entered[i];
+	left += ec->left[i];
+	g_free(ec->current[i]);
+    }
+    for (i = 0; i < TEST_FILES; i++)
+	top_bytes += 1024 * i;
+
+    tu_dbg("%d threads (enter): %ju files, %ju dirs, %ju symlinks, "
+	   "%ju entered, %ju left\n", nthreads, (uintmax_t)files,
+	   (uintmax_t)dirs, (uintmax_t)symlinks, (uintmax_t)entered,
+	   (uintmax_t)left);
+
+    /* the entries of the top directory are not seen */
+    if (files != expected.files - TEST_FILES ||
+	dirs != expected.dirs - TEST_FANOUT ||
+	symlinks != expected.symlinks - 1 ||
+	bytes != expected.bytes - top_bytes) {
+	g_fprintf(stderr, "%d threads (enter): wrong counts\n", nthreads);
+	ok = FALSE;
+    }
+    if (stats.skipped != 1 || stats.dirs != expected.dirs ||
+	entered != expected.dirs + 1 || left != expected.dirs) {
+	g_fprintf(stderr, "%d threads (enter): %ju skipped, %ju read, "
+		  "%ju entered, %ju left\n", nthreads,
+		  (uintmax_t)stats.skipped, (uintmax_t)stats.dirs,
+		  (uintmax_t)entered, (uintmax_t)left);
+	ok = FALSE;
+    }
+    if (ec->mixed) {
+	g_fprintf(stderr, "%d threads (enter): entries not between enter and "
+		  "leave of their directory\n", nthreads);
+	ok = FALSE;
+    }
+    g_free(ec);
+    return ok;
+}
+
+/*
+ * Tests
+ */
+
+static gboolean
+test_walk(void)
+{
+    gboolean ok = TRUE;
+
+    if (!setup())
+	return FALSE;
+    ok = ok && run_walk(1, FALSE);
+    ok = ok && run_walk(4, FALSE);
+    ok = ok && run_walk(MAX_WORKERS, FALSE);
+    remove_tree(TEST_DIR);
+    return ok;
+}
+
+static gboolean
+test_prune(void)
+{
+    gboolean ok = TRUE;
+
+    if (!setup())
+	return FALSE;
+    ok = ok && run_walk(1, TRUE);
+    ok = ok && run_walk(8, TRUE);
+    remove_tree(TEST_DIR);
+    return ok;
+}
+
+static gboolean
+test_enter(void)
+{
+    gboolean ok = TRUE;
+
+    if (!setup())
+	return FALSE;
+    ok = ok && run_enter_walk(1);
+    ok = ok && run_enter_walk(8);
+    remove_tree(TEST_DIR);
+    return ok;
+}
+
+/*
+ * Main loop
+ */
+
+int
+main(int argc, char **argv)
+{
+#if defined(G_THREADS_ENABLED) && !defined(G_THREADS_IMPL_NONE)
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_walk, 90),
+	TU_TEST(test_prune, 90),
+	TU_TEST(test_enter, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+#else
+    g_fprintf(stderr, "No thread support on this platform -- nothing to test\n");
+    return 0;
+#endif
+}
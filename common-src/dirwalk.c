@@ -0,0 +1,548 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+#include "amanda.h"
+#include "dirwalk.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_getdents64) && defined(DT_UNKNOWN)
+#define USE_GETDENTS64
+#endif
+#endif
+
+#if defined(HAVE_STATX) && defined(STATX_TYPE)
+#include <sys/sysmacros.h>
+#define USE_STATX
+#endif
+
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN 0
+#endif
+
+/* big enough for a few thousand entries per getdents64 call */
+#define DIRWALK_BUFSIZE		(128*1024)
+#define DIRWALK_MAX_THREADS	32
+
+#ifdef USE_GETDENTS64
+struct linux_dirent64 {
+    guint64		d_ino;
+    gint64		d_off;
+    unsigned short	d_reclen;
+    unsigned char	d_type;
+    char		d_name[];
+};
+#endif
+
+typedef struct walk_s walk_t;
+
+typedef struct worker_s {
+    walk_t  *walk;
+    int      index;
+    GThread *thread;
+
+    /* directories to read; the owner pushes and pops at the tail, thieves
+     * take the oldest, hence largest, subtrees from the head */
+    GMutex  *mutex;
+    GQueue  *stack;
+
+    GString *path;
+    char    *buf;
+    GPtrArray *subdirs;	/* for the enter function */
+
+    guint64  dirs;
+    guint64  skipped;
+    guint64  entries;
+    guint64  errors;
+} worker_t;
+
+struct walk_s {
+    dev_t            dev;
+    int              want;
+    dirwalk_ops_t    ops;
+    gpointer         data;
+
+    int              nthreads;
+    worker_t        *workers;
+
+    gint             pending;	/* directories queued or being read */
+    gint             queued;	/* directories in the stacks */
+    gint             nidle;	/* threads waiting for work */
+    gboolean         done;
+    GMutex          *idle_mutex;
+    GCond           *idle_cond;
+};
+
+int
+dirwalk_default_threads(void)
+{
+    long ncpu = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+	ncpu = 1;
+#endif
+    return (int)CLAMP(ncpu * 2, 4, DIRWALK_MAX_THREADS);
+}
+
+static void
+push_dir(
+    worker_t *w,
+    char     *path)
+{
+    walk_t *walk = w->walk;
+
+    g_atomic_int_inc(&walk->pending);
+    g_mutex_lock(w->mutex);
+    g_queue_push_tail(w->stack, path);
+    g_mutex_unlock(w->mutex);
+    g_atomic_int_inc(&walk->queued);
+
+    /* an idle thread either sees queued != 0 before it sleeps, or is
+     * already counted in nidle and waiting on the condition */
+    if (g_atomic_int_get(&walk->nidle) > 0) {
+	g_mutex_lock(walk->idle_mutex);
+	g_cond_signal(walk->idle_cond);
+	g_mutex_unlock(walk->idle_mutex);
+    }
+}
+
+static char *
+take_dir(
+    worker_t *w)
+{
+    walk_t *walk = w->walk;
+    char *path;
+    int i;
+
+    for (;;) {
+	g_mutex_lock(w->mutex);
+	path = g_queue_pop_tail(w->stack);
+	g_mutex_unlock(w->mutex);
+	if (path) {
+	    g_atomic_int_add(&walk->queued, -1);
+	    return path;
+	}
+
+	for (i = 1; i < walk->nthreads; i++) {
+	    worker_t *victim = &walk->workers[(w->index + i) % walk->nthreads];
+
+	    g_mutex_lock(victim->mutex);
+	    path = g_queue_pop_head(victim->stack);
+	    g_mutex_unlock(victim->mutex);
+	    if (path) {
+		g_atomic_int_add(&walk->queued, -1);
+		return path;
+	    }
+	}
+
+	g_mutex_lock(walk->idle_mutex);
+	g_atomic_int_inc(&walk->nidle);
+	while (!walk->done && g_atomic_int_get(&walk->queued) == 0) {
+	    g_cond_wait(walk->idle_cond, walk->idle_mutex);
+	}
+	g_atomic_int_add(&walk->nidle, -1);
+	if (walk->done) {
+	    g_mutex_unlock(walk->idle_mutex);
+	    return NULL;
+	}
+	g_mutex_unlock(walk->idle_mutex);
+    }
+}
+
+static void
+report_error(
+    worker_t   *w,
+    const char *path,
+    int         err)
+{
+    w->errors++;
+    if (w->walk->ops.error_fn)
+	w->walk->ops.error_fn(w->walk->data, w->index, path, err);
+}
+
+/* lstat NAME, in the directory open on DFD (or -1) at PATH, filling only
+ * the fields of FINFO the walk needs */
+static int
+stat_entry(
+    walk_t      *walk,
+    int          dfd,
+    const char  *name,
+    const char  *path,
+    gboolean     want_all,
+    struct stat *finfo)
+{
+#ifdef USE_STATX
+    static gboolean no_statx = FALSE;
+    struct statx stx;
+    unsigned int mask = STATX_TYPE;
+
+    if (!no_statx) {
+	if (want_all && (walk->want & DIRWALK_WANT_SIZE))
+	    mask |= STATX_SIZE | STATX_BLOCKS;
+	if (want_all && (walk->want & DIRWALK_WANT_TIMES))
+	    mask |= STATX_MTIME | STATX_CTIME;
+	if (statx(dfd >= 0 ? dfd : AT_FDCWD, dfd >= 0 ? name : path,
+		  AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) == 0) {
+	    memset(finfo, 0, sizeof(*finfo));
+	    finfo->st_mode = stx.stx_mode;
+	    finfo->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+	    finfo->st_size = stx.stx_size;
+	    finfo->st_blocks = stx.stx_blocks;
+	    finfo->st_mtime = stx.stx_mtime.tv_sec;
+	    finfo->st_ctime = stx.stx_ctime.tv_sec;
+#ifdef HAVE_STRUCT_STAT_ST_ATIM_TV_NSEC
+	    finfo->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+	    finfo->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+#endif
+	    return 0;
+	}
+	if (errno != ENOSYS)
+	    return -1;
+	/* the C library has statx, but not the kernel */
+	no_statx = TRUE;
+    }
+#else
+    (void)walk;
+    (void)dfd;
+    (void)name;
+    (void)want_all;
+#endif
+    return lstat(path, finfo);
+}
+
+static void
+walk_entry(
+    worker_t   *w,
+    int         dfd,
+    const char *name,
+    int         d_type)
+{
+    walk_t *walk = w->walk;
+    size_t base_len = w->path->len;
+    struct stat finfo;
+    int is_dir, is_file;
+    int is_symlink = 0;
+
+    if (is_dot_or_dotdot(name))
+	return;
+
+    g_string_append(w->path, name);
+
+    switch (d_type) {
+#ifdef DT_LNK
+    case DT_LNK:
+	/* symlinks are only counted; they are on the directory's filesystem */
+	memset(&finfo, 0, sizeof(finfo));
+	finfo.st_mode = S_IFLNK;
+	finfo.st_dev = walk->dev;
+	break;
+#endif
+
+#ifdef DT_REG
+    case DT_REG:
+	if (walk->want == 0) {
+	    memset(&finfo, 0, sizeof(finfo));
+	    finfo.st_mode = S_IFREG;
+	    finfo.st_dev = walk->dev;
+	    break;
+	}
+#endif
+	/* FALLTHROUGH */
+    case DT_UNKNOWN:
+	if (stat_entry(walk, dfd, name, w->path->str, TRUE, &finfo) == -1) {
+	    report_error(w, w->path->str, errno);
+	    goto done;
+	}
+	break;
+
+#ifdef DT_DIR
+    case DT_DIR:
+	/* the type and device are all we need of a directory */
+	if (stat_entry(walk, dfd, name, w->path->str, FALSE, &finfo) == -1) {
+	    report_error(w, w->path->str, errno);
+	    goto done;
+	}
+	break;
+#endif
+
+    default:
+	/* devices, fifos, sockets */
+	goto done;
+    }
+
+    is_dir = ((finfo.st_mode & S_IFMT) == S_IFDIR);
+    is_file = ((finfo.st_mode & S_IFMT) == S_IFREG);
+#ifdef S_IFLNK
+    is_symlink = ((finfo.st_mode & S_IFMT) == S_IFLNK);
+#endif
+    if (!(is_file || is_dir || is_symlink))
+	goto done;
+    if (finfo.st_dev != walk->dev)
+	goto done;
+
+    w->entries++;
+    if (walk->ops.entry_fn(walk->data, w->index, w->path->str, &finfo) && is_dir)
+	push_dir(w, g_strdup(w->path->str));
+
+done:
+    g_string_truncate(w->path, base_len);
+}
+
+static void
+read_dir(
+    worker_t   *w,
+    const char *dirname)
+{
+#ifdef USE_GETDENTS64
+    int fd;
+    long n, pos;
+#else
+    DIR *d;
+    struct dirent *f;
+#endif
+
+    g_string_assign(w->path, dirname);
+    if (w->path->len == 0 || w->path->str[w->path->len - 1] != '/')
+	g_string_append_c(w->path, '/');
+
+#ifdef USE_GETDENTS64
+    fd = open(dirname, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+	report_error(w, dirname, errno);
+	return;
+    }
+    w->dirs++;
+    while ((n = syscall(SYS_getdents64, fd, w->buf, DIRWALK_BUFSIZE)) > 0) {
+	for (pos = 0; pos < n; ) {
+	    struct linux_dirent64 *de = (struct linux_dirent64 *)(w->buf + pos);
+
+	    walk_entry(w, fd, de->d_name, de->d_type);
+	    pos += de->d_reclen;
+	}
+    }
+    if (n < 0)
+	report_error(w, dirname, errno);
+    close(fd);
+#else
+    if ((d = opendir(dirname)) == NULL) {
+	report_error(w, dirname, errno);
+	return;
+    }
+    w->dirs++;
+    while ((f = readdir(d)) != NULL) {
+#ifdef _DIRENT_HAVE_D_TYPE
+	walk_entry(w, -1, f->d_name, f->d_type);
+#else
+	walk_entry(w, -1, f->d_name, DT_UNKNOWN);
+#endif
+    }
+    closedir(d);
+#endif
+}
+
+/* read DIRNAME, unless the enter function skips it */
+static void
+walk_dir(
+    worker_t   *w,
+    const char *dirname)
+{
+    walk_t *walk = w->walk;
+    struct stat dinfo;
+    guint64 errors = w->errors;
+    guint i;
+
+    if (walk->ops.enter_fn) {
+	if (stat(dirname, &dinfo) == -1) {
+	    report_error(w, dirname, errno);
+	    return;
+	}
+	/* a subdirectory given by the enter function may have become a
+	 * mount point since it was seen */
+	if (!S_ISDIR(dinfo.st_mode) || dinfo.st_dev != walk->dev)
+	    return;
+
+	g_ptr_array_set_size(w->subdirs, 0);
+	if (walk->ops.enter_fn(walk->data, w->index, dirname, &dinfo,
+			    w->subdirs) == DIRWALK_SKIP) {
+	    w->skipped++;
+	    for (i = 0; i < w->subdirs->len; i++)
+		push_dir(w, g_ptr_array_index(w->subdirs, i));
+	    g_ptr_array_set_size(w->subdirs, 0);
+	    return;
+	}
+    }
+
+    read_dir(w, dirname);
+
+    if (walk->ops.leave_fn && w->errors == errors)
+	walk->ops.leave_fn(walk->data, w->index, dirname);
+}
+
+static gpointer
+walk_thread(
+    gpointer data)
+{
+    worker_t *w = data;
+    walk_t *walk = w->walk;
+    char *dirname;
+
+    while ((dirname = take_dir(w)) != NULL) {
+	walk_dir(w, dirname);
+	g_free(dirname);
+
+	if (g_atomic_int_dec_and_test(&walk->pending)) {
+	    g_mutex_lock(walk->idle_mutex);
+	    walk->done = TRUE;
+	    g_cond_broadcast(walk->idle_cond);
+	    g_mutex_unlock(walk->idle_mutex);
+	}
+    }
+
+    return NULL;
+}
+
+void
+dirwalk(
+    const char       *parent_dir,
+    const char       *start,
+    int               nthreads,
+    int               want,
+    dirwalk_fn        fn,
+    dirwalk_error_fn  error_fn,
+    gpointer          data,
+    dirwalk_stats_t  *stats)
+{
+    dirwalk_ops_t ops;
+
+    memset(&ops, 0, sizeof(ops));
+    ops.entry_fn = fn;
+    ops.error_fn = error_fn;
+    dirwalk_full(parent_dir, start, nthreads, want, &ops, data, stats);
+}
+
+void
+dirwalk_full(
+    const char          *parent_dir,
+    const char          *start,
+    int                  nthreads,
+    int                  want,
+    const dirwalk_ops_t *ops,
+    gpointer             data,
+    dirwalk_stats_t     *stats)
+{
+    walk_t walk;
+    struct stat finfo;
+    GTimer *timer;
+    int i;
+
+    if (stats)
+	memset(stats, 0, sizeof(*stats));
+
+    if (stat(parent_dir, &finfo) == -1) {
+	if (ops->error_fn)
+	    ops->error_fn(data, 0, parent_dir, errno);
+	if (stats)
+	    stats->errors++;
+	return;
+    }
+
+    timer = g_timer_new();
+
+    memset(&walk, 0, sizeof(walk));
+    walk.dev = finfo.st_dev;
+    walk.want = want;
+    walk.ops = *ops;
+    walk.data = data;
+    walk.nthreads = CLAMP(nthreads, 1, DIRWALK_MAX_THREADS);
+    walk.idle_mutex = g_mutex_new();
+    walk.idle_cond = g_cond_new();
+    walk.workers = g_new0(worker_t, walk.nthreads);
+    for (i = 0; i < walk.nthreads; i++) {
+	worker_t *w = &walk.workers[i];
+
+	w->walk = &walk;
+	w->index = i;
+	w->mutex = g_mutex_new();
+	w->stack = g_queue_new();
+	w->path = g_string_sized_new(1024);
+	w->subdirs = g_ptr_array_new();
+#ifdef USE_GETDENTS64
+	w->buf = g_malloc(DIRWALK_BUFSIZE);
+#endif
+    }
+
+    push_dir(&walk.workers[0],
+	     g_strjoin(NULL, parent_dir, "/", start, NULL));
+
+    /* the calling thread is worker 0 */
+    for (i = 1; i < walk.nthreads; i++) {
+	walk.workers[i].thread = g_thread_create(walk_thread,
+					(gpointer)&walk.workers[i], TRUE, NULL);
+	if (!walk.workers[i].thread) {
+	    /* make do with the threads we have; each of them steals from the
+	     * whole array, so the missing ones are never waited for */
+	    g_debug("dirwalk: could only start %d threads", i);
+	    break;
+	}
+    }
+    walk_thread(&walk.workers[0]);
+
+    /* all threads must be done before any stack is freed, as they look
+     * into each other's until the end */
+    for (i = 1; i < walk.nthreads; i++) {
+	if (walk.workers[i].thread)
+	    g_thread_join(walk.workers[i].thread);
+    }
+
+    for (i = 0; i < walk.nthreads; i++) {
+	worker_t *w = &walk.workers[i];
+
+	if (stats) {
+	    stats->dirs += w->dirs;
+	    stats->skipped += w->skipped;
+	    stats->entries += w->entries;
+	    stats->errors += w->errors;
+	}
+	g_mutex_free(w->mutex);
+	g_queue_free(w->stack);
+	g_string_free(w->path, TRUE);
+	g_ptr_array_free(w->subdirs, TRUE);
+	g_free(w->buf);
+    }
+    g_free(walk.workers);
+    g_mutex_free(walk.idle_mutex);
+    g_cond_free(walk.idle_cond);
+
+    if (stats)
+	stats->seconds = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+}
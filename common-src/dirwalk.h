@@ -0,0 +1,127 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Parallel directory tree walker
+ *
+ * A walk visits every regular file, directory and symlink below a directory,
+ * staying on the filesystem of that directory, from several threads.  Each
+ * thread keeps its own stack of directories to read, and takes directories
+ * from the others when its stack is empty, so a few large subtrees keep all
+ * the threads busy.
+ *
+ * On Linux, directories are read with getdents64 in large batches, and
+ * entries are examined with statx, asking only for the fields the caller
+ * needs; the type from the directory entry saves the stat of symlinks
+ * entirely.  Elsewhere, readdir and lstat are used.
+ */
+
+#ifndef DIRWALK_H
+#define DIRWALK_H
+
+#include "amanda.h"
+
+/* Fields of a regular file's struct stat the caller needs.  st_mode and
+ * st_dev are always set; for directories and symlinks, nothing else is. */
+#define DIRWALK_WANT_SIZE	(1 << 0)	/* st_size and st_blocks */
+#define DIRWALK_WANT_TIMES	(1 << 1)	/* st_mtime and st_ctime */
+
+/* Called, from any of the walker threads, for each regular file, directory
+ * and symlink.  PATH is the parent directory given to dirwalk(), then '/',
+ * then the path relative to it.  WORKER is the index of the calling thread,
+ * below the NTHREADS given to dirwalk(), so that callers can keep per-thread
+ * state without locking.
+ *
+ * @returns: for a directory, whether to walk into it; ignored otherwise
+ */
+typedef gboolean (*dirwalk_fn)(gpointer data, int worker, const char *path,
+			       struct stat *finfo);
+
+/* Called for each directory that can't be read or entry that can't be
+ * examined, with the errno value. */
+typedef void (*dirwalk_error_fn)(gpointer data, int worker, const char *path,
+				 int err);
+
+/* Return values of a dirwalk_enter_fn */
+#define DIRWALK_READ	0
+#define DIRWALK_SKIP	1
+
+/* Called before each directory is read, START included, with the stat() of
+ * the directory.  To skip reading it, return DIRWALK_SKIP; the callback can
+ * then add the paths of subdirectories to walk anyway, allocated with
+ * g_malloc, to SUBDIRS.  They are walked as if they had been found in the
+ * directory, but not given to the dirwalk_fn.
+ *
+ * @returns: DIRWALK_READ or DIRWALK_SKIP
+ */
+typedef int (*dirwalk_enter_fn)(gpointer data, int worker, const char *path,
+				struct stat *dinfo, GPtrArray *subdirs);
+
+/* Called when a directory has been read, unless there was an error reading
+ * it or examining one of its entries.  The enter function, the entries of the
+ * directory and this function are all called from the same thread, so
+ * per-thread state can follow the directory being read. */
+typedef void (*dirwalk_leave_fn)(gpointer data, int worker, const char *path);
+
+typedef struct dirwalk_ops_s {
+    dirwalk_fn       entry_fn;
+    dirwalk_error_fn error_fn;	/* may be NULL */
+    dirwalk_enter_fn enter_fn;	/* may be NULL */
+    dirwalk_leave_fn leave_fn;	/* may be NULL */
+} dirwalk_ops_t;
+
+typedef struct dirwalk_stats_s {
+    guint64 dirs;	/* directories read */
+    guint64 skipped;	/* directories not read, by the enter function */
+    guint64 entries;	/* entries given to the callback */
+    guint64 errors;
+    double  seconds;
+} dirwalk_stats_t;
+
+/* The number of threads to use by default: enough to keep several
+ * requests in flight on a network filesystem, even on a small machine.
+ */
+int dirwalk_default_threads(void);
+
+/* Walk the tree below PARENT_DIR/START (START is usually ".", or an include
+ * path relative to PARENT_DIR), with NTHREADS threads, and return when every
+ * directory has been read.  Only entries on the filesystem of PARENT_DIR are
+ * visited.  START itself is not given to FN.
+ *
+ * @param want: DIRWALK_WANT_* flags
+ * @param error_fn: may be NULL
+ * @param stats (output): may be NULL
+ */
+void dirwalk(const char *parent_dir, const char *start, int nthreads,
+	     int want, dirwalk_fn fn, dirwalk_error_fn error_fn,
+	     gpointer data, dirwalk_stats_t *stats);
+
+/* Like dirwalk(), with the enter and leave functions of OPS. */
+void dirwalk_full(const char *parent_dir, const char *start, int nthreads,
+		  int want, const dirwalk_ops_t *ops, gpointer data,
+		  dirwalk_stats_t *stats);
+
+#endif /* DIRWALK_H */
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "mem-ring.h"
+#include "testutils.h"
+#include "amutil.h"
+
+#define TEST_RING_SIZE	(64*1024)
+#define TEST_BLOCK_SIZE	(4*1024)
+#define TEST_DATA_SIZE	((guint64)64*1024*1024 + 123)
+
+struct ring_test_data {
+    mem_ring_t *ring;
+    gboolean lockfree;
+    gboolean cancelled;
+    guint64 size;
+};
+
+/* write SIZE bytes of a known pattern, in odd-sized pieces */
+static gpointer
+producer_thread(gpointer datap)
+{
+    struct ring_test_data *data = datap;
+    mem_ring_t *ring = data->ring;
+    guint64 pos = 0;
+
+    mem_ring_producer_set_size(ring, TEST_RING_SIZE, TEST_BLOCK_SIZE);
+
+    while (pos < data->size) {
+	uint64_t avail, len, i;
+	guint8 *p;
+
+	avail = mem_ring_producer_wait(ring, TEST_BLOCK_SIZE, &data->cancelled);
+	if (avail == 0)
+	    break;
+
+	len = MIN(avail, ring->ring_size - ring->write_offset);
+	len = MIN(len, 3001);
+	len = MIN(len, data->size - pos);
+	p = (guint8 *)ring->buffer + ring->write_offset;
+	for (i = 0; i < len; i++)
+	    p[i] = (guint8)((pos + i) % 251);
+	mem_ring_producer_push(ring, len);
+	pos += len;
+    }
+
+    mem_ring_producer_eof(ring);
+    return NULL;
+}
+
+/* read and check everything the producer writes; returns the byte count, or
+ * -1 on a mismatch */
+static gint64
+consume(
+    struct ring_test_data *data)
+{
+    mem_ring_t *ring = data->ring;
+    guint64 pos = 0;
+
+    if (data->lockfree)
+	mem_ring_set_lockfree(ring);
+    mem_ring_consumer_set_size(ring, TEST_RING_SIZE, TEST_BLOCK_SIZE);
+
+    while (1) {
+	gboolean eof;
+	uint64_t avail, len, i;
+	guint8 *p;
+
+	avail = mem_ring_consumer_wait(ring, TEST_BLOCK_SIZE, &data->cancelled, &eof);
+	if (avail == 0) {
+	    if (eof || data->cancelled || ring->cancelled)
+		break;
+	    continue;
+	}
+
+	len = MIN(avail, ring->ring_size - ring->read_offset);
+	p = (guint8 *)ring->buffer + ring->read_offset;
+	for (i = 0; i < len; i++) {
+	    if (p[i] != (guint8)((pos + i) % 251)) {
+		g_fprintf(stderr, "mismatch at byte %ju\n", (uintmax_t)(pos + i));
+		return -1;
+	    }
+	}
+	mem_ring_consumer_pop(ring, len);
+	pos += len;
+    }
+
+    return pos;
+}
+
+static gboolean
+run_transfer(
+    gboolean lockfree)
+{
+    struct ring_test_data data;
+    GThread *th;
+    gint64 got;
+
+    data.ring = create_mem_ring();
+    data.lockfree = lockfree;
+    data.cancelled = FALSE;
+    data.size = TEST_DATA_SIZE;
+
+    th = g_thread_create(producer_thread, (gpointer)&data, TRUE, NULL);
+    got = consume(&data);
+    if (got < 0) {
+	/* let the producer finish */
+	mem_ring_cancel(data.ring);
+    }
+    g_thread_join(th);
+    close_mem_ring(data.ring);
+
+    if (got >= 0 && (guint64)got != TEST_DATA_SIZE) {
+	g_fprintf(stderr, "got %ju bytes, expected %ju\n",
+		  (uintmax_t)got, (uintmax_t)TEST_DATA_SIZE);
+	return FALSE;
+    }
+    return got >= 0;
+}
+
+/*
+ * Tests
+ */
+
+static gboolean
+test_locked(void)
+{
+    return run_transfer(FALSE);
+}
+
+static gboolean
+test_lockfree(void)
+{
+    return run_transfer(TRUE);
+}
+
+/* a producer blocked on a full ring must wake up when the ring is cancelled */
+static gboolean
+test_cancel(void)
+{
+    struct ring_test_data data;
+    GThread *th;
+
+    data.ring = create_mem_ring();
+    data.lockfree = TRUE;
+    data.cancelled = FALSE;
+    data.size = TEST_DATA_SIZE;
+
+    th = g_thread_create(producer_thread, (gpointer)&data, TRUE, NULL);
+
+    /* never consume anything, so the producer fills the ring and sleeps */
+    mem_ring_set_lockfree(data.ring);
+    mem_ring_consumer_set_size(data.ring, TEST_RING_SIZE, TEST_BLOCK_SIZE);
+    g_usleep(G_USEC_PER_SEC / 4);
+
+    mem_ring_cancel(data.ring);
+
+    /* if we didn't hang, it's all good */
+    g_thread_join(th);
+    close_mem_ring(data.ring);
+    return TRUE;
+}
+
+/*
+ * Main loop
+ */
+
+int
+main(int argc, char **argv)
+{
+#if defined(G_THREADS_ENABLED) && !defined(G_THREADS_IMPL_NONE)
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_locked, 90),
+	TU_TEST(test_lockfree, 90),
+	TU_TEST(test_cancel, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+#else
+    g_fprintf(stderr, "No thread support on this platform -- nothing to test\n");
+    return 0;
+#endif
+}
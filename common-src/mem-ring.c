@@ -42,6 +42,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <glib.h>
+#if defined HAVE_LINUX_FUTEX_H && defined HAVE_SYS_SYSCALL_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#define USE_FUTEX 1
+#endif
 
 #include "amanda.h"
 #include "glib.h"
@@ -51,6 +56,10 @@
 #define DEFAULT_MEM_RING_BLOCK_SIZE (NETWORK_BLOCK_BYTES)
 #define DEFAULT_MEM_RING_SIZE (DEFAULT_MEM_RING_BLOCK_SIZE*8)
 
+/* bounds of the adaptive spin before sleeping, in polls of the ring */
+#define MEM_RING_MIN_SPIN 16
+#define MEM_RING_MAX_SPIN 4096
+
 static void alloc_mem_ring(mem_ring_t *mem_ring);
 
 mem_ring_t *
@@ -66,6 +75,8 @@ create_mem_ring(void)
     mem_ring->read_offset = 0;
     mem_ring->readx = 0;
     mem_ring->eof_flag = FALSE;
+    mem_ring->producer_spin = MEM_RING_MIN_SPIN;
+    mem_ring->consumer_spin = MEM_RING_MIN_SPIN;
 
     return mem_ring;
 }
@@ -155,3 +166,319 @@ close_mem_ring(
     g_free(mem_ring->buffer);
     g_free(mem_ring);
 }
+
+/*
+ * Lock-free operation
+ */
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define full_barrier() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static inline void
+cpu_relax(void)
+{
+#if defined __x86_64__ || defined __i386__
+    __asm__ volatile("pause" ::: "memory");
+#endif
+}
+
+/* Sleep until *SEQ is no longer OLD.  The seq may change before we sleep, so
+ * this can return early; callers check their condition again. */
+static void
+ring_sleep(
+    mem_ring_t *mem_ring,
+    guint32    *seq,
+    guint32     old,
+    GCond      *cond)
+{
+#ifdef USE_FUTEX
+    (void)mem_ring;
+    (void)cond;
+    syscall(SYS_futex, seq, FUTEX_WAIT_PRIVATE, old, NULL, NULL, 0);
+#else
+    g_mutex_lock(mem_ring->mutex);
+    while (load_acquire(seq) == old && !load_acquire(&mem_ring->cancelled))
+	g_cond_wait(cond, mem_ring->mutex);
+    g_mutex_unlock(mem_ring->mutex);
+#endif
+}
+
+static void
+ring_wake(
+    mem_ring_t *mem_ring,
+    guint32    *seq,
+    GCond      *cond)
+{
+    __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+#ifdef USE_FUTEX
+    (void)mem_ring;
+    (void)cond;
+    syscall(SYS_futex, seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    g_mutex_lock(mem_ring->mutex);
+    g_cond_broadcast(cond);
+    g_mutex_unlock(mem_ring->mutex);
+#endif
+}
+
+/* Wake the other side if it is sleeping until COUNTER reaches *WAIT */
+static inline void
+ring_wake_waiter(
+    mem_ring_t *mem_ring,
+    uint64_t   *wait,
+    uint64_t    counter,
+    guint32    *seq,
+    GCond      *cond)
+{
+    uint64_t target;
+
+    /* pairs with the barrier in the waiter, between setting its wait target
+     * and checking the counter again */
+    full_barrier();
+    target = __atomic_load_n(wait, __ATOMIC_RELAXED);
+    if (target && counter >= target &&
+	__atomic_compare_exchange_n(wait, &target, 0, FALSE,
+				    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+	ring_wake(mem_ring, seq, cond);
+    }
+}
+
+/* Adjust a spin count: spin longer if spinning paid off, shorter if we had to
+ * sleep anyway. */
+static inline guint
+adapt_spin(
+    guint    spin,
+    gboolean spun)
+{
+    if (spun)
+	return MIN(spin * 2, MEM_RING_MAX_SPIN);
+    return MAX(spin / 2, MEM_RING_MIN_SPIN);
+}
+
+void
+mem_ring_set_lockfree(
+    mem_ring_t *mem_ring)
+{
+    g_mutex_lock(mem_ring->mutex);
+    mem_ring->lockfree = TRUE;
+    g_mutex_unlock(mem_ring->mutex);
+}
+
+static inline uint64_t
+producer_free(
+    mem_ring_t *mem_ring)
+{
+    return mem_ring->ring_size - (mem_ring->written - load_acquire(&mem_ring->readx));
+}
+
+uint64_t
+mem_ring_producer_wait(
+    mem_ring_t *mem_ring,
+    uint64_t    need,
+    gboolean   *cancelled)
+{
+    uint64_t free_bytes;
+    guint32 seq;
+    guint i;
+
+    if (!mem_ring->lockfree) {
+	g_mutex_lock(mem_ring->mutex);
+	while (!*cancelled && !mem_ring->cancelled &&
+	       mem_ring->ring_size - (mem_ring->written - mem_ring->readx) < need) {
+	    g_cond_wait(mem_ring->free_cond, mem_ring->mutex);
+	}
+	free_bytes = mem_ring->ring_size - (mem_ring->written - mem_ring->readx);
+	g_mutex_unlock(mem_ring->mutex);
+	return (*cancelled || mem_ring->cancelled)? 0 : free_bytes;
+    }
+
+    for (i = 0; i < mem_ring->producer_spin; i++) {
+	free_bytes = producer_free(mem_ring);
+	if (free_bytes >= need) {
+	    if (i > 0)
+		mem_ring->producer_spin = adapt_spin(mem_ring->producer_spin, TRUE);
+	    return free_bytes;
+	}
+	cpu_relax();
+    }
+    mem_ring->producer_spin = adapt_spin(mem_ring->producer_spin, FALSE);
+
+    while (1) {
+	seq = load_acquire(&mem_ring->free_seq);
+	__atomic_store_n(&mem_ring->free_wait,
+			 mem_ring->written + need - mem_ring->ring_size,
+			 __ATOMIC_RELAXED);
+	full_barrier();
+	free_bytes = producer_free(mem_ring);
+	if (free_bytes >= need || *(volatile gboolean *)cancelled ||
+	    load_acquire(&mem_ring->cancelled))
+	    break;
+	ring_sleep(mem_ring, &mem_ring->free_seq, seq, mem_ring->free_cond);
+    }
+    __atomic_store_n(&mem_ring->free_wait, 0, __ATOMIC_RELAXED);
+
+    if (*(volatile gboolean *)cancelled || load_acquire(&mem_ring->cancelled))
+	return 0;
+    return free_bytes;
+}
+
+void
+mem_ring_producer_push(
+    mem_ring_t *mem_ring,
+    uint64_t    len)
+{
+    uint64_t write_offset = mem_ring->write_offset + len;
+    uint64_t written;
+
+    if (write_offset >= mem_ring->ring_size)
+	write_offset -= mem_ring->ring_size;
+
+    if (!mem_ring->lockfree) {
+	g_mutex_lock(mem_ring->mutex);
+	mem_ring->write_offset = write_offset;
+	mem_ring->written += len;
+	mem_ring->data_avail += len;
+	if (mem_ring->data_avail >= mem_ring->consumer_block_size) {
+	    g_cond_broadcast(mem_ring->add_cond);
+	    mem_ring->data_avail -= mem_ring->consumer_block_size;
+	}
+	g_mutex_unlock(mem_ring->mutex);
+	return;
+    }
+
+    written = mem_ring->written + len;
+    __atomic_store_n(&mem_ring->write_offset, write_offset, __ATOMIC_RELAXED);
+    store_release(&mem_ring->written, written);
+    ring_wake_waiter(mem_ring, &mem_ring->add_wait, written,
+		     &mem_ring->add_seq, mem_ring->add_cond);
+}
+
+void
+mem_ring_producer_eof(
+    mem_ring_t *mem_ring)
+{
+    if (!mem_ring->lockfree) {
+	g_mutex_lock(mem_ring->mutex);
+	mem_ring->eof_flag = TRUE;
+	g_cond_broadcast(mem_ring->add_cond);
+	g_mutex_unlock(mem_ring->mutex);
+	return;
+    }
+
+    store_release(&mem_ring->eof_flag, TRUE);
+    ring_wake(mem_ring, &mem_ring->add_seq, mem_ring->add_cond);
+}
+
+/* called with the acquire load of eof_flag done first, so that the data
+ * counted here is final when *eof is TRUE */
+static inline uint64_t
+consumer_avail(
+    mem_ring_t *mem_ring,
+    gboolean   *eof)
+{
+    *eof = load_acquire(&mem_ring->eof_flag);
+    return load_acquire(&mem_ring->written) - mem_ring->readx;
+}
+
+uint64_t
+mem_ring_consumer_wait(
+    mem_ring_t *mem_ring,
+    uint64_t    need,
+    gboolean   *cancelled,
+    gboolean   *eof)
+{
+    uint64_t avail;
+    gboolean eof_flag;
+    guint32 seq;
+    guint i;
+
+    if (!mem_ring->lockfree) {
+	g_mutex_lock(mem_ring->mutex);
+	while (!*cancelled && !mem_ring->cancelled && !mem_ring->eof_flag &&
+	       mem_ring->written - mem_ring->readx < need) {
+	    g_cond_wait(mem_ring->add_cond, mem_ring->mutex);
+	}
+	avail = mem_ring->written - mem_ring->readx;
+	if (eof)
+	    *eof = mem_ring->eof_flag;
+	g_mutex_unlock(mem_ring->mutex);
+	return avail;
+    }
+
+    for (i = 0; i < mem_ring->consumer_spin; i++) {
+	avail = consumer_avail(mem_ring, &eof_flag);
+	if (avail >= need || eof_flag) {
+	    if (i > 0)
+		mem_ring->consumer_spin = adapt_spin(mem_ring->consumer_spin, TRUE);
+	    goto done;
+	}
+	cpu_relax();
+    }
+    mem_ring->consumer_spin = adapt_spin(mem_ring->consumer_spin, FALSE);
+
+    while (1) {
+	seq = load_acquire(&mem_ring->add_seq);
+	__atomic_store_n(&mem_ring->add_wait, mem_ring->readx + need,
+			 __ATOMIC_RELAXED);
+	full_barrier();
+	avail = consumer_avail(mem_ring, &eof_flag);
+	if (avail >= need || eof_flag || *(volatile gboolean *)cancelled ||
+	    load_acquire(&mem_ring->cancelled))
+	    break;
+	ring_sleep(mem_ring, &mem_ring->add_seq, seq, mem_ring->add_cond);
+    }
+    __atomic_store_n(&mem_ring->add_wait, 0, __ATOMIC_RELAXED);
+
+done:
+    if (eof)
+	*eof = eof_flag;
+    return avail;
+}
+
+void
+mem_ring_consumer_pop(
+    mem_ring_t *mem_ring,
+    uint64_t    len)
+{
+    uint64_t read_offset = mem_ring->read_offset + len;
+    uint64_t readx;
+
+    if (read_offset >= mem_ring->ring_size)
+	read_offset -= mem_ring->ring_size;
+
+    if (!mem_ring->lockfree) {
+	g_mutex_lock(mem_ring->mutex);
+	mem_ring->readx += len;
+	mem_ring->read_offset = read_offset;
+	g_cond_broadcast(mem_ring->free_cond);
+	g_mutex_unlock(mem_ring->mutex);
+	return;
+    }
+
+    readx = mem_ring->readx + len;
+    __atomic_store_n(&mem_ring->read_offset, read_offset, __ATOMIC_RELAXED);
+    store_release(&mem_ring->readx, readx);
+    ring_wake_waiter(mem_ring, &mem_ring->free_wait, readx,
+		     &mem_ring->free_seq, mem_ring->free_cond);
+}
+
+void
+mem_ring_cancel(
+    mem_ring_t *mem_ring)
+{
+    store_release(&mem_ring->cancelled, TRUE);
+    full_barrier();
+
+    /* wake any sleeper, whatever it waits for */
+    __atomic_add_fetch(&mem_ring->add_seq, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&mem_ring->free_seq, 1, __ATOMIC_SEQ_CST);
+#ifdef USE_FUTEX
+    syscall(SYS_futex, &mem_ring->add_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    syscall(SYS_futex, &mem_ring->free_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+    g_mutex_lock(mem_ring->mutex);
+    g_cond_broadcast(mem_ring->add_cond);
+    g_cond_broadcast(mem_ring->free_cond);
+    g_mutex_unlock(mem_ring->mutex);
+}
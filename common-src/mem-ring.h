@@ -36,13 +36,21 @@
 #include <stream.h>
 
 typedef struct mem_ring_s {
+    /* written by the producer */
     uint64_t write_offset;	/* where to write */
     uint64_t written;		/* nb bytes written to the ring */
     gboolean eof_flag;
-    char     padding1[256 - 2*sizeof(off_t) - sizeof(gboolean)];
+    guint32  add_seq;		/* bumped to wake the consumer */
+    uint64_t free_wait;		/* readx the sleeping producer waits for */
+    guint    producer_spin;	/* adaptive spin count of the producer */
+    char     padding1[256 - 3*sizeof(uint64_t) - sizeof(gboolean) - sizeof(guint32) - sizeof(guint)];
+    /* written by the consumer */
     uint64_t read_offset;	/* where to read */
     uint64_t readx;		/* nb bytes written to the ring */
-    char     padding2[256 - 2*sizeof(off_t)];
+    guint32  free_seq;		/* bumped to wake the producer */
+    uint64_t add_wait;		/* written the sleeping consumer waits for */
+    guint    consumer_spin;	/* adaptive spin count of the consumer */
+    char     padding2[256 - 3*sizeof(uint64_t) - sizeof(guint32) - sizeof(guint)];
     char    *buffer;
     uint64_t ring_size;
     GCond   *add_cond;		/* some data was added to the ring */
@@ -53,6 +61,8 @@ typedef struct mem_ring_s {
     uint64_t consumer_ring_size;
     uint64_t producer_ring_size;
     size_t   data_avail;
+    gboolean lockfree;		/* see mem_ring_set_lockfree */
+    gboolean cancelled;
 } mem_ring_t;
 
 mem_ring_t *create_mem_ring(void);
@@ -61,4 +71,56 @@ void mem_ring_consumer_set_size(mem_ring_t *mem_ring, size_t ring_size, size_t b
 void mem_ring_producer_set_size(mem_ring_t *mem_ring, size_t ring_size, size_t block_size);
 void close_mem_ring(mem_ring_t *mem_ring);
 
+/*
+ * Producer/consumer operations
+ *
+ * A producer using these functions works with both kinds of consumers: those
+ * that lock mem_ring->mutex and wait on add_cond, and those that use
+ * mem_ring_consumer_wait/mem_ring_consumer_pop.
+ *
+ * If the consumer calls mem_ring_set_lockfree() before
+ * mem_ring_consumer_set_size(), the ring runs as a lock-free
+ * single-producer/single-consumer queue: the offsets are published with
+ * atomic operations, and a thread only sleeps (on a futex where available)
+ * when the ring is full or empty, after spinning for an adaptive period.
+ * Both sides must then use only these functions, never mem_ring->mutex.
+ */
+
+/* Switch the ring to lock-free operation; called by the consumer, before
+ * mem_ring_consumer_set_size. */
+void mem_ring_set_lockfree(mem_ring_t *mem_ring);
+
+/* Wait until at least NEED bytes are free in the ring.
+ *
+ * @param need: number of bytes needed, at most ring_size
+ * @param cancelled: checked while waiting; the wait also ends when the ring
+ *                   is cancelled with mem_ring_cancel
+ * @returns: the number of free bytes, or 0 if cancelled
+ */
+uint64_t mem_ring_producer_wait(mem_ring_t *mem_ring, uint64_t need,
+				gboolean *cancelled);
+
+/* Add LEN bytes, written at write_offset, to the ring */
+void mem_ring_producer_push(mem_ring_t *mem_ring, uint64_t len);
+
+/* Signal the end of the data */
+void mem_ring_producer_eof(mem_ring_t *mem_ring);
+
+/* Wait until at least NEED bytes are in the ring, or EOF.
+ *
+ * @param need: number of bytes needed, at most ring_size
+ * @param cancelled: as for mem_ring_producer_wait
+ * @param eof (output): TRUE if the producer signalled EOF; can be NULL
+ * @returns: the number of bytes in the ring, less than NEED only at EOF or
+ *           on cancellation
+ */
+uint64_t mem_ring_consumer_wait(mem_ring_t *mem_ring, uint64_t need,
+				gboolean *cancelled, gboolean *eof);
+
+/* Free LEN bytes, read at read_offset, from the ring */
+void mem_ring_consumer_pop(mem_ring_t *mem_ring, uint64_t len);
+
+/* Wake up both sides, and make any current or future wait return */
+void mem_ring_cancel(mem_ring_t *mem_ring);
+
 #endif
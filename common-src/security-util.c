@@ -344,6 +344,82 @@ tcpm_stream_write(
     return (0);
 }
 
+/*
+ * Return a zero-copy writer for the connection under a stream, or NULL if
+ * the stream's data does not go to the fd as-is.
+ *
+ * For rsh and ssh, rc->write is a pipe to the child we spawned.  A vmspliced
+ * pipe is only released once its reader has consumed it (see zerocopy.h),
+ * which holds because those clients read() their stdin; a reader that
+ * spliced the pipe onwards would break that.
+ */
+zerocopy_t *
+tcpm_stream_zerocopy(
+    security_stream_t *stream)
+{
+    struct sec_stream *rs = (struct sec_stream *)stream;
+    zerocopy_t *zc;
+
+    if (stream->driver->stream_write != tcpm_stream_write ||
+	stream->driver->data_write != generic_data_write ||
+	stream->driver->data_encrypt != NULL)
+	return NULL;
+
+    if (!stream_write_mutex) {
+	stream_write_mutex = g_mutex_new();
+    }
+    g_mutex_lock(stream_write_mutex);
+    if (!rs->rc->zc_tried) {
+	rs->rc->zc = zerocopy_new(rs->rc->write);
+	rs->rc->zc_tried = TRUE;
+    }
+    zc = rs->rc->zc;
+    g_mutex_unlock(stream_write_mutex);
+
+    return zc;
+}
+
+/*
+ * Write a chunk of data to a stream with the connection's zero-copy writer.
+ * The data must not change until TAG is released by the writer.
+ */
+int
+tcpm_stream_write_zerocopy(
+    void *	s,
+    const struct iovec *iov,
+    int		iovcnt,
+    guint64	tag)
+{
+    struct sec_stream *rs = s;
+    guint32 hdr[2];
+    size_t size = 0;
+    int i;
+
+    assert(rs != NULL);
+    assert(rs->rc != NULL);
+    assert(rs->rc->zc != NULL);
+
+    for (i = 0; i < iovcnt; i++)
+	size += iov[i].iov_len;
+
+    g_mutex_lock(stream_write_mutex);
+    auth_debug(6, _("sec: stream_write_zerocopy: writing %zu bytes to %s:%d %d\n"),
+		   size, rs->rc->hostname, rs->handle,
+		   rs->rc->write);
+
+    /* same framing as tcpm_send_token */
+    hdr[0] = htonl(size);
+    hdr[1] = htonl((guint32)rs->handle);
+    if (!zerocopy_write(rs->rc->zc, hdr, sizeof(hdr), iov, iovcnt, tag)) {
+	security_stream_seterror(&rs->secstr, _("write error to: %s"),
+				 strerror(errno));
+	g_mutex_unlock(stream_write_mutex);
+	return (-1);
+    }
+    g_mutex_unlock(stream_write_mutex);
+    return (0);
+}
+
 /*
  * Write a chunk of data to a stream.
  */
@@ -2102,6 +2178,8 @@ sec_tcp_conn_put(
 	return;
     }
     auth_debug(1, _("sec_tcp_conn_put: closing connection to %s\n"), rc->hostname);
+    zerocopy_free(rc->zc);
+    rc->zc = NULL;
     if (rc->read != -1)
 	aclose(rc->read);
     if (rc->write != -1)
@@ -2431,6 +2509,10 @@ sec_tcp_conn_read_callback(
 
     auth_debug(6, _("sec: conn_read_callback %d %d\n"), (int)rc->event_id, rc->read);
 
+    /* zero-copy completions wake us too; don't block on a read for them */
+    if (rc->zc && zerocopy_spurious_wakeup(rc->zc, rc->read))
+	return;
+
     /* Read the data off the wire.  If we get errors, shut down. */
     rval = tcpm_recv_token(rc, &rc->handle, &rc->errmsg, &rc->pkt,
 				&rc->pktlen);
@@ -38,6 +38,7 @@
 #include "shm-ring.h"
 #include "security.h"
 #include "event.h"
+#include "zerocopy.h"
 
 #define auth_debug(i, ...) do {		\
 	if ((i) <= debug_auth) {	\
@@ -135,6 +136,8 @@ struct tcp_conn {
     SSL                *ssl;
 #endif
     gboolean            paused;
+    zerocopy_t         *zc;			/* zero-copy writer, if any */
+    gboolean            zc_tried;
 };
 
 
@@ -272,6 +275,8 @@ void	stream_recvpkt_cancel(void *);
 
 int	tcpm_stream_write(void *, const void *, size_t);
 int	tcpm_stream_write_async(void *, void *, size_t, void (*)(void *, ssize_t, void *, ssize_t), void *);
+zerocopy_t *tcpm_stream_zerocopy(security_stream_t *);
+int	tcpm_stream_write_zerocopy(void *, const struct iovec *, int, guint64);
 void	tcpm_stream_read(void *, void (*)(void *, void *, ssize_t), void *);
 ssize_t	tcpm_stream_read_sync(void *, void **);
 void	tcpm_stream_read_to_shm_ring(void *, void (*)(void *, void *, ssize_t), struct shm_ring_t *, void *);
@@ -49,7 +49,9 @@
 #include "glib.h"
 #include "conffile.h"
 #include "security.h"
+#include "security-util.h"
 #include "shm-ring.h"
+#include "zerocopy.h"
 
 #define DEFAULT_SHM_RING_BLOCK_SIZE (NETWORK_BLOCK_BYTES)
 #define DEFAULT_SHM_RING_SIZE (DEFAULT_SHM_RING_BLOCK_SIZE*8)
@@ -390,6 +392,107 @@ g_debug("close_producer_shm_ring sem_close(sem_write %p", shm_ring->sem_write);
     g_free(shm_ring);
 }
 
+/* give the space of the data the kernel is done with back to the producer */
+static void
+shm_ring_release(
+    shm_ring_t *shm_ring,
+    uint64_t    released)
+{
+    uint64_t read_offset;
+
+    if (released <= shm_ring->mc->readx)
+	return;
+
+    read_offset = shm_ring->mc->read_offset + (released - shm_ring->mc->readx);
+    if (read_offset >= shm_ring->mc->ring_size)
+	read_offset -= shm_ring->mc->ring_size;
+    shm_ring->mc->read_offset = read_offset;
+    shm_ring->mc->readx = released;
+    sem_post(shm_ring->sem_write);
+}
+
+/*
+ * Consume the ring with zero-copy writes to NETFD.  The data stays in the
+ * ring until the kernel releases it, so 'sent' runs ahead of mc->readx; each
+ * write is tagged with the value of 'sent' after it.
+ */
+static void
+shm_ring_to_zerocopy(
+    shm_ring_t *shm_ring,
+    zerocopy_t *zc,
+    struct security_stream_t *netfd,
+    crc_t *crc)
+{
+    uint64_t     shm_ring_size = shm_ring->mc->ring_size;
+    uint64_t     sent = shm_ring->mc->readx;
+    uint64_t     read_offset;
+    gsize        usable;
+    gboolean     eof_flag;
+    gboolean     ok;
+
+    sem_post(shm_ring->sem_write);
+    while (!shm_ring->mc->cancelled) {
+	struct iovec iov[2];
+	int          iovcnt = 0;
+	gsize        to_write;
+
+	usable = shm_ring->mc->written - sent;
+	eof_flag = shm_ring->mc->eof_flag;
+	if (usable < shm_ring->block_size && !eof_flag) {
+	    if (sent > shm_ring->mc->readx) {
+		/* the producer may be waiting for this space */
+		shm_ring_release(shm_ring, zerocopy_wait(zc, FALSE));
+		if (zerocopy_error(zc))
+		    goto failed;
+	    } else if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) != 0) {
+		break;
+	    }
+	    continue;
+	}
+
+	to_write = MIN(usable, shm_ring->block_size);
+	read_offset = sent % shm_ring_size;
+	if (to_write + read_offset <= shm_ring_size) {
+	    iov[iovcnt].iov_base = shm_ring->data + read_offset;
+	    iov[iovcnt++].iov_len = to_write;
+	} else {
+	    iov[iovcnt].iov_base = shm_ring->data + read_offset;
+	    iov[iovcnt++].iov_len = shm_ring_size - read_offset;
+	    iov[iovcnt].iov_base = shm_ring->data;
+	    iov[iovcnt++].iov_len = to_write - shm_ring_size + read_offset;
+	}
+
+	/* a zero-length write still goes to the stream, as before */
+	ok = tcpm_stream_write_zerocopy(netfd, iov, to_write? iovcnt : 0,
+					sent + to_write) == 0;
+	if (!ok) {
+	    g_debug("zero-copy write failed: %s", strerror(errno));
+	    goto failed;
+	}
+	if (crc) {
+	    int i;
+	    for (i = 0; i < iovcnt; i++)
+		crc32_add(iov[i].iov_base, iov[i].iov_len, crc);
+	}
+	sent += to_write;
+	shm_ring_release(shm_ring, zerocopy_released(zc));
+
+	if (eof_flag && sent == shm_ring->mc->written) {
+	    shm_ring_release(shm_ring, zerocopy_wait(zc, TRUE));
+	    if (zerocopy_error(zc))
+		goto failed;
+	    // notify the producer that everything is read
+	    sem_post(shm_ring->sem_write);
+	    return;
+	}
+    }
+    return;
+
+failed:
+    shm_ring->mc->cancelled = TRUE;
+    sem_post(shm_ring->sem_write);
+}
+
 void
 shm_ring_to_security_stream(
     shm_ring_t *shm_ring,
@@ -400,6 +503,14 @@ shm_ring_to_security_stream(
     uint64_t     shm_ring_size;
     gsize        usable = 0;
     gboolean     eof_flag = FALSE;
+    zerocopy_t  *zc;
+
+    zc = tcpm_stream_zerocopy(netfd);
+    if (zc) {
+	g_debug("shm_ring_to_security_stream: zero-copy");
+	shm_ring_to_zerocopy(shm_ring, zc, netfd, crc);
+	return;
+    }
 
     g_debug("shm_ring_to_security_stream");
     shm_ring_size = shm_ring->mc->ring_size;
@@ -0,0 +1,543 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * zero-copy writes
+ */
+
+#include "amanda.h"
+#include "zerocopy.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
+
+#if defined SO_ZEROCOPY && defined MSG_ZEROCOPY && defined SO_EE_ORIGIN_ZEROCOPY
+#define ZEROCOPY_SOCKET 1
+#endif
+#if defined HAVE_VMSPLICE && defined FIONREAD
+#define ZEROCOPY_PIPE 1
+#endif
+
+/* stop asking for zero-copy once this many sends were copied anyway, as
+ * happens over loopback */
+#define ZEROCOPY_MAX_COPIED 16
+
+/* how long to sleep while a pipe reader has not caught up, in microseconds */
+#define ZEROCOPY_PIPE_POLL 1000
+
+typedef enum {
+    ZEROCOPY_KIND_SOCKET,
+    ZEROCOPY_KIND_PIPE
+} zerocopy_kind_t;
+
+typedef struct zerocopy_write_s {
+    guint64  tag;
+    gboolean sending;		/* still in zerocopy_write */
+    guint32  first_id;		/* MSG_ZEROCOPY id of the first send */
+    guint32  nsends;		/* sends done with MSG_ZEROCOPY */
+    guint32  ndone;		/* ... and completed */
+    guint64  pipe_end;		/* 'spliced' at the end of this write */
+    char     hdr[ZEROCOPY_MAX_HEADER];
+} zerocopy_write_t;
+
+struct zerocopy_s {
+    int             fd;
+    zerocopy_kind_t kind;
+    GMutex         *mutex;
+    GQueue         *pending;	/* zerocopy_write_t, oldest first */
+    guint64         released;	/* tag of the last released write */
+    guint32         next_id;	/* MSG_ZEROCOPY ids issued */
+    guint32         completed;	/* ... and completed */
+    gboolean        use_zerocopy;
+    int             copied;
+    guint64         spliced;	/* bytes vmspliced into the pipe */
+    int             error;
+};
+
+zerocopy_t *
+zerocopy_new(
+    int fd)
+{
+    zerocopy_t *zc;
+    zerocopy_kind_t kind;
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+	return NULL;
+
+    if (S_ISSOCK(st.st_mode)) {
+#ifdef ZEROCOPY_SOCKET
+	int one = 1;
+
+	/* fails for anything but TCP and UDP */
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1) {
+	    g_debug("zerocopy: SO_ZEROCOPY failed on fd %d: %s", fd,
+		    strerror(errno));
+	    return NULL;
+	}
+	kind = ZEROCOPY_KIND_SOCKET;
+#else
+	return NULL;
+#endif
+    } else if (S_ISFIFO(st.st_mode)) {
+#ifdef ZEROCOPY_PIPE
+	kind = ZEROCOPY_KIND_PIPE;
+#else
+	return NULL;
+#endif
+    } else {
+	return NULL;
+    }
+
+    zc = g_new0(zerocopy_t, 1);
+    zc->fd = fd;
+    zc->kind = kind;
+    zc->mutex = g_mutex_new();
+    zc->pending = g_queue_new();
+    zc->use_zerocopy = TRUE;
+
+    g_debug("zerocopy: using %s on fd %d",
+	    kind == ZEROCOPY_KIND_SOCKET? "MSG_ZEROCOPY" : "vmsplice", fd);
+    return zc;
+}
+
+void
+zerocopy_free(
+    zerocopy_t *zc)
+{
+    zerocopy_write_t *w;
+
+    if (!zc)
+	return;
+
+    while ((w = g_queue_pop_head(zc->pending)) != NULL)
+	g_free(w);
+    g_queue_free(zc->pending);
+    g_mutex_free(zc->mutex);
+    g_free(zc);
+}
+
+/*
+ * Completions
+ */
+
+#ifdef ZEROCOPY_SOCKET
+static void
+complete_ids(
+    zerocopy_t *zc,
+    guint32     lo,
+    guint32     hi,
+    gboolean    copied)
+{
+    GList *l;
+    guint32 i;
+
+    zc->completed += hi - lo + 1;
+    for (l = zc->pending->head; l != NULL; l = l->next) {
+	zerocopy_write_t *w = l->data;
+
+	for (i = 0; i < w->nsends; i++) {
+	    if ((guint32)(w->first_id + i - lo) <= (guint32)(hi - lo))
+		w->ndone++;
+	}
+    }
+
+    if (copied && zc->use_zerocopy) {
+	zc->copied += hi - lo + 1;
+	if (zc->copied >= ZEROCOPY_MAX_COPIED) {
+	    g_debug("zerocopy: the kernel copies the data on fd %d, using plain writes",
+		    zc->fd);
+	    zc->use_zerocopy = FALSE;
+	}
+    }
+}
+
+/* read the error queue; returns the number of completions */
+static int
+reap_socket(
+    zerocopy_t *zc)
+{
+    int reaped = 0;
+
+    while (1) {
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+	    struct sock_extended_err *serr;
+
+	    if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+		!(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+		continue;
+	    serr = (struct sock_extended_err *)CMSG_DATA(cm);
+	    if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+		continue;
+	    complete_ids(zc, serr->ee_info, serr->ee_data,
+			 (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+	    reaped++;
+	}
+    }
+
+    return reaped;
+}
+#endif
+
+/* collect completions and release what we can; called with the mutex held */
+static void
+reap(
+    zerocopy_t *zc)
+{
+    zerocopy_write_t *w;
+    guint64 drained = 0;
+
+#ifdef ZEROCOPY_SOCKET
+    if (zc->kind == ZEROCOPY_KIND_SOCKET)
+	reap_socket(zc);
+#endif
+#ifdef ZEROCOPY_PIPE
+    if (zc->kind == ZEROCOPY_KIND_PIPE) {
+	int unread;
+
+	if (ioctl(zc->fd, FIONREAD, &unread) == -1)
+	    return;
+	drained = zc->spliced - unread;
+    }
+#endif
+
+    while ((w = g_queue_peek_head(zc->pending)) != NULL && !w->sending) {
+	if (zc->kind == ZEROCOPY_KIND_SOCKET && w->ndone < w->nsends)
+	    break;
+	if (zc->kind == ZEROCOPY_KIND_PIPE && drained < w->pipe_end)
+	    break;
+	zc->released = w->tag;
+	g_free(g_queue_pop_head(zc->pending));
+    }
+}
+
+/* Block until something may have changed; FALSE if the fd failed */
+static gboolean
+wait_event(
+    zerocopy_t *zc)
+{
+    struct pollfd p;
+    int rv;
+
+    p.fd = zc->fd;
+    p.events = (zc->kind == ZEROCOPY_KIND_PIPE)? POLLOUT : 0;
+    p.revents = 0;
+
+    /* POLLERR is how the error queue says it has completions, so a real
+     * error only shows as POLLERR with nothing to reap */
+    rv = poll(&p, 1, 1000);
+    if (rv == -1 && errno != EINTR) {
+	zc->error = errno;
+	return FALSE;
+    }
+    if (rv <= 0)
+	return TRUE;
+
+    if (zc->kind == ZEROCOPY_KIND_PIPE) {
+	if (p.revents & (POLLERR | POLLHUP)) {
+	    zc->error = EPIPE;
+	    return FALSE;
+	}
+	/* the pipe has room, but the reader has not read what we wait for */
+	g_usleep(ZEROCOPY_PIPE_POLL);
+	return TRUE;
+    }
+
+#ifdef ZEROCOPY_SOCKET
+    g_mutex_lock(zc->mutex);
+    rv = reap_socket(zc);
+    g_mutex_unlock(zc->mutex);
+    if (rv == 0) {
+	int so_error = 0;
+	socklen_t len = sizeof(so_error);
+
+	if (getsockopt(zc->fd, SOL_SOCKET, SO_ERROR, &so_error, &len) == -1)
+	    so_error = errno;
+	if (so_error == 0 && (p.revents & POLLHUP))
+	    so_error = EPIPE;
+	if (so_error) {
+	    zc->error = so_error;
+	    return FALSE;
+	}
+    }
+#endif
+    return TRUE;
+}
+
+guint64
+zerocopy_released(
+    zerocopy_t *zc)
+{
+    guint64 released;
+
+    g_mutex_lock(zc->mutex);
+    reap(zc);
+    released = zc->released;
+    g_mutex_unlock(zc->mutex);
+
+    return released;
+}
+
+guint64
+zerocopy_wait(
+    zerocopy_t *zc,
+    gboolean    all)
+{
+    guint64 start = zc->released;
+    guint64 released;
+    gboolean done;
+
+    while (1) {
+	g_mutex_lock(zc->mutex);
+	reap(zc);
+	released = zc->released;
+	done = g_queue_is_empty(zc->pending) || (!all && released != start);
+	g_mutex_unlock(zc->mutex);
+
+	if (done || zc->error || !wait_event(zc))
+	    return released;
+    }
+}
+
+int
+zerocopy_error(
+    zerocopy_t *zc)
+{
+    return zc->error;
+}
+
+gboolean
+zerocopy_spurious_wakeup(
+    zerocopy_t *zc,
+    int         fd)
+{
+    struct pollfd p;
+    int i;
+
+    if (zc->kind != ZEROCOPY_KIND_SOCKET)
+	return FALSE;
+
+    /* A completion may arrive between draining the queue and polling again,
+     * so only call it a real error if POLLERR stays after a few drains. */
+    for (i = 0; i < 3; i++) {
+	p.fd = fd;
+	p.events = POLLIN;
+	p.revents = 0;
+	if (poll(&p, 1, 0) <= 0)
+	    return TRUE;
+	if (p.revents & (POLLIN | POLLHUP | POLLNVAL))
+	    return FALSE;
+
+	g_mutex_lock(zc->mutex);
+	reap(zc);
+	g_mutex_unlock(zc->mutex);
+    }
+
+    return FALSE;
+}
+
+/*
+ * Writing
+ */
+
+static void
+advance_iov(
+    struct iovec **iov,
+    int           *iovcnt,
+    size_t         n)
+{
+    while (*iovcnt > 0 && n >= (*iov)->iov_len) {
+	n -= (*iov)->iov_len;
+	(*iov)++;
+	(*iovcnt)--;
+    }
+    if (*iovcnt > 0) {
+	(*iov)->iov_base = (char *)(*iov)->iov_base + n;
+	(*iov)->iov_len -= n;
+    }
+}
+
+#ifdef ZEROCOPY_SOCKET
+static gboolean
+send_socket(
+    zerocopy_t       *zc,
+    zerocopy_write_t *w,
+    struct iovec     *iov,
+    int               iovcnt)
+{
+    while (iovcnt > 0) {
+	struct msghdr msg;
+	int flags = zc->use_zerocopy? MSG_ZEROCOPY : 0;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	n = sendmsg(zc->fd, &msg, flags);
+	if (n == -1) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == ENOBUFS && flags) {
+		/* too many pages pinned; wait for some to come back, or copy
+		 * this one if there are none outstanding */
+		gboolean outstanding;
+
+		g_mutex_lock(zc->mutex);
+		outstanding = (zc->next_id != zc->completed);
+		g_mutex_unlock(zc->mutex);
+		if (outstanding) {
+		    if (!wait_event(zc))
+			return FALSE;
+		} else {
+		    zc->use_zerocopy = FALSE;
+		}
+		continue;
+	    }
+	    return FALSE;
+	}
+
+	if (flags) {
+	    g_mutex_lock(zc->mutex);
+	    if (w->nsends == 0)
+		w->first_id = zc->next_id;
+	    w->nsends++;
+	    zc->next_id++;
+	    g_mutex_unlock(zc->mutex);
+	}
+	advance_iov(&iov, &iovcnt, n);
+    }
+
+    return TRUE;
+}
+#endif
+
+#ifdef ZEROCOPY_PIPE
+static gboolean
+send_pipe(
+    zerocopy_t       *zc,
+    zerocopy_write_t *w,
+    struct iovec     *iov,
+    int               iovcnt)
+{
+    while (iovcnt > 0) {
+	ssize_t n;
+
+	if (iov->iov_len == 0) {
+	    iov++;
+	    iovcnt--;
+	    continue;
+	}
+	n = vmsplice(zc->fd, iov, iovcnt, 0);
+	if (n == -1) {
+	    if (errno == EINTR)
+		continue;
+	    return FALSE;
+	}
+
+	g_mutex_lock(zc->mutex);
+	zc->spliced += n;
+	w->pipe_end = zc->spliced;
+	g_mutex_unlock(zc->mutex);
+	advance_iov(&iov, &iovcnt, n);
+    }
+
+    return TRUE;
+}
+#endif
+
+gboolean
+zerocopy_write(
+    zerocopy_t         *zc,
+    const void         *hdr,
+    size_t              hdr_len,
+    const struct iovec *iov,
+    int                 iovcnt,
+    guint64             tag)
+{
+    struct iovec *v;
+    zerocopy_write_t *w;
+    gboolean ok = FALSE;
+    int n = 0;
+    int i;
+
+    g_assert(hdr_len <= ZEROCOPY_MAX_HEADER);
+
+    w = g_new0(zerocopy_write_t, 1);
+    w->tag = tag;
+    w->sending = TRUE;
+
+    /* send a copy of the header from the entry, which lives until the write
+     * is released */
+    v = g_new(struct iovec, iovcnt + 1);
+    if (hdr && hdr_len) {
+	memcpy(w->hdr, hdr, hdr_len);
+	v[n].iov_base = w->hdr;
+	v[n].iov_len = hdr_len;
+	n++;
+    }
+    for (i = 0; i < iovcnt; i++)
+	v[n++] = iov[i];
+
+    g_mutex_lock(zc->mutex);
+    w->pipe_end = zc->spliced;
+    g_queue_push_tail(zc->pending, w);
+    g_mutex_unlock(zc->mutex);
+
+#ifdef ZEROCOPY_SOCKET
+    if (zc->kind == ZEROCOPY_KIND_SOCKET)
+	ok = send_socket(zc, w, v, n);
+#endif
+#ifdef ZEROCOPY_PIPE
+    if (zc->kind == ZEROCOPY_KIND_PIPE)
+	ok = send_pipe(zc, w, v, n);
+#endif
+    if (!ok && !zc->error)
+	zc->error = errno;
+
+    g_mutex_lock(zc->mutex);
+    w->sending = FALSE;
+    g_mutex_unlock(zc->mutex);
+
+    g_free(v);
+    return ok;
+}
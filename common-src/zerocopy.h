@@ -0,0 +1,102 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Zero-copy writes from long-lived buffers (e.g. a shm_ring data mapping)
+ *
+ * The kernel keeps references to the pages of a zero-copy write after the
+ * write returns, so the caller must not modify a buffer until the kernel
+ * releases it.  Each write carries a caller-chosen tag, which must increase
+ * from one write to the next; zerocopy_released() returns the tag of the
+ * last write whose buffers (and all earlier ones) can be reused.
+ *
+ * Sockets use MSG_ZEROCOPY, and are released when the completion arrives on
+ * the socket's error queue.  Pipes use vmsplice(), and are released once the
+ * reader has consumed the data; this assumes the reader read()s the pipe
+ * rather than splicing it further.
+ */
+
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <glib.h>
+#include <sys/uio.h>
+
+/* longest header zerocopy_write will copy for the caller */
+#define ZEROCOPY_MAX_HEADER 16
+
+typedef struct zerocopy_s zerocopy_t;
+
+/* Create a zero-copy writer for FD.
+ *
+ * @param fd: a connected socket or the write end of a pipe
+ * @returns: the writer, or NULL if FD can't do zero-copy writes, in which
+ *           case the caller should use write().
+ */
+zerocopy_t *zerocopy_new(int fd);
+
+/* Free a zero-copy writer.  This does not wait for outstanding writes, nor
+ * close the fd.
+ */
+void zerocopy_free(zerocopy_t *zc);
+
+/* Write HDR, which is copied, followed by IOV, which is not, and block until
+ * all of it is queued.
+ *
+ * @param zc: the writer
+ * @param hdr: a small header to send first, or NULL
+ * @param hdr_len: its length, at most ZEROCOPY_MAX_HEADER
+ * @param iov: the buffers; they must not change until TAG is released
+ * @param iovcnt: number of buffers
+ * @param tag: tag of this write
+ * @returns: FALSE on error, with errno set
+ */
+gboolean zerocopy_write(zerocopy_t *zc, const void *hdr, size_t hdr_len,
+			const struct iovec *iov, int iovcnt, guint64 tag);
+
+/* Collect the completions that are available without blocking.
+ *
+ * @returns: the tag of the last released write
+ */
+guint64 zerocopy_released(zerocopy_t *zc);
+
+/* Block until at least one more write (or, if ALL, every write) is released.
+ *
+ * @returns: the tag of the last released write
+ */
+guint64 zerocopy_wait(zerocopy_t *zc, gboolean all);
+
+/* Return the errno of a failure seen while waiting, or 0
+ */
+int zerocopy_error(zerocopy_t *zc);
+
+/* Return TRUE if FD, which is also watched for reading, was woken only by
+ * zero-copy completions on its error queue; they are collected.  A socket
+ * with MSG_ZEROCOPY completions queued always polls as having an error.
+ */
+gboolean zerocopy_spurious_wakeup(zerocopy_t *zc, int fd);
+
+#endif /* ZEROCOPY_H */
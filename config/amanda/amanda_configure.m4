@@ -173,6 +173,9 @@ AMANDA_ENABLE_GCC_WARNING([old-style-definition])
 AMANDA_DISABLE_GCC_WARNING([strict-aliasing])
 AMANDA_DISABLE_GCC_WARNING([unknown-pragmas])
 AMANDA_CHECK_SSE42
+AMANDA_CHECK_PCLMUL
+AMANDA_CHECK_AVX2
+AMANDA_CHECK_AVX512
 AMANDA_WERROR_FLAGS
 AMANDA_SWIG_ERROR
 
@@ -194,6 +197,9 @@ AC_CHECK_HEADERS(
 	libc.h \
 	libgen.h \
 	limits.h \
+	linux/errqueue.h \
+	linux/futex.h \
+	linux/io_uring.h \
 	math.h \
 	netinet/in.h \
 	regex.h \
@@ -210,6 +216,7 @@ AC_CHECK_HEADERS(
 	sys/select.h \
 	sys/stat.h \
 	sys/shm.h \
+	sys/syscall.h \
 	sys/time.h \
 	sys/types.h \
 	sys/uio.h \
@@ -263,6 +270,7 @@ AMANDA_CHECK_GLIB
 AMANDA_CHECK_READLINE
 AC_CHECK_LIB(m,modf)
 AMANDA_CHECK_LIBDL
+AMANDA_CHECK_COMPRESSION_LIBS
 AMANDA_GLIBC_BACKTRACE
 AC_SEARCH_LIBS([shm_open], [rt], [], [
   AC_MSG_ERROR([unable to find the shm_open() function])
@@ -364,6 +372,10 @@ ICE_CHECK_DECL(tolower,ctype.h)
 ICE_CHECK_DECL(toupper,ctype.h)
 ICE_CHECK_DECL(ungetc,stdio.h)
 AC_CHECK_FUNCS(unsetenv)
+AC_CHECK_FUNCS(vmsplice)
+AC_CHECK_FUNCS(fallocate)
+AC_CHECK_FUNCS(posix_fadvise sync_file_range)
+AC_CHECK_FUNCS(statx)
 ICE_CHECK_DECL(vfprintf,stdio.h stdlib.h)
 ICE_CHECK_DECL(vprintf,stdio.h stdlib.h)
 AC_CHECK_FUNC(wait4)
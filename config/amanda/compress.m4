@@ -79,3 +79,22 @@ AC_DEFUN([AMANDA_CHECK_COMPRESSION],
     # Empty GZIP so that make dist works.
     GZIP=
 ])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_COMPRESSION_LIBS
+#
+# OVERVIEW
+#
+#   Look for the zlib, zstd and lz4 libraries used for in-process compression
+#   (common-src/amcompress.c).  Each of them is optional; define HAVE_ZLIB_H,
+#   HAVE_ZSTD_H, HAVE_LZ4FRAME_H, HAVE_LIBZ, HAVE_LIBZSTD and HAVE_LIBLZ4, and
+#   add the libraries found to LIBS.
+#
+AC_DEFUN([AMANDA_CHECK_COMPRESSION_LIBS],
+[
+    AC_CHECK_HEADERS([zlib.h zstd.h lz4frame.h])
+    AC_CHECK_LIB([z], [deflate])
+    AC_CHECK_LIB([zstd], [ZSTD_compressStream2])
+    AC_CHECK_LIB([lz4], [LZ4F_compressFrame])
+])
@@ -336,6 +336,60 @@ AC_DEFUN([AMANDA_CHECK_SSE42],
     AC_SUBST(SSE42_CFLAGS)
 ])
 
+# SYNOPSIS
+#
+#   AMANDA_CHECK_PCLMUL
+#
+# OVERVIEW
+#
+#   Check if gcc support -mpclmul, used to combine hardware crcs
+#
+AC_DEFUN([AMANDA_CHECK_PCLMUL],
+[
+    # test for -mpclmul
+    AMANDA_TEST_GCC_FLAG(-mpclmul,
+    [
+	PCLMUL_CFLAGS=-mpclmul
+    ])
+    AC_SUBST(PCLMUL_CFLAGS)
+])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_AVX2
+#
+# OVERVIEW
+#
+#   Check if gcc support -mavx2, used for the RAIT parity
+#
+AC_DEFUN([AMANDA_CHECK_AVX2],
+[
+    # test for -mavx2
+    AMANDA_TEST_GCC_FLAG(-mavx2,
+    [
+	AVX2_CFLAGS=-mavx2
+    ])
+    AC_SUBST(AVX2_CFLAGS)
+])
+
+# SYNOPSIS
+#
+#   AMANDA_CHECK_AVX512
+#
+# OVERVIEW
+#
+#   Check if gcc support -mavx512bw, used for the RAIT parity
+#
+AC_DEFUN([AMANDA_CHECK_AVX512],
+[
+    # test for -mavx512bw
+    AMANDA_TEST_GCC_FLAG(-mavx512bw,
+    [
+	AVX512_CFLAGS="-mavx512f -mavx512bw"
+    ])
+    AC_SUBST(AVX512_CFLAGS)
+])
+
 # SYNOPSIS
 #
 #   AMANDA_TEST_GCC_FLAG(flag, action-if-found, action-if-not-found)
@@ -0,0 +1,1934 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/* The dedup device is a VFS device whose volume files do not hold the data
+ * itself, but a "recipe": the list of the chunks the data was cut into.  The
+ * chunks are stored once, by fingerprint, in a chunk store shared by all the
+ * slots of a changer:
+ *
+ *   $store/index        - the store lock
+ *   $store/index.log    - refcount of every chunk, see DEDUP_LOG_MAGIC
+ *   $store/ab/abcd...   - the chunk with fingerprint abcd...
+ *
+ * The data is cut with content-defined chunking (FastCDC), so an insertion
+ * in the stream only changes the chunks around it.  A volume file is the
+ * usual 32k Amanda header followed by DEDUP_REF_SIZE records; the data is
+ * read back through read_block by reassembling the chunks.  The references
+ * a file adds are committed to the index when the file is finished, which
+ * then ends its recipe with a commit record.  They are released when the
+ * file is recycled or the volume erased or relabeled, but only for a file
+ * with a commit record; a chunk is removed when its refcount drops to zero.
+ * A file that failed, or whose writer died, thus leaks its new chunks rather
+ * than releasing references it never added. */
+
+#include "amanda.h"
+#include "amutil.h"
+#include <regex.h>
+#include "fsusage.h"
+
+#include "vfs-device.h"
+
+/*
+ * Type checking and casting macros
+ */
+#define TYPE_DEDUP_DEVICE	(dedup_device_get_type())
+#define DEDUP_DEVICE(obj)	G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_DEDUP_DEVICE, DedupDevice)
+#define DEDUP_DEVICE_CONST(obj)	G_TYPE_CHECK_INSTANCE_CAST((obj), TYPE_DEDUP_DEVICE, DedupDevice const)
+#define DEDUP_DEVICE_CLASS(klass)	G_TYPE_CHECK_CLASS_CAST((klass), TYPE_DEDUP_DEVICE, DedupDeviceClass)
+#define IS_DEDUP_DEVICE(obj)	G_TYPE_CHECK_INSTANCE_TYPE((obj), TYPE_DEDUP_DEVICE)
+#define DEDUP_DEVICE_GET_CLASS(obj)	G_TYPE_INSTANCE_GET_CLASS((obj), TYPE_DEDUP_DEVICE, DedupDeviceClass)
+
+/* Chunk size limits and cut-point masks.  With normalized chunking, a
+ * harder mask is used below the average size and an easier one above it.
+ * The gear hash shifts left, so the masks use its high bits, which depend
+ * on the most bytes.  These and the gear table decide where the chunks are
+ * cut: changing any of them makes new dumps share nothing with the chunks
+ * already in a store. */
+#define DEDUP_CHUNK_MIN (16*1024)
+#define DEDUP_CHUNK_AVG (64*1024)
+#define DEDUP_CHUNK_MAX (256*1024)
+#define DEDUP_MASK_S (((G_GUINT64_CONSTANT(1) << 18) - 1) << 46)
+#define DEDUP_MASK_L (((G_GUINT64_CONSTANT(1) << 14) - 1) << 50)
+#define DEDUP_GEAR_SEED G_GUINT64_CONSTANT(0x616d616e64616475)
+
+/* Chunks are identified by their SHA-256 */
+#define DEDUP_FP_SIZE 32
+
+/* A recipe record: fingerprint, then the chunk size (big-endian) */
+#define DEDUP_REF_SIZE (DEDUP_FP_SIZE + 4)
+
+/* The record ending the recipe of a file whose references are in the
+ * index: this magic, padded with zeroes, and a size of 0, which no chunk
+ * has */
+#define DEDUP_COMMIT_MAGIC "AMDEDUP-COMMIT"
+
+/* The index is a log of the changes to the refcounts, so an update only
+ * appends to it.  It starts with DEDUP_LOG_MAGIC and a generation
+ * (big-endian), followed by transactions: the number of records
+ * (big-endian), the records, then the CRC32 of the number and the records.
+ * A record is a fingerprint and the change of its refcount (signed,
+ * big-endian).  A transaction that was not completely written is ignored,
+ * and overwritten by the next one.  When the log gets larger than twice
+ * the refcounts it holds, it is rewritten as a single transaction with the
+ * next generation; a process that replayed an older generation replays the
+ * new one from the start. */
+#define DEDUP_LOG_MAGIC "AMDEDUP2"
+#define DEDUP_LOG_MAGIC_SIZE 8
+#define DEDUP_LOG_HEADER_SIZE (DEDUP_LOG_MAGIC_SIZE + 8)
+#define DEDUP_LOG_REC_SIZE (DEDUP_FP_SIZE + 4)
+#define DEDUP_LOG_COMPACT_MIN (1024*1024)
+
+/* Recipe records are written to the volume file in batches of this size */
+#define DEDUP_RECIPE_FLUSH (32*1024)
+
+/* Bloom filter: bits per chunk in the index when it is built, minimum size
+ * (in bits, a power of two) and number of hash functions */
+#define DEDUP_BLOOM_BITS_PER_CHUNK 10
+#define DEDUP_BLOOM_MIN_BITS (1 << 20)
+#define DEDUP_BLOOM_HASHES 7
+
+/* How long to sleep between attempts to lock the index */
+#define DEDUP_LOCK_POLL 100000
+
+/* Free space kept in the filesystem of the store.  Like the VFS device's
+ * free space monitoring, it is only checked again after some data was
+ * stored or some time passed, or when it gets close. */
+#define DEDUP_STORE_RESERVE (64*1024*1024)
+#define DEDUP_SPACE_CHECK_EVERY (16*1024*1024)
+#define DEDUP_SPACE_CHECK_SECONDS 5
+
+/* Forward declaration */
+static GType dedup_device_get_type(void);
+
+/*
+ * Main object structure
+ */
+typedef struct _DedupDevice DedupDevice;
+struct _DedupDevice {
+    VfsDevice __parent__;
+
+    /* the chunk store (DEDUP_STORE property) */
+    char *store_dir;
+
+    /* data written to the current file but not yet cut into chunks, and
+     * how far the search for the next cut point went */
+    GByteArray *pending;
+    gsize cdc_pos;
+    guint64 cdc_hash;
+
+    /* recipe records not yet written to the current file */
+    GByteArray *recipe;
+
+    /* fingerprint -> number of references the current file adds */
+    GHashTable *file_refs;
+
+    /* the index (fingerprint -> refcount) as of the last time the log was
+     * replayed, and the generation and length of the log replayed; NULL
+     * until the log is first read */
+    GHashTable *index;
+    guint64 index_gen;
+    guint64 index_offset;
+
+    /* Bloom filter of the chunks in the store, built from the index at the
+     * first start_file and updated when the log is replayed; a negative
+     * answer saves a stat of the chunk */
+    guint8 *bloom;
+    guint64 bloom_mask;
+
+    /* free space in the store at the last check, when it was checked, and
+     * the bytes stored since; check_space is cleared if the filesystem
+     * can't tell */
+    gboolean check_space;
+    guint64 store_free;
+    guint64 store_used;
+    time_t store_checked;
+
+    /* the recipe of the file being read (DedupRef), the logical offset of
+     * the next read_block, and the chunk loaded in chunk_data */
+    GArray *chunks;
+    guint64 chunks_size;
+    guint64 read_offset;
+    guint cur_chunk;
+    char *chunk_data;
+
+    /* statistics for DEDUP_RATIO and DEDUP_THROUGHPUT */
+    guint64 bytes_ingested;
+    guint64 bytes_stored;
+    GTimer *write_timer;
+
+    /* the VfsDevice implementation we wrap */
+    gboolean (* vfs_clear_and_prepare_label)(Device *dself, char *label, char *timestamp);
+};
+
+/*
+ * Class definition
+ */
+typedef struct _DedupDeviceClass DedupDeviceClass;
+struct _DedupDeviceClass {
+    VfsDeviceClass __parent__;
+};
+
+/* A chunk of the file being read */
+typedef struct {
+    guint8 fp[DEDUP_FP_SIZE];
+    guint32 size;
+    guint64 offset;		/* logical offset in the file */
+} DedupRef;
+
+/* The volume files whose references are to be released */
+typedef struct {
+    DedupDevice *self;
+    int filenum;		/* only this file, or all if -1 */
+    GHashTable *delta;		/* fingerprint -> references to release, or NULL */
+    GSList *paths;
+    guint64 size;		/* logical size, header included */
+} DedupRelease;
+
+/* Gear table of the rolling hash, see DEDUP_GEAR_SEED */
+static guint64 dedup_gear[256];
+
+static DeviceClass *parent_class = NULL;
+
+/*
+ * device-specific properties
+ */
+
+/* Where to store the chunks */
+static DevicePropertyBase device_property_dedup_store;
+#define PROPERTY_DEDUP_STORE (device_property_dedup_store.ID)
+
+/* Bytes written to the device per byte added to the chunk store */
+static DevicePropertyBase device_property_dedup_ratio;
+#define PROPERTY_DEDUP_RATIO (device_property_dedup_ratio.ID)
+
+/* Bytes per second written to the device */
+static DevicePropertyBase device_property_dedup_throughput;
+#define PROPERTY_DEDUP_THROUGHPUT (device_property_dedup_throughput.ID)
+
+/* GObject housekeeping */
+void
+dedup_device_register(void);
+
+static Device*
+dedup_device_factory(char *device_name, char *device_type, char *device_node);
+
+static void
+dedup_device_class_init (DedupDeviceClass *c);
+
+static void
+dedup_device_base_init (DedupDeviceClass *c);
+
+static void
+dedup_device_init (DedupDevice *self);
+
+static void
+dedup_device_finalize(GObject *gself);
+
+/* Methods */
+static void
+dedup_device_open_device(Device *dself, char *device_name, char *device_type, char *device_node);
+
+static gboolean
+dedup_device_start_file(Device *dself, dumpfile_t *ji);
+
+static DeviceWriteResult
+dedup_device_write_block(Device *dself, guint size, gpointer data);
+
+static gboolean
+dedup_device_finish_file(Device *dself);
+
+static dumpfile_t *
+dedup_device_seek_file(Device *dself, guint requested_file);
+
+static gboolean
+dedup_device_seek_block(Device *dself, guint64 block);
+
+static int
+dedup_device_read_block(Device *dself, gpointer data, int *size_req, int max_block);
+
+static gboolean
+dedup_device_recycle_file(Device *dself, guint filenum);
+
+static gboolean
+dedup_device_erase(Device *dself);
+
+static gboolean
+dedup_clear_and_prepare_label(Device *dself, char *label, char *timestamp);
+
+static void
+dedup_update_volume_size(Device *dself);
+
+/* Properties */
+static gboolean
+property_set_dedup_store_fn(Device *dself, DevicePropertyBase *base,
+			    GValue *val, PropertySurety surety,
+			    PropertySource source);
+
+static gboolean
+property_get_dedup_ratio_fn(Device *dself, DevicePropertyBase *base,
+			    GValue *val, PropertySurety *surety,
+			    PropertySource *source);
+
+static gboolean
+property_get_dedup_throughput_fn(Device *dself, DevicePropertyBase *base,
+				 GValue *val, PropertySurety *surety,
+				 PropertySource *source);
+
+/* Chunk store */
+static char *
+dedup_chunk_path(DedupDevice *self, const guint8 *fp);
+
+static gboolean
+dedup_store_chunk(DedupDevice *self, const guint8 *data, gsize len);
+
+static gboolean
+dedup_index_update(DedupDevice *self, GHashTable *delta, gboolean adding);
+
+/* Read the recipes of the volume files matching filenum; with release,
+ * collect their references in rel->delta */
+static gboolean
+dedup_release_prepare(DedupRelease *rel, DedupDevice *self, int filenum,
+		      gboolean release);
+
+/* Once they are deleted, drop their references from the index */
+static gboolean
+dedup_release_finish(DedupRelease *rel);
+
+static void
+dedup_release_free(DedupRelease *rel);
+
+/* Read the recipe of a volume file; fill refs and/or delta if not NULL, and
+ * return the logical size of the data in *size */
+static gboolean
+dedup_read_recipe(DedupDevice *self, const char *path, GArray *refs,
+		  GHashTable *delta, guint64 *size);
+
+static GType
+dedup_device_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (DedupDeviceClass),
+            (GBaseInitFunc) dedup_device_base_init,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) dedup_device_class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (DedupDevice),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) dedup_device_init,
+            NULL
+        };
+
+        type = g_type_register_static (TYPE_VFS_DEVICE, "DedupDevice",
+                                       &info, (GTypeFlags)0);
+    }
+
+    return type;
+}
+
+void
+dedup_device_register(void)
+{
+    const char *device_prefix_list[] = { "dedup", NULL };
+
+    device_property_fill_and_register(&device_property_dedup_store,
+                                      G_TYPE_STRING, "dedup_store",
+      "Directory of the chunk store of a dedup device");
+    device_property_fill_and_register(&device_property_dedup_ratio,
+                                      G_TYPE_DOUBLE, "dedup_ratio",
+      "Bytes written to the device per byte added to the chunk store");
+    device_property_fill_and_register(&device_property_dedup_throughput,
+                                      G_TYPE_UINT64, "dedup_throughput",
+      "Bytes per second written to the dedup device");
+
+    register_device(dedup_device_factory, device_prefix_list);
+}
+
+static Device *
+dedup_device_factory(
+    char *device_name,
+    char *device_type,
+    char *device_node)
+{
+    Device *device;
+
+    g_assert(g_str_has_prefix(device_type, "dedup"));
+
+    device = DEVICE(g_object_new(TYPE_DEDUP_DEVICE, NULL));
+    device_open_device(device, device_name, device_type, device_node);
+
+    return device;
+}
+
+static void
+dedup_device_class_init (
+    DedupDeviceClass *c)
+{
+    DeviceClass *device_class = DEVICE_CLASS(c);
+    GObjectClass *g_object_class = G_OBJECT_CLASS(c);
+    guint64 x = DEDUP_GEAR_SEED;
+    int i;
+
+    parent_class = g_type_class_ref(TYPE_VFS_DEVICE);
+
+    device_class->open_device = dedup_device_open_device;
+    device_class->start_file = dedup_device_start_file;
+    device_class->write_block = dedup_device_write_block;
+    device_class->finish_file = dedup_device_finish_file;
+    device_class->seek_file = dedup_device_seek_file;
+    device_class->seek_block = dedup_device_seek_block;
+    device_class->read_block = dedup_device_read_block;
+    device_class->recycle_file = dedup_device_recycle_file;
+    device_class->erase = dedup_device_erase;
+
+    g_object_class->finalize = dedup_device_finalize;
+
+    /* splitmix64, so the table is the same on every system */
+    for (i = 0; i < 256; i++) {
+	guint64 z = (x += G_GUINT64_CONSTANT(0x9e3779b97f4a7c15));
+	z = (z ^ (z >> 30)) * G_GUINT64_CONSTANT(0xbf58476d1ce4e5b9);
+	z = (z ^ (z >> 27)) * G_GUINT64_CONSTANT(0x94d049bb133111eb);
+	dedup_gear[i] = z ^ (z >> 31);
+    }
+}
+
+static void
+dedup_device_base_init(
+    DedupDeviceClass *c)
+{
+    DeviceClass *device_class = (DeviceClass *)c;
+
+    device_class_register_property(device_class, PROPERTY_DEDUP_STORE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    property_set_dedup_store_fn);
+
+    device_class_register_property(device_class, PROPERTY_DEDUP_RATIO,
+	    PROPERTY_ACCESS_GET_MASK,
+	    property_get_dedup_ratio_fn,
+	    NULL);
+
+    device_class_register_property(device_class, PROPERTY_DEDUP_THROUGHPUT,
+	    PROPERTY_ACCESS_GET_MASK,
+	    property_get_dedup_throughput_fn,
+	    NULL);
+}
+
+static guint
+dedup_fp_hash(
+    gconstpointer key)
+{
+    guint h;
+
+    /* the fingerprint is already well mixed */
+    memcpy(&h, key, sizeof(h));
+    return h;
+}
+
+static gboolean
+dedup_fp_equal(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return memcmp(a, b, DEDUP_FP_SIZE) == 0;
+}
+
+static GHashTable *
+dedup_fp_table_new(void)
+{
+    return g_hash_table_new_full(dedup_fp_hash, dedup_fp_equal, g_free, NULL);
+}
+
+/* Add count to the value of fp in a table made by dedup_fp_table_new */
+static void
+dedup_fp_table_add(
+    GHashTable *table,
+    const guint8 *fp,
+    guint count)
+{
+    gpointer orig_key, value;
+
+    if (g_hash_table_lookup_extended(table, fp, &orig_key, &value)) {
+	g_hash_table_insert(table, g_memdup(fp, DEDUP_FP_SIZE),
+			    GUINT_TO_POINTER(GPOINTER_TO_UINT(value) + count));
+    } else {
+	g_hash_table_insert(table, g_memdup(fp, DEDUP_FP_SIZE),
+			    GUINT_TO_POINTER(count));
+    }
+}
+
+static void
+dedup_device_init (
+    DedupDevice *self)
+{
+    Device *dself = DEVICE(self);
+    VfsDevice *vself = VFS_DEVICE(self);
+    GValue val;
+
+    self->store_dir = NULL;
+    self->pending = g_byte_array_sized_new(DEDUP_CHUNK_MAX * 2);
+    self->cdc_pos = 0;
+    self->cdc_hash = 0;
+    self->recipe = g_byte_array_sized_new(DEDUP_RECIPE_FLUSH + DEDUP_REF_SIZE);
+    self->file_refs = dedup_fp_table_new();
+    self->index = NULL;
+    self->index_gen = 0;
+    self->index_offset = 0;
+    self->bloom = NULL;
+    self->bloom_mask = 0;
+    self->chunks = NULL;
+    self->chunks_size = 0;
+    self->read_offset = 0;
+    self->cur_chunk = 0;
+    self->chunk_data = NULL;
+    self->bytes_ingested = 0;
+    self->bytes_stored = 0;
+    self->check_space = TRUE;
+    self->store_free = 0;
+    self->store_used = 0;
+    self->store_checked = 0;
+    self->write_timer = g_timer_new();
+    g_timer_stop(self->write_timer);
+
+    self->vfs_clear_and_prepare_label = vself->clear_and_prepare_label;
+    vself->clear_and_prepare_label = &dedup_clear_and_prepare_label;
+    vself->update_volume_size = &dedup_update_volume_size;
+
+    /* Data is only written to the store once it is cut into chunks, some
+     * time after write_block returned, so a full filesystem can not be
+     * reported in time for LEOM.  All the slots share the store, so another
+     * volume would not help anyway: write_block fails instead when the store
+     * gets full. */
+    vself->leom = FALSE;
+
+    bzero(&val, sizeof(val));
+
+    g_value_init(&val, G_TYPE_BOOLEAN);
+    g_value_set_boolean(&val, FALSE);
+    device_set_simple_property(dself, PROPERTY_LEOM,
+	&val, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DETECTED);
+    g_value_unset(&val);
+}
+
+static void
+dedup_device_finalize(
+    GObject *gself)
+{
+    DedupDevice *self = DEDUP_DEVICE(gself);
+
+    if (G_OBJECT_CLASS(parent_class)->finalize)
+	G_OBJECT_CLASS(parent_class)->finalize(gself);
+
+    amfree(self->store_dir);
+    g_byte_array_free(self->pending, TRUE);
+    g_byte_array_free(self->recipe, TRUE);
+    g_hash_table_destroy(self->file_refs);
+    if (self->index)
+	g_hash_table_destroy(self->index);
+    amfree(self->bloom);
+    if (self->chunks)
+	g_array_free(self->chunks, TRUE);
+    amfree(self->chunk_data);
+    g_timer_destroy(self->write_timer);
+}
+
+static void
+dedup_device_open_device(
+    Device *dself,
+    char *device_name,
+    char *device_type,
+    char *device_node)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    char *node, *dir;
+    GValue val;
+
+    /* by default, the store is next to the slot directory, so all the slots
+     * of a chg-disk changer share it */
+    node = g_strdup(device_node);
+    while (strlen(node) > 1 && node[strlen(node)-1] == '/')
+	node[strlen(node)-1] = '\0';
+    dir = g_path_get_dirname(node);
+    self->store_dir = g_strconcat(dir, "/dedup", NULL);
+    g_free(dir);
+    g_free(node);
+
+    bzero(&val, sizeof(val));
+    g_value_init(&val, G_TYPE_STRING);
+    g_value_set_string(&val, self->store_dir);
+    device_set_simple_property(dself, PROPERTY_DEDUP_STORE,
+	&val, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&val);
+
+    parent_class->open_device(dself, device_name, device_type, device_node);
+}
+
+static gboolean
+property_set_dedup_store_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+
+    amfree(self->store_dir);
+    self->store_dir = g_value_dup_string(val);
+
+    /* the index and the filter describe the old store */
+    if (self->index)
+	g_hash_table_destroy(self->index);
+    self->index = NULL;
+    amfree(self->bloom);
+    self->store_checked = 0;
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
+static gboolean
+property_get_dedup_ratio_fn(
+    Device *dself,
+    DevicePropertyBase *base G_GNUC_UNUSED,
+    GValue *val,
+    PropertySurety *surety,
+    PropertySource *source)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    gdouble ratio = 1.0;
+
+    if (self->bytes_ingested > 0)
+	ratio = (gdouble)self->bytes_ingested / MAX(self->bytes_stored, 1);
+
+    g_value_unset_init(val, G_TYPE_DOUBLE);
+    g_value_set_double(val, ratio);
+
+    if (surety)
+	*surety = PROPERTY_SURETY_GOOD;
+
+    if (source)
+	*source = PROPERTY_SOURCE_DETECTED;
+
+    return TRUE;
+}
+
+static gboolean
+property_get_dedup_throughput_fn(
+    Device *dself,
+    DevicePropertyBase *base G_GNUC_UNUSED,
+    GValue *val,
+    PropertySurety *surety,
+    PropertySource *source)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    gdouble elapsed = g_timer_elapsed(self->write_timer, NULL);
+    guint64 throughput = 0;
+
+    if (elapsed > 0)
+	throughput = (guint64)(self->bytes_ingested / elapsed);
+
+    g_value_unset_init(val, G_TYPE_UINT64);
+    g_value_set_uint64(val, throughput);
+
+    if (surety)
+	*surety = PROPERTY_SURETY_GOOD;
+
+    if (source)
+	*source = PROPERTY_SOURCE_DETECTED;
+
+    return TRUE;
+}
+
+/*
+ * Chunk store
+ */
+
+static char *
+dedup_chunk_path(
+    DedupDevice *self,
+    const guint8 *fp)
+{
+    char hex[DEDUP_FP_SIZE * 2 + 1];
+    int i;
+
+    for (i = 0; i < DEDUP_FP_SIZE; i++)
+	g_snprintf(hex + 2*i, 3, "%02x", fp[i]);
+
+    return g_strdup_printf("%s/%.2s/%s", self->store_dir, hex, hex);
+}
+
+static void
+dedup_bloom_add(
+    DedupDevice *self,
+    const guint8 *fp)
+{
+    guint64 h1, h2;
+    int i;
+
+    memcpy(&h1, fp, sizeof(h1));
+    memcpy(&h2, fp + sizeof(h1), sizeof(h2));
+    h2 |= 1;
+    for (i = 0; i < DEDUP_BLOOM_HASHES; i++) {
+	guint64 bit = (h1 + i * h2) & self->bloom_mask;
+	self->bloom[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+static gboolean
+dedup_bloom_check(
+    DedupDevice *self,
+    const guint8 *fp)
+{
+    guint64 h1, h2;
+    int i;
+
+    memcpy(&h1, fp, sizeof(h1));
+    memcpy(&h2, fp + sizeof(h1), sizeof(h2));
+    h2 |= 1;
+    for (i = 0; i < DEDUP_BLOOM_HASHES; i++) {
+	guint64 bit = (h1 + i * h2) & self->bloom_mask;
+	if (!(self->bloom[bit >> 3] & (1 << (bit & 7))))
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+/* Lock the index, creating the store if needed.  Returns NULL, with the
+ * device error set, on failure. */
+static file_lock *
+dedup_index_lock(
+    DedupDevice *self)
+{
+    Device *dself = DEVICE(self);
+    char *index_path;
+    file_lock *lock;
+    int rv;
+
+    if (mkdir(self->store_dir, 0777) < 0 && errno != EEXIST) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't create chunk store %s: %s"),
+			    self->store_dir, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return NULL;
+    }
+
+    index_path = g_strconcat(self->store_dir, "/index", NULL);
+    lock = file_lock_new(index_path);
+    while ((rv = file_lock_lock(lock)) == 1)
+	g_usleep(DEDUP_LOCK_POLL);
+    if (rv == -1) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't lock chunk index %s: %s"),
+			    index_path, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	file_lock_free(lock);
+	lock = NULL;
+    }
+    g_free(index_path);
+
+    return lock;
+}
+
+static guint32
+dedup_log_crc(
+    const guint8 *data,
+    gsize len)
+{
+    crc_t crc;
+
+    crc32_init(&crc);
+    crc32_add((uint8_t *)data, len, &crc);
+    return crc32_finish(&crc);
+}
+
+/* Apply n log records to the index */
+static void
+dedup_index_apply(
+    DedupDevice *self,
+    const guint8 *recs,
+    guint32 n)
+{
+    guint32 i;
+
+    for (i = 0; i < n; i++) {
+	const guint8 *rec = recs + (gsize)i * DEDUP_LOG_REC_SIZE;
+	guint32 change;
+	gint64 refcount;
+
+	memcpy(&change, rec + DEDUP_FP_SIZE, sizeof(change));
+	change = GUINT32_FROM_BE(change);
+	refcount = GPOINTER_TO_UINT(g_hash_table_lookup(self->index, rec));
+	refcount += (gint32)change;
+	if (refcount > 0) {
+	    g_hash_table_insert(self->index, g_memdup(rec, DEDUP_FP_SIZE),
+				GUINT_TO_POINTER((guint)refcount));
+	} else {
+	    g_hash_table_remove(self->index, rec);
+	}
+
+	if (self->bloom && (gint32)change > 0)
+	    dedup_bloom_add(self, rec);
+    }
+}
+
+/* Bring self->index up to date with the log open on fd; the index must be
+ * locked.  Only the transactions appended since the last call are read,
+ * unless the log was rewritten. */
+static gboolean
+dedup_index_replay(
+    DedupDevice *self,
+    int fd)
+{
+    Device *dself = DEVICE(self);
+    struct stat st;
+    guint8 header[DEDUP_LOG_HEADER_SIZE];
+    guint64 gen;
+    guint8 *buf, *p;
+    gsize len;
+
+    if (fstat(fd, &st) < 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't stat chunk index in %s: %s"),
+			    self->store_dir, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    /* a new store, or one whose first writer died before writing the
+     * header: nothing was committed yet */
+    if ((guint64)st.st_size < DEDUP_LOG_HEADER_SIZE) {
+	memcpy(header, DEDUP_LOG_MAGIC, DEDUP_LOG_MAGIC_SIZE);
+	gen = GUINT64_TO_BE(1);
+	memcpy(header + DEDUP_LOG_MAGIC_SIZE, &gen, sizeof(gen));
+	if (ftruncate(fd, 0) < 0 ||
+	    lseek(fd, 0, SEEK_SET) == (off_t)-1 ||
+	    full_write(fd, header, sizeof(header)) < sizeof(header)) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Can't write chunk index in %s: %s"),
+				self->store_dir, strerror(errno)),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    return FALSE;
+	}
+	st.st_size = sizeof(header);
+    } else if (lseek(fd, 0, SEEK_SET) == (off_t)-1 ||
+	       full_read(fd, header, sizeof(header)) < sizeof(header)) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't read chunk index in %s: %s"),
+			    self->store_dir, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    if (memcmp(header, DEDUP_LOG_MAGIC, DEDUP_LOG_MAGIC_SIZE) != 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Chunk index in %s is corrupted"), self->store_dir),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    memcpy(&gen, header + DEDUP_LOG_MAGIC_SIZE, sizeof(gen));
+    gen = GUINT64_FROM_BE(gen);
+
+    if (!self->index || gen != self->index_gen ||
+	self->index_offset > (guint64)st.st_size) {
+	if (self->index)
+	    g_hash_table_remove_all(self->index);
+	else
+	    self->index = dedup_fp_table_new();
+	self->index_gen = gen;
+	self->index_offset = DEDUP_LOG_HEADER_SIZE;
+    }
+
+    len = st.st_size - self->index_offset;
+    if (len == 0)
+	return TRUE;
+
+    buf = g_malloc(len);
+    if (lseek(fd, self->index_offset, SEEK_SET) == (off_t)-1 ||
+	full_read(fd, buf, len) < len) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't read chunk index in %s: %s"),
+			    self->store_dir, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	g_free(buf);
+	return FALSE;
+    }
+
+    /* stop at the first incomplete transaction; the next update
+     * overwrites it */
+    p = buf;
+    while (p + 4 <= buf + len) {
+	guint32 n, crc;
+	gsize txn_len;
+
+	memcpy(&n, p, sizeof(n));
+	n = GUINT32_FROM_BE(n);
+	txn_len = 4 + (gsize)n * DEDUP_LOG_REC_SIZE;
+	if (n == 0 || txn_len + 4 > (gsize)(buf + len - p))
+	    break;
+	memcpy(&crc, p + txn_len, sizeof(crc));
+	if (GUINT32_FROM_BE(crc) != dedup_log_crc(p, txn_len))
+	    break;
+
+	dedup_index_apply(self, p + 4, n);
+	p += txn_len + 4;
+    }
+    self->index_offset += p - buf;
+
+    g_free(buf);
+    return TRUE;
+}
+
+/* Lock the index and replay the log.  Returns the log fd, or -1 with the
+ * device error set; close it, then free *lock. */
+static int
+dedup_index_open(
+    DedupDevice *self,
+    file_lock **lock)
+{
+    char *log_path;
+    int fd;
+
+    if (!(*lock = dedup_index_lock(self)))
+	return -1;
+
+    log_path = g_strconcat(self->store_dir, "/index.log", NULL);
+    fd = robust_open(log_path, O_CREAT | O_RDWR, VFS_DEVICE_CREAT_MODE);
+    if (fd < 0) {
+	device_set_error(DEVICE(self),
+	    g_strdup_printf(_("Can't open chunk index %s: %s"),
+			    log_path, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+    } else if (!dedup_index_replay(self, fd)) {
+	robust_close(fd);
+	fd = -1;
+    }
+    g_free(log_path);
+
+    if (fd < 0) {
+	file_lock_free(*lock);
+	*lock = NULL;
+    }
+    return fd;
+}
+
+/* Rewrite the log as a single transaction when most of it is outdated.
+ * Failing is harmless: the log is still valid, only longer. */
+static void
+dedup_index_compact(
+    DedupDevice *self)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    GByteArray *data;
+    guint64 gen;
+    guint32 n, crc;
+    char *log_path, *tmp_path;
+    int fd;
+
+    n = g_hash_table_size(self->index);
+    if (self->index_offset < DEDUP_LOG_COMPACT_MIN ||
+	self->index_offset < 2 * (DEDUP_LOG_HEADER_SIZE + 8 +
+				  (guint64)n * DEDUP_LOG_REC_SIZE))
+	return;
+
+    data = g_byte_array_sized_new(DEDUP_LOG_HEADER_SIZE + 8 +
+				  (gsize)n * DEDUP_LOG_REC_SIZE);
+    gen = GUINT64_TO_BE(self->index_gen + 1);
+    g_byte_array_append(data, (guint8 *)DEDUP_LOG_MAGIC, DEDUP_LOG_MAGIC_SIZE);
+    g_byte_array_append(data, (guint8 *)&gen, sizeof(gen));
+    if (n > 0) {
+	guint32 be = GUINT32_TO_BE(n);
+
+	g_byte_array_append(data, (guint8 *)&be, sizeof(be));
+	g_hash_table_iter_init(&iter, self->index);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+	    be = GUINT32_TO_BE(GPOINTER_TO_UINT(value));
+	    g_byte_array_append(data, key, DEDUP_FP_SIZE);
+	    g_byte_array_append(data, (guint8 *)&be, sizeof(be));
+	}
+	crc = GUINT32_TO_BE(dedup_log_crc(data->data + DEDUP_LOG_HEADER_SIZE,
+					  data->len - DEDUP_LOG_HEADER_SIZE));
+	g_byte_array_append(data, (guint8 *)&crc, sizeof(crc));
+    }
+
+    log_path = g_strconcat(self->store_dir, "/index.log", NULL);
+    tmp_path = g_strconcat(log_path, ".tmp", NULL);
+    fd = robust_open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC,
+		     VFS_DEVICE_CREAT_MODE);
+    if (fd < 0 ||
+	full_write(fd, data->data, data->len) < data->len ||
+	fsync(fd) < 0 ||
+	robust_close(fd) < 0 ||
+	rename(tmp_path, log_path) < 0) {
+	g_debug("Can't compact chunk index %s: %s", log_path, strerror(errno));
+	if (fd >= 0)
+	    robust_close(fd);
+	unlink(tmp_path);
+    } else {
+	self->index_gen++;
+	self->index_offset = data->len;
+    }
+
+    g_free(tmp_path);
+    g_free(log_path);
+    g_byte_array_free(data, TRUE);
+}
+
+/* Build the Bloom filter from the index */
+static gboolean
+dedup_bloom_build(
+    DedupDevice *self)
+{
+    file_lock *lock;
+    GHashTableIter iter;
+    gpointer key;
+    guint64 bits = DEDUP_BLOOM_MIN_BITS;
+    int fd;
+
+    if ((fd = dedup_index_open(self, &lock)) < 0)
+	return FALSE;
+
+    while (bits < (guint64)g_hash_table_size(self->index) * DEDUP_BLOOM_BITS_PER_CHUNK)
+	bits <<= 1;
+    amfree(self->bloom);
+    self->bloom = g_malloc0(bits / 8);
+    self->bloom_mask = bits - 1;
+
+    g_hash_table_iter_init(&iter, self->index);
+    while (g_hash_table_iter_next(&iter, &key, NULL))
+	dedup_bloom_add(self, key);
+
+    robust_close(fd);
+    file_lock_free(lock);
+    return TRUE;
+}
+
+/* Apply the references in delta to the index, by appending a transaction
+ * to the log.  When adding, check that the chunks not referenced yet were
+ * not removed since they were found in the store; when releasing, remove
+ * the chunks that are no longer referenced, once the transaction is
+ * written.  A release never takes a refcount below zero, nor removes a
+ * chunk that was not in the index: it may belong to a file being
+ * written. */
+static gboolean
+dedup_index_update(
+    DedupDevice *self,
+    GHashTable *delta,
+    gboolean adding)
+{
+    Device *dself = DEVICE(self);
+    file_lock *lock;
+    GHashTableIter iter;
+    gpointer key, value;
+    GByteArray *txn;
+    GSList *removed = NULL, *r;
+    guint32 n = 0, be;
+    int fd;
+    gboolean rval = TRUE;
+
+    if (g_hash_table_size(delta) == 0)
+	return TRUE;
+
+    if ((fd = dedup_index_open(self, &lock)) < 0)
+	return FALSE;
+
+    txn = g_byte_array_sized_new(8 + g_hash_table_size(delta) * DEDUP_LOG_REC_SIZE);
+    g_byte_array_set_size(txn, 4);
+
+    g_hash_table_iter_init(&iter, delta);
+    while (rval && g_hash_table_iter_next(&iter, &key, &value)) {
+	guint count = GPOINTER_TO_UINT(value);
+	guint old = GPOINTER_TO_UINT(g_hash_table_lookup(self->index, key));
+	gint32 change;
+	char *path;
+	struct stat st;
+
+	if (adding) {
+	    if (old == 0) {
+		path = dedup_chunk_path(self, key);
+		if (stat(path, &st) < 0) {
+		    device_set_error(dself,
+			g_strdup_printf(_("Chunk %s was removed while it was being written"), path),
+			DEVICE_STATUS_VOLUME_ERROR);
+		    rval = FALSE;
+		}
+		g_free(path);
+	    }
+	    change = count;
+	} else if (old == 0) {
+	    continue;
+	} else if (old < count) {
+	    path = dedup_chunk_path(self, key);
+	    g_debug("Chunk %s has %u references, not releasing %u", path,
+		    old, count);
+	    g_free(path);
+	    change = -(gint32)old;
+	} else {
+	    if (old == count)
+		removed = g_slist_prepend(removed, dedup_chunk_path(self, key));
+	    change = -(gint32)count;
+	}
+
+	be = GUINT32_TO_BE((guint32)change);
+	g_byte_array_append(txn, key, DEDUP_FP_SIZE);
+	g_byte_array_append(txn, (guint8 *)&be, sizeof(be));
+	n++;
+    }
+
+    if (rval && n > 0) {
+	guint32 crc;
+
+	be = GUINT32_TO_BE(n);
+	memcpy(txn->data, &be, sizeof(be));
+	crc = GUINT32_TO_BE(dedup_log_crc(txn->data, txn->len));
+	g_byte_array_append(txn, (guint8 *)&crc, sizeof(crc));
+
+	/* overwrite any incomplete transaction left by a dead writer */
+	if (ftruncate(fd, self->index_offset) < 0 ||
+	    lseek(fd, self->index_offset, SEEK_SET) == (off_t)-1 ||
+	    full_write(fd, txn->data, txn->len) < txn->len ||
+	    fsync(fd) < 0) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Can't write chunk index in %s: %s"),
+				self->store_dir, strerror(errno)),
+		DEVICE_STATUS_VOLUME_ERROR);
+	    rval = FALSE;
+	} else {
+	    dedup_index_apply(self, txn->data + 4, n);
+	    self->index_offset += txn->len;
+
+	    for (r = removed; r != NULL; r = r->next) {
+		if (unlink((char *)r->data) < 0 && errno != ENOENT)
+		    g_debug("Can't remove chunk %s: %s", (char *)r->data,
+			    strerror(errno));
+	    }
+	    dedup_index_compact(self);
+	}
+    }
+
+    slist_free_full(removed, g_free);
+    g_byte_array_free(txn, TRUE);
+    robust_close(fd);
+    file_lock_free(lock);
+    return rval;
+}
+
+/* Is the chunk already in the store? */
+static gboolean
+dedup_chunk_exists(
+    DedupDevice *self,
+    const guint8 *fp)
+{
+    char *path;
+    struct stat st;
+    gboolean rval;
+
+    if (!dedup_bloom_check(self, fp))
+	return FALSE;
+
+    path = dedup_chunk_path(self, fp);
+    rval = (stat(path, &st) == 0);
+    g_free(path);
+    return rval;
+}
+
+static gboolean
+dedup_write_chunk(
+    DedupDevice *self,
+    const guint8 *fp,
+    const guint8 *data,
+    gsize len)
+{
+    Device *dself = DEVICE(self);
+    char *path, *tmp_path, *dir;
+    int fd;
+    gboolean rval = FALSE;
+
+    path = dedup_chunk_path(self, fp);
+    tmp_path = g_strdup_printf("%s.tmp.%d", path, (int)getpid());
+
+    fd = robust_open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC,
+		     VFS_DEVICE_CREAT_MODE);
+    if (fd < 0 && errno == ENOENT) {
+	dir = g_path_get_dirname(path);
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+	    g_debug("Can't create %s: %s", dir, strerror(errno));
+	}
+	g_free(dir);
+	fd = robust_open(tmp_path, O_CREAT | O_WRONLY | O_TRUNC,
+			 VFS_DEVICE_CREAT_MODE);
+    }
+    if (fd < 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't open chunk file %s: %s"), tmp_path, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	goto out;
+    }
+
+    if (full_write(fd, data, len) < len) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error writing chunk file %s: %s"), tmp_path, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	robust_close(fd);
+	unlink(tmp_path);
+	goto out;
+    }
+
+    if (robust_close(fd) < 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error closing chunk file %s: %s"), tmp_path, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	unlink(tmp_path);
+	goto out;
+    }
+
+    /* another writer may have stored the same chunk meanwhile; its content
+     * is the same, so replacing it is harmless */
+    if (rename(tmp_path, path) < 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Can't rename %s to %s: %s"), tmp_path, path, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	unlink(tmp_path);
+	goto out;
+    }
+
+    rval = TRUE;
+
+out:
+    g_free(tmp_path);
+    g_free(path);
+    return rval;
+}
+
+static gboolean
+dedup_flush_recipe(
+    DedupDevice *self)
+{
+    IoResult result;
+
+    if (self->recipe->len == 0)
+	return TRUE;
+
+    result = vfs_device_robust_write(VFS_DEVICE(self),
+				     (char *)self->recipe->data,
+				     self->recipe->len);
+    g_byte_array_set_size(self->recipe, 0);
+
+    /* vfs_device_robust_write set error status appropriately */
+    return (result == RESULT_SUCCESS);
+}
+
+/* End the recipe with the commit record, once its references are in the
+ * index */
+static gboolean
+dedup_commit_recipe(
+    DedupDevice *self)
+{
+    guint8 rec[DEDUP_REF_SIZE];
+
+    bzero(rec, sizeof(rec));
+    memcpy(rec, DEDUP_COMMIT_MAGIC, sizeof(DEDUP_COMMIT_MAGIC));
+    g_byte_array_append(self->recipe, rec, sizeof(rec));
+
+    return dedup_flush_recipe(self);
+}
+
+/* Check that the store has room for size more bytes, or set the device
+ * error.  The store is shared by all the slots, so a full store is a device
+ * error, not the end of the volume. */
+static gboolean
+dedup_check_store_space(
+    DedupDevice *self,
+    guint64 size)
+{
+    struct fs_usage fsusage;
+    guint64 est_avail = 0;
+
+    if (!self->check_space)
+	return TRUE;
+
+    if (self->store_free >= self->store_used + size)
+	est_avail = self->store_free - self->store_used - size;
+
+    if (est_avail > 2 * DEDUP_STORE_RESERVE &&
+	self->store_used < DEDUP_SPACE_CHECK_EVERY &&
+	self->store_checked + DEDUP_SPACE_CHECK_SECONDS > time(NULL))
+	return TRUE;
+
+    if (get_fs_usage(self->store_dir, NULL, &fsusage) < 0 ||
+	fsusage.fsu_bavail_top_bit_set) {
+	g_warning("Filesystem of chunk store %s cannot provide free space: %s; not checking it",
+		self->store_dir,
+		fsusage.fsu_bavail_top_bit_set? "no result" : strerror(errno));
+	self->check_space = FALSE;
+	return TRUE;
+    }
+
+    self->store_free = fsusage.fsu_bavail * fsusage.fsu_blocksize;
+    self->store_used = 0;
+    self->store_checked = time(NULL);
+
+    if (self->store_free < size + DEDUP_STORE_RESERVE) {
+	device_set_error(DEVICE(self),
+	    g_strdup_printf(_("Chunk store %s is full"), self->store_dir),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+dedup_store_chunk(
+    DedupDevice *self,
+    const guint8 *data,
+    gsize len)
+{
+    GChecksum *checksum;
+    guint8 fp[DEDUP_FP_SIZE];
+    gsize fp_len = sizeof(fp);
+    guint32 size;
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_checksum_update(checksum, data, len);
+    g_checksum_get_digest(checksum, fp, &fp_len);
+    g_checksum_free(checksum);
+
+    self->bytes_ingested += len;
+
+    if (!g_hash_table_lookup(self->file_refs, fp) &&
+	!dedup_chunk_exists(self, fp)) {
+	if (!dedup_write_chunk(self, fp, data, len))
+	    return FALSE;
+	dedup_bloom_add(self, fp);
+	self->bytes_stored += len;
+	self->store_used += len;
+    }
+    dedup_fp_table_add(self->file_refs, fp, 1);
+
+    size = GUINT32_TO_BE(len);
+    g_byte_array_append(self->recipe, fp, DEDUP_FP_SIZE);
+    g_byte_array_append(self->recipe, (guint8 *)&size, sizeof(size));
+    if (self->recipe->len >= DEDUP_RECIPE_FLUSH)
+	return dedup_flush_recipe(self);
+
+    return TRUE;
+}
+
+/* Find the end of the next chunk in the pending data.  Returns 0 if more
+ * data is needed to decide, unless final is set. */
+static gsize
+dedup_find_cut(
+    DedupDevice *self,
+    gboolean final)
+{
+    const guint8 *buf = self->pending->data;
+    gsize len = self->pending->len;
+    gsize end = MIN(len, DEDUP_CHUNK_MAX);
+    gsize i = MAX(self->cdc_pos, DEDUP_CHUNK_MIN);
+    guint64 hash = self->cdc_hash;
+
+    if (len == 0)
+	return 0;
+
+    for (; i < end; i++) {
+	hash = (hash << 1) + dedup_gear[buf[i]];
+	if (!(hash & (i < DEDUP_CHUNK_AVG ? DEDUP_MASK_S : DEDUP_MASK_L))) {
+	    end = i + 1;
+	    goto cut;
+	}
+    }
+
+    if (end == DEDUP_CHUNK_MAX || final)
+	goto cut;
+
+    self->cdc_pos = i;
+    self->cdc_hash = hash;
+    return 0;
+
+cut:
+    self->cdc_pos = 0;
+    self->cdc_hash = 0;
+    return end;
+}
+
+/* Cut the pending data into chunks and store them */
+static gboolean
+dedup_chunk_pending(
+    DedupDevice *self,
+    gboolean final)
+{
+    gsize cut;
+
+    while ((cut = dedup_find_cut(self, final)) > 0) {
+	if (!dedup_store_chunk(self, self->pending->data, cut))
+	    return FALSE;
+	g_byte_array_remove_range(self->pending, 0, cut);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Writing
+ */
+
+static gboolean
+dedup_device_start_file(
+    Device *dself,
+    dumpfile_t *ji)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+
+    if (device_in_error(self)) return FALSE;
+
+    /* chunks stored by other writers after this point are not in the
+     * filter; they are simply stored again */
+    if (!self->bloom && !dedup_bloom_build(self))
+	return FALSE;
+
+    if (!dedup_check_store_space(self, 0))
+	return FALSE;
+
+    g_byte_array_set_size(self->pending, 0);
+    self->cdc_pos = 0;
+    self->cdc_hash = 0;
+    g_byte_array_set_size(self->recipe, 0);
+    g_hash_table_remove_all(self->file_refs);
+
+    return parent_class->start_file(dself, ji);
+}
+
+static DeviceWriteResult
+dedup_device_write_block(
+    Device *dself,
+    guint size,
+    gpointer data)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    VfsDevice *vself = VFS_DEVICE(dself);
+    gboolean ok;
+
+    if (device_in_error(self)) return WRITE_FAILED;
+
+    g_assert(vself->open_file_fd >= 0);
+
+    /* MAX_VOLUME_USAGE counts the data written to the volume, not what it
+     * takes in the store */
+    if (vself->enforce_volume_limit && vself->volume_limit &&
+	vself->volume_bytes + size > vself->volume_limit) {
+	dself->is_eom = TRUE;
+	device_set_error(dself,
+	    g_strdup(_("No space left on device: more than MAX_VOLUME_USAGE bytes written")),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	return WRITE_FAILED;
+    }
+
+    if (!dedup_check_store_space(self, size))
+	return WRITE_FAILED;
+
+    g_timer_continue(self->write_timer);
+    g_byte_array_append(self->pending, data, size);
+    ok = dedup_chunk_pending(self, FALSE);
+    g_timer_stop(self->write_timer);
+
+    if (!ok)
+	return WRITE_FAILED;
+
+    vself->volume_bytes += size;
+    dself->block++;
+    g_mutex_lock(dself->device_mutex);
+    dself->bytes_written += size;
+    g_mutex_unlock(dself->device_mutex);
+
+    return WRITE_SUCCEED;
+}
+
+static gboolean
+dedup_device_finish_file(
+    Device *dself)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    gboolean ok;
+
+    if (!dself->in_file)
+	return TRUE;
+
+    /* the commit record is only written once the references are in the
+     * index; if anything fails before, the recipe stays on the volume
+     * without it and its references are never released */
+    ok = !device_in_error(self);
+    if (ok) {
+	g_timer_continue(self->write_timer);
+	ok = dedup_chunk_pending(self, TRUE) && dedup_flush_recipe(self);
+	g_timer_stop(self->write_timer);
+    }
+    if (ok)
+	ok = dedup_index_update(self, self->file_refs, TRUE) &&
+	     dedup_commit_recipe(self);
+    g_hash_table_remove_all(self->file_refs);
+
+    /* the parent closes the file even if this one failed */
+    if (!parent_class->finish_file(dself))
+	return FALSE;
+
+    return ok;
+}
+
+/*
+ * Reading
+ */
+
+static gboolean
+dedup_read_recipe(
+    DedupDevice *self,
+    const char *path,
+    GArray *refs,
+    GHashTable *delta,
+    guint64 *size)
+{
+    guint8 *buf;
+    gsize len, i;
+    int fd;
+    GHashTable *file_delta = NULL;
+    gboolean committed = FALSE;
+    gboolean rval = TRUE;
+
+    *size = VFS_DEVICE_LABEL_SIZE;
+
+    fd = robust_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+	device_set_error(DEVICE(self),
+	    g_strdup_printf(_("Couldn't open file %s: %s"), path, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    buf = g_malloc(DEDUP_REF_SIZE * 1024);
+    if (lseek(fd, VFS_DEVICE_LABEL_SIZE, SEEK_SET) == (off_t)-1) {
+	device_set_error(DEVICE(self),
+	    g_strdup_printf(_("Error seeking within file %s: %s"), path, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	rval = FALSE;
+    }
+
+    while (rval && (len = full_read(fd, buf, DEDUP_REF_SIZE * 1024)) > 0) {
+	for (i = 0; i + DEDUP_REF_SIZE <= len; i += DEDUP_REF_SIZE) {
+	    DedupRef ref;
+	    guint32 chunk_size;
+
+	    memcpy(ref.fp, buf + i, DEDUP_FP_SIZE);
+	    memcpy(&chunk_size, buf + i + DEDUP_FP_SIZE, sizeof(chunk_size));
+	    ref.size = GUINT32_FROM_BE(chunk_size);
+	    ref.offset = *size - VFS_DEVICE_LABEL_SIZE;
+	    *size += ref.size;
+
+	    if (ref.size == 0) {
+		if (memcmp(ref.fp, DEDUP_COMMIT_MAGIC, sizeof(DEDUP_COMMIT_MAGIC)) == 0)
+		    committed = TRUE;
+		continue;
+	    }
+
+	    if (refs)
+		g_array_append_val(refs, ref);
+	    if (delta) {
+		if (!file_delta)
+		    file_delta = dedup_fp_table_new();
+		dedup_fp_table_add(file_delta, ref.fp, 1);
+	    }
+	}
+	if (len < DEDUP_REF_SIZE * 1024)
+	    break;
+    }
+
+    /* only release the references that were added to the index */
+    if (file_delta) {
+	if (committed) {
+	    GHashTableIter iter;
+	    gpointer key, value;
+
+	    g_hash_table_iter_init(&iter, file_delta);
+	    while (g_hash_table_iter_next(&iter, &key, &value))
+		dedup_fp_table_add(delta, key, GPOINTER_TO_UINT(value));
+	} else {
+	    g_debug("%s was never committed to the chunk index, not releasing its chunks",
+		    path);
+	}
+	g_hash_table_destroy(file_delta);
+    }
+
+    g_free(buf);
+    robust_close(fd);
+    return rval;
+}
+
+static dumpfile_t *
+dedup_device_seek_file(
+    Device *dself,
+    guint requested_file)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    VfsDevice *vself = VFS_DEVICE(dself);
+    dumpfile_t *rval;
+
+    if (self->chunks) {
+	g_array_free(self->chunks, TRUE);
+	self->chunks = NULL;
+    }
+    self->read_offset = 0;
+
+    rval = parent_class->seek_file(dself, requested_file);
+    if (!rval || !dself->in_file)
+	return rval;
+
+    self->chunks = g_array_new(FALSE, FALSE, sizeof(DedupRef));
+    self->cur_chunk = G_MAXUINT;
+    if (!dedup_read_recipe(self, vself->file_name, self->chunks, NULL,
+			   &self->chunks_size)) {
+	amfree(rval);
+	return NULL;
+    }
+    self->chunks_size -= VFS_DEVICE_LABEL_SIZE;
+
+    return rval;
+}
+
+static gboolean
+dedup_device_seek_block(
+    Device *dself,
+    guint64 block)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+
+    if (device_in_error(self)) return FALSE;
+
+    self->read_offset = block * dself->block_size;
+    dself->block = block;
+
+    return TRUE;
+}
+
+/* Load the chunk holding self->read_offset in chunk_data */
+static gboolean
+dedup_load_chunk(
+    DedupDevice *self)
+{
+    Device *dself = DEVICE(self);
+    DedupRef *ref;
+    guint lo, hi;
+    char *path;
+    int fd;
+    gsize got;
+
+    if (self->cur_chunk < self->chunks->len) {
+	ref = &g_array_index(self->chunks, DedupRef, self->cur_chunk);
+	if (self->read_offset >= ref->offset &&
+	    self->read_offset < ref->offset + ref->size)
+	    return TRUE;
+    }
+
+    /* reads are sequential, so this is usually the next one */
+    lo = 0;
+    hi = self->chunks->len;
+    if (self->cur_chunk + 1 < self->chunks->len &&
+	g_array_index(self->chunks, DedupRef, self->cur_chunk + 1).offset <= self->read_offset)
+	lo = self->cur_chunk + 1;
+    while (hi - lo > 1) {
+	guint mid = lo + (hi - lo) / 2;
+	if (g_array_index(self->chunks, DedupRef, mid).offset <= self->read_offset)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    self->cur_chunk = lo;
+    ref = &g_array_index(self->chunks, DedupRef, lo);
+
+    if (!self->chunk_data)
+	self->chunk_data = g_malloc(DEDUP_CHUNK_MAX);
+
+    path = dedup_chunk_path(self, ref->fp);
+    fd = robust_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Couldn't open chunk %s: %s"), path, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	self->cur_chunk = G_MAXUINT;
+	g_free(path);
+	return FALSE;
+    }
+    got = full_read(fd, self->chunk_data, MIN(ref->size, DEDUP_CHUNK_MAX));
+    robust_close(fd);
+    if (ref->size > DEDUP_CHUNK_MAX || got < ref->size) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Chunk %s is truncated"), path),
+	    DEVICE_STATUS_VOLUME_ERROR);
+	self->cur_chunk = G_MAXUINT;
+	g_free(path);
+	return FALSE;
+    }
+    g_free(path);
+
+    return TRUE;
+}
+
+static int
+dedup_device_read_block(
+    Device   *dself,
+    gpointer  data,
+    int      *size_req,
+    int       max_block G_GNUC_UNUSED)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    int size = 0;
+
+    if (device_in_error(self)) return -1;
+
+    if (data == NULL || (gsize)*size_req < dself->block_size) {
+        /* Just a size query. */
+	g_assert(dself->block_size < INT_MAX);
+        *size_req = (int)dself->block_size;
+        return 0;
+    }
+
+    if (!self->chunks || self->read_offset >= self->chunks_size) {
+        dself->is_eof = TRUE;
+	g_mutex_lock(dself->device_mutex);
+        dself->in_file = FALSE;
+	g_mutex_unlock(dself->device_mutex);
+	device_set_error(dself,
+	    g_strdup(_("EOF")),
+	    DEVICE_STATUS_SUCCESS);
+        return -1;
+    }
+
+    while ((gsize)size < dself->block_size &&
+	   self->read_offset < self->chunks_size) {
+	DedupRef *ref;
+	gsize offset, n;
+
+	if (!dedup_load_chunk(self))
+	    return -1;
+
+	ref = &g_array_index(self->chunks, DedupRef, self->cur_chunk);
+	offset = self->read_offset - ref->offset;
+	n = MIN(ref->size - offset, dself->block_size - size);
+	memcpy((char *)data + size, self->chunk_data + offset, n);
+	size += n;
+	self->read_offset += n;
+    }
+
+    *size_req = size;
+    g_mutex_lock(dself->device_mutex);
+    dself->bytes_read += size;
+    g_mutex_unlock(dself->device_mutex);
+    dself->block++;
+    return size;
+}
+
+/*
+ * Releasing volume files
+ */
+
+/* A SearchDirectoryFunctor */
+static gboolean
+dedup_release_functor(
+    const char *filename,
+    gpointer user_data)
+{
+    DedupRelease *rel = user_data;
+    VfsDevice *vself = VFS_DEVICE(rel->self);
+    int filenum = atoi(filename);
+    char *path;
+    guint64 size;
+
+    if (rel->filenum >= 0 && filenum != rel->filenum)
+	return TRUE;
+
+    path = g_strjoin(NULL, vself->dir_name, "/", filename, NULL);
+    if (!dedup_read_recipe(rel->self, path, NULL,
+			   filenum > 0 ? rel->delta : NULL, &size)) {
+	g_free(path);
+	return FALSE;
+    }
+    rel->size += size;
+
+    /* file 0 holds the label, which a relabel writes again */
+    if (filenum > 0)
+	rel->paths = g_slist_prepend(rel->paths, path);
+    else
+	g_free(path);
+
+    return TRUE;
+}
+
+static gboolean
+dedup_release_prepare(
+    DedupRelease *rel,
+    DedupDevice *self,
+    int filenum,
+    gboolean release)
+{
+    VfsDevice *vself = VFS_DEVICE(self);
+    DIR *dir_handle;
+
+    rel->self = self;
+    rel->filenum = filenum;
+    rel->delta = release ? dedup_fp_table_new() : NULL;
+    rel->paths = NULL;
+    rel->size = 0;
+
+    dir_handle = opendir(vself->dir_name);
+    if (dir_handle == NULL) {
+	device_set_error(DEVICE(rel->self),
+	    g_strdup_printf(_("Couldn't open device %s (directory %s) for reading: %s"),
+			    DEVICE(rel->self)->device_name, vself->dir_name, strerror(errno)),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    search_directory(dir_handle, "^[0-9]+\\.", dedup_release_functor, rel);
+    closedir(dir_handle);
+
+    return !device_in_error(rel->self);
+}
+
+static gboolean
+dedup_release_finish(
+    DedupRelease *rel)
+{
+    GSList *iter;
+    struct stat st;
+    gboolean rval = TRUE;
+
+    /* if a file could not be deleted, keep all the chunks: leaking them is
+     * better than breaking a recipe */
+    for (iter = rel->paths; iter != NULL; iter = iter->next) {
+	if (stat((char *)iter->data, &st) == 0) {
+	    g_debug("%s was not deleted, not releasing its chunks",
+		    (char *)iter->data);
+	    goto out;
+	}
+    }
+
+    rval = dedup_index_update(rel->self, rel->delta, FALSE);
+
+out:
+    dedup_release_free(rel);
+    return rval;
+}
+
+static void
+dedup_release_free(
+    DedupRelease *rel)
+{
+    slist_free_full(rel->paths, g_free);
+    rel->paths = NULL;
+    if (rel->delta)
+	g_hash_table_destroy(rel->delta);
+    rel->delta = NULL;
+}
+
+static gboolean
+dedup_device_recycle_file(
+    Device *dself,
+    guint filenum)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    DedupRelease rel;
+    gboolean rval;
+
+    if (device_in_error(self)) return FALSE;
+
+    if (!dedup_release_prepare(&rel, self, filenum, TRUE)) {
+	dedup_release_free(&rel);
+	return FALSE;
+    }
+
+    rval = parent_class->recycle_file(dself, filenum);
+    if (!dedup_release_finish(&rel))
+	rval = FALSE;
+    dedup_update_volume_size(dself);
+
+    return rval;
+}
+
+static gboolean
+dedup_device_erase(
+    Device *dself)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    DedupRelease rel;
+    gboolean rval;
+
+    if (!dedup_release_prepare(&rel, self, -1, TRUE)) {
+	dedup_release_free(&rel);
+	return FALSE;
+    }
+
+    rval = parent_class->erase(dself);
+    if (!dedup_release_finish(&rel))
+	rval = FALSE;
+
+    return rval;
+}
+
+static gboolean
+dedup_clear_and_prepare_label(
+    Device *dself,
+    char *label,
+    char *timestamp)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    DedupRelease rel;
+    gboolean rval;
+
+    if (!dedup_release_prepare(&rel, self, -1, TRUE)) {
+	dedup_release_free(&rel);
+	return FALSE;
+    }
+
+    rval = self->vfs_clear_and_prepare_label(dself, label, timestamp);
+    if (!dedup_release_finish(&rel))
+	rval = FALSE;
+
+    return rval;
+}
+
+static void
+dedup_update_volume_size(
+    Device *dself)
+{
+    DedupDevice *self = DEDUP_DEVICE(dself);
+    VfsDevice *vself = VFS_DEVICE(dself);
+    DedupRelease rel;
+
+    /* the size of a volume is the size of the data written to it */
+    if (dedup_release_prepare(&rel, self, -1, FALSE))
+	vself->volume_bytes = rel.size;
+    dedup_release_free(&rel);
+}
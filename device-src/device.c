@@ -50,6 +50,7 @@ void    tape_device_register    (void);
 #endif
 void    vfs_device_register     (void);
 void    diskflat_device_register (void);
+void    dedup_device_register   (void);
 #ifdef WANT_DVDRW_DEVICE
 void    dvdrw_device_register   (void);
 #endif
@@ -75,6 +76,7 @@ void device_api_init(void) {
     null_device_register();
     vfs_device_register();
     diskflat_device_register();
+    dedup_device_register();
 #ifdef WANT_TAPE_DEVICE
     tape_device_register();
 #endif
@@ -21,7 +21,9 @@
  */
 
 /* The RAIT device encapsulates some number of other devices into a single
- * redundant device. */
+ * redundant device.  Each block is split among the data children, and the
+ * last RAIT_PARITY children get Reed-Solomon parity chunks (see
+ * rait-parity.h), so that any RAIT_PARITY children can be lost. */
 
 #include "amanda.h"
 #include "property.h"
@@ -31,15 +33,17 @@
 #include "device.h"
 #include "fileheader.h"
 #include "amsemaphore.h"
+#include "rait-parity.h"
 
 /* Just a note about the failure mode of different operations:
-   - Recovers from a failure (enters degraded mode)
+   - Recovers from failures (enters degraded mode), as long as no more
+     children failed than there are parity children
      open_device()
      seek_file() -- explodes if headers don't match.
      seek_block() -- explodes if headers don't match.
      read_block() -- explodes if data doesn't match.
 
-   - Operates in degraded mode (but dies if a new problem shows up)
+   - Operates in degraded mode (but dies if too many problems show up)
      read_label() -- but dies on label mismatch.
      start() -- but dies when writing in degraded mode.
      property functions
@@ -83,8 +87,9 @@ struct _RaitDeviceClass {
 
 typedef enum {
     RAIT_STATUS_COMPLETE, /* All subdevices OK. */
-    RAIT_STATUS_DEGRADED, /* One subdevice failed. */
-    RAIT_STATUS_FAILED    /* Two or more subdevices failed. */
+    RAIT_STATUS_DEGRADED, /* Some subdevices failed, no more than the
+                             parity can make up for. */
+    RAIT_STATUS_FAILED    /* Too many subdevices failed. */
 } RaitStatus;
 
 /* Older versions of glib have a deadlock in their thread pool implementations,
@@ -104,13 +109,40 @@ typedef struct RaitDevicePrivate_s {
     GPtrArray * children;
     /* These flags are only relevant for reading. */
     RaitStatus status;
-    /* If status == RAIT_STATUS_DEGRADED, this holds the index of the
-       failed node. It holds a negative number otherwise. */
-    int failed;
+    /* The indexes (guint) of the failed children; empty unless status is
+       RAIT_STATUS_DEGRADED or RAIT_STATUS_FAILED. */
+    GArray *failed;
+    /* why they failed, "; "-separated */
+    char *failed_errmsgs;
+
+    /* the number of parity children (RAIT_PARITY) */
+    guint nb_parity;
 
     /* the child block size */
     gsize child_block_size;
 
+    /* one block buffer per child and one per parity child, all buffer_size
+     * bytes long; reused for every block instead of being allocated each
+     * time */
+    GPtrArray *buffers;
+    GPtrArray *parity;
+    gsize buffer_size;
+    /* and room for a chunk pointer and a lost flag per child, for
+     * rait_parity_encode and rait_parity_reconstruct */
+    char **chunks;
+    gboolean *lost;
+
+#ifndef USE_INTERNAL_THREADPOOL
+    /* pool running the child operations, kept for the life of the device;
+     * pool_func is the function of the batch in progress and pool_pending
+     * the number of its operations not yet finished */
+    GThreadPool *pool;
+    GFunc pool_func;
+    GMutex *pool_mutex;
+    GCond *pool_cond;
+    guint pool_pending;
+#endif
+
 #ifdef USE_INTERNAL_THREADPOOL
     /* array of ThreadInfo for performing parallel operations */
     GArray *threads;
@@ -171,6 +203,16 @@ static gboolean rait_device_finish (Device * self);
 static DeviceStatusFlags rait_device_read_label(Device * dself);
 static void find_simple_params(RaitDevice * self, guint * num_children,
                                guint * data_children);
+static gboolean check_failed_children(RaitDevice * self);
+static void free_block_buffers(RaitDevice * self);
+static void alloc_block_buffers(RaitDevice * self, guint num_children,
+                                guint parity_children, gsize size);
+
+/* pointer to the class of our parent */
+static DeviceClass *parent_class = NULL;
+
+static DevicePropertyBase device_property_rait_parity;
+#define PROPERTY_RAIT_PARITY (device_property_rait_parity.ID)
 
 /* property handlers */
 
@@ -210,9 +252,10 @@ static gboolean property_set_max_volume_usage_fn(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
 
+static gboolean property_set_rait_parity_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
 
-/* pointer to the class of our parent */
-static DeviceClass *parent_class = NULL;
 
 static GType
 rait_device_get_type (void)
@@ -259,6 +302,18 @@ rait_device_finalize(GObject *obj_self)
         g_ptr_array_free (self->private->children, TRUE);
         self->private->children = NULL;
     }
+    free_block_buffers(self);
+    g_ptr_array_free(PRIVATE(self)->buffers, TRUE);
+    g_ptr_array_free(PRIVATE(self)->parity, TRUE);
+    g_array_free(PRIVATE(self)->failed, TRUE);
+    amfree(PRIVATE(self)->failed_errmsgs);
+#ifndef USE_INTERNAL_THREADPOOL
+    if (PRIVATE(self)->pool) {
+	g_thread_pool_free(PRIVATE(self)->pool, TRUE, TRUE);
+	g_mutex_free(PRIVATE(self)->pool_mutex);
+	g_cond_free(PRIVATE(self)->pool_cond);
+    }
+#endif
 #ifdef USE_INTERNAL_THREADPOOL
     g_assert(PRIVATE(self)->threads_sem == NULL || PRIVATE(self)->threads_sem->value == 0);
 
@@ -297,14 +352,37 @@ rait_device_finalize(GObject *obj_self)
 static void
 rait_device_init (RaitDevice * o G_GNUC_UNUSED)
 {
+    GValue response;
+
     PRIVATE(o) = g_new(RaitDevicePrivate, 1);
     PRIVATE(o)->children = g_ptr_array_new();
     PRIVATE(o)->status = RAIT_STATUS_COMPLETE;
-    PRIVATE(o)->failed = -1;
+    PRIVATE(o)->failed = g_array_new(FALSE, FALSE, sizeof(guint));
+    PRIVATE(o)->failed_errmsgs = NULL;
+    PRIVATE(o)->nb_parity = 1;
+    PRIVATE(o)->buffers = g_ptr_array_new();
+    PRIVATE(o)->parity = g_ptr_array_new();
+    PRIVATE(o)->buffer_size = 0;
+    PRIVATE(o)->chunks = NULL;
+    PRIVATE(o)->lost = NULL;
+#ifndef USE_INTERNAL_THREADPOOL
+    PRIVATE(o)->pool = NULL;
+    PRIVATE(o)->pool_func = NULL;
+    PRIVATE(o)->pool_mutex = NULL;
+    PRIVATE(o)->pool_cond = NULL;
+    PRIVATE(o)->pool_pending = 0;
+#endif
 #ifdef USE_INTERNAL_THREADPOOL
     PRIVATE(o)->threads = NULL;
     PRIVATE(o)->threads_sem = NULL;
 #endif
+
+    bzero(&response, sizeof(response));
+    g_value_init(&response, G_TYPE_UINT);
+    g_value_set_uint(&response, PRIVATE(o)->nb_parity);
+    device_set_simple_property(DEVICE(o), PROPERTY_RAIT_PARITY,
+	    &response, PROPERTY_SURETY_GOOD, PROPERTY_SOURCE_DEFAULT);
+    g_value_unset(&response);
 }
 
 static void
@@ -394,6 +472,11 @@ rait_device_base_init (RaitDeviceClass * c)
 	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
 	    property_get_max_volume_usage_fn,
 	    property_set_max_volume_usage_fn);
+
+    device_class_register_property(device_class, PROPERTY_RAIT_PARITY,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    property_set_rait_parity_fn);
 }
 
 /* This function does something a little clever and a little
@@ -477,16 +560,43 @@ static void do_thread_pool_op(RaitDevice *self, GFunc func, GPtrArray * ops) {
 
 #else /* USE_INTERNAL_THREADPOOL */
 
-static void do_thread_pool_op(RaitDevice *self G_GNUC_UNUSED, GFunc func, GPtrArray * ops) {
-    GThreadPool * pool;
+static void rait_thread_pool_func(gpointer data, gpointer user_data) {
+    RaitDevicePrivate *private = user_data;
+
+    private->pool_func(data, NULL);
+
+    g_mutex_lock(private->pool_mutex);
+    if (--private->pool_pending == 0)
+	g_cond_signal(private->pool_cond);
+    g_mutex_unlock(private->pool_mutex);
+}
+
+static void do_thread_pool_op(RaitDevice *self, GFunc func, GPtrArray * ops) {
+    RaitDevicePrivate *private = PRIVATE(self);
     guint i;
 
-    pool = g_thread_pool_new(func, NULL, -1, FALSE, NULL);
+    /* the pool is created on first use and kept, so each block written or
+     * read does not pay for setting up and tearing down a pool */
+    if (private->pool == NULL) {
+	private->pool = g_thread_pool_new(rait_thread_pool_func, private,
+					  -1, FALSE, NULL);
+	private->pool_mutex = g_mutex_new();
+	private->pool_cond = g_cond_new();
+    }
+
+    g_mutex_lock(private->pool_mutex);
+    g_assert(private->pool_pending == 0);
+    private->pool_func = func;
+    private->pool_pending = ops->len;
     for (i = 0; i < ops->len; i ++) {
-        g_thread_pool_push(pool, g_ptr_array_index(ops, i), NULL);
+        g_thread_pool_push(private->pool, g_ptr_array_index(ops, i), NULL);
     }
 
-    g_thread_pool_free(pool, FALSE, TRUE);
+    /* wait until every operation is done */
+    while (private->pool_pending > 0)
+	g_cond_wait(private->pool_cond, private->pool_mutex);
+    private->pool_func = NULL;
+    g_mutex_unlock(private->pool_mutex);
 }
 
 #endif /* USE_INTERNAL_THREADPOOL */
@@ -511,6 +621,43 @@ static void do_rait_child_ops(RaitDevice *self, GFunc func, GPtrArray * ops) {
     }
 }
 
+/* Stickes new_message at the end of *old_message; frees new_message and
+ * may change *old_message. */
+static void append_message(char ** old_message, char * new_message) {
+    char * rval;
+    if (*old_message == NULL || **old_message == '\0') {
+        rval = new_message;
+    } else {
+        rval = g_strdup_printf("%s; %s", *old_message, new_message);
+        amfree(new_message);
+    }
+    amfree(*old_message);
+    *old_message = rval;
+}
+
+/* Is the child at child_index known to have failed? */
+static gboolean
+child_failed(RaitDevice * self, guint child_index) {
+    guint i;
+
+    for (i = 0; i < PRIVATE(self)->failed->len; i ++) {
+        if (g_array_index(PRIVATE(self)->failed, guint, i) == child_index)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Record the failure of a child; errmsg says why, and is freed. */
+static void
+set_child_failed(RaitDevice * self, guint child_index, char * errmsg) {
+    if (child_failed(self, child_index)) {
+        g_free(errmsg);
+        return;
+    }
+    g_array_append_val(PRIVATE(self)->failed, child_index);
+    append_message(&PRIVATE(self)->failed_errmsgs, errmsg);
+}
+
 static char *
 child_device_names_to_rait_name(RaitDevice * self) {
     GPtrArray *kids;
@@ -526,7 +673,7 @@ child_device_names_to_rait_name(RaitDevice * self) {
 
         bzero(&val, sizeof(val));
 
-        if ((signed)i != self->private->failed) {
+        if (!child_failed(self, i)) {
 	    if (device_property_get(child, PROPERTY_CANONICAL_NAME, &val)) {
 		child_name = g_value_get_string(&val);
 		got_prop = TRUE;
@@ -580,7 +727,7 @@ calculate_block_size_from_children(RaitDevice * self, gsize *rait_size)
 
         bzero(&property_result, sizeof(property_result));
 
-	if ((signed)i == self->private->failed)
+	if (child_failed(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -671,7 +818,7 @@ set_block_size_on_children(RaitDevice *self, gsize child_block_size)
 
 	bzero(&property_result, sizeof(property_result));
 
-	if ((signed)i == self->private->failed)
+	if (child_failed(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -709,15 +856,19 @@ set_block_size_on_children(RaitDevice *self, gsize child_block_size)
     return TRUE;
 }
 
-/* The time for users to specify block sizes has ended; set this device's
- * block-size attributes for easy access by other RAIT functions.  Returns
- * FALSE on error, with the device's error status already set. */
+/* The time for users to specify block sizes (and RAIT_PARITY) has ended; set
+ * this device's block-size attributes for easy access by other RAIT
+ * functions.  Returns FALSE on error, with the device's error status already
+ * set. */
 static gboolean
 fix_block_size(RaitDevice *self)
 {
     Device *dself = (Device *)self;
     gsize my_block_size, child_block_size;
 
+    if (!check_failed_children(self))
+	return FALSE;
+
     if (dself->block_size_source == PROPERTY_SOURCE_DEFAULT) {
 	child_block_size = calculate_block_size_from_children(self, &my_block_size);
 	if (child_block_size == 0)
@@ -731,7 +882,12 @@ fix_block_size(RaitDevice *self)
 	guint data_children;
 
 	find_simple_params(self, NULL, &data_children);
-	g_assert((dself->block_size % data_children) == 0);
+	if ((dself->block_size % data_children) != 0) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Block size must be a multiple of %d"), data_children),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    return FALSE;
+	}
 	child_block_size = dself->block_size / data_children;
     }
 
@@ -799,7 +955,7 @@ static GPtrArray * make_generic_boolean_op_array(RaitDevice* self) {
     for (i = 0; i < self->private->children->len; i ++) {
         GenericOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (child_failed(self, i)) {
             continue;
         }
 
@@ -819,7 +975,6 @@ static GPtrArray * make_generic_boolean_op_array(RaitDevice* self) {
 static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
                                          BooleanExtractor extractor) {
     int nfailed = 0;
-    int lastfailed = 0;
     guint i;
 
     /* We found one or more failed elements.  See which elements failed, and
@@ -827,13 +982,14 @@ static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
     for (i = 0; i < ops->len; i ++) {
 	GenericOp * op = g_ptr_array_index(ops, i);
 	if (!extractor(op)) {
-	    self->private->failed = op->child_index;
+	    set_child_failed(self, op->child_index,
+		    g_strdup_printf("%s: %s", op->child->device_name,
+				    device_error_or_status(op->child)));
 	    g_warning("RAIT array %s isolated device %s: %s",
 		    DEVICE(self)->device_name,
 		    op->child->device_name,
 		    device_error(op->child));
 	    nfailed++;
-            lastfailed = i;
 	}
     }
 
@@ -841,11 +997,14 @@ static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
     if (nfailed == 0)
 	return TRUE;
 
-    /* a single failure in COMPLETE just puts us in DEGRADED mode */
-    if (self->private->status == RAIT_STATUS_COMPLETE && nfailed == 1) {
-	self->private->status = RAIT_STATUS_DEGRADED;
-        self->private->failed = lastfailed;
-	g_warning("RAIT array %s DEGRADED", DEVICE(self)->device_name);
+    /* as long as the parity makes up for the failed children, we are just
+     * in DEGRADED mode */
+    if (self->private->status != RAIT_STATUS_FAILED &&
+        check_failed_children(self)) {
+        if (self->private->status == RAIT_STATUS_COMPLETE) {
+            self->private->status = RAIT_STATUS_DEGRADED;
+            g_warning("RAIT array %s DEGRADED", DEVICE(self)->device_name);
+        }
 	return TRUE;
     } else {
 	self->private->status = RAIT_STATUS_FAILED;
@@ -854,6 +1013,32 @@ static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
     }
 }
 
+/* The number of parity children is only known once the RAIT_PARITY property
+ * is set, after the children are opened; so any number of children may fail
+ * to open, and this is checked again before using the device.  Puts the
+ * device in the FAILED state and returns FALSE if too many children failed. */
+static gboolean
+check_failed_children(RaitDevice * self) {
+    guint num_children, data_children;
+
+    if (self->private->status == RAIT_STATUS_FAILED)
+        return FALSE;
+
+    find_simple_params(self, &num_children, &data_children);
+    if (self->private->failed->len <= num_children - data_children)
+        return TRUE;
+
+    self->private->status = RAIT_STATUS_FAILED;
+    device_set_error(DEVICE(self),
+        g_strdup_printf(_("%u of the %u child devices failed, but RAIT can "
+                          "only make up for %u: %s"),
+                        self->private->failed->len, num_children,
+                        num_children - data_children,
+                        self->private->failed_errmsgs),
+        DEVICE_STATUS_DEVICE_ERROR);
+    return FALSE;
+}
+
 typedef struct {
     RaitDevice * self;
     char *rait_name;
@@ -883,28 +1068,12 @@ static gboolean compare_volume_results(Device * a, Device * b) {
 	 && 0 == compare_possibly_null_strings(a->volume_label, b->volume_label));
 }
 
-/* Stickes new_message at the end of *old_message; frees new_message and
- * may change *old_message. */
-static void append_message(char ** old_message, char * new_message) {
-    char * rval;
-    if (*old_message == NULL || **old_message == '\0') {
-        rval = new_message;
-    } else {
-        rval = g_strdup_printf("%s; %s", *old_message, new_message);
-        amfree(new_message);
-    }
-    amfree(*old_message);
-    *old_message = rval;
-}
-
 static gboolean
 open_child_devices (Device * dself, char * device_name,
 	    char * device_node) {
     GPtrArray *device_names;
     GPtrArray * device_open_ops;
     guint i;
-    gboolean failure;
-    char *failure_errmsgs;
     DeviceStatusFlags failure_flags;
     RaitDevice * self;
 
@@ -937,8 +1106,6 @@ open_child_devices (Device * dself, char * device_name,
     g_ptr_array_free(device_names, TRUE);
     do_rait_child_ops(self, device_open_do_op, device_open_ops);
 
-    failure = FALSE;
-    failure_errmsgs = NULL;
     failure_flags = 0;
 
     /* Check results of opening devices. */
@@ -955,31 +1122,26 @@ open_child_devices (Device * dself, char * device_name,
             DeviceStatusFlags status =
                 op->result == NULL ?
                     DEVICE_STATUS_DEVICE_ERROR : op->result->status;
-            append_message(&failure_errmsgs,
-                           strdup(this_failure_errmsg));
 	    failure_flags |= status;
-            if (self->private->status == RAIT_STATUS_COMPLETE) {
-                /* The first failure just puts us in degraded mode. */
-                g_warning("%s: %s",
-                          device_name, this_failure_errmsg);
-		g_warning("%s: %s failed, entering degraded mode.",
-                          device_name, op->device_name);
-                g_ptr_array_add(self->private->children, op->result);
-                self->private->status = RAIT_STATUS_DEGRADED;
-                self->private->failed = i;
-            } else {
-                /* The second and further failures are fatal. */
-                failure = TRUE;
-            }
+            /* A failure puts us in degraded mode; whether the parity can
+             * make up for all of them is checked by fix_block_size. */
+            g_warning("%s: %s",
+                      device_name, this_failure_errmsg);
+            g_warning("%s: %s failed, entering degraded mode.",
+                      device_name, op->device_name);
+            g_ptr_array_add(self->private->children, op->result);
+            self->private->status = RAIT_STATUS_DEGRADED;
+            set_child_failed(self, i, this_failure_errmsg);
         }
         amfree(op->device_name);
     }
 
     g_ptr_array_free_full(device_open_ops);
 
-    if (failure) {
+    if (self->private->failed->len == self->private->children->len) {
         self->private->status = RAIT_STATUS_FAILED;
-	device_set_error(dself, failure_errmsgs, failure_flags);
+	device_set_error(dself, g_strdup(self->private->failed_errmsgs),
+			 failure_flags);
         return FALSE;
     }
 
@@ -1007,8 +1169,7 @@ rait_device_open_from_children (GSList *child_devices) {
     RaitDevice *self;
     GSList *iter;
     char *device_name;
-    int nfailures;
-    int i;
+    guint i;
 
     /* first, open a RAIT device using the DEFER_CHILDREN_SENTINEL */
     dself = device_open("rait:" DEFER_CHILDREN_SENTINEL);
@@ -1018,14 +1179,13 @@ rait_device_open_from_children (GSList *child_devices) {
 
     /* set its children */
     self = RAIT_DEVICE(dself);
-    nfailures = 0;
     for (i=0, iter = child_devices; iter; i++, iter = iter->next) {
 	Device *kid = iter->data;
 
 	/* a NULL kid is OK -- it opens the device in degraded mode */
 	if (!kid) {
-	    nfailures++;
-	    self->private->failed = i;
+	    set_child_failed(self, i,
+		    g_strdup_printf(_("child device %u is missing"), i));
 	} else {
 	    g_assert(IS_DEVICE(kid));
 	    g_object_ref((GObject *)kid);
@@ -1034,22 +1194,18 @@ rait_device_open_from_children (GSList *child_devices) {
 	g_ptr_array_add(self->private->children, kid);
     }
 
-    /* and set the status based on the children */
-    switch (nfailures) {
-	case 0:
-	    self->private->status = RAIT_STATUS_COMPLETE;
-	    break;
-
-	case 1:
-	    self->private->status = RAIT_STATUS_DEGRADED;
-	    break;
-
-	default:
-	    self->private->status = RAIT_STATUS_FAILED;
-	    device_set_error(dself,
-		    _("more than one child device is missing"),
-		    DEVICE_STATUS_DEVICE_ERROR);
-	    break;
+    /* and set the status based on the children; as in open_child_devices,
+     * whether the parity makes up for the missing children is checked by
+     * fix_block_size */
+    if (self->private->failed->len == 0) {
+	self->private->status = RAIT_STATUS_COMPLETE;
+    } else if (self->private->failed->len < self->private->children->len) {
+	self->private->status = RAIT_STATUS_DEGRADED;
+    } else {
+	self->private->status = RAIT_STATUS_FAILED;
+	device_set_error(dself,
+		g_strdup(_("all child devices are missing")),
+		DEVICE_STATUS_DEVICE_ERROR);
     }
 
     /* create a name from the children's names and use it to chain up
@@ -1092,7 +1248,7 @@ static DeviceStatusFlags rait_device_read_label(Device * dself) {
 
     /* nail down our block size, if we haven't already */
     if (!fix_block_size(self))
-	return FALSE;
+	return dself->status;
 
     ops = make_generic_boolean_op_array(self);
 
@@ -1180,7 +1336,7 @@ rait_device_configure(Device * dself, gboolean use_global_config)
     for (i = 0; i < self->private->children->len; i ++) {
 	Device *child;
 
-	if ((signed)i == self->private->failed)
+	if (child_failed(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -1240,7 +1396,7 @@ rait_device_start (Device * dself, DeviceAccessMode mode, char * label,
     for (i = 0; i < self->private->children->len; i ++) {
         StartOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (child_failed(self, i)) {
             continue;
         }
 
@@ -1422,14 +1578,16 @@ rait_device_start_file (Device * dself, dumpfile_t * info) {
     return TRUE;
 }
 
+/* The last num_children - data_children children hold the parity; with a
+ * single child, there is no parity at all. */
 static void find_simple_params(RaitDevice * self,
                                guint * num_children,
                                guint * data_children) {
-    int num, data;
+    guint num, data;
 
     num = self->private->children->len;
     if (num > 1)
-        data = num - 1;
+        data = num - MIN(self->private->nb_parity, num - 1);
     else
         data = num;
     if (num_children != NULL)
@@ -1442,7 +1600,6 @@ typedef struct {
     GenericOp base;
     guint size;           /* IN */
     gpointer data;        /* IN */
-    gboolean data_needs_free; /* bookkeeping */
 } WriteBlockOp;
 
 /* a GFunc. */
@@ -1454,62 +1611,44 @@ static void write_block_do_op(gpointer data,
         GINT_TO_POINTER(device_write_block(op->base.child, op->size, op->data));
 }
 
-/* Parity block generation. Performance of this function can be improved
-   considerably by using larger-sized integers or
-   assembly-coded vector instructions. Parameters are:
-   % data       - All data chunks in series (chunk_size * num_chunks bytes)
-   % parity     - Allocated space for parity block (chunk_size bytes)
- */
-static void make_parity_block(char * data, char * parity,
-                              guint chunk_size, guint num_chunks) {
+static void
+free_block_buffers(RaitDevice * self) {
     guint i;
-    bzero(parity, chunk_size);
-    for (i = 0; i < num_chunks - 1; i ++) {
-        guint j;
-        for (j = 0; j < chunk_size; j ++) {
-            parity[j] ^= data[chunk_size*i + j];
-        }
-    }
-}
 
-/* Does the same thing as make_parity_block, but instead of using a
-   single memory chunk holding all chunks, it takes a GPtrArray of
-   chunks. */
-static void make_parity_block_extents(GPtrArray * data, char * parity,
-                                      guint chunk_size) {
-    guint i;
-    bzero(parity, chunk_size);
-    for (i = 0; i < data->len; i ++) {
-        guint j;
-        char * data_chunk;
-        data_chunk = g_ptr_array_index(data, i);
-        for (j = 0; j < chunk_size; j ++) {
-            parity[j] ^= data_chunk[j];
-        }
+    for (i = 0; i < PRIVATE(self)->buffers->len; i ++) {
+        g_free(g_ptr_array_index(PRIVATE(self)->buffers, i));
+    }
+    g_ptr_array_set_size(PRIVATE(self)->buffers, 0);
+    for (i = 0; i < PRIVATE(self)->parity->len; i ++) {
+        g_free(g_ptr_array_index(PRIVATE(self)->parity, i));
     }
+    g_ptr_array_set_size(PRIVATE(self)->parity, 0);
+    amfree(PRIVATE(self)->chunks);
+    amfree(PRIVATE(self)->lost);
+    PRIVATE(self)->buffer_size = 0;
 }
 
-/* Does the parity creation algorithm. Allocates and returns a single
-   device block from a larger RAIT block. chunks and chunk are 1-indexed. */
-static char * extract_data_block(char * data, guint size,
-                                 guint chunks, guint chunk) {
-    char * rval;
-    guint chunk_size;
-
-    g_assert(chunks > 0 && chunk > 0 && chunk <= chunks);
-    g_assert(data != NULL);
-    g_assert(size > 0 && size % (chunks - 1) == 0);
+/* Make sure there is a buffer of size bytes for each of num_children
+   children, and a parity buffer of the same size for each of
+   parity_children parity children. */
+static void
+alloc_block_buffers(RaitDevice * self, guint num_children,
+                    guint parity_children, gsize size) {
+    if (PRIVATE(self)->buffer_size == size &&
+        PRIVATE(self)->buffers->len == num_children &&
+        PRIVATE(self)->parity->len == parity_children)
+        return;
 
-    chunk_size = size / (chunks - 1);
-    rval = g_malloc(chunk_size);
-    if (chunks != chunk) {
-        /* data block. */
-        memcpy(rval, data + chunk_size * (chunk - 1), chunk_size);
-    } else {
-        make_parity_block(data, rval, chunk_size, chunks);
+    free_block_buffers(self);
+    while (PRIVATE(self)->buffers->len < num_children) {
+        g_ptr_array_add(PRIVATE(self)->buffers, g_malloc(size));
     }
-
-    return rval;
+    while (PRIVATE(self)->parity->len < parity_children) {
+        g_ptr_array_add(PRIVATE(self)->parity, g_malloc(size));
+    }
+    PRIVATE(self)->chunks = g_new(char *, num_children);
+    PRIVATE(self)->lost = g_new(gboolean, num_children);
+    PRIVATE(self)->buffer_size = size;
 }
 
 static DeviceWriteResult
@@ -1518,6 +1657,7 @@ rait_device_write_block (Device * dself, guint size, gpointer data) {
     guint i;
     DeviceWriteResult rait_result;
     guint data_children, num_children;
+    guint chunk_size;
     gsize blocksize = dself->block_size;
     RaitDevice * self;
     gboolean last_block = (size < blocksize);
@@ -1528,11 +1668,6 @@ rait_device_write_block (Device * dself, guint size, gpointer data) {
     if (self->private->status != RAIT_STATUS_COMPLETE) return WRITE_FAILED;
 
     find_simple_params(RAIT_DEVICE(self), &num_children, &data_children);
-    num_children = self->private->children->len;
-    if (num_children != 1)
-        data_children = num_children - 1;
-    else
-        data_children = num_children;
 
     g_assert(size % data_children == 0 || last_block);
 
@@ -1549,18 +1684,35 @@ rait_device_write_block (Device * dself, guint size, gpointer data) {
         size = blocksize;
     }
 
+    /* the data children write straight from the caller's buffer; only the
+     * parity needs space of its own.  With a single data child, every parity
+     * chunk is a copy of the data. */
+    chunk_size = size / data_children;
+    if (data_children > 1 && num_children > data_children) {
+        guint parity_children = num_children - data_children;
+
+        alloc_block_buffers(self, num_children, parity_children, chunk_size);
+        for (i = 0; i < data_children; i ++) {
+            PRIVATE(self)->chunks[i] = (char *)data + chunk_size * i;
+        }
+        rait_parity_encode(data_children, parity_children,
+                           PRIVATE(self)->chunks,
+                           (char **)PRIVATE(self)->parity->pdata, chunk_size);
+    }
+
     ops = g_ptr_array_sized_new(num_children);
     for (i = 0; i < self->private->children->len; i ++) {
         WriteBlockOp * op;
         op = g_malloc(sizeof(*op));
         op->base.child = g_ptr_array_index(self->private->children, i);
-        op->size = size / data_children;
-        if (num_children <= 2) {
+        op->size = chunk_size;
+        if (data_children == 1) {
             op->data = data;
-            op->data_needs_free = FALSE;
+        } else if (i < data_children) {
+            op->data = (char *)data + chunk_size * i;
         } else {
-            op->data_needs_free = TRUE;
-            op->data = extract_data_block(data, size, num_children, i + 1);
+            op->data = g_ptr_array_index(PRIVATE(self)->parity,
+                                         i - data_children);
         }
         g_ptr_array_add(ops, op);
     }
@@ -1576,8 +1728,6 @@ rait_device_write_block (Device * dself, guint size, gpointer data) {
 	} else {
 	    rait_result = WRITE_FAILED;
 	}
-        if (op->data_needs_free)
-            free(op->data);
     }
 
     if (last_block) {
@@ -1689,7 +1839,7 @@ rait_device_seek_file (Device * dself, guint file) {
     ops = g_ptr_array_sized_new(self->private->children->len);
     for (i = 0; i < self->private->children->len; i ++) {
         SeekFileOp * op;
-        if ((int)i == self->private->failed)
+        if (child_failed(self, i))
             continue; /* This device is broken. */
         op = g_new(SeekFileOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -1714,7 +1864,7 @@ rait_device_seek_file (Device * dself, guint file) {
 
         this_op = (SeekFileOp*)g_ptr_array_index(ops, i);
 
-        if ((signed)this_op->base.child_index == self->private->failed)
+        if (child_failed(self, this_op->base.child_index))
             continue;
 
         this_result = this_op->base.result;
@@ -1782,7 +1932,7 @@ rait_device_seek_block (Device * dself, guint64 block) {
     ops = g_ptr_array_sized_new(self->private->children->len);
     for (i = 0; i < self->private->children->len; i ++) {
         SeekBlockOp * op;
-        if ((int)i == self->private->failed)
+        if (child_failed(self, i))
             continue; /* This device is broken. */
         op = g_new(SeekBlockOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -1855,106 +2005,70 @@ static int g_ptr_array_count(GPtrArray * array, BooleanExtractor filter) {
     return rval;
 }
 
+/* The data children read straight into the caller's buffer, and the parity
+ * children into PRIVATE(self)->buffers.  Verify the parity if every child
+ * was read, or rebuild the data chunks that were not. */
 static gboolean raid_block_reconstruction(RaitDevice * self, GPtrArray * ops,
                                       gpointer buf, size_t bufsize) {
-    guint num_children, data_children;
+    guint num_children, data_children, parity_children;
     gsize blocksize;
     gsize child_blocksize;
+    char **chunks = PRIVATE(self)->chunks;
+    gboolean *lost = PRIVATE(self)->lost;
+    char **parity = (char **)PRIVATE(self)->parity->pdata;
     guint i;
-    int parity_child;
-    gpointer parity_block = NULL;
-    gboolean success;
-
-    success = TRUE;
 
     blocksize = DEVICE(self)->block_size;
     find_simple_params(self, &num_children, &data_children);
-
-    if (num_children > 1)
-        parity_child = num_children - 1;
-    else
-        parity_child = -1;
+    parity_children = num_children - data_children;
 
     child_blocksize = blocksize / data_children;
+    g_assert(child_blocksize * data_children <= bufsize);
 
+    for (i = 0; i < num_children; i ++) {
+        if (i < data_children)
+            chunks[i] = (char *)buf + child_blocksize * i;
+        else
+            chunks[i] = g_ptr_array_index(PRIVATE(self)->buffers, i);
+        lost[i] = TRUE;
+    }
     for (i = 0; i < ops->len; i ++) {
         ReadBlockOp * op = g_ptr_array_index(ops, i);
-        if (!extract_boolean_read_block_op_data(op))
-            continue;
-        if ((int)(op->base.child_index) == parity_child) {
-            parity_block = op->buffer;
-        } else {
-	    g_assert(child_blocksize * (op->base.child_index+1) <= bufsize);
-            memcpy((char *)buf + child_blocksize * op->base.child_index, op->buffer,
-                   child_blocksize);
-        }
+        if (extract_boolean_read_block_op_data(op))
+            lost[op->base.child_index] = FALSE;
     }
-    if (self->private->status == RAIT_STATUS_COMPLETE) {
-	g_assert(parity_block != NULL); /* should have found parity_child */
-
-        if (num_children >= 2) {
-            /* Verify the parity block. This code is inefficient but
-               does the job for the 2-device case, too. */
-            gpointer constructed_parity;
-            GPtrArray * data_extents;
-
-            constructed_parity = g_malloc(child_blocksize);
-            data_extents = g_ptr_array_sized_new(data_children);
-            for (i = 0; i < data_children; i ++) {
-                ReadBlockOp * op = g_ptr_array_index(ops, i);
-                g_assert(extract_boolean_read_block_op_data(op));
-                if ((int)op->base.child_index == parity_child)
-                    continue;
-                g_ptr_array_add(data_extents, op->buffer);
-            }
-            make_parity_block_extents(data_extents, constructed_parity,
-                                      child_blocksize);
 
-            if (0 != memcmp(parity_block, constructed_parity,
+    if (self->private->status == RAIT_STATUS_COMPLETE) {
+        /* Verify the parity blocks.  This does the job for the 2-device
+           case, too, where the parity is a copy of the data. */
+        rait_parity_encode(data_children, parity_children, chunks, parity,
+                           child_blocksize);
+        for (i = 0; i < parity_children; i ++) {
+            if (0 != memcmp(chunks[data_children + i], parity[i],
                             child_blocksize)) {
                 device_set_error(DEVICE(self),
 		    g_strdup(_("RAIT is inconsistent: Parity block did not match data blocks.")),
 		    DEVICE_STATUS_DEVICE_ERROR);
 		/* TODO: can't we just isolate the device in this case? */
-                success = FALSE;
+                return FALSE;
             }
-            g_ptr_array_free(data_extents, TRUE);
-            amfree(constructed_parity);
-        } else { /* do nothing. */ }
+        }
+        return TRUE;
     } else if (self->private->status == RAIT_STATUS_DEGRADED) {
-	g_assert(self->private->failed >= 0 && self->private->failed < (int)num_children);
-        /* We are in degraded mode. What's missing? */
-        if (self->private->failed == parity_child) {
-            /* do nothing. */
-        } else if (num_children >= 2) {
-            /* Reconstruct failed block from parity block. */
-            GPtrArray * data_extents = g_ptr_array_new();
-
-            for (i = 0; i < data_children; i ++) {
-                ReadBlockOp * op = g_ptr_array_index(ops, i);
-                if (!extract_boolean_read_block_op_data(op))
-                    continue;
-                g_ptr_array_add(data_extents, op->buffer);
-            }
-
-            /* Conveniently, the reconstruction is the same procedure
-               as the parity generation. This even works if there is
-               only one remaining device! */
-            make_parity_block_extents(data_extents,
-                                      (char *)buf + (child_blocksize *
-                                             self->private->failed),
-                                      child_blocksize);
-
-            /* The array members belong to our ops argument. */
-            g_ptr_array_free(data_extents, TRUE);
-        } else {
-            g_assert_not_reached();
+        /* We are in degraded mode; rebuild whatever data is missing from
+           the parity. */
+        if (!rait_parity_reconstruct(data_children, parity_children,
+                                     chunks, lost, parity, child_blocksize)) {
+            device_set_error(DEVICE(self),
+                g_strdup(_("RAIT is missing more blocks than the parity can rebuild")),
+                DEVICE_STATUS_DEVICE_ERROR);
+            return FALSE;
         }
+        return TRUE;
     } else {
 	/* device is already in FAILED state -- we shouldn't even be here */
-        success = FALSE;
+        return FALSE;
     }
-    return success;
 }
 
 static int
@@ -1982,15 +2096,22 @@ rait_device_read_block (Device * dself, gpointer buf, int * size, int max_block)
     g_assert(blocksize % data_children == 0); /* see find_block_size */
     child_blocksize = blocksize / data_children;
 
+    alloc_block_buffers(self, num_children, num_children - data_children,
+                        child_blocksize);
+
     ops = g_ptr_array_sized_new(num_children);
     for (i = 0; i < num_children; i ++) {
         ReadBlockOp * op;
-        if ((int)i == self->private->failed)
+        if (child_failed(self, i))
             continue; /* This device is broken. */
         op = g_new(ReadBlockOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
         op->base.child_index = i;
-        op->buffer = g_malloc(child_blocksize);
+        /* see raid_block_reconstruction */
+        if (i < data_children)
+            op->buffer = (char *)buf + child_blocksize * i;
+        else
+            op->buffer = g_ptr_array_index(PRIVATE(self)->buffers, i);
         op->desired_read_size = op->read_size = child_blocksize;
         op->max_block = max_block;
         g_ptr_array_add(ops, op);
@@ -2031,10 +2152,6 @@ rait_device_read_block (Device * dself, gpointer buf, int * size, int max_block)
 	}
     }
 
-    for (i = 0; i < ops->len; i ++) {
-        ReadBlockOp * op = g_ptr_array_index(ops, i);
-        amfree(op->buffer);
-    }
     g_ptr_array_free_full(ops);
 
     if (success) {
@@ -2071,7 +2188,7 @@ static GPtrArray * make_property_op_array(RaitDevice * self,
     for (i = 0; i < self->private->children->len; i ++) {
         PropertyOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (child_failed(self, i)) {
             continue;
         }
 
@@ -2155,25 +2272,15 @@ property_set_block_size_fn(Device *dself,
     DevicePropertyBase *base G_GNUC_UNUSED, GValue *val,
     PropertySurety surety, PropertySource source)
 {
-    RaitDevice *self = RAIT_DEVICE(dself);
     gint my_block_size = g_value_get_int(val);
-    guint data_children;
-
-    find_simple_params(self, NULL, &data_children);
-    if ((my_block_size % data_children) != 0) {
-	device_set_error(dself,
-	    g_strdup_printf(_("Block size must be a multiple of %d"), data_children),
-	    DEVICE_STATUS_DEVICE_ERROR);
-	return FALSE;
-    }
 
+    /* the number of data children depends on RAIT_PARITY, which may be set
+     * after this property, so the block size is checked against it and given
+     * to the children by fix_block_size, when the device is started */
     dself->block_size = my_block_size;
     dself->block_size_source = source;
     dself->block_size_surety = surety;
 
-    if (!fix_block_size(self))
-	return FALSE;
-
     return TRUE;
 }
 
@@ -2547,6 +2654,46 @@ property_set_max_volume_usage_fn(Device *dself,
     return success;
 }
 
+static gboolean
+property_set_rait_parity_fn(Device *dself,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    RaitDevice *self = RAIT_DEVICE(dself);
+    guint nb_parity = g_value_get_uint(val);
+    guint num_children = self->private->children->len;
+
+    if (nb_parity < 1) {
+	device_set_error(dself,
+	    g_strdup(_("RAIT_PARITY must be at least 1")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    if (num_children > 1 && nb_parity >= num_children) {
+	device_set_error(dself,
+	    g_strdup_printf(_("RAIT_PARITY must be less than the number of child devices (%u)"),
+			    num_children),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    if (nb_parity > 1 && num_children > RAIT_PARITY_MAX_CHUNKS) {
+	device_set_error(dself,
+	    g_strdup_printf(_("RAIT_PARITY can not be more than 1 with more than %d child devices"),
+			    RAIT_PARITY_MAX_CHUNKS),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    self->private->nb_parity = nb_parity;
+
+    /* a block size calculated for the old number of data children must be
+     * calculated again */
+    if (dself->block_size_source == PROPERTY_SOURCE_DETECTED)
+	dself->block_size_source = PROPERTY_SOURCE_DEFAULT;
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
 typedef struct {
     GenericOp base;
     guint filenum;
@@ -2636,5 +2783,12 @@ rait_device_factory (char * device_name, char * device_type, char * device_node)
 void
 rait_device_register (void) {
     static const char * device_prefix_list[] = {"rait", NULL};
+
+    rait_parity_init();
+
+    device_property_fill_and_register(&device_property_rait_parity,
+                                      G_TYPE_UINT, "rait_parity",
+       "Number of RAIT child devices holding parity");
+
     register_device(rait_device_factory, device_prefix_list);
 }
@@ -0,0 +1,127 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * AVX2 kernels for the RAIT parity, compiled with -mavx2; rait_parity_init
+ * only uses them if the CPU supports it.
+ *
+ * A product c * s is c * (low nibble of s) ^ c * (high nibble of s << 4), so
+ * each product is two 16-entry table lookups, done 32 bytes at a time with
+ * vpshufb.
+ */
+
+#include "amanda.h"
+#include "rait-parity.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+gboolean compiled_with_avx2 = TRUE;
+
+gboolean
+rait_cpu_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("avx2");
+}
+
+void
+rait_xor_region_avx2(
+    char *dst,
+    const char *src,
+    gsize len)
+{
+    gsize i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+	__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+	_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, s));
+    }
+    if (i < len)
+	rait_xor_region_generic(dst + i, src + i, len - i);
+}
+
+void
+rait_gf_mul_region_avx2(
+    guint8 c,
+    const char *src,
+    char *dst,
+    gsize len,
+    gboolean add)
+{
+    __m128i lo128 = _mm_loadu_si128((const __m128i *)rait_gf_nibble_table[c][0]);
+    __m128i hi128 = _mm_loadu_si128((const __m128i *)rait_gf_nibble_table[c][1]);
+    /* vpshufb looks up within each 128-bit lane, so both lanes get the table */
+    __m256i lo = _mm256_inserti128_si256(_mm256_castsi128_si256(lo128), lo128, 1);
+    __m256i hi = _mm256_inserti128_si256(_mm256_castsi128_si256(hi128), hi128, 1);
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    gsize i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+	__m256i p_lo = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+	__m256i p_hi = _mm256_shuffle_epi8(hi,
+			_mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+	__m256i p = _mm256_xor_si256(p_lo, p_hi);
+
+	if (add)
+	    p = _mm256_xor_si256(p, _mm256_loadu_si256((const __m256i *)(dst + i)));
+	_mm256_storeu_si256((__m256i *)(dst + i), p);
+    }
+    if (i < len)
+	rait_gf_mul_region_generic(c, src + i, dst + i, len - i, add);
+}
+
+#else
+gboolean compiled_with_avx2 = FALSE;
+
+gboolean
+rait_cpu_has_avx2(void)
+{
+    return FALSE;
+}
+
+void
+rait_xor_region_avx2(
+    char *dst G_GNUC_UNUSED,
+    const char *src G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED)
+{
+    g_error("rait_xor_region_avx2 is not defined");
+}
+
+void
+rait_gf_mul_region_avx2(
+    guint8 c G_GNUC_UNUSED,
+    const char *src G_GNUC_UNUSED,
+    char *dst G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED,
+    gboolean add G_GNUC_UNUSED)
+{
+    g_error("rait_gf_mul_region_avx2 is not defined");
+}
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * AVX-512 kernels for the RAIT parity, compiled with -mavx512f -mavx512bw;
+ * rait_parity_init only uses them if the CPU supports AVX-512BW.
+ *
+ * A product c * s is c * (low nibble of s) ^ c * (high nibble of s << 4), so
+ * each product is two 16-entry table lookups, done 64 bytes at a time with
+ * vpshufb.
+ */
+
+#include "amanda.h"
+#include "rait-parity.h"
+
+#ifdef __AVX512BW__
+#include <immintrin.h>
+
+gboolean compiled_with_avx512 = TRUE;
+
+gboolean
+rait_cpu_has_avx512(void)
+{
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("avx512bw");
+}
+
+void
+rait_xor_region_avx512(
+    char *dst,
+    const char *src,
+    gsize len)
+{
+    gsize i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+	__m512i s = _mm512_loadu_si512((const __m512i *)(src + i));
+	__m512i d = _mm512_loadu_si512((const __m512i *)(dst + i));
+	_mm512_storeu_si512((__m512i *)(dst + i), _mm512_xor_si512(d, s));
+    }
+    if (i < len)
+	rait_xor_region_generic(dst + i, src + i, len - i);
+}
+
+void
+rait_gf_mul_region_avx512(
+    guint8 c,
+    const char *src,
+    char *dst,
+    gsize len,
+    gboolean add)
+{
+    __m128i lo128 = _mm_loadu_si128((const __m128i *)rait_gf_nibble_table[c][0]);
+    __m128i hi128 = _mm_loadu_si128((const __m128i *)rait_gf_nibble_table[c][1]);
+    /* vpshufb looks up within each 128-bit lane, so every lane gets the table */
+    __m512i lo = _mm512_broadcast_i32x4(lo128);
+    __m512i hi = _mm512_broadcast_i32x4(hi128);
+    __m512i mask = _mm512_set1_epi8(0x0f);
+    gsize i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+	__m512i s = _mm512_loadu_si512((const __m512i *)(src + i));
+	__m512i p_lo = _mm512_shuffle_epi8(lo, _mm512_and_si512(s, mask));
+	__m512i p_hi = _mm512_shuffle_epi8(hi,
+			_mm512_and_si512(_mm512_srli_epi64(s, 4), mask));
+	__m512i p = _mm512_xor_si512(p_lo, p_hi);
+
+	if (add)
+	    p = _mm512_xor_si512(p, _mm512_loadu_si512((const __m512i *)(dst + i)));
+	_mm512_storeu_si512((__m512i *)(dst + i), p);
+    }
+    if (i < len)
+	rait_gf_mul_region_generic(c, src + i, dst + i, len - i, add);
+}
+
+#else
+gboolean compiled_with_avx512 = FALSE;
+
+gboolean
+rait_cpu_has_avx512(void)
+{
+    return FALSE;
+}
+
+void
+rait_xor_region_avx512(
+    char *dst G_GNUC_UNUSED,
+    const char *src G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED)
+{
+    g_error("rait_xor_region_avx512 is not defined");
+}
+
+void
+rait_gf_mul_region_avx512(
+    guint8 c G_GNUC_UNUSED,
+    const char *src G_GNUC_UNUSED,
+    char *dst G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED,
+    gboolean add G_GNUC_UNUSED)
+{
+    g_error("rait_gf_mul_region_avx512 is not defined");
+}
+#endif
@@ -0,0 +1,426 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+#include "amanda.h"
+#include "rait-parity.h"
+
+/* Utilities */
+
+#define SIZE_BUF 33819
+static size_t size_of_test[] = { 1, 2, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 255, 4096, 16383, 16384, 16385, 33000, 0 };
+
+static char src_buf[SIZE_BUF + 64];
+static char ref_buf[SIZE_BUF + 64];
+static char dst_buf[SIZE_BUF + 64];
+
+static void
+fill_random(
+    char *buf,
+    gsize size)
+{
+    gsize i;
+
+    for (i = 0; i < size; i++)
+	buf[i] = rand();
+}
+
+/* multiply by shifts and adds, to check the tables */
+static guint8
+slow_gf_mul(
+    guint8 a,
+    guint8 b)
+{
+    guint p = 0;
+    guint x = a;
+
+    while (b) {
+	if (b & 1)
+	    p ^= x;
+	b >>= 1;
+	x <<= 1;
+	if (x & 0x100)
+	    x ^= 0x11d;
+    }
+    return p;
+}
+
+static int
+test_gf(void)
+{
+    guint a, b;
+
+    for (a = 0; a < 256; a++) {
+	gboolean has_inverse = FALSE;
+
+	for (b = 0; b < 256; b++) {
+	    if (rait_gf_mul(a, b) != slow_gf_mul(a, b)) {
+		g_fprintf(stderr, " GF %u * %u = %u, not %u\n", a, b,
+			  rait_gf_mul(a, b), slow_gf_mul(a, b));
+		return FALSE;
+	    }
+	    if (rait_gf_mul(a, b) == 1)
+		has_inverse = TRUE;
+	}
+	if (a && !has_inverse) {
+	    g_fprintf(stderr, " GF %u has no inverse\n", a);
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
+
+/* check a mul kernel against the generic one, for every size and a few
+ * alignments */
+static int
+check_mul_kernel(
+    const char *name,
+    void (*mul_fn)(guint8 c, const char *src, char *dst, gsize len, gboolean add))
+{
+    static const guint8 coefs[] = { 0, 1, 2, 0x1d, 0x8e, 0xff };
+    guint c, i, align, add;
+
+    for (i = 0; size_of_test[i] != 0; i++) {
+	gsize size = size_of_test[i];
+
+	for (align = 0; align < 3; align++) {
+	    for (c = 0; c < G_N_ELEMENTS(coefs); c++) {
+		for (add = 0; add < 2; add++) {
+		    fill_random(src_buf, sizeof(src_buf));
+		    fill_random(ref_buf, sizeof(ref_buf));
+		    memcpy(dst_buf, ref_buf, sizeof(dst_buf));
+
+		    rait_gf_mul_region_generic(coefs[c], src_buf + align,
+					       ref_buf + align, size, add);
+		    mul_fn(coefs[c], src_buf + align, dst_buf + align,
+			   size, add);
+		    if (memcmp(ref_buf, dst_buf, sizeof(dst_buf)) != 0) {
+			g_fprintf(stderr, " %s %zu bytes, c=%u add=%u align=%u: mismatch\n",
+				  name, size, coefs[c], add, align);
+			return FALSE;
+		    }
+		}
+	    }
+	}
+    }
+    return TRUE;
+}
+
+static int
+check_xor_kernel(
+    const char *name,
+    void (*xor_fn)(char *dst, const char *src, gsize len))
+{
+    guint i, j, align;
+
+    for (i = 0; size_of_test[i] != 0; i++) {
+	gsize size = size_of_test[i];
+
+	for (align = 0; align < 3; align++) {
+	    fill_random(src_buf, sizeof(src_buf));
+	    fill_random(ref_buf, sizeof(ref_buf));
+	    memcpy(dst_buf, ref_buf, sizeof(dst_buf));
+
+	    for (j = 0; j < size; j++)
+		ref_buf[align + j] ^= src_buf[align + j];
+	    xor_fn(dst_buf + align, src_buf + align, size);
+	    if (memcmp(ref_buf, dst_buf, sizeof(dst_buf)) != 0) {
+		g_fprintf(stderr, " %s %zu bytes, align=%u: mismatch\n",
+			  name, size, align);
+		return FALSE;
+	    }
+	}
+    }
+    return TRUE;
+}
+
+static int
+test_kernels(void)
+{
+    int ok = TRUE;
+
+    ok &= check_xor_kernel("xor generic", rait_xor_region_generic);
+    if (rait_have_avx2) {
+	ok &= check_xor_kernel("xor avx2", rait_xor_region_avx2);
+	ok &= check_mul_kernel("mul avx2", rait_gf_mul_region_avx2);
+    } else {
+	g_fprintf(stderr, " no AVX2, skipping its kernels\n");
+    }
+    if (rait_have_avx512) {
+	ok &= check_xor_kernel("xor avx512", rait_xor_region_avx512);
+	ok &= check_mul_kernel("mul avx512", rait_gf_mul_region_avx512);
+    } else {
+	g_fprintf(stderr, " no AVX-512, skipping its kernels\n");
+    }
+    return ok;
+}
+
+/* allocate n chunks of size bytes */
+static char **
+alloc_chunks(
+    guint n,
+    gsize size)
+{
+    char **chunks = g_new(char *, n);
+    guint i;
+
+    for (i = 0; i < n; i++)
+	chunks[i] = g_malloc(size);
+    return chunks;
+}
+
+static void
+free_chunks(
+    char **chunks,
+    guint n)
+{
+    guint i;
+
+    for (i = 0; i < n; i++)
+	g_free(chunks[i]);
+    g_free(chunks);
+}
+
+/* The first parity chunk must be the XOR of the data, as RAIT volumes with a
+ * single parity child were always written, and with a single data chunk
+ * every parity chunk is a copy of it. */
+static int
+test_layout(void)
+{
+    gsize size = 4099;
+    char **data = alloc_chunks(5, size);
+    char **parity = alloc_chunks(3, size);
+    char *x = g_malloc0(size);
+    guint i;
+    int ok = TRUE;
+
+    for (i = 0; i < 5; i++) {
+	fill_random(data[i], size);
+	rait_xor_region_generic(x, data[i], size);
+    }
+
+    rait_parity_encode(5, 3, data, parity, size);
+    if (memcmp(parity[0], x, size) != 0) {
+	g_fprintf(stderr, " first parity chunk is not the XOR of the data\n");
+	ok = FALSE;
+    }
+
+    rait_parity_encode(1, 3, data, parity, size);
+    for (i = 0; i < 3; i++) {
+	if (memcmp(parity[i], data[0], size) != 0) {
+	    g_fprintf(stderr, " parity chunk %u is not a copy of the only data chunk\n", i);
+	    ok = FALSE;
+	}
+    }
+
+    free_chunks(data, 5);
+    free_chunks(parity, 3);
+    g_free(x);
+    return ok;
+}
+
+/* Encode, then lose every combination of up to nb_parity chunks and check
+ * the data comes back; losing one more chunk must fail. */
+static int
+test_reconstruct(
+    guint nb_data,
+    guint nb_parity)
+{
+    guint nb_chunks = nb_data + nb_parity;
+    gsize size = 1000 + nb_data * 37;
+    char **orig = alloc_chunks(nb_chunks, size);
+    char **chunks = alloc_chunks(nb_chunks, size);
+    char **scratch = alloc_chunks(nb_parity, size);
+    gboolean *lost = g_new(gboolean, nb_chunks);
+    guint mask, i, nb_lost;
+    int ok = TRUE;
+
+    for (i = 0; i < nb_data; i++)
+	fill_random(orig[i], size);
+    rait_parity_encode(nb_data, nb_parity, orig, orig + nb_data, size);
+    for (i = 0; i < nb_chunks; i++)
+	memcpy(chunks[i], orig[i], size);
+
+    for (mask = 1; mask < (1U << nb_chunks) && ok; mask++) {
+	nb_lost = 0;
+	for (i = 0; i < nb_chunks; i++) {
+	    lost[i] = !!(mask & (1U << i));
+	    if (lost[i])
+		nb_lost++;
+	}
+	if (nb_lost > nb_parity + 1)
+	    continue;
+
+	for (i = 0; i < nb_chunks; i++) {
+	    if (lost[i])
+		memset(chunks[i], 0xa5, size);
+	}
+
+	if (nb_lost <= nb_parity) {
+	    if (!rait_parity_reconstruct(nb_data, nb_parity, chunks, lost,
+					 scratch, size)) {
+		g_fprintf(stderr, " %u+%u lost 0x%x: reconstruction failed\n",
+			  nb_data, nb_parity, mask);
+		ok = FALSE;
+	    }
+	    for (i = 0; i < nb_data && ok; i++) {
+		if (memcmp(chunks[i], orig[i], size) != 0) {
+		    g_fprintf(stderr, " %u+%u lost 0x%x: data chunk %u is wrong\n",
+			      nb_data, nb_parity, mask, i);
+		    ok = FALSE;
+		}
+	    }
+	} else {
+	    if (rait_parity_reconstruct(nb_data, nb_parity, chunks, lost,
+					scratch, size)) {
+		g_fprintf(stderr, " %u+%u lost 0x%x: reconstruction did not fail\n",
+			  nb_data, nb_parity, mask);
+		ok = FALSE;
+	    }
+	}
+
+	for (i = 0; i < nb_chunks; i++)
+	    memcpy(chunks[i], orig[i], size);
+    }
+
+    free_chunks(orig, nb_chunks);
+    free_chunks(chunks, nb_chunks);
+    free_chunks(scratch, nb_parity);
+    g_free(lost);
+    return ok;
+}
+
+/*
+ * Benchmark: encoding throughput of each kernel.  This only runs when
+ * rait-parity-test is invoked with --bench, never from 'make check'.
+ */
+
+#define BENCH_CHUNK_SIZE (32*1024)
+#define BENCH_TOTAL_SIZE (256*1024*1024)
+
+static void
+bench_encode(
+    const char *name,
+    guint nb_data,
+    guint nb_parity)
+{
+    char **data = alloc_chunks(nb_data, BENCH_CHUNK_SIZE);
+    char **parity = alloc_chunks(nb_parity, BENCH_CHUNK_SIZE);
+    GTimer *timer = g_timer_new();
+    int n = BENCH_TOTAL_SIZE / BENCH_CHUNK_SIZE / nb_data;
+    double secs;
+    guint i;
+
+    for (i = 0; i < nb_data; i++)
+	fill_random(data[i], BENCH_CHUNK_SIZE);
+
+    g_timer_start(timer);
+    for (i = 0; i < (guint)n; i++)
+	rait_parity_encode(nb_data, nb_parity, data, parity, BENCH_CHUNK_SIZE);
+    secs = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    g_fprintf(stderr, " %-10s %2u+%u %6.2f GB/s of data\n", name,
+	      nb_data, nb_parity,
+	      secs > 0 ? (double)n * nb_data * BENCH_CHUNK_SIZE / secs / 1e9 : 0.0);
+
+    free_chunks(data, nb_data);
+    free_chunks(parity, nb_parity);
+}
+
+static void
+benchmark(void)
+{
+    gboolean have_avx512 = rait_have_avx512;
+    gboolean have_avx2 = rait_have_avx2;
+
+    g_fprintf(stderr, " benchmark:\n");
+
+    rait_xor_region = rait_xor_region_generic;
+    rait_gf_mul_region = rait_gf_mul_region_generic;
+    bench_encode("generic", 8, 1);
+    bench_encode("generic", 8, 2);
+    if (have_avx2) {
+	rait_xor_region = rait_xor_region_avx2;
+	rait_gf_mul_region = rait_gf_mul_region_avx2;
+	bench_encode("avx2", 8, 1);
+	bench_encode("avx2", 8, 2);
+    }
+    if (have_avx512) {
+	rait_xor_region = rait_xor_region_avx512;
+	rait_gf_mul_region = rait_gf_mul_region_avx512;
+	bench_encode("avx512", 8, 1);
+	bench_encode("avx512", 8, 2);
+    }
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(
+    int    argc,
+    char **argv)
+{
+    static const guint geometries[][2] = {
+	{ 1, 1 }, { 1, 2 }, { 2, 1 }, { 3, 1 }, { 4, 2 }, { 8, 2 },
+	{ 6, 3 }, { 10, 4 },
+    };
+    int i;
+    int nb_error = 0;
+    gboolean bench = FALSE;
+
+    for (i = 1; i < argc; i++) {
+	if (g_str_equal(argv[i], "--bench")) {
+	    bench = TRUE;
+	} else {
+	    g_fprintf(stderr, "USAGE: %s [--bench]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    rait_parity_init();
+
+    if (!test_gf())
+	nb_error++;
+    if (!test_kernels())
+	nb_error++;
+    if (!test_layout())
+	nb_error++;
+    for (i = 0; i < (int)G_N_ELEMENTS(geometries); i++) {
+	if (!test_reconstruct(geometries[i][0], geometries[i][1]))
+	    nb_error++;
+    }
+
+    if (nb_error) {
+	g_fprintf(stderr, " FAIL RAIT parity\n");
+    } else {
+	g_fprintf(stderr, " PASS RAIT parity\n");
+	if (bench)
+	    benchmark();
+    }
+    return nb_error;
+}
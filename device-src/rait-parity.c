@@ -0,0 +1,367 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Reed-Solomon parity for the RAIT device; see rait-parity.h
+ */
+
+#include "amanda.h"
+#include "rait-parity.h"
+
+#define GF_POLY 0x11d
+
+/* the chunks are processed this many bytes at a time, so that the piece of
+ * each data chunk stays in the cache while all the parity chunks use it */
+#define STRIP_SIZE 16384
+
+static guint8 gf_exp[512];
+static guint8 gf_log[256];
+static guint8 gf_mul_table[256][256];
+guint8 rait_gf_nibble_table[256][2][16];
+
+gboolean rait_have_avx2 = FALSE;
+gboolean rait_have_avx512 = FALSE;
+void (*rait_xor_region)(char *dst, const char *src, gsize len);
+void (*rait_gf_mul_region)(guint8 c, const char *src, char *dst,
+			   gsize len, gboolean add);
+
+static gboolean parity_initialized = FALSE;
+
+void
+rait_parity_init(void)
+{
+    guint x;
+    guint a, b;
+
+    if (parity_initialized)
+	return;
+
+    /* 2 generates the multiplicative group */
+    x = 1;
+    for (a = 0; a < 255; a++) {
+	gf_exp[a] = x;
+	gf_log[x] = a;
+	x <<= 1;
+	if (x & 0x100)
+	    x ^= GF_POLY;
+    }
+    /* so that gf_exp[gf_log[a] + gf_log[b]] needs no modulo */
+    for (a = 255; a < 512; a++)
+	gf_exp[a] = gf_exp[a - 255];
+
+    for (a = 0; a < 256; a++) {
+	for (b = 0; b < 256; b++) {
+	    if (a == 0 || b == 0)
+		gf_mul_table[a][b] = 0;
+	    else
+		gf_mul_table[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+	}
+	for (b = 0; b < 16; b++) {
+	    rait_gf_nibble_table[a][0][b] = gf_mul_table[a][b];
+	    rait_gf_nibble_table[a][1][b] = gf_mul_table[a][b << 4];
+	}
+    }
+
+    if (compiled_with_avx512)
+	rait_have_avx512 = rait_cpu_has_avx512();
+    if (compiled_with_avx2)
+	rait_have_avx2 = rait_cpu_has_avx2();
+    if (rait_have_avx512) {
+	rait_xor_region = &rait_xor_region_avx512;
+	rait_gf_mul_region = &rait_gf_mul_region_avx512;
+    } else if (rait_have_avx2) {
+	rait_xor_region = &rait_xor_region_avx2;
+	rait_gf_mul_region = &rait_gf_mul_region_avx2;
+    } else {
+	rait_xor_region = &rait_xor_region_generic;
+	rait_gf_mul_region = &rait_gf_mul_region_generic;
+    }
+
+    parity_initialized = TRUE;
+}
+
+guint8
+rait_gf_mul(
+    guint8 a,
+    guint8 b)
+{
+    return gf_mul_table[a][b];
+}
+
+static guint8
+gf_div(
+    guint8 a,
+    guint8 b)
+{
+    g_assert(b != 0);
+    if (a == 0)
+	return 0;
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+guint8
+rait_parity_coef(
+    guint parity,
+    guint data)
+{
+    guint8 x = parity;
+    guint8 y = 0xff ^ data;
+
+    if (parity == 0 || data == 0)
+	return 1;
+
+    /* the Cauchy matrix 1 / (x_i + y_j), with x_i = i and y_j = 255 - j,
+     * which are all distinct as long as i + j < 255; row i is then scaled by
+     * (x_i + y_0) and column j by (x_0 + y_j) / (x_0 + y_0) */
+    g_assert(parity + data < 255);
+    return gf_div(rait_gf_mul(x ^ 0xff, y), rait_gf_mul(x ^ y, 0xff));
+}
+
+/* dst = c * src, or dst ^= c * src; multiplying by 0 or 1 needs no table */
+static void
+mul_region(
+    guint8 c,
+    const char *src,
+    char *dst,
+    gsize len,
+    gboolean add)
+{
+    if (c == 0) {
+	if (!add)
+	    memset(dst, 0, len);
+    } else if (c == 1) {
+	if (add)
+	    rait_xor_region(dst, src, len);
+	else
+	    memcpy(dst, src, len);
+    } else {
+	rait_gf_mul_region(c, src, dst, len, add);
+    }
+}
+
+void
+rait_parity_encode(
+    guint nb_data,
+    guint nb_parity,
+    char **data,
+    char **parity,
+    gsize size)
+{
+    gsize offset;
+    gsize len;
+    guint p, d;
+
+    g_assert(nb_data > 0);
+    g_assert(nb_parity <= 1 || nb_data + nb_parity <= RAIT_PARITY_MAX_CHUNKS);
+
+    for (offset = 0; offset < size; offset += len) {
+	len = MIN(STRIP_SIZE, size - offset);
+	for (p = 0; p < nb_parity; p++) {
+	    for (d = 0; d < nb_data; d++) {
+		mul_region(rait_parity_coef(p, d), data[d] + offset,
+			   parity[p] + offset, len, d > 0);
+	    }
+	}
+    }
+}
+
+/* Invert the k x k matrix m in place, by Gauss-Jordan elimination.  Returns
+ * FALSE if m is singular, which can not happen for a square piece of our
+ * Cauchy matrix. */
+static gboolean
+gf_invert_matrix(
+    guint8 *m,
+    guint k)
+{
+    guint8 *inv = g_new0(guint8, k * k);
+    guint row, col, i;
+
+    for (i = 0; i < k; i++)
+	inv[i * k + i] = 1;
+
+    for (col = 0; col < k; col++) {
+	guint8 pivot;
+
+	/* find a row with a non-zero pivot, and move it up */
+	for (row = col; row < k; row++) {
+	    if (m[row * k + col])
+		break;
+	}
+	if (row == k) {
+	    g_free(inv);
+	    return FALSE;
+	}
+	if (row != col) {
+	    for (i = 0; i < k; i++) {
+		guint8 t;
+		t = m[row * k + i]; m[row * k + i] = m[col * k + i]; m[col * k + i] = t;
+		t = inv[row * k + i]; inv[row * k + i] = inv[col * k + i]; inv[col * k + i] = t;
+	    }
+	}
+
+	/* scale the pivot row to get a one on the diagonal */
+	pivot = m[col * k + col];
+	for (i = 0; i < k; i++) {
+	    m[col * k + i] = gf_div(m[col * k + i], pivot);
+	    inv[col * k + i] = gf_div(inv[col * k + i], pivot);
+	}
+
+	/* and clear the column in every other row */
+	for (row = 0; row < k; row++) {
+	    guint8 f = m[row * k + col];
+
+	    if (row == col || f == 0)
+		continue;
+	    for (i = 0; i < k; i++) {
+		m[row * k + i] ^= rait_gf_mul(f, m[col * k + i]);
+		inv[row * k + i] ^= rait_gf_mul(f, inv[col * k + i]);
+	    }
+	}
+    }
+
+    memcpy(m, inv, k * k);
+    g_free(inv);
+    return TRUE;
+}
+
+gboolean
+rait_parity_reconstruct(
+    guint nb_data,
+    guint nb_parity,
+    char **chunks,
+    const gboolean *lost,
+    char **scratch,
+    gsize size)
+{
+    guint *lost_data;
+    guint *rows;
+    guint8 *matrix;
+    guint nb_lost = 0;
+    guint nb_rows = 0;
+    guint i, r, d;
+    gboolean rval = FALSE;
+
+    lost_data = g_new(guint, nb_data);
+    rows = g_new(guint, nb_parity + 1);
+    for (d = 0; d < nb_data; d++) {
+	if (lost[d])
+	    lost_data[nb_lost++] = d;
+    }
+    if (nb_lost == 0) {
+	rval = TRUE;
+	goto done;
+    }
+
+    /* use the first nb_lost parity chunks that were read */
+    for (i = 0; i < nb_parity && nb_rows < nb_lost; i++) {
+	if (!lost[nb_data + i])
+	    rows[nb_rows++] = i;
+    }
+    if (nb_rows < nb_lost)
+	goto done;
+
+    /* Each parity chunk, less the contribution of the data chunks that were
+     * read, leaves the contribution of the lost data chunks: a system of
+     * nb_lost equations, solved by inverting its matrix. */
+    matrix = g_new(guint8, nb_lost * nb_lost);
+    for (r = 0; r < nb_lost; r++) {
+	for (i = 0; i < nb_lost; i++)
+	    matrix[r * nb_lost + i] = rait_parity_coef(rows[r], lost_data[i]);
+    }
+    if (!gf_invert_matrix(matrix, nb_lost)) {
+	g_free(matrix);
+	goto done;
+    }
+
+    for (r = 0; r < nb_lost; r++) {
+	memcpy(scratch[r], chunks[nb_data + rows[r]], size);
+	for (d = 0; d < nb_data; d++) {
+	    if (lost[d])
+		continue;
+	    mul_region(rait_parity_coef(rows[r], d), chunks[d], scratch[r],
+		       size, TRUE);
+	}
+    }
+
+    for (i = 0; i < nb_lost; i++) {
+	for (r = 0; r < nb_lost; r++) {
+	    mul_region(matrix[i * nb_lost + r], scratch[r],
+		       chunks[lost_data[i]], size, r > 0);
+	}
+    }
+
+    g_free(matrix);
+    rval = TRUE;
+
+done:
+    g_free(lost_data);
+    g_free(rows);
+    return rval;
+}
+
+void
+rait_xor_region_generic(
+    char *dst,
+    const char *src,
+    gsize len)
+{
+    gsize i;
+
+    /* a 64-bit word at a time, which the compiler can turn into vector
+     * instructions; memcpy keeps the loads safe whatever the alignment */
+    for (i = 0; i + sizeof(guint64) <= len; i += sizeof(guint64)) {
+	guint64 d, s;
+	memcpy(&d, dst + i, sizeof(d));
+	memcpy(&s, src + i, sizeof(s));
+	d ^= s;
+	memcpy(dst + i, &d, sizeof(d));
+    }
+    for (; i < len; i++) {
+	dst[i] ^= src[i];
+    }
+}
+
+void
+rait_gf_mul_region_generic(
+    guint8 c,
+    const char *src,
+    char *dst,
+    gsize len,
+    gboolean add)
+{
+    const guint8 *table = gf_mul_table[c];
+    const guint8 *s = (const guint8 *)src;
+    guint8 *d = (guint8 *)dst;
+    gsize i;
+
+    if (add) {
+	for (i = 0; i < len; i++)
+	    d[i] ^= table[s[i]];
+    } else {
+	for (i = 0; i < len; i++)
+	    d[i] = table[s[i]];
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Reed-Solomon parity for the RAIT device
+ *
+ * A block is split in nb_data data chunks, and nb_parity parity chunks are
+ * computed from them over GF(2^8) (polynomial 0x11d).  Any nb_parity chunks
+ * can be lost and the data still rebuilt from the others.
+ *
+ * The coefficients form a Cauchy matrix scaled so that its first row and its
+ * first column are all ones: the first parity chunk is the XOR of the data
+ * chunks (the layout of a RAIT volume with a single parity child), and with a
+ * single data chunk every parity chunk is a copy of it (a mirror).  The
+ * coefficients do not depend on nb_data or nb_parity, but there can be at
+ * most RAIT_PARITY_MAX_CHUNKS chunks in all when nb_parity > 1.
+ */
+
+#ifndef RAIT_PARITY_H
+#define RAIT_PARITY_H
+
+#include "amanda.h"
+
+#define RAIT_PARITY_MAX_CHUNKS 256
+
+/* Build the tables and pick the fastest kernels for this CPU; call this
+ * before anything else in this file. */
+void rait_parity_init(void);
+
+guint8 rait_gf_mul(guint8 a, guint8 b);
+
+/* the coefficient of data chunk DATA in parity chunk PARITY */
+guint8 rait_parity_coef(guint parity, guint data);
+
+/* Compute the nb_parity parity chunks from the nb_data data chunks; every
+ * chunk is size bytes long. */
+void rait_parity_encode(guint nb_data, guint nb_parity,
+			char **data, char **parity, gsize size);
+
+/* Rebuild the lost data chunks.  chunks holds the nb_data data chunks
+ * followed by the nb_parity parity chunks, and lost[i] is TRUE if chunks[i]
+ * was not read; the lost data chunks are overwritten, the lost parity chunks
+ * are left alone.  scratch is nb_parity buffers of size bytes.  Returns FALSE
+ * if more chunks were lost than there are parity chunks. */
+gboolean rait_parity_reconstruct(guint nb_data, guint nb_parity,
+				 char **chunks, const gboolean *lost,
+				 char **scratch, gsize size);
+
+/*
+ * Kernels; rait_parity_init points rait_xor_region and rait_gf_mul_region
+ * at the best ones the CPU supports.  The others are only exported for
+ * rait-parity-test.
+ */
+
+/* dst ^= src */
+extern void (*rait_xor_region)(char *dst, const char *src, gsize len);
+/* dst = c * src, or dst ^= c * src if add */
+extern void (*rait_gf_mul_region)(guint8 c, const char *src, char *dst,
+				  gsize len, gboolean add);
+
+/* rait_gf_nibble_table[c][0][n] = c * n, rait_gf_nibble_table[c][1][n] = c *
+ * (n << 4), for the byte-shuffle kernels */
+extern guint8 rait_gf_nibble_table[256][2][16];
+
+void rait_xor_region_generic(char *dst, const char *src, gsize len);
+void rait_gf_mul_region_generic(guint8 c, const char *src, char *dst,
+				gsize len, gboolean add);
+
+extern gboolean compiled_with_avx2;
+extern gboolean rait_have_avx2;
+gboolean rait_cpu_has_avx2(void);
+void rait_xor_region_avx2(char *dst, const char *src, gsize len);
+void rait_gf_mul_region_avx2(guint8 c, const char *src, char *dst,
+			     gsize len, gboolean add);
+
+extern gboolean compiled_with_avx512;
+extern gboolean rait_have_avx512;
+gboolean rait_cpu_has_avx512(void);
+void rait_xor_region_avx512(char *dst, const char *src, gsize len);
+void rait_gf_mul_region_avx512(guint8 c, const char *src, char *dst,
+			       gsize len, gboolean add);
+
+#endif /* RAIT_PARITY_H */
@@ -154,6 +154,18 @@ static DevicePropertyBase device_property_s3_subdomain;
 static DevicePropertyBase device_property_s3_multi_part_upload;
 #define PROPERTY_S3_MULTI_PART_UPLOAD (device_property_s3_multi_part_upload.ID)
 
+/* Size of the parts of a multi-part upload */
+static DevicePropertyBase device_property_s3_multi_part_size;
+#define PROPERTY_S3_MULTI_PART_SIZE (device_property_s3_multi_part_size.ID)
+
+/* Number of multi-part upload parts that can be in memory */
+static DevicePropertyBase device_property_nb_buffers_backup;
+#define PROPERTY_NB_BUFFERS_BACKUP (device_property_nb_buffers_backup.ID)
+
+/* Number of blocks read ahead that can wait in memory to be returned in order */
+static DevicePropertyBase device_property_nb_buffers_recovery;
+#define PROPERTY_NB_BUFFERS_RECOVERY (device_property_nb_buffers_recovery.ID)
+
 /* If the s3 server have the multi-delete functionality */
 static DevicePropertyBase device_property_s3_multi_delete;
 #define PROPERTY_S3_MULTI_DELETE (device_property_s3_multi_delete.ID)
@@ -468,10 +480,22 @@ static gboolean s3_device_set_nb_threads_recovery(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
 
+static gboolean s3_device_set_nb_buffers_recovery(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
 static gboolean s3_device_set_s3_multi_part_upload(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
 
+static gboolean s3_device_set_s3_multi_part_size(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_nb_buffers_backup(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
 static gboolean s3_device_set_max_volume_usage_fn(Device *p_self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
@@ -530,6 +554,31 @@ static gboolean make_bucket(Device * pself);
 /* Wait that all threads are done */
 static void reset_thread(S3Device *self);
 
+/* A block read by a thread, waiting in self->read_ahead to be returned */
+typedef struct s3_read_ahead_s {
+    gint64  block;
+    char   *buffer;
+    guint   size;
+} s3_read_ahead_t;
+
+static gint compare_read_ahead_block(gconstpointer a, gconstpointer b,
+				     gpointer data);
+static void free_read_ahead_block(gpointer data);
+
+/* Drop all blocks read ahead but not returned */
+static void reset_read_ahead(S3Device *self);
+
+/* Multi-part upload pipeline; see S3Device.parts_ready */
+static gboolean s3_device_write_part(S3Device *self, guint size,
+				     gpointer data);
+static S3Part *s3_get_free_part(S3Device *self);
+static void s3_start_part_upload(S3Device *self);
+static gboolean s3_check_write_error(S3Device *self);
+static void free_part(gpointer data);
+
+/* Free all the parts; no upload may be running */
+static void free_parts(S3Device *self);
+
 /*
  * virtual functions */
 
@@ -1181,6 +1230,15 @@ s3_device_register(void)
     device_property_fill_and_register(&device_property_s3_multi_part_upload,
                                       G_TYPE_BOOLEAN, "s3_multi_part_upload",
        "If multi part upload must be used");
+    device_property_fill_and_register(&device_property_s3_multi_part_size,
+                                      G_TYPE_UINT64, "s3_multi_part_size",
+       "Size of the parts of a multi-part upload");
+    device_property_fill_and_register(&device_property_nb_buffers_backup,
+                                      G_TYPE_UINT64, "nb_buffers_backup",
+       "Number of multi-part upload parts that can be in memory");
+    device_property_fill_and_register(&device_property_nb_buffers_recovery,
+                                      G_TYPE_UINT64, "nb_buffers_recovery",
+       "Number of blocks read ahead that can wait to be returned in order");
 
     device_property_fill_and_register(&device_property_timeout,
                                       G_TYPE_UINT64, "timeout",
@@ -1231,7 +1289,18 @@ s3_device_init(S3Device * self)
     self->nb_threads = 1;
     self->nb_threads_backup = 1;
     self->nb_threads_recovery = 1;
+    self->nb_buffers_recovery = -1;
+    self->read_ahead = NULL;
+    self->nb_read_ahead = 0;
     self->use_s3_multi_part_upload = FALSE;
+    self->multi_part_size = 0;
+    self->nb_buffers_backup = -1;
+    self->part_size = 0;
+    self->nb_parts = 0;
+    self->part_filling = NULL;
+    self->parts_ready = NULL;
+    self->parts_free = NULL;
+    self->next_part_number = 1;
     self->thread_pool_delete = NULL;
     self->thread_pool_write = NULL;
     self->thread_pool_read = NULL;
@@ -1519,11 +1588,26 @@ s3_device_base_init(
 	    device_simple_property_get_fn,
 	    s3_device_set_nb_threads_recovery);
 
+    device_class_register_property(device_class, PROPERTY_NB_BUFFERS_BACKUP,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_nb_buffers_backup);
+
+    device_class_register_property(device_class, PROPERTY_NB_BUFFERS_RECOVERY,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_nb_buffers_recovery);
+
     device_class_register_property(device_class, PROPERTY_S3_MULTI_PART_UPLOAD,
 	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
 	    device_simple_property_get_fn,
 	    s3_device_set_s3_multi_part_upload);
 
+    device_class_register_property(device_class, PROPERTY_S3_MULTI_PART_SIZE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_s3_multi_part_size);
+
     device_class_register_property(device_class, PROPERTY_COMPRESSION,
 	    PROPERTY_ACCESS_GET_MASK,
 	    device_simple_property_get_fn,
@@ -2165,6 +2249,18 @@ s3_device_set_nb_threads_recovery(Device *p_self,
     return device_simple_property_set_fn(p_self, base, val, surety, source);
 }
 
+static gboolean
+s3_device_set_nb_buffers_recovery(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->nb_buffers_recovery = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
 static gboolean
 s3_device_set_s3_multi_part_upload(Device *p_self,
     DevicePropertyBase *base, GValue *val,
@@ -2177,6 +2273,38 @@ s3_device_set_s3_multi_part_upload(Device *p_self,
     return device_simple_property_set_fn(p_self, base, val, surety, source);
 }
 
+static gboolean
+s3_device_set_s3_multi_part_size(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->multi_part_size = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_nb_buffers_backup(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+    guint64 new_val;
+
+    new_val = g_value_get_uint64(val);
+    if (new_val < 1) {
+	device_set_error(p_self,
+	    g_strdup(_("NB_BUFFERS_BACKUP must be at least 1")),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+    self->nb_buffers_backup = new_val;
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
 static gboolean
 s3_device_set_max_volume_usage_fn(Device *p_self,
     DevicePropertyBase *base, GValue *val,
@@ -2479,6 +2607,15 @@ static void s3_device_finalize(GObject * obj_self) {
 	g_cond_free(self->thread_idle_cond);
 	self->thread_idle_cond = NULL;
     }
+    if (self->read_ahead) {
+	g_tree_destroy(self->read_ahead);
+	self->read_ahead = NULL;
+    }
+    free_parts(self);
+    if (self->parts_ready) {
+	g_queue_free(self->parts_ready);
+	self->parts_ready = NULL;
+    }
     if (self->s3t) {
 	for (thread = 0; thread < self->nb_threads; thread++) {
 	    g_mutex_free(self->s3t[thread].now_mutex);
@@ -2740,6 +2877,18 @@ setup_handle(S3Device * self) {
 	self->thread_idle_cond = g_cond_new();
 	self->thread_idle_mutex = g_mutex_new();
 
+	/* by default, keep as many finished blocks as there are readers */
+	if (self->nb_buffers_recovery < 0)
+	    self->nb_buffers_recovery = self->nb_threads_recovery;
+	self->read_ahead = g_tree_new_full(compare_read_ahead_block, NULL,
+					   NULL, free_read_ahead_block);
+	self->nb_read_ahead = 0;
+
+	/* by default, one part can be filled while each thread sends one */
+	if (self->nb_buffers_backup < 0)
+	    self->nb_buffers_backup = self->nb_threads_backup + 1;
+	self->parts_ready = g_queue_new();
+
 	for (thread = 0; thread < self->nb_threads; thread++) {
 	    self->s3t[thread].idle = 1;
 	    self->s3t[thread].done = 1;
@@ -3187,6 +3336,8 @@ s3_device_finish (
     S3Device *self = S3_DEVICE(pself);
 
     reset_thread(self);
+    reset_read_ahead(self);
+    free_parts(self);
 
     /* we're not in a file anymore */
     pself->access_mode = ACCESS_NULL;
@@ -3327,6 +3478,9 @@ s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
 	self->uploadId = g_strdup(s3_initiate_multi_part_upload(self->s3t[0].s3,
 						self->bucket, self->filename));
 	self->part_etag = g_tree_new_full(gint_cmp, NULL, NULL, g_free);
+	self->part_size = self->multi_part_size ? self->multi_part_size
+						: pself->block_size;
+	self->next_part_number = 1;
     }
 
     return TRUE;
@@ -3357,8 +3511,14 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
     }
 
     if (self->use_s3_multi_part_upload && self->uploadId) {
-	filename = g_strdup(self->filename);
-    } else if (self->chunked) {
+	if (!s3_device_write_part(self, size, data))
+	    return WRITE_FAILED;
+	pself->block++;
+	self->volume_bytes += size;
+	return WRITE_SUCCEED;
+    }
+
+    if (self->chunked) {
 	filename = g_strdup(self->filename);
     } else {
 	filename = file_and_block_to_key(self, pself->file, pself->block);
@@ -3476,8 +3636,8 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
 	self->s3t[thread].curl_buffer.cond = NULL;
     }
     self->s3t[thread].filename = filename;
-    self->s3t[thread].uploadId = g_strdup(self->uploadId);
-    self->s3t[thread].partNumber = pself->block + 1;
+    self->s3t[thread].uploadId = NULL;
+    self->s3t[thread].partNumber = 0;
     g_mutex_unlock(self->thread_idle_mutex);
     g_thread_pool_push(self->thread_pool_write, &self->s3t[thread], NULL);
 
@@ -3486,6 +3646,186 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
     return WRITE_SUCCEED;
 }
 
+/* Copy a block into the parts of the multi-part upload, sending each part
+ * as soon as it is full.  Blocks when all the parts are in flight. */
+static gboolean
+s3_device_write_part(
+    S3Device *self,
+    guint     size,
+    gpointer  data)
+{
+    guint copied = 0;
+
+    while (copied < size) {
+	S3Part *part;
+	guint64 count;
+
+	if (!self->part_filling) {
+	    g_mutex_lock(self->thread_idle_mutex);
+	    self->part_filling = s3_get_free_part(self);
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    if (!self->part_filling)
+		return FALSE;
+	}
+	part = self->part_filling;
+
+	/* the copy is done without the lock, the part is ours */
+	count = MIN(part->alloc - part->size, (guint64)(size - copied));
+	memcpy(part->buffer + part->size, (char *)data + copied, count);
+	part->size += count;
+	copied += count;
+
+	if (part->size == part->alloc) {
+	    g_mutex_lock(self->thread_idle_mutex);
+	    g_queue_push_tail(self->parts_ready, part);
+	    self->part_filling = NULL;
+	    s3_start_part_upload(self);
+	    g_mutex_unlock(self->thread_idle_mutex);
+	}
+    }
+
+    return TRUE;
+}
+
+/* Return an empty part, allocating it if fewer than nb_buffers_backup parts
+ * exist, or waiting for an upload to finish.  Called with
+ * thread_idle_mutex held; returns NULL with the device in error. */
+static S3Part *
+s3_get_free_part(
+    S3Device *self)
+{
+    S3Part *part = NULL;
+
+    while (1) {
+	if (s3_check_write_error(self))
+	    return NULL;
+
+	if (self->parts_free) {
+	    part = self->parts_free->data;
+	    self->parts_free = g_slist_delete_link(self->parts_free,
+						   self->parts_free);
+	    if (part->alloc == self->part_size)
+		break;
+	    /* allocated for another part size */
+	    free_part(part);
+	    self->nb_parts--;
+	}
+
+	if (self->nb_parts < self->nb_buffers_backup) {
+	    part = g_new0(S3Part, 1);
+	    part->buffer = g_try_malloc(self->part_size);
+	    if (!part->buffer) {
+		g_free(part);
+		device_set_error(DEVICE(self),
+			g_strdup("Failed to allocate memory"),
+			DEVICE_STATUS_DEVICE_ERROR);
+		return NULL;
+	    }
+	    part->alloc = self->part_size;
+	    self->nb_parts++;
+	    break;
+	}
+
+	g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+    }
+
+    part->size = 0;
+    part->partNumber = self->next_part_number++;
+    return part;
+}
+
+/* Give the parts waiting in parts_ready to the idle write threads.  Called
+ * with thread_idle_mutex held, from the device or from a write thread. */
+static void
+s3_start_part_upload(
+    S3Device *self)
+{
+    int thread;
+
+    if (device_in_error(DEVICE(self)))
+	return;
+
+    for (thread = 0; thread < self->nb_threads_backup; thread++) {
+	S3_by_thread *s3t = &self->s3t[thread];
+	S3Part *part;
+
+	if (g_queue_is_empty(self->parts_ready))
+	    break;
+	if (s3t->idle != 1 || s3t->errflags != DEVICE_STATUS_SUCCESS)
+	    continue;
+
+	part = g_queue_pop_head(self->parts_ready);
+
+	/* the part is sent from its own buffer */
+	g_free((char *)s3t->curl_buffer.buffer);
+	s3t->part = part;
+	s3t->idle = 0;
+	s3t->done = 0;
+	s3t->curl_buffer.buffer = part->buffer;
+	s3t->curl_buffer.buffer_pos = 0;
+	s3t->curl_buffer.buffer_len = part->size;
+	s3t->curl_buffer.max_buffer_size = part->alloc;
+	s3t->curl_buffer.end_of_buffer = TRUE;
+	s3t->curl_buffer.mutex = NULL;
+	s3t->curl_buffer.cond = NULL;
+	s3t->buffer_len = part->size;
+	s3t->filename = g_strdup(self->filename);
+	s3t->uploadId = g_strdup(self->uploadId);
+	s3t->partNumber = part->partNumber;
+	g_thread_pool_push(self->thread_pool_write, s3t, NULL);
+    }
+}
+
+/* Move an error of a write thread to the device.  Called with
+ * thread_idle_mutex held. */
+static gboolean
+s3_check_write_error(
+    S3Device *self)
+{
+    int thread;
+
+    for (thread = 0; thread < self->nb_threads_backup; thread++) {
+	S3_by_thread *s3t = &self->s3t[thread];
+
+	if (s3t->idle == 1 && s3t->errflags != DEVICE_STATUS_SUCCESS) {
+	    device_set_error(DEVICE(self), (char *)s3t->errmsg, s3t->errflags);
+	    s3t->errflags = DEVICE_STATUS_SUCCESS;
+	    s3t->errmsg = NULL;
+	}
+    }
+
+    return device_in_error(DEVICE(self));
+}
+
+static void
+free_part(
+    gpointer data)
+{
+    S3Part *part = data;
+
+    g_free(part->buffer);
+    g_free(part);
+}
+
+static void
+free_parts(
+    S3Device *self)
+{
+    S3Part *part;
+
+    if (self->part_filling) {
+	free_part(self->part_filling);
+	self->part_filling = NULL;
+    }
+    if (self->parts_ready) {
+	while ((part = g_queue_pop_head(self->parts_ready)) != NULL)
+	    free_part(part);
+    }
+    slist_free_full(self->parts_free, free_part);
+    self->parts_free = NULL;
+    self->nb_parts = 0;
+}
+
 static void
 s3_thread_write_block(
     gpointer thread_data,
@@ -3525,6 +3865,7 @@ s3_thread_write_block(
     g_free((void *)s3t->filename);
     g_free((void *)s3t->uploadId);
     s3t->filename = NULL;
+    s3t->uploadId = NULL;
     if (!result) {
 	s3t->errflags = DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR;
 	s3t->errmsg = g_strdup_printf(_("While writing data block to %s: %s"), S3_name[self->s3_api], s3_strerror(s3t->s3));
@@ -3541,6 +3882,16 @@ s3_thread_write_block(
 	self->ultotal += s3t->curl_buffer.buffer_len;
     s3t->curl_buffer.buffer_len = s3t->buffer_len;
     s3t->ulnow = 0;
+    if (s3t->part) {
+	/* the buffer belongs to the part, which goes back to the pool; then
+	 * start on the next full part right away */
+	self->parts_free = g_slist_prepend(self->parts_free, s3t->part);
+	s3t->part = NULL;
+	s3t->curl_buffer.buffer = NULL;
+	s3t->curl_buffer.buffer_len = 0;
+	s3t->buffer_len = 0;
+	s3_start_part_upload(self);
+    }
     g_cond_broadcast(self->thread_idle_cond);
     g_mutex_unlock(self->thread_idle_mutex);
 
@@ -3584,6 +3935,18 @@ s3_device_finish_file (Device * pself) {
 
     g_mutex_lock(self->thread_idle_mutex);
 
+    /* send the last part, which may be short */
+    if (self->part_filling) {
+	if (self->part_filling->size > 0) {
+	    g_queue_push_tail(self->parts_ready, self->part_filling);
+	} else {
+	    self->parts_free = g_slist_prepend(self->parts_free,
+					       self->part_filling);
+	}
+	self->part_filling = NULL;
+	s3_start_part_upload(self);
+    }
+
     while (idle_thread != self->nb_threads) {
 	idle_thread = 0;
 	for (thread = 0; thread < self->nb_threads; thread++)  {
@@ -3603,8 +3966,23 @@ s3_device_finish_file (Device * pself) {
 	}
     }
     self->ultotal = 0;
+
+    /* the parts not sent because of an error */
+    if (self->parts_ready) {
+	S3Part *part;
+	while ((part = g_queue_pop_head(self->parts_ready)) != NULL)
+	    self->parts_free = g_slist_prepend(self->parts_free, part);
+    }
     g_mutex_unlock(self->thread_idle_mutex);
-    if (self->use_s3_multi_part_upload && self->uploadId) {
+
+    if (self->use_s3_multi_part_upload && self->uploadId &&
+	device_in_error(pself)) {
+	s3_abort_multi_part_upload(self->s3t[0].s3, self->bucket,
+				   self->filename, self->uploadId);
+	g_tree_destroy(self->part_etag);
+	self->part_etag = NULL;
+	amfree(self->filename);
+    } else if (self->use_s3_multi_part_upload && self->uploadId) {
 	CurlBuffer data;
 	GString *buf = g_string_new("<CompleteMultipartUpload>\n");
 	g_tree_foreach(self->part_etag, add_part_etag, buf);
@@ -3616,13 +3994,19 @@ s3_device_finish_file (Device * pself) {
 	data.end_of_buffer = FALSE;
 	data.mutex = NULL;
 	data.cond = NULL;
-	s3_complete_multi_part_upload(self->s3t[0].s3,
+	if (!s3_complete_multi_part_upload(self->s3t[0].s3,
 				self->bucket, self->filename, self->uploadId,
-				S3_BUFFER_READ_FUNCS, &data);
+				S3_BUFFER_READ_FUNCS, &data)) {
+	    device_set_error(pself,
+		g_strdup_printf(_("While completing multi-part upload: %s"),
+				s3_strerror(self->s3t[0].s3)),
+		DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
+	}
+	g_string_free(buf, TRUE);
 
 	g_tree_destroy(self->part_etag);
 	self->part_etag = NULL;
-	g_free(self->filename);
+	amfree(self->filename);
     }
 
     amfree(self->uploadId);
@@ -3950,6 +4334,7 @@ s3_device_seek_file(Device *pself, guint file) {
     if (device_in_error(self)) return NULL;
 
     reset_thread(self);
+    reset_read_ahead(self);
 
     g_mutex_lock(pself->device_mutex);
     pself->file = file;
@@ -4068,6 +4453,7 @@ s3_device_seek_block(Device *pself, guint64 block) {
     if (device_in_error(pself)) return FALSE;
 
     reset_thread(self);
+    reset_read_ahead(self);
     pself->block = block;
     self->last_byte_read = (block * pself->block_size) - 1;
     self->next_block_to_read = block;
@@ -4126,6 +4512,7 @@ s3_start_read_ahead(
 	    s3t->filename = key;
 	    s3t->range_min = range_min;
 	    s3t->range_max = range_max;
+	    s3t->block = self->next_block_to_read;
 	    s3t->done = 0;
 	    s3t->idle = 0;
 	    s3t->eof = FALSE;
@@ -4175,11 +4562,9 @@ s3_start_read_ahead(
 static int
 s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_block G_GNUC_UNUSED) {
     S3Device * self = S3_DEVICE(pself);
-    char *key;
     int thread;
     int done = 0;
     int found = 0;
-    guint64 range_min = 0;
     S3_by_thread *s3t = NULL;
 
     g_assert (self != NULL);
@@ -4261,42 +4646,55 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 	return size;
     }
 
-    /* get the file*/
-    if (self->filename) {
-	key = g_strdup(self->filename);
-	range_min = self->last_byte_read + 1;
-    } else {
-	key = file_and_block_to_key(self, pself->file, pself->block);
-    }
-    g_assert(key != NULL);
+    /* The block is either waiting in the read-ahead buffer, because its
+     * thread finished it before the blocks preceding it were returned, or
+     * still held by the thread reading it. */
+    while (!done) {
+	gint64 block = pself->block;
+	s3_read_ahead_t *rb = g_tree_lookup(self->read_ahead, &block);
 
-    found = 0;
-    /* find which thread read the key */
-    for (thread = 0; thread < self->nb_threads_recovery; thread++) {
-	s3t = &self->s3t[thread];
-	if (!s3t->idle &&
-	    g_str_equal(key, (char *)s3t->filename) &&
-	    range_min == s3t->range_min) {
-	    found = 1;
+	if (rb) {
+	    if ((guint)*size_req < rb->size) {
+		/* buffer not enough large */
+		*size_req = rb->size;
+		g_mutex_unlock(self->thread_idle_mutex);
+		return 0;
+	    }
+	    g_tree_steal(self->read_ahead, &block);
+	    self->nb_read_ahead--;
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    memcpy(data, rb->buffer, rb->size);
+	    *size_req = rb->size;
+	    free_read_ahead_block(rb);
+	    pself->block++;
+	    self->last_byte_read += *size_req;
+	    done = 1;
+	    g_mutex_lock(self->thread_idle_mutex);
 	    break;
 	}
-    }
 
-   if (!found) {
-	/* return eof */
-	g_free(key);
-	pself->is_eof = TRUE;
-	pself->in_file = FALSE;
-	device_set_error(pself, g_strdup(_("EOF")), DEVICE_STATUS_SUCCESS);
-	g_mutex_unlock(self->thread_idle_mutex);
-	return -1;
-   }
+	found = 0;
+	/* find which thread read the block */
+	for (thread = 0; thread < self->nb_threads_recovery; thread++) {
+	    s3t = &self->s3t[thread];
+	    if (!s3t->idle && s3t->block == block) {
+		found = 1;
+		break;
+	    }
+	}
+
+	if (!found) {
+	    /* return eof */
+	    pself->is_eof = TRUE;
+	    pself->in_file = FALSE;
+	    device_set_error(pself, g_strdup(_("EOF")), DEVICE_STATUS_SUCCESS);
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    return -1;
+	}
 
-    while (!done) {
 	if (!s3t->done) {
 	} else if (s3t->eof) {
 	    /* return eof */
-	    g_free(key);
 	    pself->is_eof = TRUE;
 	    pself->in_file = FALSE;
 	    device_set_error(pself, g_strdup(_("EOF")), DEVICE_STATUS_SUCCESS);
@@ -4305,17 +4703,16 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 	} else if (s3t->errflags != DEVICE_STATUS_SUCCESS) {
 	    /* return the error */
 	    device_set_error(pself, (char *)s3t->errmsg, s3t->errflags);
-	    g_free(key);
 	    g_mutex_unlock(self->thread_idle_mutex);
 	    return -1;
-       } else if ((guint)*size_req >= s3t->curl_buffer.buffer_pos) {
+	} else if ((guint)*size_req >= s3t->curl_buffer.buffer_pos) {
 	    /* return the buffer */
 	    g_mutex_unlock(self->thread_idle_mutex);
 	    memcpy(data, s3t->curl_buffer.buffer, s3t->curl_buffer.buffer_pos);
 	    *size_req = s3t->curl_buffer.buffer_pos;
-	    g_free(key);
 	    s3t->idle = 1;
 	    g_free((char *)s3t->filename);
+	    s3t->filename = NULL;
 	    pself->block++;
 	    self->last_byte_read += *size_req;
 	    done = 1;
@@ -4323,14 +4720,18 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 	    break;
 	} else { /* buffer not enough large */
 	    *size_req = s3t->curl_buffer.buffer_len;
-	    g_free(key);
 	    g_mutex_unlock(self->thread_idle_mutex);
 	    return 0;
 	}
 
-	if (!done) {
-	    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+	/* threads that moved their block to the read-ahead buffer can
+	 * start on the next one while we wait */
+	s3_start_read_ahead(pself, max_block, *size_req);
+	if (device_in_error(self)) {
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    return -1;
 	}
+	g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
     }
 
     /* start a read ahead for each thread */
@@ -4408,6 +4809,27 @@ s3_thread_read_block(
 	s3t->eof = TRUE;
     } else {
 	self->dltotal += s3t->curl_buffer.buffer_pos;
+
+	/* Hand the block over to the read-ahead buffer if there is room,
+	 * so this thread can start on another range before the blocks
+	 * preceding this one are returned. */
+	if (!s3t->curl_buffer.mutex &&
+	    self->nb_read_ahead < self->nb_buffers_recovery) {
+	    s3_read_ahead_t *rb = g_new0(s3_read_ahead_t, 1);
+
+	    rb->block = s3t->block;
+	    rb->buffer = s3t->curl_buffer.buffer;
+	    rb->size = s3t->curl_buffer.buffer_pos;
+	    g_tree_insert(self->read_ahead, &rb->block, rb);
+	    self->nb_read_ahead++;
+	    s3t->curl_buffer.buffer = NULL;
+	    s3t->curl_buffer.buffer_len = 0;
+	    s3t->curl_buffer.buffer_pos = 0;
+	    s3t->buffer_len = 0;
+	    g_free((char *)s3t->filename);
+	    s3t->filename = NULL;
+	    s3t->idle = 1;
+	}
     }
     s3t->dlnow = 0;
     s3t->ulnow = 0;
@@ -4471,3 +4893,41 @@ reset_thread(
 	g_mutex_unlock(self->thread_idle_mutex);
     }
 }
+
+static gint
+compare_read_ahead_block(
+    gconstpointer a,
+    gconstpointer b,
+    gpointer data G_GNUC_UNUSED)
+{
+    gint64 block_a = *(const gint64 *)a;
+    gint64 block_b = *(const gint64 *)b;
+
+    if (block_a < block_b)
+	return -1;
+    return block_a > block_b;
+}
+
+static void
+free_read_ahead_block(
+    gpointer data)
+{
+    s3_read_ahead_t *rb = (s3_read_ahead_t *)data;
+
+    g_free(rb->buffer);
+    g_free(rb);
+}
+
+static void
+reset_read_ahead(
+    S3Device *self)
+{
+    if (self->read_ahead) {
+	g_mutex_lock(self->thread_idle_mutex);
+	g_tree_destroy(self->read_ahead);
+	self->read_ahead = g_tree_new_full(compare_read_ahead_block, NULL,
+					   NULL, free_read_ahead_block);
+	self->nb_read_ahead = 0;
+	g_mutex_unlock(self->thread_idle_mutex);
+    }
+}
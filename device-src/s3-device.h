@@ -52,6 +52,15 @@ extern DevicePropertyBase device_property_s3_secret_key;
 typedef struct _S3MetadataFile S3MetadataFile;
 typedef struct _S3Device S3Device;
 
+/* A part of a multi-part upload */
+typedef struct _S3Part S3Part;
+struct _S3Part {
+    char		*buffer;
+    guint64		 alloc;		/* size of buffer */
+    guint64		 size;		/* bytes of data in buffer */
+    int			 partNumber;
+};
+
 typedef struct _S3_by_thread S3_by_thread;
 struct _S3_by_thread {
     S3Handle            *s3;
@@ -65,6 +74,8 @@ struct _S3_by_thread {
     int			 partNumber;
     guint64		 range_min;
     guint64		 range_max;
+    gint64		 block;		/* block being read */
+    S3Part		*part;		/* part being uploaded */
     DeviceStatusFlags    errflags;	/* device_status */
     char                *errmsg;	/* device error message */
     GMutex		*now_mutex;
@@ -148,7 +159,20 @@ struct _S3Device {
     int          nb_threads;
     int          nb_threads_backup;
     int          nb_threads_recovery;
+    int          nb_buffers_recovery;
     gboolean     use_s3_multi_part_upload;
+    /* multi-part upload pipeline: write_block fills part_filling, full
+     * parts wait in parts_ready for an idle write thread, and the parts
+     * uploaded go back to parts_free.  At most nb_buffers_backup parts of
+     * part_size bytes are allocated. */
+    guint64      multi_part_size;
+    int          nb_buffers_backup;
+    guint64      part_size;
+    int          nb_parts;
+    S3Part      *part_filling;
+    GQueue      *parts_ready;
+    GSList      *parts_free;
+    int          next_part_number;
     GThreadPool *thread_pool_delete;
     GThreadPool *thread_pool_write;
     GThreadPool *thread_pool_read;
@@ -157,6 +181,10 @@ struct _S3Device {
     gint64	 last_byte_read;
     gint64	 next_block_to_read;
     gint64	 next_byte_to_read;
+    /* blocks read ahead but not yet returned, by block number; holds at
+     * most nb_buffers_recovery blocks */
+    GTree       *read_ahead;
+    int          nb_read_ahead;
     GSList      *objects;
     guint64	 object_size;
     gboolean	 bucket_made;
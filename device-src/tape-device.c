@@ -25,6 +25,7 @@
 #include <string.h> /* memset() */
 #include "amutil.h"
 #include "device.h"
+#include "tape-positions.h"
 
 #ifdef HAVE_SYS_TAPE_H
 # include <sys/tape.h>
@@ -84,6 +85,9 @@ struct TapeDevicePrivate_s {
     int write_count;
     char * device_filename;
     gsize read_block_size;
+
+    /* the POSITION_INDEX of the volume: where each file's header starts */
+    tape_positions_t *positions;
 };
 
 /*
@@ -121,6 +125,12 @@ gint tape_fileno(int fd);
 #define TAPE_OP_ERROR -1
 #define TAPE_POSITION_UNKNOWN -2
 
+/* returns the logical block address of the tape head, or
+ * TAPE_POSITION_UNKNOWN */
+gint64 tape_tell(int fd);
+/* position the tape at a logical block address returned by tape_tell */
+gboolean tape_locate(int fd, guint64 block);
+
 /* Possible (abstracted) results from a system I/O operation. */
 typedef enum {
     RESULT_SUCCESS,
@@ -164,6 +174,7 @@ DeviceStatusFlags tape_is_ready(int fd, TapeDevice *t_self);
 #define PROPERTY_BSF_AFTER_EOM (device_property_bsf_after_eom.ID)
 #define PROPERTY_NONBLOCKING_OPEN (device_property_nonblocking_open.ID)
 #define PROPERTY_FINAL_FILEMARKS (device_property_final_filemarks.ID)
+#define PROPERTY_POSITION_INDEX (device_property_position_index.ID)
 
 static DevicePropertyBase device_property_broken_gmt_online;
 static DevicePropertyBase device_property_fsf;
@@ -175,6 +186,7 @@ static DevicePropertyBase device_property_eom;
 static DevicePropertyBase device_property_bsf_after_eom;
 static DevicePropertyBase device_property_nonblocking_open;
 static DevicePropertyBase device_property_final_filemarks;
+static DevicePropertyBase device_property_position_index;
 static DevicePropertyBase device_property_read_buffer_size; /* old name for READ_BLOCK_SIZE */
 
 /* here are local prototypes */
@@ -191,6 +203,8 @@ static gboolean tape_device_get_read_block_size_fn(Device *p_self, DevicePropert
 				    GValue *val, PropertySurety *surety, PropertySource *source);
 static gboolean tape_device_set_read_block_size_fn(Device *p_self, DevicePropertyBase *base,
 				    GValue *val, PropertySurety surety, PropertySource source);
+static gboolean tape_device_set_position_index_fn(Device *p_self, DevicePropertyBase *base,
+				    GValue *val, PropertySurety surety, PropertySource source);
 static void tape_device_open_device (Device * self, char * device_name, char * device_type, char * device_node);
 static Device * tape_device_factory (char * device_name, char * device_type, char * device_node);
 static DeviceStatusFlags tape_device_read_label(Device * self);
@@ -318,6 +332,7 @@ tape_device_init (TapeDevice * self) {
 
     self->private->write_count = 0;
     self->private->device_filename = NULL;
+    self->private->positions = tape_positions_new();
 
     /* Static properites */
     g_value_init(&response, CONCURRENCY_PARADIGM_TYPE);
@@ -366,6 +381,7 @@ static void tape_device_finalize(GObject * obj_self) {
     robust_close(self->fd);
     self->fd = -1;
     amfree(self->private->device_filename);
+    tape_positions_free(self->private->positions);
     amfree(self->private);
 }
 
@@ -448,6 +464,11 @@ tape_device_base_init (TapeDeviceClass * c)
 	    device_simple_property_get_fn,
 	    tape_device_set_final_filemarks_fn);
 
+    device_class_register_property(device_class, PROPERTY_POSITION_INDEX,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    tape_device_set_position_index_fn);
+
     /* We don't (yet?) support reading the device's compression state, so not
      * gettable. */
     device_class_register_property(device_class, PROPERTY_COMPRESSION,
@@ -625,6 +646,17 @@ tape_device_set_read_block_size_fn(Device *p_self, DevicePropertyBase *base G_GN
 					val, surety, source);
 }
 
+static gboolean
+tape_device_set_position_index_fn(Device *p_self, DevicePropertyBase *base,
+    GValue *val, PropertySurety surety, PropertySource source)
+{
+    TapeDevice *self = TAPE_DEVICE(p_self);
+
+    tape_positions_set_dir(self->private->positions, g_value_get_string(val));
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
 void tape_device_register(void) {
     static const char * device_prefix_list[] = { "tape", NULL };
 
@@ -671,6 +703,10 @@ void tape_device_register(void) {
                                       G_TYPE_UINT, "final_filemarks",
       "How many filemarks to write after the last tape file?" );
 
+    device_property_fill_and_register(&device_property_position_index,
+                                      G_TYPE_STRING, "position_index",
+      "Directory holding per-volume block addresses of tape files" );
+
     device_property_fill_and_register(&device_property_read_buffer_size,
                                       G_TYPE_UINT, "read_buffer_size",
       "(deprecated name for READ_BLOCK_SIZE)");
@@ -1277,6 +1313,9 @@ tape_device_start (Device * d_self, DeviceAccessMode mode, char * label,
 		DEVICE_STATUS_DEVICE_ERROR);
             return FALSE;
 	}
+
+	tape_positions_start(self->private->positions, mode,
+			     d_self->volume_label, d_self->volume_time);
         break;
 
     case ACCESS_READ:
@@ -1308,6 +1347,9 @@ tape_device_start (Device * d_self, DeviceAccessMode mode, char * label,
 	/* unset the VOLUME_UNLABELED flag, if it was set */
 	device_set_error(d_self, NULL, DEVICE_STATUS_SUCCESS);
         d_self->file = 0;
+
+	tape_positions_start(self->private->positions, mode,
+			     d_self->volume_label, d_self->volume_time);
         break;
 
     default:
@@ -1323,12 +1365,17 @@ static gboolean tape_device_start_file(Device * d_self,
     IoResult result;
     char * amanda_header;
     char *msg = NULL;
+    gint64 position = TAPE_POSITION_UNKNOWN;
 
     self = TAPE_DEVICE(d_self);
 
     g_assert(self->fd >= 0);
     if (device_in_error(self)) return FALSE;
 
+    /* note where this file's header starts, so seek_file can locate it */
+    if (self->private->positions->dir)
+	position = tape_tell(self->fd);
+
     /* set the blocksize in the header properly */
     info->blocksize = d_self->block_size;
 
@@ -1362,6 +1409,8 @@ static gboolean tape_device_start_file(Device * d_self,
     d_self->block = 0;
     if (d_self->file >= 0)
         d_self->file ++;
+    if (position >= 0 && d_self->file > 0)
+	tape_positions_record(self->private->positions, d_self->file, position);
     g_mutex_lock(d_self->device_mutex);
     d_self->in_file = TRUE;
     d_self->bytes_written = 0;
@@ -1406,6 +1455,7 @@ tape_device_seek_file (Device * d_self, guint file) {
     int buffer_len;
     IoResult result;
     char *msg;
+    gint64 position;
 
     self = TAPE_DEVICE(d_self);
 
@@ -1427,6 +1477,30 @@ tape_device_seek_file (Device * d_self, guint file) {
     d_self->bytes_read = 0;
     g_mutex_unlock(d_self->device_mutex);
 
+    /* If we know where this file starts, locate straight to it rather than
+     * spacing over every filemark in between.  Should the drive refuse,
+     * start over from BOT and do it the slow way. */
+    position = tape_positions_find(self->private->positions,
+				   d_self->volume_label, d_self->volume_time,
+				   file);
+    if (position >= 0) {
+	if (tape_locate(self->fd, position)) {
+	    g_debug("tape_device_seek_file: located file %u at block %jd",
+		    file, (intmax_t)position);
+	    goto positioned;
+	}
+
+	g_debug("tape_device_seek_file: could not locate to block %jd (%s); "
+		"using FSF", (intmax_t)position, strerror(errno));
+	if (!tape_rewind(self->fd)) {
+	    device_set_error(d_self,
+		g_strdup(_("Could not rewind device after failed locate")),
+		DEVICE_STATUS_VOLUME_ERROR | DEVICE_STATUS_DEVICE_ERROR);
+	    return NULL;
+	}
+	difference = file;
+    }
+
 reseek:
     if (difference > 0) {
         /* Seeking forwards */
@@ -1479,6 +1553,7 @@ reseek:
 	}
     }
 
+positioned:
     /* double-check that we're on the right fileno, if possible.  This is most
      * likely a programming error if it occurs, but could also be due to a weird
      * tape drive or driver (and that would *never* happen, right?) */
@@ -2242,6 +2317,37 @@ gint tape_fileno(int fd) {
         return get.mt_fileno;
 }
 
+gint64 tape_tell(int fd G_GNUC_UNUSED) {
+#ifdef MTIOCPOS
+    struct mtpos pos;
+
+    if (0 != ioctl(fd, MTIOCPOS, &pos))
+        return TAPE_POSITION_UNKNOWN;
+    if (pos.mt_blkno < 0)
+        return TAPE_POSITION_UNKNOWN;
+    return pos.mt_blkno;
+#else
+    return TAPE_POSITION_UNKNOWN;
+#endif
+}
+
+gboolean tape_locate(int fd G_GNUC_UNUSED, guint64 block G_GNUC_UNUSED) {
+#ifdef MTSEEK
+    struct mtop mt;
+
+    if (block > G_MAXINT) {
+        errno = EINVAL;
+        return FALSE;
+    }
+    mt.mt_op = MTSEEK;
+    mt.mt_count = block;
+    return 0 == ioctl(fd, MTIOCTOP, &mt);
+#else
+    errno = ENOSYS;
+    return FALSE;
+#endif
+}
+
 gint tape_eod(int fd) {
     struct mtop mt;
     struct mtget get;
@@ -0,0 +1,374 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+#include "amanda.h"
+#include "tape-positions.h"
+
+/* Utilities */
+
+static char *index_dir;
+
+static char *
+index_file(
+    const char *label)
+{
+    return g_strdup_printf("%s/%s", index_dir, label);
+}
+
+static void
+write_index(
+    const char *label,
+    const char *contents)
+{
+    char *filename = index_file(label);
+    FILE *fp = fopen(filename, "w");
+
+    g_assert(fp != NULL);
+    fputs(contents, fp);
+    fclose(fp);
+    g_free(filename);
+}
+
+/* the first line of the index of LABEL, or NULL; caller frees */
+static char *
+index_header(
+    const char *label)
+{
+    char *filename = index_file(label);
+    FILE *fp = fopen(filename, "r");
+    char *line = NULL;
+
+    if (fp) {
+	line = agets(fp);
+	fclose(fp);
+    }
+    g_free(filename);
+    return line;
+}
+
+static void
+remove_index(
+    const char *label)
+{
+    char *filename = index_file(label);
+
+    unlink(filename);
+    g_free(filename);
+}
+
+/* a fresh index, as a new process would have */
+static tape_positions_t *
+new_positions(void)
+{
+    tape_positions_t *tp = tape_positions_new();
+
+    tape_positions_set_dir(tp, index_dir);
+    return tp;
+}
+
+static gboolean
+check_find(
+    tape_positions_t *tp,
+    const char *label,
+    const char *time,
+    guint file,
+    gint64 expected)
+{
+    gint64 got = tape_positions_find(tp, label, time, file);
+
+    if (got != expected) {
+	g_fprintf(stderr, " %s %s file %u: got %jd, expected %jd\n",
+		  label, time, file, (intmax_t)got, (intmax_t)expected);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Tests
+ */
+
+/* positions recorded while writing are found again by another process */
+static int
+test_write_reload(void)
+{
+    tape_positions_t *tp = new_positions();
+    gboolean ok = TRUE;
+
+    /* appending to a volume without an index creates it */
+    tape_positions_start(tp, ACCESS_APPEND, "VOL-1", "20160101000000");
+    if (!tp->on_disk) {
+	g_fprintf(stderr, " no index created for VOL-1\n");
+	ok = FALSE;
+    }
+    tape_positions_record(tp, 1, 100);
+    tape_positions_record(tp, 2, 250);
+    tape_positions_record(tp, 4, 900);
+    /* a file rewritten after a failed write: the last line wins */
+    tape_positions_record(tp, 2, 260);
+    ok = check_find(tp, "VOL-1", "20160101000000", 2, 260) && ok;
+    tape_positions_free(tp);
+
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, 100) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 2, 260) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 3, -1) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 4, 900) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 5, -1) && ok;
+    /* the label is never looked up */
+    ok = check_find(tp, "VOL-1", "20160101000000", 0, -1) && ok;
+    tape_positions_free(tp);
+
+    /* a NULL volume_time is stored as "X" */
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_WRITE, "VOL-2", NULL);
+    tape_positions_record(tp, 1, 42);
+    tape_positions_free(tp);
+    tp = new_positions();
+    ok = check_find(tp, "VOL-2", NULL, 1, 42) && ok;
+    ok = check_find(tp, "VOL-2", "X", 1, 42) && ok;
+    tape_positions_free(tp);
+
+    /* a '/' in the label does not escape the directory */
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_WRITE, "A/B", "20160101000000");
+    tape_positions_record(tp, 1, 7);
+    tape_positions_free(tp);
+    tp = new_positions();
+    ok = check_find(tp, "A/B", "20160101000000", 1, 7) && ok;
+    tape_positions_free(tp);
+    remove_index("A_B");
+
+    remove_index("VOL-1");
+    remove_index("VOL-2");
+    return ok;
+}
+
+/* what tape_device_start does to the index */
+static int
+test_start(void)
+{
+    tape_positions_t *tp = new_positions();
+    char *header;
+    gboolean ok = TRUE;
+
+    tape_positions_start(tp, ACCESS_WRITE, "VOL-1", "20160101000000");
+    tape_positions_record(tp, 1, 100);
+    tape_positions_record(tp, 2, 200);
+    tape_positions_free(tp);
+
+    /* appending to the same volume keeps its index, and adds to it */
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_APPEND, "VOL-1", "20160101000000");
+    ok = check_find(tp, "VOL-1", "20160101000000", 2, 200) && ok;
+    tape_positions_record(tp, 3, 300);
+    tape_positions_free(tp);
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, 100) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 3, 300) && ok;
+    tape_positions_free(tp);
+
+    /* reading leaves it alone */
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_READ, "VOL-1", "20160101000000");
+    ok = check_find(tp, "VOL-1", "20160101000000", 3, 300) && ok;
+    tape_positions_free(tp);
+
+    /* labeling the volume again starts over, even with the same timestamp */
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_WRITE, "VOL-1", "20160101000000");
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    tape_positions_free(tp);
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 3, -1) && ok;
+    tape_positions_free(tp);
+
+    /* and in the same process, whatever was loaded is forgotten */
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_APPEND, "VOL-1", "20160101000000");
+    tape_positions_record(tp, 1, 111);
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, 111) && ok;
+    tape_positions_start(tp, ACCESS_WRITE, "VOL-1", "20160202000000");
+    ok = check_find(tp, "VOL-1", "20160202000000", 1, -1) && ok;
+    tape_positions_free(tp);
+
+    header = index_header("VOL-1");
+    if (!header || !g_str_equal(header, "VOL-1 20160202000000")) {
+	g_fprintf(stderr, " bad header after relabel: '%s'\n",
+		  header? header : "(none)");
+	ok = FALSE;
+    }
+    g_free(header);
+
+    remove_index("VOL-1");
+    return ok;
+}
+
+/* a damaged index loses what it can not parse, but nothing else */
+static int
+test_corrupt(void)
+{
+    tape_positions_t *tp;
+    char *header;
+    gboolean ok = TRUE;
+
+    write_index("VOL-1",
+		"VOL-1 20160101000000\n"
+		"1 100\n"
+		"garbage\n"
+		"2\n"
+		"3 -300\n"
+		"x 400\n"
+		"\n"
+		"5 500\n"
+		"6 6");		/* truncated by a crash */
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, 100) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 2, -1) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 3, -1) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 4, -1) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 5, 500) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 6, 6) && ok;
+    tape_positions_free(tp);
+
+    /* without a valid header, nothing is trusted ... */
+    write_index("VOL-1", "\001\002\003 garbage\n1 100\n");
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    tape_positions_free(tp);
+    write_index("VOL-1", "");
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    tape_positions_free(tp);
+
+    /* ... and appending replaces it with a good one */
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_APPEND, "VOL-1", "20160101000000");
+    tape_positions_record(tp, 2, 200);
+    tape_positions_free(tp);
+    header = index_header("VOL-1");
+    if (!header || !g_str_equal(header, "VOL-1 20160101000000")) {
+	g_fprintf(stderr, " bad header after append: '%s'\n",
+		  header? header : "(none)");
+	ok = FALSE;
+    }
+    g_free(header);
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    ok = check_find(tp, "VOL-1", "20160101000000", 2, 200) && ok;
+    tape_positions_free(tp);
+
+    /* an index that can not be written records nothing */
+    tp = tape_positions_new();
+    tape_positions_set_dir(tp, "/nonexistent/tape-positions-test");
+    tape_positions_start(tp, ACCESS_WRITE, "VOL-1", "20160101000000");
+    tape_positions_record(tp, 1, 100);
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    tape_positions_free(tp);
+
+    remove_index("VOL-1");
+    return ok;
+}
+
+/* An index for another volume must not be used: seek_file then falls back
+ * to spacing over the filemarks. */
+static int
+test_stale(void)
+{
+    tape_positions_t *tp;
+    gboolean ok = TRUE;
+
+    tp = new_positions();
+    tape_positions_start(tp, ACCESS_WRITE, "VOL-1", "20160101000000");
+    tape_positions_record(tp, 1, 100);
+    tape_positions_free(tp);
+
+    /* the tape was relabeled by another program */
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160303000000", 1, -1) && ok;
+    /* a volume loaded later in the same process */
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, 100) && ok;
+    ok = check_find(tp, "VOL-2", "20160101000000", 1, -1) && ok;
+    tape_positions_free(tp);
+
+    /* an index for another label, copied over this one */
+    write_index("VOL-2", "VOL-1 20160101000000\n1 100\n");
+    tp = new_positions();
+    ok = check_find(tp, "VOL-2", "20160101000000", 1, -1) && ok;
+    tape_positions_free(tp);
+
+    /* changing POSITION_INDEX forgets what was loaded */
+    tp = new_positions();
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, 100) && ok;
+    tape_positions_set_dir(tp, "/nonexistent/tape-positions-test");
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    tape_positions_set_dir(tp, NULL);
+    ok = check_find(tp, "VOL-1", "20160101000000", 1, -1) && ok;
+    tape_positions_free(tp);
+
+    remove_index("VOL-1");
+    remove_index("VOL-2");
+    return ok;
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(
+    int    argc G_GNUC_UNUSED,
+    char **argv G_GNUC_UNUSED)
+{
+    int nb_error = 0;
+
+    index_dir = g_strdup_printf("tape-positions-test.%d", (int)getpid());
+    if (mkdir(index_dir, 0700) != 0) {
+	g_fprintf(stderr, " cannot create %s: %s\n", index_dir, strerror(errno));
+	return 1;
+    }
+
+    if (!test_write_reload())
+	nb_error++;
+    if (!test_start())
+	nb_error++;
+    if (!test_corrupt())
+	nb_error++;
+    if (!test_stale())
+	nb_error++;
+
+    rmdir(index_dir);
+    g_free(index_dir);
+
+    if (nb_error) {
+	g_fprintf(stderr, " FAIL tape position index\n");
+    } else {
+	g_fprintf(stderr, " PASS tape position index\n");
+    }
+    return nb_error;
+}
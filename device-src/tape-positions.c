@@ -0,0 +1,258 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * Block-address index of the files of a tape volume; see tape-positions.h
+ */
+
+#include "amanda.h"
+#include "tape-positions.h"
+
+tape_positions_t *
+tape_positions_new(void)
+{
+    tape_positions_t *tp = g_new0(tape_positions_t, 1);
+
+    tp->positions = g_array_new(FALSE, FALSE, sizeof(gint64));
+    return tp;
+}
+
+void
+tape_positions_free(
+    tape_positions_t *tp)
+{
+    if (!tp)
+	return;
+    amfree(tp->dir);
+    g_array_free(tp->positions, TRUE);
+    amfree(tp->label);
+    amfree(tp->time);
+    g_free(tp);
+}
+
+void
+tape_positions_set_dir(
+    tape_positions_t *tp,
+    const char *dir)
+{
+    amfree(tp->dir);
+    if (dir && *dir)
+	tp->dir = g_strdup(dir);
+
+    /* whatever was loaded came from the old directory */
+    g_array_set_size(tp->positions, 0);
+    amfree(tp->label);
+    amfree(tp->time);
+    tp->on_disk = FALSE;
+}
+
+/* Name of the index of LABEL; caller frees */
+static char *
+tape_positions_filename(
+    tape_positions_t *tp,
+    const char *label)
+{
+    char *base = g_strdup(label);
+    char *rval;
+
+    g_strdelimit(base, "/", '_');
+    rval = g_strdup_printf("%s/%s", tp->dir, base);
+    g_free(base);
+    return rval;
+}
+
+void
+tape_positions_reset(
+    tape_positions_t *tp,
+    const char *label,
+    const char *time,
+    gboolean truncate)
+{
+    char *filename;
+    FILE *fp;
+
+    g_array_set_size(tp->positions, 0);
+    amfree(tp->label);
+    amfree(tp->time);
+    tp->on_disk = FALSE;
+
+    if (!tp->dir || !label)
+	return;
+
+    tp->label = g_strdup(label);
+    tp->time = g_strdup(time? time : "X");
+    if (!truncate)
+	return;
+
+    filename = tape_positions_filename(tp, tp->label);
+    fp = fopen(filename, "w");
+    if (!fp) {
+	g_debug("tape_device: cannot create position index '%s': %s",
+		filename, strerror(errno));
+    } else {
+	g_fprintf(fp, "%s %s\n", tp->label, tp->time);
+	if (fclose(fp) != 0)
+	    g_debug("tape_device: error writing position index '%s': %s",
+		    filename, strerror(errno));
+	else
+	    tp->on_disk = TRUE;
+    }
+    g_free(filename);
+}
+
+gboolean
+tape_positions_load(
+    tape_positions_t *tp,
+    const char *label,
+    const char *time)
+{
+    char *filename;
+    FILE *fp;
+    char *line;
+    char *expected;
+    gboolean matched = FALSE;
+
+    if (!tp->dir || !label)
+	return FALSE;
+
+    if (tp->label &&
+	g_str_equal(tp->label, label) &&
+	g_str_equal(tp->time, time? time : "X"))
+	return tp->on_disk;
+
+    tape_positions_reset(tp, label, time, FALSE);
+
+    filename = tape_positions_filename(tp, tp->label);
+    fp = fopen(filename, "r");
+    if (!fp) {
+	if (errno != ENOENT)
+	    g_debug("tape_device: cannot open position index '%s': %s",
+		    filename, strerror(errno));
+	g_free(filename);
+	return FALSE;
+    }
+
+    /* the header names the volume; a relabeled tape gets a new datestamp */
+    expected = g_strdup_printf("%s %s", tp->label, tp->time);
+    line = agets(fp);
+    if (line && g_str_equal(line, expected)) {
+	matched = TRUE;
+	amfree(line);
+	while ((line = agets(fp)) != NULL) {
+	    guint file;
+	    intmax_t block;
+
+	    if (sscanf(line, "%u %jd", &file, &block) == 2 && block >= 0) {
+		gint64 unknown = -1;
+
+		while (tp->positions->len <= file)
+		    g_array_append_val(tp->positions, unknown);
+		g_array_index(tp->positions, gint64, file) = block;
+	    }
+	    amfree(line);
+	}
+    } else {
+	g_debug("tape_device: position index '%s' is for another volume; ignoring it",
+		filename);
+    }
+    amfree(line);
+    g_free(expected);
+    fclose(fp);
+    g_free(filename);
+
+    tp->on_disk = matched;
+    return matched;
+}
+
+void
+tape_positions_record(
+    tape_positions_t *tp,
+    guint file,
+    gint64 block)
+{
+    gint64 unknown = -1;
+    char *filename;
+    FILE *fp;
+
+    if (!tp->on_disk)
+	return;
+
+    while (tp->positions->len <= file)
+	g_array_append_val(tp->positions, unknown);
+    g_array_index(tp->positions, gint64, file) = block;
+
+    filename = tape_positions_filename(tp, tp->label);
+    fp = fopen(filename, "a");
+    if (!fp) {
+	g_debug("tape_device: cannot append to position index '%s': %s",
+		filename, strerror(errno));
+    } else {
+	g_fprintf(fp, "%u %jd\n", file, (intmax_t)block);
+	if (fclose(fp) != 0)
+	    g_debug("tape_device: error writing position index '%s': %s",
+		    filename, strerror(errno));
+    }
+    g_free(filename);
+}
+
+gint64
+tape_positions_find(
+    tape_positions_t *tp,
+    const char *label,
+    const char *time,
+    guint file)
+{
+    if (file == 0 || !tape_positions_load(tp, label, time))
+	return -1;
+    if (file >= tp->positions->len)
+	return -1;
+    return g_array_index(tp->positions, gint64, file);
+}
+
+void
+tape_positions_start(
+    tape_positions_t *tp,
+    DeviceAccessMode mode,
+    const char *label,
+    const char *time)
+{
+    switch (mode) {
+    case ACCESS_APPEND:
+	/* keep the existing index if it describes this volume */
+	if (!tape_positions_load(tp, label, time))
+	    tape_positions_reset(tp, label, time, TRUE);
+	break;
+
+    case ACCESS_WRITE:
+	/* everything after the label is gone, so start a fresh index */
+	tape_positions_reset(tp, label, time, TRUE);
+	break;
+
+    default:
+	break;
+    }
+}
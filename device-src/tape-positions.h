@@ -0,0 +1,86 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+
+/*
+ * Block-address index of the files of a tape volume, for the tape device's
+ * POSITION_INDEX property
+ *
+ * There is one text file per volume label in the index directory.  Its first
+ * line is "LABEL TIMESTAMP", the volume it describes; a relabeled tape gets a
+ * new timestamp, so the index of the old volume is then ignored.  Each other
+ * line is "FILE BLOCK": file FILE starts at logical block BLOCK.  Lines are
+ * only appended, and a later line for a file overrides an earlier one.
+ */
+
+#ifndef TAPE_POSITIONS_H
+#define TAPE_POSITIONS_H
+
+#include "amanda.h"
+#include "device.h"
+
+typedef struct tape_positions_s {
+    char *dir;			/* the index directory, or NULL if disabled */
+    GArray *positions;		/* gint64; positions[n] is the block of file n,
+				 * or -1 if unknown */
+    char *label;		/* the volume they belong to */
+    char *time;
+    gboolean on_disk;		/* the index file has a header for it */
+} tape_positions_t;
+
+tape_positions_t *tape_positions_new(void);
+void tape_positions_free(tape_positions_t *tp);
+
+/* Use the index in DIR, or none if DIR is NULL or empty; forgets whatever was
+ * loaded from the old one. */
+void tape_positions_set_dir(tape_positions_t *tp, const char *dir);
+
+/* Forget any loaded positions and associate the index with the volume
+ * LABEL/TIME.  If TRUNCATE, the index file is rewritten with just its
+ * header line. */
+void tape_positions_reset(tape_positions_t *tp, const char *label,
+			  const char *time, gboolean truncate);
+
+/* Load the index of the volume LABEL/TIME, unless it is already loaded.
+ * Returns TRUE if the index exists and matches this volume. */
+gboolean tape_positions_load(tape_positions_t *tp, const char *label,
+			     const char *time);
+
+/* Remember that FILE starts at BLOCK, in memory and on disk; does nothing
+ * unless the index of the current volume is on disk. */
+void tape_positions_record(tape_positions_t *tp, guint file, gint64 block);
+
+/* Block address of FILE on the volume LABEL/TIME, or -1 if not known */
+gint64 tape_positions_find(tape_positions_t *tp, const char *label,
+			   const char *time, guint file);
+
+/* What starting the device in MODE does to the index of the volume
+ * LABEL/TIME: appending keeps an index that describes it, writing a new
+ * label starts over. */
+void tape_positions_start(tape_positions_t *tp, DeviceAccessMode mode,
+			  const char *label, const char *time);
+
+#endif /* TAPE_POSITIONS_H */
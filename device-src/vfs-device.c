@@ -24,6 +24,7 @@
 #include <string.h> /* memset() */
 #include "fsusage.h"
 #include "amutil.h"
+#include "stat-time.h"
 #include <regex.h>
 
 #include "vfs-device.h"
@@ -49,6 +50,12 @@
 #define MONITOR_FREE_SPACE_EVERY_KB 102400
 #define MONITOR_FREE_SPACE_CLOSELY_WITHIN_BLOCKS 128
 
+/* With SYNC PROGRESSIVE, start writing out the file every this many bytes */
+#define VFS_DEVICE_SYNC_CHUNK (8*1024*1024)
+
+/* Size of the read-ahead window requested while reading a file */
+#define VFS_DEVICE_READAHEAD (8*1024*1024)
+
 void vfs_device_register(void);
 
 /* here are local prototypes */
@@ -84,8 +91,13 @@ static gboolean vfs_validate(Device *dself);
 
 static gboolean check_is_dir(VfsDevice * self, const char * name);
 static char * file_number_to_file_name(VfsDevice * self, guint file);
-static gboolean file_number_to_file_name_functor(const char * filename,
-                                                 gpointer datap);
+static gboolean vfs_index_refresh(VfsDevice * self);
+static void vfs_index_drop(VfsDevice * self);
+static void vfs_index_add(VfsDevice * self, guint file, const char *path);
+static void vfs_index_set_size(VfsDevice * self, guint file, guint64 size);
+static void vfs_index_remove(VfsDevice * self, guint file);
+static gboolean vfs_index_build_functor(const char * filename,
+                                        gpointer datap);
 static gboolean vfs_device_set_max_volume_usage_fn(Device *dself,
 			    DevicePropertyBase *base, GValue *val,
 			    PropertySurety surety, PropertySource source);
@@ -107,6 +119,12 @@ static gboolean property_set_slow_write_fn(Device *dself,
 static gboolean property_get_use_data_fn(Device *dself,
 			    DevicePropertyBase *base, GValue *val,
 			    PropertySurety *surety, PropertySource *source);
+static gboolean property_get_sync_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety *surety, PropertySource *source);
+static gboolean property_set_sync_fn(Device *dself,
+			    DevicePropertyBase *base, GValue *val,
+			    PropertySurety surety, PropertySource source);
 static gboolean property_set_use_data_fn(Device *dself,
 			    DevicePropertyBase *base, GValue *val,
 			    PropertySurety surety, PropertySource source);
@@ -124,8 +142,6 @@ static gboolean check_dir_empty_functor(const char * filename,
 static int search_vfs_directory(VfsDevice *self, const char * regex,
 			SearchDirectoryFunctor functor, gpointer user_data);
 static gint get_last_file_number(VfsDevice * self);
-static gboolean get_last_file_number_functor(const char * filename,
-                                             gpointer datap);
 static char * make_new_file_name(VfsDevice * self, const dumpfile_t * ji);
 static gboolean try_unlink(const char * file);
 
@@ -137,6 +153,14 @@ static gboolean check_at_leom(VfsDevice *self, guint64 size);
 /* Similar, but for PEOM */
 static gboolean check_at_peom(VfsDevice *self, guint64 size);
 
+/* With SYNC PROGRESSIVE, start write-out of the data written since the last
+ * call and wait for the previous chunk, so dirty pages do not pile up */
+static void vfs_sync_progress(VfsDevice *self);
+
+/* Ask the kernel to read ahead the part of the current file that the next
+ * read_block calls will need */
+static void vfs_readahead(VfsDevice *self);
+
 /* pointer to the classes of our parents */
 static DeviceClass *parent_class = NULL;
 
@@ -150,6 +174,9 @@ DevicePropertyBase device_property_slow_write;
 DevicePropertyBase device_property_use_data;
 #define PROPERTY_USE_DATA (device_property_use_data.ID)
 
+DevicePropertyBase device_property_sync;
+#define PROPERTY_SYNC (device_property_sync.ID)
+
 void vfs_device_register(void) {
     static const char * device_prefix_list[] = { "file", NULL };
 
@@ -162,6 +189,9 @@ void vfs_device_register(void) {
     device_property_fill_and_register(&device_property_use_data,
                                       G_TYPE_STRING, "use_data",
       "Should VFS device use the data subdir?");
+    device_property_fill_and_register(&device_property_sync,
+                                      G_TYPE_STRING, "sync",
+      "When should VFS device flush the files it writes to disk?");
 
     register_device(vfs_device_factory, device_prefix_list);
 }
@@ -210,6 +240,10 @@ vfs_device_init (
     self->slow_write = FALSE;
     self->slow_count = 0;
     self->use_data = 2;
+    self->sync = VFS_SYNC_NONE;
+    self->sync_started = 0;
+    self->sync_waited = 0;
+    self->readahead_offset = 0;
     self->checked_fs_free_bytes = G_MAXUINT64;
     self->checked_fs_free_time = 0;
     self->checked_fs_free_bytes = G_MAXUINT64;
@@ -218,6 +252,10 @@ vfs_device_init (
     self->update_volume_size = &vfs_update_volume_size;
     self->device_start_file_open = &vfs_device_start_file_open;
     self->validate = &vfs_validate;
+    self->file_index = NULL;
+    self->index_dir = NULL;
+    self->index_racy = FALSE;
+    self->last_file = -1;
 
     /* Register Properties */
     bzero(&response, sizeof(response));
@@ -323,6 +361,11 @@ vfs_device_base_init(
 	    property_get_use_data_fn,
 	    property_set_use_data_fn);
 
+    device_class_register_property(device_class, PROPERTY_SYNC,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK,
+	    property_get_sync_fn,
+	    property_set_sync_fn);
+
     device_class_register_property(device_class, PROPERTY_MAX_VOLUME_USAGE,
 	    (PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_MASK) &
 			(~ PROPERTY_ACCESS_SET_INSIDE_FILE_WRITE),
@@ -506,6 +549,61 @@ property_set_use_data_fn(
     return device_simple_property_set_fn(dself, base, val, surety, source);
 }
 
+static gboolean
+property_get_sync_fn(
+    Device *dself,
+    DevicePropertyBase *base G_GNUC_UNUSED,
+    GValue *val,
+    PropertySurety *surety,
+    PropertySource *source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    g_value_unset_init(val, G_TYPE_STRING);
+    switch (self->sync) {
+	case VFS_SYNC_NONE: g_value_set_string(val, "NONE"); break;
+	case VFS_SYNC_FILE: g_value_set_string(val, "FILE"); break;
+	case VFS_SYNC_PROGRESSIVE: g_value_set_string(val, "PROGRESSIVE"); break;
+    }
+    if (surety)
+	*surety = PROPERTY_SURETY_GOOD;
+
+    if (source)
+	*source = PROPERTY_SOURCE_DEFAULT;
+
+    return TRUE;
+}
+
+
+static gboolean
+property_set_sync_fn(
+    Device *dself,
+    DevicePropertyBase *base,
+    GValue *val,
+    PropertySurety surety,
+    PropertySource source)
+{
+    VfsDevice *self = VFS_DEVICE(dself);
+
+    const char *value = g_value_get_string(val);
+
+    if (g_strcasecmp(value, "NONE") == 0 ||
+	g_strcasecmp(value, "NO") == 0) {
+	self->sync = VFS_SYNC_NONE;
+    } else if (g_strcasecmp(value, "FILE") == 0) {
+	self->sync = VFS_SYNC_FILE;
+    } else if (g_strcasecmp(value, "PROGRESSIVE") == 0) {
+	self->sync = VFS_SYNC_PROGRESSIVE;
+    } else {
+	device_set_error(dself,
+	    g_strdup_printf(_("Illegal SYNC value (%s), must be NONE, FILE or PROGRESSIVE"), value),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
 static gboolean
 property_set_leom_fn(
     Device *dself,
@@ -551,6 +649,7 @@ static void vfs_device_finalize(
         (* G_OBJECT_CLASS(parent_class)->finalize)(obj_self);
 
     amfree(self->dir_name);
+    vfs_index_drop(self);
 
     self->release_file(dself);
 }
@@ -594,74 +693,236 @@ static gboolean check_is_dir(
     }
 }
 
+/* One volume file, as found in the directory */
 typedef struct {
-    VfsDevice * self;
-    int count;
-    char * result;
-} fnfn_data;
+    char *name;
+    guint64 size;
+} VfsFileEntry;
+
+static void
+free_vfs_file_entry(
+    gpointer data)
+{
+    VfsFileEntry *entry = data;
+
+    g_free(entry->name);
+    g_free(entry);
+}
+
+static gint
+compare_file_number(
+    gconstpointer a,
+    gconstpointer b,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    guint fa = GPOINTER_TO_UINT(a);
+    guint fb = GPOINTER_TO_UINT(b);
+
+    if (fa < fb)
+	return -1;
+    return fa > fb;
+}
 
 /* A SearchDirectoryFunctor. */
 static gboolean
-file_number_to_file_name_functor(const char *filename,
-                                 gpointer datap) {
-    char *result_tmp;
+vfs_index_build_functor(
+    const char *filename,
+    gpointer datap)
+{
+    VfsDevice *self = VFS_DEVICE(datap);
+    char *path;
     struct stat file_status;
-    fnfn_data *data = (fnfn_data*)datap;
+    guint64 file;
+    VfsFileEntry *entry;
 
-    result_tmp = g_strjoin(NULL, data->self->dir_name, "/", filename, NULL);
+    file = g_ascii_strtoull(filename, NULL, 10); /* Guaranteed to work. */
+    if (file > G_MAXINT) {
+	g_warning(_("Super-large device file %s found, ignoring"), filename);
+        return TRUE;
+    }
+
+    path = g_strjoin(NULL, self->dir_name, "/", filename, NULL);
 
     /* Just to be thorough, let's check that it's a real
        file. */
-    if (0 != stat(result_tmp, &file_status)) {
-	g_warning(_("Cannot stat file %s (%s), ignoring it"), result_tmp, strerror(errno));
+    if (0 != stat(path, &file_status)) {
+	g_warning(_("Cannot stat file %s (%s), ignoring it"), path, strerror(errno));
     } else if (!S_ISREG(file_status.st_mode)) {
-	g_warning(_("%s is not a regular file, ignoring it"), result_tmp);
+	g_warning(_("%s is not a regular file, ignoring it"), path);
+    } else if ((entry = g_tree_lookup(self->file_index,
+				      GUINT_TO_POINTER((guint)file)))) {
+	g_warning("Found multiple names for file number %d, choosing file %s/%s",
+		  (int)file, self->dir_name, entry->name);
     } else {
-        data->count ++;
-        if (data->result == NULL) {
-            data->result = result_tmp;
-            result_tmp = NULL;
-        }
+	entry = g_new0(VfsFileEntry, 1);
+	entry->name = g_strdup(filename);
+	entry->size = file_status.st_size;
+	g_tree_insert(self->file_index, GUINT_TO_POINTER((guint)file), entry);
+	if ((gint)file > self->last_file)
+	    self->last_file = file;
     }
-    amfree(result_tmp);
+    amfree(path);
     return TRUE;
 }
 
-/* This function finds the filename for a given file number. We search
- * for a filesystem file matching the regex /^0*$device_file\./; if
- * there is more than one such file we make a warning and take an
- * arbitrary one. */
+/* Make sure self->file_index describes the directory, scanning it again only
+ * if it changed since the index was built; any change we make ourselves is
+ * applied to the index as well.  Returns FALSE, with the device error set,
+ * if the directory can't be read. */
+static gboolean
+vfs_index_refresh(
+    VfsDevice *self)
+{
+    struct stat dir_status;
+    struct timespec mtime;
+
+    if (stat(self->dir_name, &dir_status) < 0) {
+	device_set_error(DEVICE(self),
+		g_strdup_printf(_("Couldn't stat directory %s: %s"),
+			self->dir_name, strerror(errno)),
+		DEVICE_STATUS_DEVICE_ERROR);
+	vfs_index_drop(self);
+	return FALSE;
+    }
+    mtime = get_stat_mtime(&dir_status);
+
+    if (self->file_index && !self->index_racy &&
+	g_str_equal(self->index_dir, self->dir_name) &&
+	mtime.tv_sec == self->index_mtime.tv_sec &&
+	mtime.tv_nsec == self->index_mtime.tv_nsec) {
+	return TRUE;
+    }
+
+    vfs_index_drop(self);
+    self->file_index = g_tree_new_full(compare_file_number, NULL, NULL,
+				       free_vfs_file_entry);
+    self->index_dir = g_strdup(self->dir_name);
+    self->index_mtime = mtime;
+    /* a file created later in the same second as the last change might not
+     * change the mtime, so such an index is rebuilt on the next lookup */
+    self->index_racy = (mtime.tv_sec >= time(NULL));
+    self->last_file = -1;
+    if (search_vfs_directory(self, "^[0-9]+\\.",
+			     vfs_index_build_functor, self) < 0) {
+	vfs_index_drop(self);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+vfs_index_drop(
+    VfsDevice *self)
+{
+    if (self->file_index) {
+	g_tree_destroy(self->file_index);
+	self->file_index = NULL;
+    }
+    amfree(self->index_dir);
+    self->last_file = -1;
+}
+
+/* Record the directory mtime after a change we made and applied to the
+ * index, so the next refresh does not scan the directory again. */
+static void
+vfs_index_touch(
+    VfsDevice *self)
+{
+    struct stat dir_status;
+
+    if (stat(self->dir_name, &dir_status) < 0) {
+	vfs_index_drop(self);
+	return;
+    }
+    self->index_mtime = get_stat_mtime(&dir_status);
+}
+
+static void
+vfs_index_add(
+    VfsDevice *self,
+    guint file,
+    const char *path)
+{
+    VfsFileEntry *entry;
+    const char *base;
+
+    if (!self->file_index)
+	return;
+
+    base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+    entry = g_new0(VfsFileEntry, 1);
+    entry->name = g_strdup(base);
+    entry->size = 0;
+    g_tree_replace(self->file_index, GUINT_TO_POINTER(file), entry);
+    if ((gint)file > self->last_file)
+	self->last_file = file;
+    vfs_index_touch(self);
+}
+
+/* A GTraverseFunc */
+static gboolean
+find_last_file_traverse(
+    gpointer key,
+    gpointer value G_GNUC_UNUSED,
+    gpointer data)
+{
+    *(gint *)data = GPOINTER_TO_UINT(key);
+    return FALSE;
+}
+
+static void
+vfs_index_remove(
+    VfsDevice *self,
+    guint file)
+{
+    if (!self->file_index)
+	return;
+
+    g_tree_remove(self->file_index, GUINT_TO_POINTER(file));
+    if ((gint)file == self->last_file) {
+	self->last_file = -1;
+	g_tree_foreach(self->file_index, find_last_file_traverse,
+		       &self->last_file);
+    }
+    vfs_index_touch(self);
+}
+
+static void
+vfs_index_set_size(
+    VfsDevice *self,
+    guint file,
+    guint64 size)
+{
+    VfsFileEntry *entry;
+
+    if (!self->file_index)
+	return;
+
+    entry = g_tree_lookup(self->file_index, GUINT_TO_POINTER(file));
+    if (entry)
+	entry->size = size;
+}
+
+/* This function finds the filename for a given file number, a file in the
+ * directory matching the regex /^0*$device_file\./; if there is more than
+ * one such file, the index keeps the first one found. */
 static char *
 file_number_to_file_name(
     VfsDevice *self,
     guint device_file)
 {
-    char *regex;
-    fnfn_data data;
-
-    data.self = self;
-    data.count = 0;
-    data.result = NULL;
-
-    regex = g_strdup_printf("^0*%u\\.", device_file);
+    VfsFileEntry *entry;
 
-    search_vfs_directory(self, regex,
-                         file_number_to_file_name_functor, &data);
+    if (!vfs_index_refresh(self))
+	return NULL;
 
-    amfree(regex);
+    entry = g_tree_lookup(self->file_index, GUINT_TO_POINTER(device_file));
+    if (entry == NULL)
+	return NULL;
 
-    if (data.count == 0) {
-        g_assert(data.result == NULL);
-        return NULL;
-    } else if (data.count > 1) {
-	g_warning("Found multiple names for file number %d, choosing file %s",
-                device_file, data.result);
-        return data.result;
-    } else {
-        g_assert(data.result != NULL);
-        return data.result;
-    }
-    g_assert_not_reached();
+    return g_strjoin(NULL, self->dir_name, "/", entry->name, NULL);
 }
 
 /* This function returns the dynamically-allocated lockfile name for a
@@ -694,28 +955,17 @@ static void promote_volume_lock(VfsDevice * self G_GNUC_UNUSED) {
 static void demote_volume_lock(VfsDevice * self G_GNUC_UNUSED) {
 }
 
-/* A SearchDirectoryFunctor */
+/* A GTraverseFunc */
 static gboolean
-update_volume_size_functor(const char *filename,
-                           gpointer user_data)
+update_volume_size_traverse(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer data)
 {
-    char *full_filename;
-    struct stat stat_buf;
-    VfsDevice *self = VFS_DEVICE(user_data);
+    VfsFileEntry *entry = value;
 
-    full_filename = g_strjoin(NULL, self->dir_name, "/", filename, NULL);
-
-    if (stat(full_filename, &stat_buf) < 0) {
-        /* Log it and keep going. */
-	g_warning(_("Couldn't stat file %s: %s"), full_filename, strerror(errno));
-        amfree(full_filename);
-        return TRUE;
-    }
-
-    amfree(full_filename);
-    self->volume_bytes += stat_buf.st_size;
-
-    return TRUE;
+    *(guint64 *)data += entry->size;
+    return FALSE;
 }
 
 static void
@@ -724,9 +974,10 @@ vfs_update_volume_size(
 {
     VfsDevice *self = VFS_DEVICE(dself);
     self->volume_bytes = 0;
-    search_vfs_directory(self, "^[0-9]+\\.",
-                         update_volume_size_functor, self);
-
+    if (vfs_index_refresh(self)) {
+	g_tree_foreach(self->file_index, update_volume_size_traverse,
+		       &self->volume_bytes);
+    }
 }
 
 static void
@@ -801,6 +1052,7 @@ delete_vfs_files(
     /* This function assumes that the volume is locked! */
     search_vfs_directory(self, VFS_DEVICE_FILE_REGEX,
                          delete_vfs_files_functor, self);
+    vfs_index_drop(self);
 }
 
 /* This is a functor suitable for search_directory. It simply prints a
@@ -1067,6 +1319,9 @@ vfs_device_write_block(
     dself->bytes_written += size;
     g_mutex_unlock(dself->device_mutex);
 
+    if (self->sync == VFS_SYNC_PROGRESSIVE)
+	vfs_sync_progress(self);
+
     return WRITE_SUCCEED;
 }
 
@@ -1092,6 +1347,8 @@ vfs_device_read_block(
         return 0;
     }
 
+    vfs_readahead(self);
+
     size = dself->block_size;
     result = vfs_device_robust_read(self, data, &size);
     switch (result) {
@@ -1189,84 +1446,47 @@ vfs_device_finish(
     return TRUE;
 }
 
-typedef struct {
-    VfsDevice *self;
-    int rval;
-} glfn_data;
-
-/* A SearchDirectoryFunctor. */
-static gboolean
-get_last_file_number_functor(
-    const char *filename,
-    gpointer datap)
-{
-    guint64 file;
-    glfn_data *data = (glfn_data *)datap;
-
-    file = g_ascii_strtoull(filename, NULL, 10); /* Guaranteed to work. */
-    if (file > G_MAXINT) {
-	g_warning(_("Super-large device file %s found, ignoring"), filename);
-        return TRUE;
-    }
-    /* This condition is needlessly complex due to sign issues. */
-    if (data->rval < 0 || ((guint)data->rval) < file) {
-        data->rval = file;
-    }
-    return TRUE;
-}
-
 static gint
 get_last_file_number(
     VfsDevice *self)
 {
-    glfn_data data;
-    int count;
     Device *dself = DEVICE(self);
-    data.self = self;
-    data.rval = -1;
 
-    count = search_vfs_directory(self, "^[0-9]+\\.",
-                                 get_last_file_number_functor, &data);
+    if (!vfs_index_refresh(self))
+	return -1;
 
-    if (count <= 0) {
+    if (self->last_file < 0) {
         /* Somebody deleted something important while we weren't looking. */
 	device_set_error(dself,
 	    g_strdup(_("Error identifying VFS device contents!")),
 	    DEVICE_STATUS_DEVICE_ERROR | DEVICE_STATUS_VOLUME_ERROR);
         return -1;
-    } else {
-        g_assert(data.rval >= 0);
     }
 
-    return data.rval;
+    return self->last_file;
 }
 
 typedef struct {
-    VfsDevice * self;
     guint request;
     int best_found;
 } gnfn_data;
 
-/* A SearchDirectoryFunctor. */
+/* A GTraverseFunc; the traversal is in file number order, so the first file
+ * at or after the request is the one. */
 static gboolean
-get_next_file_number_functor(
-    const char *filename,
+get_next_file_number_traverse(
+    gpointer key,
+    gpointer value G_GNUC_UNUSED,
     gpointer datap)
 {
-    guint      file;
+    guint      file = GPOINTER_TO_UINT(key);
     gnfn_data *data = (gnfn_data*)datap;
 
-    file = g_ascii_strtoull(filename, NULL, 10); /* Guaranteed to work. */
-    if (file > G_MAXINT) {
-	g_warning(_("Super-large device file %s found, ignoring"), filename);
-        return TRUE;
-    }
-    /* This condition is needlessly complex due to sign issues. */
-    if (file >= data->request &&
-        (data->best_found < 0 || file < (guint)data->best_found)) {
+    if (file >= data->request) {
         data->best_found = file;
+	return TRUE;
     }
-    return TRUE;
+    return FALSE;
 }
 
 /* Returns the file number equal to or greater than the given requested
@@ -1277,16 +1497,12 @@ get_next_file_number(
     guint request)
 {
     gnfn_data data;
-    int count;
     Device *dself = DEVICE(self);
-    data.self = self;
-    data.request = request;
-    data.best_found = -1;
 
-    count = search_vfs_directory(self, "^[0-9]+\\.",
-                                 get_next_file_number_functor, &data);
+    if (!vfs_index_refresh(self))
+	return -1;
 
-    if (count <= 0) {
+    if (self->last_file < 0) {
         /* Somebody deleted something important while we weren't looking. */
 	device_set_error(dself,
 	    g_strdup(_("Error identifying VFS device contents!")),
@@ -1294,6 +1510,16 @@ get_next_file_number(
         return -1;
     }
 
+    /* the usual case: the file itself exists */
+    if (g_tree_lookup(self->file_index, GUINT_TO_POINTER(request)))
+	return request;
+    if ((gint)request > self->last_file)
+	return -1;
+
+    data.request = request;
+    data.best_found = -1;
+    g_tree_foreach(self->file_index, get_next_file_number_traverse, &data);
+
     /* Could be -1. */
     return data.best_found;
 }
@@ -1357,6 +1583,7 @@ vfs_device_start_file_open(
         self->release_file(dself);
         return FALSE;
     }
+    vfs_index_add(self, dself->file, self->file_name);
 
     return TRUE;
 }
@@ -1410,6 +1637,8 @@ vfs_device_start_file(
     self->volume_bytes += VFS_DEVICE_LABEL_SIZE;
     self->checked_bytes_used += VFS_DEVICE_LABEL_SIZE;
     dself->block = 0;
+    self->sync_started = VFS_DEVICE_LABEL_SIZE;
+    self->sync_waited = 0;
     g_mutex_lock(dself->device_mutex);
     dself->in_file = TRUE;
     dself->bytes_written = 0;
@@ -1424,6 +1653,7 @@ vfs_device_finish_file(
     Device *dself)
 {
     VfsDevice *self = VFS_DEVICE(dself);
+    struct stat file_status;
 
     if (!dself->in_file)
 	return TRUE;
@@ -1432,6 +1662,18 @@ vfs_device_finish_file(
     dself->in_file = FALSE;
     g_mutex_unlock(dself->device_mutex);
 
+    if (self->open_file_fd >= 0 && self->sync != VFS_SYNC_NONE &&
+	fsync(self->open_file_fd) == -1) {
+	device_set_error(dself,
+	    g_strdup_printf(_("Error syncing data file %s: %s"),
+			    self->file_name, strerror(errno)),
+	    DEVICE_STATUS_VOLUME_ERROR);
+    }
+
+    if (self->open_file_fd >= 0 &&
+	fstat(self->open_file_fd, &file_status) == 0) {
+	vfs_index_set_size(self, dself->file, file_status.st_size);
+    }
     self->release_file(dself);
 
     if (device_in_error(self)) return FALSE;
@@ -1517,6 +1759,12 @@ vfs_device_seek_file(
         return NULL;
     }
 
+#ifdef HAVE_POSIX_FADVISE
+    /* the file will be read front to back; let the kernel read ahead more */
+    (void)posix_fadvise(self->open_file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    self->readahead_offset = 0;
+
     result = vfs_device_robust_read(self, header_buffer,
                                     &header_buffer_size);
     if (result != RESULT_SUCCESS) {
@@ -1583,6 +1831,7 @@ vfs_device_seek_block(
                    SEEK_SET);
 
     dself->block = block;
+    self->readahead_offset = 0;
 
     if (result == (off_t)(-1)) {
 	device_set_error(dself,
@@ -1594,6 +1843,63 @@ vfs_device_seek_block(
     return TRUE;
 }
 
+static void
+vfs_sync_progress(
+    VfsDevice *self)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+    off_t end = DEVICE(self)->bytes_written + VFS_DEVICE_LABEL_SIZE;
+
+    if (end - self->sync_started < VFS_DEVICE_SYNC_CHUNK)
+	return;
+
+    /* wait for the chunk started by the previous call to hit the disk */
+    if (self->sync_started > self->sync_waited) {
+	if (sync_file_range(self->open_file_fd, self->sync_waited,
+			    self->sync_started - self->sync_waited,
+			    SYNC_FILE_RANGE_WAIT_BEFORE |
+			    SYNC_FILE_RANGE_WRITE |
+			    SYNC_FILE_RANGE_WAIT_AFTER) == -1) {
+	    g_debug("sync_file_range failed: %s", strerror(errno));
+	}
+	self->sync_waited = self->sync_started;
+    }
+
+    /* and start the write-out of this one */
+    if (sync_file_range(self->open_file_fd, self->sync_started,
+			end - self->sync_started,
+			SYNC_FILE_RANGE_WRITE) == -1) {
+	g_debug("sync_file_range failed: %s", strerror(errno));
+    }
+    self->sync_started = end;
+#else
+    (void)self;
+#endif
+}
+
+static void
+vfs_readahead(
+    VfsDevice *self)
+{
+#ifdef HAVE_POSIX_FADVISE
+    Device *dself = DEVICE(self);
+    off_t pos = dself->block * dself->block_size + VFS_DEVICE_LABEL_SIZE;
+
+    /* keep at least half a window ahead of the reader */
+    if (self->readahead_offset > pos + VFS_DEVICE_READAHEAD / 2)
+	return;
+
+    if (self->readahead_offset < pos)
+	self->readahead_offset = pos;
+    (void)posix_fadvise(self->open_file_fd, self->readahead_offset,
+			pos + VFS_DEVICE_READAHEAD - self->readahead_offset,
+			POSIX_FADV_WILLNEED);
+    self->readahead_offset = pos + VFS_DEVICE_READAHEAD;
+#else
+    (void)self;
+#endif
+}
+
 static gboolean
 try_unlink(
     const char *file)
@@ -1729,6 +2035,7 @@ vfs_device_recycle_file(
     }
 
     self->volume_bytes -= file_size;
+    vfs_index_remove(self, filenum);
     self->release_file(dself);
     return TRUE;
 }
@@ -40,6 +40,13 @@
 
 #define VFS_DEVICE_LABEL_SIZE (32768)
 
+/* Values of the SYNC property */
+typedef enum {
+    VFS_SYNC_NONE,		/* leave it to the kernel */
+    VFS_SYNC_FILE,		/* fsync each file when it is finished */
+    VFS_SYNC_PROGRESSIVE	/* also write out the file as it grows */
+} VfsSync;
+
 GType	vfs_device_get_type	(void);
 
 /*
@@ -75,8 +82,25 @@ typedef struct {
     gboolean slow_write;
     int      slow_count;
 
+    /* SYNC property; sync_started and sync_waited are the offsets in the
+     * current file up to which write-out was started and completed */
+    VfsSync sync;
+    off_t sync_started;
+    off_t sync_waited;
+
+    /* offset up to which read-ahead was requested in the current file */
+    off_t readahead_offset;
+
     /* and how many bytes have been written since the last check? */
     guint64 checked_bytes_used;
+
+    /* index of the volume files by file number (VfsFileEntry), valid while
+     * index_dir is dir_name and the directory mtime is index_mtime */
+    GTree *file_index;
+    char *index_dir;
+    struct timespec index_mtime;
+    gboolean index_racy;
+    gint last_file;
     gboolean (* clear_and_prepare_label)(Device *dself, char *label, char *timestamp);
     void (* release_file)(Device *dself);
     void (* update_volume_size)(Device *dself);
@@ -108,9 +108,10 @@ push_buffer_impl(
 
     /* Handle EOF */
     if (!buf) {
-	/* write out the partial buffer, if there's anything in it */
+	/* write out the partial buffer, if there's anything in it, as a short
+	 * final block; padding it would add bytes to the file */
 	if (self->partial_length) {
-	    if (!do_block(self, self->block_size, self->partial)) {
+	    if (!do_block(self, self->partial_length, self->partial)) {
 		return;
 	    }
 	    self->partial_length = 0;
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 18;
+use Test::More tests => 24;
 use strict;
 use warnings;
 
@@ -1316,3 +1316,36 @@ if ($use_diff) {
     is($filedata, $data, "file writing functional. ")
       or diag("original and written infofile different.");
 }
+
+## the binary database
+
+config_uninit();
+$testconf = Installcheck::Config->new();
+$testconf->add_param('infofile-format', '"binary"');
+$testconf->write();
+config_init( $CONFIG_INIT_EXPLICIT_NAME, "TESTCONF" ) == $CFGERR_OK
+  or die("config_init failed");
+
+$ci = Amanda::Curinfo->new($infodir);
+my $bin_info = $ci->get_info($host, $disk);
+is_deeply($bin_info->{history}, $info->{history},
+    "a disk without a binary record is read from its text file");
+
+ok(!defined $ci->put_info($host, $disk, $info),
+    "Amanda::Curinfo->put_info check (binary)");
+ok(-f "$infodir/curinfo.db", "binary database created");
+
+unlink $curinfo_file;
+$bin_info = $ci->get_info($host, $disk);
+is_deeply(
+    [ $bin_info->{command}, $bin_info->{last_level},
+      $bin_info->{consecutive_runs}, $bin_info->{inf}, $bin_info->{history},
+      [ map { $_ + 0 } @{$bin_info->{full}->{rate}}, @{$bin_info->{incr}->{comp}} ] ],
+    [ $info->{command}, $info->{last_level},
+      $info->{consecutive_runs}, $info->{inf}, $info->{history},
+      [ map { $_ + 0 } @{$info->{full}->{rate}}, @{$info->{incr}->{comp}} ] ],
+    "record read back from the binary database");
+
+ok($ci->del_info($host, $disk), "Amanda::Curinfo->del_info check (binary)");
+ok(!defined $ci->get_info($host, $disk)->{command},
+    "record deleted from the binary database");
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 634;
+use Test::More tests => 754;
 use File::Path qw( mkpath rmtree );
 use Sys::Hostname;
 use Carp;
@@ -792,6 +792,110 @@ SKIP: {
         "set an invalid-property-name");
 }
 
+####
+## Dedup device
+
+$vtape1 = mkvtape(1);
+rmtree("$taperoot/dedup");
+$dev_name = "dedup:$vtape1";
+
+$dev = Amanda::Device->new($dev_name);
+is($dev->status(), $DEVICE_STATUS_SUCCESS,
+    "$dev_name: create successful")
+    or diag($dev->error_or_status());
+
+properties_include([ $dev->property_list() ],
+    [ @common_properties, 'max_volume_usage', 'dedup_store',
+      'dedup_ratio', 'dedup_throughput' ],
+    "necessary properties listed on dedup device");
+
+ok($dev->start($ACCESS_WRITE, "TESTCONF13", undef),
+    "start in write mode")
+    or diag($dev->error_or_status());
+
+# the same data twice; the second copy is only references
+for (my $i = 1; $i <= 2; $i++) {
+    write_file(0x2FACE, $dev->block_size()*40+17, $i);
+}
+
+ok($dev->finish(),
+    "finish device after write")
+    or diag($dev->error_or_status());
+
+cmp_ok($dev->property_get("dedup_ratio"), ">", 1.9,
+    "second copy was deduplicated");
+
+$dev = undef;
+$dev = Amanda::Device->new($dev_name);
+ok($dev->start($ACCESS_READ, undef, undef),
+    "start in read mode")
+    or diag($dev->error_or_status());
+
+verify_file(0x2FACE, $dev->block_size()*40+17, 2);
+verify_file(0x2FACE, $dev->block_size()*40+17, 1);
+
+ok($dev->finish(),
+    "finish device after read")
+    or diag($dev->error_or_status());
+
+# a second volume, sharing the chunks of the first
+$vtape2 = mkvtape(2);
+$dev = Amanda::Device->new("dedup:$vtape2");
+ok($dev->start($ACCESS_WRITE, "TESTCONF14", undef),
+    "start second volume in write mode")
+    or diag($dev->error_or_status());
+
+write_file(0x2FACE, $dev->block_size()*40+17, 1);
+
+ok($dev->finish(),
+    "finish second volume after write")
+    or diag($dev->error_or_status());
+
+# a file without its commit record, as left by a taper that died while
+# writing it; its references were never added to the index
+{
+    my ($recipe) = glob("$vtape1/data/00001.*");
+    open(my $in, "<", $recipe) or die "open $recipe: $!";
+    binmode($in);
+    my $data = do { local $/; <$in> };
+    close($in);
+    open(my $out, ">", "$vtape1/data/00003.uncommitted")
+	or die "open $vtape1/data/00003.uncommitted: $!";
+    binmode($out);
+    print $out substr($data, 0, -36);
+    close($out);
+}
+
+$dev = Amanda::Device->new($dev_name);
+ok($dev->erase(),
+   "erase device")
+    or diag($dev->error_or_status());
+
+ok(scalar(my @chunks = glob("$taperoot/dedup/??/*")),
+    "erase kept the chunks the second volume uses");
+
+$dev = Amanda::Device->new("dedup:$vtape2");
+ok($dev->start($ACCESS_READ, undef, undef),
+    "start second volume in read mode")
+    or diag($dev->error_or_status());
+
+verify_file(0x2FACE, $dev->block_size()*40+17, 1);
+
+ok($dev->finish(),
+    "finish second volume after read")
+    or diag($dev->error_or_status());
+
+ok($dev->erase(),
+   "erase second volume")
+    or diag($dev->error_or_status());
+
+is_deeply([ glob("$taperoot/dedup/??/*") ], [],
+    "erase removed all the chunks");
+
+ok($dev->finish(),
+   "finish device after erase")
+    or diag($dev->error_or_status());
+
 ####
 ## Test a RAIT device of two vfs devices.
 
@@ -929,6 +1033,88 @@ ok(!($dev->start($ACCESS_WRITE, "TESTCONF29", undef)),
    "start a RAIT device in write mode fails, when created with 'undef'")
     or diag($dev->error_or_status());
 
+####
+## Test a RAIT device of five vfs devices, two of them parity, which can lose
+## any two of its children.
+
+my @vtapes = map { mkvtape($_) } (1 .. 5);
+$dev_name = "rait:file:{" . join(",", @vtapes) . "}";
+
+$dev = Amanda::Device->new($dev_name);
+is($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "$dev_name: create successful")
+    or diag($dev->error_or_status());
+
+is($dev->property_set("rait_parity", 2), undef,
+    "rait device accepts property RAIT_PARITY");
+
+is($dev->property_get("rait_parity"), 2,
+    "..and remembers it");
+
+is($dev->property_get("block_size"), 32768*3,
+    "rait device calculates its block size for three data children");
+
+ok($dev->start($ACCESS_WRITE, "TESTCONF31", undef),
+   "start in write mode with two parity children")
+    or diag($dev->error_or_status());
+
+write_file(0x5EED, $dev->block_size()*10+17, 1);
+write_file(0xB10C, $dev->block_size()*3, 2);
+
+ok($dev->finish(),
+   "finish device after write")
+    or diag($dev->error_or_status());
+
+# lose a data child and a parity child
+$dev = Amanda::Device->new("rait:{MISSING,file:$vtapes[1],file:$vtapes[2],file:$vtapes[3],MISSING}");
+$dev->property_set("rait_parity", 2);
+
+ok($dev->start($ACCESS_READ, undef, undef),
+   "start in read mode with a data and a parity child MISSING")
+    or diag($dev->error_or_status());
+
+verify_file(0x5EED, $dev->block_size()*10+17, 1);
+verify_file(0xB10C, $dev->block_size()*3, 2);
+
+ok($dev->finish(),
+   "finish device read with a data and a parity child MISSING")
+    or diag($dev->error_or_status());
+
+# and two data children, while reading
+$dev = Amanda::Device->new($dev_name);
+$dev->property_set("rait_parity", 2);
+
+ok($dev->start($ACCESS_READ, undef, undef),
+   "start in read mode with two parity children")
+    or diag($dev->error_or_status());
+
+rmtree($vtapes[0]);
+rmtree($vtapes[1]);
+
+verify_file(0xB10C, $dev->block_size()*3, 2);
+verify_file(0x5EED, $dev->block_size()*10+17, 1);
+
+ok($dev->finish(),
+   "finish device read after losing two data children")
+    or diag($dev->error_or_status());
+
+# three is one too many
+$dev = Amanda::Device->new("rait:{MISSING,MISSING,MISSING,file:$vtapes[3],file:$vtapes[4]}");
+$dev->property_set("rait_parity", 2);
+
+ok(!($dev->start($ACCESS_READ, undef, undef)),
+   "start in read mode fails with three children MISSING");
+like($dev->error_or_status(), qr/3 of the 5 child devices failed/,
+   "..with the right error");
+
+# as is two, with the default RAIT_PARITY
+$dev = Amanda::Device->new("rait:{MISSING,MISSING,file:$vtapes[2],file:$vtapes[3],file:$vtapes[4]}");
+
+ok(!($dev->start($ACCESS_READ, undef, undef)),
+   "start in read mode fails with two children MISSING and a single parity child");
+
+undef $dev;
+
 # Make two devices with different labels, should get a
 # message accordingly.
 ($vtape1, $vtape2) = (mkvtape(1), mkvtape(2));
@@ -1501,6 +1687,110 @@ SKIP: {
 	or diag($dev->error_or_status());
 }
 
+# Test the multi-part upload pipeline and the parallel ranged reads against
+# the mock S3 server
+my $s3_dev = Amanda::Device->new("s3:installcheck-mock");
+my $run_s3_mock_tests = $s3_dev->status() == $DEVICE_STATUS_SUCCESS ||
+    $s3_dev->error() !~ /is not known/;
+$s3_dev = undef;
+SKIP: {
+    skip "the S3 device is not available",
+	    20 +
+	    2 * $write_file_count +
+	    2 * $verify_file_count
+	unless $run_s3_mock_tests;
+
+    # delay one ranged read in three, so they complete out of order
+    my $s3server = Installcheck::Mock::S3Server->new(delay_ranges => 3);
+
+    $dev_name = "s3:installcheck-mock/mock-";
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->status(), $DEVICE_STATUS_SUCCESS,
+       "$dev_name: create successful")
+	or diag($dev->error_or_status());
+
+    for my $prop (['S3_HOST', $s3server->{'host'}],
+		  ['S3_ACCESS_KEY', 'mock-access-key'],
+		  ['S3_SECRET_KEY', 'mock-secret-key'],
+		  ['S3_SSL', 'OFF'],
+		  ['BLOCK_SIZE', 65536],
+		  ['S3_MULTI_PART_UPLOAD', 'YES'],
+		  ['S3_MULTI_PART_SIZE', 200000],
+		  ['NB_THREADS_BACKUP', 3],
+		  ['NB_BUFFERS_BACKUP', 4],
+		  ['NB_THREADS_RECOVERY', 4],
+		  ['NB_BUFFERS_RECOVERY', 4]) {
+	is($dev->property_set($prop->[0], $prop->[1]), undef,
+	    "set $prop->[0]")
+	    or diag($dev->error_or_status());
+    }
+
+    ok($dev->start($ACCESS_WRITE, "TESTCONF-MOCK", undef),
+       "start in write mode")
+	or diag($dev->error_or_status());
+
+    write_file(0xBEEF, $dev->block_size()*100, 1);
+    write_file(0xFEED, $dev->block_size()*100+1234, 2);
+
+    ok($dev->finish(),
+       "finish device after write")
+	or diag($dev->error_or_status());
+
+    # every part but the last of each upload is S3_MULTI_PART_SIZE bytes,
+    # the parts are numbered from 1 and add up to the completed object
+    my (%parts, %completed);
+    for my $line ($s3server->log_lines()) {
+	if ($line =~ /^PUT-PART (\S+) (\d+) (\d+)$/) {
+	    $parts{$1}[$2 - 1] = $3;
+	} elsif ($line =~ /^COMPLETE (\S+) (\d+)$/) {
+	    $completed{$1} = $2;
+	}
+    }
+    my @bad_uploads;
+    for my $key (sort keys %parts) {
+	my @sizes = @{$parts{$key}};
+	my $last = pop @sizes;
+	my $total = $last || 0;
+	for my $size (@sizes) {
+	    push @bad_uploads, $key
+		if !defined $size or $size != 200000;
+	    $total += $size || 0;
+	}
+	push @bad_uploads, $key
+	    if !defined $last or $last > 200000 or
+	       ($completed{$key} || 0) != $total;
+    }
+    ok(scalar(keys %parts) >= 2 && !@bad_uploads,
+	"multi-part uploads are sent in parts of S3_MULTI_PART_SIZE")
+	or diag("bad uploads: @bad_uploads");
+
+    # blocks come back from several threads, out of order; read the files
+    # in reverse order so the read-ahead buffer is reset too
+    ok($dev->start($ACCESS_READ, undef, undef),
+       "start in read mode")
+	or diag($dev->error_or_status());
+
+    verify_file(0xFEED, $dev->block_size()*100+1234, 2);
+    verify_file(0xBEEF, $dev->block_size()*100, 1);
+
+    ok(scalar(grep { /^GET-RANGE / } $s3server->log_lines()) >= 200,
+	"blocks are read with ranged GETs");
+
+    is($dev->property_get('NB_BUFFERS_RECOVERY'), 4,
+	"nb_buffers_recovery is still set");
+
+    ok($dev->finish(),
+       "finish device after read")
+	or diag($dev->error_or_status());
+
+    ok($dev->erase(),
+       "erase device")
+	or diag($dev->error_or_status());
+
+    $dev = undef;
+    $s3server->cleanup();
+}
+
 # Test a tape device if the proper environment variables are set
 my $TAPE_DEVICE = $ENV{'INSTALLCHECK_TAPE_DEVICE'};
 my $run_tape_tests = defined $TAPE_DEVICE;
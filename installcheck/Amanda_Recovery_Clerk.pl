@@ -17,7 +17,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 21;
+use Test::More tests => 28;
 use File::Path;
 use Data::Dumper;
 use strict;
@@ -34,6 +34,7 @@ use Amanda::Header;
 use Amanda::DB::Catalog;
 use Amanda::Xfer qw( :constants );
 use Amanda::Recovery::Clerk;
+use Amanda::Recovery::Prefetch;
 use Amanda::Recovery::Scan;
 use Amanda::MainLoop;
 use Amanda::Util;
@@ -325,6 +326,20 @@ sub clerk_notif_part {
     }
 }
 
+package main::Prefetch;
+
+use parent -norequire, 'Amanda::Recovery::Prefetch';
+
+# remember which parts the clerk read from the spool
+sub release_spool {
+    my $self = shift;
+    my ($spool) = @_;
+
+    my $part = $spool->{'entry'}->{'part'};
+    push @{$self->{'spooled_parts'}}, [ $part->{'label'}, $part->{'filenum'} ];
+    $self->SUPER::release_spool(@_);
+}
+
 package main;
 
 # run a recovery with the given plan on the given clerk, expecting a bytestream with
@@ -610,6 +625,102 @@ try_recovery(
     msg => "mismatched level detected");
 
 quit_clerk($clerk);
+
+# now recover with an extra restore stream, which copies parts from the volume
+# the clerk is not reading into a spool
+
+sub quit_prefetch {
+    my ($clerk, $prefetch, $msg) = @_;
+
+    $clerk->quit(finished_cb => make_cb(finished_cb => sub {
+	my ($err) = @_;
+	die "$err" if $err;
+
+	$prefetch->quit(finished_cb => \&Amanda::MainLoop::quit);
+    }));
+    Amanda::MainLoop::run();
+    ok(!-d $prefetch->{'spool_dir'}, $msg);
+}
+
+my $spool_dir = "$Installcheck::TMP/Amanda_Recovery_Clerk-spool";
+my $prefetch;
+my @prefetch_dumps = (
+    fake_dump("games", "/games", $datestamp, 0,
+	{ label => 'TESTCONF02', filenum => 2 },
+	{ label => 'TESTCONF02', filenum => 3 },
+    ),
+    fake_dump("usr", "/usr", $datestamp, 0,
+	{ label => 'TESTCONF01', filenum => 2 },
+	{ label => 'TESTCONF01', filenum => 3 },
+	{ label => 'TESTCONF02', filenum => 1 },
+    ),
+);
+
+$chg = Amanda::Changer->new("chg-disk:$taperoot");
+$scan = Amanda::Recovery::Scan->new(chg => $chg);
+$prefetch = main::Prefetch->new(
+    dumps => \@prefetch_dumps,
+    streams => 2,
+    spool_dir => $spool_dir,
+    spool_size => 1024*1024,
+    get_chg => sub { $chg });
+$clerk = Amanda::Recovery::Clerk->new(scan => $scan, debug => 1,
+				      prefetch => $prefetch);
+
+# let the stream copy the first part of /usr before the clerk starts on /games
+{
+    my $poll;
+    $poll = sub {
+	my $state = $prefetch->{'entries'}->[2]->{'state'};
+	if ($state eq 'spooled' or $prefetch->{'failed_labels'}->{'TESTCONF01'}) {
+	    return Amanda::MainLoop::quit();
+	}
+	Amanda::MainLoop::call_after(100, $poll);
+    };
+    $poll->();
+    Amanda::MainLoop::run();
+}
+
+try_recovery(
+    clerk => $clerk,
+    seed => 0xF002,
+    dump => $prefetch_dumps[0],
+    msg => "recovery from the first volume, with restore-streams 2");
+
+try_recovery(
+    clerk => $clerk,
+    seed => 0xF001,
+    dump => $prefetch_dumps[1],
+    msg => "recovery spanning both volumes, with restore-streams 2");
+
+is_deeply($prefetch->{'spooled_parts'}->[0], [ 'TESTCONF01', 2 ],
+    "..and the first part on TESTCONF01 was read from the spool");
+
+quit_prefetch($clerk, $prefetch, "..and the spool is removed on quit");
+
+# a spool too small for any part: the clerk reads everything from the volumes
+$chg = Amanda::Changer->new("chg-disk:$taperoot");
+$scan = Amanda::Recovery::Scan->new(chg => $chg);
+$prefetch = main::Prefetch->new(
+    dumps => [ $prefetch_dumps[1] ],
+    streams => 2,
+    spool_dir => $spool_dir,
+    spool_size => 32*1024,
+    get_chg => sub { $chg });
+$clerk = Amanda::Recovery::Clerk->new(scan => $scan, debug => 1,
+				      prefetch => $prefetch);
+
+try_recovery(
+    clerk => $clerk,
+    seed => 0xF001,
+    dump => $prefetch_dumps[1],
+    msg => "recovery spanning both volumes, with a spool too small for a part");
+
+is_deeply($prefetch->{'spooled_parts'}, undef,
+    "..and no part was read from the spool");
+
+quit_prefetch($clerk, $prefetch, "..and the spool is removed on quit");
+
 rmtree($taperoot);
 
 # try a recovery from a DirectTCP-capable device.  Note that this is the only real
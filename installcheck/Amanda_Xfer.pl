@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 68;
+use Test::More tests => 72;
 use File::Path;
 use Data::Dumper;
 use strict;
@@ -36,6 +36,7 @@ use Amanda::Paths;
 use Amanda::Config qw( :init :getconf );
 use Amanda::Constants;
 use Fcntl 'SEEK_SET';
+use IO::Uncompress::Gunzip qw( gunzip $GunzipError );
 
 # get Amanda::Device only when we're building for server
 BEGIN {
@@ -1398,6 +1399,100 @@ SKIP: {
     rmtree($holding_base);
 }
 
+# restore a compressed holding file from a block of its seek table
+SKIP: {
+    skip "not built with server", 4 unless Amanda::Util::built_with_component("server");
+    skip "no in-process gzip", 4 unless Amanda::Xfer::xfer_filter_compress_supported("gzip");
+
+    my $RANDOM_SEED = 0xD0D0CACA;
+    my $data_size = 5*1024*1024 + 1234;
+    my $holding_base = "$Installcheck::TMP/seek-holding";
+
+    my $run_to_buffer = sub {
+	my ($src, %params) = @_;
+	my $dest = Amanda::Xfer::Dest::Buffer->new(0);
+	my $xfer = Amanda::Xfer->new([ $src, @{$params{'filters'} || []}, $dest ]);
+
+	$xfer->start(sub {
+	    my ($src, $msg, $xfer) = @_;
+	    if ($msg->{type} == $XMSG_ERROR) {
+		die $msg->{elt} . " failed: " . $msg->{message};
+	    } elsif ($msg->{'type'} == $XMSG_DONE) {
+		Amanda::MainLoop::quit();
+	    }
+	}, $params{'offset'}, -1);
+	$src->start_recovery() if $src->isa("Amanda::Xfer::Source::Holding");
+	Amanda::MainLoop::run();
+	return $dest->get();
+    };
+
+    my $data = $run_to_buffer->(
+	Amanda::Xfer::Source::Random->new($data_size, $RANDOM_SEED));
+    # four threads, so the data is cut in blocks and a seek table is written
+    my $compressed = $run_to_buffer->(
+	Amanda::Xfer::Source::Random->new($data_size, $RANDOM_SEED),
+	filters => [ Amanda::Xfer::Filter::Compress->new("gzip", 1, 4) ]);
+
+    # store it in two chunks, split in the middle of a block
+    rmtree($holding_base);
+    mkpath($holding_base);
+    my $split = int(length($compressed) / 2) + 17;
+    my @pieces = (substr($compressed, 0, $split), substr($compressed, $split));
+    for my $i (0 .. 1) {
+	my $hdr = Amanda::Header->new();
+	$hdr->{'type'} = ($i == 0)?
+	    $Amanda::Header::F_DUMPFILE : $Amanda::Header::F_CONT_DUMPFILE;
+	$hdr->{'datestamp'} = "20070102030405";
+	$hdr->{'dumplevel'} = 0;
+	$hdr->{'compressed'} = 1;
+	$hdr->{'name'} = "localhost";
+	$hdr->{'disk'} = "/home";
+	$hdr->{'program'} = "INSTALLCHECK";
+	$hdr->{'cont_filename'} = "$holding_base/file1" if $i == 0;
+
+	open(my $fh, ">", "$holding_base/file$i")
+	    or die("opening '$holding_base/file$i': $!");
+	print $fh $hdr->to_string(32768,32768);
+	print $fh $pieces[$i];
+	close($fh);
+    }
+
+    my ($errmsg, $comp_offset, $uncomp_offset) =
+	Amanda::XferServer::holding_file_find_block("$holding_base/file0",
+						    3*1024*1024 + 5);
+    ok(!defined $errmsg && $uncomp_offset == 3*1024*1024 && $comp_offset > $split,
+	"holding_file_find_block finds the block holding an offset, in the second chunk")
+	or diag($errmsg);
+
+    my $from_block = $run_to_buffer->(
+	Amanda::Xfer::Source::Holding->new("$holding_base/file0"),
+	offset => $comp_offset);
+    my $uncompressed;
+    gunzip(\$from_block => \$uncompressed, MultiStream => 1)
+	or die("gunzip failed: $GunzipError");
+    ok($uncompressed eq substr($data, $uncomp_offset),
+	"Amanda::Xfer::Source::Holding read from the block decompresses to the rest of the image");
+
+    ($errmsg) = Amanda::XferServer::holding_file_find_block("$holding_base/file0",
+							    $data_size);
+    like($errmsg, qr/past the end/,
+	"holding_file_find_block fails for an offset past the end of the image");
+
+    # a holding file without a seek table
+    open(my $fh, ">", "$holding_base/file1") or die("opening: $!");
+    my $hdr = Amanda::Header->new();
+    $hdr->{'type'} = $Amanda::Header::F_CONT_DUMPFILE;
+    print $fh $hdr->to_string(32768,32768);
+    print $fh 'a' x 100000;
+    close($fh);
+    ($errmsg) = Amanda::XferServer::holding_file_find_block("$holding_base/file0",
+							    0);
+    like($errmsg, qr/seek table/,
+	"holding_file_find_block fails if there is no seek table");
+
+    rmtree($holding_base);
+}
+
 # test Amanda::Xfer::Dest::Taper::DirectTCP; do it twice, once with a cancellation
 SKIP: {
     skip "not built with ndmp and server", 3 unless
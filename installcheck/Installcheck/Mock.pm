@@ -93,6 +93,28 @@ The C<cleanup> method will clean up any data files, and should be called when a
 test suite finishes.  The C<reset> method resets the changer to its initial
 state, without restarting ndmjob.
 
+=head2 S3
+
+A small S3 server, enough for the S3 device with S3_SUBDOMAIN off: buckets,
+objects with ranged reads, multi-part uploads and multi-delete.  Requests are
+not authenticated.  Start it with:
+
+  my $s3server = Installcheck::Mock::S3Server->new();
+
+All keyword arguments are optional, and include:
+
+  delay_ranges => N  delay the ranged GETs of every Nth block of 64k, so the
+		     ranged reads complete out of order
+
+The resulting object has the following attributes:
+
+  $s->{'host'}	    the "ip:port" to use as S3_HOST
+  $s->{'log'}	    a file with one line per request, e.g. "PUT-PART key 2 1024"
+		    or "GET-RANGE key 0-65535"
+
+The C<log_lines> method returns the lines of the log, and C<cleanup> stops the
+server and removes its data.
+
 =cut
 
 use Installcheck;
@@ -231,4 +253,383 @@ sub cleanup {
     rmtree($self->{'simdir'}) if -d $self->{'simdir'};
 }
 
+package Installcheck::Mock::S3Server;
+
+use File::Path qw( mkpath rmtree );
+use File::Basename qw( dirname );
+use IO::Socket::INET;
+use Digest::MD5 qw( md5_hex );
+use POSIX qw( :sys_wait_h );
+
+sub new {
+    my $class = shift;
+    my %params = @_;
+
+    my $self = bless {}, $class;
+
+    $self->{'root'} = "$Installcheck::TMP/mock-s3";
+    $self->{'log'} = "$Installcheck::TMP/mock-s3.log";
+    $self->{'delay_ranges'} = $params{'delay_ranges'};
+    rmtree($self->{'root'});
+    mkpath($self->{'root'});
+    unlink($self->{'log'});
+
+    # bind before forking, so the port is known and the server is ready
+    my $listen = IO::Socket::INET->new(
+	    LocalAddr => '127.0.0.1',
+	    LocalPort => 0,
+	    Proto => 'tcp',
+	    Listen => 16,
+	    ReuseAddr => 1)
+	or die("cannot listen for the mock S3 server: $!");
+    $self->{'host'} = "127.0.0.1:" . $listen->sockport();
+
+    my $pid = fork();
+    die("fork: $!") unless defined $pid;
+    if ($pid == 0) {
+	# one process per connection, all in our process group
+	setpgrp(0, 0);
+	$SIG{'CHLD'} = 'IGNORE';
+	while (1) {
+	    my $conn = $listen->accept();
+	    next unless $conn;
+	    my $child = fork();
+	    if (defined $child && $child == 0) {
+		close($listen);
+		$self->_serve($conn);
+		POSIX::_exit(0);
+	    }
+	    close($conn);
+	}
+    }
+    close($listen);
+    $self->{'pid'} = $pid;
+
+    return $self;
+}
+
+sub log_lines {
+    my $self = shift;
+
+    open(my $fh, "<", $self->{'log'}) or return ();
+    my @lines = <$fh>;
+    close($fh);
+    chomp @lines;
+    return @lines;
+}
+
+sub cleanup {
+    my $self = shift;
+
+    if ($self->{'pid'}) {
+	kill('TERM', -$self->{'pid'});
+	waitpid($self->{'pid'}, 0);
+	$self->{'pid'} = undef;
+    }
+    rmtree($self->{'root'}) if -d $self->{'root'};
+}
+
+sub _log {
+    my $self = shift;
+    my ($line) = @_;
+
+    # the lines of concurrent connections must not interleave
+    open(my $fh, ">>", $self->{'log'}) or die("open $self->{log}: $!");
+    flock($fh, 2);
+    print $fh "$line\n";
+    close($fh);
+}
+
+sub _unescape {
+    my ($str) = @_;
+
+    $str =~ s/\+/ /g;
+    $str =~ s/%([0-9A-Fa-f]{2})/chr(hex($1))/ge;
+    return $str;
+}
+
+sub _key_file {
+    my $self = shift;
+    my ($bucket, $key) = @_;
+
+    $key =~ s/([^A-Za-z0-9._-])/sprintf("%%%02X", ord($1))/ge;
+    return "$self->{root}/$bucket/$key";
+}
+
+sub _keys {
+    my $self = shift;
+    my ($bucket) = @_;
+
+    opendir(my $dh, "$self->{root}/$bucket") or return ();
+    my @keys = sort map { _unescape($_) } grep { !/^\./ } readdir($dh);
+    closedir($dh);
+    return @keys;
+}
+
+sub _slurp {
+    my ($filename) = @_;
+
+    open(my $fh, "<", $filename) or return undef;
+    binmode($fh);
+    my $data = do { local $/; <$fh> };
+    close($fh);
+    return $data;
+}
+
+sub _spew {
+    my ($filename, $data) = @_;
+
+    # write then rename, so a concurrent GET never sees a partial object;
+    # dot files are not listed
+    my $tmp = dirname($filename) . "/.tmp$$";
+    open(my $fh, ">", $tmp) or die("open $tmp: $!");
+    binmode($fh);
+    print $fh $data;
+    close($fh);
+    rename($tmp, $filename) or die("rename $filename: $!");
+}
+
+sub _serve {
+    my $self = shift;
+    my ($conn) = @_;
+
+    binmode($conn);
+    while (my $line = <$conn>) {
+	$line =~ s/\r?\n$//;
+	next if $line eq '';
+	my ($method, $uri) = split(/ /, $line);
+
+	my %headers;
+	while (my $hline = <$conn>) {
+	    $hline =~ s/\r?\n$//;
+	    last if $hline eq '';
+	    my ($name, $value) = ($hline =~ /^([^:]*):\s*(.*)$/);
+	    $headers{lc($name)} = $value if defined $name;
+	}
+
+	if (($headers{'expect'} || '') =~ /100-continue/i) {
+	    print $conn "HTTP/1.1 100 Continue\r\n\r\n";
+	    $conn->flush();
+	}
+
+	my $body = '';
+	if (($headers{'transfer-encoding'} || '') =~ /chunked/i) {
+	    while (my $size = <$conn>) {
+		$size = hex($size);
+		my $chunk = '';
+		read($conn, $chunk, $size) if $size;
+		<$conn>;
+		last if $size == 0;
+		$body .= $chunk;
+	    }
+	} elsif ($headers{'content-length'}) {
+	    read($conn, $body, $headers{'content-length'});
+	}
+
+	my ($path, $query) = split(/\?/, $uri, 2);
+	my %query;
+	for my $param (split(/&/, $query || '')) {
+	    my ($name, $value) = split(/=/, $param, 2);
+	    $query{$name} = defined $value ? _unescape($value) : '';
+	}
+	$path =~ s{^/}{};
+	my ($bucket, $key) = split(m{/}, $path, 2);
+	$bucket = _unescape($bucket) if defined $bucket;
+	$key = _unescape($key) if defined $key && $key ne '';
+	$key = undef if defined $key && $key eq '';
+
+	my ($code, $resp_headers, $resp_body) =
+	    $self->_request($method, $bucket, $key, \%query, \%headers, $body);
+
+	my $status = {
+	    200 => 'OK', 204 => 'No Content', 206 => 'Partial Content',
+	    400 => 'Bad Request', 404 => 'Not Found',
+	    416 => 'Requested Range Not Satisfiable',
+	}->{$code};
+	$resp_body = '' unless defined $resp_body;
+	print $conn "HTTP/1.1 $code $status\r\n";
+	for my $name (sort keys %$resp_headers) {
+	    print $conn "$name: $resp_headers->{$name}\r\n";
+	}
+	print $conn "Content-Length: " . length($resp_body) . "\r\n";
+	print $conn "\r\n";
+	print $conn $resp_body unless $method eq 'HEAD';
+	$conn->flush();
+    }
+    close($conn);
+}
+
+sub _error {
+    my ($code, $name) = @_;
+
+    return ($code, { 'Content-Type' => 'application/xml' },
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" .
+	"<Error><Code>$name</Code><Message>$name</Message></Error>\n");
+}
+
+sub _xml {
+    my ($xml) = @_;
+
+    return (200, { 'Content-Type' => 'application/xml' },
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n$xml");
+}
+
+sub _request {
+    my $self = shift;
+    my ($method, $bucket, $key, $query, $headers, $body) = @_;
+    my $bucket_dir = "$self->{root}/$bucket";
+    my $uploads_dir = "$self->{root}/.uploads";
+
+    return _error(400, 'InvalidBucketName') unless defined $bucket && $bucket ne '';
+
+    if ($method eq 'PUT' && !defined $key) {
+	mkpath($bucket_dir);
+	return (200, {}, '');
+    }
+    return _error(404, 'NoSuchBucket') unless -d $bucket_dir;
+
+    if (!defined $key) {
+	if ($method eq 'GET' && exists $query->{'uploads'}) {
+	    my $prefix = $query->{'prefix'} || '';
+	    my $xml = "<ListMultipartUploadsResult><Bucket>$bucket</Bucket>\n";
+	    opendir(my $dh, $uploads_dir);
+	    for my $upload_id (sort grep { !/^\./ } ($dh ? readdir($dh) : ())) {
+		my $upload_key = _slurp("$uploads_dir/$upload_id/.key");
+		next unless defined $upload_key;
+		next unless substr($upload_key, 0, length($prefix)) eq $prefix;
+		$xml .= "<Upload><Key>$upload_key</Key>" .
+			"<UploadId>$upload_id</UploadId></Upload>\n";
+	    }
+	    closedir($dh) if $dh;
+	    $xml .= "<IsTruncated>false</IsTruncated>" .
+		    "</ListMultipartUploadsResult>\n";
+	    return _xml($xml);
+	} elsif ($method eq 'GET') {
+	    my $prefix = $query->{'prefix'} || '';
+	    my $delimiter = $query->{'delimiter'};
+	    my $max_keys = $query->{'max-keys'} || 1000;
+	    my $marker = $query->{'marker'};
+	    my (@contents, %common_prefixes);
+	    my $count = 0;
+	    my $truncated = 'false';
+	    my $next_marker;
+	    for my $k ($self->_keys($bucket)) {
+		next unless substr($k, 0, length($prefix)) eq $prefix;
+		next if defined $marker && $k le $marker;
+		if ($count >= $max_keys) {
+		    $truncated = 'true';
+		    last;
+		}
+		my $rest = substr($k, length($prefix));
+		if (defined $delimiter && $delimiter ne '' &&
+		    (my $i = index($rest, $delimiter)) >= 0) {
+		    my $common = $prefix . substr($rest, 0, $i + length($delimiter));
+		    $count++ unless $common_prefixes{$common}++;
+		} else {
+		    push @contents, $k;
+		    $count++;
+		}
+		$next_marker = $k;
+	    }
+	    my $xml = "<ListBucketResult><Name>$bucket</Name>\n" .
+		      "<IsTruncated>$truncated</IsTruncated>\n";
+	    $xml .= "<NextMarker>$next_marker</NextMarker>\n"
+		if $truncated eq 'true';
+	    for my $k (@contents) {
+		my $size = -s $self->_key_file($bucket, $k);
+		$xml .= "<Contents><Key>$k</Key><Size>$size</Size>" .
+			"<StorageClass>STANDARD</StorageClass></Contents>\n";
+	    }
+	    for my $common (sort keys %common_prefixes) {
+		$xml .= "<CommonPrefixes><Prefix>$common</Prefix></CommonPrefixes>\n";
+	    }
+	    $xml .= "</ListBucketResult>\n";
+	    return _xml($xml);
+	} elsif ($method eq 'POST' && exists $query->{'delete'}) {
+	    my $xml = "<DeleteResult>\n";
+	    while ($body =~ m{<Key>([^<]*)</Key>}g) {
+		unlink($self->_key_file($bucket, $1));
+		$self->_log("DELETE $1");
+		$xml .= "<Deleted><Key>$1</Key></Deleted>\n";
+	    }
+	    $xml .= "</DeleteResult>\n";
+	    return _xml($xml);
+	} elsif ($method eq 'DELETE') {
+	    rmdir($bucket_dir);
+	    return (204, {}, '');
+	}
+	return _error(400, 'InvalidRequest');
+    }
+
+    my $file = $self->_key_file($bucket, $key);
+
+    if ($method eq 'POST' && exists $query->{'uploads'}) {
+	my $upload_id = sprintf("upload-%d-%d", $$, ++$self->{'nb_uploads'});
+	mkpath("$uploads_dir/$upload_id");
+	_spew("$uploads_dir/$upload_id/.key", $key);
+	$self->_log("INITIATE $key");
+	return _xml("<InitiateMultipartUploadResult><Bucket>$bucket</Bucket>" .
+		    "<Key>$key</Key><UploadId>$upload_id</UploadId>" .
+		    "</InitiateMultipartUploadResult>\n");
+    } elsif (exists $query->{'uploadId'}) {
+	my $upload_id = $query->{'uploadId'};
+	my $upload_dir = "$uploads_dir/$upload_id";
+	return _error(404, 'NoSuchUpload') unless -d $upload_dir;
+
+	if ($method eq 'PUT') {
+	    my $part = $query->{'partNumber'};
+	    _spew("$upload_dir/$part", $body);
+	    $self->_log("PUT-PART $key $part " . length($body));
+	    return (200, { 'ETag' => '"' . md5_hex($body) . '"' }, '');
+	} elsif ($method eq 'POST') {
+	    my $data = '';
+	    while ($body =~ m{<PartNumber>\s*(\d+)\s*</PartNumber>}g) {
+		my $part = _slurp("$upload_dir/$1");
+		return _error(400, 'InvalidPart') unless defined $part;
+		$data .= $part;
+	    }
+	    _spew($file, $data);
+	    rmtree($upload_dir);
+	    $self->_log("COMPLETE $key " . length($data));
+	    return _xml("<CompleteMultipartUploadResult><Bucket>$bucket</Bucket>" .
+			"<Key>$key</Key></CompleteMultipartUploadResult>\n");
+	} elsif ($method eq 'DELETE') {
+	    rmtree($upload_dir);
+	    $self->_log("ABORT $key");
+	    return (204, {}, '');
+	}
+	return _error(400, 'InvalidRequest');
+    } elsif ($method eq 'PUT') {
+	_spew($file, $body);
+	$self->_log("PUT $key " . length($body));
+	return (200, { 'ETag' => '"' . md5_hex($body) . '"' }, '');
+    } elsif ($method eq 'GET' || $method eq 'HEAD') {
+	my $data = _slurp($file);
+	return _error(404, 'NoSuchKey') unless defined $data;
+	my $range = $headers->{'range'};
+	if ($method eq 'GET' && defined $range &&
+	    $range =~ /^bytes=(\d+)-(\d*)$/) {
+	    my ($begin, $end) = ($1, $2);
+	    $end = length($data) - 1 if $end eq '' || $end >= length($data);
+	    return _error(416, 'InvalidRange') if $begin > $end;
+	    $self->_log("GET-RANGE $key $begin-$end");
+	    my $delay = $self->{'delay_ranges'};
+	    if ($delay && int($begin / 65536) % $delay == 0) {
+		select(undef, undef, undef, 0.2);
+	    }
+	    return (206, {
+		    'Content-Range' => "bytes $begin-$end/" . length($data),
+		}, substr($data, $begin, $end - $begin + 1));
+	}
+	$self->_log("$method $key");
+	# the body of a HEAD is not sent, only its Content-Length
+	return (200, {}, $data);
+    } elsif ($method eq 'DELETE') {
+	unlink($file);
+	$self->_log("DELETE $key");
+	return (204, {}, '');
+    }
+    return _error(400, 'InvalidRequest');
+}
+
 1;
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 11;
+use Test::More tests => 15;
 use strict;
 use warnings;
 
@@ -32,8 +32,9 @@ use Installcheck::Mock;
 use Installcheck::Run qw(run run_err run_out run_get $diskname);
 use Amanda::DB::Catalog;
 use Amanda::Paths;
-use Amanda::Config qw( :init );
+use Amanda::Config qw( :init :getconf config_dir_relative );
 use Amanda::Changer;
+use Amanda::Cmdfile;
 use Amanda::Debug;
 
 Amanda::Debug::dbopen("installcheck");
@@ -179,6 +180,33 @@ is_deeply([ get_dry_run("$sbindir/amvault",
     [ "TESTCONF02", "1", "localhost", "$diskname/dir",     "1" ]
     ], "amvault with a disk expression dumps only that disk");
 
+# --parallel copies what it selected through the driver, and leaves the
+# dumps queued earlier with --delayed for --run-delayed
+ok(run("$sbindir/amvault",
+		'--delayed', '--fulls-only',
+		'TESTCONF', 'localhost', "$diskname/dir"),
+    "amvault --delayed queues a vault")
+    or diag($Installcheck::Run::stderr);
+
+ok(run("$sbindir/amvault",
+		'--parallel', '--fulls-only',
+		'TESTCONF', 'localhost', "=$diskname"),
+    "amvault --parallel runs")
+    or diag($Installcheck::Run::stderr);
+
+my @vaulted = Amanda::DB::Catalog::get_dumps(storage => 'amvault-test');
+is_deeply([ map { $_->{'diskname'} } @vaulted ], [ $diskname, $diskname ],
+    "..and vaults only the dumps it selected")
+    or diag(Dumper(\@vaulted));
+
+my ($dir_full) = Amanda::DB::Catalog::get_dumps(diskname => "$diskname/dir",
+						level => 0);
+my $cmdfile = Amanda::Cmdfile->new(config_dir_relative(getconf($CNF_CMDFILE)));
+is($cmdfile->get_nb_image_cmd_for_storage('localhost', "$diskname/dir",
+		$dir_full->{'dump_timestamp'}, 0, 'amvault-test'), 1,
+    "..while the delayed vault is still queued");
+$cmdfile->unlock();
+
 # Test NDMP-to-NDMP vaulting.  This will test all manner of goodness:
 #  - specifying a named changer on the amvault command line
 #  - exporting
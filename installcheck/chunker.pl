@@ -340,7 +340,7 @@ $handle = "11-11111";
 $datestamp = "20070102030405";
 run_chunker("simple");
 # note that features (ffff here) and options (ops) are ignored by the chunker
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /boot 0 $datestamp 512 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /boot 0 $datestamp 512 INSTALLCHECK 10240 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 700*1024, "ghost", "/boot", 0);
@@ -365,7 +365,7 @@ check_holding_chunks($test_hfile, [ 480, 220 ], "ghost", "/boot", $datestamp, 0)
 $handle = "22-11111";
 $datestamp = "20080808080808";
 run_chunker("partial");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /root 0 $datestamp 512 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /root 0 $datestamp 512 INSTALLCHECK 10240 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 768*1024, "ghost", "/root", 0);
@@ -391,7 +391,7 @@ check_holding_chunks($test_hfile, [ 480, 288 ], "ghost", "/root", $datestamp, 0)
 $handle = "33-11111";
 $datestamp = "20070202020202";
 run_chunker("failed");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /usr 0 $datestamp 512 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /usr 0 $datestamp 512 INSTALLCHECK 10240 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 0, "ghost", "/usr", 0);
@@ -419,7 +419,7 @@ cleanup_chunker();
 $handle = "44-11111";
 $datestamp = "20040404040404";
 run_chunker("more-than-use");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 10240 INSTALLCHECK 512 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 10240 INSTALLCHECK 512 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 700*1024, "ghost", "/var", 1);
@@ -448,7 +448,7 @@ check_holding_chunks($test_hfile, [ 480, 220 ], "ghost", "/var", $datestamp, 0);
 $handle = "55-11111";
 $datestamp = "20050505050505";
 run_chunker("more-than-use-and-chunks");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 96 INSTALLCHECK 160 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 96 INSTALLCHECK 160 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 400*1024, "ghost", "/var", 1);
@@ -480,7 +480,7 @@ cleanup_chunker();
 $handle = "55-22222";
 $datestamp = "20050505050505";
 run_chunker("use, continue on same file");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var/lib 0 $datestamp 10240 INSTALLCHECK 64 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var/lib 0 $datestamp 10240 INSTALLCHECK 64 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 70*1024, "ghost", "/var/lib", 1);
@@ -512,7 +512,7 @@ cleanup_chunker();
 $handle = "66-11111";
 $datestamp = "20060606060606";
 run_chunker("out-of-use-during-header");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /u01 0 $datestamp 96 INSTALLCHECK 120 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /u01 0 $datestamp 96 INSTALLCHECK 120 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 400*1024, "ghost", "/u01", 1);
@@ -542,7 +542,7 @@ check_holding_chunks($test_hfile, [ 64, 96, 96, 96, 48 ],
 $handle = "88-11111";
 $datestamp = "20080808080808";
 run_chunker("ENOSPC-1", ENOSPC_at => 90*1024);
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 10240 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 10240 INSTALLCHECK 10240 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 100*1024, "roast", "/boot", 0);
@@ -574,7 +574,7 @@ check_holding_chunks($test_hfile, [ 32, 68 ], "roast", "/boot", $datestamp, 0);
 $handle = "88-22222";
 $datestamp = "20080808080808";
 run_chunker("ENOSPC-2", ENOSPC_at => 130*1024);
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 128*1024, "roast", "/boot", 0);
@@ -607,7 +607,7 @@ ok(!-f "$test_hfile.1.tmp",
 $handle = "88-33333";
 $datestamp = "20080808080809";
 run_chunker("ENOSPC-2", ENOSPC_at => 130*1024);
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 128*1024, "roast", "/boot", 0);
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 312;
+use Test::More tests => 320;
 use strict;
 use warnings;
 
@@ -135,6 +135,7 @@ sub wait_for_exit {
 
 sub cleanup_taper {
     -f $test_filename and unlink($test_filename);
+    -f "$test_filename.tmp" and unlink("$test_filename.tmp");
     -f $taper_stderr_file and unlink($taper_stderr_file);
 
     # make a small effort to collect zombies
@@ -287,6 +288,49 @@ sub make_holding_file {
     write_dumpfile_data_to($fh, $size, $hostname, $disk);
 }
 
+# write a holding-like file in test_filename.tmp, slowly, in a child, the way
+# xfer-dest-holding does: the committed length in the header block is updated
+# after each piece, and between pieces the file holds bytes past it that are
+# then truncated away, as after a short write.  The file is renamed to
+# test_filename at the end.  Returns the pid of the child.
+sub write_growing_holding_file {
+    my ($size, $hostname, $disk) = @_;
+    my $tmp_filename = "$test_filename.tmp";
+
+    my $pid = fork();
+    return $pid if $pid;
+
+    my $bufbase = substr((('='x127)."\n".('-'x127)."\n") x 4, 8, -3) . "1K\n";
+    my $data = join('', map { sprintf("%08x", $_).$bufbase } 0 .. $size/1024 - 1);
+    my $set_committed = sub {
+	my ($fh, $len) = @_;
+	sysseek($fh, 32768 - 64, 0);
+	$fh->syswrite(pack("a64", sprintf("COMMITTED %020d\n", $len)), 64);
+    };
+
+    open(my $fh, "+>", $tmp_filename) or die("open $tmp_filename: $!");
+    write_dumpfile_header_to($fh, $size, $hostname, $disk);
+    $set_committed->($fh, 0);
+
+    my $written = 0;
+    while ($written < $size) {
+	sysseek($fh, 32768 + $written, 0);
+	$fh->syswrite("X" x 8192, 8192);
+	select(undef, undef, undef, 0.2);
+	truncate($fh, 32768 + $written);
+
+	my $len = 128*1024;
+	$len = $size - $written if $len > $size - $written;
+	sysseek($fh, 32768 + $written, 0);
+	$fh->syswrite(substr($data, $written, $len), $len);
+	$written += $len;
+	$set_committed->($fh, $written);
+    }
+    close($fh);
+    rename($tmp_filename, $test_filename);
+    exit;
+}
+
 # connect to the given port and write a dumpfile; this *will* create
 # zombies, but it's OK -- installchecks aren't daemons.
 sub write_to_port {
@@ -513,6 +557,41 @@ check_logs([
     qr(^INFO taper tape TESTCONF01 kb 2016 fm 6 \[OK\]$),
 ], "multipart PORT-WRITE logged correctly");
 
+##
+# A STREAM-WRITE of a holding file that is still growing; the taper must
+# only read the committed data
+
+$handle = "11-35555";
+$datestamp = "19780615010204";
+run_taper(4096, "STREAM-WRITE of a growing holding file");
+like(taper_reply, qr/^TAPER-OK worker0-0 ALLOW-TAKE-SCRIBE-FROM$/,
+	"got TAPER-OK") or die;
+my $writer_pid = write_growing_holding_file(1024*1024, "localhost", "/opt");
+taper_cmd("STREAM-WRITE worker0-0 $handle \"$test_filename\" localhost /opt 0 $datestamp \"\" \"\" \"\" \"\" \"\" \"\" \"\" \"\" 12");
+like(taper_reply, qr/^REQUEST-NEW-TAPE worker0-0 $handle$/,
+	"got REQUEST-NEW-TAPE worker0-0 $handle") or die;
+taper_cmd("START-SCAN worker0-0 $handle");
+taper_cmd("NEW-TAPE worker0-0 $handle");
+like(taper_reply, qr/^NEW-TAPE worker0-0 $handle TESTCONF01$/,
+	"got proper NEW-TAPE worker0-0 $handle") or die;
+like(taper_reply, qr/^READY worker0-0 $handle/);
+waitpid($writer_pid, 0);
+taper_cmd("DONE worker0-0 $handle 12 00000000:0 00000000:0 02929ca0:1048576");
+like(taper_reply, qr/^PARTDONE worker0-0 $handle TESTCONF01 1 1024 "\[sec [\d.]+ bytes 1048576 kps [\d.]+ orig-kb 12\]"$/,
+	"got PARTDONE") or die;
+like(taper_reply, qr/^DONE worker0-0 $handle INPUT-GOOD TAPE-GOOD "02929ca0:1048576" "\[sec [\d.]+ bytes 1048576 kps [\d.]+ orig-kb 12\]" "" ""$/,
+	"got DONE") or die;
+taper_cmd("QUIT");
+wait_for_exit();
+
+check_logs([
+    qr(^INFO taper Slot 1 without label can be labeled$),
+    qr(^START taper datestamp $datestamp "ST:TESTCONF" "POOL:TESTCONF" label TESTCONF01 tape 1$),
+    qr(^PART taper "ST:TESTCONF" "POOL:TESTCONF" TESTCONF01 1 localhost /opt $datestamp 1/-1 0 \[sec [\d.]+ bytes 1048576 kps [\d.]+ orig-kb 12\]$),
+    qr(^DONE taper "ST:TESTCONF" "POOL:TESTCONF" localhost /opt $datestamp 1 0 00000000:0 00000000:0 02929ca0:1048576 \[sec [\d.]+ bytes 1048576 kps [\d.]+ orig-kb 12\]$),
+    qr(^INFO taper tape TESTCONF01 kb 1024 fm 1 \[OK\]$),
+], "STREAM-WRITE of a growing holding file logged correctly");
+
 ##
 # Test NO-NEW-TAPE
 
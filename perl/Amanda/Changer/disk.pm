@@ -107,6 +107,7 @@ sub new {
     $self->{'auto-create-slot'} = $config->get_boolean_property(
 					'auto-create-slot', 0);
     $self->{'removable'} = $config->get_boolean_property('removable', 0);
+    $self->{'dedup'} = $config->get_boolean_property('dedup', 0);
     $self->{'mount'} = $config->get_boolean_property('mount', 0);
     $self->{'umount'} = $config->get_boolean_property('umount', 0);
     $self->{'umount_lockfile'} = $config->get_property('umount-lockfile');
@@ -433,7 +434,7 @@ sub _make_res {
     my $res;
 
     my $slot_path = "$self->{'dir'}/slot$slot";
-    my $device_name = "file:$slot_path";
+    my $device_name = ($self->{'dedup'}? "dedup" : "file") . ":$slot_path";
     my $device = Amanda::Device->new($device_name);
     if ($device->status != $DEVICE_STATUS_SUCCESS) {
 	return $self->make_error("failed", $res_cb,
@@ -179,6 +179,7 @@ sub msg_PORT_WRITE {
         $self->{'chunk_size'} = $params{'chunk_size'};
         $self->{'progname'} = $params{'progname'};
         $self->{'use_bytes'} = $params{'use_bytes'};
+        $self->{'stream_flush'} = $params{'stream_flush'};
         $self->{'options'} = $params{'options'};
         $self->{'header'} = undef; # no header yet
         $self->{'cancelled'} = undef;
@@ -271,6 +272,7 @@ sub msg_PORT_WRITE {
 	    filename => $self->{'filename'},
 	    use_bytes => $self->{'use_bytes'},
 	    chunk_size => $self->{'chunk_size'},
+	    stream_flush => $self->{'stream_flush'},
             dump_cb => $dump_cb);
     };
 }
@@ -46,12 +46,12 @@ use constant START => message("START",
 
 use constant PORT_WRITE => message("PORT-WRITE",
     format => [ qw( handle filename hostname features diskname level datestamp
-	    chunk_size progname use_bytes options ) ],
+	    chunk_size progname use_bytes stream_flush options ) ],
 );
 
 use constant SHM_WRITE => message("SHM-WRITE",
     format => [ qw( handle filename hostname features diskname level datestamp
-	    chunk_size progname use_bytes options ) ],
+	    chunk_size progname use_bytes stream_flush options ) ],
 );
 
 use constant FAILED => message("FAILED",
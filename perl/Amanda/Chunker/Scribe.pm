@@ -136,11 +136,14 @@ All of this is supplied to the C<start_dump> method:
       filename => $filename,
       use_bytes => $use_bytes,
       chunk_size => $chunk_size,
+      stream_flush => $stream_flush,
       dump_cb => $dump_cb);
 
 The c<dump_header> here is the header that will be applied to all chunk of the
 dumpfile.  The only field in the header that the Scribe controls is the
-cont_filename.  The C<dump_cb> callback passed to C<start_dump> is called when the
+cont_filename.  Set C<stream_flush> if a taper reads the holding file while it
+is written; only then do the chunk headers carry the committed length it
+needs.  The C<dump_cb> callback passed to C<start_dump> is called when the
 dump is completely finished - either successfully or with a fatal error.
 Unlike most callbacks, this one takes keyword arguments, since it has so many
 parameters.
@@ -401,6 +404,9 @@ sub start_dump {
     $self->{'xfer'} = $params{'xfer'};
     $self->{'dump_start_time'} = time;
 
+    # a taper reads the holding file while we write it
+    $self->{'xdh'}->set_streaming() if $params{'stream_flush'};
+
     # and start the part
     $self->_start_chunk();
 }
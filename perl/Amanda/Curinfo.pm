@@ -97,6 +97,8 @@ sub local_message {
 	return "No info for host '$self->{'host'}' and disk '$self->{'disk'}'";
     } elsif ($self->{'code'} == 1300033) {
 	return "Info for host '$self->{'host'}' and disk '$self->{'disk'}'";
+    } elsif ($self->{'code'} == 1300034) {
+	return "$self->{'infofile'}: $self->{'error'}.";
     }
 }
 
@@ -114,6 +116,7 @@ use Amanda::Debug qw( :logging );
 use Amanda::Util qw( sanitise_filename );
 
 use Amanda::Curinfo::Info;
+use Amanda::Curinfo::Db;
 
 =head1 NAME
 
@@ -192,6 +195,11 @@ usage is the same as retrieving an info object.
 To create a new info object, please see the documentation for
 L<Amanda::Curinfo::Info>.
 
+When the C<infofile-format> of the configuration is C<binary>, the records
+are read from and written to the binary database in C<$infodir>, through
+L<Amanda::Curinfo::Db>; a disk that has no record there yet is read from its
+text file, as in the C library.
+
 =head1 SEE ALSO
 
 This module is meant to replicate the behavior of the library
@@ -218,6 +226,11 @@ sub new
 
     my $self = { infodir => $infodir };
 
+    my $format = getconf($CNF_INFOFILE_FORMAT);
+    if (defined $format && $format eq 'binary') {
+	$self->{'db'} = Amanda::Curinfo::Db->new($infodir);
+    }
+
     bless $self, $class;
     return $self;
 }
@@ -226,6 +239,12 @@ sub get_info
 {
     my ($self, $host, $disk) = @_;
 
+    if ($self->{'db'}) {
+	my $info = $self->{'db'}->get_info($host, $disk);
+	return $info if defined $info;
+	# not converted yet, read the text file
+    }
+
     my $infodir  = $self->{infodir};
     my $host_q   = sanitise_filename($host);
     my $disk_q   = sanitise_filename($disk);
@@ -250,6 +269,8 @@ sub put_info
 {
     my ($self, $host, $disk, $info) = @_;
 
+    return $self->{'db'}->put_info($host, $disk, $info) if $self->{'db'};
+
     my $infodir     = $self->{infodir};
     my $host_q      = sanitise_filename($host);
     my $disk_q      = sanitise_filename($disk);
@@ -311,6 +332,13 @@ sub del_info
     my $disk_q   = sanitise_filename($disk);
     my $infofile = "$infodir/$host_q/$disk_q/info";
 
+    if ($self->{'db'}) {
+	# the text file would be read back if it were left
+	unlink $infofile;
+	my $err = $self->{'db'}->del_info($host, $disk);
+	return !$err;
+    }
+
     return unlink $infofile;
 }
 
@@ -0,0 +1,562 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94085, or: http://www.zmanda.com
+
+package Amanda::Curinfo::Db;
+
+use strict;
+use warnings;
+use Fcntl qw( O_RDWR O_RDONLY O_CREAT O_TRUNC SEEK_SET );
+use IO::Handle;
+
+use Amanda::Debug qw( :logging );
+use Amanda::Util;
+use Amanda::Curinfo::Info;
+
+=head1 NAME
+
+Amanda::Curinfo::Db - access the binary curinfo database
+
+=head1 SYNOPSIS
+
+   use Amanda::Curinfo::Db;
+
+   my $db = Amanda::Curinfo::Db->new($infodir);
+   my $info = $db->get_info($host, $disk);
+   $db->put_info($host, $disk, $info);
+   $db->del_info($host, $disk);
+
+=head1 DESCRIPTION
+
+This module reads and writes F<curinfo.db> in C<$infodir>, the database used
+when C<infofile-format> is C<binary>.  It is used by L<Amanda::Curinfo>, and
+should not be needed directly.
+
+C<get_info> returns an L<Amanda::Curinfo::Info> object, C<undef> if the
+database has no record for that disk, or an C<Amanda::Message> on error.
+C<put_info> and C<del_info> return nothing on success, and an
+C<Amanda::Message> on error.  Each change is committed immediately.
+
+The file layout and the locking and commit protocol are those of the binary
+database in F<server-src/infofile.c>; see the comments there.
+
+=cut
+
+my $MAGIC = "AMINFODB";
+my $BOM = 0x01020304;
+my $VERSION = 1;
+my $PAGE = 4096;
+my $SLOT_SIZE = 8192;
+my $KEY_SIZE = 1024;
+my $MIN_BUCKETS = 1024;
+my $EMPTY = 0;
+my $DELETED = 0xffffffff;
+my $MAX_STATS = 23;
+my $NB_HISTORY = 100;
+my $DUMP_LEVELS = 400;
+
+my $HEADER_FORMAT = "a8 L8";
+my $HEADER_SIZE = 40;
+my @HEADER_FIELDS = qw( magic bom version slot_size nbuckets nslots nused
+			ndeleted free_head );
+
+# offsets in a record
+my $KEY_OFFSET = 128;
+my $HISTORY_OFFSET = 1152;
+my $HISTORY_SIZE = 40;
+my $STATS_OFFSET = 5152;
+my $STATS_SIZE = 128;
+
+sub new
+{
+    my ($class, $infodir) = @_;
+
+    my $filename = "$infodir/curinfo.db";
+    my $self = {
+	filename => $filename,
+	lock     => Amanda::Util::file_lock->new("$filename.lock"),
+    };
+
+    return bless $self, $class;
+}
+
+sub get_info
+{
+    my ($self, $host, $disk) = @_;
+
+    return undef if !-e $self->{'filename'};
+
+    my $err = $self->_lock(0);
+    return $err if $err;
+
+    my $result = eval {
+	$self->_open();
+	my ($bucket) = $self->_find("$host\0$disk");
+	return undef if !defined $bucket;
+	my $slot = $self->_read_bucket($bucket) - 1;
+	return $self->_record_to_info($self->_read($self->_slot_offset($slot),
+						  $SLOT_SIZE));
+    };
+    $err = $@;
+    $self->_close();
+    $self->{'lock'}->unlock();
+
+    return $self->_error($err) if $err;
+    return $result;
+}
+
+sub put_info
+{
+    my ($self, $host, $disk, $info) = @_;
+
+    my $record = $self->_info_to_record("$host\0$disk", $info);
+    return $record if ref $record;
+
+    return $self->_commit("$host\0$disk", $record);
+}
+
+sub del_info
+{
+    my ($self, $host, $disk) = @_;
+
+    return $self->_commit("$host\0$disk", undef);
+}
+
+# Write RECORD for KEY, or delete it if RECORD is undef
+sub _commit
+{
+    my ($self, $key, $record) = @_;
+
+    my $err = $self->_lock(1);
+    return $err if $err;
+
+    eval {
+	$self->_open(1);
+	my ($bucket, $free_bucket) = $self->_find($key);
+	my $hdr = $self->{'hdr'};
+
+	if (!defined $bucket && !defined $record) {
+	    return;
+	}
+
+	# keep the hash table at most half full
+	if (!defined $bucket &&
+	    ($hdr->{'nused'} + $hdr->{'ndeleted'} + 1) * 2 > $hdr->{'nbuckets'}) {
+	    $self->_build($hdr->{'nused'} + 1);
+	    $self->_open(1);
+	    ($bucket, $free_bucket) = $self->_find($key);
+	    $hdr = $self->{'hdr'};
+	}
+
+	# write the new record to a free slot
+	my $new_slot;
+	if (defined $record) {
+	    $self->_grow() if $hdr->{'free_head'} == 0;
+	    $new_slot = $hdr->{'free_head'} - 1;
+	    my $offset = $self->_slot_offset($new_slot);
+	    ($hdr->{'free_head'}) = unpack("L", $self->_read($offset + 4, 4));
+	    $self->_write($offset, $record);
+	    $self->_write_header();
+	    $self->{'fh'}->sync();
+	}
+
+	# switch the bucket to it
+	my $old_slot;
+	if (defined $bucket) {
+	    $old_slot = $self->_read_bucket($bucket) - 1;
+	    if (defined $record) {
+		$self->_write($PAGE + 4 * $bucket, pack("L", $new_slot + 1));
+	    } else {
+		$self->_write($PAGE + 4 * $bucket, pack("L", $DELETED));
+		$hdr->{'nused'}--;
+		$hdr->{'ndeleted'}++;
+	    }
+	} else {
+	    die "curinfo.db hash table is full" if !defined $free_bucket;
+	    $hdr->{'ndeleted'}-- if $self->_read_bucket($free_bucket) == $DELETED;
+	    $self->_write($PAGE + 4 * $free_bucket, pack("L", $new_slot + 1));
+	    $hdr->{'nused'}++;
+	}
+	$self->_write_header();
+	$self->{'fh'}->sync();
+
+	# and free the old record
+	if (defined $old_slot) {
+	    $self->_write($self->_slot_offset($old_slot),
+			  pack("L2", 0, $hdr->{'free_head'}));
+	    $hdr->{'free_head'} = $old_slot + 1;
+	    $self->_write_header();
+	}
+    };
+    $err = $@;
+    $self->_close();
+    $self->{'lock'}->unlock();
+
+    return $self->_error($err) if $err;
+    return;
+}
+
+sub _error
+{
+    my ($self, $err) = @_;
+
+    chomp $err;
+    debug("curinfo.db: $err");
+    return Amanda::Curinfo::Message->new(
+			source_filename => __FILE__,
+			source_line     => __LINE__,
+			code     => 1300034,
+			severity => $Amanda::Message::ERROR,
+			infofile => $self->{'filename'},
+			error    => $err);
+}
+
+sub _lock
+{
+    my ($self, $write) = @_;
+
+    # file_lock does not wait for the lock
+    my $rv;
+    while (($rv = $write ? $self->{'lock'}->lock_wr()
+			 : $self->{'lock'}->lock_rd()) == 1) {
+	select(undef, undef, undef, 0.01);
+    }
+    return $self->_error("could not lock $self->{'filename'}.lock: $!")
+	if $rv != 0;
+    return;
+}
+
+# open the database, creating it if $write, and read its header
+sub _open
+{
+    my ($self, $write) = @_;
+
+    my $fh;
+    if (!sysopen($fh, $self->{'filename'}, $write ? O_RDWR : O_RDONLY)) {
+	die "could not open $self->{'filename'}: $!" if !$write || !$!{ENOENT};
+	$self->_build(0);
+	sysopen($fh, $self->{'filename'}, O_RDWR)
+	    or die "could not open $self->{'filename'}: $!";
+    }
+    binmode $fh;
+    $self->{'fh'} = $fh;
+
+    my %hdr;
+    @hdr{@HEADER_FIELDS} = unpack($HEADER_FORMAT,
+				  $self->_read(0, $HEADER_SIZE));
+    if ($hdr{'magic'} ne $MAGIC || $hdr{'bom'} != $BOM ||
+	$hdr{'version'} != $VERSION || $hdr{'slot_size'} != $SLOT_SIZE ||
+	$hdr{'nbuckets'} == 0 || ($hdr{'nbuckets'} & ($hdr{'nbuckets'} - 1))) {
+	die "$self->{'filename'} is not a binary infofile of this version";
+    }
+    $self->{'hdr'} = \%hdr;
+}
+
+sub _close
+{
+    my $self = shift;
+
+    close $self->{'fh'} if $self->{'fh'};
+    delete $self->{'fh'};
+    delete $self->{'hdr'};
+}
+
+sub _read
+{
+    my ($self, $offset, $size) = @_;
+
+    my $data = '';
+    sysseek($self->{'fh'}, $offset, SEEK_SET)
+	or die "could not seek in $self->{'filename'}: $!";
+    while (length($data) < $size) {
+	my $n = sysread($self->{'fh'}, $data, $size - length($data),
+			length($data));
+	die "could not read $self->{'filename'}: $!" if !defined $n;
+	die "$self->{'filename'} is truncated" if $n == 0;
+    }
+    return $data;
+}
+
+sub _write
+{
+    my ($self, $offset, $data) = @_;
+
+    sysseek($self->{'fh'}, $offset, SEEK_SET)
+	or die "could not seek in $self->{'filename'}: $!";
+    my $done = 0;
+    while ($done < length($data)) {
+	my $n = syswrite($self->{'fh'}, $data, length($data) - $done, $done);
+	die "could not write $self->{'filename'}: $!" if !defined $n;
+	$done += $n;
+    }
+}
+
+sub _write_header
+{
+    my $self = shift;
+
+    $self->_write(0, pack($HEADER_FORMAT,
+			  @{$self->{'hdr'}}{@HEADER_FIELDS}));
+}
+
+sub _slots_offset
+{
+    my ($nbuckets) = @_;
+
+    my $size = $nbuckets * 4;
+    return $PAGE + int(($size + $PAGE - 1) / $PAGE) * $PAGE;
+}
+
+sub _slot_offset
+{
+    my ($self, $slot) = @_;
+
+    return _slots_offset($self->{'hdr'}->{'nbuckets'}) + $slot * $SLOT_SIZE;
+}
+
+sub _read_bucket
+{
+    my ($self, $bucket) = @_;
+
+    return unpack("L", $self->_read($PAGE + 4 * $bucket, 4));
+}
+
+# FNV-1a, as in infofile.c
+sub _hash
+{
+    my ($key) = @_;
+
+    my $h = 2166136261;
+    for my $c (unpack("C*", $key)) {
+	$h ^= $c;
+	# multiply by 16777619 (2**24 + 403) modulo 2**32
+	$h = ((($h << 24) & 0xffffffff) + $h * 403) & 0xffffffff;
+    }
+    return $h;
+}
+
+# return the bucket holding KEY, or (undef, the bucket where it goes)
+sub _find
+{
+    my ($self, $key) = @_;
+
+    my $hdr = $self->{'hdr'};
+    my $mask = $hdr->{'nbuckets'} - 1;
+    my $i = _hash($key) & $mask;
+    my $free_bucket;
+
+    for (my $n = 0; $n < $hdr->{'nbuckets'}; $n++, $i = ($i + 1) & $mask) {
+	my $b = $self->_read_bucket($i);
+	if ($b == $EMPTY) {
+	    $free_bucket = $i if !defined $free_bucket;
+	    last;
+	}
+	if ($b == $DELETED) {
+	    $free_bucket = $i if !defined $free_bucket;
+	    next;
+	}
+	next if $b > $hdr->{'nslots'};
+	my ($keylen) = unpack("L", $self->_read($self->_slot_offset($b - 1) + 28, 4));
+	next if $keylen != length($key);
+	return ($i) if $self->_read($self->_slot_offset($b - 1) + $KEY_OFFSET,
+				    $keylen) eq $key;
+    }
+
+    return (undef, $free_bucket);
+}
+
+# add free slots
+sub _grow
+{
+    my $self = shift;
+
+    my $hdr = $self->{'hdr'};
+    my $nslots = $hdr->{'nslots'};
+    my $nmore = int($nslots / 4) + 16;
+
+    truncate($self->{'fh'}, $self->_slot_offset($nslots + $nmore))
+	or die "could not extend $self->{'filename'}: $!";
+    for (my $i = $nslots + $nmore; $i > $nslots; $i--) {
+	$self->_write($self->_slot_offset($i - 1),
+		      pack("L2", 0, $hdr->{'free_head'}));
+	$hdr->{'free_head'} = $i;
+    }
+    $hdr->{'nslots'} = $nslots + $nmore;
+    $self->_write_header();
+}
+
+# write a new database with room for NRECORDS records, copy the records of
+# the open one (if any) to it, and rename it over the database.
+sub _build
+{
+    my ($self, $nrecords) = @_;
+
+    my $newfile = "$self->{'filename'}.new";
+    my $nbuckets = $MIN_BUCKETS;
+    $nbuckets *= 2 while $nbuckets < $nrecords * 4;
+
+    my @records;
+    if ($self->{'fh'}) {
+	my $old_hdr = $self->{'hdr'};
+	for my $i (0 .. $old_hdr->{'nbuckets'} - 1) {
+	    my $b = $self->_read_bucket($i);
+	    next if $b == $EMPTY || $b == $DELETED || $b > $old_hdr->{'nslots'};
+	    push @records, $self->_read($self->_slot_offset($b - 1), $SLOT_SIZE);
+	}
+	$self->_close();
+    }
+
+    my %hdr = (
+	magic     => $MAGIC,
+	bom       => $BOM,
+	version   => $VERSION,
+	slot_size => $SLOT_SIZE,
+	nbuckets  => $nbuckets,
+	nslots    => scalar(@records),
+	nused     => scalar(@records),
+	ndeleted  => 0,
+	free_head => 0,
+    );
+    my $buckets = "\0" x (_slots_offset($nbuckets) - $PAGE);
+    my $mask = $nbuckets - 1;
+    my $slot = 0;
+    for my $record (@records) {
+	my ($keylen) = unpack("L", substr($record, 28, 4));
+	my $i = _hash(substr($record, $KEY_OFFSET, $keylen)) & $mask;
+	$i = ($i + 1) & $mask while unpack("L", substr($buckets, 4 * $i, 4));
+	substr($buckets, 4 * $i, 4) = pack("L", ++$slot);
+	substr($record, 4, 4) = pack("L", 0);
+    }
+
+    my $fh;
+    sysopen($fh, $newfile, O_RDWR|O_CREAT|O_TRUNC, 0666)
+	or die "could not create $newfile: $!";
+    binmode $fh;
+    my $data = pack($HEADER_FORMAT, @hdr{@HEADER_FIELDS});
+    $data .= "\0" x ($PAGE - length($data));
+    $data .= $buckets;
+    for my $part ($data, @records) {
+	my $done = 0;
+	while ($done < length($part)) {
+	    my $n = syswrite($fh, $part, length($part) - $done, $done);
+	    die "could not write $newfile: $!" if !defined $n;
+	    $done += $n;
+	}
+    }
+    $fh->sync();
+    close $fh;
+    rename($newfile, $self->{'filename'})
+	or die "could not rename $newfile: $!";
+}
+
+sub _record_to_info
+{
+    my ($self, $record) = @_;
+
+    my ($in_use, $next_free, $command, $last_level, $consecutive_runs,
+	$nstats, $nhistory, $keylen, @perf) = unpack("L3 l2 L3 d12", $record);
+    die "corrupted record" if $nstats > $MAX_STATS || $nhistory > $NB_HISTORY;
+
+    my $info = Amanda::Curinfo::Info->new();
+    $info->{'command'} = $command;
+    $info->{'full'}->set_rate(@perf[0..2]);
+    $info->{'full'}->set_comp(@perf[3..5]);
+    $info->{'incr'}->set_rate(@perf[6..8]);
+    $info->{'incr'}->set_comp(@perf[9..11]);
+    $info->{'last_level'} = $last_level;
+    $info->{'consecutive_runs'} = $consecutive_runs;
+
+    for my $i (0 .. $nstats - 1) {
+	my ($level, $size, $csize, $secs, $date, $filenum, $label) =
+	    unpack("l x4 q5 Z80",
+		   substr($record, $STATS_OFFSET + $i * $STATS_SIZE, $STATS_SIZE));
+	die "corrupted record" if $level < 0 || $level >= $DUMP_LEVELS;
+	$info->{'inf'}[$level] = Amanda::Curinfo::Stats->new($level, $size,
+				    $csize, $secs, $date, $filenum, $label);
+    }
+
+    for my $i (0 .. $nhistory - 1) {
+	my ($level, $size, $csize, $date, $secs) =
+	    unpack("l x4 q4",
+		   substr($record, $HISTORY_OFFSET + $i * $HISTORY_SIZE,
+			  $HISTORY_SIZE));
+	push @{$info->{'history'}}, Amanda::Curinfo::History->new($level,
+				    $size, $csize, $date, $secs);
+    }
+
+    return $info;
+}
+
+sub _info_to_record
+{
+    my ($self, $key, $info) = @_;
+
+    return $self->_error("name too long for the binary infofile: $key")
+	if length($key) > $KEY_SIZE;
+
+    my @perf;
+    for my $perf ($info->{'full'}, $info->{'incr'}) {
+	for my $field ('rate', 'comp') {
+	    my @values = @{$perf->{$field} || []};
+	    push @perf, map { defined $values[$_] ? $values[$_] : -1 } 0 .. 2;
+	}
+    }
+
+    # same selection as write_txinfofile
+    my $stats = '';
+    my $nstats = 0;
+    for my $stat (@{$info->{'inf'}}) {
+	next if !defined $stat;
+	my $label = $stat->{'label'} || '';
+	next if $stat->{'date'} < 0 && $label eq '';
+	if ($nstats == $MAX_STATS) {
+	    return $self->_error("more than $MAX_STATS levels with stats do "
+			       . "not fit in the binary infofile");
+	}
+	$stats .= pack("l x4 q5 a80", $stat->{'level'}, $stat->{'size'},
+		       $stat->{'csize'}, int($stat->{'secs'}), $stat->{'date'},
+		       $stat->{'filenum'} || 0, substr($label, 0, 79));
+	$nstats++;
+    }
+
+    my $history = '';
+    my $nhistory = 0;
+    for my $hist (@{$info->{'history'}}) {
+	last if $nhistory == $NB_HISTORY || $hist->{'level'} < 0;
+	$history .= pack("l x4 q4", $hist->{'level'}, $hist->{'size'},
+			 $hist->{'csize'}, $hist->{'date'}, $hist->{'secs'});
+	$nhistory++;
+    }
+
+    my $last_level = $info->{'last_level'};
+    my $consecutive_runs = $info->{'consecutive_runs'};
+    $last_level = -1 if !defined $last_level;
+    $consecutive_runs = -1 if !defined $consecutive_runs;
+
+    my $record = pack("L3 l2 L3 d12 a$KEY_SIZE", 1, 0,
+		      ($info->{'command'} || 0) & 0xffffffff,
+		      $last_level, $consecutive_runs,
+		      $nstats, $nhistory, length($key), @perf, $key);
+    $record .= $history . "\0" x ($HISTORY_SIZE * $NB_HISTORY - length($history));
+    $record .= $stats . "\0" x ($STATS_SIZE * $MAX_STATS - length($stats));
+    $record .= "\0" x ($SLOT_SIZE - length($record));
+
+    return $record;
+}
+
+1;
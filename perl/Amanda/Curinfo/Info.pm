@@ -155,7 +155,8 @@ sub new
     };
 
     bless $self, $class;
-    my $err = $self->read_infofile($infofile) if -e $infofile;
+    my $err = $self->read_infofile($infofile)
+	if defined $infofile && -e $infofile;
     return $err if $err;
 
     return $self;
@@ -615,6 +615,18 @@ sub get_parts_and_dumps {
 	# get the raw contents from search_logfile, or use holding if
 	# $logfile is undef
 	if ($logfile ne 'holding') {
+	    # use the catalog index to skip logfiles that can't match at all
+	    next if (%hostnames_hash
+		and !_logfile_has("$logfile_dir/$logfile", 'hostname', \%hostnames_hash));
+	    next if (%disknames_hash
+		and !_logfile_has("$logfile_dir/$logfile", 'diskname', \%disknames_hash));
+	    next if (%levels_hash
+		and !_logfile_has("$logfile_dir/$logfile", 'level', \%levels_hash));
+	    next if (%dump_timestamps_hash
+		and !_logfile_has("$logfile_dir/$logfile", 'timestamp', \%dump_timestamps_hash));
+	    next if (%labels_hash
+		and !_logfile_has("$logfile_dir/$logfile", 'label', \%labels_hash));
+
 	    @find_results = Amanda::Logfile::search_logfile(undef, undef,
 							"$logfile_dir/$logfile", 1, 1);
 	    # convert to dumpfile hashes, including the write_timestamp from the logfile name
@@ -770,11 +782,11 @@ sub get_parts_and_dumps {
 	# if these dumps were on the holding disk, then we're done
 	next if $logfile eq 'holding';
 
-	# re-read the logfile to extract dump-level info that's not captured by
-	# search_logfile
-	my $logh = Amanda::Logfile::open_logfile("$logfile_dir/$logfile");
-	die "logfile '$logfile' not found" unless $logh;
-	while (my ($type, $prog, $str) = Amanda::Logfile::get_logline($logh)) {
+	# extract dump-level info that's not captured by search_logfile from
+	# the taper lines of the logfile, kept in its catalog index
+	die "logfile '$logfile' not found" unless -f "$logfile_dir/$logfile";
+	for my $line (Amanda::Logfile::search_logfile_taper_lines("$logfile_dir/$logfile")) {
+	    my ($type, $prog, $str) = @$line;
 	    next unless $prog == $P_TAPER;
 	    my $status;
 	    if ($type == $L_DONE) {
@@ -936,12 +948,22 @@ sub get_parts_and_dumps {
 		$dump->{'sec'} = $secs+0.0;
 	    }
 	}
-	Amanda::Logfile::close_logfile($logh);
     }
 
     return [ values %dumps], \@parts;
 }
 
+# return true if the logfile may have a dump with any of the keys of %$values
+# for $key, according to its catalog index
+sub _logfile_has {
+    my ($logfile, $key, $values) = @_;
+
+    for my $value (keys %$values) {
+	return 1 if Amanda::Logfile::logfile_index_has($logfile, $key, $value);
+    }
+    return 0;
+}
+
 sub get_parts {
     my ($dumps, $parts) = get_parts_and_dumps("parts", @_);
     return @$parts;
@@ -137,6 +137,7 @@ sub run {
 		'no-reassembly'         => $params{'no-reassembly'},
 		'pipe-fd'               => $params{'pipe-fd'} ? 1 : undef,
 		'restore'               => $params{'restore'},
+		'seek'                  => $params{'seek'},
 		'server-decompress'     => $params{'server-decompress'},
 		'server-decrypt'        => $params{'server-decrypt'},
 		'finished_cb'           => $params{'finished_cb'},
@@ -185,45 +185,54 @@ sub get_index_handle() {
     my $filename;
     my $need_uncompress;
     my $need_sort;
-    $filename = Amanda::Logfile::getindex_sorted_fname($params{'host'},
-						       $params{'disk'},
-						       $params{'datestamp'},
-						       0+$params{'level'});
+    $filename = Amanda::Logfile::getindex_sorted_idx_fname($params{'host'},
+							   $params{'disk'},
+							   $params{'datestamp'},
+							   0+$params{'level'});
     if (-f $filename) {
+	# written by the dumper, it reads as a sorted .gz file
+	$need_uncompress = 1;
     } else {
-	$filename = Amanda::Logfile::getindex_sorted_gz_fname(
-				$params{'host'},
-				$params{'disk'},
-				$params{'datestamp'},
-				0+$params{'level'});
+	$filename = Amanda::Logfile::getindex_sorted_fname($params{'host'},
+							   $params{'disk'},
+							   $params{'datestamp'},
+							   0+$params{'level'});
 	if (-f $filename) {
-	    $need_uncompress = 1;
 	} else {
-	    $filename = Amanda::Logfile::getindex_unsorted_fname(
-				$params{'host'},
-				$params{'disk'},
-				$params{'datestamp'},
-				0+$params{'level'});
+	    $filename = Amanda::Logfile::getindex_sorted_gz_fname(
+				    $params{'host'},
+				    $params{'disk'},
+				    $params{'datestamp'},
+				    0+$params{'level'});
 	    if (-f $filename) {
-		$need_sort = 1;
+		$need_uncompress = 1;
 	    } else {
-		$filename = Amanda::Logfile::getindex_unsorted_gz_fname(
-				$params{'host'},
-				$params{'disk'},
-				$params{'datestamp'},
-				0+$params{'level'});
+		$filename = Amanda::Logfile::getindex_unsorted_fname(
+				    $params{'host'},
+				    $params{'disk'},
+				    $params{'datestamp'},
+				    0+$params{'level'});
 		if (-f $filename) {
-		    $need_uncompress = 1;
 		    $need_sort = 1;
 		} else {
-		    $filename = Amanda::Logfile::getindexfname(
-				$params{'host'},
-				$params{'disk'},
-				$params{'datestamp'},
-				0+$params{'level'});
+		    $filename = Amanda::Logfile::getindex_unsorted_gz_fname(
+				    $params{'host'},
+				    $params{'disk'},
+				    $params{'datestamp'},
+				    0+$params{'level'});
 		    if (-f $filename) {
 			$need_uncompress = 1;
 			$need_sort = 1;
+		    } else {
+			$filename = Amanda::Logfile::getindexfname(
+				    $params{'host'},
+				    $params{'disk'},
+				    $params{'datestamp'},
+				    0+$params{'level'});
+			if (-f $filename) {
+			    $need_uncompress = 1;
+			    $need_sort = 1;
+			}
 		    }
 		}
 	    }
@@ -111,6 +111,13 @@ form the clerk.  See FEEDBACK, below.
 The C<scan> parameter must be an L<Amanda::Recovery::Scan> instance, which
 will be used to find the volumes required for the recovery.
 
+The optional C<prefetch> parameter gives an L<Amanda::Recovery::Prefetch>
+object, which reads parts from other volumes while the Clerk is busy with the
+current one.  The Clerk asks it where each part should be read from, and reads
+parts it has already copied from its spool rather than from their volume.  A
+prefetcher can also be given later, between transfers, with
+C<< $clerk->set_prefetch($prefetch) >>.
+
 =head2 TRANSFERRING A DUMPFILE
 
 Next, get a dump object and supply it to the Clerk to get a transfer source
@@ -213,6 +220,7 @@ sub new {
 
     my $self = {
 	scan => $params{'scan'},
+	prefetch => $params{'prefetch'},
 	debug => $debug,
 	feedback => $params{'feedback'}
 	    || Amanda::Recovery::Clerk::Feedback->new(),
@@ -221,6 +229,7 @@ sub new {
 	current_label => undef,
 	current_dev => undef,
 	current_res => undef,
+	current_spool => undef,
 
 	xfer_state => undef,
     };
@@ -228,6 +237,13 @@ sub new {
     return bless ($self, $class);
 }
 
+sub set_prefetch {
+    my $self = shift;
+    my ($prefetch) = @_;
+
+    $self->{'prefetch'} = $prefetch;
+}
+
 sub get_xfer_src {
     my $self = shift;
     my %params = @_;
@@ -248,6 +264,12 @@ sub get_xfer_src {
 	next_part_idx => 1,
 	next_part => undef,
 
+	# where next_part will be read from: its own volume, or a spool
+	located_part => undef,
+	next_label => undef,
+	next_filenum => undef,
+	next_spool => undef,
+
 	xfer_src => undef,
 	xfer => undef,
 	xfer_src_ready => 0,
@@ -350,7 +372,10 @@ sub quit {
     step release => sub {
 	# if we have a reservation, we need to release it; otherwise, we can
 	# just call finished_cb
-	if ($self->{'current_res'}) {
+	if ($self->{'current_spool'}) {
+	    $self->_release_spool();
+	    $finished_cb->();
+	} elsif ($self->{'current_res'}) {
 	    $self->{'current_dev'}->finish();
 	    $self->{'current_res'}->release(finished_cb => $finished_cb);
 	} else {
@@ -375,8 +400,8 @@ sub _xmsg_part_done {
     my ($src, $msg, $xfer) = @_;
     my $xfer_state = $self->{'xfer_state'};
 
-    my $next_label = $xfer_state->{'next_part'}->{'label'};
-    my $next_filenum = $xfer_state->{'next_part'}->{'filenum'};
+    my $next_label = $xfer_state->{'next_label'};
+    my $next_filenum = $xfer_state->{'next_filenum'};
 
     confess "read incorrect filenum $next_filenum != $msg->{'fileno'}"
 	unless $next_filenum == $msg->{'fileno'};
@@ -502,7 +527,6 @@ sub _maybe_start_part {
 	}
 
 	# find the correct part
-	my $next_label = $xfer_state->{'next_part'}->{'label'};
 	if (defined $xfer_state->{'xfer_src'}) {
 	    my $offset = $xfer_state->{'xfer_src'}->get_offset();
 	    if ($offset > 0) {
@@ -513,13 +537,55 @@ sub _maybe_start_part {
 		    $partnum++;
 		    $partsize = $xfer_state->{'dump'}->{'parts'}[$partnum]->{'kb'} * 1024
 		}
-		$next_label = $xfer_state->{'dump'}->{'parts'}[$partnum]->{'label'};
 		$xfer_state->{'next_part'} = $xfer_state->{'dump'}->{'parts'}[$partnum];
 		$xfer_state->{'next_part_idx'} = $partnum;
 		$xfer_state->{'xfer_src'}->set_offset($offset);
 	    }
 	}
 
+	return $steps->{'locate_part'}->();
+    };
+
+    step locate_part => sub {
+	# find out where to read this part from, unless we already know
+	if (defined $xfer_state->{'located_part'} and
+	    $xfer_state->{'located_part'} == $xfer_state->{'next_part'}) {
+	    return $steps->{'check_volume'}->();
+	}
+
+	if ($self->{'prefetch'}) {
+	    return $self->{'prefetch'}->locate_part(
+		    part => $xfer_state->{'next_part'},
+		    located_cb => $steps->{'located_part'});
+	}
+	return $steps->{'located_part'}->(undef, undef);
+    };
+
+    step located_part => sub {
+	my ($err, $spool) = @_;
+
+	if ($err) {
+	    push @{$xfer_state->{'errors'}}, "$err";
+	    return $steps->{'handle_error'}->();
+	}
+
+	# a spooled part is read from a copy, rather than from its volume
+	$xfer_state->{'located_part'} = $xfer_state->{'next_part'};
+	$xfer_state->{'next_spool'} = $spool;
+	if ($spool) {
+	    $xfer_state->{'next_label'} = $spool->{'label'};
+	    $xfer_state->{'next_filenum'} = $spool->{'filenum'};
+	} else {
+	    $xfer_state->{'next_label'} = $xfer_state->{'next_part'}->{'label'};
+	    $xfer_state->{'next_filenum'} = $xfer_state->{'next_part'}->{'filenum'};
+	}
+
+	return $steps->{'check_volume'}->();
+    };
+
+    step check_volume => sub {
+	my $next_label = $xfer_state->{'next_label'};
+
 	# same volume
 	if ($self->{'current_label'} and
 	     $self->{'current_label'} eq $next_label) {
@@ -537,6 +603,11 @@ sub _maybe_start_part {
     };
 
     step release => sub {
+	if ($self->{'current_spool'}) {
+	    $self->_release_spool();
+	    return $steps->{'released'}->();
+	}
+
 	if (!$self->{'current_res'}) {
 	    return $steps->{'released'}->();
 	}
@@ -558,14 +629,22 @@ sub _maybe_start_part {
 	    return $steps->{'handle_error'}->();
 	}
 
+	# the prefetcher may now use the volume
+	$self->{'prefetch'}->volume_released($self->{'current_label'})
+	    if $self->{'prefetch'} and defined $self->{'current_label'};
+
 	$self->{'on_vol_hdr'} = undef;
 	$self->{'current_dev'} = undef;
 	$self->{'current_res'} = undef;
 	$self->{'current_label'} = undef;
 
+	if ($xfer_state->{'next_spool'}) {
+	    return $steps->{'open_spool'}->();
+	}
+
 	# now load the next volume
 
-	my $next_label = $xfer_state->{'next_part'}->{'label'};
+	my $next_label = $xfer_state->{'next_label'};
 
 	$self->dbg("loading volume '$next_label'");
 	$self->{'scan'}->find_volume(label => $next_label,
@@ -575,7 +654,7 @@ sub _maybe_start_part {
     step loaded_label => sub {
 	my ($err, $res) = @_;
 
-	my $next_label = $xfer_state->{'next_part'}->{'label'};
+	my $next_label = $xfer_state->{'next_label'};
 
 	if ($err) {
 	    push @{$xfer_state->{'errors'}}, "$err";
@@ -624,9 +703,45 @@ sub _maybe_start_part {
 	});
     };
 
+    step open_spool => sub {
+	my $spool = $xfer_state->{'next_spool'};
+	my $err;
+
+	# spool devices are not in any changer, so open them directly
+	my $dev = Amanda::Device->new($spool->{'device_name'});
+	if ($dev->status != $DEVICE_STATUS_SUCCESS) {
+	    $err = $dev->error_or_status();
+	} else {
+	    if ($xfer_state->{'xfer_src'}
+		    and $xfer_state->{'xfer_src'}->isa("Amanda::Xfer::Source::Recovery")) {
+		$xfer_state->{'xfer_src'}->use_device($dev);
+	    }
+	    if (!$dev->start($Amanda::Device::ACCESS_READ, undef, undef)) {
+		$err = $dev->error_or_status();
+	    } elsif ($dev->volume_label ne $spool->{'label'}) {
+		$err = "expected volume label '$spool->{label}', but found volume " .
+		       "label '" . $dev->volume_label . "'";
+	    }
+	}
+
+	if ($err) {
+	    push @{$xfer_state->{'errors'}}, "$err";
+	    return $steps->{'handle_error'}->();
+	}
+
+	$self->dbg("reading '$xfer_state->{next_part}->{label}' file " .
+		   "$xfer_state->{next_part}->{filenum} from $spool->{device_name}");
+	$self->{'on_vol_hdr'} = undef;
+	$self->{'current_dev'} = $dev;
+	$self->{'current_spool'} = $spool;
+	$self->{'current_label'} = $dev->volume_label;
+
+	return $steps->{'seek_and_check'}->();
+    };
+
     step seek_and_check => sub {
-	my $next_label = $xfer_state->{'next_part'}->{'label'};
-	my $next_filenum = $xfer_state->{'next_part'}->{'filenum'};
+	my $next_label = $xfer_state->{'next_label'};
+	my $next_filenum = $xfer_state->{'next_filenum'};
 	my $dev = $self->{'current_dev'};
 	if (!$self->{'on_vol_hdr'} || $self->{'previous_filenum'} != $next_filenum) {
 	    $self->{'on_vol_hdr'} = $dev->seek_file($next_filenum);
@@ -659,8 +774,10 @@ sub _maybe_start_part {
 
 	} else {
 	    $self->{'current_part'} = $xfer_state->{'next_part'};
-	    # notify caller of the part
-	    $self->{'feedback'}->clerk_notif_part($next_label, $next_filenum, $self->{'on_vol_hdr'});
+	    # notify caller of the part, by its place on the original volume
+	    $self->{'feedback'}->clerk_notif_part($xfer_state->{'next_part'}->{'label'},
+						  $xfer_state->{'next_part'}->{'filenum'},
+						  $self->{'on_vol_hdr'});
 
 	    return $steps->{'seek_record'}->();
 	}
@@ -683,8 +800,8 @@ sub _maybe_start_part {
 	}
 
 	# start the part
-	my $next_label = $xfer_state->{'next_part'}->{'label'};
-	my $next_filenum = $xfer_state->{'next_part'}->{'filenum'};
+	my $next_label = $xfer_state->{'next_label'};
+	my $next_filenum = $xfer_state->{'next_filenum'};
 	$self->dbg("reading file $next_filenum on '$next_label'");
 	$xfer_state->{'xfer_src'}->start_part($self->{'current_dev'});
 
@@ -759,6 +876,10 @@ sub close_volume {
     my $self = shift;
     my %params = @_;
 
+    if ($self->{'current_spool'}) {
+	$self->_release_spool();
+    }
+
     if (!$self->{'current_res'}) {
 	$params{'close_volume_cb'}->();
 	return;
@@ -767,6 +888,8 @@ sub close_volume {
     $self->{'current_dev'}->finish();
     $self->{'current_res'}->release(
 		finished_cb => sub {
+			$self->{'prefetch'}->volume_released($self->{'current_label'})
+			    if $self->{'prefetch'};
 			$self->{'on_vol_hdr'} = undef;
 			$self->{'current_dev'} = undef;
 			$self->{'current_res'} = undef;
@@ -776,6 +899,18 @@ sub close_volume {
     );
 }
 
+# finish with the spooled copy of a part
+sub _release_spool {
+    my $self = shift;
+
+    $self->{'current_dev'}->finish();
+    $self->{'prefetch'}->release_spool($self->{'current_spool'});
+    $self->{'on_vol_hdr'} = undef;
+    $self->{'current_dev'} = undef;
+    $self->{'current_spool'} = undef;
+    $self->{'current_label'} = undef;
+}
+
 sub _zeropad {
     my ($timestamp) = @_;
     if (length($timestamp) == 8) {
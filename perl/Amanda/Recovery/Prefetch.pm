@@ -0,0 +1,653 @@
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+# License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this library; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA.
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+package Amanda::Recovery::Prefetch;
+
+use strict;
+use warnings;
+use Carp;
+use File::Path;
+
+use Amanda::Xfer qw( :constants );
+use Amanda::Device qw( :constants );
+use Amanda::Debug qw( :logging );
+use Amanda::MainLoop;
+use Amanda::Util;
+
+=head1 NAME
+
+Amanda::Recovery::Prefetch - read the parts of a recovery from several volumes
+at once
+
+=head1 SYNOPSIS
+
+    my $prefetch = Amanda::Recovery::Prefetch->new(
+	dumps => $plan->{'dumps'},
+	streams => getconf($CNF_RESTORE_STREAMS),
+	spool_dir => "$tmpdir/restore-spool-$$",
+	spool_size => getconf($CNF_RESTORE_SPOOL_SIZE) * 1024,
+	get_chg => sub { my ($storage_name) = @_; return $chg; });
+
+    my $clerk = Amanda::Recovery::Clerk->new(
+	scan => $scan,
+	prefetch => $prefetch);
+
+    # ... use the clerk as usual ...
+
+    $clerk->quit(finished_cb => sub {
+	$prefetch->quit(finished_cb => $finished_cb);
+    });
+
+=head1 OVERVIEW
+
+A L<Amanda::Recovery::Clerk> reads the parts of a dump one after the other,
+loading each volume as it gets to it.  When the parts of a recovery are spread
+over several volumes -- a split dump, or a chain of dumps of the same DLE at
+different levels -- each volume sits idle until the clerk reaches it.
+
+A Prefetch object runs up to C<streams - 1> extra readers ("streams"), each
+with its own reservation, on the volumes that the clerk is I<not> reading.  A
+stream copies one part at a time from its volume into a single-file vtape in
+C<spool_dir>, and the clerk then reads that part from the spool instead of from
+the original volume.  So the spool is the reorder buffer: parts are read in
+whatever order the volumes allow, and are given to the clerk in the order of
+the plan.
+
+Each stream keeps at most one copied part waiting for the clerk, in addition to
+the one it is copying, so the spool never holds more than two parts per stream.
+A stream works through all of the wanted parts on a volume, in plan order,
+before moving on to the volume holding the earliest part nobody is reading yet.
+
+The spool is also limited in size.  A part is only copied if its size, from the
+catalog, fits in C<spool_size> bytes along with the parts already in the spool,
+and if the filesystem holding C<spool_dir> has room for it.  A part that could
+never fit, or whose size is not known, is left on its volume.  A part that does
+not fit yet waits until the clerk has consumed earlier parts.
+
+The clerk never waits for a copy.  When it gets to a part that has not been
+completely copied yet, the stream holding that volume stops copying and
+releases the volume, and the clerk reads the part from the volume.
+
+Streams are an optimization only.  If a stream cannot load a volume (for
+example, because the changer has no free drive), or a copy fails, the parts
+involved are left to the clerk, which reads them from the volume as it would
+without a Prefetch object, with the usual error handling and interactivity.
+
+=head1 INTERFACE
+
+The constructor takes the list of dumps that will be recovered, in order, and a
+C<get_chg> sub which returns the changer for a storage name.  C<spool_size> is
+the most the spool may hold, in bytes; 0 means that it is only limited by the
+free space in C<spool_dir>.  Holding-disk parts are ignored.  Streams are only started if the parts are on more than one
+volume.
+
+The clerk calls C<locate_part> for each part before reading it:
+
+    $prefetch->locate_part(
+	part => $part,
+	located_cb => $located_cb);
+
+which calls C<< $located_cb->(undef, $spool) >> if the part has been copied
+to the spool, or C<< $located_cb->(undef, undef) >> if the clerk should read it
+from its volume.  In the former case, C<$spool> is a hash with keys
+C<device_name>, C<label> and C<filenum> giving the location of the copy; the
+clerk calls C<release_spool($spool)> once it is done with that device.  In the
+latter case, the part's volume is reserved for the clerk until the clerk calls
+C<volume_released($label)>.
+
+C<quit> cancels the streams, releases their volumes, and removes
+C<spool_dir>:
+
+    $prefetch->quit(finished_cb => $finished_cb);
+
+=cut
+
+sub new {
+    my $class = shift;
+    my %params = @_;
+
+    for my $rq_param (qw(dumps get_chg spool_dir)) {
+	croak "required parameter '$rq_param' missing"
+	    unless exists $params{$rq_param};
+    }
+
+    my $self = bless {
+	get_chg => $params{'get_chg'},
+	spool_dir => $params{'spool_dir'},
+	spool_size => $params{'spool_size'} || 0,
+	spool_used => 0,
+	debug => $Amanda::Config::debug_recovery,
+
+	entries => [],
+	entry_by_part => {},
+
+	# volumes the clerk has, or is about to load, and volumes the streams
+	# have given up on
+	main_labels => {},
+	failed_labels => {},
+
+	workers => [],
+	waiter => undef,
+	quit_cb => undef,
+    }, $class;
+
+    my %labels;
+    for my $dump (@{$params{'dumps'}}) {
+	for my $part (@{$dump->{'parts'}}) {
+	    next unless defined $part; # skip parts[0]
+	    next unless defined $part->{'label'}; # skip holding parts
+	    my $entry = {
+		idx => scalar @{$self->{'entries'}},
+		part => $part,
+		label => $part->{'label'},
+		storage => $part->{'storage'} || $dump->{'storage'},
+		size => (defined $part->{'kb'} and $part->{'kb'} > 0)?
+			    $part->{'kb'} * 1024 : undef,
+		state => 'pending',
+	    };
+	    push @{$self->{'entries'}}, $entry;
+	    $self->{'entry_by_part'}->{$part} = $entry;
+	    $labels{$part->{'label'}} = 1;
+	}
+    }
+
+    # the clerk starts with the first volume
+    $self->{'main_labels'}->{$self->{'entries'}->[0]->{'label'}} = 1
+	if @{$self->{'entries'}};
+
+    my $nworkers = ($params{'streams'} || 1) - 1;
+    $nworkers = keys(%labels) - 1 if $nworkers > keys(%labels) - 1;
+    if ($nworkers > 0) {
+	if (!-d $self->{'spool_dir'} and !mkdir($self->{'spool_dir'}, 0700)) {
+	    warning("Can't create restore spool directory '$self->{spool_dir}': $!; " .
+		    "reading one volume at a time");
+	    $nworkers = 0;
+	}
+    }
+
+    for my $i (1 .. $nworkers) {
+	push @{$self->{'workers'}}, {
+	    name => "stream $i",
+	    busy => 0,
+	    dead => 0,
+	    label => undef,
+	    res => undef,
+	    dev => undef,
+	    xfer => undef,
+	    unclaimed => undef,
+	};
+    }
+    $self->dbg(scalar(@{$self->{'entries'}}) . " parts on " . keys(%labels) .
+	       " volumes, $nworkers extra streams");
+
+    $self->_kick_workers();
+
+    return $self;
+}
+
+sub locate_part {
+    my $self = shift;
+    my %params = @_;
+
+    for my $rq_param (qw(part located_cb)) {
+	croak "required parameter '$rq_param' missing"
+	    unless exists $params{$rq_param};
+    }
+
+    my $entry = $self->{'entry_by_part'}->{$params{'part'}};
+    if (!$entry or !@{$self->{'workers'}}) {
+	if ($entry) {
+	    $entry->{'state'} = 'direct';
+	    $self->{'main_labels'}->{$entry->{'label'}} = 1;
+	}
+	return $params{'located_cb'}->(undef, undef);
+    }
+
+    # the clerk reads in order, so anything before this part was skipped
+    for my $e (@{$self->{'entries'}}[0 .. $entry->{'idx'} - 1]) {
+	$self->_skip_entry($e);
+    }
+
+    confess "Prefetch is already waiting for a part" if $self->{'waiter'};
+    $self->{'waiter'} = { entry => $entry, located_cb => $params{'located_cb'} };
+    $self->_kick_workers();
+}
+
+sub release_spool {
+    my $self = shift;
+    my ($spool) = @_;
+
+    my $entry = $spool->{'entry'};
+    $self->dbg("done with the copy of '$entry->{label}' file $entry->{part}->{filenum}");
+    $self->_spool_remove($entry, $spool->{'dir'});
+    $entry->{'state'} = 'done';
+    $self->_kick_workers();
+}
+
+sub volume_released {
+    my $self = shift;
+    my ($label) = @_;
+
+    delete $self->{'main_labels'}->{$label};
+    $self->_kick_workers();
+}
+
+sub quit {
+    my $self = shift;
+    my %params = @_;
+
+    $self->{'quit_cb'} = $params{'finished_cb'};
+    $self->{'waiter'} = undef;
+    for my $w (@{$self->{'workers'}}) {
+	$w->{'xfer'}->cancel() if $w->{'xfer'};
+    }
+    $self->_kick_workers();
+}
+
+# check whether the part the clerk is waiting for can be had yet
+sub _check_waiter {
+    my $self = shift;
+    my $waiter = $self->{'waiter'};
+    return unless $waiter;
+
+    my $entry = $waiter->{'entry'};
+    my $state = $entry->{'state'};
+
+    if ($state eq 'spooled' or $state eq 'reading') {
+	if ($entry->{'worker'} and $entry->{'worker'}->{'unclaimed'} and
+	    $entry->{'worker'}->{'unclaimed'} == $entry) {
+	    $entry->{'worker'}->{'unclaimed'} = undef;
+	}
+	$entry->{'state'} = 'reading';
+	$self->{'waiter'} = undef;
+	$self->dbg("part '$entry->{label}' file $entry->{part}->{filenum} comes from " .
+		   $entry->{'spool'}->{'device_name'});
+	# the stream that copied it may go on to the next part
+	$self->_worker_done();
+	return $waiter->{'located_cb'}->(undef, $entry->{'spool'});
+    }
+
+    # the clerk reads anything else from the volume; if a stream has that
+    # volume, take it back rather than waiting for a copy.  _worker_next
+    # releases it once the stream is idle.
+    my $held_by = $self->_worker_holding($entry->{'label'});
+    if ($held_by) {
+	if ($held_by->{'xfer'} and !$held_by->{'yielding'}) {
+	    $self->dbg("$held_by->{name}: giving volume '$entry->{label}' to the clerk");
+	    $held_by->{'yielding'} = 1;
+	    $held_by->{'xfer'}->cancel();
+	}
+	return;
+    }
+
+    $entry->{'state'} = 'direct';
+    $self->{'main_labels'}->{$entry->{'label'}} = 1;
+    $self->{'waiter'} = undef;
+    return $waiter->{'located_cb'}->(undef, undef);
+}
+
+sub _skip_entry {
+    my $self = shift;
+    my ($entry) = @_;
+
+    if ($entry->{'state'} eq 'pending') {
+	$entry->{'state'} = 'skipped';
+    } elsif ($entry->{'state'} eq 'spooled') {
+	$entry->{'worker'}->{'unclaimed'} = undef
+	    if $entry->{'worker'}->{'unclaimed'} and
+	       $entry->{'worker'}->{'unclaimed'} == $entry;
+	$self->_spool_remove($entry, $entry->{'spool'}->{'dir'});
+	$entry->{'state'} = 'skipped';
+    } elsif ($entry->{'state'} eq 'spooling') {
+	$entry->{'skip'} = 1;
+    }
+}
+
+# remove the copy of ENTRY in DIR, and give its space back
+sub _spool_remove {
+    my $self = shift;
+    my ($entry, $dir) = @_;
+
+    rmtree($dir);
+    $self->{'spool_used'} -= $entry->{'spool_bytes'} if $entry->{'spool_bytes'};
+    $entry->{'spool_bytes'} = 0;
+    $entry->{'spool'} = undef;
+}
+
+# can ENTRY ever be copied to the spool?
+sub _spoolable {
+    my $self = shift;
+    my ($entry) = @_;
+
+    return 0 if $entry->{'nospool'};
+    return 0 unless defined $entry->{'size'};
+    return 0 if $self->{'spool_size'} and $entry->{'size'} > $self->{'spool_size'};
+    return 1;
+}
+
+sub _worker_holding {
+    my $self = shift;
+    my ($label) = @_;
+
+    for my $w (@{$self->{'workers'}}) {
+	return $w if !$w->{'dead'} and $w->{'label'} and $w->{'label'} eq $label;
+    }
+    return undef;
+}
+
+sub _kick_workers {
+    my $self = shift;
+
+    $self->_check_waiter();
+    for my $w (@{$self->{'workers'}}) {
+	$self->_worker_next($w);
+    }
+
+    if ($self->{'quit_cb'} and !grep { !$_->{'dead'} } @{$self->{'workers'}}) {
+	my $quit_cb = $self->{'quit_cb'};
+	$self->{'quit_cb'} = undef;
+	$self->{'workers'} = [];
+	rmtree($self->{'spool_dir'}) if -d $self->{'spool_dir'};
+	$quit_cb->();
+    }
+}
+
+# choose the next part for stream W to copy, or undef if it should wait
+sub _pick_entry {
+    my $self = shift;
+    my ($w) = @_;
+
+    # only one copy may wait for the clerk, unless the clerk needs an earlier one
+    my $limit = $w->{'unclaimed'}? $w->{'unclaimed'}->{'idx'}
+				  : scalar @{$self->{'entries'}};
+
+    my $picked;
+    for my $entry (@{$self->{'entries'}}[0 .. $limit - 1]) {
+	next unless $entry->{'state'} eq 'pending' and $self->_spoolable($entry);
+	my $label = $entry->{'label'};
+
+	# keep going on our own volume
+	if ($w->{'label'} and $label eq $w->{'label'}) {
+	    $picked = $entry;
+	    last;
+	}
+    }
+
+    # start on the volume of the earliest part nobody is reading
+    if (!$picked) {
+	for my $entry (@{$self->{'entries'}}[0 .. $limit - 1]) {
+	    next unless $entry->{'state'} eq 'pending' and $self->_spoolable($entry);
+	    my $label = $entry->{'label'};
+	    next if $self->{'main_labels'}->{$label};
+	    next if $self->{'failed_labels'}->{$label};
+	    next if $self->_worker_holding($label);
+	    $picked = $entry;
+	    last;
+	}
+    }
+
+    # wait for the clerk to free some of the spool
+    return undef if $picked and $self->{'spool_size'} and
+		    $self->{'spool_used'} + $picked->{'size'} > $self->{'spool_size'};
+
+    return $picked;
+}
+
+sub _has_pending {
+    my $self = shift;
+    my ($label) = @_;
+
+    return grep { $_->{'state'} eq 'pending' and $_->{'label'} eq $label and
+		  $self->_spoolable($_) }
+		@{$self->{'entries'}};
+}
+
+sub _worker_next {
+    my $self = shift;
+    my ($w) = @_;
+
+    return if $w->{'busy'} or $w->{'dead'};
+
+    if ($self->{'quit_cb'}) {
+	return $self->_worker_release($w, 1);
+    }
+
+    # the clerk wants this volume
+    if ($w->{'res'} and $self->{'waiter'} and
+	$self->{'waiter'}->{'entry'}->{'label'} eq $w->{'label'}) {
+	return $self->_worker_release($w, 0);
+    }
+
+    my $entry = $self->_pick_entry($w);
+
+    if ($w->{'res'} and (!$entry or $entry->{'label'} ne $w->{'label'})) {
+	# let go of this volume, so the clerk or another stream can use it,
+	# unless there is more to do here once the clerk catches up
+	return if !$entry and $self->_has_pending($w->{'label'});
+	return $self->_worker_release($w, 0);
+    }
+
+    return unless $entry;
+
+    if ($w->{'res'}) {
+	return $self->_worker_spool($w, $entry);
+    } else {
+	return $self->_worker_load($w, $entry);
+    }
+}
+
+sub _worker_load {
+    my $self = shift;
+    my ($w, $entry) = @_;
+    my $label = $entry->{'label'};
+
+    my $chg = $self->{'get_chg'}->($entry->{'storage'});
+    if (!$chg or $chg->isa("Amanda::Changer::Error")) {
+	$self->{'failed_labels'}->{$label} = 1;
+	return $self->_worker_done();
+    }
+
+    $self->dbg("$w->{name}: loading volume '$label'");
+    $w->{'busy'} = 1;
+    $w->{'label'} = $label;
+    $chg->load(label => $label, res_cb => sub {
+	my ($err, $res) = @_;
+
+	if (!$err) {
+	    my $dev = $res->{'device'};
+	    if (!$dev->start($ACCESS_READ, undef, undef)) {
+		$err = $dev->error_or_status();
+	    } elsif ($dev->volume_label ne $label) {
+		$err = "expected volume label '$label', but found volume " .
+		       "label '" . $dev->volume_label . "'";
+	    } else {
+		$w->{'res'} = $res;
+		$w->{'dev'} = $dev;
+		$w->{'busy'} = 0;
+		return $self->_worker_done();
+	    }
+	    return $res->release(finished_cb => sub {
+		$self->_worker_load_failed($w, $label, $err, 0);
+	    });
+	}
+
+	# without a free drive, this stream is of no use
+	my $fatal = (ref $err and ($err->{'reason'} || '') eq 'driveinuse');
+	$self->_worker_load_failed($w, $label, $err, $fatal);
+    });
+}
+
+sub _worker_load_failed {
+    my $self = shift;
+    my ($w, $label, $err, $fatal) = @_;
+
+    $self->dbg("$w->{name}: can't use volume '$label': $err");
+    $self->{'failed_labels'}->{$label} = 1;
+    $w->{'label'} = undef;
+    $w->{'busy'} = 0;
+    $w->{'dead'} = 1 if $fatal;
+    $self->_worker_done();
+}
+
+sub _worker_release {
+    my $self = shift;
+    my ($w, $quitting) = @_;
+
+    if (!$w->{'res'}) {
+	$w->{'label'} = undef;
+	$w->{'dead'} = 1 if $quitting;
+	return;
+    }
+
+    $self->dbg("$w->{name}: releasing volume '$w->{label}'");
+    $w->{'busy'} = 1;
+    $w->{'dev'}->finish();
+    $w->{'res'}->release(finished_cb => sub {
+	my ($err) = @_;
+	warning("$err") if $err;
+
+	$w->{'res'} = undef;
+	$w->{'dev'} = undef;
+	$w->{'label'} = undef;
+	$w->{'busy'} = 0;
+	$w->{'dead'} = 1 if $quitting;
+	$self->_worker_done();
+    });
+}
+
+sub _worker_spool {
+    my $self = shift;
+    my ($w, $entry) = @_;
+    my $dev = $w->{'dev'};
+    my $filenum = $entry->{'part'}->{'filenum'};
+    my $dir = "$self->{spool_dir}/part-$entry->{idx}";
+    my $spool_label = "RESTORE-SPOOL-$entry->{idx}";
+    my $spool_dev;
+    my $err;
+
+    # the size in the catalog is rounded to a kilobyte, so leave some slack
+    my $fsusage = Amanda::Util::get_fs_usage($self->{'spool_dir'});
+    my $avail = $fsusage? $fsusage->{'blocksize'} * $fsusage->{'bavail'} : 0;
+    if ($avail < $entry->{'size'} + 1024*1024) {
+	$self->dbg("$w->{name}: only $avail bytes free in '$self->{spool_dir}'; " .
+		   "leaving '$entry->{label}' file $filenum on the volume");
+	$entry->{'nospool'} = 1;
+	return $self->_worker_done();
+    }
+
+    $entry->{'state'} = 'spooling';
+    $entry->{'worker'} = $w;
+    $entry->{'spool_bytes'} = $entry->{'size'};
+    $self->{'spool_used'} += $entry->{'size'};
+
+    my $hdr = $dev->seek_file($filenum);
+    if (!$hdr) {
+	$err = $dev->error_or_status();
+    } elsif (!-d $dir and !mkdir($dir, 0700)) {
+	$err = "Can't create '$dir': $!";
+    } else {
+	$spool_dev = Amanda::Device->new("file:$dir");
+	if ($spool_dev->status != $DEVICE_STATUS_SUCCESS) {
+	    $err = $spool_dev->error_or_status();
+	} elsif (!$spool_dev->start($ACCESS_WRITE, $spool_label, "X") or
+		 !$spool_dev->start_file($hdr)) {
+	    $err = $spool_dev->error_or_status();
+	}
+    }
+    if ($err) {
+	$spool_dev->finish() if $spool_dev;
+	return $self->_worker_spool_done($w, $entry, $dir, undef, [ "$err" ]);
+    }
+
+    $self->dbg("$w->{name}: copying '$entry->{label}' file $filenum to '$dir'");
+    my @errors;
+    my $xfer = Amanda::Xfer->new([
+	    Amanda::Xfer::Source::Device->new($dev),
+	    Amanda::Xfer::Dest::Device->new($spool_dev, 0) ]);
+    $w->{'busy'} = 1;
+    $w->{'xfer'} = $xfer;
+    $xfer->start(sub {
+	my ($src, $msg, $xfer) = @_;
+
+	if ($msg->{'type'} == $XMSG_ERROR) {
+	    push @errors, $msg->{'message'};
+	} elsif ($msg->{'type'} == $XMSG_DONE) {
+	    push @errors, "cancelled" if $self->{'quit_cb'} or $w->{'yielding'};
+	    $w->{'xfer'} = undef;
+	    $w->{'busy'} = 0;
+	    $spool_dev->finish();
+	    $self->_worker_spool_done($w, $entry, $dir,
+		    { device_name => "file:$dir",
+		      label => $spool_label,
+		      filenum => 1,
+		      dir => $dir,
+		      entry => $entry },
+		    \@errors);
+	}
+    });
+}
+
+sub _worker_spool_done {
+    my $self = shift;
+    my ($w, $entry, $dir, $spool, $errors) = @_;
+
+    if ($w->{'yielding'}) {
+	# the clerk took this volume back; _worker_next releases it
+	$w->{'yielding'} = 0;
+	$self->_spool_remove($entry, $dir);
+	$entry->{'state'} = $entry->{'skip'}? 'skipped' : 'pending';
+	return $self->_worker_done();
+    }
+
+    if (@$errors) {
+	# leave the part, and the rest of this volume, to the clerk
+	$self->dbg("$w->{name}: copying '$entry->{label}' file " .
+		   "$entry->{part}->{filenum} failed: " . join("; ", @$errors));
+	$self->_spool_remove($entry, $dir);
+	$entry->{'state'} = $entry->{'skip'}? 'skipped' : 'pending';
+	$self->{'failed_labels'}->{$entry->{'label'}} = 1;
+	return $self->_worker_release($w, 0);
+    }
+
+    if ($entry->{'skip'}) {
+	$self->_spool_remove($entry, $dir);
+	$entry->{'state'} = 'skipped';
+    } else {
+	$entry->{'state'} = 'spooled';
+	$entry->{'spool'} = $spool;
+	$w->{'unclaimed'} = $entry;
+    }
+    $self->_worker_done();
+}
+
+# resume the streams from the main loop, rather than recursing
+sub _worker_done {
+    my $self = shift;
+
+    Amanda::MainLoop::call_later(sub { $self->_kick_workers(); });
+}
+
+sub dbg {
+    my ($self, $msg) = @_;
+    if ($self->{'debug'}) {
+	debug("Amanda::Recovery::Prefetch: $msg");
+    }
+}
+
+1;
@@ -61,6 +61,7 @@ Amanda::Restore -- interface to restore backup
                 'no-reassembly'         => $params{'no-reassembly'},
                 'pipe-fd'               => $params{'pipe-fd'} ? 1 : undef,
                 'restore'               => $params{'restore'},
+                'seek'                  => $params{'seek'},
                 'server-decompress'     => $params{'server-decompress'},
                 'server-decrypt'        => $params{'server-decrypt'},
                 'finished_cb'           => $params{'finished_cb'},
@@ -182,6 +183,15 @@ Reserve the tapes needed for the restore
 Set to 0 to not do the restore, undef will do the restore.
 use with 'init'.
 
+=head2 seek
+
+Start the restore at the compressed block holding this byte of the
+uncompressed image, instead of at the start of the image.  The dump must be
+on holding disk and compressed in blocks, with a seek table (see
+compress-threads in amanda.conf(5)); the output starts at the beginning of
+that block, whose offset is reported.  The CRC of a partial restore are not
+checked.
+
 =head2 server-decompress
 
 Decompress only if it is server compressed
@@ -437,6 +447,12 @@ sub local_message {
 	return "Storage $self->{'storage'} have no changer";
     } elsif ($self->{'code'} == 4900068) {
 	return "$self->{'msg'}";
+    } elsif ($self->{'code'} == 4900069) {
+	return "'seek' needs a dump on holding disk";
+    } elsif ($self->{'code'} == 4900070) {
+	return "Can't seek to byte $self->{'offset'}: $self->{'errmsg'}";
+    } elsif ($self->{'code'} == 4900071) {
+	return "Restoring from byte $self->{'uncomp_offset'} of the image, at byte $self->{'comp_offset'} of the holding file";
     } else {
 	return "No mesage for code '$self->{'code'}'";
     }
@@ -482,6 +498,7 @@ use Amanda::Cmdfile;
 use Amanda::Xfer qw( :constants );
 use Amanda::Recovery::Planner;
 use Amanda::Recovery::Clerk;
+use Amanda::Recovery::Prefetch;
 use Amanda::Recovery::Scan;
 use Amanda::Extract;
 use Amanda::Feature;
@@ -941,6 +958,8 @@ sub restore {
     my %scan;
     my $clerk;
     my %clerk;
+    my $prefetch;
+    my $prefetch_checked = 0;
     my %storage;
     my $interactivity;
     my $source_crc;
@@ -962,6 +981,7 @@ sub restore {
     my $xfer;
     my $use_dar = 0;
     my $xfer_waiting_dar = 0;
+    my $seek_offset;
 
     my $steps = define_steps
 	cb_ref => \$params{'finished_cb'},
@@ -1310,6 +1330,32 @@ debug("plan: " . Data::Dumper::Dumper($plan->{'dumps'}));
     };
 
     step start_dump => sub {
+	# with more than one restore stream, copy parts from the other volumes
+	# of the plan while the clerk reads the current one
+	if (!$prefetch_checked) {
+	    $prefetch_checked = 1;
+	    my $streams = getconf($CNF_RESTORE_STREAMS);
+	    if ($streams > 1) {
+		$prefetch = Amanda::Recovery::Prefetch->new(
+			dumps => $plan->{'dumps'},
+			streams => $streams,
+			spool_dir => getconf($CNF_TMPDIR) . "/restore-spool-$$",
+			spool_size => getconf($CNF_RESTORE_SPOOL_SIZE) * 1024,
+			get_chg => sub {
+			    my ($storage_name) = @_;
+			    if (!$storage{$storage_name}) {
+				my ($storage) = Amanda::Storage->new(
+						storage_name => $storage_name,
+						tapelist => $tl);
+				return undef
+				    if $storage->isa("Amanda::Changer::Error");
+				$storage{$storage_name} = $storage;
+			    }
+			    return $storage{$storage_name}->{'chg'};
+			});
+	    }
+	}
+
 	$current_dump = shift @{$plan->{'dumps'}};
 
 	if (!$current_dump) {
@@ -1367,6 +1413,7 @@ debug("plan: " . Data::Dumper::Dumper($plan->{'dumps'}));
 	    $clerk{$storage_name} = $clerk;
 	};
 	$clerk = $clerk{$storage_name};
+	$clerk->set_prefetch($prefetch) if $prefetch;
 
 	$clerk->get_xfer_src(
 	    dump => $current_dump,
@@ -1578,13 +1625,21 @@ debug("plan: " . Data::Dumper::Dumper($plan->{'dumps'}));
 	    # need to compress this file
 
 	    $filtered = 1;
-	    my $compress_opt = $params{'compress-best'} ?
-		$Amanda::Constants::COMPRESS_BEST_OPT :
-		$Amanda::Constants::COMPRESS_FAST_OPT;
-	    push @filters,
-		Amanda::Xfer::Filter::Process->new(
-		    [ $Amanda::Constants::COMPRESS_PATH,
-		      $compress_opt ], 0, 0, 0, 1);
+	    if ($Amanda::Constants::COMPRESS_SUFFIX eq ".gz" and
+		Amanda::Xfer::xfer_filter_compress_supported("gzip")) {
+		# compress in-process, the output is the same as gzip's
+		push @filters,
+		    Amanda::Xfer::Filter::Compress->new("gzip",
+			$params{'compress-best'} ? 9 : 1, 1);
+	    } else {
+		my $compress_opt = $params{'compress-best'} ?
+		    $Amanda::Constants::COMPRESS_BEST_OPT :
+		    $Amanda::Constants::COMPRESS_FAST_OPT;
+		push @filters,
+		    Amanda::Xfer::Filter::Process->new(
+			[ $Amanda::Constants::COMPRESS_PATH,
+			  $compress_opt ], 0, 0, 0, 1);
+	    }
 
 	    # adjust the header
 	    $hdr->{'compressed'} = 1;
@@ -1595,6 +1650,47 @@ debug("plan: " . Data::Dumper::Dumper($plan->{'dumps'}));
 	}
         $use_dar |= !$filtered && !$hdr->{'compressed'} && !$hdr->{'encrypted'};
 
+	# start at the block of the seek table holding byte 'seek' of the
+	# image; a holding file can be read from any offset
+	$seek_offset = undef;
+	if (defined $params{'seek'}) {
+	    my $holding_file;
+	    $holding_file = $current_dump->{'parts'}[1]{'holding_file'}
+		if defined $current_dump;
+	    return $steps->{'failure'}->(
+		Amanda::Restore::Message-> new(
+			source_filename => __FILE__,
+			source_line     => __LINE__,
+			code            => 4900069,
+			severity	=> $Amanda::Message::ERROR))
+		if !defined $holding_file;
+
+	    my ($errmsg, $comp_offset, $uncomp_offset) =
+		Amanda::XferServer::holding_file_find_block($holding_file,
+							    $params{'seek'});
+	    return $steps->{'failure'}->(
+		Amanda::Restore::Message-> new(
+			source_filename => __FILE__,
+			source_line     => __LINE__,
+			code            => 4900070,
+			severity	=> $Amanda::Message::ERROR,
+			offset		=> $params{'seek'},
+			errmsg		=> $errmsg))
+		if defined $errmsg;
+
+	    $self->user_message(
+		Amanda::Restore::Message-> new(
+			source_filename => __FILE__,
+			source_line     => __LINE__,
+			code            => 4900071,
+			severity	=> $Amanda::Message::INFO,
+			comp_offset	=> $comp_offset,
+			uncomp_offset	=> $uncomp_offset));
+	    $seek_offset = $comp_offset;
+	    $use_dar = 0;
+	    $check_crc = 0;
+	}
+
 	my $copy_hdr = Amanda::Header->from_string($hdr->to_string(128,32768));
 	# write the header to the destination if requested
 	$copy_hdr->{'blocksize'} = Amanda::Holding::DISK_BLOCK_BYTES;
@@ -1778,6 +1874,8 @@ debug("plan: " . Data::Dumper::Dumper($plan->{'dumps'}));
 		$self->{'feedback'}->start_read_dar($xfer_dest, $steps->{'dar_data'}, $steps->{'filter_done'}, 'application dar');
 	    }
 	    $xfer_waiting_dar = 1;
+	} elsif (defined $seek_offset) {
+	    push @{$current_dump->{'range'}}, "$seek_offset:-1";
 	} else {
 	    push @{$current_dump->{'range'}}, "0:-1";
 	}
@@ -2138,6 +2236,12 @@ debug("plan: " . Data::Dumper::Dumper($plan->{'dumps'}));
     };
 
     step finished => sub {
+	if ($prefetch) {
+	    my $p = $prefetch;
+	    $prefetch = undef;
+	    return $p->quit(finished_cb => $steps->{'finished'});
+	}
+
 	if ($clerk) {
 	    $clerk->quit(finished_cb => $steps->{'quit'});
 	} else {
@@ -2156,6 +2260,14 @@ debug("plan: " . Data::Dumper::Dumper($plan->{'dumps'}));
     };
 
     step quit2 => sub {
+	# the prefetcher's reservations must go before the clerks quit their
+	# changers
+	if ($prefetch) {
+	    my $p = $prefetch;
+	    $prefetch = undef;
+	    return $p->quit(finished_cb => $steps->{'quit2'});
+	}
+
 	my ($storage_name) = keys %clerk;
 	if ($storage_name) {
 	    my $clerk = $clerk{$storage_name};
@@ -34,6 +34,7 @@ use warnings;
                              <=  HOST=			# fe_amidxtaped_host
                              <=  DISK=			# fe_amidxtaped_disk
                              <=  DATESTAMP=		# fe_amidxtaped_datestamp
+                             <=  SEEK=			# fe_amidxtaped_seek
                              <=  END			# ALWAYS
   HEADER-SEND-SIZE size   =>                            # fe_amrecover_header_send_size
                              <= HEADER-READY            # fe_amrecover_header_ready
@@ -166,6 +167,12 @@ use warnings;
     enable the USE-DAR exchange
     amidxtaped expect many "DAR x:y" followed by "DAR-DONE"
 
+  fe_amidxtaped_seek
+    If amrecover can send the "SEEK=" line to amidxtaped
+    It is the offset in the uncompressed image to restore from; the data
+    starts at the beginning of the compressed block holding it.  Only for a
+    dump on holding disk compressed with a seek table.
+
   fe_amrecover_header_send_size
     if amidxtaped can send "HEADER-SEND-SIZE size" to amrecover
 
@@ -317,7 +324,7 @@ sub read_command {
 
     my @known_commands = qw(
 	HOST DISK DATESTAMP LABEL DEVICE FSF HEADER
-	FEATURES CONFIG );
+	SEEK FEATURES CONFIG );
     while (1) {
 	$_ = $self->getline($ctl_stream);
 	$_ =~ s/\r?\n$//g;
@@ -672,6 +679,12 @@ sub plan_cb {
 		"interaction is necessary");
     }
 
+    if (defined $self->{'command'}{'SEEK'} and
+	$self->{'command'}{'SEEK'} !~ /^\d+$/) {
+	$self->sendmessage("invalid SEEK offset '$self->{'command'}{'SEEK'}'");
+	return $self->quit();
+    }
+
     ($self->{'restore'}, my $result_message) = Amanda::Restore->new(
 			message_pathname => $self->{'message_pathname'});
     #return $result_message if defined $result_message;
@@ -680,6 +693,7 @@ sub plan_cb {
 		#'pipe'		=> 1,
 		'pipe-fd'	=> $self->wfd($self->{'data_stream'}),
 		'header'	=> $self->{'command'}{'HEADER'} ? 1 : undef,
+		'seek'		=> $self->{'command'}{'SEEK'},
 		'interactivity'	=> $self->{'interactivity'},
 		'decompress'        => $self->{'their_features'}->has($Amanda::Feature::fe_amrecover_receive_unfiltered)?0:1,
 		'server-decompress' => $self->{'their_features'}->has($Amanda::Feature::fe_amrecover_receive_unfiltered)?1:0,
@@ -843,7 +843,8 @@ REREAD:
 			my $dlet = $dle->{'storage'}->{$storage};
 			delete $dlet->{'wait_for_tape'};
 			delete $self->{'taper'}->{$taper}->{'worker'}->{$worker}->{'wait_for_tape'};
-		    } elsif ($line[6] eq "FILE-WRITE") {
+		    } elsif ($line[6] eq "FILE-WRITE" ||
+			     $line[6] eq "STREAM-WRITE") {
 			#7:name 8:handle 9:filename 10:host 11:disk 12:level 13:datestamp 14:splitsize
 			my $worker = $line[7];
 			my $serial = $line[8];
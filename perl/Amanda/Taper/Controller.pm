@@ -285,6 +285,15 @@ sub msg_FILE_WRITE {
     $worker->FILE_WRITE(@_);
 }
 
+sub msg_STREAM_WRITE {
+    my $self = shift;
+    my ($msgtype, %params) = @_;
+
+    $self->dbg(3, "msg_STREAM_WRITE: " . Data::Dumper::Dumper(\%params));
+    my $worker = $self->{'worker'}->{$params{'worker_name'}};
+    $worker->STREAM_WRITE(@_);
+}
+
 sub msg_PORT_WRITE {
     my $self = shift;
     my ($msgtype, %params) = @_;
@@ -64,6 +64,13 @@ use constant FILE_WRITE => message("FILE-WRITE",
 	    orig_kb) ],
 );
 
+use constant STREAM_WRITE => message("STREAM-WRITE",
+    format => [ qw( worker_name handle filename hostname diskname level datestamp
+	    dle_tape_splitsize dle_split_diskbuffer dle_fallback_splitsize dle_allow_split
+	    part_size part_cache_type part_cache_dir part_cache_max_size
+	    orig_kb) ],
+);
+
 use constant VAULT_WRITE => message("VAULT-WRITE",
     format => [ qw( worker_name handle src_storage src_pool src_label
 		    hostname diskname level datestamp
@@ -91,6 +91,7 @@ sub new {
 	header => undef,
 	doing_port_write => undef,
 	doing_shm_write => undef,
+	doing_stream_write => undef,
 	input_errors => [],
 
 	# periodic status updates
@@ -150,6 +151,24 @@ sub FILE_WRITE {
     $self->{'doing_port_write'} = 0;
     $self->{'doing_shm_write'} = 0;
     $self->{'doing_vault'} = 0;
+    $self->{'doing_stream_write'} = 0;
+
+    $self->setup_and_start_dump($msgtype,
+	dump_cb => sub { $self->dump_cb(@_); },
+	%params);
+}
+
+# like FILE_WRITE, but the dump is still being written to the holding disk;
+# the driver sends DONE or FAILED when the dumper and chunker are finished.
+sub STREAM_WRITE {
+    my $self = shift;
+    my ($msgtype, %params) = @_;
+    $self->_assert_in_state("idle") or return;
+
+    $self->{'doing_port_write'} = 0;
+    $self->{'doing_shm_write'} = 0;
+    $self->{'doing_vault'} = 0;
+    $self->{'doing_stream_write'} = 1;
 
     $self->setup_and_start_dump($msgtype,
 	dump_cb => sub { $self->dump_cb(@_); },
@@ -167,6 +186,7 @@ sub PORT_WRITE {
     $self->{'doing_port_write'} = 1;
     $self->{'doing_shm_write'} = 0;
     $self->{'doing_vault'} = 0;
+    $self->{'doing_stream_write'} = 0;
 
     $self->setup_and_start_dump($msgtype,
 	dump_cb => sub { $self->dump_cb(@_); },
@@ -184,6 +204,7 @@ sub SHM_WRITE {
     $self->{'doing_port_write'} = 0;
     $self->{'doing_shm_write'} = 1;
     $self->{'doing_vault'} = 0;
+    $self->{'doing_stream_write'} = 0;
 
     $self->setup_and_start_dump($msgtype,
 	dump_cb => sub { $self->dump_cb(@_); },
@@ -201,6 +222,7 @@ sub VAULT_WRITE {
     $self->{'doing_port_write'} = 0;
     $self->{'doing_shm_write'} = 0;
     $self->{'doing_vault'} = 1;
+    $self->{'doing_stream_write'} = 0;
 
     $self->setup_and_start_dump($msgtype,
 	dump_cb => sub { $self->dump_cb(@_); },
@@ -275,6 +297,11 @@ sub DONE {
     $self->{'orig_kb'} = $params{'orig_kb'};
     $self->{'native_crc'} = $params{'native_crc'};
     $self->{'client_crc'} = $params{'client_crc'};
+    if ($self->{'doing_stream_write'}) {
+	# the holding file is complete, let the source read to its end
+	$self->{'server_crc'} = $params{'server_crc'};
+	$self->{'xfer_source'}->stream_done() if defined $self->{'xfer_source'};
+    }
     if (defined $self->{'result'}) {
 	$self->result_cb(undef);
     }
@@ -299,6 +326,9 @@ sub FAILED {
 	$self->{'header_xfer'}->cancel();
     } elsif (defined $self->{'result'}) {
 	$self->result_cb(undef);
+    } elsif ($self->{'doing_stream_write'} &&
+	     $self->{'state'} eq 'getting_header') {
+	# wait_stream_header will abort the dump
     } elsif (!defined $self->{'scribe'}->{'xdt'}) {
 	# ignore, the dump is already cancelled or not yet started.
     } elsif (!defined $self->{'scribe'}->{'xfer'}) {
@@ -1051,6 +1081,12 @@ sub setup_and_start_dump {
 	    $self->{'xfer_source'} = Amanda::Xfer::Source::ShmRing->new();
 	} elsif ($msgtype eq Amanda::Taper::Protocol::FILE_WRITE) {
 	    $self->{'xfer_source'} = Amanda::Xfer::Source::Holding->new($params{'filename'});
+	} elsif ($msgtype eq Amanda::Taper::Protocol::STREAM_WRITE) {
+	    $self->{'xfer_source'} = Amanda::Xfer::Source::Holding->new($params{'filename'});
+	    $self->{'xfer_source'}->set_streaming();
+	    # the driver may have sent DONE before the source existed
+	    $self->{'xfer_source'}->stream_done()
+		if defined $self->{'dumper_status'} and $self->{'dumper_status'} eq "DONE";
 	} elsif ($msgtype eq Amanda::Taper::Protocol::VAULT_WRITE) {
 	    my $dump = $self->{'src'}->{'plan'}->shift_dump();
 	    return $self->{'src'}->{'clerk'}->get_xfer_src(
@@ -1157,6 +1193,10 @@ sub setup_and_start_dump {
 
 	    $self->{'xfer_source'}->start_recovery();
 	    $steps->{'start_dump'}->(undef);
+	} elsif ($msgtype eq Amanda::Taper::Protocol::STREAM_WRITE) {
+	    # the chunker may not have written the header yet; the crc and the
+	    # dumper status come later, with the DONE or FAILED from the driver
+	    $steps->{'wait_stream_header'}->();
 	} elsif ($msgtype eq Amanda::Taper::Protocol::PORT_WRITE ||
 		 $msgtype eq Amanda::Taper::Protocol::SHM_WRITE) {
 	    # ..but quite a bit harder for PORT-WRITE; this method will send the
@@ -1169,6 +1209,30 @@ sub setup_and_start_dump {
 	}
     };
 
+    step wait_stream_header => sub {
+	if (defined $self->{'dumper_status'} &&
+	    $self->{'dumper_status'} eq "FAILED") {
+	    push @{$self->{'input_errors'}}, "dumper failed";
+	    return $steps->{'start_dump'}->(undef);
+	}
+
+	my $hdr;
+	for my $filename ($params{'filename'}, "$params{filename}.tmp") {
+	    next if !-f $filename;
+	    $hdr = Amanda::Holding::get_header($filename);
+	    last if defined $hdr && $hdr->{'type'} == $Amanda::Header::F_DUMPFILE;
+	    $hdr = undef;
+	}
+	if (!defined $hdr) {
+	    return Amanda::MainLoop::call_after(1000, $steps->{'wait_stream_header'});
+	}
+
+	$hdr->{'cont_filename'} = '';
+	$self->{'header'} = $hdr;
+	$self->{'xfer_source'}->start_recovery();
+	$steps->{'start_dump'}->(undef);
+    };
+
     step start_dump => sub {
 	my ($err) = @_;
 
@@ -1250,6 +1314,10 @@ sub dump_cb {
     # connection from a normal EOF) and have not done so yet, then send a
     # DUMPER_STATUS message and re-call this method (dump_cb) with the result.
     if ($params{'result'} eq "DONE"
+	    and $self->{'doing_stream_write'}
+	    and !exists $self->{'dumper_status'}) {
+	# wait for the DONE or FAILED from the driver
+    } elsif ($params{'result'} eq "DONE"
 	    and ($self->{'doing_port_write'} || $self->{'doing_shm_write'})
 	    and !exists $self->{'dumper_status'}) {
 	my $controller = $self->{'controller'};
@@ -143,6 +143,7 @@ sub new {
 	uniq => $uniq,
 	delayed => $params{'delayed'},
 	run_delayed => $params{'run_delayed'},
+	parallel => $params{'parallel'},
 	opt_dumpspecs => $params{'opt_dumpspecs'},
 	opt_dry_run => $params{'opt_dry_run'},
 	config => $params{'config'},
@@ -355,46 +356,7 @@ sub run {
     Amanda::Logfile::make_dump_storage_hash();
 
     if ($self->{'run_delayed'}) {
-	#fork the driver
-	my ($rpipe, $driver_pipe) = POSIX::pipe();
-	my $driver_pid = POSIX::fork();
-	if ($driver_pid == 0) {
-	    my $driver = "$amlibexecdir/driver";
-	    my @log_filename = ('--log-filename', $self->{'trace_log_filename'});
-	    my @config_overrides = ();
-	    if (defined $self->{'config_overrides_opt'} and
-		@{$self->{'config_overrides_opt'}}) {
-		@config_overrides = @{$self->{'config_overrides_opt'}};
-	    }
-	    ## child, exec the driver
-	    POSIX::dup2($rpipe, 0);
-	    POSIX::close($rpipe);
-	    POSIX::close($driver_pipe);
-	    POSIX::dup2(fileno($self->{'amdump_log'}), 1);
-	    POSIX::dup2(fileno($self->{'amdump_log'}), 2);
-	    debug("exec: " . join(' ', $driver, $self->{'config'}, @log_filename, "--no-dump", "--no-vault", @config_overrides));
-	    close($self->{'amdump_log'});
-	    exec $driver, $self->{'config'}, @log_filename, "--no-dump",
-			"--no-flush", "-ostorage=",
-			"-ovault-storage=$self->{'dest_storage_name'}",
-			@config_overrides;
-	    die "Could not exec $driver: $!";
-	}
-
-	debug(" driver: $driver_pid");
-	open my $driver_stream, ">&=$driver_pipe";
-	POSIX::close($rpipe);
-
-	print {$driver_stream} "DATE $self->{'timestamp'}\n";
-	print {$driver_stream} "ENDFLUSH\n";
-	close($driver_stream);
-
-	my $dead = wait();
-	die("Error waiting: $!") if ($dead <= 0);
-	my $s = $? >> 8;
-	debug("driver finished with exit code $s");
-	my $exit = WIFEXITED($?)? WEXITSTATUS($?) : 1;
-	$self->{'exit_code'} |= $exit if $exit;
+	$self->run_driver();
 
 	my $end_longdate = strftime "%a %b %e %H:%M:%S %Z %Y", localtime;
 	$self->amdump_log("end at $end_longdate");
@@ -405,6 +367,58 @@ sub run {
     }
 }
 
+# run the driver on the COPY commands of the cmdfile for the dest storage,
+# it runs one taper worker per 'taper-parallel-write'.  With 'vault_pid',
+# the driver only runs the commands added by that process.
+sub run_driver {
+    my $self = shift;
+    my %params = @_;
+
+    #fork the driver
+    my ($rpipe, $driver_pipe) = POSIX::pipe();
+    my $driver_pid = POSIX::fork();
+    if ($driver_pid == 0) {
+	my $driver = "$amlibexecdir/driver";
+	my @log_filename = ('--log-filename', $self->{'trace_log_filename'});
+	my @vault_pid = ();
+	@vault_pid = ('--vault-pid', $params{'vault_pid'})
+	    if defined $params{'vault_pid'};
+	my @config_overrides = ();
+	if (defined $self->{'config_overrides_opt'} and
+	    @{$self->{'config_overrides_opt'}}) {
+	    @config_overrides = @{$self->{'config_overrides_opt'}};
+	}
+	## child, exec the driver
+	POSIX::dup2($rpipe, 0);
+	POSIX::close($rpipe);
+	POSIX::close($driver_pipe);
+	POSIX::dup2(fileno($self->{'amdump_log'}), 1);
+	POSIX::dup2(fileno($self->{'amdump_log'}), 2);
+	debug("exec: " . join(' ', $driver, $self->{'config'}, @log_filename, "--no-dump", "--no-flush", @vault_pid, @config_overrides));
+	close($self->{'amdump_log'});
+	exec $driver, $self->{'config'}, @log_filename, "--no-dump",
+		    "--no-flush", @vault_pid, "-ostorage=",
+		    "-ovault-storage=$self->{'dest_storage_name'}",
+		    @config_overrides;
+	die "Could not exec $driver: $!";
+    }
+
+    debug(" driver: $driver_pid");
+    open my $driver_stream, ">&=$driver_pipe";
+    POSIX::close($rpipe);
+
+    print {$driver_stream} "DATE $self->{'timestamp'}\n";
+    print {$driver_stream} "ENDFLUSH\n";
+    close($driver_stream);
+
+    my $dead = wait();
+    die("Error waiting: $!") if ($dead <= 0);
+    my $s = $? >> 8;
+    debug("driver finished with exit code $s");
+    my $exit = WIFEXITED($?)? WEXITSTATUS($?) : 1;
+    $self->{'exit_code'} |= $exit if $exit;
+}
+
 sub setup_src {
     my $self = shift;
 
@@ -666,19 +680,8 @@ sub plan_cb {
 				dump_timestamp  => $dump->{'dump_timestamp'},
 				level           => $dump->{'level'},
 				storage_name	=> $self->{'dest_storage_name'}));
-	    $self->{'catalog'}->add_copy_cmd(config	    => get_config_name(),
-					     src_storage    => $dump->{'storage'},
-					     label	    => $dump->{'parts'}[1]->{'label'},
-					     hostname	    => $dump->{'hostname'},
-					     diskname	    => $dump->{'diskname'},
-					     dump_timestamp => $dump->{'dump_timestamp'},
-					     level	    => $dump->{'level'},
-					     dst_storage    => $self->{'dest_storage_name'},
-					     working_pid    => $$,
-					     status	    => $Amanda::Cmdfile::CMD_TODO,
-					     size	    => $dump->{'bytes'},
-					     start_time	    => time()+0);
 	}
+	$self->add_copy_cmds($plan->{'dumps'});
 	return $self->quit(0);
     }
 
@@ -700,6 +703,90 @@ sub plan_cb {
 				severity	=> $Amanda::Message::ERROR));
     }
 
+    if ($self->{'parallel'}) {
+	return $self->run_parallel();
+    }
+
+    $self->setup_dst();
+}
+
+# add a COPY command to the cmdfile for each dump
+sub add_copy_cmds {
+    my $self = shift;
+    my ($dumps) = @_;
+
+    my $conf_cmdfile = config_dir_relative(getconf($CNF_CMDFILE));
+    my $cmdfile = Amanda::Cmdfile->new($conf_cmdfile);
+    for my $dump (@$dumps) {
+	my $part = $dump->{'parts'}[1];
+	my @labels;
+	for my $p (@{$dump->{'parts'}}) {
+	    next if !defined $p or !defined $p->{'label'};
+	    push @labels, $p->{'label'}
+		if !@labels or $labels[-1] ne $p->{'label'};
+	}
+	my $cmddata = Amanda::Cmdfile->new_Cmddata(
+		operation      => $Amanda::Cmdfile::CMD_COPY,
+		config         => get_config_name(),
+		src_storage    => $dump->{'storage'},
+		src_pool       => $dump->{'pool'},
+		src_label      => $part->{'label'},
+		src_fileno     => $part->{'filenum'},
+		src_labels_str => " ;" . join(" ;", @labels) . " ;",
+		hostname       => $dump->{'hostname'},
+		diskname       => $dump->{'diskname'},
+		dump_timestamp => $dump->{'dump_timestamp'},
+		level          => $dump->{'level'},
+		dst_storage    => $self->{'dest_storage_name'},
+		working_pid    => $$,
+		status         => $Amanda::Cmdfile::CMD_TODO,
+		start_time     => time());
+	$cmdfile->add_to_memory($cmddata);
+    }
+    $cmdfile->write();
+}
+
+# Vault the dumps through the driver, with one copy stream per
+# 'taper-parallel-write' of the dest storage.  Each taper worker has its own
+# clerk for the source volumes and the driver gives all the dumps of a source
+# volume to the same worker, so they are recorded in volume and file order.
+# Dumps on the holding disk are not handled by the driver, they are vaulted
+# here once it is done.
+sub run_parallel {
+    my $self = shift;
+    my $plan = $self->{'src'}->{'plan'};
+    my @volume_dumps;
+    my @holding_dumps;
+    my %label_rank;
+
+    for my $dump (@{$plan->{'dumps'}}) {
+	my $label = $dump->{'parts'}[1]->{'label'};
+	if (!defined $label) {
+	    push @holding_dumps, $dump;
+	    next;
+	}
+	$label_rank{$label} = scalar(keys %label_rank)
+	    if !exists $label_rank{$label};
+	push @volume_dumps, $dump;
+    }
+    @volume_dumps = sort {
+	$label_rank{$a->{'parts'}[1]->{'label'}} <=> $label_rank{$b->{'parts'}[1]->{'label'}} ||
+	$a->{'parts'}[1]->{'filenum'} <=> $b->{'parts'}[1]->{'filenum'}
+    } @volume_dumps;
+
+    if (@volume_dumps) {
+	# the dumps queued earlier with --delayed stay queued
+	$self->add_copy_cmds(\@volume_dumps);
+	$self->run_driver(vault_pid => $$);
+    }
+
+    if (!@holding_dumps) {
+	my $end_longdate = strftime "%a %b %e %H:%M:%S %Z %Y", localtime;
+	$self->amdump_log("end at $end_longdate");
+	return $self->quit($self->{'exit_code'});
+    }
+
+    $plan->{'dumps'} = \@holding_dumps;
     $self->setup_dst();
 }
 
@@ -755,7 +842,7 @@ sub scribe_started {
     my $xfers_finished = sub {
 	my ($err) = @_;
 	return $self->failure($err) if $err;
-	$self->quit(0);
+	$self->quit($self->{'exit_code'});
     };
 
     $self->xfer_dumps($xfers_finished);
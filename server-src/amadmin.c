@@ -1652,9 +1652,14 @@ import_db(
 		get_pname(), org);
     }
 
+    begin_info_batch();
     do {
 	rc = import_one();
     } while (rc);
+    if (commit_info_batch()) {
+	g_fprintf(stderr, _("%s: error writing the records: %s\n"),
+		get_pname(), strerror(errno));
+    }
 
     amfree(line);
     return;
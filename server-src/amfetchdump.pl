@@ -144,7 +144,7 @@ Usage: amfetchdump [-c|-C|-l] [-p|-n] [-a] [-O directory] [-d device]
      [--exclude-list-glob filename]*]
      [--prev-level level]
      [--next-level level]
-    [--init] [--restore]
+    [--init] [--restore] [--seek offset]
     [-o configoption]* [--exact-match] config
     hostname [diskname [datestamp [hostname [diskname [datestamp ... ]]]]]
 EOF
@@ -171,7 +171,7 @@ my ($opt_config, $opt_no_reassembly, $opt_compress, $opt_compress_best, $opt_pip
     $opt_exclude_file, $opt_exclude_list, $opt_exclude_list_glob,
     $opt_prev_level, $opt_next_level,
     $opt_exact_match, $opt_run_client_scripts,
-    $opt_reserve_tapes, $opt_release_tapes);
+    $opt_reserve_tapes, $opt_release_tapes, $opt_seek);
 
 my $NEVER = 0;
 my $ALWAYS = 1;
@@ -222,6 +222,7 @@ GetOptions(
     'release-tapes' => \$opt_release_tapes,
     'init' => \$opt_init,
     'restore!' => \$opt_restore,
+    'seek=s' => \$opt_seek,
     'b=s' => \$opt_blocksize,
     'd=s' => \$opt_device,
     'O=s' => \$opt_chdir,
@@ -242,6 +243,10 @@ usage("-l is not compatible with -c or -C")
     if ($opt_leave and $opt_compress);
 usage("-p is not compatible with -n")
     if ($opt_pipe and $opt_no_reassembly);
+usage("--seek must be a byte offset")
+    if (defined $opt_seek and $opt_seek !~ /^\d+$/);
+usage("--seek is not compatible with -n")
+    if (defined $opt_seek and $opt_no_reassembly);
 usage("-h, --header-file, and --header-fd are mutually incompatible")
     if (($opt_header and ($opt_header_file or $opt_header_fd))
 	    or ($opt_header_file and $opt_header_fd));
@@ -473,6 +478,7 @@ sub main {
 		'no-reassembly'		=> $opt_no_reassembly,
 		'pipe-fd'		=> $opt_pipe ? 1 : undef,
 		'restore'		=> $opt_restore,
+		'seek'			=> $opt_seek,
 		'server-decompress'	=> $opt_server_decompress,
 		'server-decrypt'	=> $opt_server_decrypt,
 		'run-client-scripts'	=> $opt_run_client_scripts,
@@ -43,6 +43,7 @@ char *getindex_unsorted_fname(char *host, char *disk, char *date, int level);
 char *getindex_unsorted_gz_fname(char *host, char *disk, char *date, int level);
 char *getindex_sorted_fname(char *host, char *disk, char *date, int level);
 char *getindex_sorted_gz_fname(char *host, char *disk, char *date, int level);
+char *getindex_sorted_idx_fname(char *host, char *disk, char *date, int level);
 char *getheaderfname(char *host, char *disk, char *date, int level);
 char *getoldindexfname(char *host, char *disk, char *date, int level);
 
@@ -48,6 +48,7 @@
 #include "clock.h"
 #include "match.h"
 #include "amindex.h"
+#include "sortedindex.h"
 #include "disk_history.h"
 #include "list_dir.h"
 #include "logfile.h"
@@ -91,6 +92,10 @@ static int amindexd_debug = 0;
 static REMOVE_ITEM *uncompress_remove = NULL;
 					/* uncompressed files to remove */
 static REMOVE_ITEM *compress_sorted_files = NULL;
+
+/* sorted indexes opened in this session, by filename; NULL for a dump
+ * without one */
+static GHashTable *sorted_indexes = NULL;
 					/* compress new sorted files */
 
 static am_feature_t *our_features = NULL;
@@ -103,6 +108,7 @@ static char *uncompress_file(char *, char *, char *, int,
 			     char *, GPtrArray **,
 			     gboolean need_uncompress, gboolean need_sort);
 static int process_ls_dump(char *, DUMP_ITEM *, int, GPtrArray **);
+static sorted_index_t *get_sorted_index(DUMP_ITEM *);
 
 static size_t reply_buffer_size = 1;
 static char *reply_buffer = NULL;
@@ -224,6 +230,41 @@ compress_files(
     return compress;
 }
 
+typedef struct ls_dump_s {
+    DUMP_ITEM *dump_item;
+    int        recursive;
+    size_t     len_dir_slash;
+    char      *old_line;
+} ls_dump_t;
+
+/* add the entry for LINE, a path in the listed directory */
+static gboolean
+ls_dump_line(
+    gpointer data,
+    char    *line)
+{
+    ls_dump_t *ls = data;
+    char *s;
+    int ch;
+
+    if(!ls->recursive) {
+	s = line + ls->len_dir_slash;
+	ch = *s++;
+	while(ch && ch != '/')
+	    ch = *s++;/* find end of the file name */
+	if(ch == '/') {
+	    s++;
+	}
+	s[-1] = '\0';
+    }
+    if(!ls->old_line || !g_str_equal(line, ls->old_line)) {
+	add_dir_list_item(ls->dump_item, line);
+	g_free(ls->old_line);
+	ls->old_line = g_strdup(line);
+    }
+    return TRUE;
+}
+
 /* find all matching entries in a dump listing */
 /* return -1 if error */
 static int
@@ -233,21 +274,40 @@ process_ls_dump(
     int		recursive,
     GPtrArray **emsg)
 {
-    char line[STR_SIZE], old_line[STR_SIZE];
+    char line[STR_SIZE];
     char *filename = NULL;
     char *dir_slash = NULL;
     FILE *fp;
-    char *s;
-    int ch;
-    size_t len_dir_slash;
+    ls_dump_t ls;
+    sorted_index_t *sidx;
 
-    old_line[0] = '\0';
     if (g_str_equal(dir, "/")) {
 	dir_slash = g_strdup(dir);
     } else {
 	dir_slash = g_strconcat(dir, "/", NULL);
     }
 
+    ls.dump_item = dump_item;
+    ls.recursive = recursive;
+    ls.len_dir_slash = strlen(dir_slash);
+    ls.old_line = NULL;
+
+    sidx = get_sorted_index(dump_item);
+    if (sidx) {
+	char *errmsg = NULL;
+
+	if (sorted_index_scan(sidx, dir_slash, recursive, ls_dump_line, &ls,
+			      &errmsg) == -1) {
+	    g_ptr_array_add(*emsg, errmsg);
+	    amfree(ls.old_line);
+	    amfree(dir_slash);
+	    return -1;
+	}
+	amfree(ls.old_line);
+	amfree(dir_slash);
+	return 0;
+    }
+
     filename = get_index_name(dump_hostname, dump_item->hostname, disk_name,
 			      dump_item->date, dump_item->level, emsg);
     if (filename == NULL) {
@@ -263,31 +323,17 @@ process_ls_dump(
 	return -1;
     }
 
-    len_dir_slash=strlen(dir_slash);
-
     while (fgets(line, STR_SIZE, fp) != NULL) {
 	if (line[0] != '\0') {
 	    if(strlen(line) > 0 && line[strlen(line)-1] == '\n')
 		line[strlen(line)-1] = '\0';
 	    if (g_str_has_prefix(line, dir_slash )) {
-		if(!recursive) {
-		    s = line + len_dir_slash;
-		    ch = *s++;
-		    while(ch && ch != '/')
-			ch = *s++;/* find end of the file name */
-		    if(ch == '/') {
-			s++;
-		    }
-		    s[-1] = '\0';
-		}
-		if(!g_str_equal(line, old_line)) {
-		    add_dir_list_item(dump_item, line);
-		    strcpy(old_line, line);
-		}
+		ls_dump_line(&ls, line);
 	    }
 	}
     }
     afclose(fp);
+    amfree(ls.old_line);
     amfree(filename);
     amfree(dir_slash);
     return 0;
@@ -790,6 +836,14 @@ disk_history_list(void)
 }
 
 
+static gboolean
+stop_at_first(
+    gpointer  data G_GNUC_UNUSED,
+    char     *line G_GNUC_UNUSED)
+{
+    return FALSE;
+}
+
 /*
  * is the directory dir backed up - dir assumed complete relative to
  * disk mount point
@@ -846,6 +900,27 @@ is_dir_valid_opaque(
     /* go back till we hit a level 0 dump */
     do
     {
+	sorted_index_t *sidx = get_sorted_index(item);
+
+	if (sidx) {
+	    char *errmsg = NULL;
+	    int found = sorted_index_scan(sidx, ldir, TRUE, stop_at_first,
+					  NULL, &errmsg);
+
+	    if (found == -1) {
+		reply(599, _("System error: %s"), errmsg);
+		g_free(errmsg);
+		amfree(filename);
+		amfree(ldir);
+		return -1;
+	    } else if (found > 0) {
+		amfree(filename);
+		amfree(ldir);
+		return 0;
+	    }
+	    goto next_level;
+	}
+
 	amfree(filename);
 	emsg = g_ptr_array_new();
 	filename = get_index_name(dump_hostname, item->hostname, disk_name,
@@ -878,6 +953,7 @@ is_dir_valid_opaque(
 	}
 	afclose(fp);
 
+next_level:
 	last_level = item->level;
 	do
 	{
@@ -1737,6 +1813,8 @@ main(
 	lock_index = NULL;
     }
 
+    if (sorted_indexes)
+	g_hash_table_destroy(sorted_indexes);
     free_find_result(&output_find);
     reply(200, _("Good bye."));
     dbclose();
@@ -1854,6 +1932,41 @@ get_index_dir(
     return -1;
 }
 
+/* Return the sorted index of a dump, or NULL if it has none or it can't be
+ * read, in which case the other index files are used. */
+static sorted_index_t *
+get_sorted_index(
+    DUMP_ITEM *dump_item)
+{
+    sorted_index_t *sidx = NULL;
+    struct stat     sbuf;
+    char           *fn;
+    char           *errmsg = NULL;
+
+    if (!sorted_indexes) {
+	sorted_indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+				(GDestroyNotify)sorted_index_close);
+    }
+
+    fn = getindex_sorted_idx_fname(dump_hostname, disk_name, dump_item->date,
+				   dump_item->level);
+    if (g_hash_table_lookup_extended(sorted_indexes, fn, NULL,
+				     (gpointer *)&sidx)) {
+	g_free(fn);
+	return sidx;
+    }
+
+    if (stat(fn, &sbuf) == 0 && S_ISREG(sbuf.st_mode)) {
+	sidx = sorted_index_open(fn, &errmsg);
+	if (!sidx) {
+	    dbprintf("%s\n", errmsg);
+	    g_free(errmsg);
+	}
+    }
+    g_hash_table_insert(sorted_indexes, fn, sidx);
+    return sidx;
+}
+
 static char *
 get_index_name(
     char       *dump_hostname,
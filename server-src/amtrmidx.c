@@ -49,6 +49,7 @@ typedef struct inames {
     gboolean index_sorted_gz;
     gboolean index_unsorted;
     gboolean index_unsorted_gz;
+    gboolean index_sorted_idx;
     gboolean state_gz;
 } inames;
 
@@ -320,6 +321,8 @@ main(
 		    iname->index_unsorted = TRUE;
 		} else if (strcmp(n, "unsorted.gz") == 0) {
 		    iname->index_unsorted_gz = TRUE;
+		} else if (strcmp(n, "sorted.idx") == 0) {
+		    iname->index_sorted_idx = TRUE;
 		} else if (strcmp(n, "state.gz") == 0) {
 		    iname->state_gz = TRUE;
 		} else {
@@ -476,6 +479,22 @@ main(
 			amfree(filepath);
 		    }
 
+		    if (iname && iname->index_sorted_idx) {
+			char *filepath = g_strconcat(path, "-sorted.idx", NULL);
+			if (lstat(filepath, &sbuf) != -1 &&
+			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
+			    ((time_t)sbuf.st_mtime < tmp_time)) {
+			    char *qfilepath = quote_string(filepath);
+			    g_debug("rm %s", qfilepath);
+		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
+				g_debug("Error removing %s: %s",
+					 qfilepath, strerror(errno));
+			    }
+			    amfree(qfilepath);
+		        }
+			amfree(filepath);
+		    }
+
 		    if (iname && iname->state_gz) {
 			char *filepath = g_strconcat(path, ".state.gz", NULL);
 			if (lstat(filepath, &sbuf) != -1 &&
@@ -501,12 +520,14 @@ main(
 		char *sorted_gz_name = getindex_sorted_gz_fname(host, disk, datestamp, level);
 		char *unsorted_name = getindex_unsorted_fname(host, disk, datestamp, level);
 		char *unsorted_gz_name = getindex_unsorted_gz_fname(host, disk, datestamp, level);
+		char *sorted_idx_name = getindex_sorted_idx_fname(host, disk, datestamp, level);
 
 		gboolean orig_exist = FALSE;
 		gboolean sorted_exist = FALSE;
 		gboolean sorted_gz_exist = FALSE;
 		gboolean unsorted_exist = FALSE;
 		gboolean unsorted_gz_exist = FALSE;
+		gboolean sorted_idx_exist = FALSE;
 
 		int fd;
 		int uncompress_err_fd = -1;
@@ -524,15 +545,35 @@ main(
 		    sorted_gz_exist = iname->index_sorted_gz;
 		    unsorted_exist = iname->index_unsorted;
 		    unsorted_gz_exist = iname->index_unsorted_gz;
+		    sorted_idx_exist = iname->index_sorted_idx;
 		} else {
 		    orig_exist = file_exists(orig_name);
 		    sorted_exist = file_exists(sorted_name);
 		    sorted_gz_exist = file_exists(sorted_gz_name);
 		    unsorted_exist = file_exists(unsorted_name);
 		    unsorted_gz_exist = file_exists(unsorted_gz_name);
+		    sorted_idx_exist = file_exists(sorted_idx_name);
 		}
 
-		if (sort_index && compress_index) {
+		if (sorted_idx_exist) {
+		    /* written sorted by the dumper, it is used whatever the
+		     * setting of sort-index and compress-index */
+		    if (orig_exist) {
+			unlink(orig_name);
+		    }
+		    if (sorted_exist) {
+			unlink(sorted_name);
+		    }
+		    if (sorted_gz_exist) {
+			unlink(sorted_gz_name);
+		    }
+		    if (unsorted_exist) {
+			unlink(unsorted_name);
+		    }
+		    if (unsorted_gz_exist) {
+			unlink(unsorted_gz_name);
+		    }
+		} else if (sort_index && compress_index) {
 		    if (!sorted_gz_exist) {
 			if (sorted_exist) {
 			    // COMPRESS
@@ -663,6 +704,7 @@ main(
 		    g_free(sorted_gz_name);
 		    g_free(unsorted_name);
 		    g_free(unsorted_gz_name);
+		    g_free(sorted_idx_name);
 		}
 
 		amfree(datestamp);
@@ -38,6 +38,7 @@
 #include "diskfile.h"
 #include "tapefile.h"
 #include "find.h"
+#include "logindex.h"
 
 int amtrmidx_debug = 0;
 
@@ -209,6 +210,7 @@ main(
 			  logname, newfile, strerror(errno));
 		    /*NOTREACHED*/
 		}
+		logindex_remove(oldfile);
 		amfree(newfile);
 		amfree(oldfile);
 
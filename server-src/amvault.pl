@@ -121,7 +121,8 @@ sub usage {
 Usage: amvault [-o configoption...] [-q] [--quiet] [-n] [--dry-run]
 	   [--exact-match] [--export] [--nointeractivity]
 	   [--src-labelstr labelstr] [--src-storage storage]
-	   [--no-uniq] [--delayed] [run-delayed] [--dest-storage storage]
+	   [--no-uniq] [--delayed] [run-delayed] [--parallel]
+	   [--dest-storage storage]
 	   [--fulls-only] [--latest-fulls] [--incrs-only]
 	   [--src-timestamp src-timestamp]
 	   config
@@ -145,6 +146,8 @@ Usage: amvault [-o configoption...] [-q] [--quiet] [-n] [--dry-run]
     --uniq: Do not vault something that is already in the dest-storage
     --delayed: Schedule the vault to be run later
     --run-delayed: Run the delayed vault
+    --parallel: Run a copy stream for each taper-parallel-write of the
+		dest-storage
 
 Copies dumps selected by the specified filters onto volumes on the storage
 <dest-storage>.  If <src-timestamp> is "latest", then the most recent run of
@@ -179,6 +182,7 @@ my $opt_interactivity = 1;
 my $opt_uniq = undef;
 my $opt_delayed = 0;
 my $opt_run_delayed = 0;
+my $opt_parallel = 0;
 
 debug("Arguments: " . join(' ', @ARGV));
 Getopt::Long::Configure(qw{ bundling });
@@ -208,6 +212,7 @@ GetOptions(
     'uniq!' => \$opt_uniq,
     'delayed!' => \$opt_delayed,
     'run-delayed' => \$opt_run_delayed,
+    'parallel' => \$opt_parallel,
     'version' => \&Amanda::Util::version_opt,
     'help' => \&usage,
 ) or usage("usage error");
@@ -314,6 +319,7 @@ my $messages;
     uniq => $opt_uniq,
     delayed => $opt_delayed,
     run_delayed => $opt_run_delayed,
+    parallel => $opt_parallel,
     config_overrides_opts => \@config_overrides_opts,
     user_msg => \&user_msg,
     delay => $delay,
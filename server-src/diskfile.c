@@ -847,6 +847,8 @@ parse_diskline(
 	all_netifs = netif;
 	netif->config = cfg_if;
 	netif->curusage = 0;
+	netif->maxusage = interface_get_maxusage(cfg_if);
+	netif->raised = 0;
     }
 
     skip_whitespace(s, ch);
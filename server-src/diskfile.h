@@ -43,6 +43,8 @@ typedef struct netif_s {
     struct netif_s *next;
     interface_t *config;
     unsigned long curusage;
+    unsigned long maxusage;		/* the limit, adapted by the driver */
+    time_t raised;			/* when maxusage was last raised */
 } netif_t;
 
 typedef struct amhost_s {
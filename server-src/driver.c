@@ -53,6 +53,7 @@
 #include "cmdfile.h"
 #include "tapefile.h"
 #include "shm-ring.h"
+#include "runqindex.h"
 
 #define driver_debug(i, ...) do {	\
 	if ((i) <= debug_driver) {	\
@@ -70,6 +71,7 @@
 
 static disklist_t  waitq;	// dle waiting estimate result
 static schedlist_t runq;	// dle waiting to be dumped to holding disk
+static runq_index_t *runq_index;	// index of runq, see start_some_dumps
 static schedlist_t directq;	// dle waiting to be dumped directly to tape
 static schedlist_t roomq;	// dle waiting for more space on holding disk
 static int pending_aborts;
@@ -79,6 +81,8 @@ static off_t total_disksize;
 static char *dumper_program;
 static char *chunker_program;
 static int  inparallel;
+static gboolean adaptive_bandwidth;
+static gboolean streaming_flush;
 static storage_t *storage;
 static int conf_max_dle_by_volume;
 static int conf_taperalgo;
@@ -108,6 +112,7 @@ static cmddatas_t *cmddatas = NULL;
 static int no_dump = FALSE;
 //static int no_flush = FALSE;
 static int no_vault = FALSE;
+static pid_t vault_pid = 0;		// only vault the COPY commands of this pid
 static GHashTable *dump_storage_hash = NULL;
 
 static int wait_children(int count);
@@ -118,12 +123,18 @@ static void adjust_diskspace(sched_t *sp, cmd_t cmd);
 static void delete_diskspace(sched_t *sp);
 static assignedhd_t **build_diskspace(char *destname);
 static int client_constrained(disk_t *dp);
+static gboolean host_busy(am_host_t *host);
+static gboolean spindle_busy(am_host_t *host, int spindle);
 static void deallocate_bandwidth(netif_t *ip, unsigned long kps);
+static void update_bandwidth(sched_t *sp, off_t received);
+static gboolean host_congested(am_host_t *host);
 static void dump_schedule(schedlist_t *qp, char *str);
 static assignedhd_t **find_diskspace(off_t size, int *cur_idle,
 					assignedhd_t *preferred);
 static unsigned long network_free_kps(netif_t *ip);
 static off_t holding_free_space(void);
+static void holding_sample_kps(assignedhd_t *h);
+static gboolean holding_prefer(holdalloc_t *ha, holdalloc_t *minp);
 static void dumper_chunker_result(job_t *job);
 static void dumper_taper_result(job_t *job);
 static void vault_taper_result(job_t *job);
@@ -133,6 +144,9 @@ static void handle_chunker_result(void *);
 static void handle_dumpers_time(void *);
 static void handle_taper_result(void *);
 static gboolean dump_match_selection(char *storage_n, sched_t *sp);
+static void start_stream_flush(job_t *job);
+static void stream_taper_result(job_t *job);
+static sched_t *dup_flush_sched(sched_t *sp);
 
 static void holdingdisk_state(char *time_str);
 static wtaper_t *idle_taper(taper_t *taper);
@@ -311,6 +325,14 @@ main(
 	}
     }
 
+    if (argc > 3) {
+	if (g_str_equal(argv[2], "--vault-pid")) {
+	    vault_pid = atoi(argv[3]);
+	    argv += 2;
+	    argc -= 2;
+	}
+    }
+
     if (argc > 2) {
 	if (g_str_equal(argv[2], "--no-vault")) {
 	    no_vault = TRUE;
@@ -427,6 +449,9 @@ main(
     /* set up any configuration-dependent variables */
 
     inparallel	= getconf_int(CNF_INPARALLEL);
+    adaptive_bandwidth = g_str_equal(getconf_str(CNF_BANDWIDTH_ALLOCATION),
+				     "adaptive");
+    streaming_flush = getconf_boolean(CNF_STREAMING_FLUSH);
 
     conf_reserve = (unsigned long)getconf_int(CNF_RESERVE);
 
@@ -451,6 +476,7 @@ main(
 	ha->hdisk = hdp;
 	ha->allocated_dumpers = 0;
 	ha->allocated_space = (off_t)0;
+	ha->kps = 0;
 	ha->disksize = holdingdisk_get_disksize(hdp);
 
 	/* get disk size */
@@ -543,6 +569,7 @@ main(
 
     runq.head = NULL;
     runq.tail = NULL;
+    runq_index = runq_index_new();
     directq.head = NULL;
     directq.tail = NULL;
     waitq = origq;
@@ -1548,15 +1575,35 @@ start_a_vault_wtaper(
     }
 }
 
+static gboolean
+host_busy(
+    am_host_t *host)
+{
+    return host->inprogress >= host->maxdumps;
+}
+
+static gboolean
+spindle_busy(
+    am_host_t *host,
+    int        spindle)
+{
+    disk_t *dp;
+
+    for (dp = host->disks; dp != NULL; dp = dp->hostnext)
+	if (dp->inprogress && dp->spindle == spindle) {
+	    return TRUE;
+	}
+
+    return FALSE;
+}
+
 static int
 client_constrained(
     disk_t *	dp)
 {
-    disk_t *dp2;
-
     /* first, check if host is too busy */
 
-    if (dp->host->inprogress >= dp->host->maxdumps) {
+    if (host_busy(dp->host)) {
 	return 1;
     }
 
@@ -1566,14 +1613,114 @@ client_constrained(
 	return 0;
     }
 
-    for (dp2 = dp->host->disks; dp2 != NULL; dp2 = dp2->hostnext)
-	if (dp2->inprogress && dp2->spindle == dp->spindle) {
-	    return 1;
-	}
+    return spindle_busy(dp->host, dp->spindle);
+}
 
-    return 0;
+/*
+ * Check if SP can be dumped now, to WTAPER or to holding disk if it is NULL.
+ * Returns NOT_IDLE, with the holding disk space in *HOLDP, if it can, or
+ * else the reason it can't; *NO_HOLDING_SPACE is set if the reason is that
+ * there's not enough holding disk space for it.
+ */
+static int
+dump_dle_idle(
+    sched_t         *sp,
+    wtaper_t        *wtaper,
+    const time_t     now,
+    off_t            extra_tapes_size,
+    assignedhd_t  ***holdp,
+    gboolean        *no_holding_space)
+{
+    disk_t *diskp = sp->disk;
+
+    *holdp = NULL;
+    *no_holding_space = FALSE;
+
+    if (diskp->host->start_t > now || diskp->start_t > now) {
+	return IDLE_START_WAIT;
+    } else if (diskp->host->netif->curusage > 0 &&
+	       sp->est_kps > network_free_kps(diskp->host->netif)) {
+	return IDLE_NO_BANDWIDTH;
+    } else if (adaptive_bandwidth && host_congested(diskp->host)) {
+	return IDLE_NO_BANDWIDTH;
+    } else if (!wtaper && sp->no_space) {
+	return IDLE_NO_DISKSPACE;
+    } else if (!wtaper && diskp->to_holdingdisk == HOLD_NEVER) {
+	return IDLE_NO_HOLD;
+    } else if (extra_tapes_size && sp->est_size > extra_tapes_size) {
+	/* no tape space */
+	return IDLE_NO_DISKSPACE;
+    } else if (!wtaper &&
+	       (*holdp = find_diskspace(predict_holding_size(sp), NULL, NULL)) == NULL &&
+	       (*holdp = find_diskspace(sp->est_size, NULL, NULL)) == NULL) {
+	*no_holding_space = TRUE;
+	return IDLE_NO_DISKSPACE;
+    } else if (client_constrained(diskp)) {
+	free_assignedhd(*holdp);
+	*holdp = NULL;
+	return IDLE_CLIENT_CONSTRAINED;
+    }
+    return NOT_IDLE;
+}
+
+/*
+ * Checks of runq_index_pick() for the runq; they are those of dump_dle_idle,
+ * without the side effects of allow_dump_dle.
+ */
+
+typedef struct runq_pick_s {
+    time_t          now;
+    assignedhd_t  **holdp;	/* of the dump accepted */
+} runq_pick_t;
+
+static gboolean
+runq_host_ok(
+    gpointer   data G_GNUC_UNUSED,
+    am_host_t *host)
+{
+    return !host_busy(host);
+}
+
+static gboolean
+runq_spindle_ok(
+    gpointer   data G_GNUC_UNUSED,
+    am_host_t *host,
+    int        spindle)
+{
+    return !spindle_busy(host, spindle);
+}
+
+static gboolean
+runq_sched_ok(
+    gpointer data,
+    sched_t *sp)
+{
+    runq_pick_t *pick = data;
+    assignedhd_t **holdp;
+    gboolean no_holding_space;
+
+    if (dump_dle_idle(sp, NULL, pick->now, 0, &holdp,
+		      &no_holding_space) != NOT_IDLE)
+	return FALSE;
+
+    if (pick->holdp)
+	free_assignedhd(pick->holdp);
+    pick->holdp = holdp;
+    return TRUE;
 }
 
+/* find_diskspace can't find more than what is free on all holding disks */
+static gint64
+runq_size_limit(
+    gpointer data G_GNUC_UNUSED)
+{
+    return holding_free_space();
+}
+
+static const runq_checks_t runq_checks = {
+    runq_host_ok, runq_spindle_ok, runq_sched_ok, runq_size_limit
+};
+
 static void
 allow_dump_dle(
     sched_t        *sp,
@@ -1590,6 +1737,8 @@ allow_dump_dle(
 {
     assignedhd_t **holdp=NULL;
     disk_t        *diskp = sp->disk;
+    gboolean       no_holding_space;
+    int            idle;
 
     /* if the dump can go to that storage */
     if (wtaper) {
@@ -1601,30 +1750,18 @@ allow_dump_dle(
 	}
     }
 
-    if (diskp->host->start_t > now) {
-	*cur_idle = max(*cur_idle, IDLE_START_WAIT);
-	if (*delayed_sp == NULL || sleep_time > diskp->host->start_t) {
-	    *delayed_sp = sp;
-	    sleep_time = diskp->host->start_t;
-	}
-    } else if(diskp->start_t > now) {
+    idle = dump_dle_idle(sp, wtaper, now, extra_tapes_size, &holdp,
+			 &no_holding_space);
+    if (idle == IDLE_START_WAIT) {
+	time_t start_t = diskp->host->start_t > now ? diskp->host->start_t
+						    : diskp->start_t;
+
 	*cur_idle = max(*cur_idle, IDLE_START_WAIT);
-	if (*delayed_sp == NULL || sleep_time > diskp->start_t) {
+	if (*delayed_sp == NULL || sleep_time > start_t) {
 	    *delayed_sp = sp;
-	    sleep_time = diskp->start_t;
+	    sleep_time = start_t;
 	}
-    } else if (diskp->host->netif->curusage > 0 &&
-	       sp->est_kps > network_free_kps(diskp->host->netif)) {
-	*cur_idle = max(*cur_idle, IDLE_NO_BANDWIDTH);
-    } else if (!wtaper && sp->no_space) {
-	*cur_idle = max(*cur_idle, IDLE_NO_DISKSPACE);
-    } else if (!wtaper && diskp->to_holdingdisk == HOLD_NEVER) {
-	*cur_idle = max(*cur_idle, IDLE_NO_HOLD);
-    } else if (extra_tapes_size && sp->est_size > extra_tapes_size) {
-	*cur_idle = max(*cur_idle, IDLE_NO_DISKSPACE);
-	/* no tape space */
-    } else if (!wtaper && (holdp =
-	find_diskspace(sp->est_size, cur_idle, NULL)) == NULL) {
+    } else if (no_holding_space) {
 	*cur_idle = max(*cur_idle, IDLE_NO_DISKSPACE);
 	if (all_tapeq_empty() && dumper_to_holding == 0 && rq != &directq && no_taper_flushing()) {
 	    char *qname = quote_string(diskp->name);
@@ -1644,9 +1781,8 @@ allow_dump_dle(
 	    amfree(qname);
 	    if (empty(*rq) && active_dumper() == 0) { force_flush = 1;}
 	}
-    } else if (client_constrained(diskp)) {
-	free_assignedhd(holdp);
-	*cur_idle = max(*cur_idle, IDLE_CLIENT_CONSTRAINED);
+    } else if (idle != NOT_IDLE) {
+	*cur_idle = max(*cur_idle, idle);
     } else {
 
 	/* disk fits, dump it */
@@ -1706,6 +1842,8 @@ start_some_dumps(
     char *dumporder;
     int  dumper_to_holding = 0;
     gboolean state_changed = FALSE;
+    gboolean runq_exhausted = FALSE;
+    int runq_idle = NOT_IDLE;
 
     /* don't start any actual dumps until the taper is started */
     if (!taper_started && conf_reserve > 0) return;
@@ -1771,6 +1909,11 @@ start_some_dumps(
 	    else
 		dumptype = 'T';
 	}
+	if (!strchr("sStTbB", dumptype)) {
+	    log_add(L_WARNING, _("Unknown dumporder character \'%c\', using 's'.\n"),
+		    dumptype);
+	    dumptype = 's';
+	}
 
 	sp = NULL;
 	//diskp = NULL;
@@ -1865,7 +2008,21 @@ start_some_dumps(
 		}
 	    }
 	}
-	if (sp == NULL) {
+	if (sp == NULL && rq == &runq && !runq_exhausted) {
+	    runq_pick_t pick;
+
+	    pick.now = now;
+	    pick.holdp = NULL;
+	    sp = runq_index_pick(runq_index, dumptype, &runq_checks, &pick,
+				 NULL);
+	    holdp = pick.holdp;
+	}
+	if (sp == NULL && !runq_exhausted) {
+	    /*
+	     * No dump can start: go through the whole queue to find why,
+	     * and to move to the directq the dumps that can't get holding
+	     * disk space.  The other idle dumpers would find the same.
+	     */
 	    for (slist = rq->head; slist != NULL;
 				   slist = slist_next) {
 		slist_next = slist->next;
@@ -1878,6 +2035,12 @@ start_some_dumps(
 	    }
 	    sp = sp_accept;
 	    holdp = holdp_accept;
+	    if (sp == NULL && delayed_sp == NULL) {
+		runq_exhausted = TRUE;
+		runq_idle = cur_idle;
+	    }
+	} else if (sp == NULL) {
+	    cur_idle = max(cur_idle, runq_idle);
 	}
 
 	/* Redo with same dumper if a diskp was moved to directq */
@@ -1909,7 +2072,10 @@ start_some_dumps(
 	    job_t *job = alloc_job();
 
 	    sp->act_size = (off_t)0;
-	    allocate_bandwidth(sp->disk->host->netif, sp->est_kps);
+	    sp->bw_kps = sp->est_kps;
+	    sp->act_kps = 0;
+	    sp->progress_time = 0;
+	    allocate_bandwidth(sp->disk->host->netif, sp->bw_kps);
 	    sp->activehd = assign_holdingdisk(holdp, sp);
 	    amfree(holdp);
 	    g_free(sp->destname);
@@ -1938,6 +2104,10 @@ start_some_dumps(
 	    dumper->sent_command = FALSE;
 	    startup_chunk_process(chunker,chunker_program);
 	    chunker_cmd(chunker, START, NULL, driver_timestamp);
+	    /* before the write command, which tells the chunker whether a
+	     * taper follows the holding file */
+	    if (streaming_flush)
+		start_stream_flush(job);
 	    if (sp->disk->compress == COMP_SERVER_FAST ||
 		sp->disk->compress == COMP_SERVER_BEST ||
 		sp->disk->compress == COMP_SERVER_CUST ||
@@ -1960,7 +2130,10 @@ start_some_dumps(
 	    job_t *job = alloc_job();
 
 	    sp->act_size = (off_t)0;
-	    allocate_bandwidth(sp->disk->host->netif, sp->est_kps);
+	    sp->bw_kps = sp->est_kps;
+	    sp->act_kps = 0;
+	    sp->progress_time = 0;
+	    allocate_bandwidth(sp->disk->host->netif, sp->bw_kps);
 	    sp->disk->host->inprogress++;	/* host is now busy */
 	    sp->disk->inprogress = 1;
 	    job->sched = sp;
@@ -2078,6 +2251,7 @@ start_degraded_mode(
     /*@keep@*/ schedlist_t *queuep)
 {
     schedlist_t newq;
+    GList *slist;
     off_t est_full_size;
     char *qname;
     taper_t  *taper;
@@ -2129,6 +2303,7 @@ start_degraded_mode(
 	    }
 	    else if(sp->degr_level != -1) {
 		sp->level = sp->degr_level;
+		sp->hold_factor = 0.0;
 		sp->dumpdate = g_strdup(sp->degr_dumpdate);
 		sp->est_nsize = sp->degr_nsize;
 		sp->est_csize = sp->degr_csize;
@@ -2146,6 +2321,11 @@ start_degraded_mode(
     }
 
     /*@i@*/ *queuep = newq;
+    if (queuep == &runq) {
+	/* the estimates of the dumps changed */
+	for (slist = runq.head; slist != NULL; slist = slist->next)
+	    runq_index_add(runq_index, get_sched(slist), FALSE);
+    }
     all_degraded_mode = (nb_storage == 0);
     for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
 	all_degraded_mode &= taper->degraded_mode;
@@ -2346,7 +2526,8 @@ handle_taper_result(
 
 	    wtaper->nb_dle--;
 	    wtaper->result = cmd;
-	    if (job->dumper && !dp->dataport_list && !dp->shm_name) {
+	    if (job->dumper && !job->stream_flush &&
+		!dp->dataport_list && !dp->shm_name) {
 		job->dumper->result = FAILED;
 	    }
 	    if (g_str_equal(result_argv[3], "INPUT-ERROR")) {
@@ -2505,7 +2686,8 @@ handle_taper_result(
 	    }
 
 	    wtaper->written += OFF_T_ATOI(result_argv[5]);
-	    if (wtaper->written > sp->act_size)
+	    /* act_size of a dump in progress is its holding reservation */
+	    if (!job->stream_flush && wtaper->written > sp->act_size)
 		sp->act_size = wtaper->written;
 
 	    partsize = 0;
@@ -2827,7 +3009,9 @@ handle_taper_result(
 		    g_free(wtaper->tape_error);
 		    wtaper->tape_error = g_strdup("BOGUS");
 		    wtaper->result = cmd;
-		    if (wtaper->job->dumper) {
+		    if (wtaper->job->stream_flush) {
+			stream_taper_result(wtaper->job);
+		    } else if (wtaper->job->dumper) {
 			if (wtaper->job->dumper->result != LAST_TOK) {
 			    // Dumper already returned it's result
 			    dumper_taper_result(wtaper->job);
@@ -2868,7 +3052,9 @@ handle_taper_result(
 		taper_cmd(taper, wtaper, CLOSE_VOLUME, job->sched, NULL, 0, NULL);
 		wtaper->state &= ~TAPER_STATE_TAPE_STARTED;
 	    }
-	    if (job->sched->action == ACTION_DUMP_TO_TAPE) {
+	    if (job->stream_flush) {
+		stream_taper_result(job);
+	    } else if (job->sched->action == ACTION_DUMP_TO_TAPE) {
 		assert(job->dumper != NULL);
 		if (job->dumper->result != LAST_TOK) {
 		    // Dumper already returned it's result
@@ -3296,7 +3482,7 @@ dumper_taper_result(
     dumper->busy = 0;
     dp->host->inprogress -= 1;
     dp->inprogress = 0;
-    deallocate_bandwidth(dp->host->netif, sp->est_kps);
+    deallocate_bandwidth(dp->host->netif, sp->bw_kps);
     free_serial_job(job);
     free_job(job);
     dumper->job = NULL;
@@ -3386,6 +3572,8 @@ dumper_chunker_result(
     off_t dummy;
     off_t size;
     int is_partial;
+    sched_t  *stream_sp = NULL;
+    wtaper_t *stream_wtaper = NULL;
 
     dumper  = job->dumper;
     chunker = job->chunker;
@@ -3411,9 +3599,17 @@ dumper_chunker_result(
 	update_failed_dump(sp);
     }
 
-    deallocate_bandwidth(dp->host->netif, sp->est_kps);
+    deallocate_bandwidth(dp->host->netif, sp->bw_kps);
 
     is_partial = dumper->result != DONE || chunker->result != DONE;
+    if (job->stream_flush) {
+	/* the taper keeps the job until it is done with the holding file */
+	stream_wtaper = job->wtaper;
+	stream_sp = dup_flush_sched(sp);
+	job->sched = stream_sp;
+	taper_cmd(stream_wtaper->taper, stream_wtaper,
+		  is_partial ? FAILED : DONE, sp, NULL, 0, NULL);
+    }
     rename_tmp_holding(sp->destname, !is_partial);
     holding_set_from_driver(sp->destname, sp->origsize,
 		sp->native_crc, sp->client_crc,
@@ -3427,6 +3623,7 @@ dumper_chunker_result(
 
     size = holding_file_size(sp->destname, 0);
     h[activehd]->used = size - dummy;
+    holding_sample_kps(h[activehd]);
     h[activehd]->disk->allocated_dumpers--;
     adjust_diskspace(sp, DONE);
 
@@ -3477,17 +3674,18 @@ dumper_chunker_result(
 
 		for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
 		    if (g_str_equal(storage_name, taper->storage_name)) {
-			sched_t *sp1 = g_new0(sched_t, 1);
-			*sp1 = *sp;
-			sp1->action = ACTION_FLUSH;
-	                sp1->destname = g_strdup(sp->destname);
-	                sp1->dumpdate = g_strdup(sp->dumpdate);
-	                sp1->degr_dumpdate = g_strdup(sp->degr_dumpdate);
-	                sp1->degr_mesg = g_strdup(sp->degr_mesg);
-	                sp1->datestamp = g_strdup(sp->datestamp);
-			enqueue_sched(&taper->tapeq, sp1);
-
-			sp1->command_id = cmddata->id;
+			if (stream_wtaper && !is_partial &&
+			    stream_wtaper->taper == taper) {
+			    /* already written by the streaming flush,
+			     * file_taper_result completes it */
+			    stream_sp->command_id = cmddata->id;
+			    job->stream_flush = FALSE;
+			} else {
+			    sched_t *sp1 = dup_flush_sched(sp);
+			    enqueue_sched(&taper->tapeq, sp1);
+
+			    sp1->command_id = cmddata->id;
+			}
 			g_printf("driver: to write host %s disk %s date %s on storage %s\n",
 				 dp->host->hostname, qname, driver_timestamp, taper->storage_name);
 		    }
@@ -3509,8 +3707,13 @@ dumper_chunker_result(
     chunker->fd = -1;
     chunker->down = 1;
 
-    free_serial_job(job);
-    free_job(job);
+    if (stream_wtaper) {
+	job->dumper = NULL;
+	job->chunker = NULL;
+    } else {
+	free_serial_job(job);
+	free_job(job);
+    }
     dumper->job = NULL;
     chunker->job = NULL;
 
@@ -3527,6 +3730,134 @@ dumper_chunker_result(
     start_a_vault();
 }
 
+/* a copy of sp to flush the holding file it points to */
+static sched_t *
+dup_flush_sched(
+    sched_t *sp)
+{
+    sched_t *sp1 = g_new0(sched_t, 1);
+
+    *sp1 = *sp;
+    sp1->action = ACTION_FLUSH;
+    sp1->destname = g_strdup(sp->destname);
+    sp1->dumpdate = g_strdup(sp->dumpdate);
+    sp1->degr_dumpdate = g_strdup(sp->degr_dumpdate);
+    sp1->degr_mesg = g_strdup(sp->degr_mesg);
+    sp1->datestamp = g_strdup(sp->datestamp);
+    sp1->src_storage = g_strdup(sp->src_storage);
+    sp1->src_pool = g_strdup(sp->src_pool);
+    sp1->src_label = g_strdup(sp->src_label);
+    sp1->try_again_message = NULL;
+    return sp1;
+}
+
+/*
+ * Start writing a dump to a storage while the chunker is still writing it
+ * to the holding disk.  Only an idle worker with a volume already started
+ * is used, a streaming flush never asks for a new volume.  The dump stays
+ * on the holding disk until the write is done.
+ */
+static void
+start_stream_flush(
+    job_t *job)
+{
+    sched_t  *sp = job->sched;
+    disk_t   *dp = sp->disk;
+    taper_t  *taper;
+    wtaper_t *wtaper = NULL;
+
+    for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
+	if (!taper->storage_name || !taper->flush_storage ||
+	    taper->degraded_mode || taper->down ||
+	    !dump_match_selection(taper->storage_name, sp))
+	    continue;
+	wtaper = idle_taper(taper);
+	if (wtaper &&
+	    wtaper->state & TAPER_STATE_TAPE_STARTED &&
+	    wtaper->nb_dle < taper->max_dle_by_volume &&
+	    (dp->tape_splitsize || dp->allow_split ||
+	     sp->est_size <= wtaper->left))
+	    break;
+	wtaper = NULL;
+    }
+    if (!wtaper)
+	return;
+
+    job->wtaper = wtaper;
+    job->stream_flush = TRUE;
+    wtaper->job = job;
+
+    amfree(wtaper->input_error);
+    amfree(wtaper->tape_error);
+    wtaper->result = LAST_TOK;
+    wtaper->sendresult = FALSE;
+    amfree(wtaper->first_label);
+    amfree(wtaper->dst_labels_str);
+    if (wtaper->dst_labels) {
+	slist_free_full(wtaper->dst_labels, g_free);
+	wtaper->dst_labels = NULL;
+    }
+    wtaper->written = 0;
+    wtaper->state &= ~TAPER_STATE_IDLE;
+    wtaper->state |= TAPER_STATE_FILE_TO_TAPE;
+    if (taper->nb_wait_reply == 0) {
+	taper->ev_read = event_create(taper->fd, EV_READFD,
+				      handle_taper_result, taper);
+	event_activate(taper->ev_read);
+    }
+    taper->nb_wait_reply++;
+    wtaper->nb_dle++;
+    taper_cmd(taper, wtaper, STREAM_WRITE, sp, sp->destname,
+	      sp->level, sp->datestamp);
+}
+
+/*
+ * The taper is done with a STREAM-WRITE that file_taper_result will not
+ * handle: it failed while the dump was running, or the dump itself failed.
+ * A dump still running is flushed from the holding disk as usual.
+ */
+static void
+stream_taper_result(
+    job_t *job)
+{
+    wtaper_t *wtaper = job->wtaper;
+    taper_t  *taper  = wtaper->taper;
+    sched_t  *sp     = job->sched;
+    char     *qname  = quote_string(sp->disk->name);
+
+    g_printf("driver: streaming flush of %s %s stopped: %s\n",
+	     sp->disk->host->hostname, qname,
+	     wtaper->tape_error ? wtaper->tape_error :
+	     wtaper->input_error ? wtaper->input_error : "dump failed");
+    amfree(qname);
+
+    job->wtaper = NULL;
+    job->stream_flush = FALSE;
+    wtaper->job = NULL;
+    wtaper->state &= ~TAPER_STATE_FILE_TO_TAPE;
+    if (!(wtaper->state & (TAPER_STATE_WAIT_CLOSED_VOLUME|TAPER_STATE_WAIT_CLOSED_SOURCE_VOLUME))) {
+	wtaper->state |= TAPER_STATE_IDLE;
+    }
+    amfree(wtaper->input_error);
+    amfree(wtaper->tape_error);
+    taper->nb_wait_reply--;
+    if (taper->nb_wait_reply == 0) {
+	event_release(taper->ev_read);
+	taper->ev_read = NULL;
+    }
+
+    if (!job->dumper) {
+	free_sched(sp);
+	free_serial_job(job);
+	free_job(job);
+    }
+
+    continue_port_dumps();
+    start_some_dumps(&runq);
+    start_a_flush();
+    start_a_vault();
+}
+
 static gboolean
 dump_match_selection(
     char    *storage_n,
@@ -3615,6 +3946,17 @@ handle_dumper_result(
 	    }
 	}
 
+	if (cmd == PROGRESS) { /* PROGRESS <handle> <received> */
+	    if (result_argc != 3) {
+		error(_("error [dumper PROGRESS result_argc != 3: %d]"), result_argc);
+		/*NOTREACHED*/
+	    }
+	    if (adaptive_bandwidth)
+		update_bandwidth(sp, OFF_T_ATOI(result_argv[2]));
+	    g_strfreev(result_argv);
+	    continue;
+	}
+
 	qname = quote_string(dp->name);
 	switch(cmd) {
 
@@ -3819,6 +4161,7 @@ handle_chunker_result(
     char **result_argv;
     int dummy;
     int activehd;
+    int i;
     char *qname;
 
     assert(chunker != NULL);
@@ -3964,15 +4307,24 @@ handle_chunker_result(
 		error(_("!h || activehd < 0"));
 		/*NOTREACHED*/
 	    }
-	    h[activehd]->disk->allocated_dumpers--;
 	    h[activehd]->used = h[activehd]->reserved;
+	    holding_sample_kps(h[activehd]);
+	    h[activehd]->disk->allocated_dumpers--;
 	    if( h[++activehd] ) { /* There's still some allocated space left.
 				   * Tell the dumper about it. */
 		sp->activehd++;
 		chunker_cmd(chunker, CONTINUE, sp, NULL);
 	    } else { /* !h[++activehd] - must allocate more space */
-		sp->act_size = sp->est_size; /* not quite true */
-		sp->est_size = (sp->act_size/(off_t)20) * (off_t)21; /* +5% */
+		/* all reserved space is used, grow the reservation by 5%,
+		 * doubled on each request, up to 40%, a dump that outgrew
+		 * its estimate is likely to outgrow it by much more */
+		sp->act_size = 0;
+		for (i = 0; i < activehd; i++)
+		    sp->act_size += h[i]->reserved;
+		if (sp->more_disk < 3)
+		    sp->more_disk++;
+		sp->est_size = sp->act_size +
+			       (sp->act_size/(off_t)20) * (off_t)(1 << (sp->more_disk-1));
 		sp->est_size = am_round(sp->est_size, (off_t)DISK_BLOCK_KB);
 		if (sp->est_size < sp->act_size + 2*DISK_BLOCK_KB)
 		    sp->est_size += 2 * DISK_BLOCK_KB;
@@ -4686,6 +5038,10 @@ cmdfile_vault(
     if (cmddata->start_time > now)
 	return;
 
+    /* amvault --parallel only wants the commands it added */
+    if (vault_pid != 0 && cmddata->working_pid != vault_pid)
+	return;
+
     // find taper_t for the storage
     for (i=0; i < nb_storage ; i++) {
 	if (tapetable[i].storage_name &&
@@ -4905,15 +5261,15 @@ network_free_kps(
 	unsigned long maxusage=0;
 	unsigned long curusage=0;
 	for(p = disklist_netifs(); p != NULL; p = p->next) {
-	    maxusage += interface_get_maxusage(p->config);
+	    maxusage += p->maxusage;
 	    curusage += p->curusage;
 	}
 	if (maxusage >= curusage)
 	    res = maxusage - curusage;
 #ifndef __lint
     } else {
-	if ((unsigned long)interface_get_maxusage(ip->config) >= ip->curusage)
-	    res = interface_get_maxusage(ip->config) - ip->curusage;
+	if (ip->maxusage >= ip->curusage)
+	    res = ip->maxusage - ip->curusage;
 #endif
     }
 
@@ -4951,6 +5307,119 @@ deallocate_bandwidth(
     ip->curusage -= kps;
 }
 
+/*
+ * With bandwidth-allocation "adaptive", a running dump is charged its
+ * measured rate instead of its estimated one, and the limit of each
+ * interface follows the measured rates, much like a TCP congestion window:
+ * it is raised by a step while the interface is near its limit and the
+ * dumps run at their usual rate, and halved, down to the measured total,
+ * when they run at less than CONGESTED of it.
+ */
+#define CONGESTED	0.5
+#define NEAR_LIMIT	0.9
+
+/* Sum the measured and the estimated rates of the running dumps that have a
+ * measured rate, of host HOST or on interface IP. */
+static int
+measured_kps(
+    am_host_t *		host,
+    netif_t *		ip,
+    double *		act_kps,
+    double *		est_kps)
+{
+    dumper_t *dumper;
+    int nb = 0;
+
+    *act_kps = *est_kps = 0.0;
+    for (dumper = dmptable; dumper < dmptable + inparallel; dumper++) {
+	sched_t *sp;
+
+	if (!dumper->busy || !dumper->job || !dumper->job->sched)
+	    continue;
+	sp = dumper->job->sched;
+	if (sp->act_kps == 0)
+	    continue;
+	if (host && sp->disk->host != host)
+	    continue;
+	if (ip && sp->disk->host->netif != ip)
+	    continue;
+	*act_kps += (double)sp->act_kps;
+	*est_kps += (double)sp->est_kps;
+	nb++;
+    }
+    return nb;
+}
+
+/* The dumps of HOST are slowed down; starting another one won't help */
+static gboolean
+host_congested(
+    am_host_t *		host)
+{
+    double act_kps, est_kps;
+
+    if (!measured_kps(host, NULL, &act_kps, &est_kps))
+	return FALSE;
+    return act_kps < est_kps * CONGESTED;
+}
+
+/* The dumper of SP reported that RECEIVED kb were received so far */
+static void
+update_bandwidth(
+    sched_t *		sp,
+    off_t		received)
+{
+    netif_t *ip = sp->disk->host->netif;
+    double now = g_timeval_to_double(curclock());
+    double kps, act_kps, est_kps;
+    unsigned long step;
+
+    /* the first report only sets the starting point, the dump may have
+     * spent some time before sending data */
+    if (sp->progress_time == 0 || now <= sp->progress_time ||
+	received < sp->progress_size) {
+	sp->progress_size = received;
+	sp->progress_time = now;
+	return;
+    }
+
+    kps = (double)(received - sp->progress_size) / (now - sp->progress_time);
+    sp->progress_size = received;
+    sp->progress_time = now;
+
+    if (sp->act_kps == 0) {
+	sp->act_kps = (unsigned long)kps;
+    } else {
+	sp->act_kps = (unsigned long)((sp->act_kps + kps) / 2);
+    }
+    if (sp->act_kps == 0)
+	sp->act_kps = 1;
+
+    deallocate_bandwidth(ip, sp->bw_kps);
+    sp->bw_kps = sp->act_kps;
+    allocate_bandwidth(ip, sp->bw_kps);
+
+    if (!measured_kps(NULL, ip, &act_kps, &est_kps))
+	return;
+
+    if (act_kps < est_kps * CONGESTED) {
+	unsigned long maxusage = MAX((unsigned long)act_kps, ip->maxusage / 2);
+	if (maxusage < ip->maxusage) {
+	    ip->maxusage = maxusage;
+	    g_printf(_("driver: interface-limit time %s if %s: %lu (congested)\n"),
+		     walltime_str(curclock()), interface_name(ip->config),
+		     ip->maxusage);
+	}
+    } else if (ip->curusage >= ip->maxusage * NEAR_LIMIT &&
+	       time(NULL) >= ip->raised + PROGRESS_INTERVAL) {
+	step = interface_get_maxusage(ip->config) / 10;
+	ip->maxusage += MAX(step, 1);
+	ip->raised = time(NULL);
+	g_printf(_("driver: interface-limit time %s if %s: %lu\n"),
+		 walltime_str(curclock()), interface_name(ip->config),
+		 ip->maxusage);
+    }
+}
+
 /* ------------ */
 static off_t
 holding_free_space(void)
@@ -4968,6 +5437,59 @@ holding_free_space(void)
     return total_free;
 }
 
+/* Update the write rate of the holding disk of H, from what the chunker
+ * wrote since it started writing to it.  The rate is the rate of one
+ * dumper multiplied by the number of dumpers writing to the disk.
+ */
+static void
+holding_sample_kps(
+    assignedhd_t *h)
+{
+    holdalloc_t *ha = h->disk;
+    double now = g_timeval_to_double(curclock());
+    unsigned long kps;
+
+    if (h->start_time == 0.0 || now < h->start_time + 1.0 ||
+	h->used <= h->start_used)
+	return;
+
+    kps = (unsigned long)((double)(h->used - h->start_used) /
+			  (now - h->start_time));
+    kps *= MAX(ha->allocated_dumpers, 1);
+    if (ha->kps == 0)
+	ha->kps = kps;
+    else
+	ha->kps = (ha->kps * 3 + kps) / 4;
+    h->start_time = 0.0;
+    hold_debug(1, _("holding_sample_kps: hdisk %s kps %lu\n"),
+		   holdingdisk_name(ha->hdisk), ha->kps);
+}
+
+/* Is HA a better choice than MINP for a new dump? Use the write rate a new
+ * dumper would get if it is known for both disks and they differ by more
+ * than 25%, otherwise the number of dumpers and the free space.
+ */
+static gboolean
+holding_prefer(
+    holdalloc_t *ha,
+    holdalloc_t *minp)
+{
+    double ha_kps, minp_kps;
+
+    if (ha->kps > 0 && minp->kps > 0) {
+	ha_kps = (double)ha->kps / (ha->allocated_dumpers + 1);
+	minp_kps = (double)minp->kps / (minp->allocated_dumpers + 1);
+	if (ha_kps > minp_kps * 1.25)
+	    return TRUE;
+	if (minp_kps > ha_kps * 1.25)
+	    return FALSE;
+    }
+
+    return ha->allocated_dumpers < minp->allocated_dumpers ||
+	   (ha->allocated_dumpers == minp->allocated_dumpers &&
+	    ha->disksize-ha->allocated_space > minp->disksize-minp->allocated_space);
+}
+
 /*
  * We return an array of pointers to assignedhd_t. The array contains at
  * most one entry per holding disk. The list of pointers is terminated by
@@ -5011,7 +5533,8 @@ find_diskspace(
 
     while( i < num_holdalloc && size > (off_t)0 ) {
 	/* find the holdingdisk with the fewest active dumpers and among
-	 * those the one with the biggest free space
+	 * those the one with the biggest free space, or the one that will
+	 * give the best write rate if it is known
 	 */
 	minp = NULL; minj = -1;
 	for(j = 0, ha = holdalloc; ha != NULL; ha = ha->next, j++ ) {
@@ -5023,10 +5546,7 @@ find_diskspace(
 	    }
 	    else if( ha->allocated_space <= ha->disksize - (off_t)(2*DISK_BLOCK_KB) &&
 		!used[j] &&
-		(!minp ||
-		 ha->allocated_dumpers < minp->allocated_dumpers ||
-		 (ha->allocated_dumpers == minp->allocated_dumpers &&
-		  ha->disksize-ha->allocated_space > minp->disksize-minp->allocated_space)) ) {
+		(!minp || holding_prefer(ha, minp)) ) {
 		minp = ha;
 		minj = j;
 	    }
@@ -5060,6 +5580,8 @@ find_diskspace(
 	result[i]->reserved = halloc;
 	result[i]->used = (off_t)0;
 	result[i]->destname = NULL;
+	result[i]->start_time = 0.0;
+	result[i]->start_used = (off_t)0;
 	result[i+1] = NULL;
 	i++;
     }
@@ -5329,6 +5851,8 @@ build_diskspace(
 	    result[i]->reserved = used[j];
 	    result[i]->used = used[j];
 	    result[i]->destname = g_strdup(destname);
+	    result[i]->start_time = 0.0;
+	    result[i]->start_used = (off_t)0;
 	    result[i+1] = NULL;
 	    i++;
 	}
@@ -5350,8 +5874,8 @@ holdingdisk_state(
 
     for(ha = holdalloc, dsk = 0; ha != NULL; ha = ha->next, dsk++) {
 	diff = ha->disksize - ha->allocated_space;
-	g_printf(_(" hdisk %d: free %lld dumpers %d"), dsk,
-	       (long long)diff, ha->allocated_dumpers);
+	g_printf(_(" hdisk %d: free %lld dumpers %d kps %lu"), dsk,
+	       (long long)diff, ha->allocated_dumpers, ha->kps);
     }
     g_printf("\n");
 }
@@ -5869,6 +6393,8 @@ enqueue_sched(
     } else {
 	list->tail = list->head;
     }
+    if (list == &runq)
+	runq_index_add(runq_index, sp, FALSE);
 }
 
 
@@ -5885,6 +6411,8 @@ headqueue_sched(
     if (!list->tail) {
 	list->tail = list->head;
     }
+    if (list == &runq)
+	runq_index_add(runq_index, sp, TRUE);
 }
 
 static void
@@ -5929,6 +6457,8 @@ dequeue_sched(
     list->head = g_list_delete_link(list->head, list->head);
 
     if (list->head == NULL) list->tail = NULL;
+    if (list == &runq)
+	runq_index_remove(runq_index, sp);
 
     return sp;
 }
@@ -5947,6 +6477,8 @@ remove_sched(
     } else {
 	list->head = g_list_remove(list->head, sp);
     }
+    if (list == &runq)
+	runq_index_remove(runq_index, sp);
 }
 
 
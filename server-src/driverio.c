@@ -603,6 +603,7 @@ taper_cmd(
 			    "\n", NULL);
 	break;
     case FILE_WRITE:
+    case STREAM_WRITE:
 	sp = (sched_t *)ptr;
 	dp = sp->disk;
         qname = quote_string(dp->name);
@@ -999,6 +1000,8 @@ chunker_cmd(
 	    qname = quote_string(dp->name);
 	    qdest = quote_string(sp->destname);
 	    h[activehd]->disk->allocated_dumpers++;
+	    h[activehd]->start_time = g_timeval_to_double(curclock());
+	    h[activehd]->start_used = h[activehd]->used;
 	    g_snprintf(number, sizeof(number), "%d", sp->level);
 	    g_snprintf(chunksize, sizeof(chunksize), "%lld",
 		    (long long)holdingdisk_get_chunksize(h[0]->disk->hdisk));
@@ -1017,6 +1020,7 @@ chunker_cmd(
 			    " ", chunksize,
 			    " ", dp->program,
 			    " ", use,
+			    " ", chunker->job->stream_flush ? "1" : "0",
 			    " |", o,
 			    "\n", NULL);
 	    amfree(features);
@@ -1040,6 +1044,8 @@ chunker_cmd(
 	    qname = quote_string(dp->name);
 	    qdest = quote_string(h[activehd]->destname);
 	    h[activehd]->disk->allocated_dumpers++;
+	    h[activehd]->start_time = g_timeval_to_double(curclock());
+	    h[activehd]->start_used = h[activehd]->used;
 	    g_snprintf(chunksize, sizeof(chunksize), "%lld",
 		     (long long)holdingdisk_get_chunksize(h[activehd]->disk->hdisk));
 	    g_snprintf(use, sizeof(use), "%lld",
@@ -1146,6 +1152,7 @@ free_job(
     job->dumper  = NULL;
     job->chunker = NULL;
     job->wtaper  = NULL;
+    job->stream_flush = FALSE;
 }
 
 void
@@ -1301,6 +1308,7 @@ update_info_dumper(
     }
     amfree(conf_infofile);
 
+    begin_info_batch();
     get_info(dp->host->hostname, dp->name, &info);
 
     /* Clean up information about this and higher-level dumps.  This
@@ -1368,7 +1376,8 @@ update_info_dumper(
 	info.history[0].secs  = dumptime;
     }
 
-    if (put_info(dp->host->hostname, dp->name, &info)) {
+    if (put_info(dp->host->hostname, dp->name, &info) ||
+	commit_info_batch()) {
 	int save_errno = errno;
 	g_fprintf(stderr, _("infofile update failed (%s,'%s'): %s\n"),
 		  dp->host->hostname, dp->name, strerror(save_errno));
@@ -1406,6 +1415,7 @@ update_info_taper(
 	/*NOTREACHED*/
     }
 
+    begin_info_batch();
     get_info(dp->host->hostname, dp->name, &info);
 
     infp = &info.inf[level];
@@ -1416,7 +1426,8 @@ update_info_taper(
 
     info.command = NO_COMMAND;
 
-    if (put_info(dp->host->hostname, dp->name, &info)) {
+    if (put_info(dp->host->hostname, dp->name, &info) ||
+	commit_info_batch()) {
 	int save_errno = errno;
 	g_fprintf(stderr, _("infofile update failed (%s,'%s'): %s\n"),
 		  dp->host->hostname, dp->name, strerror(save_errno));
@@ -1429,6 +1440,50 @@ update_info_taper(
     close_infofile();
 }
 
+/* Return the holding disk space to reserve for the dump of SP.  The
+ * estimate of a compressed dump is computed with the average compression
+ * ratio, if the recent ratios vary, the dump can be larger than its
+ * estimate; reserve enough for the worst recent ratio, but never more than
+ * twice the estimate.  The factor is computed once per sched_t and level.
+ */
+off_t
+predict_holding_size(
+    sched_t *sp)
+{
+    info_t info;
+    perf_t *perfp;
+    disk_t *dp = sp->disk;
+    double avg, worst;
+    int i;
+
+    if (sp->hold_factor == 0.0) {
+	sp->hold_factor = 1.0;
+	if (dp->compress != COMP_NONE &&
+	    open_infofile(getconf_str(CNF_INFOFILE)) == 0) {
+	    get_info(dp->host->hostname, dp->name, &info);
+	    close_infofile();
+
+	    if (sp->level == 0) perfp = &info.full;
+	    else perfp = &info.incr;
+
+	    avg = perf_average(perfp->comp, 0.0);
+	    worst = 0.0;
+	    for (i = 0; i < AVG_COUNT; i++) {
+		if (perfp->comp[i] > worst)
+		    worst = perfp->comp[i];
+	    }
+	    if (avg > 0.0 && worst > avg) {
+		sp->hold_factor = worst / avg;
+		if (sp->hold_factor > 2.0)
+		    sp->hold_factor = 2.0;
+	    }
+	}
+    }
+
+    return am_round((off_t)((double)sp->est_size * sp->hold_factor),
+		    (off_t)DISK_BLOCK_KB);
+}
+
 /* Free an array of pointers to assignedhd_t after freeing the
  * assignedhd_t themselves. The array must be NULL-terminated.
  */
@@ -73,6 +73,8 @@ typedef enum action_s {
 typedef struct job_s {
     int               in_use;
     gboolean          do_port_write;
+    gboolean          stream_flush;	/* taper reads the holding file */
+					/* while it is being written    */
     struct sched_s   *sched;
     struct chunker_s *chunker;
     struct dumper_s  *dumper;
@@ -89,6 +91,7 @@ typedef struct holdalloc_s {
     off_t disksize;
     int allocated_dumpers;
     off_t allocated_space;
+    unsigned long kps;		/* measured write rate per dumper, 0 if unknown */
 } holdalloc_t;
 
 typedef struct assignedhd_s {
@@ -96,6 +99,8 @@ typedef struct assignedhd_s {
     off_t		used;
     off_t		reserved;
     char		*destname;
+    double		start_time;	/* when the chunker started writing */
+    off_t		start_used;	/* used at start_time */
 } assignedhd_t;
 
 
@@ -211,6 +216,13 @@ typedef struct sched_s {
     char *dumpdate, *degr_dumpdate;
     char *based_on_timestamp, *degr_based_on_timestamp;
     unsigned long est_kps, degr_kps;
+    unsigned long bw_kps;			/* allocated on the interface */
+    unsigned long act_kps;			/* measured, 0 if not yet */
+    off_t progress_size;			/* at the last PROGRESS */
+    double progress_time;
+    double hold_factor;			/* predicted holding usage / est_size, */
+						/* 0 if not yet */
+    int more_disk;				/* number of RQ-MORE-DISK */
     char *destname;                             /* file/port name */
     assignedhd_t **holdp;
     time_t timestamp;
@@ -255,5 +267,6 @@ void check_unfree_serial(void);
 char *job2serial(job_t *job);
 void update_info_dumper(sched_t *sp, off_t origsize, off_t dumpsize, time_t dumptime);
 void update_info_taper(sched_t *sp, char *label, off_t filenum, int level);
+off_t predict_holding_size(sched_t *sp);
 void free_assignedhd(assignedhd_t **holdp);
 #endif	/* !DRIVERIO_H */
@@ -45,6 +45,9 @@
 #include "amutil.h"
 #include "timestamp.h"
 #include "amxml.h"
+#include "amcompress.h"
+#include "pipespawn.h"
+#include "sortedindex.h"
 
 #ifdef FAILURE_CODE
 static int dumper_try_again=0;
@@ -75,6 +78,8 @@ struct databuf {
     char *dataout;
     char *datalimit;
     pid_t compresspid;		/* valid if fd is pipe to compress */
+    am_compress_t *compress;	/* valid if compressing in-process */
+    int compress_errno;		/* errno of the failed write of compressed data */
     pid_t encryptpid;		/* valid if fd is pipe to encrypt */
     shm_ring_t *shm_ring_producer;
     shm_ring_t *shm_ring_consumer;
@@ -141,6 +146,7 @@ static int level;
 static char *dumpdate = NULL;
 static char *dumper_timestamp = NULL;
 static time_t conf_dtimeout;
+static gboolean send_progress;
 static int indexfderror;
 static int set_datafd;
 static char *dle_str = NULL;
@@ -217,6 +223,9 @@ static ssize_t	write_tapeheader(int, dumpfile_t *);
 static void	databuf_init(struct databuf *, int);
 static int	databuf_write(struct databuf *, const void *, size_t);
 static int	databuf_flush(struct databuf *);
+static size_t	databuf_output(struct databuf *, const void *, size_t);
+static int	databuf_start_compress(struct databuf *);
+static int	databuf_finish_compress(struct databuf *);
 static void	process_dumpeof(void);
 static void	process_dumpline(const char *);
 static void	add_msg_data(const char *, size_t);
@@ -226,6 +235,7 @@ static char *	dumper_get_security_conf (char *, void *);
 
 static int	runcompress(int, pid_t *, comp_t, char *);
 static int	runencrypt(int, pid_t *,  encrypt_t, char *);
+static int	runsortindex(int, pid_t *, char *);
 
 static void	sendbackup_response(void *, pkt_t *, security_handle_t *);
 static int	startup_dump(const char *, const char *, const char *, int,
@@ -244,6 +254,8 @@ static gboolean header_sent(struct databuf *db);
 static void	timeout(time_t);
 static void	retimeout(time_t);
 static void	timeout_callback(void *unused);
+static void	progress(gboolean start);
+static void	progress_callback(void *unused);
 static gpointer handle_shm_ring_to_fd_thread(gpointer data);
 static gpointer handle_shm_ring_direct(gpointer data);
 
@@ -479,6 +491,8 @@ main(
     signal(SIGPIPE, SIG_IGN);
 
     conf_dtimeout = (time_t)getconf_int(CNF_DTIMEOUT);
+    send_progress = g_str_equal(getconf_str(CNF_BANDWIDTH_ALLOCATION),
+				"adaptive");
 
     protocol_init();
 
@@ -940,6 +954,8 @@ databuf_init(
     db->buf = NULL;
     db->datain = db->dataout = db->datalimit = NULL;
     db->compresspid = -1;
+    db->compress = NULL;
+    db->compress_errno = 0;
     db->encryptpid = -1;
     db->shm_ring_producer = NULL;
     db->shm_ring_consumer = NULL;
@@ -986,7 +1002,7 @@ databuf_flush(
     /*
      * Write out the buffer
      */
-    written = full_write(db->fd, db->dataout,
+    written = databuf_output(db, db->dataout,
 			(size_t)(db->datain - db->dataout));
     if (written > 0) {
 	crc32_add((uint8_t *)db->dataout, written, &crc_data_out);
@@ -1010,6 +1026,108 @@ databuf_flush(
     return 0;
 }
 
+/*
+ * Output callback of the in-process compressor: write the compressed data
+ * to the output fd.
+ */
+static gboolean
+databuf_compress_output(
+    gpointer	data,
+    gpointer	buf,
+    gsize	size)
+{
+    struct databuf *db = data;
+    size_t written;
+
+    written = full_write(db->fd, buf, size);
+    if (written != size)
+	db->compress_errno = errno? errno : EIO;
+    g_free(buf);
+    return written == size;
+}
+
+/*
+ * Write data to the output fd, through the compressor if there is one.
+ * Returns the number of bytes consumed, as full_write does, with errno set
+ * on error.
+ */
+static size_t
+databuf_output(
+    struct databuf *	db,
+    const void *	buf,
+    size_t		size)
+{
+    if (!db->compress)
+	return full_write(db->fd, buf, size);
+
+    if (!am_compress_write(db->compress, buf, size)) {
+	g_debug("data compress: %s", am_compress_error(db->compress));
+	errno = db->compress_errno? db->compress_errno : EIO;
+	return 0;
+    }
+    return size;
+}
+
+/*
+ * Setup the compression of the data output.  COMP_FAST and COMP_BEST are
+ * done in-process when the compression program is gzip, anything else is
+ * done by running the compression program.
+ */
+static int
+databuf_start_compress(
+    struct databuf *	db)
+{
+    char *errmsg = NULL;
+    int level;
+    int nthreads = getconf_int(CNF_COMPRESS_THREADS);
+
+    if (srvcompress == COMP_SERVER_CUST ||
+	!g_str_equal(COMPRESS_SUFFIX, ".gz") ||
+	!am_compress_supported(AM_COMPRESS_GZIP)) {
+	write_to = "compression program";
+	return runcompress(db->fd, &db->compresspid, srvcompress, "data compress");
+    }
+
+    level = srvcompress == COMP_BEST ? am_compress_best_level(AM_COMPRESS_GZIP)
+				     : am_compress_fast_level(AM_COMPRESS_GZIP);
+    /* compress in parallel blocks, with a seek table, if there is more
+     * than one thread */
+    db->compress = am_compress_new(AM_COMPRESS_GZIP, level, nthreads, 0,
+				   nthreads > 1 ? AM_COMPRESS_SEEK_TABLE : 0,
+				   databuf_compress_output, db, &errmsg);
+    if (!db->compress) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("data compress: %s"), errmsg);
+	g_free(errmsg);
+	return -1;
+    }
+    g_debug("data compress: in-process gzip, level %d, %d thread%s", level,
+	    nthreads, nthreads > 1 ? "s" : "");
+    return 0;
+}
+
+/*
+ * Flush the end of the compressed stream to the output fd.
+ */
+static int
+databuf_finish_compress(
+    struct databuf *	db)
+{
+    if (!db->compress)
+	return 0;
+
+    if (!am_compress_finish(db->compress)) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("data compress: %s"),
+				 am_compress_error(db->compress));
+	return -1;
+    }
+    g_debug("data compress: %lld bytes compressed to %lld bytes",
+	    (long long)am_compress_bytes_in(db->compress),
+	    (long long)am_compress_bytes_out(db->compress));
+    return 0;
+}
+
 static void
 process_dumpeof(void)
 {
@@ -1549,6 +1667,7 @@ do_dump(
     times_t runtime;
     double dumptime;	/* Time dump took in secs */
     pid_t indexpid = -1;
+    gboolean sorted_index = FALSE;
     char *m;
     int to_unlink = 1;
 
@@ -1594,7 +1713,12 @@ do_dump(
 						COMPRESS_SUFFIX);
 
     if (streams[INDEXFD].fd != NULL) {
-	if (getconf_boolean(CNF_COMPRESS_INDEX)) {
+	sorted_index = getconf_boolean(CNF_SORT_INDEX) &&
+		       getconf_boolean(CNF_COMPRESS_INDEX) &&
+		       sorted_index_supported();
+	if (sorted_index) {
+	    indexfile_real = getindex_sorted_idx_fname(hostname, diskname, dumper_timestamp, level);
+	} else if (getconf_boolean(CNF_COMPRESS_INDEX)) {
 	    indexfile_real = getindex_unsorted_gz_fname(hostname, diskname, dumper_timestamp, level);
 	} else {
 	    indexfile_real = getindex_unsorted_fname(hostname, diskname, dumper_timestamp, level);
@@ -1615,6 +1739,11 @@ do_dump(
 	    errstr = g_strdup_printf(_("err open %s: %s"),
                                      indexfile_tmp, strerror(errno));
 	    goto failed;
+	} else if (sorted_index) {
+	    if (runsortindex(indexout, &indexpid, "index sort") < 0) {
+		aclose(indexout);
+		goto failed;
+	    }
 	} else if (getconf_boolean(CNF_COMPRESS_INDEX)) {
 	    if (runcompress(indexout, &indexpid, COMP_BEST, "index compress") < 0) {
 		aclose(indexout);
@@ -1696,6 +1825,7 @@ do_dump(
 	g_mutex_lock(shm_thread_mutex);
     }
     timeout(conf_dtimeout);
+    progress(TRUE);
     if (shm_thread) {
 	g_cond_broadcast(shm_thread_cond);
 	g_mutex_unlock(shm_thread_mutex);
@@ -1813,7 +1943,13 @@ do_dump(
 	    waitpid(indexpid,&index_status,0);
 	    log_add(L_INFO, "pid-done %ld", (long)indexpid);
 	}
-	if (rename(indexfile_tmp, indexfile_real) != 0) {
+	if (sorted_index && (indexpid <= 0 || !WIFEXITED(index_status) ||
+			     WEXITSTATUS(index_status) != 0)) {
+	    /* a partial sorted index is useless, and would be rejected */
+	    log_add(L_WARNING, _("could not write the sorted index \"%s\""),
+		    indexfile_real);
+	    unlink(indexfile_tmp);
+	} else if (rename(indexfile_tmp, indexfile_real) != 0) {
 	    log_add(L_WARNING, _("could not rename \"%s\" to \"%s\": %s"),
 		    indexfile_tmp, indexfile_real, strerror(errno));
 	}
@@ -1951,6 +2087,8 @@ do_dump(
 
     if (data_path == DATA_PATH_AMANDA)
 	aclose(db->fd);
+    am_compress_free(db->compress);
+    db->compress = NULL;
 
     amfree(state_filename);
     amfree(state_filename_gz);
@@ -1967,6 +2105,8 @@ failed:
     amfree(m);
 
     aclose(db->fd);
+    am_compress_free(db->compress);
+    db->compress = NULL;
     /* kill all child process */
     if (db->compresspid != -1) {
 	g_fprintf(stderr,_("%s: kill compress command\n"),get_pname());
@@ -2149,8 +2289,7 @@ handle_shm_ring_to_fd_thread(
 	     * reading the datafd.
 	     */
 	    if ((srvcompress != COMP_NONE) && (srvcompress != COMP_CUST)) {
-		write_to = "compression program";
-		if (runcompress(db->fd, &db->compresspid, srvcompress, "data compress") < 0) {
+		if (databuf_start_compress(db) < 0) {
 		    dump_result = 2;
 		    aclose(db->fd);
 		    stop_dump();
@@ -2169,7 +2308,7 @@ handle_shm_ring_to_fd_thread(
 		to_write = db->shm_ring_consumer->block_size;
 
 	    if (to_write + read_offset <= shm_ring_size) {
-		if (full_write(db->fd, db->shm_ring_consumer->data + read_offset, to_write) != to_write) {
+		if (databuf_output(db, db->shm_ring_consumer->data + read_offset, to_write) != to_write) {
 		    errstr = g_strdup_printf("write to %s failed: %s", write_to, strerror(errno));
 		    g_debug("%s", errstr);
 		    g_mutex_lock(shm_thread_mutex);
@@ -2187,7 +2326,7 @@ handle_shm_ring_to_fd_thread(
 			      db->crc);
 		}
 	    } else {
-		if (full_write(db->fd, db->shm_ring_consumer->data + read_offset,
+		if (databuf_output(db, db->shm_ring_consumer->data + read_offset,
 			   shm_ring_size - read_offset) != shm_ring_size - read_offset) {
 		    errstr = g_strdup_printf("write to %s failed: %s", write_to, strerror(errno));
 		    g_debug("%s", errstr);
@@ -2201,7 +2340,7 @@ handle_shm_ring_to_fd_thread(
 		    g_mutex_unlock(shm_thread_mutex);
 		    return NULL;
 		}
-		if (full_write(db->fd, db->shm_ring_consumer->data,
+		if (databuf_output(db, db->shm_ring_consumer->data,
 			   to_write - shm_ring_size + read_offset) != to_write - shm_ring_size + read_offset) {
 		    errstr = g_strdup_printf("write to %s failed: %s", write_to, strerror(errno));
 		    g_debug("%s", errstr);
@@ -2233,6 +2372,16 @@ handle_shm_ring_to_fd_thread(
 		db->shm_ring_consumer->mc->eof_flag) {
 		// notify the producer that everythinng is read
 		sem_post(db->shm_ring_consumer->sem_write);
+		if (databuf_finish_compress(db) < 0) {
+		    g_debug("%s", errstr);
+		    g_mutex_lock(shm_thread_mutex);
+		    dump_result = 2;
+		    aclose(db->fd);
+		    stop_dump();
+		    g_cond_broadcast(shm_thread_cond);
+		    g_mutex_unlock(shm_thread_mutex);
+		    return NULL;
+		}
 		goto shm_done;
 	    }
 	}
@@ -2698,8 +2847,7 @@ read_datafd(
 	 * reading the datafd.
 	 */
 	if ((srvcompress != COMP_NONE) && (srvcompress != COMP_CUST)) {
-	    write_to = "compression program";
-	    if (runcompress(db->fd, &db->compresspid, srvcompress, "data compress") < 0) {
+	    if (databuf_start_compress(db) < 0) {
 		dump_result = 2;
 		aclose(db->fd);
 		stop_dump();
@@ -2720,7 +2868,9 @@ read_datafd(
      * EOF.  Stop and return.
      */
     if (size == 0) {
-	databuf_flush(db);
+	if (databuf_flush(db) == 0 && databuf_finish_compress(db) < 0) {
+	    dump_result = 2;
+	}
 	if (dumpbytes != (off_t)0) {
 	    dumpsize += (off_t)1;
 	}
@@ -3109,6 +3259,56 @@ stop_dump(void)
     aclose(indexout);
     aclose(g_databuf->fd);
     timeout(0);
+    progress(FALSE);
+}
+
+/*
+ * Start or stop reporting to the driver, every PROGRESS_INTERVAL seconds,
+ * how much data was received from the client.  The driver uses it to
+ * measure the rate of the dump.
+ */
+static event_handle_t *ev_progress = NULL;
+
+static void
+progress(
+    gboolean start)
+{
+    if (!start) {
+	if (ev_progress != NULL) {
+	    event_release(ev_progress);
+	    ev_progress = NULL;
+	}
+	return;
+    }
+
+    if (send_progress && ev_progress == NULL) {
+	ev_progress = event_create((event_id_t)PROGRESS_INTERVAL, EV_TIME,
+				   progress_callback, NULL);
+	event_activate(ev_progress);
+    }
+}
+
+static void
+progress_callback(
+    void *	unused)
+{
+    struct databuf *db = g_databuf;
+    off_t received;
+
+    (void)unused;	/* Quiet unused parameter warning */
+
+    /* the same counters as the final dumpsize */
+    if (db->shm_ring_producer) {
+	received = db->shm_ring_producer->mc->written;
+    } else if (db->shm_ring_direct) {
+	received = db->shm_ring_direct->mc->written;
+    } else if (db->shm_ring_consumer) {
+	received = db->shm_ring_consumer->mc->written;
+    } else {
+	received = crc_data_in.size;
+    }
+
+    putresult(PROGRESS, "%s %lld\n", handle, (long long)(received / 1024));
 }
 
 
@@ -3222,6 +3422,119 @@ runcompress(
     return (-1);
 }
 
+/*
+ * Runs the index sort with the first arg as its stdout.  Returns
+ * 0 on success or negative if error, and it's pid via the second
+ * argument.  The outfd arg is dup2'd to the pipe to the sort process,
+ * which runs 'sort' on the index lines and writes its output as a
+ * sorted index (see sortedindex.h).
+ */
+static int
+runsortindex(
+    int		outfd,
+    pid_t *	pid,
+    char       *name)
+{
+    int outpipe[2], rval;
+    int errpipe[2];
+    filter_t *filter;
+
+    assert(outfd >= 0);
+    assert(pid != NULL);
+
+    /* outpipe[0] is pipe's stdin, outpipe[1] is stdout. */
+    if (pipe(outpipe) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("pipe: %s"), strerror(errno));
+	return (-1);
+    }
+
+    /* errpipe[0] is pipe's output, outpipe[1] is input. */
+    if (pipe(errpipe) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("pipe: %s"), strerror(errno));
+	return (-1);
+    }
+
+    g_debug("execute: %s -T %s", SORT_PATH, getconf_str(CNF_TMPDIR));
+    switch (*pid = fork()) {
+    case -1:
+	g_free(errstr);
+	errstr = g_strdup_printf(_("couldn't fork: %s"), strerror(errno));
+	aclose(outpipe[0]);
+	aclose(outpipe[1]);
+	aclose(errpipe[0]);
+	aclose(errpipe[1]);
+	return (-1);
+    default:
+	rval = dup2(outpipe[1], outfd);
+	if (rval < 0) {
+	    g_free(errstr);
+	    errstr = g_strdup_printf(_("couldn't dup2: %s"), strerror(errno));
+	}
+	aclose(outpipe[1]);
+	aclose(outpipe[0]);
+	aclose(errpipe[1]);
+	filter = g_new0(filter_t, 1);
+	filter->fd = errpipe[0];
+	filter->name = g_strdup(name);
+	filter->buffer = NULL;
+	filter->size = 0;
+	filter->allocated_size = 0;
+	filter->event = event_create((event_id_t)filter->fd, EV_READFD,
+				     handle_filter_stderr, filter);
+	event_activate(filter->event);
+	return (rval);
+    case 0: {
+	int in_fd = 0;
+	int sort_fd;
+	int err_fd = 2;
+	pid_t sort_pid;
+	amwait_t sort_status;
+	char *errmsg = NULL;
+
+	close(outpipe[1]);
+	close(errpipe[0]);
+	if (dup2(outpipe[0], 0) < 0) {
+	    error(_("err dup2 in: %s"), strerror(errno));
+	    /*NOTREACHED*/
+	}
+	if (dup2(outfd, 1) == -1) {
+	    error(_("err dup2 out: %s"), strerror(errno));
+	    /*NOTREACHED*/
+	}
+	if (dup2(errpipe[1], 2) == -1) {
+	    error(_("err dup2 err: %s"), strerror(errno));
+	    /*NOTREACHED*/
+	}
+	safe_fd(-1, 0);
+	set_root_privs(-1);
+
+	/* sorted_index_write_from_fd needs bytewise collation; safe_env()
+	 * does not strip the locale in every build, so force it */
+	putenv(g_strdup("LC_ALL=C"));
+	sort_pid = pipespawn(SORT_PATH, STDOUT_PIPE, 0,
+			     &in_fd, &sort_fd, &err_fd,
+			     SORT_PATH, "-T", getconf_str(CNF_TMPDIR), NULL);
+	close(0);
+	if (!sorted_index_write_from_fd(sort_fd, 1, &errmsg)) {
+	    g_fprintf(stderr, "error: %s\n", errmsg);
+	    exit(1);
+	}
+	close(sort_fd);
+	waitpid(sort_pid, &sort_status, 0);
+	if (!WIFEXITED(sort_status) || WEXITSTATUS(sort_status) != 0) {
+	    g_fprintf(stderr, "error: %s failed\n", SORT_PATH);
+	    exit(1);
+	}
+	exit(0);
+	/*NOTREACHED*/
+    }
+    }
+    /*NOTREACHED*/
+    return (-1);
+}
+
 /*
  * Runs encrypt with the first arg as its stdout.  Returns
  * 0 on success or negative if error, and it's pid via the second
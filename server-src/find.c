@@ -38,6 +38,7 @@
 #include "logfile.h"
 #include "holding.h"
 #include "find.h"
+#include "logindex.h"
 #include <regex.h>
 #include "cmdline.h"
 
@@ -49,6 +50,13 @@ static int parse_taper_datestamp_log(char *logline, char **datestamp,
 				     char **level, char **storage, char **pool);
 static gboolean logfile_has_tape(char * label, char * datestamp,
                                  char * logfile);
+static gboolean search_logfile_real(find_result_t **output_find,
+				    const char *label,
+				    const char *passed_datestamp,
+				    const char *logfile,
+				    disklist_t *dynamic_disklist,
+				    int added_todo, logindex_t *idx);
+static logindex_t *get_logindex(const char *logfile);
 
 static char *find_sort_order = NULL;
 static GStringChunk *string_chunk = NULL;
@@ -774,6 +782,16 @@ static gboolean logfile_has_tape(char * label, char * datestamp,
                                  char * logfile) {
     FILE * logf;
     char * ck_datestamp, *ck_label = NULL, *ck_storage = NULL, *ck_pool = NULL;
+    logindex_t *idx;
+
+    if ((idx = get_logindex(logfile)) != NULL) {
+	char *volume = g_strconcat(datestamp, " ", label, NULL);
+	gboolean found = g_hash_table_lookup(idx->keys[LOGINDEX_VOLUME],
+					     volume) != NULL;
+	g_free(volume);
+	return found;
+    }
+
     if((logf = fopen(logfile, "r")) == NULL) {
 	error(_("could not open logfile %s: %s"), logfile, strerror(errno));
 	/*NOTREACHED*/
@@ -827,8 +845,184 @@ volume_matches(
     return TRUE;
 }
 
-/* WARNING: Function accesses globals find_diskqp, curlog, curlog, curstr,
- * dynamic_disklist */
+/*
+ * Catalog index
+ *
+ * search_logfile answers searches that are not restricted to one volume from
+ * the catalog index of the logfile (see logindex.h), building it the first
+ * time with search_logfile_real.  The most recently used index is kept in
+ * memory, since callers tend to ask several questions of the same logfile.
+ */
+
+static logindex_t *cur_logindex = NULL;
+
+static void
+logindex_add_volume(
+    logindex_t *idx,
+    const char *datestamp,
+    const char *label)
+{
+    char *volume = g_strconcat(datestamp, " ", label, NULL);
+
+    logindex_add_key(idx, LOGINDEX_LABEL, label);
+    logindex_add_key(idx, LOGINDEX_VOLUME, volume);
+    if (volume_matches(NULL, label, datestamp))
+	logindex_add_key(idx, LOGINDEX_VALID_VOLUME, volume);
+    g_free(volume);
+}
+
+typedef struct {
+    logindex_t *idx;
+    gboolean valid;
+} check_volume_t;
+
+static void
+check_volume(
+    gpointer key,
+    gpointer value G_GNUC_UNUSED,
+    gpointer user_data)
+{
+    check_volume_t *cv = user_data;
+    char *volume = key;
+    char *label = strchr(volume, ' ');
+    char *datestamp;
+    gboolean valid;
+
+    if (!label || !cv->valid)
+	return;
+    datestamp = g_strndup(volume, label - volume);
+    valid = volume_matches(NULL, label + 1, datestamp);
+    g_free(datestamp);
+
+    if (valid != (g_hash_table_lookup(cv->idx->keys[LOGINDEX_VALID_VOLUME],
+				      volume) != NULL))
+	cv->valid = FALSE;
+}
+
+/* The results of an index depend on which of its volumes were still in the
+ * tapelist, with the same datestamp, when it was built */
+static gboolean
+logindex_volumes_valid(
+    logindex_t *idx)
+{
+    check_volume_t cv = { idx, TRUE };
+
+    g_hash_table_foreach(idx->keys[LOGINDEX_VOLUME], check_volume, &cv);
+    return cv.valid;
+}
+
+static logindex_t *
+get_logindex(
+    const char *logfile)
+{
+    struct stat st;
+    find_result_t *r;
+    int n;
+
+    if (stat(logfile, &st) != 0)
+	return NULL;
+
+    if (cur_logindex && logindex_is_current(cur_logindex, logfile, &st) &&
+	logindex_volumes_valid(cur_logindex))
+	return cur_logindex;
+
+    logindex_free(cur_logindex);
+    cur_logindex = logindex_read(logfile, &st);
+    if (cur_logindex && !logindex_volumes_valid(cur_logindex)) {
+	g_debug("volumes of %s were relabeled; reindexing it", logfile);
+	logindex_free(cur_logindex);
+	cur_logindex = NULL;
+    }
+
+    if (!cur_logindex) {
+	cur_logindex = logindex_new(logfile, &st);
+	search_logfile_real(&cur_logindex->results, NULL, NULL, logfile,
+			    NULL, 0, cur_logindex);
+	if (!cur_logindex->datestamp) {
+	    /* no taper START at all */
+	    for (n = 0, r = cur_logindex->results; r; r = r->next)
+		n++;
+	    cur_logindex->n_pre_start = n;
+	}
+	logindex_write(cur_logindex);
+    }
+
+    return cur_logindex;
+}
+
+/* Append the results of IDX to *OUTPUT_FIND, filtered the way
+ * search_logfile_real filters them while parsing */
+static gboolean
+search_logindex(
+    logindex_t     *idx,
+    find_result_t **output_find,
+    const char     *passed_datestamp,
+    disklist_t     *dynamic_disklist,
+    int             added_todo)
+{
+    find_result_t *r;
+    find_result_t *head = NULL, **tail = &head;
+    int n, n_results = 0;
+    disk_t *dp;
+
+    for (r = idx->results; r; r = r->next)
+	n_results++;
+
+    for (n = 0, r = idx->results; r; r = r->next, n++) {
+	gboolean pre_start = (n >= n_results - idx->n_pre_start);
+	find_result_t *new_output_find;
+
+	if (pre_start && !passed_datestamp)
+	    continue;
+
+	dp = lookup_disk(r->hostname, r->diskname);
+	if (dp == NULL) {
+	    if (dynamic_disklist == NULL)
+		continue;
+	    dp = add_disk(dynamic_disklist, r->hostname, r->diskname);
+	    dp->todo = added_todo;
+	}
+	if (!find_match(r->hostname, r->diskname))
+	    continue;
+
+	new_output_find = g_new(find_result_t, 1);
+	*new_output_find = *r;
+	new_output_find->next = NULL;
+#define COPY_STR(field) \
+	if (r->field) \
+	    new_output_find->field = g_string_chunk_insert_const(string_chunk, \
+								  r->field);
+	COPY_STR(timestamp);
+	COPY_STR(write_timestamp);
+	COPY_STR(hostname);
+	COPY_STR(diskname);
+	COPY_STR(storage);
+	COPY_STR(pool);
+	COPY_STR(label);
+	COPY_STR(status);
+	COPY_STR(dump_status);
+	COPY_STR(message);
+#undef COPY_STR
+	if (pre_start) {
+	    if (*new_output_find->timestamp == '\0')
+		new_output_find->timestamp =
+		    g_string_chunk_insert_const(string_chunk, passed_datestamp);
+	    if (*new_output_find->write_timestamp == '\0')
+		new_output_find->write_timestamp =
+		    g_string_chunk_insert_const(string_chunk, passed_datestamp);
+	}
+
+	*tail = new_output_find;
+	tail = &new_output_find->next;
+    }
+
+    if (!head)
+	return FALSE;
+    *tail = *output_find;
+    *output_find = head;
+    return TRUE;
+}
+
 gboolean
 search_logfile(
     find_result_t **output_find,
@@ -837,6 +1031,82 @@ search_logfile(
     const char *logfile,
     disklist_t * dynamic_disklist,
     int added_todo)
+{
+    logindex_t *idx;
+
+    g_return_val_if_fail(output_find != NULL, 0);
+    g_return_val_if_fail(logfile != NULL, 0);
+
+    if (string_chunk == NULL) {
+	string_chunk = g_string_chunk_new(32768);
+    }
+
+    /* searches for a single volume are rare and read few logfiles */
+    if (label == NULL && (idx = get_logindex(logfile)) != NULL &&
+	(!passed_datestamp || !idx->datestamp ||
+	 g_str_equal(passed_datestamp, idx->datestamp))) {
+	return search_logindex(idx, output_find, passed_datestamp,
+			       dynamic_disklist, added_todo);
+    }
+
+    return search_logfile_real(output_find, label, passed_datestamp, logfile,
+			       dynamic_disklist, added_todo, NULL);
+}
+
+GPtrArray *
+search_logfile_taper_lines(
+    const char *logfile)
+{
+    logindex_t *idx = get_logindex(logfile);
+
+    if (!idx)
+	return NULL;
+    return idx->lines;
+}
+
+gboolean
+logfile_index_has(
+    const char *logfile,
+    const char *key,
+    const char *value)
+{
+    logindex_t *idx = get_logindex(logfile);
+    logindex_key_t k;
+
+    if (!idx || !value)
+	return TRUE;
+
+    if (g_str_equal(key, "hostname"))
+	k = LOGINDEX_HOSTNAME;
+    else if (g_str_equal(key, "diskname"))
+	k = LOGINDEX_DISKNAME;
+    else if (g_str_equal(key, "level"))
+	k = LOGINDEX_LEVEL;
+    else if (g_str_equal(key, "label"))
+	k = LOGINDEX_LABEL;
+    else if (g_str_equal(key, "timestamp"))
+	k = LOGINDEX_TIMESTAMP;
+    else
+	return TRUE;
+
+    return logindex_has_key(idx, k, value);
+}
+
+/* Parse LOGFILE; if IDX is not NULL, build the catalog index instead: keep
+ * every dump, whatever the disklist says, including those logged before the
+ * first taper START, and fill in the keys and lines of IDX.
+ *
+ * WARNING: Function accesses globals find_diskqp, curlog, curlog, curstr,
+ * dynamic_disklist */
+static gboolean
+search_logfile_real(
+    find_result_t **output_find,
+    const char *label,
+    const char *passed_datestamp,
+    const char *logfile,
+    disklist_t * dynamic_disklist,
+    int added_todo,
+    logindex_t *idx)
 {
     FILE *logf;
     char *host = NULL;
@@ -867,6 +1137,7 @@ search_logfile(
     find_result_t *a_part_find;
     gboolean right_label = FALSE;
     gboolean found_something = FALSE;
+    gboolean stopped = FALSE;
     double sec;
     off_t kb;
     off_t bytes;
@@ -900,6 +1171,13 @@ search_logfile(
 
     filenum = (off_t)0;
     while(get_logline(logf)) {
+	if (idx && curprog == P_TAPER &&
+	    (curlog == L_DONE || curlog == L_PARTIAL ||
+	     curlog == L_FAIL || curlog == L_SUCCESS)) {
+	    logindex_add_line(idx, curlog, curprog, curstr);
+	}
+	if (stopped && !(curlog == L_START && curprog == P_TAPER))
+	    continue;
 	if (curlog == L_START && curprog == P_TAPER) {
 	    amfree(ck_label);
 	    amfree(ck_storage);
@@ -911,11 +1189,21 @@ search_logfile(
                          logfile, curstr);
                 continue;
 	    }
+	    if (idx) {
+		/* logfile_has_tape looks at every volume */
+		logindex_add_volume(idx, ck_datestamp, ck_label);
+		if (stopped)
+		    continue;
+	    }
             if (datestamp != NULL) {
                 if (!g_str_equal(datestamp, ck_datestamp)) {
                     g_printf(_("Log file %s stamped %s, expecting %s!\n"),
                              logfile, ck_datestamp, datestamp);
 		    amfree(ck_label);
+		    if (idx) {
+			stopped = TRUE;
+			continue;
+		    }
                     break;
                 }
             }
@@ -939,10 +1227,19 @@ search_logfile(
 	    ck_pool = NULL;
             if (datestamp == NULL) {
                 datestamp = g_strdup(ck_datestamp);
+		if (idx) {
+		    /* everything so far was logged before this START */
+		    idx->datestamp = logindex_strdup(idx, datestamp);
+		    for (a_part_find = *output_find;
+			 a_part_find;
+			 a_part_find = a_part_find->next) {
+			idx->n_pre_start++;
+		    }
+		}
             }
 	    filenum = (off_t)0;
 	}
-	if (!datestamp)
+	if (!datestamp && !idx)
 	    continue;
 	if (right_label &&
 	    (curlog == L_SUCCESS ||
@@ -1103,7 +1400,7 @@ search_logfile(
 
 	    if(strlen(date) < 3) { /* old log didn't have datestamp */
 		level = atoi(date);
-		date = g_strdup(datestamp);
+		date = g_strdup(datestamp ? datestamp : "");
 		partnum = 1;
 		totalparts = 1;
 	    } else {
@@ -1142,6 +1439,22 @@ search_logfile(
 		skip_integer(s, ch);
 	    }
 
+	    if (idx) {
+		char *level_str = g_strdup_printf("%d", level);
+		char *timestamp;
+
+		if (strlen(date) == 8)
+		    timestamp = g_strconcat(date, "000000", NULL);
+		else
+		    timestamp = g_strdup(date);
+		logindex_add_key(idx, LOGINDEX_HOSTNAME, host);
+		logindex_add_key(idx, LOGINDEX_DISKNAME, disk);
+		logindex_add_key(idx, LOGINDEX_LEVEL, level_str);
+		logindex_add_key(idx, LOGINDEX_TIMESTAMP, timestamp);
+		g_free(level_str);
+		g_free(timestamp);
+	    }
+
 	    skip_whitespace(s, ch);
 	    if(ch == '\0') {
 		g_printf(_("strange log line in %s \"%s\"\n"),
@@ -1292,16 +1605,19 @@ search_logfile(
 	    if (g_str_has_prefix(rest, "error")) rest += 6;
 	    if (g_str_has_prefix(rest, "config")) rest += 7;
 
-	    dp = lookup_disk(host,disk);
-	    if ( dp == NULL ) {
-		if (dynamic_disklist == NULL) {
-		    amfree(disk);
-		    continue;
+	    /* the index keeps every disk; search_logindex filters them */
+	    if (!idx) {
+		dp = lookup_disk(host,disk);
+		if ( dp == NULL ) {
+		    if (dynamic_disklist == NULL) {
+			amfree(disk);
+			continue;
+		    }
+		    dp = add_disk(dynamic_disklist, host, disk);
+		    dp->todo = added_todo;
 		}
-		dp = add_disk(dynamic_disklist, host, disk);
-		dp->todo = added_todo;
 	    }
-            if (find_match(host, disk)) {
+            if (idx || find_match(host, disk)) {
 		if(curprog == P_TAPER) {
 		    char *key = g_strdup_printf(
 					"HOST:%s DISK:%s: DATE:%s LEVEL:%d",
@@ -1320,7 +1636,7 @@ search_logfile(
 			    maxparts = a_part_find->totalparts;
 		    }
 		    new_output_find->timestamp = g_string_chunk_insert_const(string_chunk, date);
-		    new_output_find->write_timestamp = g_string_chunk_insert_const(string_chunk, datestamp);
+		    new_output_find->write_timestamp = g_string_chunk_insert_const(string_chunk, datestamp ? datestamp : "");
 		    new_output_find->hostname=g_string_chunk_insert_const(string_chunk, host);
 		    new_output_find->diskname=g_string_chunk_insert_const(string_chunk, disk);
 		    new_output_find->level=level;
@@ -78,6 +78,22 @@ gboolean search_logfile(find_result_t **output_find, const char *volume_label,
                         const char *log_datestamp, const char *logfile,
                         disklist_t * dynamic_disklist, int added_todo);
 
+/* Return the taper DONE, PARTIAL, FAIL and SUCCESS lines of a logfile, from
+ * its catalog index, as an array of logindex_line_t (see logindex.h).  The
+ * array belongs to the index, and is only valid until the next search.
+ *
+ * @returns: the lines, or NULL if the logfile does not exist
+ */
+GPtrArray *search_logfile_taper_lines(const char *logfile);
+
+/* Check the catalog index of a logfile for a hostname, diskname, level,
+ * label or (zero-padded) dump timestamp; KEY is one of those words.
+ *
+ * @returns: FALSE if the logfile has no dump with that VALUE
+ */
+gboolean logfile_index_has(const char *logfile, const char *key,
+			   const char *value);
+
 /* return all dumps on holding disk; not really a search at all.
  *
  * * output_find      : Put found dumps here.
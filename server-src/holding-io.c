@@ -0,0 +1,916 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+#include "amanda.h"
+#include "amutil.h"
+#include "conffile.h"
+#include "holding-io.h"
+
+#if defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+    defined(__NR_io_uring_register)
+#define USE_IO_URING
+#endif
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+/* O_DIRECT wants the buffer, offset and length aligned to the logical block
+ * size of the device; 4k covers every device in practice. */
+#define HOLDING_IO_ALIGN	4096
+#define HOLDING_IO_BUFSIZE	(1024*1024)
+#define HOLDING_IO_MAX_DEPTH	64
+
+#define ALIGN_DOWN(x) ((x) & ~(guint64)(HOLDING_IO_ALIGN-1))
+#define ALIGN_UP(x)   ALIGN_DOWN((x) + HOLDING_IO_ALIGN - 1)
+
+enum { BUF_FREE, BUF_FILLING, BUF_BUSY, BUF_DONE };
+
+typedef struct {
+    char    *data;
+    guint64  offset;	/* file offset of data[0] */
+    size_t   len;	/* bytes of data (write), or bytes to read (read) */
+    size_t   start;	/* write: leading bytes re-read from the file;
+			 * read: bytes already returned to the caller */
+    size_t   io_len;	/* length of the request */
+    ssize_t  result;	/* bytes transferred, or -errno */
+    int      state;
+    double   submitted;
+    struct iovec iov;	/* for READV/WRITEV */
+} hio_buf_t;
+
+#ifdef USE_IO_URING
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void    *sq_map, *cq_map;
+    size_t   sq_map_size, cq_map_size, sqes_size;
+    gboolean fixed;	/* the buffers are registered */
+} hio_uring_t;
+#endif
+
+/* statistics, per file and per holding disk */
+typedef struct {
+    guint64 ops;
+    guint64 bytes;
+    guint64 depth_sum;
+    int     depth_max;
+    double  latency_sum;
+    double  latency_max;
+} hio_stats_t;
+
+struct holding_io_s {
+    gboolean writing;
+    char    *filename;
+    char    *disk;		/* holding disk name, for the statistics */
+    int      fd;
+    gboolean direct;
+
+    char      *mem;		/* backs the (aligned) buffers */
+    hio_buf_t *bufs;
+    int        depth;
+    int        head;		/* oldest buffer in use */
+    int        count;		/* buffers in use, in file order from head */
+    int        inflight;
+    hio_buf_t *fill;		/* write: the buffer being filled */
+
+    guint64  start_offset;	/* where the caller's data starts */
+    guint64  next_offset;	/* file offset of the next buffer */
+    guint64  end_offset;	/* write: end of the preallocation;
+				 * read: size of the file */
+    guint64  accepted;		/* write: bytes taken from the caller */
+    guint64  retired_end;	/* write: end of the data in the buffers
+				 * already recycled, all on disk */
+    int      error;		/* first errno seen */
+
+#ifdef USE_IO_URING
+    hio_uring_t *ring;
+#endif
+
+    GTimer     *timer;
+    hio_stats_t stats;
+};
+
+static GHashTable *disk_stats = NULL;
+G_LOCK_DEFINE_STATIC(disk_stats);
+
+/*
+ * Utilities
+ */
+
+/* find the holding disk that FILENAME lives on */
+static holdingdisk_t *
+find_holdingdisk(
+    const char *filename)
+{
+    identlist_t il;
+
+    for (il = getconf_identlist(CNF_HOLDINGDISK); il != NULL; il = il->next) {
+	holdingdisk_t *hdisk = lookup_holdingdisk(il->data);
+	char *dir;
+	size_t len;
+
+	if (!hdisk)
+	    continue;
+	dir = holdingdisk_get_diskdir(hdisk);
+	len = strlen(dir);
+	while (len > 0 && dir[len-1] == '/')
+	    len--;
+	if (len > 0 && strncmp(filename, dir, len) == 0 && filename[len] == '/')
+	    return hdisk;
+    }
+
+    return NULL;
+}
+
+static void
+log_stats(
+    holding_io_t *hio)
+{
+    hio_stats_t *s = &hio->stats;
+    hio_stats_t *d;
+    const char *what = hio->writing? "write" : "read";
+
+    if (s->ops == 0)
+	return;
+
+    G_LOCK(disk_stats);
+    if (!disk_stats)
+	disk_stats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    d = g_hash_table_lookup(disk_stats, hio->disk);
+    if (!d) {
+	d = g_new0(hio_stats_t, 1);
+	g_hash_table_insert(disk_stats, g_strdup(hio->disk), d);
+    }
+    d->ops += s->ops;
+    d->bytes += s->bytes;
+    d->depth_sum += s->depth_sum;
+    d->depth_max = MAX(d->depth_max, s->depth_max);
+    d->latency_sum += s->latency_sum;
+    d->latency_max = MAX(d->latency_max, s->latency_max);
+
+    g_debug("holding-io: %s '%s': %ju %ss, %ju bytes, queue depth avg %.1f max %d, "
+	    "latency avg %.2f ms max %.2f ms",
+	    what, hio->filename, (uintmax_t)s->ops, what, (uintmax_t)s->bytes,
+	    (double)s->depth_sum / s->ops, s->depth_max,
+	    s->latency_sum * 1000 / s->ops, s->latency_max * 1000);
+    g_debug("holding-io: holding disk '%s' total: %ju requests, %ju bytes, "
+	    "queue depth avg %.1f max %d, latency avg %.2f ms max %.2f ms",
+	    hio->disk, (uintmax_t)d->ops, (uintmax_t)d->bytes,
+	    (double)d->depth_sum / d->ops, d->depth_max,
+	    d->latency_sum * 1000 / d->ops, d->latency_max * 1000);
+    G_UNLOCK(disk_stats);
+}
+
+/*
+ * io_uring
+ *
+ * This talks to the kernel directly, rather than through liburing, as we only
+ * need to submit single reads and writes and reap their completions.
+ */
+
+#ifdef USE_IO_URING
+
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static void
+uring_free(
+    hio_uring_t *ring)
+{
+    if (ring->sqes)
+	munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != ring->sq_map)
+	munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map)
+	munmap(ring->sq_map, ring->sq_map_size);
+    if (ring->fd >= 0)
+	close(ring->fd);
+    g_free(ring);
+}
+
+static hio_uring_t *
+uring_new(
+    holding_io_t *hio)
+{
+    hio_uring_t *ring = g_new0(hio_uring_t, 1);
+    struct io_uring_params p;
+    struct iovec *iov;
+    char *sq, *cq;
+    void *map;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, hio->depth, &p);
+    if (ring->fd < 0) {
+	g_debug("holding-io: io_uring_setup failed: %s", strerror(errno));
+	g_free(ring);
+	return NULL;
+    }
+
+    ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	ring->sq_map_size = ring->cq_map_size =
+		MAX(ring->sq_map_size, ring->cq_map_size);
+#endif
+
+    map = mmap(NULL, ring->sq_map_size, PROT_READ|PROT_WRITE,
+	       MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED)
+	goto failed;
+    ring->sq_map = map;
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	ring->cq_map = ring->sq_map;
+    } else
+#endif
+    {
+	map = mmap(NULL, ring->cq_map_size, PROT_READ|PROT_WRITE,
+		   MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (map == MAP_FAILED)
+	    goto failed;
+	ring->cq_map = map;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+	       MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (map == MAP_FAILED)
+	goto failed;
+    ring->sqes = map;
+
+    sq = ring->sq_map;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq = ring->cq_map;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    /* registered buffers save mapping the pages on every request; this can
+     * fail against RLIMIT_MEMLOCK, in which case plain requests work too */
+    iov = g_new(struct iovec, hio->depth);
+    for (i = 0; i < hio->depth; i++) {
+	iov[i].iov_base = hio->bufs[i].data;
+	iov[i].iov_len = HOLDING_IO_BUFSIZE;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd,
+			  IORING_REGISTER_BUFFERS, iov, hio->depth) == 0;
+    g_free(iov);
+
+    return ring;
+
+failed:
+    g_debug("holding-io: can't map io_uring: %s", strerror(errno));
+    uring_free(ring);
+    return NULL;
+}
+
+/* queue a request for buffer I; returns FALSE if the kernel refused it */
+static gboolean
+uring_submit(
+    holding_io_t *hio,
+    int i)
+{
+    hio_uring_t *ring = hio->ring;
+    hio_buf_t *b = &hio->bufs[i];
+    struct io_uring_sqe *sqe;
+    unsigned tail, idx;
+    int rv;
+
+    tail = *ring->sq_tail;
+    if (tail - load_acquire(ring->sq_head) > *ring->sq_mask)
+	return FALSE;
+    idx = tail & *ring->sq_mask;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = hio->fd;
+    sqe->off = b->offset;
+    sqe->user_data = i;
+    if (ring->fixed) {
+	sqe->opcode = hio->writing? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+	sqe->addr = (guint64)(uintptr_t)b->data;
+	sqe->len = b->io_len;
+	sqe->buf_index = i;
+    } else {
+	b->iov.iov_base = b->data;
+	b->iov.iov_len = b->io_len;
+	sqe->opcode = hio->writing? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->addr = (guint64)(uintptr_t)&b->iov;
+	sqe->len = 1;
+    }
+    ring->sq_array[idx] = idx;
+    store_release(ring->sq_tail, tail + 1);
+
+    do {
+	rv = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0) {
+	/* the kernel did not take it, so take it back */
+	g_debug("holding-io: io_uring_enter failed: %s", strerror(errno));
+	store_release(ring->sq_tail, tail);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void hio_complete(holding_io_t *hio, int i, ssize_t result);
+
+/* collect completions, waiting for at least one if WAIT */
+static void
+uring_reap(
+    holding_io_t *hio,
+    gboolean wait)
+{
+    hio_uring_t *ring = hio->ring;
+    unsigned head, tail;
+
+    if (wait) {
+	int rv;
+	do {
+	    rv = syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+			 IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (rv < 0 && errno == EINTR);
+    }
+
+    head = *ring->cq_head;
+    tail = load_acquire(ring->cq_tail);
+    while (head != tail) {
+	struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+	int i = (int)cqe->user_data;
+	ssize_t res = cqe->res;
+
+	head++;
+	store_release(ring->cq_head, head);
+	hio_complete(hio, i, res);
+    }
+}
+
+#endif /* USE_IO_URING */
+
+/*
+ * Request handling
+ */
+
+/* finish buffer I synchronously, starting DONE bytes in */
+static ssize_t
+hio_pio(
+    holding_io_t *hio,
+    hio_buf_t *b,
+    size_t done)
+{
+    while (done < b->io_len) {
+	ssize_t n;
+
+	/* with O_DIRECT, a read from the (unaligned) end of the file fails */
+	if (!hio->writing && b->offset + done >= hio->end_offset)
+	    break;
+	if (hio->writing)
+	    n = pwrite(hio->fd, b->data + done, b->io_len - done, b->offset + done);
+	else
+	    n = pread(hio->fd, b->data + done, b->io_len - done, b->offset + done);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0)
+	    return -errno;
+	if (n == 0) {
+	    /* EOF when reading; when writing, a full disk */
+	    if (hio->writing)
+		return -ENOSPC;
+	    break;
+	}
+	done += n;
+    }
+
+    return done;
+}
+
+static void
+hio_complete(
+    holding_io_t *hio,
+    int i,
+    ssize_t result)
+{
+    hio_buf_t *b = &hio->bufs[i];
+    double latency;
+
+    /* a short write means the disk is full; a short read short of the end
+     * of the file is finished by hand */
+    if (result > 0 && (size_t)result < b->io_len && !hio->writing &&
+	b->offset + result < hio->end_offset &&
+	(!hio->direct || result % HOLDING_IO_ALIGN == 0))
+	result = hio_pio(hio, b, result);
+
+    b->result = result;
+    b->state = BUF_DONE;
+    hio->inflight--;
+
+    latency = g_timer_elapsed(hio->timer, NULL) - b->submitted;
+    hio->stats.latency_sum += latency;
+    hio->stats.latency_max = MAX(hio->stats.latency_max, latency);
+    if (result > 0)
+	hio->stats.bytes += result;
+
+    if (result < 0 && !hio->error)
+	hio->error = -result;
+    else if (hio->writing && (size_t)result != b->io_len && !hio->error)
+	hio->error = ENOSPC;
+}
+
+static void
+hio_submit(
+    holding_io_t *hio,
+    hio_buf_t *b)
+{
+    int i = b - hio->bufs;
+
+    if (hio->writing) {
+	/* pad the tail of the data out to a whole block; the padding is
+	 * truncated away when the file is closed */
+	b->io_len = hio->direct? ALIGN_UP(b->len) : b->len;
+	memset(b->data + b->len, 0, b->io_len - b->len);
+    } else {
+	b->io_len = b->len;
+    }
+
+    b->state = BUF_BUSY;
+    b->submitted = g_timer_elapsed(hio->timer, NULL);
+    hio->inflight++;
+    hio->stats.ops++;
+    hio->stats.depth_sum += hio->inflight;
+    hio->stats.depth_max = MAX(hio->stats.depth_max, hio->inflight);
+
+#ifdef USE_IO_URING
+    if (hio->ring) {
+	if (uring_submit(hio, i)) {
+	    /* pick up anything that's already finished */
+	    uring_reap(hio, FALSE);
+	    return;
+	}
+    }
+#endif
+
+    hio_complete(hio, i, hio_pio(hio, b, 0));
+}
+
+static void
+hio_wait(
+    holding_io_t *hio,
+    hio_buf_t *b)
+{
+#ifdef USE_IO_URING
+    while (b->state == BUF_BUSY)
+	uring_reap(hio, TRUE);
+#else
+    (void)hio;
+    g_assert(b->state != BUF_BUSY);
+#endif
+}
+
+static void
+hio_wait_all(
+    holding_io_t *hio)
+{
+    int n;
+
+    for (n = 0; n < hio->count; n++)
+	hio_wait(hio, &hio->bufs[(hio->head + n) % hio->depth]);
+}
+
+/* take the next buffer, in file order */
+static hio_buf_t *
+hio_next_buffer(
+    holding_io_t *hio)
+{
+    hio_buf_t *b;
+
+    g_assert(hio->count < hio->depth);
+    b = &hio->bufs[(hio->head + hio->count) % hio->depth];
+    hio->count++;
+
+    b->state = BUF_FILLING;
+    b->offset = hio->next_offset;
+    b->len = b->start = b->io_len = 0;
+    b->result = 0;
+    hio->next_offset += HOLDING_IO_BUFSIZE;
+
+    return b;
+}
+
+static void
+hio_retire_head(
+    holding_io_t *hio)
+{
+    hio_buf_t *b = &hio->bufs[hio->head];
+
+    if (hio->writing)
+	hio->retired_end = b->offset + b->len;
+    b->state = BUF_FREE;
+    hio->head = (hio->head + 1) % hio->depth;
+    hio->count--;
+}
+
+static holding_io_t *
+hio_new(
+    const char *filename,
+    gboolean writing)
+{
+    holding_io_t *hio;
+    holdingdisk_t *hdisk;
+    int depth;
+    int fd;
+    int flags = writing? O_RDWR : O_RDONLY;
+    gboolean direct = TRUE;
+    int i;
+
+    hdisk = find_holdingdisk(filename);
+    if (!hdisk)
+	return NULL;
+    depth = holdingdisk_get_io_depth(hdisk);
+    if (depth <= 0)
+	return NULL;
+    depth = MIN(depth, HOLDING_IO_MAX_DEPTH);
+
+    fd = open(filename, flags | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+	/* the filesystem doesn't do O_DIRECT (e.g., tmpfs) */
+	direct = FALSE;
+	fd = open(filename, flags);
+    }
+    if (fd < 0) {
+	g_debug("holding-io: can't open '%s': %s", filename, strerror(errno));
+	return NULL;
+    }
+
+    hio = g_new0(holding_io_t, 1);
+    hio->writing = writing;
+    hio->filename = g_strdup(filename);
+    hio->disk = g_strdup(holdingdisk_name(hdisk));
+    hio->fd = fd;
+    hio->direct = direct && O_DIRECT != 0;
+    hio->depth = depth;
+    hio->timer = g_timer_new();
+
+    hio->mem = g_malloc((gsize)depth * HOLDING_IO_BUFSIZE + HOLDING_IO_ALIGN);
+    hio->bufs = g_new0(hio_buf_t, depth);
+    for (i = 0; i < depth; i++) {
+	char *p = hio->mem + (gsize)i * HOLDING_IO_BUFSIZE;
+	hio->bufs[i].data = (char *)(uintptr_t)ALIGN_UP((uintptr_t)p);
+	hio->bufs[i].state = BUF_FREE;
+    }
+
+#ifdef USE_IO_URING
+    if (depth > 1)
+	hio->ring = uring_new(hio);
+#endif
+
+    return hio;
+}
+
+static void
+hio_free(
+    holding_io_t *hio)
+{
+    log_stats(hio);
+#ifdef USE_IO_URING
+    if (hio->ring)
+	uring_free(hio->ring);
+#endif
+    if (hio->fd >= 0)
+	close(hio->fd);
+    g_timer_destroy(hio->timer);
+    g_free(hio->bufs);
+    g_free(hio->mem);
+    g_free(hio->filename);
+    g_free(hio->disk);
+    g_free(hio);
+}
+
+/*
+ * Writing
+ */
+
+holding_io_t *
+holding_io_open_write(
+    const char *filename,
+    guint64 offset,
+    guint64 size)
+{
+    holding_io_t *hio = hio_new(filename, TRUE);
+
+    if (!hio)
+	return NULL;
+
+    hio->start_offset = offset;
+    hio->retired_end = offset;
+    hio->next_offset = hio->direct? ALIGN_DOWN(offset) : offset;
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+    /* reserve the space now, so the chunk is laid out contiguously; the
+     * excess is released again when the file is closed */
+    if (size > 0) {
+	if (fallocate(hio->fd, FALLOC_FL_KEEP_SIZE, offset, size) == 0)
+	    hio->end_offset = offset + size;
+	else if (errno != EOPNOTSUPP && errno != ENOSYS)
+	    g_debug("holding-io: fallocate '%s': %s", filename, strerror(errno));
+    }
+#else
+    (void)size;
+#endif
+
+    /* we can only write whole blocks, so start with the partial block that
+     * is already in the file */
+    if (hio->next_offset < offset) {
+	hio_buf_t *b = hio_next_buffer(hio);
+	size_t partial = offset - b->offset;
+	ssize_t n;
+
+	do {
+	    n = pread(hio->fd, b->data, HOLDING_IO_ALIGN, b->offset);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0 || (size_t)n < partial) {
+	    g_debug("holding-io: can't read the end of '%s': %s", filename,
+		    n < 0? strerror(errno) : "short read");
+	    hio_free(hio);
+	    return NULL;
+	}
+	b->len = b->start = partial;
+	hio->fill = b;
+    }
+
+    return hio;
+}
+
+size_t
+holding_io_write(
+    holding_io_t *hio,
+    const void *buf,
+    size_t len,
+    crc_t *crc)
+{
+    const char *p = buf;
+    size_t done = 0;
+
+    while (done < len && !hio->error) {
+	hio_buf_t *b = hio->fill;
+	size_t n;
+
+	if (!b) {
+	    if (hio->count == hio->depth) {
+		/* recycle the oldest buffer, once it is on disk */
+		hio_wait(hio, &hio->bufs[hio->head]);
+		if (hio->error)
+		    break;
+		hio_retire_head(hio);
+	    }
+	    b = hio->fill = hio_next_buffer(hio);
+	}
+
+	n = MIN(len - done, HOLDING_IO_BUFSIZE - b->len);
+	if (crc)
+	    crc32_add_copy((uint8_t *)b->data + b->len, (uint8_t *)p + done, n, crc);
+	else
+	    memcpy(b->data + b->len, p + done, n);
+	b->len += n;
+	done += n;
+	hio->accepted += n;
+
+	if (b->len == HOLDING_IO_BUFSIZE) {
+	    hio->fill = NULL;
+	    hio_submit(hio, b);
+	}
+    }
+
+    if (done < len)
+	errno = hio->error;
+    return done;
+}
+
+guint64
+holding_io_written(
+    holding_io_t *hio)
+{
+    guint64 end = hio->retired_end;
+    int n;
+
+#ifdef USE_IO_URING
+    if (hio->ring)
+	uring_reap(hio, FALSE);
+#endif
+
+    /* the buffers complete in any order; stop at the first one that isn't
+     * on disk yet */
+    for (n = 0; n < hio->count; n++) {
+	hio_buf_t *b = &hio->bufs[(hio->head + n) % hio->depth];
+
+	if (b->state != BUF_DONE || b->result != (ssize_t)b->io_len)
+	    break;
+	end = b->offset + b->len;
+    }
+
+    return end > hio->start_offset? end - hio->start_offset : 0;
+}
+
+gboolean
+holding_io_close_write(
+    holding_io_t *hio,
+    guint64 *written,
+    GByteArray **unwritten)
+{
+    guint64 data_end = hio->start_offset + hio->accepted;
+    guint64 durable_end = data_end;
+    GByteArray *rest = NULL;
+    int save_errno;
+    int n;
+
+    if (hio->fill) {
+	hio_buf_t *b = hio->fill;
+
+	hio->fill = NULL;
+	if (b->len > b->start && !hio->error)
+	    hio_submit(hio, b);
+	else
+	    b->result = -ECANCELED;
+    }
+    hio_wait_all(hio);
+
+    /* everything up to the first failed request, in file order, is on disk;
+     * everything after it goes back to the caller */
+    for (n = 0; n < hio->count; n++) {
+	hio_buf_t *b = &hio->bufs[(hio->head + n) % hio->depth];
+
+	if (b->len == b->start)
+	    continue;	/* holds nothing new */
+	if (b->result == (ssize_t)b->io_len && b->state == BUF_DONE)
+	    continue;
+	if (!rest) {
+	    durable_end = MAX(b->offset, hio->start_offset);
+	    rest = g_byte_array_new();
+	}
+	g_byte_array_append(rest, (guint8 *)b->data + b->start, b->len - b->start);
+    }
+    g_assert(!rest || durable_end + rest->len == data_end);
+    if (rest && !hio->error)
+	hio->error = EIO;
+
+    /* drop the padding and whatever preallocation wasn't used */
+    if (ftruncate(hio->fd, durable_end) != 0 && !hio->error)
+	hio->error = errno;
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE)
+    if (hio->end_offset > durable_end)
+	(void)fallocate(hio->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+			durable_end, hio->end_offset - durable_end);
+#endif
+
+    *written = durable_end - hio->start_offset;
+    if (unwritten) {
+	*unwritten = rest;
+    } else if (rest) {
+	g_byte_array_free(rest, TRUE);
+    }
+
+    save_errno = hio->error;
+    hio_free(hio);
+    errno = save_errno;
+    return save_errno == 0;
+}
+
+/*
+ * Reading
+ */
+
+/* keep the queue of reads full */
+static void
+hio_read_ahead(
+    holding_io_t *hio)
+{
+    while (hio->count < hio->depth && hio->next_offset < hio->end_offset &&
+	   !hio->error) {
+	hio_buf_t *b = hio_next_buffer(hio);
+
+	b->len = HOLDING_IO_BUFSIZE;
+	if (b->offset < hio->start_offset)
+	    b->start = hio->start_offset - b->offset;
+	hio_submit(hio, b);
+    }
+}
+
+holding_io_t *
+holding_io_open_read(
+    const char *filename,
+    guint64 offset)
+{
+    holding_io_t *hio = hio_new(filename, FALSE);
+    struct stat st;
+
+    if (!hio)
+	return NULL;
+
+    if (fstat(hio->fd, &st) < 0) {
+	g_debug("holding-io: can't stat '%s': %s", filename, strerror(errno));
+	hio_free(hio);
+	return NULL;
+    }
+
+    hio->start_offset = offset;
+    hio->next_offset = hio->direct? ALIGN_DOWN(offset) : offset;
+    hio->end_offset = st.st_size;
+    hio_read_ahead(hio);
+
+    return hio;
+}
+
+gsize
+holding_io_read(
+    holding_io_t *hio,
+    void *buf,
+    gsize len)
+{
+    char *p = buf;
+    gsize done = 0;
+
+    while (done < len && hio->count > 0) {
+	hio_buf_t *b = &hio->bufs[hio->head];
+	size_t avail, n;
+
+	hio_wait(hio, b);
+	if (b->result < 0) {
+	    if (!hio->error)
+		hio->error = -b->result;
+	    break;
+	}
+
+	avail = (size_t)b->result > b->start? b->result - b->start : 0;
+	n = MIN(avail, len - done);
+	memcpy(p + done, b->data + b->start, n);
+	b->start += n;
+	done += n;
+
+	if (b->start >= (size_t)b->result) {
+	    gboolean eof = (size_t)b->result < b->len;
+
+	    hio_retire_head(hio);
+	    if (eof) {
+		/* the file ended early; anything queued behind this is empty */
+		hio_wait_all(hio);
+		while (hio->count > 0)
+		    hio_retire_head(hio);
+		hio->end_offset = 0;
+	    }
+	    hio_read_ahead(hio);
+	}
+    }
+
+    errno = (done < len)? hio->error : 0;
+    return done;
+}
+
+void
+holding_io_close_read(
+    holding_io_t *hio)
+{
+    if (!hio)
+	return;
+
+    /* the kernel may still be writing into the buffers */
+    hio_wait_all(hio);
+    hio_free(hio);
+}
@@ -0,0 +1,103 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Direct, queued I/O on holding disk chunk files
+ *
+ * For holding disks with a non-zero io-depth, the data part of a chunk file
+ * is written and read with O_DIRECT in large aligned requests, keeping up to
+ * io-depth of them in flight at once (with io_uring where available,
+ * otherwise one at a time).  The 32k header is not handled here; callers keep
+ * reading and writing it through their own, buffered, file descriptor.
+ *
+ * The engine is only used when it is configured; all of the open functions
+ * return NULL otherwise, and the caller should fall back to read()/write().
+ */
+
+#ifndef HOLDING_IO_H
+#define HOLDING_IO_H
+
+#include "amanda.h"
+#include "amutil.h"
+
+typedef struct holding_io_s holding_io_t;
+
+/* Open FILENAME for writing data at OFFSET, which need not be aligned.
+ *
+ * @param filename: the chunk file, which must already exist
+ * @param offset: where to start writing
+ * @param size: the most data that will be written; this is preallocated
+ * @returns: the writer, or NULL to use write()
+ */
+holding_io_t *holding_io_open_write(const char *filename, guint64 offset,
+				    guint64 size);
+
+/* Queue LEN bytes for writing, adding them to CRC (if not NULL) as they are
+ * copied.  This returns without waiting for the data to reach the disk.
+ *
+ * @returns: the number of bytes accepted; if less than LEN, a write has
+ *           failed and errno is set.
+ */
+size_t holding_io_write(holding_io_t *hio, const void *buf, size_t len,
+			crc_t *crc);
+
+/* How much of the data accepted since open is on disk, with nothing missing
+ * before it.  This does not wait; the padding of a partial block is not
+ * counted.
+ *
+ * @returns: a byte count, from the OFFSET given to holding_io_open_write
+ */
+guint64 holding_io_written(holding_io_t *hio);
+
+/* Wait for all writes, trim the file to the end of the data, log the I/O
+ * statistics, and free the writer.
+ *
+ * On failure, the file is trimmed to the data that did reach the disk, and
+ * the rest of the accepted data is returned in UNWRITTEN so that it can be
+ * written elsewhere.
+ *
+ * @param written: (output) bytes accepted since open that reached the disk
+ * @param unwritten: (output) the rest of the accepted data, or NULL
+ * @returns: FALSE on error, with errno set
+ */
+gboolean holding_io_close_write(holding_io_t *hio, guint64 *written,
+				GByteArray **unwritten);
+
+/* Open FILENAME for reading data from OFFSET, and start reading ahead.
+ *
+ * @returns: the reader, or NULL to use read()
+ */
+holding_io_t *holding_io_open_read(const char *filename, guint64 offset);
+
+/* Read up to LEN bytes, like read_fully: a short count means EOF (errno is
+ * 0) or an error (errno is set).
+ */
+gsize holding_io_read(holding_io_t *hio, void *buf, gsize len);
+
+/* Cancel any read-ahead, log the I/O statistics, and free the reader */
+void holding_io_close_read(holding_io_t *hio);
+
+#endif /* HOLDING_IO_H */
@@ -37,6 +37,7 @@
 #include "diskfile.h"
 #include "fileheader.h"
 #include "logfile.h"
+#include "amcompress.h"
 
 /*
  * utilities */
@@ -718,6 +719,128 @@ holding_file_get_dumpfile(
     return 1;
 }
 
+/*
+ * Seek tables
+ */
+
+/* a chunk of a holding file, and where its data is in the image */
+typedef struct holding_chunk_s {
+    char *filename;
+    guint64 start;
+    guint64 size;
+} holding_chunk_t;
+
+static gboolean
+read_holding_chunks(
+    gpointer data,
+    guint64  offset,
+    char    *buf,
+    gsize    size)
+{
+    GArray *chunks = (GArray *)data;
+    guint i;
+
+    for (i = 0; i < chunks->len && size > 0; i++) {
+	holding_chunk_t *chunk = &g_array_index(chunks, holding_chunk_t, i);
+	gsize len;
+	int fd;
+
+	if (offset >= chunk->start + chunk->size)
+	    continue;
+	len = MIN(size, chunk->start + chunk->size - offset);
+
+	if ((fd = robust_open(chunk->filename, O_RDONLY, 0)) == -1)
+	    return FALSE;
+	if (lseek(fd, DISK_BLOCK_BYTES + (offset - chunk->start), SEEK_SET) == -1 ||
+	    full_read(fd, buf, len) != len) {
+	    int save_errno = errno;
+	    aclose(fd);
+	    errno = save_errno;
+	    return FALSE;
+	}
+	aclose(fd);
+
+	buf += len;
+	offset += len;
+	size -= len;
+    }
+
+    if (size > 0) {
+	errno = EINVAL;
+	return FALSE;
+    }
+    return TRUE;
+}
+
+char *
+holding_file_find_block(
+    char    *hfile,
+    guint64  offset,
+    guint64 *comp_offset,
+    guint64 *uncomp_offset)
+{
+    GArray *chunks = g_array_new(FALSE, FALSE, sizeof(holding_chunk_t));
+    am_seek_table_t *table;
+    const am_seek_entry_t *entry;
+    dumpfile_t file;
+    char *filename;
+    char *errmsg = NULL;
+    guint64 size = 0;
+    guint i;
+
+    *comp_offset = 0;
+    *uncomp_offset = 0;
+
+    /* follow the cont_filename of each chunk, like holding_file_size */
+    filename = g_strdup(hfile);
+    while (filename != NULL && filename[0] != '\0') {
+	holding_chunk_t chunk;
+	struct stat finfo;
+
+	if (stat(filename, &finfo) == -1) {
+	    errmsg = g_strdup_printf(_("stat %s: %s"), filename, strerror(errno));
+	    g_free(filename);
+	    goto done;
+	}
+	if (!holding_file_get_dumpfile(filename, &file)) {
+	    errmsg = g_strdup_printf(_("can't read the header of %s"), filename);
+	    g_free(filename);
+	    goto done;
+	}
+
+	chunk.filename = filename;
+	chunk.start = size;
+	chunk.size = finfo.st_size > DISK_BLOCK_BYTES ?
+			finfo.st_size - DISK_BLOCK_BYTES : 0;
+	g_array_append_val(chunks, chunk);
+	size += chunk.size;
+
+	filename = g_strdup(file.cont_filename);
+	dumpfile_free_data(&file);
+    }
+    g_free(filename);
+
+    table = am_seek_table_read_fn(read_holding_chunks, chunks, size, &errmsg);
+    if (!table)
+	goto done;
+
+    entry = am_seek_table_find(table, offset);
+    if (entry) {
+	*comp_offset = entry->comp_offset;
+	*uncomp_offset = entry->uncomp_offset;
+    } else {
+	errmsg = g_strdup_printf(_("offset %ju is past the end of the image (%ju bytes)"),
+				 (uintmax_t)offset, (uintmax_t)table->uncomp_size);
+    }
+    am_seek_table_free(table);
+
+done:
+    for (i = 0; i < chunks->len; i++)
+	g_free(g_array_index(chunks, holding_chunk_t, i).filename);
+    g_array_free(chunks, TRUE);
+    return errmsg;
+}
+
 /*
  * Cleanup
  */
@@ -939,6 +1062,57 @@ holding_set_from_driver(
     close(fd);
 }
 
+#define COMMITTED_PREFIX "COMMITTED "
+
+gboolean
+holding_put_committed(
+    char    *hdrbuf,
+    guint64  length)
+{
+    /* the header text must end before the field */
+    if (memchr(hdrbuf, '\0', HOLDING_COMMITTED_OFFSET) == NULL)
+	return FALSE;
+
+    memset(hdrbuf + HOLDING_COMMITTED_OFFSET, '\0', HOLDING_COMMITTED_SIZE);
+    g_snprintf(hdrbuf + HOLDING_COMMITTED_OFFSET, HOLDING_COMMITTED_SIZE,
+	       COMMITTED_PREFIX "%020ju\n", (uintmax_t)length);
+    return TRUE;
+}
+
+gboolean
+holding_set_committed(
+    int      fd,
+    guint64  length)
+{
+    char field[HOLDING_COMMITTED_SIZE];
+    ssize_t n;
+
+    memset(field, '\0', sizeof(field));
+    g_snprintf(field, sizeof(field), COMMITTED_PREFIX "%020ju\n",
+	       (uintmax_t)length);
+    do {
+	n = pwrite(fd, field, sizeof(field), HOLDING_COMMITTED_OFFSET);
+    } while (n < 0 && errno == EINTR);
+    if (n >= 0 && n != (ssize_t)sizeof(field))
+	errno = ENOSPC;
+
+    return n == (ssize_t)sizeof(field);
+}
+
+gboolean
+holding_get_committed(
+    const char *hdrbuf,
+    guint64    *length)
+{
+    const char *field = hdrbuf + HOLDING_COMMITTED_OFFSET;
+
+    if (strncmp(field, COMMITTED_PREFIX, strlen(COMMITTED_PREFIX)) != 0)
+	return FALSE;
+
+    *length = g_ascii_strtoull(field + strlen(COMMITTED_PREFIX), NULL, 10);
+    return TRUE;
+}
+
 int
 rename_tmp_holding(
     char *	holding_file,
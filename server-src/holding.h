@@ -138,6 +138,23 @@ int
 holding_file_get_dumpfile(char *fname,
                           dumpfile_t *file);
 
+/* Find where to start reading a compressed holding file to restore it from
+ * byte OFFSET of the uncompressed image, using the seek table written by a
+ * multi-threaded compressor (see amcompress.h).  The block found starts at
+ * or before OFFSET.
+ *
+ * @param hfile: full pathname of holding file
+ * @param offset: offset in the uncompressed image
+ * @param comp_offset: (result) offset of the block in the holding file data
+ * @param uncomp_offset: (result) offset of the block in the uncompressed image
+ * @returns: NULL on success, else a newly allocated error message
+ */
+char *
+holding_file_find_block(char *hfile,
+                        guint64 offset,
+                        guint64 *comp_offset,
+                        guint64 *uncomp_offset);
+
 /*
  * Maintenance
  */
@@ -172,6 +189,44 @@ holding_set_from_driver(char *holding_file, off_t orig_size,
 			crc_t native_crc, crc_t client_crc,
 			crc_t server_crc);
 
+/* While a chunk is being written, the length of its data that is on disk,
+ * with nothing missing before it, is kept in the last bytes of its header
+ * block.  A reader following the chunk as it grows (streaming-flush) must not
+ * read past it: the rest of the file may be padding, writes still in flight,
+ * or data that will be truncated and written to the next chunk instead.  The
+ * field is only meaningful until the chunk is complete.
+ */
+#define HOLDING_COMMITTED_SIZE   64
+#define HOLDING_COMMITTED_OFFSET (DISK_BLOCK_BYTES - HOLDING_COMMITTED_SIZE)
+
+/* Add the committed length to a header block built with build_header.
+ *
+ * @param hdrbuf: the header block, DISK_BLOCK_BYTES long
+ * @param length: bytes of data in the chunk
+ * @returns: FALSE if the header text leaves no room for it
+ */
+gboolean
+holding_put_committed(char *hdrbuf, guint64 length);
+
+/* Update the committed length in the header of a chunk being written; the
+ * header must have been written with holding_put_committed.
+ *
+ * @param fd: the chunk file
+ * @param length: bytes of data in the chunk
+ * @returns: FALSE on error, with errno set
+ */
+gboolean
+holding_set_committed(int fd, guint64 length);
+
+/* Get the committed length from a header block.
+ *
+ * @param hdrbuf: the header block, DISK_BLOCK_BYTES long
+ * @param length: (result) bytes of data in the chunk
+ * @returns: FALSE if the header has none
+ */
+gboolean
+holding_get_committed(const char *hdrbuf, guint64 *length);
+
 /* Rename holding files from the temporary names used during
  * creation.
  *
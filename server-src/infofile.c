@@ -35,6 +35,7 @@
 #include "conffile.h"
 #include "infofile.h"
 #include "amutil.h"
+#include <sys/mman.h>
 
 static void zero_info(info_t *);
 
@@ -49,6 +50,18 @@ static void zero_info(info_t *);
   static int write_txinfofile(FILE *, info_t *);
   static int delete_txinfofile(char *, char *);
 
+typedef struct infodb_s infodb_t;
+typedef struct infodb_record_s infodb_record_t;
+
+  static infodb_t *infodb = NULL;	/* infofile-format "binary" */
+
+  static infodb_t *infodb_open(char *);
+  static void infodb_close(infodb_t *);
+  static int infodb_get(infodb_t *, char *, char *, info_t *);
+  static int infodb_put(infodb_t *, char *, char *, info_t *);
+  static int infodb_del(infodb_t *, char *, char *);
+  static int infodb_commit(infodb_t *);
+
 static FILE *
 open_txinfofile(
     char *	host,
@@ -511,14 +524,939 @@ delete_txinfofile(
     return rc;
 }
 
+/*
+ * Binary database
+ *
+ * With infofile-format "binary", all the records are kept in
+ * infodir/curinfo.db, which is mapped in memory:
+ *
+ *   - a header page (infodb_header_t)
+ *   - a hash table of nbuckets buckets, each holding the slot number + 1 of a
+ *     record, INFODB_EMPTY or INFODB_DELETED; it is indexed by the FNV-1a hash
+ *     of "host\0disk", with linear probing, and padded to a page
+ *   - nslots slots of INFODB_SLOT_SIZE bytes, each holding an infodb_record_t
+ *     or a link of the free list
+ *
+ * Everything is in host byte order; perl/Amanda/Curinfo/Db.pm knows the same
+ * layout, so keep them in sync.
+ *
+ * Changes are collected in a batch (see begin_info_batch) and committed under
+ * the write lock of curinfo.db.lock: the new records are written to free
+ * slots and synced before the buckets are switched to them, so that a crash
+ * leaves each disk with either its old or its new record, and the old slots
+ * are put on the free list afterwards.  When the hash table gets half full,
+ * the whole database is rewritten to a bigger one, which is renamed over
+ * curinfo.db.  Readers take the read lock for each lookup.
+ *
+ * A disk that has no record yet is read from its text file, so that the
+ * text database is converted as the records are updated.
+ */
+
+#define INFODB_MAGIC		"AMINFODB"
+#define INFODB_BOM		0x01020304
+#define INFODB_VERSION		1
+#define INFODB_PAGE		4096
+#define INFODB_SLOT_SIZE	8192
+#define INFODB_KEY_SIZE		1024
+#define INFODB_MIN_BUCKETS	1024
+#define INFODB_EMPTY		0
+#define INFODB_DELETED		G_MAXUINT32
+
+/* the number of levels with stats that fit in a slot */
+#define INFODB_MAX_STATS	23
+
+typedef struct infodb_header_s {
+    char    magic[8];
+    guint32 bom;
+    guint32 version;
+    guint32 slot_size;
+    guint32 nbuckets;		/* a power of two */
+    guint32 nslots;
+    guint32 nused;		/* buckets holding a record */
+    guint32 ndeleted;		/* INFODB_DELETED buckets */
+    guint32 free_head;		/* first free slot + 1, or 0; only a hint, see
+				 * infodb_rebuild_free_list */
+} infodb_header_t;
+
+typedef struct infodb_history_s {
+    gint32  level;
+    guint32 pad;
+    gint64  size;
+    gint64  csize;
+    gint64  date;
+    gint64  secs;
+} infodb_history_t;
+
+typedef struct infodb_stats_s {
+    gint32  level;
+    guint32 pad;
+    gint64  size;
+    gint64  csize;
+    gint64  secs;
+    gint64  date;
+    gint64  filenum;
+    char    label[MAX_LABEL];
+} infodb_stats_t;
+
+struct infodb_record_s {
+    guint32 in_use;		/* 0 in a free slot or for a deletion */
+    guint32 next_free;		/* next free slot + 1, or 0 */
+    guint32 command;
+    gint32  last_level;
+    gint32  consecutive_runs;
+    guint32 nstats;
+    guint32 nhistory;
+    guint32 keylen;		/* strlen(host) + 1 + strlen(disk) */
+    double  full_rate[AVG_COUNT];
+    double  full_comp[AVG_COUNT];
+    double  incr_rate[AVG_COUNT];
+    double  incr_comp[AVG_COUNT];
+    char    key[INFODB_KEY_SIZE];	/* host '\0' disk */
+    infodb_history_t history[NB_HISTORY];
+    infodb_stats_t   stats[INFODB_MAX_STATS];
+};
+
+struct infodb_s {
+    char       *filename;
+    file_lock  *lock;
+    int         fd;
+    gboolean    writable;
+    char       *map;
+    size_t      map_size;
+    ino_t       ino;
+
+    int         batch_depth;
+    GHashTable *batch;		/* infodb_record_t of the pending changes */
+};
+
+static int infodb_map(infodb_t *db);
+
+static size_t
+infodb_slots_offset(
+    guint32 nbuckets)
+{
+    return INFODB_PAGE + am_round((size_t)nbuckets * sizeof(guint32),
+				  INFODB_PAGE);
+}
+
+static infodb_record_t *
+infodb_slot(
+    char    *map,
+    guint32  slot)
+{
+    infodb_header_t *hdr = (infodb_header_t *)map;
+
+    return (infodb_record_t *)(map + infodb_slots_offset(hdr->nbuckets)
+				   + (size_t)slot * INFODB_SLOT_SIZE);
+}
+
+static guint32
+infodb_hash(
+    const char *key,
+    guint32     keylen)
+{
+    guint32 h = 2166136261U;
+    guint32 i;
+
+    for (i = 0; i < keylen; i++) {
+	h ^= (guchar)key[i];
+	h *= 16777619U;
+    }
+    return h;
+}
+
+static guint
+infodb_record_hash(
+    gconstpointer p)
+{
+    const infodb_record_t *rec = p;
+
+    return infodb_hash(rec->key, rec->keylen);
+}
+
+static gboolean
+infodb_record_equal(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const infodb_record_t *ra = a;
+    const infodb_record_t *rb = b;
+
+    return ra->keylen == rb->keylen &&
+	   memcmp(ra->key, rb->key, ra->keylen) == 0;
+}
+
+/* Find the bucket holding the record for KEY in the database mapped at MAP.
+ *
+ * @returns: the bucket, or -1 if there is none, in which case *free_bucket
+ *           is set to the bucket where it should be added, or -1
+ */
+static gint64
+infodb_find(
+    char       *map,
+    const char *key,
+    guint32     keylen,
+    gint64     *free_bucket)
+{
+    infodb_header_t *hdr = (infodb_header_t *)map;
+    guint32 *buckets = (guint32 *)(map + INFODB_PAGE);
+    guint32 mask = hdr->nbuckets - 1;
+    guint32 i = infodb_hash(key, keylen) & mask;
+    guint32 n;
+    gint64 first_free = -1;
+
+    for (n = 0; n < hdr->nbuckets; n++, i = (i + 1) & mask) {
+	guint32 b = buckets[i];
+	infodb_record_t *rec;
+
+	if (b == INFODB_EMPTY) {
+	    if (first_free == -1)
+		first_free = i;
+	    break;
+	}
+	if (b == INFODB_DELETED) {
+	    if (first_free == -1)
+		first_free = i;
+	    continue;
+	}
+	if (b > hdr->nslots)
+	    continue;
+	rec = infodb_slot(map, b - 1);
+	if (rec->keylen == keylen && memcmp(rec->key, key, keylen) == 0)
+	    return i;
+    }
+
+    if (free_bucket)
+	*free_bucket = first_free;
+    return -1;
+}
+
+/* Fill REC, which must be zeroed, with HOST, DISK and INFO
+ *
+ * @returns: 0 on success, -1 if it does not fit in a record
+ */
+static int
+infodb_record_from_info(
+    infodb_record_t *rec,
+    char            *host,
+    char            *disk,
+    info_t          *info)
+{
+    size_t hostlen = strlen(host);
+    size_t disklen = strlen(disk);
+    int level;
+    int i;
+
+    if (hostlen + 1 + disklen > INFODB_KEY_SIZE) {
+	g_debug("infofile: %s:%s: name too long for the binary infofile",
+		host, disk);
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    memcpy(rec->key, host, hostlen);
+    memcpy(rec->key + hostlen + 1, disk, disklen);
+    rec->keylen = hostlen + 1 + disklen;
+
+    if (!info)
+	return 0;
+
+    rec->in_use = 1;
+    rec->command = info->command;
+    rec->last_level = info->last_level;
+    rec->consecutive_runs = info->consecutive_runs;
+    for (i = 0; i < AVG_COUNT; i++) {
+	rec->full_rate[i] = info->full.rate[i];
+	rec->full_comp[i] = info->full.comp[i];
+	rec->incr_rate[i] = info->incr.rate[i];
+	rec->incr_comp[i] = info->incr.comp[i];
+    }
+
+    /* same selection as write_txinfofile */
+    for (level = 0; level < DUMP_LEVELS; level++) {
+	stats_t *sp = &info->inf[level];
+	infodb_stats_t *st;
+
+	if (sp->date < (time_t)0 && sp->label[0] == '\0')
+	    continue;
+	if (rec->nstats == INFODB_MAX_STATS) {
+	    g_debug("infofile: %s:%s: more than %d levels with stats do not "
+		    "fit in the binary infofile", host, disk, INFODB_MAX_STATS);
+	    errno = EOVERFLOW;
+	    return -1;
+	}
+	st = &rec->stats[rec->nstats++];
+	st->level = level;
+	st->size = sp->size;
+	st->csize = sp->csize;
+	st->secs = sp->secs;
+	st->date = sp->date;
+	st->filenum = sp->filenum;
+	strncpy(st->label, sp->label, sizeof(st->label) - 1);
+    }
+
+    for (i = 0; i < NB_HISTORY && info->history[i].level > -1; i++) {
+	infodb_history_t *hp = &rec->history[i];
+
+	hp->level = info->history[i].level;
+	hp->size = info->history[i].size;
+	hp->csize = info->history[i].csize;
+	hp->date = info->history[i].date;
+	hp->secs = info->history[i].secs;
+    }
+    rec->nhistory = i;
+
+    return 0;
+}
+
+/* Fill INFO, which must be zeroed, from REC
+ *
+ * @returns: 0 on success, -2 if the record is corrupted
+ */
+static int
+infodb_record_to_info(
+    infodb_record_t *rec,
+    info_t          *info)
+{
+    guint32 i;
+
+    if (rec->nstats > INFODB_MAX_STATS || rec->nhistory > NB_HISTORY)
+	return -2;
+
+    info->command = rec->command;
+    info->last_level = rec->last_level;
+    info->consecutive_runs = rec->consecutive_runs;
+    for (i = 0; i < AVG_COUNT; i++) {
+	info->full.rate[i] = rec->full_rate[i];
+	info->full.comp[i] = rec->full_comp[i];
+	info->incr.rate[i] = rec->incr_rate[i];
+	info->incr.comp[i] = rec->incr_comp[i];
+    }
+
+    for (i = 0; i < rec->nstats; i++) {
+	infodb_stats_t *st = &rec->stats[i];
+	stats_t *sp;
+
+	if (st->level < 0 || st->level >= DUMP_LEVELS)
+	    return -2;
+	sp = &info->inf[st->level];
+	sp->size = st->size;
+	sp->csize = st->csize;
+	sp->secs = st->secs;
+	sp->date = st->date;
+	sp->filenum = st->filenum;
+	strncpy(sp->label, st->label, sizeof(sp->label) - 1);
+	sp->label[sizeof(sp->label) - 1] = '\0';
+    }
+
+    for (i = 0; i < rec->nhistory; i++) {
+	infodb_history_t *hp = &rec->history[i];
+
+	info->history[i].level = hp->level;
+	info->history[i].size = hp->size;
+	info->history[i].csize = hp->csize;
+	info->history[i].date = hp->date;
+	info->history[i].secs = hp->secs;
+    }
+
+    return 0;
+}
+
+static int
+infodb_lock(
+    infodb_t *db,
+    gboolean  write)
+{
+    int rc;
+
+    /* file_lock does not wait for the lock */
+    while ((rc = write ? file_lock_lock_wr(db->lock)
+		       : file_lock_lock_rd(db->lock)) == 1) {
+	g_usleep(10000);
+    }
+    if (rc != 0) {
+	g_debug("infofile: could not lock %s.lock: %s", db->filename,
+		strerror(errno));
+	return -1;
+    }
+    return 0;
+}
+
+static void
+infodb_unlock(
+    infodb_t *db)
+{
+    file_lock_unlock(db->lock);
+}
+
+static void
+infodb_unmap(
+    infodb_t *db)
+{
+    if (db->map) {
+	munmap(db->map, db->map_size);
+	db->map = NULL;
+	db->map_size = 0;
+    }
+    if (db->fd != -1) {
+	close(db->fd);
+	db->fd = -1;
+    }
+}
+
+/* Write a new database to FILENAME.new with room for NRECORDS records, copy
+ * the records of the database mapped at OLD_MAP (if not NULL) to it, and
+ * rename it to FILENAME.  Must be called with the write lock held.
+ *
+ * @returns: 0 on success, -1 on error
+ */
+static int
+infodb_build(
+    char    *filename,
+    guint32  nrecords,
+    char    *old_map)
+{
+    char *newfile = g_strconcat(filename, ".new", NULL);
+    infodb_header_t *hdr;
+    infodb_header_t *old_hdr = (infodb_header_t *)old_map;
+    guint32 nbuckets = INFODB_MIN_BUCKETS;
+    guint32 nslots = 0;
+    size_t size;
+    char *map = NULL;
+    int fd;
+    guint32 i;
+    int rc = -1;
+
+    while (nbuckets < nrecords * 4)
+	nbuckets *= 2;
+    if (old_hdr)
+	nslots = old_hdr->nused;
+    size = infodb_slots_offset(nbuckets) + (size_t)nslots * INFODB_SLOT_SIZE;
+
+    fd = open(newfile, O_RDWR|O_CREAT|O_TRUNC, 0666);
+    if (fd == -1) {
+	g_debug("infofile: could not create %s: %s", newfile, strerror(errno));
+	goto done;
+    }
+    if (ftruncate(fd, size) == -1) {
+	g_debug("infofile: could not extend %s: %s", newfile, strerror(errno));
+	goto done;
+    }
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	map = NULL;
+	g_debug("infofile: could not map %s: %s", newfile, strerror(errno));
+	goto done;
+    }
+
+    hdr = (infodb_header_t *)map;
+    memcpy(hdr->magic, INFODB_MAGIC, sizeof(hdr->magic));
+    hdr->bom = INFODB_BOM;
+    hdr->version = INFODB_VERSION;
+    hdr->slot_size = INFODB_SLOT_SIZE;
+    hdr->nbuckets = nbuckets;
+    hdr->nslots = nslots;
+
+    if (old_hdr) {
+	guint32 *old_buckets = (guint32 *)(old_map + INFODB_PAGE);
+	guint32 *buckets = (guint32 *)(map + INFODB_PAGE);
+
+	for (i = 0; i < old_hdr->nbuckets && hdr->nused < nslots; i++) {
+	    guint32 b = old_buckets[i];
+	    infodb_record_t *rec;
+	    gint64 free_bucket;
+
+	    if (b == INFODB_EMPTY || b == INFODB_DELETED || b > old_hdr->nslots)
+		continue;
+	    rec = infodb_slot(map, hdr->nused);
+	    memcpy(rec, infodb_slot(old_map, b - 1), sizeof(*rec));
+	    rec->next_free = 0;
+	    if (infodb_find(map, rec->key, rec->keylen, &free_bucket) != -1 ||
+		free_bucket == -1) {
+		continue;
+	    }
+	    buckets[free_bucket] = ++hdr->nused;
+	}
+	/* a bucket may have been dropped as a duplicate */
+	for (i = hdr->nused; i < nslots; i++) {
+	    infodb_record_t *rec = infodb_slot(map, i);
+
+	    rec->in_use = 0;
+	    rec->next_free = hdr->free_head;
+	    hdr->free_head = i + 1;
+	}
+    }
+
+    if (msync(map, size, MS_SYNC) == -1) {
+	g_debug("infofile: could not sync %s: %s", newfile, strerror(errno));
+	goto done;
+    }
+    if (rename(newfile, filename) == -1) {
+	g_debug("infofile: could not rename %s: %s", newfile, strerror(errno));
+	goto done;
+    }
+    rc = 0;
+
+done:
+    if (map)
+	munmap(map, size);
+    if (fd != -1)
+	close(fd);
+    if (rc == -1)
+	unlink(newfile);
+    g_free(newfile);
+    return rc;
+}
+
+static int
+infodb_map(
+    infodb_t *db)
+{
+    infodb_header_t *hdr;
+    struct stat st;
+
+    infodb_unmap(db);
+
+    db->writable = TRUE;
+    db->fd = open(db->filename, O_RDWR);
+    if (db->fd == -1 && errno == EACCES) {
+	db->writable = FALSE;
+	db->fd = open(db->filename, O_RDONLY);
+    }
+    if (db->fd == -1) {
+	g_debug("infofile: could not open %s: %s", db->filename,
+		strerror(errno));
+	return -1;
+    }
+    if (fstat(db->fd, &st) == -1) {
+	g_debug("infofile: could not stat %s: %s", db->filename,
+		strerror(errno));
+	goto failed;
+    }
+    if (st.st_size < INFODB_PAGE) {
+	g_debug("infofile: %s is truncated", db->filename);
+	goto failed;
+    }
+
+    db->map = mmap(NULL, st.st_size,
+		   db->writable ? PROT_READ|PROT_WRITE : PROT_READ,
+		   MAP_SHARED, db->fd, 0);
+    if (db->map == MAP_FAILED) {
+	db->map = NULL;
+	g_debug("infofile: could not map %s: %s", db->filename,
+		strerror(errno));
+	goto failed;
+    }
+    db->map_size = st.st_size;
+    db->ino = st.st_ino;
+
+    hdr = (infodb_header_t *)db->map;
+    if (memcmp(hdr->magic, INFODB_MAGIC, sizeof(hdr->magic)) != 0 ||
+	hdr->bom != INFODB_BOM ||
+	hdr->version != INFODB_VERSION ||
+	hdr->slot_size != INFODB_SLOT_SIZE ||
+	hdr->nbuckets == 0 || (hdr->nbuckets & (hdr->nbuckets - 1)) != 0 ||
+	infodb_slots_offset(hdr->nbuckets) +
+		(size_t)hdr->nslots * INFODB_SLOT_SIZE > db->map_size) {
+	g_debug("infofile: %s is not a binary infofile of this version",
+		db->filename);
+	goto failed;
+    }
+
+    return 0;
+
+failed:
+    infodb_unmap(db);
+    return -1;
+}
+
+/* Map the database again if another process grew or replaced it.  Must be
+ * called with a lock held. */
+static int
+infodb_refresh(
+    infodb_t *db)
+{
+    struct stat st;
+
+    if (stat(db->filename, &st) == -1) {
+	g_debug("infofile: could not stat %s: %s", db->filename,
+		strerror(errno));
+	return -1;
+    }
+    if (db->map && st.st_ino == db->ino && (size_t)st.st_size == db->map_size)
+	return 0;
+    return infodb_map(db);
+}
+
+static infodb_t *
+infodb_open(
+    char *dir)
+{
+    infodb_t *db = g_new0(infodb_t, 1);
+    char *lockfile;
+    struct stat st;
+    int rc = 0;
+
+    g_assert(sizeof(infodb_record_t) <= INFODB_SLOT_SIZE);
+
+    db->fd = -1;
+    db->filename = g_strconcat(dir, "/curinfo.db", NULL);
+    lockfile = g_strconcat(db->filename, ".lock", NULL);
+    db->lock = file_lock_new(lockfile);
+    g_free(lockfile);
+
+    if (mkpdir(db->filename, 0755, (uid_t)-1, (gid_t)-1) == -1 ||
+	infodb_lock(db, TRUE) == -1) {
+	infodb_close(db);
+	return NULL;
+    }
+    if (stat(db->filename, &st) == -1 && errno == ENOENT)
+	rc = infodb_build(db->filename, 0, NULL);
+    if (rc == 0)
+	rc = infodb_map(db);
+    infodb_unlock(db);
+
+    if (rc == -1) {
+	infodb_close(db);
+	return NULL;
+    }
+    return db;
+}
+
+static void
+infodb_close(
+    infodb_t *db)
+{
+    if (db->batch) {
+	if (g_hash_table_size(db->batch) > 0)
+	    g_debug("infofile: %d uncommitted changes discarded",
+		    g_hash_table_size(db->batch));
+	g_hash_table_destroy(db->batch);
+    }
+    infodb_unmap(db);
+    file_lock_free(db->lock);
+    g_free(db->filename);
+    g_free(db);
+}
+
+static int
+infodb_get(
+    infodb_t *db,
+    char     *host,
+    char     *disk,
+    info_t   *info)
+{
+    infodb_record_t *key = g_new0(infodb_record_t, 1);
+    infodb_record_t *rec;
+    gint64 b;
+    int rc = -1;
+
+    if (infodb_record_from_info(key, host, disk, NULL) == -1)
+	goto done;
+
+    /* changes not committed yet */
+    if (db->batch && (rec = g_hash_table_lookup(db->batch, key)) != NULL) {
+	rc = rec->in_use ? infodb_record_to_info(rec, info) : -1;
+	goto done;
+    }
+
+    if (infodb_lock(db, FALSE) == -1) {
+	rc = -2;
+	goto done;
+    }
+    if (infodb_refresh(db) == -1) {
+	rc = -2;
+    } else {
+	b = infodb_find(db->map, key->key, key->keylen, NULL);
+	if (b != -1) {
+	    guint32 *buckets = (guint32 *)(db->map + INFODB_PAGE);
+
+	    rc = infodb_record_to_info(infodb_slot(db->map, buckets[b] - 1),
+				       info);
+	}
+    }
+    infodb_unlock(db);
+
+done:
+    g_free(key);
+    return rc;
+}
+
+/* Queue REC, which has no info for a deletion, and commit it unless a
+ * batch is open */
+static int
+infodb_queue(
+    infodb_t        *db,
+    infodb_record_t *rec)
+{
+    int rc = 0;
+
+    if (!db->batch)
+	db->batch = g_hash_table_new_full(infodb_record_hash,
+					  infodb_record_equal, NULL, g_free);
+    g_hash_table_replace(db->batch, rec, rec);
+
+    if (db->batch_depth == 0) {
+	rc = infodb_commit(db);
+	g_hash_table_remove_all(db->batch);
+    }
+    return rc;
+}
+
+static int
+infodb_put(
+    infodb_t *db,
+    char     *host,
+    char     *disk,
+    info_t   *info)
+{
+    infodb_record_t *rec = g_new0(infodb_record_t, 1);
+
+    if (infodb_record_from_info(rec, host, disk, info) == -1) {
+	g_free(rec);
+	return -1;
+    }
+    return infodb_queue(db, rec);
+}
+
+static int
+infodb_del(
+    infodb_t *db,
+    char     *host,
+    char     *disk)
+{
+    infodb_record_t *rec = g_new0(infodb_record_t, 1);
+
+    if (infodb_record_from_info(rec, host, disk, NULL) == -1) {
+	g_free(rec);
+	return -1;
+    }
+    return infodb_queue(db, rec);
+}
+
+/* Add NMORE free slots to the database */
+static int
+infodb_grow(
+    infodb_t *db,
+    guint32   nmore)
+{
+    infodb_header_t *hdr = (infodb_header_t *)db->map;
+    guint32 nslots = hdr->nslots;
+    size_t size = infodb_slots_offset(hdr->nbuckets) +
+		  (size_t)(nslots + nmore) * INFODB_SLOT_SIZE;
+    guint32 i;
+
+    if (size > db->map_size) {
+	if (ftruncate(db->fd, size) == -1) {
+	    g_debug("infofile: could not extend %s: %s", db->filename,
+		    strerror(errno));
+	    return -1;
+	}
+	if (infodb_map(db) == -1)
+	    return -1;
+	hdr = (infodb_header_t *)db->map;
+    }
+
+    for (i = nslots + nmore; i > nslots; i--) {
+	infodb_record_t *rec = infodb_slot(db->map, i - 1);
+
+	rec->in_use = 0;
+	rec->next_free = hdr->free_head;
+	hdr->free_head = i;
+    }
+    hdr->nslots = nslots + nmore;
+
+    return 0;
+}
+
+/* Chain every slot that no bucket points to in the free list.  The buckets
+ * are what commits a change, so a crash in infodb_commit can leave free_head
+ * and the next_free links behind them: a slot already switched to but still
+ * on the free list, or an old one never put back on it.  The free list is
+ * thus rebuilt, under the write lock, before each commit uses it. */
+static void
+infodb_rebuild_free_list(
+    infodb_t *db)
+{
+    infodb_header_t *hdr = (infodb_header_t *)db->map;
+    guint32 *buckets = (guint32 *)(db->map + INFODB_PAGE);
+    guint8 *used = g_new0(guint8, hdr->nslots + 1);
+    guint32 i;
+
+    for (i = 0; i < hdr->nbuckets; i++) {
+	guint32 b = buckets[i];
+
+	if (b != INFODB_EMPTY && b != INFODB_DELETED && b <= hdr->nslots)
+	    used[b] = 1;
+    }
+
+    hdr->free_head = 0;
+    for (i = hdr->nslots; i > 0; i--) {
+	infodb_record_t *rec;
+
+	if (used[i])
+	    continue;
+	rec = infodb_slot(db->map, i - 1);
+	rec->in_use = 0;
+	rec->next_free = hdr->free_head;
+	hdr->free_head = i;
+    }
+    g_free(used);
+}
+
+static int
+infodb_commit(
+    infodb_t *db)
+{
+    infodb_header_t *hdr;
+    guint32 *buckets;
+    GPtrArray *recs;
+    GArray *old_slots;
+    guint32 *new_slots;
+    GHashTableIter iter;
+    gpointer p;
+    guint32 nnew = 0;
+    guint32 nfree = 0;
+    guint32 i;
+    int rc = -1;
+
+    if (!db->batch || g_hash_table_size(db->batch) == 0)
+	return 0;
+    if (!db->writable) {
+	g_debug("infofile: %s is read-only", db->filename);
+	errno = EACCES;
+	return -1;
+    }
+
+    recs = g_ptr_array_sized_new(g_hash_table_size(db->batch));
+    g_hash_table_iter_init(&iter, db->batch);
+    while (g_hash_table_iter_next(&iter, &p, NULL))
+	g_ptr_array_add(recs, p);
+    new_slots = g_new0(guint32, recs->len);
+    old_slots = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+    if (infodb_lock(db, TRUE) == -1)
+	goto done;
+    if (infodb_refresh(db) == -1)
+	goto unlock;
+
+    /* make sure the hash table stays at most half full */
+    for (i = 0; i < recs->len; i++) {
+	infodb_record_t *rec = g_ptr_array_index(recs, i);
+
+	if (rec->in_use &&
+	    infodb_find(db->map, rec->key, rec->keylen, NULL) == -1)
+	    nnew++;
+    }
+    hdr = (infodb_header_t *)db->map;
+    if ((guint64)(hdr->nused + hdr->ndeleted + nnew) * 2 > hdr->nbuckets) {
+	if (infodb_build(db->filename, hdr->nused + nnew, db->map) == -1 ||
+	    infodb_map(db) == -1)
+	    goto unlock;
+    }
+
+    /* write the new records to free slots */
+    infodb_rebuild_free_list(db);
+    hdr = (infodb_header_t *)db->map;
+    for (i = hdr->free_head; i != 0 && nfree < recs->len;
+	 i = infodb_slot(db->map, i - 1)->next_free) {
+	nfree++;
+    }
+    if (nfree < recs->len &&
+	infodb_grow(db, MAX(recs->len - nfree, hdr->nslots / 4 + 16)) == -1)
+	goto unlock;
+    hdr = (infodb_header_t *)db->map;
+    for (i = 0; i < recs->len; i++) {
+	infodb_record_t *rec = g_ptr_array_index(recs, i);
+	guint32 slot;
+
+	if (!rec->in_use)
+	    continue;
+	slot = hdr->free_head - 1;
+	hdr->free_head = infodb_slot(db->map, slot)->next_free;
+	memcpy(infodb_slot(db->map, slot), rec, sizeof(*rec));
+	new_slots[i] = slot + 1;
+    }
+    if (msync(db->map, db->map_size, MS_SYNC) == -1) {
+	g_debug("infofile: could not sync %s: %s", db->filename,
+		strerror(errno));
+	goto unlock;
+    }
+
+    /* switch the buckets to them */
+    buckets = (guint32 *)(db->map + INFODB_PAGE);
+    for (i = 0; i < recs->len; i++) {
+	infodb_record_t *rec = g_ptr_array_index(recs, i);
+	gint64 free_bucket;
+	gint64 b = infodb_find(db->map, rec->key, rec->keylen, &free_bucket);
+
+	if (b != -1) {
+	    guint32 old_slot = buckets[b] - 1;
+
+	    g_array_append_val(old_slots, old_slot);
+	    if (rec->in_use) {
+		buckets[b] = new_slots[i];
+	    } else {
+		buckets[b] = INFODB_DELETED;
+		hdr->nused--;
+		hdr->ndeleted++;
+	    }
+	} else if (rec->in_use) {
+	    g_assert(free_bucket != -1);
+	    if (buckets[free_bucket] == INFODB_DELETED)
+		hdr->ndeleted--;
+	    buckets[free_bucket] = new_slots[i];
+	    hdr->nused++;
+	}
+    }
+    if (msync(db->map, db->map_size, MS_SYNC) == -1) {
+	g_debug("infofile: could not sync %s: %s", db->filename,
+		strerror(errno));
+	goto unlock;
+    }
+
+    /* and free the old records */
+    for (i = 0; i < old_slots->len; i++) {
+	guint32 slot = g_array_index(old_slots, guint32, i);
+	infodb_record_t *rec = infodb_slot(db->map, slot);
+
+	rec->in_use = 0;
+	rec->next_free = hdr->free_head;
+	hdr->free_head = slot + 1;
+    }
+    if (msync(db->map, db->map_size, MS_SYNC) == -1) {
+	g_debug("infofile: could not sync %s: %s", db->filename,
+		strerror(errno));
+	goto unlock;
+    }
+    rc = 0;
+
+unlock:
+    infodb_unlock(db);
+done:
+    g_ptr_array_free(recs, TRUE);
+    g_array_free(old_slots, TRUE);
+    g_free(new_slots);
+    return rc;
+}
+
 int
 open_infofile(
     char *	filename)
 {
+    char *format = getconf_str(CNF_INFOFILE_FORMAT);
+
     assert(infodir == NULL);
 
     infodir = g_strdup(filename);
 
+    if (format && g_str_equal(format, "binary")) {
+	infodb = infodb_open(infodir);
+	if (!infodb) {
+	    amfree(infodir);
+	    return -1;
+	}
+    }
+
     return 0; /* success! */
 }
 
@@ -527,9 +1465,36 @@ close_infofile(void)
 {
     assert(infodir != NULL);
 
+    if (infodb) {
+	infodb_close(infodb);
+	infodb = NULL;
+    }
     amfree(infodir);
 }
 
+void
+begin_info_batch(void)
+{
+    if (infodb)
+	infodb->batch_depth++;
+}
+
+int
+commit_info_batch(void)
+{
+    int rc = 0;
+
+    if (!infodb)
+	return 0;
+
+    assert(infodb->batch_depth > 0);
+    if (--infodb->batch_depth == 0 && infodb->batch) {
+	rc = infodb_commit(infodb);
+	g_hash_table_remove_all(infodb->batch);
+    }
+    return rc;
+}
+
 /* Convert a dump level to a GMT based time stamp */
 char *
 get_dumpdate(
@@ -623,6 +1588,13 @@ get_info(
 
     (void) zero_info(info);
 
+    if (infodb) {
+	rc = infodb_get(infodb, hostname, diskname, info);
+	if (rc != -1)
+	    return rc;
+	/* not converted yet, read the text file */
+    }
+
     {
 	FILE *infof;
 
@@ -651,6 +1623,9 @@ put_info(
     FILE *infof;
     int rc;
 
+    if (infodb)
+	return infodb_put(infodb, hostname, diskname, info);
+
     infof = open_txinfofile(hostname, diskname, "w");
 
     if(infof == NULL) return -1;
@@ -668,6 +1643,15 @@ del_info(
     char *	hostname,
     char *	diskname)
 {
+    int rc;
+
+    if (infodb) {
+	/* the text file would be read back if it were left */
+	rc = infodb_del(infodb, hostname, diskname);
+	delete_txinfofile(hostname, diskname);
+	return rc;
+    }
+
     return delete_txinfofile(hostname, diskname);
 }
 
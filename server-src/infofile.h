@@ -94,4 +94,14 @@ int get_info(char *hostname, char *diskname, info_t *info);
 int put_info(char *hostname, char *diskname, info_t *info);
 int del_info(char *hostname, char *diskname);
 
+/* With infofile-format "binary", put_info and del_info between these two
+ * calls are only applied by commit_info_batch, all at once; get_info sees
+ * them.  Batches can be nested.  Without a batch, each change is committed
+ * immediately.  Nothing is batched with the text format.
+ *
+ * commit_info_batch returns 0 on success, -1 if the changes were lost.
+ */
+void begin_info_batch(void);
+int commit_info_batch(void);
+
 #endif /* ! INFOFILE_H */
@@ -0,0 +1,533 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+#include "amanda.h"
+#include "logindex.h"
+
+/*
+ * The file is in host byte order; an index written on a different host is
+ * simply rebuilt.  Strings are a 32-bit length followed by the bytes, with
+ * a length of G_MAXUINT32 for NULL.
+ *
+ *   magic, byte order mark, version
+ *   logfile size, mtime, inode
+ *   datestamp
+ *   number of results, number of pre-start results, number of lines
+ *   for each key: number of values, values
+ *   results
+ *   lines: type, program, string
+ */
+
+#define LOGINDEX_MAGIC "AMCATIDX"
+#define LOGINDEX_BOM 0x01020304
+#define LOGINDEX_VERSION 1
+
+static char *
+logindex_filename(
+    const char *logfile)
+{
+    char *dir = g_path_get_dirname(logfile);
+    char *base = g_path_get_basename(logfile);
+    char *filename = g_strconcat(dir, "/catalog/", base, NULL);
+
+    g_free(dir);
+    g_free(base);
+    return filename;
+}
+
+logindex_t *
+logindex_new(
+    const char  *logfile,
+    struct stat *st)
+{
+    logindex_t *idx = g_new0(logindex_t, 1);
+    int i;
+
+    idx->strings = g_string_chunk_new(16384);
+    idx->logfile = g_strdup(logfile);
+    idx->log_size = st->st_size;
+    idx->log_mtime = st->st_mtime;
+    idx->log_ino = st->st_ino;
+    idx->lines = g_ptr_array_new();
+    for (i = 0; i < LOGINDEX_NKEYS; i++) {
+	idx->keys[i] = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    return idx;
+}
+
+void
+logindex_free(
+    logindex_t *idx)
+{
+    guint i;
+
+    if (!idx)
+	return;
+
+    free_find_result(&idx->results);
+    for (i = 0; i < idx->lines->len; i++) {
+	g_free(g_ptr_array_index(idx->lines, i));
+    }
+    g_ptr_array_free(idx->lines, TRUE);
+    for (i = 0; i < LOGINDEX_NKEYS; i++) {
+	g_hash_table_destroy(idx->keys[i]);
+    }
+    g_string_chunk_free(idx->strings);
+    g_free(idx->logfile);
+    g_free(idx);
+}
+
+gboolean
+logindex_is_current(
+    logindex_t  *idx,
+    const char  *logfile,
+    struct stat *st)
+{
+    return g_str_equal(idx->logfile, logfile) &&
+	   idx->log_size == (guint64)st->st_size &&
+	   idx->log_mtime == (gint64)st->st_mtime &&
+	   idx->log_ino == (guint64)st->st_ino;
+}
+
+char *
+logindex_strdup(
+    logindex_t *idx,
+    const char *str)
+{
+    if (!str)
+	return NULL;
+    return g_string_chunk_insert_const(idx->strings, str);
+}
+
+void
+logindex_add_key(
+    logindex_t     *idx,
+    logindex_key_t  key,
+    const char     *value)
+{
+    if (!value || g_hash_table_lookup(idx->keys[key], value))
+	return;
+    value = logindex_strdup(idx, value);
+    g_hash_table_insert(idx->keys[key], (gpointer)value, (gpointer)value);
+}
+
+gboolean
+logindex_has_key(
+    logindex_t     *idx,
+    logindex_key_t  key,
+    const char     *value)
+{
+    return g_hash_table_lookup(idx->keys[key], "") != NULL ||
+	   g_hash_table_lookup(idx->keys[key], value) != NULL;
+}
+
+void
+logindex_add_line(
+    logindex_t *idx,
+    logtype_t   type,
+    program_t   prog,
+    const char *str)
+{
+    logindex_line_t *line = g_new(logindex_line_t, 1);
+
+    line->type = type;
+    line->prog = prog;
+    line->str = logindex_strdup(idx, str);
+    g_ptr_array_add(idx->lines, line);
+}
+
+void
+logindex_remove(
+    const char *logfile)
+{
+    char *filename = logindex_filename(logfile);
+
+    if (unlink(filename) != 0 && errno != ENOENT) {
+	g_debug("could not remove catalog index '%s': %s", filename,
+		strerror(errno));
+    }
+    g_free(filename);
+}
+
+/*
+ * Writing
+ */
+
+static void
+put_u32(
+    GByteArray *buf,
+    guint32     val)
+{
+    g_byte_array_append(buf, (guint8 *)&val, sizeof(val));
+}
+
+static void
+put_u64(
+    GByteArray *buf,
+    guint64     val)
+{
+    g_byte_array_append(buf, (guint8 *)&val, sizeof(val));
+}
+
+static void
+put_double(
+    GByteArray *buf,
+    double      val)
+{
+    g_byte_array_append(buf, (guint8 *)&val, sizeof(val));
+}
+
+static void
+put_str(
+    GByteArray *buf,
+    const char *str)
+{
+    if (!str) {
+	put_u32(buf, G_MAXUINT32);
+    } else {
+	guint32 len = strlen(str);
+	put_u32(buf, len);
+	g_byte_array_append(buf, (guint8 *)str, len);
+    }
+}
+
+static void
+put_crc(
+    GByteArray *buf,
+    crc_t      *crc)
+{
+    put_u32(buf, crc->crc);
+    put_u64(buf, crc->size);
+}
+
+static void
+put_key(
+    gpointer key,
+    gpointer value G_GNUC_UNUSED,
+    gpointer user_data)
+{
+    put_str((GByteArray *)user_data, (char *)key);
+}
+
+gboolean
+logindex_write(
+    logindex_t *idx)
+{
+    GByteArray *buf = g_byte_array_new();
+    char *filename = logindex_filename(idx->logfile);
+    char *tmpfilename = g_strdup_printf("%s.tmp.%d", filename, (int)getpid());
+    char *dir = g_path_get_dirname(filename);
+    find_result_t *r;
+    guint32 n_results = 0;
+    gboolean rv = FALSE;
+    guint i;
+    int fd;
+
+    for (r = idx->results; r; r = r->next)
+	n_results++;
+
+    g_byte_array_append(buf, (guint8 *)LOGINDEX_MAGIC, 8);
+    put_u32(buf, LOGINDEX_BOM);
+    put_u32(buf, LOGINDEX_VERSION);
+    put_u64(buf, idx->log_size);
+    put_u64(buf, (guint64)idx->log_mtime);
+    put_u64(buf, idx->log_ino);
+    put_str(buf, idx->datestamp);
+    put_u32(buf, n_results);
+    put_u32(buf, idx->n_pre_start);
+    put_u32(buf, idx->lines->len);
+    for (i = 0; i < LOGINDEX_NKEYS; i++) {
+	put_u32(buf, g_hash_table_size(idx->keys[i]));
+	g_hash_table_foreach(idx->keys[i], put_key, buf);
+    }
+
+    for (r = idx->results; r; r = r->next) {
+	put_str(buf, r->timestamp);
+	put_str(buf, r->write_timestamp);
+	put_str(buf, r->hostname);
+	put_str(buf, r->diskname);
+	put_str(buf, r->storage);
+	put_u32(buf, r->storage_id);
+	put_str(buf, r->pool);
+	put_u32(buf, r->level);
+	put_str(buf, r->label);
+	put_u64(buf, r->filenum);
+	put_str(buf, r->status);
+	put_str(buf, r->dump_status);
+	put_str(buf, r->message);
+	put_u32(buf, r->partnum);
+	put_u32(buf, r->totalparts);
+	put_double(buf, r->sec);
+	put_u64(buf, r->bytes);
+	put_u64(buf, r->kb);
+	put_u64(buf, r->orig_kb);
+	put_crc(buf, &r->native_crc);
+	put_crc(buf, &r->client_crc);
+	put_crc(buf, &r->server_crc);
+    }
+
+    for (i = 0; i < idx->lines->len; i++) {
+	logindex_line_t *line = g_ptr_array_index(idx->lines, i);
+	put_u32(buf, line->type);
+	put_u32(buf, line->prog);
+	put_str(buf, line->str);
+    }
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+	g_debug("could not create catalog directory '%s': %s", dir,
+		strerror(errno));
+	goto done;
+    }
+
+    fd = open(tmpfilename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+	g_debug("could not create catalog index '%s': %s", tmpfilename,
+		strerror(errno));
+	goto done;
+    }
+    if (full_write(fd, buf->data, buf->len) != buf->len) {
+	g_debug("could not write catalog index '%s': %s", tmpfilename,
+		strerror(errno));
+	close(fd);
+	unlink(tmpfilename);
+	goto done;
+    }
+    if (close(fd) != 0 || rename(tmpfilename, filename) != 0) {
+	g_debug("could not write catalog index '%s': %s", filename,
+		strerror(errno));
+	unlink(tmpfilename);
+	goto done;
+    }
+    rv = TRUE;
+
+done:
+    g_byte_array_free(buf, TRUE);
+    g_free(dir);
+    g_free(tmpfilename);
+    g_free(filename);
+    return rv;
+}
+
+/*
+ * Reading
+ */
+
+typedef struct {
+    logindex_t *idx;
+    char *p;
+    char *end;
+    gboolean bad;
+} reader_t;
+
+static gboolean
+get_bytes(
+    reader_t *rd,
+    void     *dst,
+    gsize     len)
+{
+    if (rd->bad || (gsize)(rd->end - rd->p) < len) {
+	rd->bad = TRUE;
+	memset(dst, 0, len);
+	return FALSE;
+    }
+    memcpy(dst, rd->p, len);
+    rd->p += len;
+    return TRUE;
+}
+
+static guint32
+get_u32(
+    reader_t *rd)
+{
+    guint32 val;
+    get_bytes(rd, &val, sizeof(val));
+    return val;
+}
+
+static guint64
+get_u64(
+    reader_t *rd)
+{
+    guint64 val;
+    get_bytes(rd, &val, sizeof(val));
+    return val;
+}
+
+static double
+get_double(
+    reader_t *rd)
+{
+    double val;
+    get_bytes(rd, &val, sizeof(val));
+    return val;
+}
+
+static char *
+get_str(
+    reader_t *rd)
+{
+    guint32 len = get_u32(rd);
+    char *str;
+
+    if (rd->bad || len == G_MAXUINT32)
+	return NULL;
+    if ((gsize)(rd->end - rd->p) < len) {
+	rd->bad = TRUE;
+	return NULL;
+    }
+    str = g_string_chunk_insert_len(rd->idx->strings, rd->p, len);
+    rd->p += len;
+    return str;
+}
+
+static void
+get_crc(
+    reader_t *rd,
+    crc_t    *crc)
+{
+    crc->crc = get_u32(rd);
+    crc->size = get_u64(rd);
+}
+
+logindex_t *
+logindex_read(
+    const char  *logfile,
+    struct stat *st)
+{
+    char *filename = logindex_filename(logfile);
+    logindex_t *idx = NULL;
+    reader_t rd;
+    find_result_t **tail;
+    struct stat idx_st;
+    char *data = NULL;
+    guint32 n_results, n_lines;
+    guint32 i, j, n;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+	if (errno != ENOENT) {
+	    g_debug("could not open catalog index '%s': %s", filename,
+		    strerror(errno));
+	}
+	goto done;
+    }
+    if (fstat(fd, &idx_st) != 0 || idx_st.st_size < 8 + 4 + 4) {
+	close(fd);
+	goto done;
+    }
+    data = g_malloc(idx_st.st_size);
+    if (full_read(fd, data, idx_st.st_size) != (size_t)idx_st.st_size) {
+	g_debug("could not read catalog index '%s': %s", filename,
+		strerror(errno));
+	close(fd);
+	goto done;
+    }
+    close(fd);
+
+    idx = logindex_new(logfile, st);
+    rd.idx = idx;
+    rd.p = data + 8;
+    rd.end = data + idx_st.st_size;
+    rd.bad = FALSE;
+
+    if (memcmp(data, LOGINDEX_MAGIC, 8) != 0 ||
+	get_u32(&rd) != LOGINDEX_BOM ||
+	get_u32(&rd) != LOGINDEX_VERSION ||
+	get_u64(&rd) != idx->log_size ||
+	get_u64(&rd) != (guint64)idx->log_mtime ||
+	get_u64(&rd) != idx->log_ino) {
+	/* out of date, or not ours to read */
+	goto bad;
+    }
+
+    idx->datestamp = get_str(&rd);
+    n_results = get_u32(&rd);
+    idx->n_pre_start = get_u32(&rd);
+    n_lines = get_u32(&rd);
+    for (i = 0; i < LOGINDEX_NKEYS; i++) {
+	n = get_u32(&rd);
+	for (j = 0; j < n && !rd.bad; j++) {
+	    char *value = get_str(&rd);
+	    if (value)
+		g_hash_table_insert(idx->keys[i], value, value);
+	}
+    }
+
+    tail = &idx->results;
+    for (i = 0; i < n_results && !rd.bad; i++) {
+	find_result_t *r = g_new0(find_result_t, 1);
+
+	*tail = r;
+	tail = &r->next;
+	r->timestamp = get_str(&rd);
+	r->write_timestamp = get_str(&rd);
+	r->hostname = get_str(&rd);
+	r->diskname = get_str(&rd);
+	r->storage = get_str(&rd);
+	r->storage_id = (gint32)get_u32(&rd);
+	r->pool = get_str(&rd);
+	r->level = (gint32)get_u32(&rd);
+	r->label = get_str(&rd);
+	r->filenum = (off_t)get_u64(&rd);
+	r->status = get_str(&rd);
+	r->dump_status = get_str(&rd);
+	r->message = get_str(&rd);
+	r->partnum = (gint32)get_u32(&rd);
+	r->totalparts = (gint32)get_u32(&rd);
+	r->sec = get_double(&rd);
+	r->bytes = (off_t)get_u64(&rd);
+	r->kb = (off_t)get_u64(&rd);
+	r->orig_kb = (off_t)get_u64(&rd);
+	get_crc(&rd, &r->native_crc);
+	get_crc(&rd, &r->client_crc);
+	get_crc(&rd, &r->server_crc);
+    }
+
+    for (i = 0; i < n_lines && !rd.bad; i++) {
+	logindex_line_t *line = g_new(logindex_line_t, 1);
+
+	line->type = get_u32(&rd);
+	line->prog = get_u32(&rd);
+	line->str = get_str(&rd);
+	g_ptr_array_add(idx->lines, line);
+    }
+
+    if (rd.bad || rd.p != rd.end || (guint32)idx->n_pre_start > n_results) {
+	g_debug("catalog index '%s' is corrupt; rebuilding it", filename);
+	goto bad;
+    }
+    goto done;
+
+bad:
+    logindex_free(idx);
+    idx = NULL;
+
+done:
+    g_free(data);
+    g_free(filename);
+    return idx;
+}
@@ -0,0 +1,128 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Catalog index of a logfile
+ *
+ * The index of logdir/log.X.N is kept in logdir/catalog/log.X.N, and holds
+ * what search_logfile needs from the logfile: the dumps and parts it finds
+ * (before any disklist or volume filtering), the raw taper result lines, and
+ * the set of hostnames, disknames, levels, labels, dump timestamps and
+ * volumes mentioned in the logfile, so that a search can skip logfiles that
+ * cannot match.
+ *
+ * The logfiles stay the reference: an index records the size, mtime and inode
+ * of its logfile, and is rebuilt from it whenever they change, or when one of
+ * its volumes was overwritten or relabeled since.  An index can always be
+ * deleted.
+ */
+
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include "amanda.h"
+#include "logfile.h"
+#include "find.h"
+
+typedef enum {
+    LOGINDEX_HOSTNAME,
+    LOGINDEX_DISKNAME,
+    LOGINDEX_LEVEL,
+    LOGINDEX_LABEL,
+    LOGINDEX_TIMESTAMP,		/* dump timestamp, zero-padded */
+    LOGINDEX_VOLUME,		/* "datestamp label" of each taper START */
+    LOGINDEX_VALID_VOLUME,	/* those that matched the tapelist */
+    LOGINDEX_NKEYS
+} logindex_key_t;
+
+typedef struct logindex_line_s {
+    logtype_t  type;
+    program_t  prog;
+    char      *str;
+} logindex_line_t;
+
+typedef struct logindex_s {
+    char    *logfile;
+    guint64  log_size;
+    gint64   log_mtime;
+    guint64  log_ino;
+
+    char *datestamp;		/* of the first taper START line, or NULL */
+
+    /* results of search_logfile, in the same order, with "" as the write
+     * timestamp of dumps logged before the first taper START */
+    find_result_t *results;
+    int n_pre_start;		/* number of such dumps, at the end of results */
+
+    GPtrArray  *lines;		/* taper DONE, PARTIAL, FAIL and SUCCESS lines */
+    GHashTable *keys[LOGINDEX_NKEYS];
+
+    GStringChunk *strings;
+} logindex_t;
+
+/* Create an empty index for LOGFILE, which has status ST
+ *
+ * @returns: the new index
+ */
+logindex_t *logindex_new(const char *logfile, struct stat *st);
+
+/* Read the index of LOGFILE, which has status ST
+ *
+ * @returns: the index, or NULL if it does not exist or is out of date
+ */
+logindex_t *logindex_read(const char *logfile, struct stat *st);
+
+/* Write IDX to disk; a failure is only logged, as the index can be rebuilt.
+ *
+ * @returns: FALSE on error
+ */
+gboolean logindex_write(logindex_t *idx);
+
+/* Is IDX still the index of LOGFILE, which has status ST? */
+gboolean logindex_is_current(logindex_t *idx, const char *logfile,
+			     struct stat *st);
+
+/* Add a copy of STR to the strings of IDX */
+char *logindex_strdup(logindex_t *idx, const char *str);
+
+/* Note that the logfile mentions VALUE for KEY.  An empty VALUE means the
+ * value is not known, and makes every value match. */
+void logindex_add_key(logindex_t *idx, logindex_key_t key, const char *value);
+
+/* Does the logfile mention VALUE for KEY? */
+gboolean logindex_has_key(logindex_t *idx, logindex_key_t key,
+			  const char *value);
+
+/* Add a taper result line */
+void logindex_add_line(logindex_t *idx, logtype_t type, program_t prog,
+		       const char *str);
+
+void logindex_free(logindex_t *idx);
+
+/* Remove the index of LOGFILE, if any */
+void logindex_remove(const char *logfile);
+
+#endif /* LOGINDEX_H */
@@ -48,6 +48,7 @@
 #include "timestamp.h"
 #include "amxml.h"
 #include "cmdfile.h"
+#include "fsusage.h"
 
 #define planner_debug(i,x) do {		\
 	if ((i) <= debug_planner) {	\
@@ -74,6 +75,8 @@ time_t	conf_etimeout;
 int	conf_reserve;
 int	conf_usetimestamps;
 
+/* am_host_t.status; am_host_t.inprogress is the number of estimate
+ * requests in flight to the host */
 #define HOST_READY				(0)	/* must be 0 */
 #define HOST_ACTIVE				(1)
 #define HOST_DONE				(2)
@@ -107,6 +110,7 @@ typedef struct est_s {
     int level_days;
     int promote;
     int post_dle;
+    int req_id;		/* the estimate request it was sent in, or 0 */
     double fullrate, incrrate;
     double fullcomp, incrcomp;
     char *errstr;
@@ -119,6 +123,13 @@ typedef struct estlist_s {
 } estlist_t;
 #define get_est(elist) ((est_t *)((elist)->data))
 
+/* An estimate request in flight; a host may have up to estimate-requests */
+typedef struct est_req_s {
+    am_host_t *host;
+    int id;
+} est_req_t;
+static int last_req_id = 0;
+
 /* pestq = partial estimate */
 estlist_t startq;	// REQ not yet send.
 estlist_t waitq;	// REQ send, waiting for PREP or REP.
@@ -184,6 +195,7 @@ static void handle_failed(est_t *est);
 static void delay_dumps(void);
 static int promote_highest_priority_incremental(void);
 static int promote_hills(void);
+static int balance_binpack(void);
 static void output_scheduleline(est_t *est);
 static void server_estimate(est_t *est, int i, info_t *info, int level,
 			    tapetype_t *tapetype);
@@ -661,12 +673,17 @@ main(
     section_start = curclock();
 
     startq.head = startq.tail = NULL;
+    begin_info_batch();
     while(!empty(origq)) {
 	disk_t *dp = dequeue_disk(&origq);
 	if(dp->todo == 1) {
 	    setup_estimate(dp);
 	}
     }
+    if (commit_info_batch()) {
+	error(_("could not update info db: %s"), strerror(errno));
+	/*NOTREACHED*/
+    }
 
     g_fprintf(stderr, _("%s: time %s: setting up estimates took %s secs\n"),
 		    get_pname(),
@@ -678,7 +695,17 @@ main(
      * 5. Get Dump Size Estimates from Remote Client Hosts
      *
      * Each host is queried (in parallel) for dump size information on all
-     * of its disks, and the results gathered as they come in.
+     * of its disks, and the results gathered as they come in.  The disks
+     * of a host are split between up to estimate-requests requests.
+     *
+     * 6. Analyze Dump Estimates
+     *
+     * Each disk's estimates are looked at to determine what level it
+     * should dump at, and to calculate the expected size and time taking
+     * historical dump rates and compression ratios into account.  The
+     * total expected size is accumulated as well.  A disk is analyzed as
+     * soon as all its estimates are in, while the other hosts are still
+     * estimating.
      */
 
     /* go out and get the dump estimates */
@@ -691,6 +718,13 @@ main(
     waitq.head = waitq.tail = NULL;
     failq.head = failq.tail = NULL;
 
+			/* an empty tape still has a label and an endmark */
+    total_size = ((gint64)tt_blocksize_kb + (gint64)tape_mark) * (gint64)2;
+    total_lev0 = 0.0;
+    balanced_size = 0.0;
+
+    schedq.head = schedq.tail = NULL;
+
     get_estimates();
 
     g_fprintf(stderr, _("%s: time %s: getting estimates took %s secs\n"),
@@ -699,37 +733,21 @@ main(
 		    walltime_str(timessub(curclock(), section_start)));
 
     /*
-     * At this point, all disks with estimates are in estq, and
-     * all the disks on hosts that didn't respond to our inquiry
+     * At this point, all disks with estimates are analyzed and in schedq,
+     * and all the disks on hosts that didn't respond to our inquiry
      * are in failq.
      */
 
     est_dump_queue("FAILED", failq, 15, stderr);
-    est_dump_queue("DONE", estq, 15, stderr);
+    est_dump_queue("DONE", schedq, 15, stderr);
 
     if (!empty(failq)) {
         exit_status = EXIT_FAILURE;
     }
 
-    /*
-     * 6. Analyze Dump Estimates
-     *
-     * Each disk's estimates are looked at to determine what level it
-     * should dump at, and to calculate the expected size and time taking
-     * historical dump rates and compression ratios into account.  The
-     * total expected size is accumulated as well.
-     */
-
     g_fprintf(stderr,_("\nANALYZING ESTIMATES...\n"));
     section_start = curclock();
 
-			/* an empty tape still has a label and an endmark */
-    total_size = ((gint64)tt_blocksize_kb + (gint64)tape_mark) * (gint64)2;
-    total_lev0 = 0.0;
-    balanced_size = 0.0;
-
-    schedq.head = schedq.tail = NULL;
-    while(!empty(estq)) analyze_estimate(dequeue_est(&estq));
     while(!empty(failq)) handle_failed(dequeue_est(&failq));
 
     run_server_global_scripts(EXECUTE_ON_POST_ESTIMATE, get_config_name(),
@@ -803,18 +821,25 @@ main(
      * Amanda never delays full dumps just for the sake of balancing the
      * schedule, so it can take a full cycle to balance the schedule after
      * a big bump.
+     *
+     * With balance-algorithm "binpack", the full dumps of the whole cycle
+     * are placed at once instead; see balance_binpack.
      */
 
     g_fprintf(stderr,
      _("\nPROMOTING DUMPS IF NEEDED, total_lev0 %1.0lf, balanced_size %1.0lf...\n"),
 	    total_lev0, balanced_size);
 
-    balance_threshold = balanced_size * PROMOTE_THRESHOLD;
-    moved_one = 1;
-    while((balanced_size - total_lev0) > balance_threshold && moved_one)
-	moved_one = promote_highest_priority_incremental();
+    if (g_str_equal(getconf_str(CNF_BALANCE_ALGORITHM), "binpack")) {
+	moved_one = balance_binpack();
+    } else {
+	balance_threshold = balanced_size * PROMOTE_THRESHOLD;
+	moved_one = 1;
+	while((balanced_size - total_lev0) > balance_threshold && moved_one)
+	    moved_one = promote_highest_priority_incremental();
 
-    moved_one = promote_hills();
+	moved_one = promote_hills();
+    }
 
     g_fprintf(stderr, _("%s: time %s: analysis took %s secs\n"),
 		    get_pname(),
@@ -979,6 +1004,7 @@ setup_estimate(
     ep->errstr = 0;
     ep->promote = 0;
     ep->post_dle = 0;
+    ep->req_id = 0;
     ep->degr_mesg = NULL;
     ep->dump_est = &default_one_est;
     ep->degr_est = &default_one_est;
@@ -1557,6 +1583,8 @@ static gint64 bump_thresh(
  */
 
 static void getsize(am_host_t *hostp);
+static gboolean send_estimate_request(am_host_t *hostp, int max_dles);
+static void analyze_estimates(void);
 static disk_t *lookup_hostdisk(am_host_t *hp, char *str);
 static void handle_result(void *datap, pkt_t *pkt, security_handle_t *sech);
 
@@ -1639,6 +1667,7 @@ static void get_estimates(void)
 	}
 	amfree(qname);
     }
+    analyze_estimates();
 }
 
 /*
@@ -1803,10 +1832,55 @@ out:
 
 
 
+/*
+ * Send the requests for the estimates of HOSTP not yet requested, split
+ * evenly between the free slots of its estimate-requests window.
+ */
 static void getsize(am_host_t *hostp)
+{
+    int window = getconf_int(CNF_ESTIMATE_REQUESTS);
+    int nb_ready;
+    disk_t *dp;
+
+    g_assert(hostp->disks != NULL);
+
+    if (hostp->status != HOST_READY)
+	return;
+
+    if (!hostp->features) {
+	send_estimate_request(hostp, 0);
+    } else {
+	while (hostp->inprogress < window) {
+	    int nb_slots = window - hostp->inprogress;
+
+	    nb_ready = 0;
+	    for (dp = hostp->disks; dp != NULL; dp = dp->hostnext) {
+		if (dp->todo && find_est_for_dp(dp)->state == DISK_READY)
+		    nb_ready++;
+	    }
+	    if (nb_ready == 0)
+		break;
+	    if (!send_estimate_request(hostp,
+				       (nb_ready + nb_slots - 1) / nb_slots))
+		break;
+	}
+    }
+
+    if (hostp->status != HOST_DONE)
+	hostp->status = hostp->inprogress ? HOST_ACTIVE : HOST_DONE;
+}
+
+/*
+ * Send one request for at most MAX_DLES of the estimates of HOSTP not yet
+ * requested, or the "noop" request if the host features are not known.
+ *
+ * @returns: TRUE if a request was sent
+ */
+static gboolean send_estimate_request(am_host_t *hostp, int max_dles)
 {
     disk_t *	dp;
     est_t *	ep;
+    est_req_t *	est_req;
     int		i;
     time_t	timeout;
     const	security_driver_t *secdrv;
@@ -1819,13 +1893,12 @@ static void getsize(am_host_t *hostp)
     GString *reqbuf;
     char *req;
     int total_estimates = 0;
-
-    g_assert(hostp->disks != NULL);
-
-    if (hostp->status != HOST_READY)
-	return;
+    int nb_dles = 0;
 
     reqbuf = g_string_new(NULL);
+    est_req = g_new0(est_req_t, 1);
+    est_req->host = hostp;
+    est_req->id = ++last_req_id;
 
     /*
      * The first time through here we send a "noop" request.  This will
@@ -1885,6 +1958,8 @@ static void getsize(am_host_t *hostp)
          */
         int estimates_for_client = 0;
 
+        if (nb_dles == max_dles) break;
+
         if(dp->todo == 0) continue;
 
 	ep = find_est_for_dp(dp);
@@ -2024,6 +2099,8 @@ static void getsize(am_host_t *hostp)
         if (estimates_for_client) {
             tmp = g_strjoinv("\n", strings);
             total_estimates += estimates_for_client;
+            nb_dles++;
+            ep->req_id = est_req->id;
             g_string_append(reqbuf, tmp);
             g_free(tmp);
             if (ep->state == DISK_DONE) {
@@ -2049,8 +2126,10 @@ static void getsize(am_host_t *hostp)
 
     if(total_estimates == 0) {
         g_string_free(reqbuf, TRUE);
-        hostp->status = HOST_DONE;
-        return;
+        g_free(est_req);
+        if (!hostp->inprogress)
+            hostp->status = HOST_DONE;
+        return FALSE;
     }
 
     if (conf_etimeout < 0) {
@@ -2064,8 +2143,11 @@ send:
     for (dp = hostp->disks; dp != NULL; dp = dp->hostnext) {
 	if (dp->todo && dp->auth) break;
     }
-    if (!dp)
-	return;
+    if (!dp) {
+	g_string_free(reqbuf, TRUE);
+	g_free(est_req);
+	return FALSE;
+    }
 
     req = g_string_free(reqbuf, FALSE);
     dbprintf("send request to %s:%s:(%s):\n----\n%s\n----\n\n", hostp->hostname, hostp->disks->name, dp->name, req);
@@ -2076,9 +2158,11 @@ send:
 		_("Could not find security driver '%s' for host '%s'"),
 		hostp->disks->auth, hostp->hostname);
 	g_free(req);
-	return;
+	g_free(est_req);
+	return FALSE;
     }
     hostp->status = HOST_ACTIVE;
+    hostp->inprogress++;
 
     while ((ep = dequeue_est(&activeq))) {
 	ep->errstr = NULL;
@@ -2086,9 +2170,10 @@ send:
     }
 
     protocol_sendreq(hostp->hostname, secdrv, amhost_get_security_conf,
-	req, timeout, handle_result, hostp);
+	req, timeout, handle_result, est_req);
 
     g_free(req);
+    return TRUE;
 }
 
 static disk_t *lookup_hostdisk(
@@ -2113,7 +2198,9 @@ static void handle_result(
     gint64 size;
     est_t  *ep;
     disk_t *dp;
+    est_req_t *est_req;
     am_host_t *hostp;
+    gboolean last_reply;
     char *msg, msg_undo;
     char *remoterr, *errbuf = NULL;
     char *s;
@@ -2126,9 +2213,15 @@ static void handle_result(
     char *disk = NULL;
     long long size_;
 
-    hostp = (am_host_t *)datap;
+    est_req = (est_req_t *)datap;
+    hostp = est_req->host;
     hostp->status = HOST_READY;
 
+    /* a P_PREP is followed by more replies to the same request */
+    last_reply = (pkt == NULL || pkt->type != P_PREP);
+    if (last_reply)
+	hostp->inprogress--;
+
     if (pkt == NULL) {
 	if (g_str_equal(security_geterror(sech), "timeout waiting for REP")) {
 	    errbuf = g_strdup_printf("Some estimate timeout on %s", hostp->hostname);
@@ -2310,6 +2403,7 @@ next_line:
 	ep = find_est_for_dp(dp);
 	if(ep->state != DISK_ACTIVE &&
 	   ep->state != DISK_PARTIALY_DONE) continue;
+	if (ep->req_id != est_req->id) continue;
 
 	if(ep->state == DISK_ACTIVE) {
 	    remove_est(&waitq, ep);
@@ -2402,7 +2496,8 @@ next_line:
 	amfree(qname);
     }
 
-    if(hostp->status == HOST_DONE) {
+    /* the other requests to the host may still use the connection */
+    if(hostp->status == HOST_DONE && hostp->inprogress == 0) {
 	if (pkt->type == P_REP) {
 	    security_close_connection(sech, hostp->hostname);
 
@@ -2418,6 +2513,9 @@ next_line:
     while(waitpid(-1, NULL, WNOHANG)> 0);
     if (errbuf)
 	goto error_return;
+    analyze_estimates();
+    if (last_reply)
+	g_free(est_req);
     return;
 
  NAK_parse_failed:
@@ -2440,6 +2538,7 @@ next_line:
     for(dp = hostp->disks; dp != NULL; dp = dp->hostnext) {
 	if (dp->todo) {
 	    ep = find_est_for_dp(dp);
+	    if (ep->req_id != est_req->id) continue;
 	    if (ep->state == DISK_ACTIVE ||
 		ep->state == DISK_PARTIALY_DONE) {
 		char *tt;
@@ -2475,6 +2574,8 @@ next_line:
 	for (dp = hostp->disks; dp != NULL; dp = dp->hostnext) {
 	    if (dp->todo) {
 		ep = find_est_for_dp(dp);
+		/* leave the other requests to the host alone */
+		if (ep->req_id != 0 && ep->req_id != est_req->id) continue;
 		qname = quote_string(dp->name);
 		if(ep->state == DISK_ACTIVE) {
 		    remove_est(&waitq, ep);
@@ -2499,6 +2600,9 @@ next_line:
     /* try to clean up any defunct processes, since Amanda doesn't wait() for
        them explicitly */
     while(waitpid(-1, NULL, WNOHANG)> 0);
+    analyze_estimates();
+    if (last_reply)
+	g_free(est_req);
 }
 
 
@@ -2513,6 +2617,15 @@ next_line:
 static int schedule_order(est_t *a, est_t *b);	  /* subroutines */
 static one_est_t *pick_inclevel(est_t *ep);
 
+/*
+ * Analyze the disks whose estimates are all in; called as the replies
+ * arrive so the analysis overlaps the estimates of the slower hosts.
+ */
+static void analyze_estimates(void)
+{
+    while(!empty(estq)) analyze_estimate(dequeue_est(&estq));
+}
+
 static void analyze_estimate(
     est_t *ep)
 {
@@ -3461,6 +3574,324 @@ static int promote_hills(void)
     return 0;
 }
 
+/*
+ * ========================================================================
+ * BIN-PACKING BALANCE
+ *
+ * With balance-algorithm "binpack", the full dumps of the next
+ * runspercycle runs are placed in one bin per run, instead of promoting
+ * dumps one at a time.  A full dump goes in a run no later than the one it
+ * is due in: tonight's if it can be promoted, or a later one.  A full dump
+ * already scheduled for tonight stays there.
+ *
+ * The dumps are placed largest first, each in the least loaded run it can go
+ * in.  Among the runs within PROMOTE_THRESHOLD of the least loaded, the
+ * latest one is preferred, so a dump is only promoted if that improves the
+ * balance.  A run is skipped if:
+ *
+ *  - the full dump doesn't fit in the tape space left for the run;
+ *  - the run would keep the client busy longer than its share of the
+ *    cycle, at the rate of its past full dumps;
+ *  - the run already has a full dump larger than the holding disks, which
+ *    must be written directly to tape.
+ *
+ * If every run is skipped, the last two checks are dropped, then the first
+ * one for the later runs.  The dumps placed in tonight's run are promoted.
+ * The later runs are only a forecast: the placement is redone each night.
+ */
+
+typedef struct bp_item_s {
+    est_t  *ep;
+    gint64  size;		/* level 0 size on tape */
+    double  time;		/* at the full dump rate */
+    int     host;		/* index of the host */
+    int     first_run;		/* runs it can be placed in */
+    int     last_run;
+    gboolean oversize;		/* larger than the holding disks */
+} bp_item_t;
+
+/* the space of the holding disks, as the driver will find it */
+static gint64
+holding_disks_size(void)
+{
+    identlist_t il;
+    gint64 total = 0;
+
+    for (il = getconf_identlist(CNF_HOLDINGDISK); il != NULL; il = il->next) {
+	holdingdisk_t *hdp = lookup_holdingdisk(il->data);
+	struct fs_usage fsusage;
+	gint64 disksize, kb_avail;
+
+	if (!hdp)
+	    continue;
+	if (get_fs_usage(holdingdisk_get_diskdir(hdp), NULL, &fsusage) == -1)
+	    continue;
+	if (fsusage.fsu_bavail_top_bit_set)
+	    kb_avail = 0;
+	else
+	    kb_avail = fsusage.fsu_bavail / 1024 * fsusage.fsu_blocksize;
+
+	disksize = holdingdisk_get_disksize(hdp);
+	if (disksize > 0)
+	    total += min(disksize, kb_avail);
+	else if (kb_avail > -disksize)
+	    total += kb_avail + disksize;
+    }
+    return total;
+}
+
+static int
+bp_item_order(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const bp_item_t *ia = a, *ib = b;
+
+    /* largest first, then the most urgent */
+    if (ia->size != ib->size)
+	return ia->size < ib->size ? 1 : -1;
+    return ia->last_run - ib->last_run;
+}
+
+typedef struct binpack_s {
+    int      nruns;
+    int      nhosts;
+    gint64  *load;		/* size of the full dumps of each run */
+    int     *nfull;		/* number of full dumps of each run */
+    int     *noversize;		/* those larger than the holding disks */
+    double  *host_load;		/* [run * nhosts + host] */
+    double  *host_budget;	/* share of the cycle of each host */
+    gint64   room;		/* left on tonight's tapes */
+    gint64   run_cap;		/* for the full dumps of a later run */
+} binpack_t;
+
+/* Can ITEM go in RUN?  The checks are relaxed as PASS increases. */
+static gboolean
+bp_run_ok(
+    binpack_t *bp,
+    bp_item_t *item,
+    int        run,
+    int        pass)
+{
+    double hl = bp->host_load[run * bp->nhosts + item->host];
+
+    if (run == 0) {
+	/* it replaces tonight's incremental */
+	if (item->size - item->ep->dump_est->csize > bp->room)
+	    return FALSE;
+    } else if (pass < 2 && bp->load[run] + item->size > bp->run_cap) {
+	return FALSE;
+    }
+    if (pass < 1 && hl > 0 && hl + item->time > bp->host_budget[item->host])
+	return FALSE;
+    if (pass < 1 && item->oversize && bp->noversize[run] > 0)
+	return FALSE;
+    return TRUE;
+}
+
+static void
+bp_place(
+    binpack_t *bp,
+    bp_item_t *item,
+    int        run)
+{
+    bp->load[run] += item->size;
+    bp->nfull[run]++;
+    bp->noversize[run] += item->oversize;
+    bp->host_load[run * bp->nhosts + item->host] += item->time;
+}
+
+static int
+balance_binpack(void)
+{
+    GList     *elist;
+    GArray    *items;
+    GHashTable *hosts;
+    bp_item_t *item;
+    binpack_t  bp;
+    gint64     holding_size = holding_disks_size();
+    gint64     total = 0;
+    double     days_per_run, slack;
+    int        run, i;
+    int        promoted = 0;
+    char      *qname;
+
+    bp.nruns = runs_per_cycle;
+    if (bp.nruns > 10000) bp.nruns = 10000;
+    if (bp.nruns <= 1)
+	return 0;
+    bp.nhosts = 0;
+    days_per_run = (double)conf_dumpcycle / runs_per_cycle;
+
+    items = g_array_new(FALSE, FALSE, sizeof(bp_item_t));
+    hosts = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (elist = schedq.head; elist != NULL; elist = elist->next) {
+	est_t  *ep = get_est(elist);
+	disk_t *dp = ep->disk;
+	bp_item_t it;
+	double rate;
+	gpointer hostidx;
+
+	if (dp->skip_full || dp->strategy == DS_NOFULL ||
+	    dp->strategy == DS_INCRONLY)
+	    continue;
+
+	it.ep = ep;
+	if (ep->dump_est->level == 0) {
+	    it.size = ep->dump_est->csize;
+	    it.first_run = it.last_run = 0;
+	} else {
+	    one_est_t *level0_est = est_for_level(ep, 0);
+	    int due_run = 0;
+
+	    if (level0_est->nsize > 0)
+		it.size = est_tape_size(ep, 0);
+	    else
+		it.size = ep->last_lev0size;
+
+	    if (ep->next_level0 > 0)
+		due_run = (int)(ep->next_level0 / days_per_run);
+	    if (due_run > bp.nruns - 1)
+		due_run = bp.nruns - 1;
+
+	    /* can it be promoted tonight? */
+	    if (level0_est->nsize > 0 && ep->next_level0 > 0 &&
+		ep->next_level0 <= dp->maxpromoteday)
+		it.first_run = 0;
+	    else
+		it.first_run = 1;
+	    it.last_run = max(due_run, it.first_run);
+	}
+	if (it.size <= 0)
+	    continue;
+
+	rate = ep->fullrate < 1.0 ? DEFAULT_DUMPRATE : ep->fullrate;
+	it.time = (double)it.size / rate;
+	it.oversize = holding_size > 0 && it.size > holding_size;
+
+	if (!g_hash_table_lookup_extended(hosts, dp->host->hostname, NULL,
+					  &hostidx)) {
+	    hostidx = GINT_TO_POINTER(bp.nhosts++);
+	    g_hash_table_insert(hosts, dp->host->hostname, hostidx);
+	}
+	it.host = GPOINTER_TO_INT(hostidx);
+
+	total += it.size;
+	g_array_append_val(items, it);
+    }
+    g_hash_table_destroy(hosts);
+
+    if (items->len == 0) {
+	g_array_free(items, TRUE);
+	return 0;
+    }
+
+    bp.load = g_new0(gint64, bp.nruns);
+    bp.nfull = g_new0(int, bp.nruns);
+    bp.noversize = g_new0(int, bp.nruns);
+    bp.host_load = g_new0(double, (gsize)bp.nruns * bp.nhosts);
+    bp.host_budget = g_new0(double, bp.nhosts);
+    bp.room = tape_length - total_size;
+    bp.run_cap = tape_length - (total_size - (gint64)total_lev0);
+    slack = (double)total / bp.nruns * PROMOTE_THRESHOLD;
+
+    for (i = 0; i < (int)items->len; i++) {
+	item = &g_array_index(items, bp_item_t, i);
+	bp.host_budget[item->host] += item->time;
+    }
+    for (i = 0; i < bp.nhosts; i++)
+	bp.host_budget[i] = bp.host_budget[i] / bp.nruns *
+			    (1.0 + PROMOTE_THRESHOLD);
+
+    g_fprintf(stderr,
+	      _("  binpack: %u full dumps, %lld KB over %d runs, holding disks %lld KB, room tonight %lld KB\n"),
+	      items->len, (long long)total, bp.nruns,
+	      (long long)holding_size, (long long)bp.room);
+
+    g_array_sort(items, bp_item_order);
+
+    /* tonight's full dumps can't move */
+    for (i = 0; i < (int)items->len; i++) {
+	item = &g_array_index(items, bp_item_t, i);
+	if (item->ep->dump_est->level == 0)
+	    bp_place(&bp, item, 0);
+    }
+
+    for (i = 0; i < (int)items->len; i++) {
+	int pass, best = -1;
+
+	item = &g_array_index(items, bp_item_t, i);
+	if (item->ep->dump_est->level == 0)
+	    continue;
+
+	for (pass = 0; pass < 3 && best == -1; pass++) {
+	    gint64 min_load = G_MAXINT64;
+
+	    for (run = item->first_run; run <= item->last_run; run++) {
+		if (bp_run_ok(&bp, item, run, pass) && bp.load[run] < min_load)
+		    min_load = bp.load[run];
+	    }
+	    if (min_load == G_MAXINT64)
+		continue;
+
+	    /* the latest run close enough to the least loaded one */
+	    for (run = item->last_run; run >= item->first_run; run--) {
+		if (bp_run_ok(&bp, item, run, pass) &&
+		    (double)bp.load[run] <= (double)min_load + slack) {
+		    best = run;
+		    break;
+		}
+	    }
+	}
+	if (best == -1) {
+	    /* it could only go tonight, and there's no room left */
+	    best = 1;
+	}
+	bp_place(&bp, item, best);
+
+	if (best == 0) {
+	    est_t  *ep = item->ep;
+	    disk_t *dp = ep->disk;
+	    one_est_t *level0_est = est_for_level(ep, 0);
+	    int check_days = ep->next_level0;
+
+	    bp.room -= level0_est->csize - ep->dump_est->csize;
+	    total_size += level0_est->csize - ep->dump_est->csize;
+	    total_lev0 += (double)level0_est->csize;
+	    ep->degr_est = ep->dump_est;
+	    ep->dump_est = level0_est;
+	    ep->next_level0 = 0;
+	    promoted++;
+
+	    qname = quote_string(dp->name);
+	    g_fprintf(stderr,
+		  _("   promote: moving %s:%s up, total_lev0 %1.0lf, total_size %lld\n"),
+		    dp->host->hostname, qname,
+		    total_lev0, (long long)total_size);
+	    log_add(L_INFO,
+		    plural(_("Full dump of %s:%s promoted from %d day ahead."),
+			   _("Full dump of %s:%s promoted from %d days ahead."),
+			   check_days),
+		    dp->host->hostname, qname, check_days);
+	    amfree(qname);
+	}
+    }
+
+    for (run = 0; run < bp.nruns && run < 100; run++) {
+	g_fprintf(stderr, _("  binpack: run %d: %d full dumps, %lld KB\n"),
+		  run, bp.nfull[run], (long long)bp.load[run]);
+    }
+
+    amfree(bp.load);
+    amfree(bp.nfull);
+    amfree(bp.noversize);
+    amfree(bp.host_load);
+    amfree(bp.host_budget);
+    g_array_free(items, TRUE);
+    return promoted;
+}
+
 /*
  * ========================================================================
  * OUTPUT SCHEDULE
@@ -0,0 +1,804 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+#include "amanda.h"
+#include "runqindex.h"
+
+/* the dumporder characters, in the order of the heaps; the last heap is by
+ * size only, to skip the hosts and spindles whose dumps are all too big */
+static const char runq_orders[] = "sStTbB";
+#define RUNQ_NORDERS	7
+#define RUNQ_SIZE	6
+
+typedef enum {
+    RUNQ_ROOT,
+    RUNQ_HOST,
+    RUNQ_SPINDLE,
+    RUNQ_SCHED
+} runq_kind_t;
+
+typedef struct runq_node_s runq_node_t;
+
+/*
+ * A node is the root, a host, a spindle of a host or a dump.  Each node but
+ * the dumps has a heap of its children for each order; BEST is the best
+ * dump below the node (the node itself for a dump), by which it is placed in
+ * its parent's heap, at POS (-1 while it is not there).
+ */
+struct runq_node_s {
+    runq_kind_t  kind;
+    runq_node_t *parent;
+    runq_node_t *best[RUNQ_NORDERS];
+    int          pos[RUNQ_NORDERS];
+    GPtrArray   *heap[RUNQ_NORDERS];
+    guint        count;		/* dumps below */
+
+    am_host_t   *host;		/* hosts and spindles */
+    int          spindle;	/* spindles */
+    GHashTable  *spindles;	/* hosts: spindle -> node */
+
+    /* dumps */
+    sched_t     *sp;
+    int          priority;
+    gint64       key[RUNQ_NORDERS];	/* smallest first */
+    gint64       seq;		/* position in the queue */
+};
+
+struct runq_index_s {
+    runq_node_t *root;
+    GHashTable  *hosts;		/* am_host_t * -> node */
+    GHashTable  *scheds;	/* sched_t * -> node */
+    gint64       head_seq;
+    gint64       tail_seq;
+    GPtrArray   *frontier;	/* of runq_index_pick */
+};
+
+static runq_node_t *
+new_node(
+    runq_kind_t  kind,
+    runq_node_t *parent)
+{
+    runq_node_t *node = g_new0(runq_node_t, 1);
+    int o;
+
+    node->kind = kind;
+    node->parent = parent;
+    for (o = 0; o < RUNQ_NORDERS; o++) {
+	node->pos[o] = -1;
+	if (kind != RUNQ_SCHED)
+	    node->heap[o] = g_ptr_array_new();
+    }
+    return node;
+}
+
+static void
+free_node(
+    runq_node_t *node)
+{
+    int o;
+
+    for (o = 0; o < RUNQ_NORDERS; o++) {
+	if (node->heap[o])
+	    g_ptr_array_free(node->heap[o], TRUE);
+    }
+    if (node->spindles)
+	g_hash_table_destroy(node->spindles);
+    g_free(node);
+}
+
+/* Is dump A before dump B in order O? */
+static gboolean
+sched_before(
+    runq_node_t *a,
+    runq_node_t *b,
+    int          o)
+{
+    if (o != RUNQ_SIZE && a->priority != b->priority)
+	return a->priority > b->priority;
+    if (a->key[o] != b->key[o])
+	return a->key[o] < b->key[o];
+    return a->seq < b->seq;
+}
+
+static gboolean
+node_before(
+    runq_node_t *a,
+    runq_node_t *b,
+    int          o)
+{
+    return sched_before(a->best[o], b->best[o], o);
+}
+
+/*
+ * Heaps of nodes, keeping the pos of each node
+ */
+
+static void
+heap_set(
+    GPtrArray   *heap,
+    int          o,
+    guint        i,
+    runq_node_t *node)
+{
+    g_ptr_array_index(heap, i) = node;
+    node->pos[o] = i;
+}
+
+static void
+heap_sift_up(
+    GPtrArray *heap,
+    int        o,
+    guint      i)
+{
+    runq_node_t *node = g_ptr_array_index(heap, i);
+
+    while (i > 0) {
+	guint parent = (i - 1) / 2;
+	runq_node_t *p = g_ptr_array_index(heap, parent);
+
+	if (!node_before(node, p, o))
+	    break;
+	heap_set(heap, o, i, p);
+	i = parent;
+    }
+    heap_set(heap, o, i, node);
+}
+
+static void
+heap_sift_down(
+    GPtrArray *heap,
+    int        o,
+    guint      i)
+{
+    runq_node_t *node = g_ptr_array_index(heap, i);
+
+    for (;;) {
+	guint child = 2 * i + 1;
+	runq_node_t *c;
+
+	if (child >= heap->len)
+	    break;
+	if (child + 1 < heap->len &&
+	    node_before(g_ptr_array_index(heap, child + 1),
+			g_ptr_array_index(heap, child), o))
+	    child++;
+	c = g_ptr_array_index(heap, child);
+	if (!node_before(c, node, o))
+	    break;
+	heap_set(heap, o, i, c);
+	i = child;
+    }
+    heap_set(heap, o, i, node);
+}
+
+static void
+heap_insert(
+    GPtrArray   *heap,
+    int          o,
+    runq_node_t *node)
+{
+    g_ptr_array_add(heap, node);
+    node->pos[o] = heap->len - 1;
+    heap_sift_up(heap, o, heap->len - 1);
+}
+
+static void
+heap_remove(
+    GPtrArray   *heap,
+    int          o,
+    runq_node_t *node)
+{
+    guint i = node->pos[o];
+    runq_node_t *last = g_ptr_array_index(heap, heap->len - 1);
+
+    g_ptr_array_set_size(heap, heap->len - 1);
+    node->pos[o] = -1;
+    if (last != node) {
+	heap_set(heap, o, i, last);
+	heap_sift_up(heap, o, i);
+	heap_sift_down(heap, o, last->pos[o]);
+    }
+}
+
+/* The heap of NODE changed in order O: update its best dump, and its place
+ * in its parent's heap, up to the root. */
+static void
+refresh(
+    runq_node_t *node,
+    int          o)
+{
+    for (; node != NULL; node = node->parent) {
+	GPtrArray *heap = node->heap[o];
+	runq_node_t *best = heap->len ?
+		((runq_node_t *)g_ptr_array_index(heap, 0))->best[o] : NULL;
+
+	if (best == node->best[o] && (best == NULL || node->pos[o] >= 0 ||
+				      node->parent == NULL))
+	    break;
+	node->best[o] = best;
+	if (node->parent == NULL)
+	    break;
+
+	if (best == NULL) {
+	    if (node->pos[o] >= 0)
+		heap_remove(node->parent->heap[o], o, node);
+	} else if (node->pos[o] < 0) {
+	    heap_insert(node->parent->heap[o], o, node);
+	} else {
+	    heap_sift_up(node->parent->heap[o], o, node->pos[o]);
+	    heap_sift_down(node->parent->heap[o], o, node->pos[o]);
+	}
+    }
+}
+
+/*
+ * Public functions
+ */
+
+runq_index_t *
+runq_index_new(void)
+{
+    runq_index_t *idx = g_new0(runq_index_t, 1);
+
+    idx->root = new_node(RUNQ_ROOT, NULL);
+    idx->hosts = g_hash_table_new(g_direct_hash, g_direct_equal);
+    idx->scheds = g_hash_table_new(g_direct_hash, g_direct_equal);
+    idx->head_seq = 0;
+    idx->tail_seq = 1;
+    idx->frontier = g_ptr_array_new();
+    return idx;
+}
+
+static void
+free_host_node(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer data G_GNUC_UNUSED)
+{
+    runq_node_t *host = value;
+    GHashTableIter iter;
+    gpointer spindle;
+
+    g_hash_table_iter_init(&iter, host->spindles);
+    while (g_hash_table_iter_next(&iter, NULL, &spindle))
+	free_node(spindle);
+    free_node(host);
+}
+
+static void
+free_sched_node(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer data G_GNUC_UNUSED)
+{
+    free_node(value);
+}
+
+void
+runq_index_free(
+    runq_index_t *idx)
+{
+    g_hash_table_foreach(idx->scheds, free_sched_node, NULL);
+    g_hash_table_foreach(idx->hosts, free_host_node, NULL);
+    g_hash_table_destroy(idx->scheds);
+    g_hash_table_destroy(idx->hosts);
+    free_node(idx->root);
+    g_ptr_array_free(idx->frontier, TRUE);
+    g_free(idx);
+}
+
+void
+runq_index_add(
+    runq_index_t *idx,
+    sched_t      *sp,
+    gboolean      at_head)
+{
+    am_host_t *hostp = sp->disk->host;
+    runq_node_t *host, *spindle, *node;
+    int o;
+
+    if (g_hash_table_lookup(idx->scheds, sp))
+	return;
+
+    host = g_hash_table_lookup(idx->hosts, hostp);
+    if (!host) {
+	host = new_node(RUNQ_HOST, idx->root);
+	host->host = hostp;
+	host->spindles = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(idx->hosts, hostp, host);
+    }
+    spindle = g_hash_table_lookup(host->spindles,
+				  GINT_TO_POINTER(sp->disk->spindle));
+    if (!spindle) {
+	spindle = new_node(RUNQ_SPINDLE, host);
+	spindle->host = hostp;
+	spindle->spindle = sp->disk->spindle;
+	g_hash_table_insert(host->spindles,
+			    GINT_TO_POINTER(sp->disk->spindle), spindle);
+    }
+
+    node = new_node(RUNQ_SCHED, spindle);
+    node->sp = sp;
+    node->priority = sp->disk->priority;
+    node->key[0] = sp->est_size;
+    node->key[1] = -(gint64)sp->est_size;
+    node->key[2] = sp->est_time;
+    node->key[3] = -(gint64)sp->est_time;
+    node->key[4] = sp->est_kps;
+    node->key[5] = -(gint64)sp->est_kps;
+    node->key[RUNQ_SIZE] = sp->est_size;
+    node->seq = at_head ? idx->head_seq-- : idx->tail_seq++;
+    g_hash_table_insert(idx->scheds, sp, node);
+
+    for (o = 0; o < RUNQ_NORDERS; o++) {
+	node->best[o] = node;
+	heap_insert(spindle->heap[o], o, node);
+	refresh(spindle, o);
+    }
+    spindle->count++;
+    host->count++;
+    idx->root->count++;
+}
+
+void
+runq_index_remove(
+    runq_index_t *idx,
+    sched_t      *sp)
+{
+    runq_node_t *node = g_hash_table_lookup(idx->scheds, sp);
+    runq_node_t *spindle, *host;
+    int o;
+
+    if (!node)
+	return;
+    spindle = node->parent;
+    host = spindle->parent;
+
+    for (o = 0; o < RUNQ_NORDERS; o++) {
+	heap_remove(spindle->heap[o], o, node);
+	refresh(spindle, o);
+    }
+    g_hash_table_remove(idx->scheds, sp);
+    free_node(node);
+
+    idx->root->count--;
+    if (--spindle->count == 0) {
+	g_hash_table_remove(host->spindles,
+			    GINT_TO_POINTER(spindle->spindle));
+	free_node(spindle);
+    }
+    if (--host->count == 0) {
+	g_hash_table_remove(idx->hosts, host->host);
+	free_node(host);
+    }
+}
+
+guint
+runq_index_size(
+    runq_index_t *idx)
+{
+    return idx->root->count;
+}
+
+/*
+ * Visiting the nodes of a heap in order only needs the children, in that
+ * heap, of the nodes already visited; FRONTIER is a heap of those, and of
+ * the top of the heap of each host or spindle that passed its check.
+ */
+static void
+frontier_push(
+    GPtrArray   *frontier,
+    runq_node_t *node,
+    int          o)
+{
+    guint i;
+
+    g_ptr_array_add(frontier, node);
+    for (i = frontier->len - 1; i > 0; ) {
+	guint parent = (i - 1) / 2;
+
+	if (!node_before(node, g_ptr_array_index(frontier, parent), o))
+	    break;
+	g_ptr_array_index(frontier, i) = g_ptr_array_index(frontier, parent);
+	i = parent;
+    }
+    g_ptr_array_index(frontier, i) = node;
+}
+
+static runq_node_t *
+frontier_pop(
+    GPtrArray *frontier,
+    int        o)
+{
+    runq_node_t *top, *last;
+    guint i = 0;
+
+    if (frontier->len == 0)
+	return NULL;
+    top = g_ptr_array_index(frontier, 0);
+    last = g_ptr_array_index(frontier, frontier->len - 1);
+    g_ptr_array_set_size(frontier, frontier->len - 1);
+
+    if (frontier->len > 0) {
+	for (;;) {
+	    guint child = 2 * i + 1;
+
+	    if (child >= frontier->len)
+		break;
+	    if (child + 1 < frontier->len &&
+		node_before(g_ptr_array_index(frontier, child + 1),
+			    g_ptr_array_index(frontier, child), o))
+		child++;
+	    if (!node_before(g_ptr_array_index(frontier, child), last, o))
+		break;
+	    g_ptr_array_index(frontier, i) = g_ptr_array_index(frontier, child);
+	    i = child;
+	}
+	g_ptr_array_index(frontier, i) = last;
+    }
+    return top;
+}
+
+/* Visit the nodes in order O, skipping those whose dumps are all larger
+ * than SIZE_LIMIT, until a dump passes CHECKS. */
+static sched_t *
+pick_in_order(
+    runq_index_t        *idx,
+    int                  o,
+    const runq_checks_t *checks,
+    gpointer             data,
+    gint64               size_limit,
+    guint               *nvisited)
+{
+    GPtrArray *frontier = idx->frontier;
+    runq_node_t *node;
+
+    if (idx->root->heap[o]->len == 0)
+	return NULL;
+
+    g_ptr_array_set_size(frontier, 0);
+    frontier_push(frontier, g_ptr_array_index(idx->root->heap[o], 0), o);
+
+    while ((node = frontier_pop(frontier, o)) != NULL) {
+	GPtrArray *heap = node->parent->heap[o];
+	guint child = 2 * node->pos[o] + 1;
+
+	(*nvisited)++;
+
+	if (node->best[RUNQ_SIZE]->key[RUNQ_SIZE] > size_limit) {
+	    /* by size, all the nodes left are too big */
+	    if (o == RUNQ_SIZE)
+		break;
+	    /* else only those below this one */
+	} else {
+	    switch (node->kind) {
+	    case RUNQ_HOST:
+		if (checks->host_ok(data, node->host))
+		    frontier_push(frontier,
+				  g_ptr_array_index(node->heap[o], 0), o);
+		break;
+
+	    case RUNQ_SPINDLE:
+		if (node->spindle == -1 ||
+		    checks->spindle_ok(data, node->host, node->spindle))
+		    frontier_push(frontier,
+				  g_ptr_array_index(node->heap[o], 0), o);
+		break;
+
+	    case RUNQ_SCHED:
+		if (checks->sched_ok(data, node->sp))
+		    return node->sp;
+		break;
+
+	    case RUNQ_ROOT:
+		break;
+	    }
+	}
+
+	/* the nodes after this one in its parent's heap */
+	if (child < heap->len)
+	    frontier_push(frontier, g_ptr_array_index(heap, child), o);
+	if (child + 1 < heap->len)
+	    frontier_push(frontier, g_ptr_array_index(heap, child + 1), o);
+    }
+
+    return NULL;
+}
+
+sched_t *
+runq_index_pick(
+    runq_index_t        *idx,
+    char                 dumptype,
+    const runq_checks_t *checks,
+    gpointer             data,
+    guint               *visited)
+{
+    const char *p = strchr(runq_orders, dumptype);
+    sched_t *result = NULL;
+    guint nvisited = 0;
+    gint64 size_limit = G_MAXINT64;
+    int o;
+
+    o = (p && dumptype) ? p - runq_orders : 0;
+
+    /*
+     * When the size is limited, most of the dumps may be too big, and in the
+     * orders by priority they are found anywhere; look first, by size, if any dump
+     * can start at all.  This stops at the first dump too big.
+     */
+    if (checks->size_limit) {
+	size_limit = checks->size_limit(data);
+	result = pick_in_order(idx, RUNQ_SIZE, checks, data, size_limit,
+			       &nvisited);
+    }
+    if (!checks->size_limit || result)
+	result = pick_in_order(idx, o, checks, data, size_limit, &nvisited);
+
+    if (visited)
+	*visited = nvisited;
+    return result;
+}
+
+#ifdef TEST
+
+/*
+ * Synthetic schedule: pick dumps for idle dumpers with the index and with a
+ * scan of the queue as start_some_dumps used to do, check that both pick the
+ * same dump, and compare the time they take.
+ *
+ *   runqindex [hosts [dumps [inparallel [dumporder [holding]]]]]
+ *
+ * HOLDING is the size of the holding disk, in dumps of the average size;
+ * the smaller it is, the more dumps are too big to start.
+ */
+
+typedef struct bench_s {
+    off_t holding_free;
+} bench_t;
+
+static gboolean
+bench_host_ok(
+    gpointer   data G_GNUC_UNUSED,
+    am_host_t *host)
+{
+    return host->inprogress < host->maxdumps;
+}
+
+static gboolean
+bench_spindle_ok(
+    gpointer   data G_GNUC_UNUSED,
+    am_host_t *host,
+    int        spindle)
+{
+    disk_t *dp;
+
+    for (dp = host->disks; dp != NULL; dp = dp->hostnext) {
+	if (dp->inprogress && dp->spindle == spindle)
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+bench_sched_ok(
+    gpointer data,
+    sched_t *sp)
+{
+    bench_t *b = data;
+
+    return sp->est_size <= b->holding_free;
+}
+
+static gint64
+bench_size_limit(
+    gpointer data)
+{
+    bench_t *b = data;
+
+    return b->holding_free;
+}
+
+static const runq_checks_t bench_checks = {
+    bench_host_ok, bench_spindle_ok, bench_sched_ok, bench_size_limit
+};
+
+/* the scan of the whole queue, with the accept rule of start_some_dumps */
+static sched_t *
+bench_scan(
+    GList   *queue,
+    char     dumptype,
+    bench_t *b)
+{
+    sched_t *accepted = NULL;
+    GList *l;
+
+    for (l = queue; l != NULL; l = l->next) {
+	sched_t *sp = l->data;
+	disk_t *dp = sp->disk;
+	int accept;
+
+	if (!bench_sched_ok(b, sp) || !bench_host_ok(b, dp->host) ||
+	    (dp->spindle != -1 && !bench_spindle_ok(b, dp->host, dp->spindle)))
+	    continue;
+
+	accept = !accepted;
+	if (!accept) {
+	    switch (dumptype) {
+	    case 's': accept = (sp->est_size < accepted->est_size); break;
+	    case 'S': accept = (sp->est_size > accepted->est_size); break;
+	    case 't': accept = (sp->est_time < accepted->est_time); break;
+	    case 'T': accept = (sp->est_time > accepted->est_time); break;
+	    case 'b': accept = (sp->est_kps < accepted->est_kps); break;
+	    case 'B': accept = (sp->est_kps > accepted->est_kps); break;
+	    default:  accept = (sp->est_size < accepted->est_size); break;
+	    }
+	}
+	if (accept && (!accepted ||
+		       dp->priority >= accepted->disk->priority))
+	    accepted = sp;
+    }
+    return accepted;
+}
+
+/* the planner sends the schedule by decreasing priority */
+static gint
+bench_sort(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const sched_t *sa = a, *sb = b;
+
+    if (sa->disk->priority != sb->disk->priority)
+	return sb->disk->priority - sa->disk->priority;
+    return (sb->est_size > sa->est_size) - (sb->est_size < sa->est_size);
+}
+
+int
+main(
+    int		argc,
+    char **	argv)
+{
+    int nhosts = argc > 1 ? atoi(argv[1]) : 400;
+    int ndumps = argc > 2 ? atoi(argv[2]) : 8000;
+    int inparallel = argc > 3 ? atoi(argv[3]) : 64;
+    char *dumporder = argc > 4 ? argv[4] : "sssStTbB";
+    int holding = argc > 5 ? atoi(argv[5]) : 64;
+    am_host_t *hosts;
+    sched_t **running;
+    GList *queue = NULL, *l;
+    runq_index_t *idx;
+    bench_t b;
+    GTimer *timer;
+    double index_time = 0, scan_time = 0;
+    guint64 picks = 0, nvisited = 0;
+    off_t total = 0;
+    int i, nrunning = 0;
+
+    glib_init();
+    srandom(42);
+
+    hosts = g_new0(am_host_t, nhosts);
+    for (i = 0; i < nhosts; i++)
+	hosts[i].maxdumps = 1 + random() % 3;
+
+    for (i = 0; i < ndumps; i++) {
+	am_host_t *host = &hosts[random() % nhosts];
+	disk_t *dp = g_new0(disk_t, 1);
+	sched_t *sp = g_new0(sched_t, 1);
+
+	dp->host = host;
+	dp->hostnext = host->disks;
+	host->disks = dp;
+	dp->spindle = (random() % 2) ? -1 : (int)(random() % 4);
+	dp->priority = random() % 3;
+	sp->disk = dp;
+	sp->est_size = 1 + random() % 1000000;
+	sp->est_time = 1 + random() % 3600;
+	sp->est_kps = 1 + random() % 100000;
+	total += sp->est_size;
+	queue = g_list_prepend(queue, sp);
+    }
+    queue = g_list_sort(queue, bench_sort);
+
+    idx = runq_index_new();
+    for (l = queue; l != NULL; l = l->next)
+	runq_index_add(idx, l->data, FALSE);
+
+    b.holding_free = total / ndumps * holding;
+    running = g_new0(sched_t *, inparallel);
+    timer = g_timer_new();
+
+    while (queue || nrunning > 0) {
+	int started = 0;
+
+	for (i = 0; i < inparallel; i++) {
+	    char dumptype = dumporder[i % strlen(dumporder)];
+	    sched_t *sp, *sp_scan;
+	    guint visited;
+
+	    if (running[i])
+		continue;
+
+	    g_timer_start(timer);
+	    sp = runq_index_pick(idx, dumptype, &bench_checks, &b, &visited);
+	    index_time += g_timer_elapsed(timer, NULL);
+
+	    g_timer_start(timer);
+	    sp_scan = bench_scan(queue, dumptype, &b);
+	    scan_time += g_timer_elapsed(timer, NULL);
+
+	    picks++;
+	    nvisited += visited;
+	    if (sp != sp_scan) {
+		g_fprintf(stderr, "pick %ju (%c): index and scan differ\n",
+			  (uintmax_t)picks, dumptype);
+		return 1;
+	    }
+	    /* the other idle dumpers can't start anything either */
+	    if (!sp)
+		break;
+
+	    runq_index_remove(idx, sp);
+	    queue = g_list_remove(queue, sp);
+	    sp->disk->host->inprogress++;
+	    sp->disk->inprogress = 1;
+	    b.holding_free -= sp->est_size;
+	    running[i] = sp;
+	    nrunning++;
+	    started++;
+	}
+
+	/* finish one dump */
+	if (nrunning > 0) {
+	    do {
+		i = random() % inparallel;
+	    } while (!running[i]);
+	    running[i]->disk->host->inprogress--;
+	    running[i]->disk->inprogress = 0;
+	    b.holding_free += running[i]->est_size;
+	    running[i] = NULL;
+	    nrunning--;
+	} else if (!started) {
+	    g_fprintf(stderr, "%d dumps can never start\n",
+		      g_list_length(queue));
+	    return 1;
+	}
+    }
+
+    g_printf("%d hosts, %d dumps, %d dumpers, dumporder %s, holding %d\n",
+	     nhosts, ndumps, inparallel, dumporder, holding);
+    g_printf("%ju picks, %.1f nodes visited per pick\n",
+	     (uintmax_t)picks, (double)nvisited / picks);
+    g_printf("index: %.3f s (%.2f us per pick)\n", index_time,
+	     index_time * 1e6 / picks);
+    g_printf("scan:  %.3f s (%.2f us per pick)\n", scan_time,
+	     scan_time * 1e6 / picks);
+
+    runq_index_free(idx);
+    return 0;
+}
+
+#endif /* TEST */
@@ -0,0 +1,92 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Index of the driver's run queue
+ *
+ * For each dumporder character, the queued dumps are kept in a tree of
+ * heaps: a heap of hosts, each with a heap of its spindles, each with a heap
+ * of its dumps.  The dumps are ordered by disk priority (highest first),
+ * then by the dumporder criterion, then by their position in the queue; a
+ * host or spindle is ordered by its best dump.
+ *
+ * runq_index_pick() visits the dumps in that order, skipping a whole host
+ * when it is busy and a whole spindle when it is in use, and stops at the
+ * first dump that can start.  The busy hosts and spindles are bounded by the
+ * number of running dumps, so a pick costs O(log n) plus the dumps that are
+ * better but can't start, instead of a scan of the whole queue.
+ */
+
+#ifndef RUNQINDEX_H
+#define RUNQINDEX_H
+
+#include "amanda.h"
+#include "driverio.h"
+
+typedef struct runq_index_s runq_index_t;
+
+/* The checks made by runq_index_pick(), from the widest to the narrowest.
+ * They must not change the index. */
+typedef struct runq_checks_s {
+    /* can a dump of HOST start? */
+    gboolean (*host_ok)(gpointer data, am_host_t *host);
+
+    /* can a dump on SPINDLE of HOST start?  Not called for spindle -1. */
+    gboolean (*spindle_ok)(gpointer data, am_host_t *host, int spindle);
+
+    /* can SP start? */
+    gboolean (*sched_ok)(gpointer data, sched_t *sp);
+
+    /* no dump with a larger est_size can start; may be NULL */
+    gint64 (*size_limit)(gpointer data);
+} runq_checks_t;
+
+runq_index_t *runq_index_new(void);
+void runq_index_free(runq_index_t *idx);
+
+/* Add SP, at the end of the queue or, with AT_HEAD, at its head.  The
+ * fields used for ordering (the disk priority, est_size, est_time and
+ * est_kps) must not change until SP is removed. */
+void runq_index_add(runq_index_t *idx, sched_t *sp, gboolean at_head);
+
+/* Remove SP; it may not be in the index. */
+void runq_index_remove(runq_index_t *idx, sched_t *sp);
+
+/* @returns: the number of dumps in the index */
+guint runq_index_size(runq_index_t *idx);
+
+/* Find the best dump according to DUMPTYPE (a dumporder character, one of
+ * "sStTbB") that passes CHECKS.
+ *
+ * @param visited (output): the number of hosts, spindles and dumps looked
+ *                          at; may be NULL
+ * @returns: the dump, or NULL if none can start
+ */
+sched_t *runq_index_pick(runq_index_t *idx, char dumptype,
+			 const runq_checks_t *checks, gpointer data,
+			 guint *visited);
+
+#endif /* RUNQINDEX_H */
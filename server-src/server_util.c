@@ -58,7 +58,7 @@ const char *cmdstr[] = {
     "START-SCAN", "CLOSE-VOLUME", "CLOSED-VOLUME",
     "OPENED-SOURCE-VOLUME",
     "CLOSE-SOURCE-VOLUME", "CLOSED-SOURCE-VOLUME",
-    "RETRY", "READY", "LAST_TOK",
+    "RETRY", "READY", "PROGRESS", "STREAM-WRITE", "LAST_TOK",
     NULL
 };
 
@@ -56,10 +56,14 @@ enum {
     START_SCAN, CLOSE_VOLUME, CLOSED_VOLUME,
     OPENED_SOURCE_VOLUME,
     CLOSE_SOURCE_VOLUME, CLOSED_SOURCE_VOLUME,
-    RETRY, READY, LAST_TOK
+    RETRY, READY, PROGRESS, STREAM_WRITE, LAST_TOK
 };
 extern const char *cmdstr[];
 
+/* seconds between the PROGRESS results of a dumper, with
+ * bandwidth-allocation "adaptive" */
+#define PROGRESS_INTERVAL	10
+
 struct cmdargs {
     cmd_t cmd;
     int argc;
@@ -0,0 +1,968 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+#include "amanda.h"
+#include "amcompress.h"
+#include "sortedindex.h"
+
+/*
+ * All integers are little-endian.  The file is a sequence of gzip members:
+ *
+ *   data blocks: whole lines, each terminated by a newline
+ *   directory blocks, between the data blocks: skippable frames "AMID"
+ *	holding a gzip member of entries
+ *	    path, NUL, 64-bit offset in the uncompressed index
+ *	sorted by path.  Each directory prefix of the paths, up to and
+ *	including a '/', has an entry with the offset of the first path
+ *	starting with it.  The first path after the end of a directory also
+ *	has an entry, unless it starts a directory, so the first entry not
+ *	less than a path gives the first path not less than it.
+ *   block table: skippable frames "AMIB", for each data block
+ *	    64-bit file offset, 32-bit compressed size, 32-bit uncompressed size
+ *   directory table: skippable frames "AMIT", for each directory block
+ *	    64-bit file offset, 32-bit size of its frames,
+ *	    32-bit uncompressed size, its first path, NUL
+ *   footer: a skippable frame "AMIF"
+ *	    16-bit version, 16-bit reserved, 32-bit reserved,
+ *	    number of data blocks, number of directory blocks,
+ *	    offset and size of the block table,
+ *	    offset and size of the directory table,
+ *	    size of the uncompressed index, all 64-bit
+ *
+ * A table larger than a skippable frame is split in consecutive frames with
+ * the same magic.
+ */
+
+#define SIDX_DIR_MAGIC		"AMID"
+#define SIDX_BLOCKS_MAGIC	"AMIB"
+#define SIDX_DIRTAB_MAGIC	"AMIT"
+#define SIDX_FOOTER_MAGIC	"AMIF"
+#define SIDX_VERSION		1
+
+#define SIDX_FOOTER_PAYLOAD	(4 + 2 + 2 + 4 + 7*8)
+#define SIDX_FOOTER_FRAME	(SIDX_FOOTER_PAYLOAD + 26)
+#define SIDX_META_CHUNK		(AM_SKIP_FRAME_MAX_PAYLOAD - 4)
+
+/* uncompressed size of the blocks */
+#define SIDX_DATA_BLOCK_SIZE	(64*1024)
+#define SIDX_DIR_BLOCK_SIZE	(32*1024)
+
+/* size of a block table entry */
+#define SIDX_BLOCK_ENTRY	16
+
+struct sorted_index_writer_s {
+    int fd;
+    guint64 pos;		/* current offset in the file */
+
+    GString *prev;		/* previous line */
+    GString *block;		/* current data block */
+    guint64 block_offset;	/* uncompressed offset of the current block */
+    GString *dirblock;		/* current directory block */
+    GString *dirblock_first;	/* first path of the current directory block */
+
+    GString *blocks;		/* block table */
+    guint64 nblocks;
+    GString *dirtab;		/* directory table */
+    guint64 ndirblocks;
+
+    char *errmsg;
+};
+
+typedef struct sidx_block_s {
+    guint64 offset;
+    guint32 comp_size;
+    guint32 uncomp_size;
+    guint64 uncomp_offset;
+} sidx_block_t;
+
+typedef struct sidx_dir_s {
+    guint64 offset;
+    guint32 size;
+    guint32 uncomp_size;
+    char *first;
+} sidx_dir_t;
+
+struct sorted_index_s {
+    char *filename;
+    int fd;
+    guint64 file_size;
+
+    sidx_block_t *blocks;
+    guint64 nblocks;
+    sidx_dir_t *dirs;
+    guint64 ndirs;
+    char *dirtab;		/* holds the first paths of dirs */
+
+    /* the last directory block read */
+    gint64 cur_dir;
+    char *dirbuf;
+};
+
+static void
+put_le32(
+    char *p,
+    guint32 v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static void
+put_le64(
+    char *p,
+    guint64 v)
+{
+    put_le32(p, v & 0xffffffff);
+    put_le32(p+4, v >> 32);
+}
+
+static guint32
+get_le32(
+    const char *p)
+{
+    const guint8 *u = (const guint8 *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((guint32)u[3] << 24);
+}
+
+static guint64
+get_le64(
+    const char *p)
+{
+    return get_le32(p) | ((guint64)get_le32(p+4) << 32);
+}
+
+static void
+append_le32(
+    GString *s,
+    guint32 v)
+{
+    char buf[4];
+    put_le32(buf, v);
+    g_string_append_len(s, buf, 4);
+}
+
+static void
+append_le64(
+    GString *s,
+    guint64 v)
+{
+    char buf[8];
+    put_le64(buf, v);
+    g_string_append_len(s, buf, 8);
+}
+
+gboolean
+sorted_index_supported(void)
+{
+#ifdef HAVE_GZIP
+    return am_compress_supported(AM_COMPRESS_GZIP);
+#else
+    return FALSE;
+#endif
+}
+
+/*
+ * Writer
+ */
+
+static gboolean
+writer_error(
+    sorted_index_writer_t *w,
+    char *errmsg)
+{
+    if (!w->errmsg)
+	w->errmsg = errmsg;
+    else
+	g_free(errmsg);
+    return FALSE;
+}
+
+static gboolean
+writer_write(
+    sorted_index_writer_t *w,
+    const char *buf,
+    gsize size)
+{
+    if (full_write(w->fd, buf, size) != size)
+	return writer_error(w, g_strdup_printf("can't write sorted index: %s",
+					       strerror(errno)));
+    w->pos += size;
+    return TRUE;
+}
+
+/* write BUF as skippable frames with MAGIC; add their size to *SIZE */
+static gboolean
+write_meta(
+    sorted_index_writer_t *w,
+    const char *magic,
+    const char *buf,
+    gsize len,
+    guint64 *size)
+{
+    char *payload = g_malloc(4 + MIN(len, SIDX_META_CHUNK));
+    gsize done = 0;
+
+    memcpy(payload, magic, 4);
+    do {
+	gsize n = MIN(len - done, SIDX_META_CHUNK);
+	gsize frame_size;
+	char *frame;
+	gboolean ok;
+
+	memcpy(payload + 4, buf + done, n);
+	frame = am_skip_frame(AM_COMPRESS_GZIP, payload, n + 4, &frame_size);
+	ok = writer_write(w, frame, frame_size);
+	g_free(frame);
+	if (!ok) {
+	    g_free(payload);
+	    return FALSE;
+	}
+	*size += frame_size;
+	done += n;
+    } while (done < len);
+
+    g_free(payload);
+    return TRUE;
+}
+
+static gboolean
+flush_data_block(
+    sorted_index_writer_t *w)
+{
+    char *comp;
+    gsize comp_size;
+    char *errmsg;
+    gboolean ok;
+
+    if (w->block->len == 0)
+	return TRUE;
+
+    errmsg = am_compress_buffer(AM_COMPRESS_GZIP,
+				am_compress_best_level(AM_COMPRESS_GZIP),
+				w->block->str, w->block->len,
+				&comp, &comp_size);
+    if (errmsg)
+	return writer_error(w, errmsg);
+
+    append_le64(w->blocks, w->pos);
+    append_le32(w->blocks, comp_size);
+    append_le32(w->blocks, w->block->len);
+    w->nblocks++;
+
+    ok = writer_write(w, comp, comp_size);
+    g_free(comp);
+
+    w->block_offset += w->block->len;
+    g_string_truncate(w->block, 0);
+    return ok;
+}
+
+static gboolean
+flush_dir_block(
+    sorted_index_writer_t *w)
+{
+    char *comp;
+    gsize comp_size;
+    guint64 offset = w->pos;
+    guint64 size = 0;
+    char *errmsg;
+    gboolean ok;
+
+    if (w->dirblock->len == 0)
+	return TRUE;
+
+    errmsg = am_compress_buffer(AM_COMPRESS_GZIP,
+				am_compress_best_level(AM_COMPRESS_GZIP),
+				w->dirblock->str, w->dirblock->len,
+				&comp, &comp_size);
+    if (errmsg)
+	return writer_error(w, errmsg);
+
+    ok = write_meta(w, SIDX_DIR_MAGIC, comp, comp_size, &size);
+    g_free(comp);
+    if (!ok)
+	return FALSE;
+
+    append_le64(w->dirtab, offset);
+    append_le32(w->dirtab, size);
+    append_le32(w->dirtab, w->dirblock->len);
+    g_string_append_len(w->dirtab, w->dirblock_first->str,
+			w->dirblock_first->len + 1);
+    w->ndirblocks++;
+
+    g_string_truncate(w->dirblock, 0);
+    return TRUE;
+}
+
+static gboolean
+add_entry(
+    sorted_index_writer_t *w,
+    const char *path,
+    gsize len,
+    guint64 offset)
+{
+    if (w->dirblock->len > 0 &&
+	w->dirblock->len + len + 9 > SIDX_DIR_BLOCK_SIZE) {
+	if (!flush_dir_block(w))
+	    return FALSE;
+    }
+    if (w->dirblock->len == 0) {
+	g_string_truncate(w->dirblock_first, 0);
+	g_string_append_len(w->dirblock_first, path, len);
+    }
+
+    g_string_append_len(w->dirblock, path, len);
+    g_string_append_c(w->dirblock, '\0');
+    append_le64(w->dirblock, offset);
+    return TRUE;
+}
+
+sorted_index_writer_t *
+sorted_index_writer_new(
+    int fd)
+{
+    sorted_index_writer_t *w = g_new0(sorted_index_writer_t, 1);
+
+    w->fd = fd;
+    w->prev = g_string_new(NULL);
+    w->block = g_string_sized_new(SIDX_DATA_BLOCK_SIZE + 4096);
+    w->dirblock = g_string_sized_new(SIDX_DIR_BLOCK_SIZE + 4096);
+    w->dirblock_first = g_string_new(NULL);
+    w->blocks = g_string_new(NULL);
+    w->dirtab = g_string_new(NULL);
+    return w;
+}
+
+gboolean
+sorted_index_writer_add(
+    sorted_index_writer_t *w,
+    const char *line,
+    gsize len)
+{
+    gsize common, i;
+    guint64 offset;
+    gboolean new_dir = FALSE;
+    int cmp;
+
+    if (w->errmsg)
+	return FALSE;
+    if (len == 0 || !memchr(line, '/', len) || memchr(line, '\0', len))
+	return TRUE;
+
+    for (common = 0; common < len && common < w->prev->len; common++) {
+	if (line[common] != w->prev->str[common])
+	    break;
+    }
+    if (common < len && common < w->prev->len)
+	cmp = (guchar)line[common] - (guchar)w->prev->str[common];
+    else
+	cmp = (len > w->prev->len) - (len < w->prev->len);
+    if (cmp < 0)
+	return writer_error(w, g_strdup("index is not sorted"));
+
+    /* a data block always holds whole lines */
+    if (w->block->len > 0 &&
+	w->block->len + len + 1 > SIDX_DATA_BLOCK_SIZE) {
+	if (!flush_data_block(w))
+	    return FALSE;
+    }
+    offset = w->block_offset + w->block->len;
+
+    /* the directories that are not a prefix of the previous line appear
+     * for the first time; since the lines are sorted, the entries are too */
+    for (i = common; i < len; i++) {
+	if (line[i] == '/') {
+	    if (!add_entry(w, line, i + 1, offset))
+		return FALSE;
+	    new_dir = TRUE;
+	}
+    }
+
+    /* the line ends a directory of the previous line */
+    if (!new_dir && w->prev->len > common &&
+	memchr(w->prev->str + common, '/', w->prev->len - common)) {
+	if (!add_entry(w, line, len, offset))
+	    return FALSE;
+    }
+
+    g_string_append_len(w->block, line, len);
+    g_string_append_c(w->block, '\n');
+    g_string_truncate(w->prev, 0);
+    g_string_append_len(w->prev, line, len);
+    return TRUE;
+}
+
+gboolean
+sorted_index_writer_finish(
+    sorted_index_writer_t *w)
+{
+    char footer[SIDX_FOOTER_PAYLOAD];
+    guint64 blocks_offset, blocks_size = 0;
+    guint64 dirtab_offset, dirtab_size = 0;
+    gsize frame_size;
+    char *frame;
+    gboolean ok;
+
+    if (w->errmsg)
+	return FALSE;
+    if (!flush_data_block(w) || !flush_dir_block(w))
+	return FALSE;
+
+    blocks_offset = w->pos;
+    if (!write_meta(w, SIDX_BLOCKS_MAGIC, w->blocks->str, w->blocks->len,
+		    &blocks_size))
+	return FALSE;
+    dirtab_offset = w->pos;
+    if (!write_meta(w, SIDX_DIRTAB_MAGIC, w->dirtab->str, w->dirtab->len,
+		    &dirtab_size))
+	return FALSE;
+
+    memset(footer, 0, sizeof(footer));
+    memcpy(footer, SIDX_FOOTER_MAGIC, 4);
+    footer[4] = SIDX_VERSION;
+    put_le64(footer+12, w->nblocks);
+    put_le64(footer+20, w->ndirblocks);
+    put_le64(footer+28, blocks_offset);
+    put_le64(footer+36, blocks_size);
+    put_le64(footer+44, dirtab_offset);
+    put_le64(footer+52, dirtab_size);
+    put_le64(footer+60, w->block_offset);
+    frame = am_skip_frame(AM_COMPRESS_GZIP, footer, sizeof(footer),
+			  &frame_size);
+    g_assert(frame_size == SIDX_FOOTER_FRAME);
+    ok = writer_write(w, frame, frame_size);
+    g_free(frame);
+    return ok;
+}
+
+const char *
+sorted_index_writer_error(
+    sorted_index_writer_t *w)
+{
+    return w->errmsg;
+}
+
+void
+sorted_index_writer_free(
+    sorted_index_writer_t *w)
+{
+    if (!w)
+	return;
+    g_string_free(w->prev, TRUE);
+    g_string_free(w->block, TRUE);
+    g_string_free(w->dirblock, TRUE);
+    g_string_free(w->dirblock_first, TRUE);
+    g_string_free(w->blocks, TRUE);
+    g_string_free(w->dirtab, TRUE);
+    g_free(w->errmsg);
+    g_free(w);
+}
+
+gboolean
+sorted_index_write_from_fd(
+    int    in_fd,
+    int    out_fd,
+    char **errmsg)
+{
+    sorted_index_writer_t *w = sorted_index_writer_new(out_fd);
+    GString *buf = g_string_sized_new(128*1024);
+    gsize start = 0;
+    gboolean ok = TRUE;
+
+    *errmsg = NULL;
+    while (ok) {
+	char *nl;
+	ssize_t n;
+
+	/* add the complete lines in the buffer */
+	while ((nl = memchr(buf->str + start, '\n', buf->len - start))) {
+	    if (!sorted_index_writer_add(w, buf->str + start,
+					 nl - (buf->str + start))) {
+		ok = FALSE;
+		break;
+	    }
+	    start = nl + 1 - buf->str;
+	}
+	if (!ok)
+	    break;
+	g_string_erase(buf, 0, start);
+	start = 0;
+
+	g_string_set_size(buf, buf->len + 65536);
+	n = read(in_fd, buf->str + buf->len - 65536, 65536);
+	if (n < 0 && errno == EINTR) {
+	    g_string_set_size(buf, buf->len - 65536);
+	    continue;
+	}
+	g_string_set_size(buf, buf->len - 65536 + MAX(n, 0));
+	if (n < 0) {
+	    *errmsg = g_strdup_printf("can't read index: %s", strerror(errno));
+	    ok = FALSE;
+	} else if (n == 0) {
+	    /* a last line without newline */
+	    if (buf->len > 0)
+		ok = sorted_index_writer_add(w, buf->str, buf->len);
+	    if (ok)
+		ok = sorted_index_writer_finish(w);
+	    break;
+	}
+    }
+
+    if (!ok && !*errmsg)
+	*errmsg = g_strdup(sorted_index_writer_error(w));
+    sorted_index_writer_free(w);
+    g_string_free(buf, TRUE);
+    return ok;
+}
+
+/*
+ * Reader
+ */
+
+static gboolean
+read_at(
+    int fd,
+    guint64 offset,
+    char *buf,
+    gsize size)
+{
+    if (lseek(fd, (off_t)offset, SEEK_SET) != (off_t)offset)
+	return FALSE;
+    return full_read(fd, buf, size) == size;
+}
+
+/* read the frames with MAGIC at OFFSET, and return their concatenated
+ * payloads */
+static char *
+read_meta(
+    sorted_index_t *idx,
+    const char *magic,
+    guint64 offset,
+    guint64 size,
+    gsize *len,
+    char **errmsg)
+{
+    char *region;
+    char *data;
+    gsize pos = 0;
+
+    *len = 0;
+    if (offset + size > idx->file_size || size > G_MAXSIZE) {
+	*errmsg = g_strdup_printf("%s: corrupt sorted index", idx->filename);
+	return NULL;
+    }
+    region = g_malloc(size);
+    if (!read_at(idx->fd, offset, region, size)) {
+	*errmsg = g_strdup_printf("can't read %s: %s", idx->filename,
+				  strerror(errno));
+	g_free(region);
+	return NULL;
+    }
+
+    /* the payloads are never longer than the region */
+    data = g_malloc(size + 1);
+    while (pos < size) {
+	gsize payload_len, frame_size;
+	const char *payload = am_skip_frame_parse(AM_COMPRESS_GZIP,
+				region + pos, size - pos,
+				&payload_len, &frame_size);
+
+	if (!payload || payload_len < 4 || memcmp(payload, magic, 4) != 0) {
+	    *errmsg = g_strdup_printf("%s: corrupt sorted index",
+				      idx->filename);
+	    g_free(region);
+	    g_free(data);
+	    return NULL;
+	}
+	memcpy(data + *len, payload + 4, payload_len - 4);
+	*len += payload_len - 4;
+	pos += frame_size;
+    }
+    data[*len] = '\0';
+
+    g_free(region);
+    return data;
+}
+
+/* decompress the data block B */
+static char *
+read_block(
+    sorted_index_t *idx,
+    guint64 b,
+    char **errmsg)
+{
+    sidx_block_t *block = &idx->blocks[b];
+    char *comp = g_malloc(block->comp_size);
+    char *data = g_malloc(block->uncomp_size + 1);
+    char *err;
+
+    if (!read_at(idx->fd, block->offset, comp, block->comp_size)) {
+	*errmsg = g_strdup_printf("can't read %s: %s", idx->filename,
+				  strerror(errno));
+	goto error;
+    }
+    err = am_uncompress_buffer(AM_COMPRESS_GZIP, comp, block->comp_size,
+			       data, block->uncomp_size);
+    if (err) {
+	*errmsg = g_strdup_printf("%s: %s", idx->filename, err);
+	g_free(err);
+	goto error;
+    }
+    data[block->uncomp_size] = '\0';
+    g_free(comp);
+    return data;
+
+error:
+    g_free(comp);
+    g_free(data);
+    return NULL;
+}
+
+/* make directory block D the current one */
+static gboolean
+load_dir_block(
+    sorted_index_t *idx,
+    guint64 d,
+    char **errmsg)
+{
+    sidx_dir_t *dir = &idx->dirs[d];
+    char *comp;
+    gsize comp_size;
+    char *err;
+
+    if (idx->cur_dir == (gint64)d)
+	return TRUE;
+    idx->cur_dir = -1;
+    amfree(idx->dirbuf);
+
+    comp = read_meta(idx, SIDX_DIR_MAGIC, dir->offset, dir->size,
+		     &comp_size, errmsg);
+    if (!comp)
+	return FALSE;
+    idx->dirbuf = g_malloc(dir->uncomp_size + 1);
+    err = am_uncompress_buffer(AM_COMPRESS_GZIP, comp, comp_size,
+			       idx->dirbuf, dir->uncomp_size);
+    g_free(comp);
+    if (err) {
+	*errmsg = g_strdup_printf("%s: %s", idx->filename, err);
+	g_free(err);
+	amfree(idx->dirbuf);
+	return FALSE;
+    }
+    idx->dirbuf[dir->uncomp_size] = '\0';
+    idx->cur_dir = d;
+    return TRUE;
+}
+
+/* find the first entry not less than KEY, or equal to KEY if EXACT, and
+ * return its offset; return 0 if there is none, 1 if found, -1 on error */
+static int
+find_entry(
+    sorted_index_t *idx,
+    const char *key,
+    gboolean exact,
+    guint64 *offset,
+    char **errmsg)
+{
+    guint64 lo = 0, hi = idx->ndirs;
+    char *p, *end;
+
+    if (idx->ndirs == 0)
+	return 0;
+
+    /* find the last directory block starting at or before KEY */
+    if (strcmp(idx->dirs[0].first, key) > 0) {
+	hi = 1;
+    }
+    while (hi - lo > 1) {
+	guint64 mid = lo + (hi - lo) / 2;
+	if (strcmp(idx->dirs[mid].first, key) <= 0)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+
+    /* the entry is in that block, or is the first one of the next block */
+    for (; lo < idx->ndirs; lo++) {
+	if (!load_dir_block(idx, lo, errmsg))
+	    return -1;
+	p = idx->dirbuf;
+	end = idx->dirbuf + idx->dirs[lo].uncomp_size;
+	while (p < end) {
+	    gsize len = strlen(p);
+	    int cmp;
+
+	    if (p + len + 9 > end) {
+		*errmsg = g_strdup_printf("%s: corrupt sorted index",
+					  idx->filename);
+		return -1;
+	    }
+	    cmp = strcmp(p, key);
+	    if (cmp >= 0) {
+		if (cmp > 0 && exact)
+		    return 0;
+		*offset = get_le64(p + len + 1);
+		return 1;
+	    }
+	    p += len + 9;
+	}
+	if (exact)
+	    break;
+    }
+    return 0;
+}
+
+sorted_index_t *
+sorted_index_open(
+    const char *filename,
+    char **errmsg)
+{
+    sorted_index_t *idx = g_new0(sorted_index_t, 1);
+    struct stat sbuf;
+    char tail[SIDX_FOOTER_FRAME];
+    const char *footer;
+    gsize len, frame_size;
+    guint64 blocks_offset, blocks_size, dirtab_offset, dirtab_size;
+    guint64 uncomp_size, uncomp_offset = 0;
+    char *blocks = NULL;
+    char *p, *end;
+    guint64 i;
+
+    *errmsg = NULL;
+    idx->filename = g_strdup(filename);
+    idx->fd = -1;
+    idx->cur_dir = -1;
+    idx->fd = open(filename, O_RDONLY);
+    if (idx->fd == -1) {
+	*errmsg = g_strdup_printf("can't open %s: %s", filename,
+				  strerror(errno));
+	goto error;
+    }
+    if (fstat(idx->fd, &sbuf) == -1) {
+	*errmsg = g_strdup_printf("can't stat %s: %s", filename,
+				  strerror(errno));
+	goto error;
+    }
+    idx->file_size = sbuf.st_size;
+
+    if (idx->file_size < SIDX_FOOTER_FRAME ||
+	!read_at(idx->fd, idx->file_size - SIDX_FOOTER_FRAME, tail,
+		 SIDX_FOOTER_FRAME)) {
+	*errmsg = g_strdup_printf("%s: not a sorted index", filename);
+	goto error;
+    }
+    footer = am_skip_frame_parse(AM_COMPRESS_GZIP, tail, sizeof(tail),
+				 &len, &frame_size);
+    if (!footer || len != SIDX_FOOTER_PAYLOAD ||
+	memcmp(footer, SIDX_FOOTER_MAGIC, 4) != 0) {
+	*errmsg = g_strdup_printf("%s: not a sorted index", filename);
+	goto error;
+    }
+    if (footer[4] != SIDX_VERSION) {
+	*errmsg = g_strdup_printf("%s: unsupported sorted index version %d",
+				  filename, footer[4]);
+	goto error;
+    }
+    idx->nblocks = get_le64(footer+12);
+    idx->ndirs = get_le64(footer+20);
+    blocks_offset = get_le64(footer+28);
+    blocks_size = get_le64(footer+36);
+    dirtab_offset = get_le64(footer+44);
+    dirtab_size = get_le64(footer+52);
+    uncomp_size = get_le64(footer+60);
+
+    /* block table */
+    blocks = read_meta(idx, SIDX_BLOCKS_MAGIC, blocks_offset, blocks_size,
+		       &len, errmsg);
+    if (!blocks)
+	goto error;
+    if (len != idx->nblocks * SIDX_BLOCK_ENTRY) {
+	*errmsg = g_strdup_printf("%s: corrupt sorted index", filename);
+	goto error;
+    }
+    idx->blocks = g_new(sidx_block_t, idx->nblocks);
+    for (i = 0, p = blocks; i < idx->nblocks; i++, p += SIDX_BLOCK_ENTRY) {
+	sidx_block_t *b = &idx->blocks[i];
+
+	b->offset = get_le64(p);
+	b->comp_size = get_le32(p+8);
+	b->uncomp_size = get_le32(p+12);
+	b->uncomp_offset = uncomp_offset;
+	uncomp_offset += b->uncomp_size;
+	if (b->offset + b->comp_size > idx->file_size) {
+	    *errmsg = g_strdup_printf("%s: corrupt sorted index", filename);
+	    goto error;
+	}
+    }
+    if (uncomp_offset != uncomp_size) {
+	*errmsg = g_strdup_printf("%s: corrupt sorted index", filename);
+	goto error;
+    }
+    amfree(blocks);
+
+    /* directory table */
+    idx->dirtab = read_meta(idx, SIDX_DIRTAB_MAGIC, dirtab_offset,
+			    dirtab_size, &len, errmsg);
+    if (!idx->dirtab)
+	goto error;
+    idx->dirs = g_new(sidx_dir_t, MIN(idx->ndirs, len / 17 + 1));
+    p = idx->dirtab;
+    end = idx->dirtab + len;
+    for (i = 0; i < idx->ndirs; i++) {
+	sidx_dir_t *d = &idx->dirs[i];
+
+	if (p + 17 > end || !memchr(p + 16, '\0', end - (p + 16))) {
+	    *errmsg = g_strdup_printf("%s: corrupt sorted index", filename);
+	    goto error;
+	}
+	d->offset = get_le64(p);
+	d->size = get_le32(p+8);
+	d->uncomp_size = get_le32(p+12);
+	d->first = p + 16;
+	p = d->first + strlen(d->first) + 1;
+    }
+    if (p != end) {
+	*errmsg = g_strdup_printf("%s: corrupt sorted index", filename);
+	goto error;
+    }
+
+    return idx;
+
+error:
+    g_free(blocks);
+    sorted_index_close(idx);
+    return NULL;
+}
+
+int
+sorted_index_scan(
+    sorted_index_t *idx,
+    const char *prefix,
+    gboolean recursive,
+    sorted_index_fn fn,
+    gpointer data,
+    char **errmsg)
+{
+    guint64 offset;
+    guint64 uncomp_size;
+    guint64 b = 0;
+    char *block = NULL;
+    size_t prefix_len = strlen(prefix);
+    int count = 0;
+    int rv;
+
+    *errmsg = NULL;
+    rv = find_entry(idx, prefix, TRUE, &offset, errmsg);
+    if (rv <= 0)
+	return rv;
+
+    uncomp_size = idx->nblocks == 0 ? 0 :
+		  idx->blocks[idx->nblocks - 1].uncomp_offset +
+		  idx->blocks[idx->nblocks - 1].uncomp_size;
+
+    /* the paths under PREFIX are contiguous from OFFSET */
+    while (offset < uncomp_size) {
+	sidx_block_t *blk = block ? &idx->blocks[b] : NULL;
+	char *p, *nl, *end;
+	char *slash;
+	char *next = NULL;
+	gboolean more;
+
+	/* read the data block holding OFFSET */
+	if (!blk || offset < blk->uncomp_offset ||
+	    offset >= blk->uncomp_offset + blk->uncomp_size) {
+	    guint64 lo = 0, hi = idx->nblocks;
+
+	    while (hi - lo > 1) {
+		guint64 mid = lo + (hi - lo) / 2;
+		if (idx->blocks[mid].uncomp_offset <= offset)
+		    lo = mid;
+		else
+		    hi = mid;
+	    }
+	    g_free(block);
+	    b = lo;
+	    blk = &idx->blocks[b];
+	    block = read_block(idx, b, errmsg);
+	    if (!block)
+		return -1;
+	}
+
+	p = block + (offset - blk->uncomp_offset);
+	end = block + blk->uncomp_size;
+	nl = memchr(p, '\n', end - p);
+	if (!nl) {
+	    *errmsg = g_strdup_printf("%s: corrupt sorted index",
+				      idx->filename);
+	    count = -1;
+	    break;
+	}
+	*nl = '\0';
+	if (strncmp(p, prefix, prefix_len) != 0)
+	    break;
+	offset += nl + 1 - p;
+
+	/* without RECURSIVE, skip the rest of a subdirectory, up to the
+	 * first path not less than its name with the '/' replaced by '0' */
+	if (!recursive && (slash = strchr(p + prefix_len, '/')) != NULL) {
+	    next = g_strndup(p, slash + 1 - p);
+	    next[slash - p] = '/' + 1;
+	}
+
+	count++;
+	more = fn(data, p);
+	if (more && next) {
+	    rv = find_entry(idx, next, FALSE, &offset, errmsg);
+	    if (rv == -1)
+		count = -1;
+	    more = (rv == 1);
+	}
+	g_free(next);
+	if (!more)
+	    break;
+    }
+
+    g_free(block);
+    return count;
+}
+
+void
+sorted_index_close(
+    sorted_index_t *idx)
+{
+    if (!idx)
+	return;
+    if (idx->fd >= 0)
+	close(idx->fd);
+    g_free(idx->filename);
+    g_free(idx->blocks);
+    g_free(idx->dirs);
+    g_free(idx->dirtab);
+    g_free(idx->dirbuf);
+    g_free(idx);
+}
@@ -0,0 +1,127 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/*
+ * Sorted, block-compressed index files (the -sorted.idx files)
+ *
+ * The paths of a dump index are stored sorted (in byte order, as 'sort'
+ * does with LC_ALL=C), in gzip members of about 64 kB of whole lines each,
+ * so the file decompresses to the sorted index with 'gzip -dc'.  Skippable
+ * gzip members (see am_skip_frame) interleaved with the data hold a table of
+ * every directory prefix of the paths, with the offset of the first path
+ * under it, and of the path following each directory; a block table, a
+ * table of the directory blocks and a footer are at the end of the file.
+ *
+ * Listing a directory reads the footer and tables once, then decompresses
+ * one directory block and the data blocks holding the listing, instead of
+ * the whole index.  A non-recursive listing jumps over the content of each
+ * subdirectory.
+ */
+
+#ifndef SORTEDINDEX_H
+#define SORTEDINDEX_H
+
+#include "amanda.h"
+
+typedef struct sorted_index_writer_s sorted_index_writer_t;
+typedef struct sorted_index_s sorted_index_t;
+
+/* Can sorted index files be written and read?  This needs zlib, and gzip as
+ * the compression program so that other tools can read them as .gz files.
+ */
+gboolean sorted_index_supported(void);
+
+/*
+ * Writer
+ */
+
+/* Start writing a sorted index to FD.
+ *
+ * @returns: the new writer
+ */
+sorted_index_writer_t *sorted_index_writer_new(int fd);
+
+/* Add the path LINE, of LEN bytes without the newline.  Paths must be added
+ * in sorted order; empty lines and lines without a '/' are skipped, as
+ * amindexd always did.
+ *
+ * @returns: FALSE on error, see sorted_index_writer_error()
+ */
+gboolean sorted_index_writer_add(sorted_index_writer_t *w, const char *line,
+				 gsize len);
+
+/* Write the remaining data and the tables.  FD is not closed.
+ *
+ * @returns: FALSE on error, see sorted_index_writer_error()
+ */
+gboolean sorted_index_writer_finish(sorted_index_writer_t *w);
+
+/* @returns: the message of the first error, or NULL */
+const char *sorted_index_writer_error(sorted_index_writer_t *w);
+
+void sorted_index_writer_free(sorted_index_writer_t *w);
+
+/* Read sorted lines from IN_FD until EOF, and write them as a sorted index
+ * to OUT_FD.  Neither fd is closed.
+ *
+ * @param errmsg (output): error message if FALSE is returned
+ * @returns: FALSE on error
+ */
+gboolean sorted_index_write_from_fd(int in_fd, int out_fd, char **errmsg);
+
+/*
+ * Reader
+ */
+
+/* Called with each path of a listing, without the newline; the callback may
+ * modify the string in place.
+ *
+ * @returns: FALSE to stop the listing
+ */
+typedef gboolean (*sorted_index_fn)(gpointer data, char *line);
+
+/* Open the sorted index FILENAME and read its tables.
+ *
+ * @param errmsg (output): error message if NULL is returned
+ * @returns: the index, or NULL on error
+ */
+sorted_index_t *sorted_index_open(const char *filename, char **errmsg);
+
+/* Call FN, in order, with the paths starting with PREFIX, which should end
+ * with a '/'.  With RECURSIVE, that is every such path; otherwise, it is
+ * every path directly in PREFIX, and only the first path under each of its
+ * subdirectories.
+ *
+ * @param errmsg (output): error message if -1 is returned
+ * @returns: the number of paths given to FN, or -1 on error
+ */
+int sorted_index_scan(sorted_index_t *idx, const char *prefix,
+		      gboolean recursive, sorted_index_fn fn, gpointer data,
+		      char **errmsg);
+
+void sorted_index_close(sorted_index_t *idx);
+
+#endif /* SORTEDINDEX_H */
@@ -27,6 +27,7 @@
 #include "xfer-server.h"
 #include "conffile.h"
 #include "holding.h"
+#include "holding-io.h"
 #include "mem-ring.h"
 
 /* A transfer destination that writes an entire dumpfile to one or more files
@@ -37,6 +38,10 @@
 #define HEADER_BLOCK_BYTES  DISK_BLOCK_BYTES
 #define HOLDING_BLOCK_BYTES DISK_BLOCK_BYTES
 
+/* while a streaming flush follows the holding file, the committed length is
+ * published at most once per this many bytes, and when the chunk is closed */
+#define PUBLISH_BYTES (1024*1024)
+
 /*
  * Xfer Dest Holding
  */
@@ -63,10 +68,9 @@ typedef struct XferDestHolding {
      * blocksize), and serves as the interface between the holding_thread and
      * the thread calling push_buffer.  Ring_length is the total length of the
      * buffer in bytes, while ring_count is the number of data bytes currently
-     * in the buffer.  The mem_ring->add_cond is signalled when data is added to the
-     * buffer, while mem_ring->free_cond is signalled when data is removed.  Both
-     * are governed by mem_ring->mutex, and both are signalled when the transfer is
-     * cancelled.
+     * in the buffer.  The ring is used in lock-free mode, through
+     * mem_ring_consumer_wait and mem_ring_consumer_pop; it is cancelled when
+     * the transfer is cancelled.
      */
 
     mem_ring_t *mem_ring;
@@ -77,8 +81,6 @@ typedef struct XferDestHolding {
      * parameters).  Note that the holding_thread holdes this mutex for the
      * entire duration of writing a chunk.
      *
-     * state_mutex should always be locked before mem_ring->mutex, if both are to be
-     * held simultaneously.
      */
     GMutex     *state_mutex;
     GCond      *state_cond;
@@ -92,6 +94,23 @@ typedef struct XferDestHolding {
     guint64     header_bytes_written;
     guint64     chunk_offset;         /* bytes written to the current */
 				      /* chunk, including header      */
+    gboolean    stream_flush;         /* a taper reads the holding file */
+				      /* while it is written            */
+    gboolean    committed_field;      /* the committed length is kept */
+				      /* in the chunk header           */
+    guint64     published;            /* chunk_offset last published */
+
+    /* Direct I/O
+     *
+     * For holding disks with an io-depth, the data is written through a
+     * holding_io_t, opened for each call.  Writes that fail after they were
+     * accepted are handed back when it is closed; that data is kept in
+     * unwritten, already counted in the CRC, and written first to the next
+     * chunk.
+     */
+    holding_io_t *hio;
+    guint64     hio_offset;           /* chunk_offset when hio was opened */
+    GByteArray *unwritten;
 
     enum { CHUNK_OK	 = 0,		/* */
 	   CHUNK_EOF	 = 1,		/* we read the complete input */
@@ -120,7 +139,8 @@ typedef struct {
 
 /* local functions */
 static int close_chunk(XferDestHolding *xdh, char *cont_filename, char **mesg);
-static ssize_t write_header(XferDestHolding *xdh, int fd);
+static ssize_t write_header(XferDestHolding *xdh, int fd, guint64 committed,
+			    gboolean *committed_field);
 static size_t full_write_with_fake_enospc(int fd, const void *buf, size_t count);
 
 /* we use a function pointer for full_write, so that we can "shim" in
@@ -153,7 +173,7 @@ _xdh_dbg(const char *fmt, ...)
  */
 
 /* Wait for at least one block, or EOF, to be available in the ring buffer.
- * Called with the ring mutex held. */
+ * Returns the number of contiguous bytes that can be written. */
 static gsize
 holding_thread_wait_for_block(
     XferDestHolding *self)
@@ -162,38 +182,23 @@ holding_thread_wait_for_block(
     gsize bytes_needed = HOLDING_BLOCK_BYTES;
     gsize usable;
 
-    while (1) {
-	/* are we ready? */
-	if (elt->cancelled)
-	    break;
+    usable = mem_ring_consumer_wait(self->mem_ring, bytes_needed,
+				    &elt->cancelled, NULL);
+    usable = MIN(usable, bytes_needed);
 
-	if (self->mem_ring->written - self->mem_ring->readx > bytes_needed)
-	    break;
-
-	if (self->mem_ring->eof_flag)
-	    break;
-
-	/* nope - so wait */
-	g_cond_wait(self->mem_ring->add_cond, self->mem_ring->mutex);
-    }
-
-    usable = MIN(self->mem_ring->written - self->mem_ring->readx, bytes_needed);
+    /* don't write past the end of the ring */
+    usable = MIN(usable, self->mem_ring->ring_size - self->mem_ring->read_offset);
 
     return usable;
 }
 
-/* Mark WRITTEN bytes as free in the ring buffer.  Called with the ring mutex
- * held. */
+/* Mark WRITTEN bytes as free in the ring buffer. */
 static void
 holding_thread_consume_block(
     XferDestHolding *self,
     gsize written)
 {
-    self->mem_ring->readx += written;
-    self->mem_ring->read_offset += written;
-    if (self->mem_ring->read_offset >= self->mem_ring->ring_size)
-	self->mem_ring->read_offset -= self->mem_ring->ring_size;
-    g_cond_broadcast(self->mem_ring->free_cond);
+    mem_ring_consumer_pop(self->mem_ring, written);
 }
 
 #ifdef FAILURE_CODE
@@ -206,6 +211,161 @@ static int shm_write_data = -1;
 static int close_chunk_close = -1;
 #endif
 
+/* Start writing data for this call, through the holding-io engine if the
+ * holding disk is set up for it.  Called with the state_mutex held */
+static void
+holding_thread_open_io(
+    XferDestHolding *self)
+{
+    char *tmp_filename;
+
+    /* the fake ENOSPC shim only knows about write() */
+    if (db_full_write != full_write)
+	return;
+
+    tmp_filename = g_strjoin(NULL, self->filename, ".tmp", NULL);
+    self->hio = holding_io_open_write(tmp_filename, self->chunk_offset,
+				      self->use_bytes);
+    self->hio_offset = self->chunk_offset;
+    g_free(tmp_filename);
+}
+
+/* Wait for the data to reach the disk.  If some of it didn't, take it back
+ * out of the chunk and keep it for the next one.  Called with the state_mutex
+ * held */
+static gboolean
+holding_thread_close_io(
+    XferDestHolding  *self,
+    char            **mesg)
+{
+    guint64 accepted, written, lost;
+    GByteArray *unwritten = NULL;
+
+    if (!self->hio)
+	return TRUE;
+
+    accepted = self->chunk_offset - self->hio_offset;
+    if (holding_io_close_write(self->hio, &written, &unwritten)) {
+	self->hio = NULL;
+	return TRUE;
+    }
+    self->hio = NULL;
+
+    if (!*mesg) {
+	*mesg = g_strdup_printf("Failed to write data to holding file '%s.tmp': %s",
+				self->filename, strerror(errno));
+    }
+    lost = accepted - written;
+    DBG(1, "%ju bytes did not reach holding file '%s.tmp'", (uintmax_t)lost,
+	self->filename);
+    self->chunk_offset -= lost;
+    self->data_bytes_written -= lost;
+    self->use_bytes += lost;
+
+    /* anything we did not get to write this time comes after that */
+    if (self->unwritten) {
+	g_byte_array_append(unwritten, self->unwritten->data, self->unwritten->len);
+	g_byte_array_free(self->unwritten, TRUE);
+    }
+    self->unwritten = unwritten;
+
+    /* keep the buffered fd in step, in case the next call can't use hio */
+    lseek(self->fd, self->chunk_offset, SEEK_SET);
+    return FALSE;
+}
+
+/* Tell a reader following the chunk how much of it is on disk; see
+ * holding_set_committed.  Unless FORCE, nothing is done until PUBLISH_BYTES
+ * more are.  Called with the state_mutex held */
+static void
+holding_thread_publish(
+    XferDestHolding *self,
+    gboolean         force)
+{
+    guint64 on_disk;
+
+    if (!self->committed_field)
+	return;
+
+    if (self->hio)
+	on_disk = self->hio_offset + holding_io_written(self->hio);
+    else
+	on_disk = self->chunk_offset;
+    if (on_disk == self->published ||
+	(!force && on_disk < self->published + PUBLISH_BYTES))
+	return;
+    self->published = on_disk;
+
+    if (!holding_set_committed(self->fd, on_disk - HEADER_BLOCK_BYTES)) {
+	/* a reader then waits for the chunk to be complete */
+	g_debug("Failed to update the header of holding file '%s.tmp': %s",
+		self->filename, strerror(errno));
+	self->committed_field = FALSE;
+    }
+}
+
+/* Write LEN bytes of data to the chunk file, adding them to the CRC.  Returns
+ * the number of bytes accepted; the data is only gone from BUF when this is
+ * LEN or hio is in use.  Called with the state_mutex held */
+static size_t
+holding_thread_write_data(
+    XferDestHolding *self,
+    char            *buf,
+    size_t           len)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    size_t count;
+
+    if (self->hio)
+	return holding_io_write(self->hio, buf, len, &elt->crc);
+
+    count = db_full_write(self->fd, buf, len);
+    if (count == len)
+	crc32_add((uint8_t *)buf, len, &elt->crc);
+    return count;
+}
+
+/* Write the data left over from a failed chunk.  Called with the state_mutex
+ * held */
+static gboolean
+holding_thread_write_unwritten(
+    XferDestHolding  *self,
+    char            **mesg)
+{
+    GByteArray *buf = self->unwritten;
+    size_t to_write = MIN(buf->len, self->use_bytes);
+    size_t count;
+
+    if (self->hio) {
+	count = holding_io_write(self->hio, buf->data, to_write, NULL);
+    } else {
+	count = db_full_write(self->fd, buf->data, to_write);
+	if (count != to_write && count > 0) {
+	    if (ftruncate(self->fd, self->chunk_offset) != 0)
+		g_debug("ftruncate failed: %s", strerror(errno));
+	    count = 0;
+	}
+    }
+
+    self->chunk_offset += count;
+    self->data_bytes_written += count;
+    self->use_bytes -= count;
+    g_byte_array_remove_range(buf, 0, count);
+    if (count > 0)
+	holding_thread_publish(self, FALSE);
+    if (buf->len == 0) {
+	g_byte_array_free(buf, TRUE);
+	self->unwritten = NULL;
+    }
+
+    if (count != to_write) {
+	amfree(*mesg);
+	*mesg = g_strdup_printf("Failed to write data to holding file '%s.tmp': %s", self->filename, strerror(errno));
+	return FALSE;
+    }
+    return TRUE;
+}
+
 /* Write an entire chunk.  Called with the state_mutex held */
 static gboolean
 holding_thread_write_chunk(
@@ -215,9 +375,14 @@ holding_thread_write_chunk(
     XferElement *elt = XFER_ELEMENT(self);
 
     self->chunk_status = CHUNK_OK;
+    holding_thread_open_io(self);
 
-    g_mutex_lock(self->mem_ring->mutex);
-    while (1) {
+    /* data that didn't make it into the last chunk goes first */
+    if (self->unwritten && !holding_thread_write_unwritten(self, mesg)) {
+	self->chunk_status = CHUNK_NO_ROOM;
+    }
+
+    while (self->chunk_status != CHUNK_NO_ROOM) {
 	gsize to_write;
 	size_t count;
 
@@ -227,7 +392,7 @@ holding_thread_write_chunk(
 	if (elt->cancelled)
 	    break;
 	if (to_write == 0) {
-	    self->chunk_status = CHUNK_EOF;
+	    self->chunk_status = self->unwritten? CHUNK_EOC : CHUNK_EOF;
 	    break;
 	}
 	if (self->chunk_status == CHUNK_EOC) {
@@ -239,7 +404,6 @@ holding_thread_write_chunk(
 
 	/* note that it's OK to reference these ring_* vars here, as they
 	 * are static at this point */
-	g_mutex_unlock(self->mem_ring->mutex);
 #ifdef FAILURE_CODE
 	{
 	    if (port_write_data == -1) {
@@ -256,33 +420,37 @@ holding_thread_write_chunk(
 	    port_write_data--;
 	}
 #endif
-	count = db_full_write(self->fd, self->mem_ring->buffer + self->mem_ring->read_offset,
-			      (guint)to_write);
+	count = holding_thread_write_data(self,
+			self->mem_ring->buffer + self->mem_ring->read_offset,
+			to_write);
 #ifdef FAILURE_CODE
 failure_port_write_data:
 #endif
-	g_mutex_lock(self->mem_ring->mutex);
-
 	if (count != to_write) {
 	    amfree(*mesg);
 	    *mesg = g_strdup_printf("Failed to write data to holding file '%s.tmp': %s", self->filename, strerror(errno));
-	    if (count > 0) {
+	    if (self->hio) {
+		/* hio has taken COUNT bytes; holding_thread_close_io sorts
+		 * out how many of them are on disk */
+		self->chunk_offset += count;
+		self->data_bytes_written += count;
+		self->use_bytes -= count;
+		holding_thread_consume_block(self, count);
+	    } else if (count > 0) {
 		if (ftruncate(self->fd, self->chunk_offset) != 0) {
 		    g_debug("ftruncate failed: %s", strerror(errno));
-		    g_mutex_unlock(self->mem_ring->mutex);
 		    return FALSE;
 		}
 	    }
 	    self->chunk_status = CHUNK_NO_ROOM;
 	    break;
 	}
-	crc32_add((uint8_t *)(self->mem_ring->buffer + self->mem_ring->read_offset),
-			 to_write, &elt->crc);
 	self->chunk_offset += count;
 
 	self->data_bytes_written += count;
 	self->use_bytes -= count;
 	holding_thread_consume_block(self, count);
+	holding_thread_publish(self, FALSE);
 
 	if (self->use_bytes <= 0) {
 	    self->chunk_status = CHUNK_EOC;
@@ -291,13 +459,16 @@ failure_port_write_data:
 	     */
 	}
     }
-    g_mutex_unlock(self->mem_ring->mutex);
 
     /* if we write all of the blocks, but the finish_file fails, then likely
      * there was some buffering going on in the holding driver, and the blocks
      * did not all make it to permanent storage -- so it's a failed part.  Note
      * that we try to finish_file even if the part failed, just to be thorough.
      */
+    if (!holding_thread_close_io(self, mesg))
+	self->chunk_status = CHUNK_NO_ROOM;
+    holding_thread_publish(self, TRUE);
+
     if (elt->cancelled) {
 	return FALSE;
     }
@@ -318,6 +489,7 @@ holding_thread(
     DBG(1, "(this is the holding thread)");
 
     self->mem_ring = xfer_element_get_mem_ring(elt->upstream);
+    mem_ring_set_lockfree(self->mem_ring);
     mem_ring_consumer_set_size(self->mem_ring, HOLDING_BLOCK_BYTES*32, HOLDING_BLOCK_BYTES);
 
     /* This is the outer loop, that loops once for each holding file or
@@ -404,7 +576,7 @@ failure_port_open_header:
 		port_write_header--;
 	    }
 #endif
-	    write_header_size = write_header(self, fd);
+	    write_header_size = write_header(self, fd, 0, &self->committed_field);
 #ifdef FAILURE_CODE
 failure_port_write_header:
 #endif
@@ -434,6 +606,7 @@ failure_port_write_header:
 	    self->fd = fd;
 	    self->header_bytes_written = HEADER_BLOCK_BYTES;
 	    self->chunk_offset = HEADER_BLOCK_BYTES;
+	    self->published = HEADER_BLOCK_BYTES;
 	}
 
 	DBG(2, "beginning to write chunk");
@@ -539,8 +712,15 @@ shm_holding_thread_write_chunk(
     XferElement *elt = XFER_ELEMENT(self);
 
     self->chunk_status = CHUNK_OK;
+    holding_thread_open_io(self);
 
-    while (!elt->cancelled &&
+    /* data that didn't make it into the last chunk goes first */
+    if (self->unwritten && !holding_thread_write_unwritten(self, mesg)) {
+	self->chunk_status = CHUNK_NO_ROOM;
+    }
+
+    while (self->chunk_status != CHUNK_NO_ROOM &&
+	   !elt->cancelled &&
 	   !elt->shm_ring->mc->cancelled) {
 	gsize to_write;
 	size_t count;
@@ -554,7 +734,7 @@ shm_holding_thread_write_chunk(
 
 	to_write = MIN(to_write, HOLDING_BLOCK_BYTES);
 	if (to_write == 0) {
-	    self->chunk_status = CHUNK_EOF;
+	    self->chunk_status = self->unwritten? CHUNK_EOC : CHUNK_EOF;
 	    break;
 	}
 	if (self->chunk_status == CHUNK_EOC) {
@@ -580,8 +760,9 @@ shm_holding_thread_write_chunk(
 	    shm_write_data--;
 	}
 #endif
-	count = db_full_write(self->fd, elt->shm_ring->data + elt->shm_ring->mc->read_offset,
-			      (guint)to_write);
+	count = holding_thread_write_data(self,
+			elt->shm_ring->data + elt->shm_ring->mc->read_offset,
+			to_write);
 #ifdef FAILURE_CODE
 failure_shm_write_data:
 #endif
@@ -589,7 +770,14 @@ failure_shm_write_data:
 	if (count != to_write) {
 	    amfree(*mesg);
 	    *mesg = g_strdup_printf("Failed to write data to holding file '%s.tmp': %s", self->filename, strerror(errno));
-	    if (count > 0) {
+	    if (self->hio) {
+		/* hio has taken COUNT bytes; holding_thread_close_io sorts
+		 * out how many of them are on disk */
+		self->chunk_offset += count;
+		self->data_bytes_written += count;
+		self->use_bytes -= count;
+		shm_holding_thread_consume_block(self, count);
+	    } else if (count > 0) {
 		if (ftruncate(self->fd, self->chunk_offset) != 0) {
 		    g_debug("ftruncate failed: %s", strerror(errno));
 		    return FALSE;
@@ -598,13 +786,12 @@ failure_shm_write_data:
 	    self->chunk_status = CHUNK_NO_ROOM;
 	    break;
 	}
-	crc32_add((uint8_t *)(elt->shm_ring->data + elt->shm_ring->mc->read_offset),
-			 to_write, &elt->crc);
 	self->chunk_offset += count;
 
 	self->data_bytes_written += count;
 	self->use_bytes -= count;
 	shm_holding_thread_consume_block(self, count);
+	holding_thread_publish(self, FALSE);
 
 	if (self->use_bytes <= 0) {
 	    self->chunk_status = CHUNK_EOC;
@@ -619,6 +806,10 @@ failure_shm_write_data:
      * did not all make it to permanent storage -- so it's a failed part.  Note
      * that we try to finish_file even if the part failed, just to be thorough.
      */
+    if (!holding_thread_close_io(self, mesg))
+	self->chunk_status = CHUNK_NO_ROOM;
+    holding_thread_publish(self, TRUE);
+
     if (elt->cancelled) {
 	elt->shm_ring->mc->cancelled = TRUE;
 	sem_post(elt->shm_ring->sem_write);
@@ -729,7 +920,7 @@ failure_shm_open_header:
 		shm_write_header--;
 	    }
 #endif
-	    write_header_size = write_header(self, fd);
+	    write_header_size = write_header(self, fd, 0, &self->committed_field);
 #ifdef FAILURE_CODE
 failure_shm_write_header:
 #endif
@@ -759,6 +950,7 @@ failure_shm_write_header:
 	    self->fd = fd;
 	    self->header_bytes_written = HEADER_BLOCK_BYTES;
 	    self->chunk_offset = HEADER_BLOCK_BYTES;
+	    self->published = HEADER_BLOCK_BYTES;
 	}
 
 	DBG(2, "beginning to write chunk");
@@ -855,10 +1047,7 @@ cancel_impl(
     /* then signal all of our condition variables, so that threads waiting on them
      * wake up and see elt->cancelled. */
     if (self->mem_ring) {
-	g_mutex_lock(self->mem_ring->mutex);
-	g_cond_broadcast(self->mem_ring->add_cond);
-	g_cond_broadcast(self->mem_ring->free_cond);
-	g_mutex_unlock(self->mem_ring->mutex);
+	mem_ring_cancel(self->mem_ring);
     }
     if (elt->shm_ring) {
 	elt->shm_ring->mc->cancelled = TRUE;
@@ -946,7 +1135,8 @@ close_chunk(
     } else {
 	self->chunk_header->cont_filename[0] = '\0';
     }
-    close_result = write_header(self, self->fd);
+    close_result = write_header(self, self->fd,
+				self->chunk_offset - HEADER_BLOCK_BYTES, NULL);
     if (close_result == -1) {
 	save_errno = errno;
 	*mesg = g_strdup_printf("Failed to rewrite header on holding file '%s': %s", self->filename, strerror(save_errno));
@@ -1020,6 +1210,8 @@ instance_init(
     self->new_filename = NULL;
     self->data_bytes_written = 0;
     self->header_bytes_written = 0;
+    self->hio = NULL;
+    self->unwritten = NULL;
     crc32_init(&elt->crc);
 }
 
@@ -1050,6 +1242,8 @@ finalize_impl(
     }
 
     self->mem_ring = NULL;
+    if (self->unwritten)
+	g_byte_array_free(self->unwritten, TRUE);
     amfree(self->filename);
     amfree(self->first_filename);
     amfree(self->new_filename);
@@ -1146,15 +1340,21 @@ xfer_dest_holding(
 }
 
 /*
- * Send an Amanda dump header to the output file and set file->blocksize
+ * Send an Amanda dump header to the output file and set file->blocksize,
+ * with COMMITTED as the committed length; COMMITTED_FIELD, if not NULL, is
+ * set to whether it must be kept up to date: a streaming flush reads the
+ * file and the header had room for it.
  */
 static ssize_t
 write_header(
     XferDestHolding *self,
-    int fd)
+    int fd,
+    guint64 committed,
+    gboolean *committed_field)
 {
     char *buffer;
     size_t written;
+    gboolean has_field;
 
     self->chunk_header->blocksize = HEADER_BLOCK_BYTES;
     if (debug_chunker > 1)
@@ -1162,6 +1362,9 @@ write_header(
     buffer = build_header((dumpfile_t *)self->chunk_header, NULL, HEADER_BLOCK_BYTES);
     if (!buffer) /* this shouldn't happen */
         error(_("header does not fit in %zd bytes"), (size_t)HEADER_BLOCK_BYTES);
+    has_field = holding_put_committed(buffer, committed);
+    if (committed_field)
+	*committed_field = has_field && self->stream_flush;
 
     written = db_full_write(fd, buffer, HEADER_BLOCK_BYTES);
     g_free(buffer);
@@ -1227,6 +1430,15 @@ xfer_dest_holding_start_chunk(
                                          use_bytes);
 }
 
+void
+xfer_dest_holding_set_streaming(
+    XferElement *elt)
+{
+    XferDestHolding *self = XFER_DEST_HOLDING(elt);
+
+    self->stream_flush = TRUE;
+}
+
 char *
 xfer_dest_holding_finish_chunk(
     XferElement *elt)
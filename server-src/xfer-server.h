@@ -43,6 +43,26 @@ void
 xfer_source_holding_start_recovery(
     XferElement *elt);
 
+/* Read a holding file while it is written: at the end of the data, wait
+ * for more or for the next chunk instead of returning EOF, until
+ * xfer_source_holding_stream_done is called.  Must be called before the
+ * xfer is started.
+ *
+ * @param elt: the XferSourceHolding
+ */
+void
+xfer_source_holding_set_streaming(
+    XferElement *elt);
+
+/* The holding file is complete, EOF is at its current end.  This can be
+ * called from any thread.
+ *
+ * @param elt: the XferSourceHolding
+ */
+void
+xfer_source_holding_stream_done(
+    XferElement *elt);
+
 guint64
 xfer_source_holding_get_bytes_read(
     XferElement *elt);
@@ -65,6 +85,16 @@ xfer_dest_holding_start_chunk(
     char *filename,
     guint64 use_bytes);
 
+/* A streaming flush reads the holding file while it is written: keep the
+ * committed length in the chunk headers up to date for it.  Must be called
+ * before the first chunk is started.
+ *
+ * @param elt: the XferDestHolding
+ */
+void
+xfer_dest_holding_set_streaming(
+    XferElement *elt);
+
 char *
 xfer_dest_holding_finish_chunk(
     XferElement *elt);
@@ -25,6 +25,8 @@
 #include "amutil.h"
 #include "xfer-server.h"
 #include "xfer-device.h"
+#include "holding.h"
+#include "holding-io.h"
 
 /*
  * Class declaration
@@ -55,7 +57,9 @@ typedef struct XferSourceHolding {
     GMutex *start_recovery_mutex;
 
     int fd;
+    holding_io_t *hio;		/* read-ahead on fd's file, or NULL */
     char *first_filename;
+    char *filename;		/* the file open on fd */
     char *next_filename;
     guint64 bytes_read;
     gint64 current_offset;
@@ -63,6 +67,13 @@ typedef struct XferSourceHolding {
     off_t fsize;
     gboolean paused;
 
+    /* the holding file is still being written; the last chunk ends when
+     * stream_done is set (atomically, by another thread).  Only the first
+     * committed bytes of the data of the current chunk may be read. */
+    gboolean streaming;
+    gint stream_done;
+    gint64 committed;
+
     GThread *holding_thread;
     GMutex     *state_mutex;
     GCond      *state_cond;
@@ -84,6 +95,9 @@ typedef struct {
 } XferSourceHoldingClass;
 
 static gboolean start_new_chunk(XferSourceHolding *self);
+static gsize read_data(XferSourceHolding *self, gpointer buf, gsize count);
+static int open_chunk(XferSourceHolding *self, const char *filename);
+static gboolean stream_wait(XferSourceHolding *self);
 
 /*
  * Implementation
@@ -91,6 +105,9 @@ static gboolean start_new_chunk(XferSourceHolding *self);
 
 #define HOLDING_BLOCK_BYTES DISK_BLOCK_BYTES
 
+/* how often to look for more data in a holding file being written */
+#define STREAM_POLL_USEC (100*1000)
+
 /*
  * Debug logging
  */
@@ -119,11 +136,7 @@ holding_thread(
     XMsg *msg;
     GTimer *timer = g_timer_new();
     uint64_t write_offset;
-    uint64_t readx;
-    uint64_t written;
     uint64_t producer_block_size;
-    uint64_t consumer_block_size;
-    uint64_t mem_ring_size;
     ssize_t  to_read_size;
     size_t   bytes_read;
 
@@ -136,29 +149,15 @@ holding_thread(
     g_cond_broadcast(self->state_cond);
     g_mutex_unlock(self->state_mutex);
     mem_ring_producer_set_size(self->mem_ring, HOLDING_BLOCK_BYTES*32, HOLDING_BLOCK_BYTES);
-    mem_ring_size = self->mem_ring->ring_size;
     producer_block_size = self->mem_ring->producer_block_size;
-    consumer_block_size = self->mem_ring->consumer_block_size;
 
     g_mutex_lock(self->state_mutex);
     while (1) {
-	g_mutex_lock(self->mem_ring->mutex);
-	write_offset = self->mem_ring->write_offset;
-	written = self->mem_ring->written;
-        readx = self->mem_ring->readx;
-
 	// wait for mem_ring space;
-	while (mem_ring_size - (written - readx) < producer_block_size) {
-	    if (elt->cancelled) {
-		g_mutex_unlock(self->mem_ring->mutex);
-		goto return_eof;
-	    }
-	    g_cond_wait(self->mem_ring->free_cond, self->mem_ring->mutex);
-	    write_offset = self->mem_ring->write_offset;
-	    written = self->mem_ring->written;
-            readx = self->mem_ring->readx;
-	}
-	g_mutex_unlock(self->mem_ring->mutex);
+	if (mem_ring_producer_wait(self->mem_ring, producer_block_size,
+				   &elt->cancelled) == 0)
+	    goto return_eof;
+	write_offset = self->mem_ring->write_offset;
 
 	if (self->fd == -1) {
 	   if (!start_new_chunk(self))
@@ -173,7 +172,7 @@ holding_thread(
 
 	//read to mem ring;
 	to_read_size = MIN(HOLDING_BLOCK_BYTES, self->mem_ring->ring_size - write_offset);
-	bytes_read = read_fully(self->fd, self->mem_ring->buffer + write_offset, to_read_size, NULL);
+	bytes_read = read_data(self, self->mem_ring->buffer + write_offset, to_read_size);
 	if (bytes_read > 0) {
 	    if (elt->size >= 0 && bytes_read > (guint64)elt->size) {
 		bytes_read = elt->size;
@@ -182,18 +181,8 @@ holding_thread(
 	    elt->offset += bytes_read;
 	    self->current_offset += bytes_read;
 	    self->bytes_read += bytes_read;
-	    crc32_add((uint8_t *)self->mem_ring->buffer + self->mem_ring->write_offset, bytes_read, &elt->crc);
-	    write_offset += bytes_read;
-	    write_offset %= mem_ring_size;
-	    g_mutex_lock(self->mem_ring->mutex);
-	    self->mem_ring->data_avail += bytes_read;
-	    self->mem_ring->written += bytes_read;
-	    self->mem_ring->write_offset = write_offset;
-	    if (self->mem_ring->data_avail >= consumer_block_size) {
-		g_cond_broadcast(self->mem_ring->add_cond);
-		self->mem_ring->data_avail -= consumer_block_size;
-	    }
-	    g_mutex_unlock(self->mem_ring->mutex);
+	    crc32_add((uint8_t *)self->mem_ring->buffer + write_offset, bytes_read, &elt->crc);
+	    mem_ring_producer_push(self->mem_ring, bytes_read);
 	} else {
 	    if (errno != 0) {
 		xfer_cancel_with_error(XFER_ELEMENT(self),
@@ -202,6 +191,9 @@ holding_thread(
 		goto return_eof;
 	    }
 
+	    if (self->streaming && stream_wait(self))
+		continue;
+
 	    if (!start_new_chunk(self))
 		goto return_eof;
 
@@ -212,10 +204,7 @@ return_eof:
     g_mutex_unlock(self->state_mutex);
 
     /* send an EOF indication downstream */
-    g_mutex_lock(self->mem_ring->mutex);
-    self->mem_ring->eof_flag = TRUE;
-    g_cond_broadcast(self->mem_ring->add_cond);
-    g_mutex_unlock(self->mem_ring->mutex);
+    mem_ring_producer_eof(self->mem_ring);
 
     g_debug("sending XMSG_CRC message");
     g_debug("xfer-source-holding CRC: %08x     size: %lld",
@@ -257,6 +246,8 @@ start_new_chunk(
 	if (self->fd != -1 &&
 	    (elt->offset < self->offset_file ||
 	     elt->offset >= self->offset_file + self->fsize)) {
+	    holding_io_close_read(self->hio);
+	    self->hio = NULL;
 	    if (close(self->fd) < 0) {
 		xfer_cancel_with_error(XFER_ELEMENT(self),
 			"while closing holding file: %s", strerror(errno));
@@ -282,7 +273,7 @@ start_new_chunk(
 	    }
 
 	    /* otherwise, open up the next file */
-	    self->fd = open(self->next_filename, O_RDONLY);
+	    self->fd = open_chunk(self, self->next_filename);
 	    if (self->fd < 0) {
 		xfer_cancel_with_error(XFER_ELEMENT(self),
 			"while opening holding file '%s': %s",
@@ -290,7 +281,8 @@ start_new_chunk(
 		wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
 		return FALSE;
 	    }
-
+	    g_free(self->filename);
+	    self->filename = g_strdup(self->next_filename);
 	}
 
 
@@ -310,8 +302,9 @@ start_new_chunk(
 		self->dest_taper = iter;
         }
 
-	/* tell a XferDestTaper about the new file */
-	if (self->dest_taper) {
+	/* tell a XferDestTaper about the new file; a chunk still written
+	 * can't be used as a cache */
+	if (self->dest_taper && !self->streaming) {
 	    struct stat st;
 	    if (fstat(self->fd, &st) < 0) {
 		xfer_cancel_with_error(XFER_ELEMENT(self),
@@ -369,12 +362,17 @@ start_new_chunk(
 
 	self->current_offset = self->offset_file += self->fsize;	/* fsize of previous chunk */
 	self->fsize = finfo.st_size - DISK_BLOCK_BYTES;
+	/* stream_wait finds out how much of a chunk still written is there */
+	self->committed = hdr.cont_filename[0]? self->fsize : 0;
 
 	g_free(self->next_filename);
 	if (hdr.cont_filename[0]) {
 	    self->next_filename = g_strdup(hdr.cont_filename);
 	} else {
 	    self->next_filename = NULL;
+	    /* the chunk being written, the offset is in it or will be */
+	    if (self->streaming)
+		seek_done = TRUE;
 	}
 	dumpfile_free_data(&hdr);
     };
@@ -388,9 +386,151 @@ start_new_chunk(
     }
     self->current_offset = elt->offset;
 
+    /* (re)start the read-ahead from here; it stops at the end of the file,
+     * so it can't be used on a file being written */
+    holding_io_close_read(self->hio);
+    self->hio = NULL;
+    if (!self->streaming)
+	self->hio = holding_io_open_read(self->filename,
+			elt->offset - self->offset_file + DISK_BLOCK_BYTES);
+
     return TRUE;
 }
 
+/* Open the chunk FILENAME; while the holding file is written, its chunks
+ * are named FILENAME.tmp until the dump is done.
+ */
+static int
+open_chunk(
+    XferSourceHolding *self,
+    const char *filename)
+{
+    char *tmp_filename;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0 && errno == ENOENT && self->streaming) {
+	tmp_filename = g_strconcat(filename, ".tmp", NULL);
+	fd = open(tmp_filename, O_RDONLY);
+	g_free(tmp_filename);
+	/* renamed in between */
+	if (fd < 0 && errno == ENOENT)
+	    fd = open(filename, O_RDONLY);
+    }
+
+    return fd;
+}
+
+/* Called at the end of the data of the current chunk while the holding
+ * file is written.  Wait until more data is committed, or until the chunk is
+ * complete: the writer sets cont_filename in its header when it starts the
+ * next chunk, the last chunk is complete when stream_done is set.  Until
+ * then, only the length the writer publishes in the header (see
+ * holding_set_committed) can be read; the size of the file may include
+ * padding, writes still in flight, or data that is truncated away again.
+ *
+ * Called with start_recovery_mutex held.
+ *
+ * @returns: TRUE if there is more data to read in this chunk, FALSE if the
+ *           caller must go to the next chunk (or EOF)
+ */
+static gboolean
+stream_wait(
+    XferSourceHolding *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    char *hdrbuf = g_malloc(DISK_BLOCK_BYTES);
+    gint64 consumed = self->current_offset - self->offset_file;
+    dumpfile_t hdr;
+    struct stat finfo;
+    gboolean done;
+    gboolean complete;
+    guint64 committed;
+    GTimeVal tv;
+
+    while (!elt->cancelled) {
+	/* read the flag first: all the data is there once it is set */
+	done = g_atomic_int_get(&self->stream_done);
+
+	complete = FALSE;
+	committed = 0;
+	if (pread(self->fd, hdrbuf, DISK_BLOCK_BYTES, 0) == DISK_BLOCK_BYTES) {
+	    parse_file_header(hdrbuf, &hdr, DISK_BLOCK_BYTES);
+	    if (hdr.cont_filename[0]) {
+		g_free(self->next_filename);
+		self->next_filename = g_strdup(hdr.cont_filename);
+		complete = TRUE;
+	    }
+	    dumpfile_free_data(&hdr);
+	    if (!holding_get_committed(hdrbuf, &committed))
+		committed = 0;
+	}
+
+	/* a complete chunk is closed, and its size is final */
+	if (complete || done) {
+	    if (fstat(self->fd, &finfo) == -1) {
+		xfer_cancel_with_error(elt,
+		    "Can't stat holding file '%s': %s",
+		    self->filename, strerror(errno));
+		wait_until_xfer_cancelled(elt->xfer);
+		break;
+	    }
+	    committed = finfo.st_size - DISK_BLOCK_BYTES;
+	}
+
+	if ((gint64)committed > consumed) {
+	    self->committed = committed;
+	    g_free(hdrbuf);
+	    return TRUE;
+	}
+
+	if (complete || done) {
+	    DBG(2, "end of chunk '%s' at %lld", self->filename,
+		(long long)committed);
+	    self->fsize = committed;
+	    self->committed = committed;
+	    if (!complete) {
+		/* the last chunk */
+		g_free(self->next_filename);
+		self->next_filename = NULL;
+		self->streaming = FALSE;
+	    }
+	    break;
+	}
+
+	g_get_current_time(&tv);
+	g_time_val_add(&tv, STREAM_POLL_USEC);
+	g_cond_timed_wait(self->start_recovery_cond, self->start_recovery_mutex,
+			  &tv);
+    }
+
+    g_free(hdrbuf);
+    return FALSE;
+}
+
+/* read from the current chunk, like read_fully */
+static gsize
+read_data(
+    XferSourceHolding *self,
+    gpointer buf,
+    gsize count)
+{
+    /* stop at the committed data of a chunk being written, like at EOF */
+    if (self->streaming) {
+	gint64 avail = self->committed -
+		       (self->current_offset - self->offset_file);
+	if (avail <= 0) {
+	    errno = 0;
+	    return 0;
+	}
+	count = MIN(count, (gsize)avail);
+    }
+
+    if (self->hio)
+	return holding_io_read(self->hio, buf, count);
+    return read_fully(self->fd, buf, count, NULL);
+}
+
 /* pick an arbitrary block size for reading */
 #define HOLDING_BLOCK_SIZE (1024*128)
 
@@ -455,7 +595,7 @@ pull_buffer_impl(
 	    goto return_eof;
 	}
 
-	bytes_read = read_fully(self->fd, buf, HOLDING_BLOCK_SIZE, NULL);
+	bytes_read = read_data(self, buf, HOLDING_BLOCK_SIZE);
 	if (bytes_read > 0) {
 	    if (elt->size >= 0 && bytes_read > (guint64)elt->size) {
 		bytes_read = elt->size;
@@ -478,6 +618,9 @@ pull_buffer_impl(
 	    goto return_eof;
 	}
 
+	if (self->streaming && stream_wait(self))
+	    continue;
+
 	if (!start_new_chunk(self))
 	    goto return_eof;
     }
@@ -544,7 +687,7 @@ pull_buffer_static_impl(
 	}
 
 	to_read_size = MIN(block_size, HOLDING_BLOCK_SIZE);
-	bytes_read = read_fully(self->fd, buf, to_read_size, NULL);
+	bytes_read = read_data(self, buf, to_read_size);
 	if (bytes_read > 0) {
 	    if (elt->size >= 0 && bytes_read > (guint64)elt->size) {
 		bytes_read = elt->size;
@@ -567,6 +710,9 @@ pull_buffer_static_impl(
 	    goto return_eof;
 	}
 
+	if (self->streaming && stream_wait(self))
+	    continue;
+
 	if (!start_new_chunk(self))
 	    goto return_eof;
     }
@@ -623,9 +769,8 @@ cancel_impl(
     if (self->mem_ring) {
 	g_mutex_lock(self->mem_ring->mutex);
 	self->mem_ring->eof_flag = TRUE;
-	g_cond_broadcast(self->mem_ring->add_cond);
-        g_cond_broadcast(self->mem_ring->free_cond);
-        g_mutex_unlock(self->mem_ring->mutex);
+	g_mutex_unlock(self->mem_ring->mutex);
+	mem_ring_cancel(self->mem_ring);
     }
 
     /* trigger the condition variable, in case the thread is waiting on it */
@@ -665,7 +810,11 @@ instance_init(
 
     elt->can_generate_eof = TRUE;
     self->fd = -1;
+    self->hio = NULL;
     self->paused = TRUE;
+    self->streaming = FALSE;
+    self->stream_done = 0;
+    self->committed = 0;
     self->current_offset = 0;
     self->offset_file = -1;
     self->fsize = -1;
@@ -688,10 +837,12 @@ finalize_impl(
 	g_free(self->first_filename);
     if (self->next_filename)
 	g_free(self->next_filename);
+    g_free(self->filename);
 
     g_cond_free(self->start_recovery_cond);
     g_mutex_unlock(self->start_recovery_mutex);
     g_mutex_free(self->start_recovery_mutex);
+    holding_io_close_read(self->hio);
     if (self->fd != -1)
 	close(self->fd); /* ignore error; we were probably already cancelled */
 
@@ -777,6 +928,24 @@ xfer_source_holding_start_recovery(
     klass->start_recovery(XFER_SOURCE_HOLDING(elt));
 }
 
+void
+xfer_source_holding_set_streaming(
+    XferElement *elt)
+{
+    XferSourceHolding *self = XFER_SOURCE_HOLDING(elt);
+
+    self->streaming = TRUE;
+}
+
+void
+xfer_source_holding_stream_done(
+    XferElement *elt)
+{
+    XferSourceHolding *self = XFER_SOURCE_HOLDING(elt);
+
+    g_atomic_int_set(&self->stream_done, 1);
+}
+
 guint64
 xfer_source_holding_get_bytes_read(
     XferElement *elt)
@@ -718,124 +718,60 @@ read_to_mem_ring(
     XferElement *elt = XFER_ELEMENT(self);
     int fd = get_read_fd(self);
     XMsg *msg;
-    uint64_t read_offset;
     uint64_t write_offset;
     uint64_t producer_block_size;
-    uint64_t consumer_block_size;
     uint64_t mem_ring_size;
 
     g_debug("read_to_mem_ring");
     mem_ring_producer_set_size(self->mem_ring, GLUE_BUFFER_SIZE*4, GLUE_BUFFER_SIZE);
     mem_ring_size = self->mem_ring->ring_size;
     producer_block_size = self->mem_ring->producer_block_size;
-    consumer_block_size = self->mem_ring->consumer_block_size;
     crc32_init(&elt->crc);
+    g_debug("read_to_mem_ring: %s", self->mem_ring->lockfree? "lock-free" : "locked");
 
     while (!elt->cancelled) {
 	gsize len;
-	gsize len2;
+	gsize to_read;
 	int read_error;
 
-	g_mutex_lock(self->mem_ring->mutex);
+	/* wait for space for a block */
+	if (mem_ring_producer_wait(self->mem_ring, producer_block_size,
+				   &elt->cancelled) == 0)
+	    goto return_eof;
+
+	/* read a buffer from upstream, up to the end of the ring */
 	write_offset = self->mem_ring->write_offset;
-        read_offset = self->mem_ring->read_offset;
-	while (!(write_offset == read_offset) &&
-	       !((write_offset < read_offset) &&
-		 (read_offset - write_offset > producer_block_size)) &&
-	       !((write_offset > read_offset) &&
-		 (mem_ring_size - write_offset + read_offset > producer_block_size))) {
-	    if (elt->cancelled) {
-		g_mutex_unlock(self->mem_ring->mutex);
-		goto return_eof;
-	    }
-	    g_cond_wait(self->mem_ring->free_cond, self->mem_ring->mutex);
-	    write_offset = self->mem_ring->write_offset;
-	    read_offset = self->mem_ring->read_offset;
+	to_read = MIN(producer_block_size, mem_ring_size - write_offset);
+	len = read_fully(fd, self->mem_ring->buffer+write_offset, to_read, &read_error);
+	if (len > 0) {
+	    crc32_add((uint8_t *)self->mem_ring->buffer+write_offset, len, &elt->crc);
+	    mem_ring_producer_push(self->mem_ring, len);
 	}
-	g_mutex_unlock(self->mem_ring->mutex);
-
-	/* read a buffer from upstream */
-	if (write_offset + self->mem_ring->producer_block_size <= mem_ring_size) {
-	    len = read_fully(fd, self->mem_ring->buffer+write_offset, producer_block_size, &read_error);
-	    if (len > 0) {
-		crc32_add((uint8_t *)self->mem_ring->buffer+write_offset, len, &elt->crc);
-		write_offset += len;
-		write_offset %= mem_ring_size;
-		g_mutex_lock(self->mem_ring->mutex);
-		self->mem_ring->data_avail += len;
-		self->mem_ring->written += len;
-		self->mem_ring->write_offset = write_offset;
-		if (self->mem_ring->data_avail >= consumer_block_size) {
-		    g_cond_broadcast(self->mem_ring->add_cond);
-		    self->mem_ring->data_avail -= consumer_block_size;
-		}
-		g_mutex_unlock(self->mem_ring->mutex);
-	    }
-	    if (len < producer_block_size) {
-		if (read_error) {
-		    if (!elt->cancelled) {
-			xfer_cancel_with_error(elt,
-			    _("Error reading from fd %d: %s"), fd, strerror(read_error));
-			g_debug("element-glue: error reading from fd %d: %s",
-                             fd, strerror(read_error));
-			wait_until_xfer_cancelled(elt->xfer);
-		    }
-		    break;
-		} else if (len == 0) { /* we only count a zero-length read as EOF */
-		    break;
-		}
-	    }
-	} else {
-	    len = read_fully(fd, self->mem_ring->buffer+write_offset, mem_ring_size - write_offset, &read_error);
-	    if (len > 0) {
-		crc32_add((uint8_t *)self->mem_ring->buffer+write_offset, len, &elt->crc);
-	    }
-	    len2 = 0;
-	    if (len == mem_ring_size - write_offset) {
-		len2 = read_fully(fd, self->mem_ring->buffer, producer_block_size - (mem_ring_size - write_offset), &read_error);
-		if (len2 > 0) {
-		    crc32_add((uint8_t *)self->mem_ring->buffer, len2, &elt->crc);
-		    len += len2;
-		}
-	    }
-	    if (len > 0) {
-		write_offset += len;
-		write_offset %= mem_ring_size;
-		g_mutex_lock(self->mem_ring->mutex);
-		self->mem_ring->write_offset = write_offset;
-		self->mem_ring->data_avail += len;
-		if (self->mem_ring->data_avail >= consumer_block_size) {
-		    g_cond_broadcast(self->mem_ring->add_cond);
-		    self->mem_ring->data_avail -= consumer_block_size;
-		}
-		g_mutex_unlock(self->mem_ring->mutex);
-	    }
-	    if (len < producer_block_size) {
-		if (read_error) {
-		    if (!elt->cancelled) {
-			xfer_cancel_with_error(elt,
-			    _("Error reading from fd %d: %s"), fd, strerror(read_error));
-			g_debug("element-glue: error reading from fd %d: %s",
-                             fd, strerror(read_error));
-			wait_until_xfer_cancelled(elt->xfer);
-		    }
-		    break;
-		} else if (len == 0 || len2 == 0) { /* we only count a zero-length read as EOF */
-		    break;
+	if (len < to_read) {
+	    if (read_error) {
+		if (!elt->cancelled) {
+		    xfer_cancel_with_error(elt,
+			_("Error reading from fd %d: %s"), fd, strerror(read_error));
+		    g_debug("element-glue: error reading from fd %d: %s",
+			     fd, strerror(read_error));
+		    wait_until_xfer_cancelled(elt->xfer);
 		}
+		break;
+	    } else if (len == 0) { /* we only count a zero-length read as EOF */
+		break;
 	    }
 	}
     }
 
 return_eof:
+    /* the consumer may have cancelled the ring before we saw the cancel */
+    if (!elt->cancelled && self->mem_ring->cancelled)
+	wait_until_xfer_cancelled(elt->xfer);
     if (elt->cancelled && elt->expect_eof)
 	xfer_element_drain_fd(fd);
 
     /* send an EOF indication downstream */
-    g_mutex_lock(self->mem_ring->mutex);
-    self->mem_ring->eof_flag = TRUE;
-    g_cond_broadcast(self->mem_ring->add_cond);
-    g_mutex_unlock(self->mem_ring->mutex);
+    mem_ring_producer_eof(self->mem_ring);
 
     /* close the read fd, since it's at EOF */
     close_read_fd(self);
@@ -1049,6 +985,109 @@ pull_static_to_shm_ring(
     return;
 }
 
+/* Pull buffers from upstream and copy them into the shm_ring.  The crc is
+ * computed while copying, so each buffer is read only once. */
+static void
+pull_to_shm_ring(
+    XferElementGlue *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    XMsg *msg;
+    uint64_t write_offset;
+    uint64_t written;
+    uint64_t readx;
+    uint64_t shm_ring_size;
+    size_t   block_size;
+    size_t   consumer_block_size;
+    char    *buf = NULL;
+    size_t   buf_size = 0;
+    size_t   buf_offset = 0;
+
+    g_debug("pull_to_shm_ring");
+
+    elt->shm_ring = shm_ring_link(xfer_element_get_shm_ring(elt->downstream)->shm_control_name);
+    shm_ring_producer_set_size(elt->shm_ring, GLUE_BUFFER_SIZE*4, GLUE_BUFFER_SIZE);
+    shm_ring_size = elt->shm_ring->mc->ring_size;
+    consumer_block_size = elt->shm_ring->mc->consumer_block_size;
+    crc32_init(&elt->crc);
+
+    while (!elt->cancelled && !elt->shm_ring->mc->cancelled) {
+	/* get the next buffer once the previous one is in the ring */
+	if (buf_offset == buf_size) {
+	    amfree(buf);
+	    buf = xfer_element_pull_buffer(elt->upstream, &buf_size);
+	    buf_offset = 0;
+	    if (!buf) {
+		elt->shm_ring->mc->eof_flag = TRUE;
+		break;
+	    }
+	    continue;
+	}
+
+	write_offset = elt->shm_ring->mc->write_offset;
+	written = elt->shm_ring->mc->written;
+
+	while (!elt->cancelled && !elt->shm_ring->mc->cancelled) {
+	    readx = elt->shm_ring->mc->readx;
+	    if (shm_ring_size - (written - readx) > elt->shm_ring->block_size)
+		break;
+	    if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_write) != 0)
+		break;
+	}
+
+	if (elt->cancelled || elt->shm_ring->mc->cancelled)
+	    break;
+
+	block_size = MIN(elt->shm_ring->block_size, shm_ring_size - write_offset);
+	block_size = MIN(block_size, buf_size - buf_offset);
+	crc32_add_copy((uint8_t *)elt->shm_ring->data + write_offset,
+		       (uint8_t *)buf + buf_offset, block_size, &elt->crc);
+	buf_offset += block_size;
+
+	write_offset += block_size;
+	write_offset %= shm_ring_size;
+	elt->shm_ring->mc->write_offset = write_offset;
+	elt->shm_ring->mc->written += block_size;
+	elt->shm_ring->data_avail += block_size;
+	if (elt->shm_ring->data_avail >= consumer_block_size) {
+	    sem_post(elt->shm_ring->sem_read);
+	    elt->shm_ring->data_avail -= consumer_block_size;
+	}
+    }
+    amfree(buf);
+
+    if (elt->cancelled) {
+	elt->shm_ring->mc->cancelled = TRUE;
+	g_debug("pull_to_shm_ring: cancel shm-ring because elt cancelled");
+	/* drain our upstream only if we're expecting an EOF */
+	if (elt->expect_eof && !elt->shm_ring->mc->eof_flag)
+	    xfer_element_drain_buffers(elt->upstream);
+    } else if (elt->shm_ring->mc->cancelled) {
+	xfer_cancel_with_error(elt, "shm_ring cancelled");
+    }
+    sem_post(elt->shm_ring->sem_read); // for the last block
+    sem_post(elt->shm_ring->sem_read); // for the eof_flag
+
+    // wait for the consumer to read everything
+    while (!elt->cancelled &&
+	   !elt->shm_ring->mc->cancelled &&
+	   (elt->shm_ring->mc->written != elt->shm_ring->mc->readx ||
+	    !elt->shm_ring->mc->eof_flag)) {
+	if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_write) != 0)
+	    break;
+    }
+
+    g_debug("sending XMSG_CRC message");
+    g_debug("pull_to_shm_ring CRC: %08x      size %lld",
+	    crc32_finish(&elt->crc), (long long)elt->crc.size);
+    msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
+    msg->crc = crc32_finish(&elt->crc);
+    msg->size = elt->crc.size;
+    xfer_queue_message(elt->xfer, msg);
+
+    return;
+}
+
 static void
 shm_ring_and_push_buffer_static(XferElementGlue *self)
 {
@@ -1324,6 +1363,10 @@ worker_thread(
 //	pull_static_to_mem_ring(self);
 //	break;
 
+    case mech_pair(XFER_MECH_PULL_BUFFER, XFER_MECH_SHM_RING):
+	pull_to_shm_ring(self);
+	break;
+
     case mech_pair(XFER_MECH_PULL_BUFFER_STATIC, XFER_MECH_SHM_RING):
 	pull_static_to_shm_ring(self);
 	break;
@@ -1639,6 +1682,11 @@ setup_impl(
 //	self->need_thread = TRUE;
 //	break;
 
+    case mech_pair(XFER_MECH_PULL_BUFFER, XFER_MECH_SHM_RING):
+	/* thread will pull from upstream and copy to a shm_ring */
+	self->need_thread = TRUE;
+	break;
+
     case mech_pair(XFER_MECH_PULL_BUFFER_STATIC, XFER_MECH_SHM_RING):
 	/* thread will pull_static from upstream and add to a mem_ring */
 	self->need_thread = TRUE;
@@ -2427,6 +2475,7 @@ static xfer_element_mech_pair_t _pairs[] = {
     { XFER_MECH_PULL_BUFFER, XFER_MECH_PUSH_BUFFER, XFER_NROPS(0), XFER_NTHREADS(1), XFER_NALLOC(0) }, /* call and call */
     { XFER_MECH_PULL_BUFFER, XFER_MECH_DIRECTTCP_LISTEN, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) }, /* call and write */
     { XFER_MECH_PULL_BUFFER, XFER_MECH_DIRECTTCP_CONNECT, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) }, /* call and write */
+    { XFER_MECH_PULL_BUFFER, XFER_MECH_SHM_RING, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) }, /* pull and copy to shm ring */
 
     { XFER_MECH_PULL_BUFFER_STATIC, XFER_MECH_READFD, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) }, /* call and write + pipe */
     { XFER_MECH_PULL_BUFFER_STATIC, XFER_MECH_WRITEFD, XFER_NROPS(1), XFER_NTHREADS(1), XFER_NALLOC(0) }, /* call and write */
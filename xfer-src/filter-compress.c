@@ -0,0 +1,352 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amxfer.h"
+#include "amcompress.h"
+
+/*
+ * Class declaration
+ *
+ * This declaration is entirely private; nothing but xfer_filter_compress() references
+ * it directly.
+ */
+
+GType xfer_filter_compress_get_type(void);
+#define XFER_FILTER_COMPRESS_TYPE (xfer_filter_compress_get_type())
+#define XFER_FILTER_COMPRESS(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_compress_get_type(), XferFilterCompress)
+#define XFER_FILTER_COMPRESS_CONST(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_compress_get_type(), XferFilterCompress const)
+#define XFER_FILTER_COMPRESS_CLASS(klass) G_TYPE_CHECK_CLASS_CAST((klass), xfer_filter_compress_get_type(), XferFilterCompressClass)
+#define IS_XFER_FILTER_COMPRESS(obj) G_TYPE_CHECK_INSTANCE_TYPE((obj), xfer_filter_compress_get_type ())
+#define XFER_FILTER_COMPRESS_GET_CLASS(obj) G_TYPE_INSTANCE_GET_CLASS((obj), xfer_filter_compress_get_type(), XferFilterCompressClass)
+
+static GObjectClass *parent_class = NULL;
+
+/*
+ * Main object structure
+ */
+
+typedef struct XferFilterCompress {
+    XferElement __parent__;
+
+    am_compress_algo_t algo;
+    int level;
+    int nthreads;
+
+    am_compress_t *comp;
+
+    /* compressed buffers waiting to be pulled, in PULL_BUFFER mode */
+    GQueue *pending;
+    gboolean eof;
+} XferFilterCompress;
+
+/*
+ * Class definition
+ */
+
+typedef struct {
+    XferElementClass __parent__;
+} XferFilterCompressClass;
+
+
+/*
+ * Utilities
+ */
+
+static gboolean
+push_output(
+    gpointer data,
+    gpointer buf,
+    gsize size)
+{
+    XferElement *elt = (XferElement *)data;
+
+    xfer_element_push_buffer(elt->downstream, buf, size);
+    return TRUE;
+}
+
+typedef struct pending_buf_s {
+    gpointer buf;
+    gsize size;
+} pending_buf_t;
+
+static gboolean
+queue_output(
+    gpointer data,
+    gpointer buf,
+    gsize size)
+{
+    XferFilterCompress *self = (XferFilterCompress *)data;
+    pending_buf_t *pb = g_new(pending_buf_t, 1);
+
+    pb->buf = buf;
+    pb->size = size;
+    g_queue_push_tail(self->pending, pb);
+    return TRUE;
+}
+
+static void
+log_stats(
+    XferFilterCompress *self)
+{
+    guint64 in = am_compress_bytes_in(self->comp);
+    guint64 out = am_compress_bytes_out(self->comp);
+
+    g_debug("%s: %s compressed %ju bytes to %ju bytes (%.1f%%)",
+	    xfer_element_repr(XFER_ELEMENT(self)),
+	    am_compress_algo_name(self->algo),
+	    (uintmax_t)in, (uintmax_t)out,
+	    in? (100.0 * out) / in : 100.0);
+}
+
+/*
+ * Implementation
+ */
+
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    XferFilterCompress *self = (XferFilterCompress *)elt;
+    am_compress_output_fn output;
+    char *errmsg = NULL;
+
+    if (elt->output_mech == XFER_MECH_PULL_BUFFER) {
+	self->pending = g_queue_new();
+	output = queue_output;
+    } else {
+	output = push_output;
+    }
+
+    /* block-parallel output gets a seek table */
+    self->comp = am_compress_new(self->algo, self->level, self->nthreads, 0,
+				 self->nthreads > 1 ? AM_COMPRESS_SEEK_TABLE : 0,
+				 output, self, &errmsg);
+    if (!self->comp) {
+	xfer_cancel_with_error(elt, "%s", errmsg);
+	g_free(errmsg);
+	return FALSE;
+    }
+
+    g_debug("%s: %s compression, level %d, %d thread%s",
+	    xfer_element_repr(elt), am_compress_algo_name(self->algo),
+	    self->level, self->nthreads, self->nthreads > 1? "s" : "");
+    return TRUE;
+}
+
+static gpointer
+pull_buffer_impl(
+    XferElement *elt,
+    size_t *size)
+{
+    XferFilterCompress *self = (XferFilterCompress *)elt;
+    pending_buf_t *pb;
+    gpointer buf;
+
+    while (!elt->cancelled && !self->eof &&
+	   g_queue_is_empty(self->pending)) {
+	size_t in_size;
+	gboolean ok;
+
+	buf = xfer_element_pull_buffer(elt->upstream, &in_size);
+	if (buf) {
+	    ok = am_compress_write(self->comp, buf, in_size);
+	    amfree(buf);
+	} else {
+	    self->eof = TRUE;
+	    ok = am_compress_finish(self->comp);
+	    if (ok)
+		log_stats(self);
+	}
+
+	if (!ok) {
+	    xfer_cancel_with_error(elt, "%s", am_compress_error(self->comp));
+	    wait_until_xfer_cancelled(elt->xfer);
+	}
+    }
+
+    if (elt->cancelled) {
+	/* drain our upstream only if we're expecting an EOF */
+	if (elt->expect_eof && !self->eof) {
+	    xfer_element_drain_buffers(elt->upstream);
+	    self->eof = TRUE;
+	}
+
+	/* return an EOF */
+	*size = 0;
+	return NULL;
+    }
+
+    pb = g_queue_pop_head(self->pending);
+    if (!pb) {
+	*size = 0;
+	return NULL;
+    }
+
+    buf = pb->buf;
+    *size = pb->size;
+    g_free(pb);
+    return buf;
+}
+
+static void
+push_buffer_impl(
+    XferElement *elt,
+    gpointer buf,
+    size_t len)
+{
+    XferFilterCompress *self = (XferFilterCompress *)elt;
+    gboolean ok;
+
+    /* drop the buffer if we've been cancelled */
+    if (elt->cancelled) {
+	amfree(buf);
+	return;
+    }
+
+    if (buf) {
+	ok = am_compress_write(self->comp, buf, len);
+	amfree(buf);
+    } else {
+	ok = am_compress_finish(self->comp);
+	if (ok)
+	    log_stats(self);
+    }
+
+    if (!ok) {
+	xfer_cancel_with_error(elt, "%s", am_compress_error(self->comp));
+	wait_until_xfer_cancelled(elt->xfer);
+	return;
+    }
+
+    /* pass the EOF downstream */
+    if (!buf)
+	xfer_element_push_buffer(elt->downstream, NULL, 0);
+}
+
+static void
+instance_init(
+    XferElement *elt)
+{
+    elt->can_generate_eof = TRUE;
+}
+
+static void
+finalize_impl(
+    GObject * obj_self)
+{
+    XferFilterCompress *self = XFER_FILTER_COMPRESS(obj_self);
+
+    am_compress_free(self->comp);
+    self->comp = NULL;
+
+    if (self->pending) {
+	pending_buf_t *pb;
+	while ((pb = g_queue_pop_head(self->pending)) != NULL) {
+	    g_free(pb->buf);
+	    g_free(pb);
+	}
+	g_queue_free(self->pending);
+	self->pending = NULL;
+    }
+
+    /* chain up */
+    G_OBJECT_CLASS(parent_class)->finalize(obj_self);
+}
+
+static void
+class_init(
+    XferFilterCompressClass * selfc)
+{
+    XferElementClass *klass = XFER_ELEMENT_CLASS(selfc);
+    GObjectClass *goc = G_OBJECT_CLASS(selfc);
+    static xfer_element_mech_pair_t mech_pairs[] = {
+	{ XFER_MECH_PULL_BUFFER, XFER_MECH_PULL_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_PUSH_BUFFER, XFER_MECH_PUSH_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
+    };
+
+    klass->setup = setup_impl;
+    klass->push_buffer = push_buffer_impl;
+    klass->pull_buffer = pull_buffer_impl;
+
+    klass->perl_class = "Amanda::Xfer::Filter::Compress";
+    klass->mech_pairs = mech_pairs;
+
+    goc->finalize = finalize_impl;
+
+    parent_class = g_type_class_peek_parent(selfc);
+}
+
+GType
+xfer_filter_compress_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (XferFilterCompressClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (XferFilterCompress),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) instance_init,
+            NULL
+        };
+
+        type = g_type_register_static (XFER_ELEMENT_TYPE, "XferFilterCompress", &info, 0);
+    }
+
+    return type;
+}
+
+/* prototype is in xfer-element.h */
+gboolean
+xfer_filter_compress_supported(
+    char *algorithm)
+{
+    return am_compress_supported(am_compress_algo_from_name(algorithm));
+}
+
+/* create an element of this class; prototype is in xfer-element.h */
+XferElement *
+xfer_filter_compress(
+    char *algorithm,
+    int level,
+    int nthreads)
+{
+    XferFilterCompress *xfc = (XferFilterCompress *)g_object_new(XFER_FILTER_COMPRESS_TYPE, NULL);
+    XferElement *elt = XFER_ELEMENT(xfc);
+
+    xfc->algo = am_compress_algo_from_name(algorithm);
+    if (xfc->algo == AM_COMPRESS_NONE)
+	error("xfer_filter_compress got an unknown algorithm '%s'",
+	      algorithm? algorithm : "(null)");
+    xfc->level = level;
+    xfc->nthreads = nthreads;
+
+    return elt;
+}
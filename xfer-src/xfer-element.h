@@ -562,6 +562,34 @@ XferElement *xfer_filter_xor(
  */
 XferElement *xfer_filter_crc(void);
 
+/* A transfer filter that compresses the data that passes through it, without
+ * forking a compression program.  The output is a gzip, zstd or lz4 stream
+ * that the corresponding command-line tool can decompress.  With more than
+ * one thread, the data is compressed in independent blocks, in parallel, and
+ * a seek table is appended (see amcompress.h).
+ *
+ * Implemented in filter-compress.c
+ *
+ * @param algorithm: "gzip", "zstd" or "lz4"
+ * @param level: compression level, or -1 for the default of the algorithm
+ * @param nthreads: number of compression threads
+ * @return: new element
+ */
+XferElement *xfer_filter_compress(
+    char *algorithm,
+    int level,
+    int nthreads);
+
+/* Return TRUE if xfer_filter_compress supports ALGORITHM in this build.
+ *
+ * Implemented in filter-compress.c
+ *
+ * @param algorithm: "gzip", "zstd" or "lz4"
+ * @return: TRUE if supported
+ */
+gboolean xfer_filter_compress_supported(
+    char *algorithm);
+
 /* A transfer destination that consumes all bytes it is given, optionally
  * validating that they match those produced by source_random
  *
@@ -1491,6 +1491,70 @@ test_xfer_simple(void)
     return 1;
 }
 
+/****
+ * Compress random data in-process and decompress it with UNCOMPRESS_PATH
+ */
+
+static int
+test_xfer_compress(int nthreads)
+{
+    unsigned int i;
+    GSource *src;
+    XferElement *elements[4];
+    gchar **argv;
+    Xfer *xfer;
+
+    if (!xfer_filter_compress_supported("gzip")
+	|| !g_str_equal(COMPRESS_SUFFIX, ".gz")) {
+	tu_dbg("in-process gzip compression is not available; skipping\n");
+	return 1;
+    }
+
+    argv = g_new0(gchar *, 3);
+    argv[0] = g_strdup(UNCOMPRESS_PATH);
+    argv[1] = g_strdup(UNCOMPRESS_OPT);
+
+    /* more than one block of the threaded compressor */
+    elements[0] = xfer_source_random(3*1024*1024 + 1234, RANDOM_SEED);
+    elements[1] = xfer_filter_compress("gzip", 1, nthreads);
+    elements[2] = xfer_filter_process(argv, FALSE, FALSE, FALSE, FALSE);
+    elements[3] = xfer_dest_null(RANDOM_SEED);
+
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    /* unreference the elements */
+    for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	g_object_unref(elements[i]);
+	g_assert(G_OBJECT(elements[i])->ref_count == 1);
+	elements[i] = NULL;
+    }
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    xfer_unref(xfer);
+
+    return 1;
+}
+
+static int
+test_xfer_compress_single(void)
+{
+    return test_xfer_compress(1);
+}
+
+static int
+test_xfer_compress_threaded(void)
+{
+    return test_xfer_compress(4);
+}
+
 /****
  * Run a transfer between two files, with or without filters
  */
@@ -1660,6 +1724,8 @@ main(int argc, char **argv)
 {
     static TestUtilsTest tests[] = {
 	TU_TEST(test_xfer_simple, 90),
+	TU_TEST(test_xfer_compress_single, 90),
+	TU_TEST(test_xfer_compress_threaded, 90),
 	TU_TEST(test_xfer_files_simple, 90),
 	TU_TEST(test_xfer_files_filter, 90),
         TU_TEST(test_glue_READFD_READFD, 90),